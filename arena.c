@@ -0,0 +1,78 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 8
+
+static ArenaChunk* chunk_create(size_t size) {
+    ArenaChunk* chunk = malloc(sizeof(ArenaChunk) + size);
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+void arena_init(Arena* arena) {
+    arena->first = NULL;
+    arena->current = NULL;
+}
+
+void arena_free(Arena* arena) {
+    ArenaChunk* chunk = arena->first;
+    while (chunk != NULL) {
+        ArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->first = NULL;
+    arena->current = NULL;
+}
+
+void arena_reset(Arena* arena) {
+    for (ArenaChunk* chunk = arena->first; chunk != NULL; chunk = chunk->next) {
+        chunk->used = 0;
+    }
+    arena->current = arena->first;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    // Reuse chunks kept from earlier resets before allocating new ones
+    ArenaChunk* chunk = arena->current;
+    while (chunk != NULL && chunk->used + size > chunk->size) {
+        chunk = chunk->next;
+    }
+
+    if (chunk == NULL) {
+        chunk = chunk_create(size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE);
+        if (arena->current == NULL) {
+            arena->first = chunk;
+        } else {
+            // Insert after the current chunk so the list stays in use order
+            chunk->next = arena->current->next;
+            arena->current->next = chunk;
+        }
+    }
+
+    arena->current = chunk;
+    void* ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+char* arena_strndup(Arena* arena, const char* str, size_t length) {
+    char* copy = arena_alloc(arena, length + 1);
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+size_t arena_capacity(const Arena* arena) {
+    size_t total = 0;
+    for (ArenaChunk* chunk = arena->first; chunk != NULL; chunk = chunk->next) {
+        total += chunk->size;
+    }
+    return total;
+}
@@ -0,0 +1,31 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// A chunk of arena memory
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaChunk;
+
+// Bump allocator. Individual allocations are never freed; the whole arena
+// is reset at once and keeps its chunks for the next use.
+typedef struct {
+    ArenaChunk* first;
+    ArenaChunk* current;
+} Arena;
+
+// Arena interface functions
+void arena_init(Arena* arena);
+void arena_free(Arena* arena);
+void arena_reset(Arena* arena);
+void* arena_alloc(Arena* arena, size_t size);
+char* arena_strndup(Arena* arena, const char* str, size_t length);
+
+// Total bytes reserved by the arena's chunks
+size_t arena_capacity(const Arena* arena);
+
+#endif // ARENA_H
@@ -6,6 +6,9 @@
 Expression* create_binary_expr(Expression* left, Expression* right, TokenType op, Token* token) {
     Expression* expr = malloc(sizeof(Expression));
     expr->type = NODE_BINARY_OP;
+    expr->op = op;
+    expr->expr_type = NULL;
+    expr->registers = 1;
     expr->token = token;
     expr->as.binary.left = left;
     expr->as.binary.right = right;
@@ -15,6 +18,9 @@ Expression* create_binary_expr(Expression* left, Expression* right, TokenType op
 Expression* create_unary_expr(Expression* operand, TokenType op, bool prefix, Token* token) {
     Expression* expr = malloc(sizeof(Expression));
     expr->type = NODE_UNARY_OP;
+    expr->op = op;
+    expr->expr_type = NULL;
+    expr->registers = 1;
     expr->token = token;
     expr->as.unary.operand = operand;
     expr->as.unary.prefix = prefix;
@@ -24,6 +30,9 @@ Expression* create_unary_expr(Expression* operand, TokenType op, bool prefix, To
 Expression* create_literal_expr(Token* token) {
     Expression* expr = malloc(sizeof(Expression));
     expr->type = NODE_LITERAL;
+    expr->op = token->type;
+    expr->expr_type = NULL;
+    expr->registers = 1;
     expr->token = token;
     return expr;
 }
@@ -31,13 +40,20 @@ Expression* create_literal_expr(Token* token) {
 Expression* create_identifier_expr(Token* token) {
     Expression* expr = malloc(sizeof(Expression));
     expr->type = NODE_IDENTIFIER;
+    expr->op = token->type;
+    expr->expr_type = NULL;
+    expr->registers = 1;
     expr->token = token;
+    expr->as.identifier.is_array = false;
     return expr;
 }
 
 Expression* create_call_expr(Expression* callee, Expression** args, int arg_count, Token* token) {
     Expression* expr = malloc(sizeof(Expression));
     expr->type = NODE_CALL;
+    expr->op = TOKEN_LPAREN;
+    expr->expr_type = NULL;
+    expr->registers = 1;
     expr->token = token;
     expr->as.call.callee = callee;
     expr->as.call.args = args;
@@ -45,6 +61,30 @@ Expression* create_call_expr(Expression* callee, Expression** args, int arg_coun
     return expr;
 }
 
+Expression* create_assign_expr(Expression* target, Expression* value, TokenType op, Token* token) {
+    Expression* expr = malloc(sizeof(Expression));
+    expr->type = NODE_ASSIGN;
+    expr->op = op;
+    expr->expr_type = NULL;
+    expr->registers = 1;
+    expr->token = token;
+    expr->as.binary.left = target;
+    expr->as.binary.right = value;
+    return expr;
+}
+
+Expression* create_cast_expr(Expression* operand, Type* target, Token* token) {
+    Expression* expr = malloc(sizeof(Expression));
+    expr->type = NODE_CAST;
+    expr->op = TOKEN_LPAREN;
+    expr->expr_type = NULL;
+    expr->registers = 1;
+    expr->token = token;
+    expr->as.cast.operand = operand;
+    expr->as.cast.target = target;
+    return expr;
+}
+
 // Statement node creation functions
 Statement* create_if_stmt(Expression* condition, Statement* then_branch, Statement* else_branch, Token* token) {
     Statement* stmt = malloc(sizeof(Statement));
@@ -90,6 +130,7 @@ Statement* create_compound_stmt(Statement** statements, int count, Token* token)
     stmt->token = token;
     stmt->as.compound.statements = statements;
     stmt->as.compound.count = count;
+    stmt->as.compound.scoped = true;
     return stmt;
 }
 
@@ -99,6 +140,7 @@ Type* create_basic_type(TypeKind kind, bool is_const, bool is_volatile) {
     type->kind = kind;
     type->is_const = is_const;
     type->is_volatile = is_volatile;
+    type->is_unsigned = false;
     return type;
 }
 
@@ -107,6 +149,7 @@ Type* create_pointer_type(Type* base, bool is_const, bool is_volatile) {
     type->kind = TYPE_POINTER;
     type->is_const = is_const;
     type->is_volatile = is_volatile;
+    type->is_unsigned = false;
     type->info.base = base;
     return type;
 }
@@ -116,6 +159,7 @@ Type* create_array_type(Type* elem_type, int size, bool is_const, bool is_volati
     type->kind = TYPE_ARRAY;
     type->is_const = is_const;
     type->is_volatile = is_volatile;
+    type->is_unsigned = false;
     type->info.array.elem_type = elem_type;
     type->info.array.size = size;
     return type;
@@ -126,18 +170,117 @@ Type* create_function_type(Type* return_type, Type** param_types, int param_coun
     type->kind = TYPE_FUNCTION;
     type->is_const = false;
     type->is_volatile = false;
+    type->is_unsigned = false;
     type->info.func.return_type = return_type;
     type->info.func.param_types = param_types;
     type->info.func.param_count = param_count;
+    type->info.func.is_variadic = false;
     return type;
 }
 
+Type* copy_type(const Type* type) {
+    if (type == NULL) return NULL;
+
+    Type* copy = malloc(sizeof(Type));
+    *copy = *type;
+    switch (type->kind) {
+        case TYPE_POINTER:
+            copy->info.base = copy_type(type->info.base);
+            break;
+        case TYPE_ARRAY:
+            copy->info.array.elem_type = copy_type(type->info.array.elem_type);
+            break;
+        case TYPE_FUNCTION:
+            copy->info.func.return_type = copy_type(type->info.func.return_type);
+            copy->info.func.param_types = malloc(sizeof(Type*) * (type->info.func.param_count + 1));
+            for (int i = 0; i < type->info.func.param_count; i++) {
+                copy->info.func.param_types[i] = copy_type(type->info.func.param_types[i]);
+            }
+            break;
+        default:
+            break;
+    }
+    return copy;
+}
+
+// Type queries
+int type_size(const Type* type) {
+    switch (type->kind) {
+        case TYPE_VOID: return 1;
+        case TYPE_BOOL: return 1;
+        case TYPE_CHAR: return 1;
+        case TYPE_SHORT: return 2;
+        case TYPE_INT: return 4;
+        case TYPE_LONG: return 8;
+        case TYPE_FLOAT: return 4;
+        case TYPE_DOUBLE: return 8;
+        case TYPE_POINTER: return 8;
+        case TYPE_ARRAY: return type->info.array.size * type_size(type->info.array.elem_type);
+        default: return 8;
+    }
+}
+
+bool is_integer_type(const Type* type) {
+    if (type == NULL) return false;
+    switch (type->kind) {
+        case TYPE_BOOL:
+        case TYPE_CHAR:
+        case TYPE_SHORT:
+        case TYPE_INT:
+        case TYPE_LONG:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool is_arithmetic_type(const Type* type) {
+    if (type == NULL) return false;
+    return is_integer_type(type) || type->kind == TYPE_FLOAT || type->kind == TYPE_DOUBLE;
+}
+
+bool is_pointer_type(const Type* type) {
+    return type != NULL && (type->kind == TYPE_POINTER || type->kind == TYPE_ARRAY);
+}
+
+bool is_scalar_type(const Type* type) {
+    return is_arithmetic_type(type) || is_pointer_type(type);
+}
+
+bool types_equal(const Type* left, const Type* right) {
+    if (left == NULL || right == NULL) return left == right;
+    if (left->kind != right->kind || left->is_unsigned != right->is_unsigned) return false;
+
+    switch (left->kind) {
+        case TYPE_POINTER:
+            return types_equal(left->info.base, right->info.base);
+        case TYPE_ARRAY:
+            return left->info.array.size == right->info.array.size &&
+                   types_equal(left->info.array.elem_type, right->info.array.elem_type);
+        case TYPE_FUNCTION:
+            if (left->info.func.param_count != right->info.func.param_count ||
+                left->info.func.is_variadic != right->info.func.is_variadic ||
+                !types_equal(left->info.func.return_type, right->info.func.return_type)) {
+                return false;
+            }
+            for (int i = 0; i < left->info.func.param_count; i++) {
+                if (!types_equal(left->info.func.param_types[i], right->info.func.param_types[i])) {
+                    return false;
+                }
+            }
+            return true;
+        default:
+            return true;
+    }
+}
+
 // Memory management functions
 void free_expression(Expression* expr) {
     if (expr == NULL) return;
     
     switch (expr->type) {
         case NODE_BINARY_OP:
+        case NODE_ASSIGN:
             free_expression(expr->as.binary.left);
             free_expression(expr->as.binary.right);
             break;
@@ -151,10 +294,15 @@ void free_expression(Expression* expr) {
             }
             free(expr->as.call.args);
             break;
+        case NODE_CAST:
+            free_expression(expr->as.cast.operand);
+            free_type(expr->as.cast.target);
+            break;
         default:
             break;
     }
     
+    free_type(expr->expr_type);
     free(expr);
 }
 
@@ -168,6 +316,7 @@ void free_statement(Statement* stmt) {
             free_statement(stmt->as.if_stmt.else_branch);
             break;
         case NODE_WHILE:
+        case NODE_DO_WHILE:
             free_expression(stmt->as.while_stmt.condition);
             free_statement(stmt->as.while_stmt.body);
             break;
@@ -186,6 +335,18 @@ void free_statement(Statement* stmt) {
             }
             free(stmt->as.compound.statements);
             break;
+        case NODE_EXPRESSION:
+            free_expression(stmt->as.expression.expr);
+            break;
+        case NODE_DECLARATION:
+            free_expression(stmt->as.declaration.initializer);
+            free_type(stmt->as.declaration.var_type);
+            break;
+        case NODE_FUNCTION:
+            free_type(stmt->as.function.type);
+            free(stmt->as.function.params);
+            free_statement(stmt->as.function.body);
+            break;
         default:
             break;
     }
@@ -231,5 +392,41 @@ Statement* create_var_stmt(Token* name, Expression* initializer, Token* token) {
     stmt->token = token;
     stmt->as.declaration.name = name;
     stmt->as.declaration.initializer = initializer;
+    stmt->as.declaration.var_type = NULL;
+    stmt->as.declaration.is_static = false;
+    stmt->as.declaration.is_extern = false;
+    stmt->as.declaration.is_unreachable = false;
+    return stmt;
+}
+
+Statement* create_do_while_stmt(Statement* body, Expression* condition, Token* token) {
+    Statement* stmt = malloc(sizeof(Statement));
+    stmt->type = NODE_DO_WHILE;
+    stmt->token = token;
+    stmt->as.while_stmt.condition = condition;
+    stmt->as.while_stmt.body = body;
+    return stmt;
+}
+
+Statement* create_jump_stmt(NodeType type, Token* token) {
+    Statement* stmt = malloc(sizeof(Statement));
+    stmt->type = type;
+    stmt->token = token;
+    return stmt;
+}
+
+Statement* create_function_stmt(Token* name, Type* type, Token** params, int param_count,
+                                Statement* body, Token* token) {
+    Statement* stmt = malloc(sizeof(Statement));
+    stmt->type = NODE_FUNCTION;
+    stmt->token = token;
+    stmt->as.function.name = name;
+    stmt->as.function.type = type;
+    stmt->as.function.params = params;
+    stmt->as.function.param_count = param_count;
+    stmt->as.function.body = body;
+    stmt->as.function.is_static = false;
+    stmt->as.function.is_inline = false;
+    stmt->as.function.is_unreachable = false;
     return stmt;
 }
\ No newline at end of file
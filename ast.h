@@ -19,7 +19,11 @@ typedef enum {
     NODE_DECLARATION,
     NODE_COMPOUND,
     NODE_CAST,
-    NODE_EXPRESSION
+    NODE_EXPRESSION,
+    NODE_ASSIGN,
+    NODE_FUNCTION,
+    NODE_BREAK,
+    NODE_CONTINUE
 } NodeType;
 
 // Type kinds
@@ -27,7 +31,9 @@ typedef enum {
     TYPE_VOID,
     TYPE_BOOL,
     TYPE_CHAR,
+    TYPE_SHORT,
     TYPE_INT,
+    TYPE_LONG,
     TYPE_FLOAT,
     TYPE_DOUBLE,
     TYPE_POINTER,
@@ -47,6 +53,7 @@ typedef struct {
     Type* return_type;
     Type** param_types;
     int param_count;
+    bool is_variadic;
 } FunctionType;
 
 // Type structure
@@ -54,6 +61,7 @@ struct Type {
     TypeKind kind;
     bool is_const;
     bool is_volatile;
+    bool is_unsigned;
     union {
         Type* base;          // For pointer types
         FunctionType func;   // For function types
@@ -64,10 +72,13 @@ struct Type {
     } info;
 };
 
-// Expression structure
+// Expression structure. expr_type is filled in by semantic analysis and
+// owned by the expression.
 struct Expression {
     NodeType type;
+    TokenType op;        // Operator for unary, binary and assignment nodes
     Type* expr_type;
+    int registers;       // Set by the checker: registers evaluating it takes
     Token* token;
     union {
         struct {
@@ -83,6 +94,13 @@ struct Expression {
             Expression** args;
             int arg_count;
         } call;
+        struct {
+            Expression* operand;  // Shares its position with unary.operand
+            Type* target;         // Owned; NULL for implicit conversions
+        } cast;
+        struct {
+            bool is_array;        // Set by the checker: the name decays to an address
+        } identifier;
     } as;
 };
 
@@ -112,6 +130,7 @@ struct Statement {
         struct {
             Statement** statements;
             int count;
+            bool scoped;         // false for a list of declarators
         } compound;
         struct {
             Expression* expr;
@@ -119,7 +138,21 @@ struct Statement {
         struct {
             Token* name;
             Expression* initializer;
+            Type* var_type;      // NULL for untyped 'var' declarations
+            bool is_static;
+            bool is_extern;
+            bool is_unreachable; // Static data nothing reachable uses (mark_reachable)
         } declaration;
+        struct {
+            Token* name;
+            Type* type;          // TYPE_FUNCTION
+            Token** params;      // Parameter names, NULL entries when unnamed
+            int param_count;
+            Statement* body;     // NULL for a prototype
+            bool is_static;
+            bool is_inline;
+            bool is_unreachable; // Static function nothing reachable uses (mark_reachable)
+        } function;
     } as;
 };
 
@@ -129,6 +162,8 @@ Expression* create_unary_expr(Expression* operand, TokenType op, bool prefix, To
 Expression* create_literal_expr(Token* token);
 Expression* create_identifier_expr(Token* token);
 Expression* create_call_expr(Expression* callee, Expression** args, int arg_count, Token* token);
+Expression* create_assign_expr(Expression* target, Expression* value, TokenType op, Token* token);
+Expression* create_cast_expr(Expression* operand, Type* target, Token* token);
 
 Statement* create_if_stmt(Expression* condition, Statement* then_branch, Statement* else_branch, Token* token);
 Statement* create_while_stmt(Expression* condition, Statement* body, Token* token);
@@ -137,12 +172,25 @@ Statement* create_return_stmt(Expression* value, Token* token);
 Statement* create_compound_stmt(Statement** statements, int count, Token* token);
 Statement* create_expression_stmt(Expression* expr, Token* token);
 Statement* create_var_stmt(Token* name, Expression* initializer, Token* token);
+Statement* create_do_while_stmt(Statement* body, Expression* condition, Token* token);
+Statement* create_jump_stmt(NodeType type, Token* token);
+Statement* create_function_stmt(Token* name, Type* type, Token** params, int param_count,
+                                Statement* body, Token* token);
 
 // Type creation functions
 Type* create_basic_type(TypeKind kind, bool is_const, bool is_volatile);
 Type* create_pointer_type(Type* base, bool is_const, bool is_volatile);
 Type* create_array_type(Type* elem_type, int size, bool is_const, bool is_volatile);
 Type* create_function_type(Type* return_type, Type** param_types, int param_count);
+Type* copy_type(const Type* type);
+
+// Type queries
+int type_size(const Type* type);
+bool is_integer_type(const Type* type);
+bool is_arithmetic_type(const Type* type);
+bool is_pointer_type(const Type* type);
+bool is_scalar_type(const Type* type);
+bool types_equal(const Type* left, const Type* right);
 
 // Memory management
 void free_expression(Expression* expr);
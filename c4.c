@@ -0,0 +1,305 @@
+#include "c4.h"
+#include "arena.h"
+#include "lexer.h"
+#include "parser.h"
+#include "semantic.h"
+#include "codegen.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Interned identifiers kept before the table is recycled
+#define INTERNER_LIMIT (1 << 20)
+
+// Growable byte buffer that keeps its storage between compilations
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} ByteBuffer;
+
+// Checked front-end state of one source file. A slot keeps its arena
+// when it is recycled, so tokens of the next file reuse warm memory.
+typedef struct {
+    char* filename;
+    ByteBuffer source;            // NUL-terminated copy, validates cache hits
+    Arena arena;                  // Tokens and lexemes
+    Statement* program;           // NULL while the slot is empty
+    SemanticAnalyzer* analyzer;
+    unsigned long last_used;
+} FrontendUnit;
+
+struct C4Context {
+    Interner interner;
+    FrontendUnit* units;
+    int unit_count;
+    bool cache_frontend;
+    unsigned long clock;
+    ByteBuffer assembly;
+    ByteBuffer object;
+    ByteBuffer diagnostics;
+    ByteBuffer report;
+};
+
+static void buffer_reserve(ByteBuffer* buffer, size_t size) {
+    if (size <= buffer->capacity) return;
+    size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+    while (capacity < size) capacity *= 2;
+    buffer->data = realloc(buffer->data, capacity);
+    buffer->capacity = capacity;
+}
+
+static void buffer_assign(ByteBuffer* buffer, const char* data, size_t length) {
+    buffer_reserve(buffer, length + 1);
+    memcpy(buffer->data, data, length);
+    buffer->data[length] = '\0';
+    buffer->length = length;
+}
+
+// Front-end unit management
+static void unit_clear(FrontendUnit* unit) {
+    if (unit->program != NULL) {
+        free_statement(unit->program);
+        semantic_free(unit->analyzer);
+    }
+    free(unit->filename);
+    unit->filename = NULL;
+    unit->program = NULL;
+    unit->analyzer = NULL;
+    arena_reset(&unit->arena);
+}
+
+static void units_free(C4Context* ctx) {
+    for (int i = 0; i < ctx->unit_count; i++) {
+        unit_clear(&ctx->units[i]);
+        arena_free(&ctx->units[i].arena);
+        free(ctx->units[i].source.data);
+    }
+    free(ctx->units);
+}
+
+static void units_create(C4Context* ctx, int count) {
+    ctx->units = calloc(count, sizeof(FrontendUnit));
+    ctx->unit_count = count;
+    for (int i = 0; i < count; i++) {
+        arena_init(&ctx->units[i].arena);
+    }
+}
+
+static FrontendUnit* unit_lookup(C4Context* ctx, const char* filename, const char* src, size_t len) {
+    if (!ctx->cache_frontend) return NULL;
+    for (int i = 0; i < ctx->unit_count; i++) {
+        FrontendUnit* unit = &ctx->units[i];
+        if (unit->program != NULL && strcmp(unit->filename, filename) == 0 &&
+            unit->source.length == len && memcmp(unit->source.data, src, len) == 0) {
+            return unit;
+        }
+    }
+    return NULL;
+}
+
+// Pick the slot for a new file: the file's previous slot, an empty one,
+// or the least recently used one
+static FrontendUnit* unit_acquire(C4Context* ctx, const char* filename) {
+    FrontendUnit* victim = &ctx->units[0];
+    for (int i = 0; i < ctx->unit_count; i++) {
+        FrontendUnit* unit = &ctx->units[i];
+        if (unit->filename != NULL && strcmp(unit->filename, filename) == 0) {
+            victim = unit;
+            break;
+        }
+        if (unit->program == NULL) {
+            victim = unit;
+        } else if (victim->program != NULL && unit->last_used < victim->last_used) {
+            victim = unit;
+        }
+    }
+    unit_clear(victim);
+    return victim;
+}
+
+// Lex, parse and check a file into a unit
+static bool unit_build(C4Context* ctx, FrontendUnit* unit, const char* filename,
+                       const char* src, size_t len, FILE* diagnostics) {
+    // Recycle the identifier table once nothing references it
+    if (ctx->interner.count > INTERNER_LIMIT) {
+        for (int i = 0; i < ctx->unit_count; i++) unit_clear(&ctx->units[i]);
+        interner_reset(&ctx->interner);
+    }
+
+    unit->filename = strdup(filename);
+    buffer_assign(&unit->source, src, len);
+
+    // Initialize compiler components
+    Lexer* lexer = lexer_init(unit->source.data, (char*)filename);
+    lexer->arena = &unit->arena;
+    lexer->interner = &ctx->interner;
+    Parser* parser = parser_init(lexer);
+    SemanticAnalyzer* analyzer = semantic_init();
+    analyzer->filename = strdup(filename);
+    analyzer->diagnostics = diagnostics;
+
+    // Parse program
+    Statement* program = parse_program(parser);
+    bool ok = !parser->had_error;
+    if (!ok) {
+        fprintf(diagnostics, "%s:%d:%d: %s\n",
+                parser->error->filename,
+                parser->error->line,
+                parser->error->column,
+                parser->error->message);
+    } else {
+        // Perform semantic analysis
+        check_program(analyzer, program);
+        ok = !analyzer->had_error;
+    }
+
+    parser_free(parser);
+    lexer_free(lexer);
+
+    if (!ok) {
+        free_statement(program);
+        semantic_free(analyzer);
+        unit_clear(unit);
+        return false;
+    }
+
+    unit->program = program;
+    unit->analyzer = analyzer;
+    return true;
+}
+
+// Context management
+C4Context* c4_context_new(void) {
+    C4Context* ctx = calloc(1, sizeof(C4Context));
+    interner_init(&ctx->interner);
+    units_create(ctx, 1);
+    return ctx;
+}
+
+void c4_context_free(C4Context* ctx) {
+    if (ctx == NULL) return;
+    units_free(ctx);
+    interner_free(&ctx->interner);
+    free(ctx->assembly.data);
+    free(ctx->object.data);
+    free(ctx->report.data);
+    free(ctx->diagnostics.data);
+    free(ctx);
+}
+
+void c4_context_set_frontend_cache(C4Context* ctx, int files) {
+    units_free(ctx);
+    ctx->cache_frontend = files > 0;
+    units_create(ctx, files > 0 ? files : 1);
+}
+
+void c4_options_init(C4Options* options) {
+    options->filename = "<input>";
+    options->optimize = true;
+    options->object = false;
+    options->unroll_factor = DEFAULT_UNROLL_FACTOR;
+    options->vector_width = DEFAULT_VECTOR_WIDTH;
+    options->inline_functions = true;
+    options->specialize_functions = true;
+    options->schedule_instructions = true;
+}
+
+// The build passes a hash of every library source, so that any change to
+// the compiler changes its identity
+#ifndef C4_BUILD_ID
+#define C4_BUILD_ID __DATE__ " " __TIME__
+#endif
+
+const char* c4_version(void) {
+    return C4_VERSION " (" C4_BUILD_ID ")";
+}
+
+void c4_options_fingerprint(const C4Options* options, char* buffer, size_t size) {
+    snprintf(buffer, size, "optimize=%d object=%d unroll=%d vector=%d inline=%d ipa-cp=%d sched=%d",
+             options->optimize ? 1 : 0, options->object ? 1 : 0, options->unroll_factor,
+             options->vector_width, options->inline_functions ? 1 : 0,
+             options->specialize_functions ? 1 : 0, options->schedule_instructions ? 1 : 0);
+}
+
+// Copy a memory stream's contents into a context buffer
+static void capture_stream(ByteBuffer* buffer, FILE* stream, char** data, size_t* size) {
+    fclose(stream);
+    buffer_assign(buffer, *data, *size);
+    free(*data);
+}
+
+bool c4_compile(C4Context* ctx, const char* src, size_t len,
+                const C4Options* options, C4Result* result) {
+    C4Options defaults;
+    if (options == NULL) {
+        c4_options_init(&defaults);
+        options = &defaults;
+    }
+
+    char* diag_data = NULL;
+    size_t diag_size = 0;
+    FILE* diagnostics = open_memstream(&diag_data, &diag_size);
+
+    // Reuse the checked AST when this exact file was compiled before
+    FrontendUnit* unit = unit_lookup(ctx, options->filename, src, len);
+    bool cached = unit != NULL;
+    bool ok = true;
+    if (!cached) {
+        unit = unit_acquire(ctx, options->filename);
+        ok = unit_build(ctx, unit, options->filename, src, len, diagnostics);
+    }
+
+    if (ok) {
+        unit->last_used = ++ctx->clock;
+
+        // Generate code. Symbol names borrow from the AST, so the listing
+        // is printed or encoded before the front end state is released.
+        CodeGenerator* gen = codegen_init(NULL, options->optimize);
+        gen->unroll_factor = options->unroll_factor;
+        gen->vector_width = options->vector_width;
+        gen->inline_functions = options->inline_functions;
+        gen->specialize_functions = options->specialize_functions;
+        gen->schedule_instructions = options->schedule_instructions;
+        generate_program(gen, unit->program);
+        size_t length;
+        if (options->object) {
+            char* object = codegen_take_object(gen, &length);
+            if (object == NULL) {
+                fprintf(diagnostics, "%s: Could not encode the generated code\n", options->filename);
+                ok = false;
+            } else {
+                buffer_assign(&ctx->object, object, length);
+            }
+            buffer_assign(&ctx->assembly, "", 0);
+            free(object);
+        } else {
+            char* text = codegen_take_output(gen, &length);
+            buffer_assign(&ctx->assembly, text, length);
+            buffer_assign(&ctx->object, "", 0);
+            free(text);
+        }
+        buffer_assign(&ctx->report, gen->report.data ? gen->report.data : "", gen->report.length);
+        codegen_free(gen);
+
+        if (!ctx->cache_frontend) unit_clear(unit);
+    }
+
+    capture_stream(&ctx->diagnostics, diagnostics, &diag_data, &diag_size);
+    if (!ok) {
+        buffer_assign(&ctx->assembly, "", 0);
+        buffer_assign(&ctx->object, "", 0);
+        buffer_assign(&ctx->report, "", 0);
+    }
+
+    result->assembly = ctx->assembly.data;
+    result->assembly_length = ctx->assembly.length;
+    result->object = ctx->object.data;
+    result->object_length = ctx->object.length;
+    result->diagnostics = ctx->diagnostics.data;
+    result->diagnostics_length = ctx->diagnostics.length;
+    result->report = ctx->report.data;
+    result->report_length = ctx->report.length;
+    result->frontend_cached = cached;
+    return ok;
+}
@@ -0,0 +1,63 @@
+#ifndef C4_H
+#define C4_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// In-memory compiler interface. A context holds every piece of state a
+// compilation needs, so separate contexts can be used from separate threads
+// and nothing is read from or written to disk.
+
+#define C4_VERSION "0.1.0"
+
+// Compilation options
+typedef struct {
+    const char* filename;   // Name used in diagnostics
+    bool optimize;
+    bool object;            // Encode an ELF object instead of printing assembly
+    int unroll_factor;      // Copies of a loop body unrolling may make; 1 turns it off
+    int vector_width;       // Int lanes of vectorized loops: 4 (SSE2), 8 (AVX2), 0 off
+    bool inline_functions;  // Replace calls to small functions by their bodies
+    bool specialize_functions;  // Propagate constant arguments across calls, with clones
+    bool schedule_instructions; // Reorder the selected instructions of each block
+} C4Options;
+
+// Compilation result. The buffers are owned by the context and stay valid
+// until the next c4_compile call on the same context.
+typedef struct {
+    const char* assembly;
+    size_t assembly_length;
+    const char* object;     // ELF64 relocatable object when options.object is set
+    size_t object_length;
+    const char* diagnostics;
+    size_t diagnostics_length;
+    const char* report;     // One line per function: values allocated, spilled and split,
+                            // then any peephole pattern hits on an indented line
+    size_t report_length;
+    bool frontend_cached;   // The checked AST of an earlier call was reused
+} C4Result;
+
+typedef struct C4Context C4Context;
+
+// Context management
+C4Context* c4_context_new(void);
+void c4_context_free(C4Context* ctx);
+
+// Keep the checked ASTs of up to `files` source files in the context.
+// Compiling a file whose name and contents match a kept one skips the
+// front end. Disabled (0) by default.
+void c4_context_set_frontend_cache(C4Context* ctx, int files);
+
+// Compilation
+void c4_options_init(C4Options* options);
+bool c4_compile(C4Context* ctx, const char* src, size_t len,
+                const C4Options* options, C4Result* result);
+
+// Version and build identification of the compiler itself
+const char* c4_version(void);
+
+// Canonical text for every option that affects the generated code. Two
+// option sets with the same fingerprint produce identical output.
+void c4_options_fingerprint(const C4Options* options, char* buffer, size_t size);
+
+#endif // C4_H
@@ -0,0 +1,408 @@
+#include "cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+// Fraction of the limit kept after an eviction pass, in percent
+#define CACHE_EVICT_TARGET 90
+
+// SHA-256
+static const unsigned int sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(unsigned int state[8], const unsigned char block[64]) {
+    unsigned int w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (unsigned int)block[i * 4] << 24 | (unsigned int)block[i * 4 + 1] << 16 |
+               (unsigned int)block[i * 4 + 2] << 8 | (unsigned int)block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        unsigned int s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        unsigned int s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    unsigned int a = state[0], b = state[1], c = state[2], d = state[3];
+    unsigned int e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+        unsigned int s1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);
+        unsigned int ch = (e & f) ^ (~e & g);
+        unsigned int t1 = h + s1 + ch + sha256_k[i] + w[i];
+        unsigned int s0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);
+        unsigned int maj = (a & b) ^ (a & c) ^ (b & c);
+        unsigned int t2 = s0 + maj;
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void cache_hasher_init(CacheHasher* hasher) {
+    static const unsigned int initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(hasher->state, initial, sizeof(initial));
+    hasher->length = 0;
+    hasher->used = 0;
+}
+
+void cache_hasher_update(CacheHasher* hasher, const void* data, size_t length) {
+    const unsigned char* bytes = data;
+    hasher->length += length;
+    while (length > 0) {
+        size_t chunk = 64 - hasher->used;
+        if (chunk > length) chunk = length;
+        memcpy(hasher->block + hasher->used, bytes, chunk);
+        hasher->used += chunk;
+        bytes += chunk;
+        length -= chunk;
+        if (hasher->used == 64) {
+            sha256_block(hasher->state, hasher->block);
+            hasher->used = 0;
+        }
+    }
+}
+
+// Strings are hashed with their terminator so adjacent fields cannot run
+// into each other
+void cache_hasher_add_string(CacheHasher* hasher, const char* str) {
+    cache_hasher_update(hasher, str, strlen(str) + 1);
+}
+
+void cache_hasher_finish(CacheHasher* hasher, char key[CACHE_KEY_LENGTH + 1]) {
+    unsigned long long bits = hasher->length * 8;
+    unsigned char pad = 0x80;
+    cache_hasher_update(hasher, &pad, 1);
+    pad = 0;
+    while (hasher->used != 56) cache_hasher_update(hasher, &pad, 1);
+
+    unsigned char length[8];
+    for (int i = 0; i < 8; i++) length[i] = (unsigned char)(bits >> (56 - i * 8));
+    cache_hasher_update(hasher, length, 8);
+
+    static const char hex[] = "0123456789abcdef";
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 4; j++) {
+            unsigned char byte = (unsigned char)(hasher->state[i] >> (24 - j * 8));
+            key[i * 8 + j * 2] = hex[byte >> 4];
+            key[i * 8 + j * 2 + 1] = hex[byte & 15];
+        }
+    }
+    key[CACHE_KEY_LENGTH] = '\0';
+}
+
+// Filesystem helpers
+static bool make_directories(const char* path) {
+    char* copy = strdup(path);
+    for (char* p = copy + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        if (mkdir(copy, 0755) != 0 && errno != EEXIST) {
+            free(copy);
+            return false;
+        }
+        *p = '/';
+    }
+    bool ok = mkdir(copy, 0755) == 0 || errno == EEXIST;
+    free(copy);
+    return ok;
+}
+
+static char* entry_path(CompileCache* cache, const char* key) {
+    char* path = malloc(strlen(cache->directory) + CACHE_KEY_LENGTH + 3);
+    sprintf(path, "%s/%.2s/%s", cache->directory, key, key + 2);
+    return path;
+}
+
+// Statistics live in <directory>/stats and are updated under flock(), which
+// also serializes eviction between threads and processes
+static int stats_lock(CompileCache* cache, CacheStats* stats) {
+    char* path = malloc(strlen(cache->directory) + 7);
+    sprintf(path, "%s/stats", cache->directory);
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    free(path);
+    if (fd < 0) return -1;
+    flock(fd, LOCK_EX);
+
+    memset(stats, 0, sizeof(*stats));
+    char text[256];
+    ssize_t length = pread(fd, text, sizeof(text) - 1, 0);
+    if (length > 0) {
+        text[length] = '\0';
+        sscanf(text, "%llu %llu %llu %llu %llu %llu", &stats->hits, &stats->misses,
+               &stats->size, &stats->entries, &stats->evictions, &stats->max_size);
+    }
+    return fd;
+}
+
+static void stats_unlock(int fd, const CacheStats* stats) {
+    char text[256];
+    int length = snprintf(text, sizeof(text), "%llu %llu %llu %llu %llu %llu\n",
+                          stats->hits, stats->misses, stats->size,
+                          stats->entries, stats->evictions, stats->max_size);
+    if (ftruncate(fd, 0) == 0 && pwrite(fd, text, length, 0) == length) {
+        // Written
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+// Eviction
+typedef struct {
+    char* path;
+    time_t mtime;
+    long mtime_nsec;
+    unsigned long long size;
+} CacheEntry;
+
+static int compare_entries(const void* a, const void* b) {
+    const CacheEntry* x = a;
+    const CacheEntry* y = b;
+    if (x->mtime != y->mtime) return x->mtime < y->mtime ? -1 : 1;
+    if (x->mtime_nsec != y->mtime_nsec) return x->mtime_nsec < y->mtime_nsec ? -1 : 1;
+    return 0;
+}
+
+// Eviction stops once the total is at most this share of the limit
+static unsigned long long eviction_target(const CompileCache* cache) {
+    return cache->max_size / 100 * CACHE_EVICT_TARGET;
+}
+
+// Rescan the cache, then delete the least recently used entries until the
+// total is below the eviction target. Called with the stats lock held.
+static void evict(CompileCache* cache, CacheStats* stats) {
+    CacheEntry* entries = NULL;
+    int count = 0;
+    int capacity = 0;
+    unsigned long long total = 0;
+
+    static const char hex[] = "0123456789abcdef";
+    char* dir_path = malloc(strlen(cache->directory) + 4);
+    for (int i = 0; i < 256; i++) {
+        sprintf(dir_path, "%s/%c%c", cache->directory, hex[i >> 4], hex[i & 15]);
+        DIR* dir = opendir(dir_path);
+        if (dir == NULL) continue;
+
+        struct dirent* ent;
+        while ((ent = readdir(dir)) != NULL) {
+            if (ent->d_name[0] == '.') continue;   // Temporaries and . / ..
+            char* path = malloc(strlen(dir_path) + strlen(ent->d_name) + 2);
+            sprintf(path, "%s/%s", dir_path, ent->d_name);
+
+            struct stat st;
+            if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+                free(path);
+                continue;
+            }
+            if (count >= capacity) {
+                capacity = capacity ? capacity * 2 : 256;
+                entries = realloc(entries, sizeof(CacheEntry) * capacity);
+            }
+            entries[count].path = path;
+            entries[count].mtime = st.st_mtim.tv_sec;
+            entries[count].mtime_nsec = st.st_mtim.tv_nsec;
+            entries[count].size = st.st_size;
+            total += st.st_size;
+            count++;
+        }
+        closedir(dir);
+    }
+    free(dir_path);
+
+    qsort(entries, count, sizeof(CacheEntry), compare_entries);
+
+    unsigned long long target = eviction_target(cache);
+    int remaining = count;
+    for (int i = 0; i < count; i++) {
+        if (total > target && unlink(entries[i].path) == 0) {
+            total -= entries[i].size;
+            remaining--;
+            stats->evictions++;
+        }
+        free(entries[i].path);
+    }
+    free(entries);
+
+    stats->size = total;
+    stats->entries = remaining;
+}
+
+// Cache interface implementation
+CompileCache* cache_open(const char* directory, unsigned long long max_size) {
+    char* path = NULL;
+    if (directory != NULL) {
+        path = strdup(directory);
+    } else if (getenv("C4_CACHE_DIR") && getenv("C4_CACHE_DIR")[0]) {
+        path = strdup(getenv("C4_CACHE_DIR"));
+    } else if (getenv("XDG_CACHE_HOME") && getenv("XDG_CACHE_HOME")[0]) {
+        path = malloc(strlen(getenv("XDG_CACHE_HOME")) + 4);
+        sprintf(path, "%s/c4", getenv("XDG_CACHE_HOME"));
+    } else if (getenv("HOME") && getenv("HOME")[0]) {
+        path = malloc(strlen(getenv("HOME")) + 11);
+        sprintf(path, "%s/.cache/c4", getenv("HOME"));
+    } else {
+        return NULL;
+    }
+
+    if (!make_directories(path)) {
+        free(path);
+        return NULL;
+    }
+
+    CompileCache* cache = malloc(sizeof(CompileCache));
+    cache->directory = path;
+
+    // A size given here becomes the cache's limit; otherwise the one it
+    // was last given applies
+    CacheStats stats;
+    int lock = stats_lock(cache, &stats);
+    if (max_size != 0) {
+        cache->max_size = max_size;
+        stats.max_size = max_size;
+    } else {
+        cache->max_size = stats.max_size ? stats.max_size : CACHE_DEFAULT_SIZE;
+    }
+    if (lock >= 0) stats_unlock(lock, &stats);
+    return cache;
+}
+
+void cache_close(CompileCache* cache) {
+    if (cache == NULL) return;
+    free(cache->directory);
+    free(cache);
+}
+
+char* cache_lookup(CompileCache* cache, const char* key, size_t* length) {
+    char* path = entry_path(cache, key);
+    char* data = NULL;
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0) {
+        data = malloc(st.st_size + 1);
+        if (read(fd, data, st.st_size) == st.st_size) {
+            data[st.st_size] = '\0';
+            *length = st.st_size;
+            // Refresh the entry's position in the LRU order
+            futimens(fd, NULL);
+        } else {
+            free(data);
+            data = NULL;
+        }
+    }
+    if (fd >= 0) close(fd);
+    free(path);
+
+    CacheStats stats;
+    int lock = stats_lock(cache, &stats);
+    if (lock >= 0) {
+        if (data != NULL) stats.hits++;
+        else stats.misses++;
+        stats_unlock(lock, &stats);
+    }
+    return data;
+}
+
+bool cache_store(CompileCache* cache, const char* key, const char* data, size_t length) {
+    // An entry eviction would remove right away is not worth writing
+    if (length > eviction_target(cache)) return false;
+
+    char* path = entry_path(cache, key);
+    char* tmp = malloc(strlen(path) + 16);
+    sprintf(tmp, "%s/%.2s/.tmp-XXXXXX", cache->directory, key);
+
+    // Make the shard directory on first use
+    char* slash = strrchr(tmp, '/');
+    *slash = '\0';
+    bool ok = make_directories(tmp);
+    *slash = '/';
+
+    int fd = ok ? mkstemp(tmp) : -1;
+    ok = fd >= 0;
+    if (ok) {
+        ok = write(fd, data, length) == (ssize_t)length;
+        ok = close(fd) == 0 && ok;
+    }
+
+    struct stat previous;
+    bool replaced = stat(path, &previous) == 0;
+    if (ok) ok = rename(tmp, path) == 0;
+    if (!ok && fd >= 0) unlink(tmp);
+
+    if (ok) {
+        CacheStats stats;
+        int lock = stats_lock(cache, &stats);
+        if (lock >= 0) {
+            if (replaced) {
+                stats.size -= previous.st_size < (off_t)stats.size ? previous.st_size : stats.size;
+            } else {
+                stats.entries++;
+            }
+            stats.size += length;
+            if (stats.size > cache->max_size) evict(cache, &stats);
+            stats_unlock(lock, &stats);
+        }
+    }
+
+    free(tmp);
+    free(path);
+    return ok;
+}
+
+bool cache_read_stats(CompileCache* cache, CacheStats* stats) {
+    int lock = stats_lock(cache, stats);
+    if (lock < 0) return false;
+    flock(lock, LOCK_UN);
+    close(lock);
+    return true;
+}
+
+void cache_print_stats(CompileCache* cache, FILE* output) {
+    CacheStats stats;
+    if (!cache_read_stats(cache, &stats)) {
+        fprintf(output, "cache directory %s is not accessible\n", cache->directory);
+        return;
+    }
+
+    unsigned long long lookups = stats.hits + stats.misses;
+    fprintf(output, "cache directory   %s\n", cache->directory);
+    fprintf(output, "hits              %llu\n", stats.hits);
+    fprintf(output, "misses            %llu\n", stats.misses);
+    fprintf(output, "hit rate          %.1f%%\n",
+            lookups ? 100.0 * stats.hits / lookups : 0.0);
+    fprintf(output, "entries           %llu\n", stats.entries);
+    fprintf(output, "size              %llu bytes\n", stats.size);
+    fprintf(output, "max size          %llu bytes\n", cache->max_size);
+    fprintf(output, "evictions         %llu\n", stats.evictions);
+}
+
+unsigned long long cache_parse_size(const char* text) {
+    char* end;
+    unsigned long long size = strtoull(text, &end, 10);
+    switch (*end) {
+        case 'k': case 'K': size <<= 10; end++; break;
+        case 'm': case 'M': size <<= 20; end++; break;
+        case 'g': case 'G': size <<= 30; end++; break;
+        default: break;
+    }
+    return *end == '\0' ? size : 0;
+}
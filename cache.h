@@ -0,0 +1,63 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Content-addressed compilation cache. Entries are keyed by a SHA-256 of
+// the compiler version, every option that affects the output, and the
+// source bytes, and live in <directory>/<2 hex digits>/<62 hex digits>.
+// Writes go through a temporary file and rename(), so readers never see a
+// partial entry. When the cache grows past its size limit the least
+// recently used entries (by modification time, refreshed on every hit) are
+// evicted.
+
+#define CACHE_KEY_LENGTH 64
+#define CACHE_DEFAULT_SIZE (256ULL * 1024 * 1024)
+
+typedef struct {
+    char* directory;
+    unsigned long long max_size;
+} CompileCache;
+
+typedef struct {
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long size;       // Bytes stored in entries
+    unsigned long long entries;
+    unsigned long long evictions;
+    unsigned long long max_size;   // Limit the cache was last opened with, 0 if never set
+} CacheStats;
+
+// Incremental key computation
+typedef struct {
+    unsigned int state[8];
+    unsigned long long length;
+    unsigned char block[64];
+    size_t used;
+} CacheHasher;
+
+void cache_hasher_init(CacheHasher* hasher);
+void cache_hasher_update(CacheHasher* hasher, const void* data, size_t length);
+void cache_hasher_add_string(CacheHasher* hasher, const char* str);
+void cache_hasher_finish(CacheHasher* hasher, char key[CACHE_KEY_LENGTH + 1]);
+
+// Cache interface functions. A NULL directory selects $C4_CACHE_DIR,
+// $XDG_CACHE_HOME/c4 or ~/.cache/c4. A nonzero size is saved as the
+// cache's limit; zero keeps the saved one, or the default if none is.
+CompileCache* cache_open(const char* directory, unsigned long long max_size);
+void cache_close(CompileCache* cache);
+
+// Look up an entry. On a hit the returned buffer is malloc'ed.
+char* cache_lookup(CompileCache* cache, const char* key, size_t* length);
+// Entries too large to survive the next eviction are not stored
+bool cache_store(CompileCache* cache, const char* key, const char* data, size_t length);
+
+bool cache_read_stats(CompileCache* cache, CacheStats* stats);
+void cache_print_stats(CompileCache* cache, FILE* output);
+
+// Parse sizes such as "500M" or "2G"; returns 0 on malformed input
+unsigned long long cache_parse_size(const char* text);
+
+#endif // CACHE_H
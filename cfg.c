@@ -0,0 +1,426 @@
+#include "codegen.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Control-flow graph construction and analysis
+
+typedef struct {
+    CodeGenerator* gen;
+    BasicBlock* current;     // Block receiving the statements being lowered
+    BasicBlock* break_target;
+    BasicBlock* continue_target;
+} CfgBuilder;
+
+// Blocks are created detached and numbered when placed, so that the
+// block list follows the source
+BasicBlock* cfg_new_block(void) {
+    BasicBlock* block = calloc(1, sizeof(BasicBlock));
+    block->id = -1;
+    block->exit = EXIT_RETURN;
+    block->rpo = -1;
+    return block;
+}
+
+void cfg_insert_block(CodeGenerator* gen, int position, BasicBlock* block) {
+    if (gen->block_count == gen->block_capacity) {
+        gen->block_capacity = gen->block_capacity ? gen->block_capacity * 2 : 16;
+        gen->blocks = realloc(gen->blocks, sizeof(BasicBlock*) * gen->block_capacity);
+    }
+    memmove(gen->blocks + position + 1, gen->blocks + position,
+            sizeof(BasicBlock*) * (gen->block_count - position));
+    gen->blocks[position] = block;
+    gen->block_count++;
+    for (int i = position; i < gen->block_count; i++) gen->blocks[i]->id = i;
+}
+
+static void place_block(CfgBuilder* builder, BasicBlock* block) {
+    cfg_insert_block(builder->gen, builder->gen->block_count, block);
+    builder->current = block;
+}
+
+void cfg_add_edge(BasicBlock* from, BasicBlock* to) {
+    from->successors[from->successor_count++] = to;
+    if (to->predecessor_count == to->predecessor_capacity) {
+        to->predecessor_capacity = to->predecessor_capacity ? to->predecessor_capacity * 2 : 4;
+        to->predecessors = realloc(to->predecessors, sizeof(BasicBlock*) * to->predecessor_capacity);
+    }
+    to->predecessors[to->predecessor_count++] = from;
+}
+
+static void jump(CfgBuilder* builder, BasicBlock* target) {
+    builder->current->exit = EXIT_JUMP;
+    cfg_add_edge(builder->current, target);
+}
+
+static bool is_constant(Expression* expr) {
+    return expr->type == NODE_LITERAL && expr->token->type == TOKEN_INTEGER_LITERAL;
+}
+
+static void branch(CfgBuilder* builder, Expression* condition, BasicBlock* if_true, BasicBlock* if_false) {
+    if (is_constant(condition)) {
+        jump(builder, condition->token->value.int_value != 0 ? if_true : if_false);
+        return;
+    }
+    builder->current->exit = EXIT_BRANCH;
+    builder->current->condition = condition;
+    cfg_add_edge(builder->current, if_true);
+    cfg_add_edge(builder->current, if_false);
+}
+
+// After a jump out, statements up to the next join land in a block no
+// edge reaches
+static void leave_block(CfgBuilder* builder) {
+    place_block(builder, cfg_new_block());
+}
+
+static void add_statement(BasicBlock* block, Statement* stmt) {
+    if (block->statement_count == block->statement_capacity) {
+        block->statement_capacity = block->statement_capacity ? block->statement_capacity * 2 : 8;
+        block->statements = realloc(block->statements, sizeof(Statement*) * block->statement_capacity);
+    }
+    block->statements[block->statement_count++] = stmt;
+}
+
+static void build_statement(CfgBuilder* builder, Statement* stmt);
+
+static void build_loop_body(CfgBuilder* builder, Statement* body, BasicBlock* break_target,
+                            BasicBlock* continue_target) {
+    BasicBlock* outer_break = builder->break_target;
+    BasicBlock* outer_continue = builder->continue_target;
+    builder->break_target = break_target;
+    builder->continue_target = continue_target;
+    build_statement(builder, body);
+    builder->break_target = outer_break;
+    builder->continue_target = outer_continue;
+}
+
+static void build_statement(CfgBuilder* builder, Statement* stmt) {
+    if (stmt == NULL) return;
+    add_statement(builder->current, stmt);
+
+    switch (stmt->type) {
+        case NODE_COMPOUND:
+            for (int i = 0; i < stmt->as.compound.count; i++) {
+                build_statement(builder, stmt->as.compound.statements[i]);
+            }
+            break;
+        case NODE_RETURN:
+            builder->current->exit = EXIT_RETURN;
+            builder->current->return_stmt = stmt;
+            builder->current->is_exit = true;
+            leave_block(builder);
+            break;
+        case NODE_BREAK:
+        case NODE_CONTINUE: {
+            BasicBlock* target = stmt->type == NODE_BREAK ? builder->break_target : builder->continue_target;
+            if (target == NULL) break;
+            jump(builder, target);
+            leave_block(builder);
+            break;
+        }
+        case NODE_IF: {
+            BasicBlock* then_block = cfg_new_block();
+            BasicBlock* else_block = stmt->as.if_stmt.else_branch != NULL ? cfg_new_block() : NULL;
+            BasicBlock* join = cfg_new_block();
+            branch(builder, stmt->as.if_stmt.condition, then_block, else_block != NULL ? else_block : join);
+            place_block(builder, then_block);
+            build_statement(builder, stmt->as.if_stmt.then_branch);
+            jump(builder, join);
+            if (else_block != NULL) {
+                place_block(builder, else_block);
+                build_statement(builder, stmt->as.if_stmt.else_branch);
+                jump(builder, join);
+            }
+            place_block(builder, join);
+            break;
+        }
+        // Loops are rotated: the condition is tested once ahead of the
+        // loop and then at its bottom, so an iteration takes a single
+        // branch back to the top of the body
+        case NODE_WHILE: {
+            BasicBlock* body = cfg_new_block();
+            BasicBlock* test = cfg_new_block();
+            BasicBlock* exit = cfg_new_block();
+            branch(builder, stmt->as.while_stmt.condition, body, exit);
+            place_block(builder, body);
+            build_loop_body(builder, stmt->as.while_stmt.body, exit, test);
+            jump(builder, test);
+            place_block(builder, test);
+            branch(builder, stmt->as.while_stmt.condition, body, exit);
+            place_block(builder, exit);
+            break;
+        }
+        case NODE_DO_WHILE: {
+            BasicBlock* body = cfg_new_block();
+            BasicBlock* test = cfg_new_block();
+            BasicBlock* exit = cfg_new_block();
+            jump(builder, body);
+            place_block(builder, body);
+            build_loop_body(builder, stmt->as.while_stmt.body, exit, test);
+            jump(builder, test);
+            place_block(builder, test);
+            branch(builder, stmt->as.while_stmt.condition, body, exit);
+            place_block(builder, exit);
+            break;
+        }
+        case NODE_FOR: {
+            // The increment and the bottom test share the latch
+            build_statement(builder, stmt->as.for_stmt.initializer);
+            Expression* condition = stmt->as.for_stmt.condition;
+            BasicBlock* body = cfg_new_block();
+            BasicBlock* latch = cfg_new_block();
+            BasicBlock* exit = cfg_new_block();
+            if (condition != NULL) {
+                branch(builder, condition, body, exit);
+            } else {
+                jump(builder, body);
+            }
+            place_block(builder, body);
+            build_loop_body(builder, stmt->as.for_stmt.body, exit, latch);
+            jump(builder, latch);
+            place_block(builder, latch);
+            build_statement(builder, stmt->as.for_stmt.increment);
+            if (condition != NULL) {
+                branch(builder, condition, body, exit);
+            } else {
+                jump(builder, body);
+            }
+            place_block(builder, exit);
+            break;
+        }
+        default:
+            // Declarations and expressions run straight through
+            break;
+    }
+}
+
+void cfg_free_block(BasicBlock* block) {
+    free(block->statements);
+    free(block->predecessors);
+    free(block->dominated);
+    free(block->frontier);
+    free(block);
+}
+
+static void free_loops(CodeGenerator* gen) {
+    for (int i = 0; i < gen->loop_count; i++) {
+        free(gen->loops[i]->blocks);
+        free(gen->loops[i]);
+    }
+    gen->loop_count = 0;
+}
+
+void free_basic_blocks(CodeGenerator* gen) {
+    for (int i = 0; i < gen->block_count; i++) cfg_free_block(gen->blocks[i]);
+    gen->block_count = 0;
+    gen->rpo_count = 0;
+    free_loops(gen);
+}
+
+void build_basic_blocks(CodeGenerator* gen, Statement* function) {
+    free_basic_blocks(gen);
+    CfgBuilder builder = {gen, NULL, NULL, NULL};
+    place_block(&builder, cfg_new_block());
+    builder.current->is_entry = true;
+
+    Statement* body = function->as.function.body;
+    for (int i = 0; i < body->as.compound.count; i++) {
+        build_statement(&builder, body->as.compound.statements[i]);
+    }
+    // Falling off the end returns
+    builder.current->is_exit = true;
+}
+
+// Analysis
+static void number_blocks(CodeGenerator* gen) {
+    // Iterative depth-first search; a block is finished once all of its
+    // successors have been visited
+    BasicBlock** stack = malloc(sizeof(BasicBlock*) * (gen->block_count + 1));
+    int* next_successor = calloc(gen->block_count + 1, sizeof(int));
+    bool* visited = calloc(gen->block_count + 1, sizeof(bool));
+    BasicBlock** postorder = malloc(sizeof(BasicBlock*) * (gen->block_count + 1));
+    int finished = 0;
+    int depth = 0;
+
+    stack[depth++] = gen->blocks[0];
+    visited[0] = true;
+    while (depth > 0) {
+        BasicBlock* block = stack[depth - 1];
+        if (next_successor[block->id] < block->successor_count) {
+            BasicBlock* successor = block->successors[next_successor[block->id]++];
+            if (!visited[successor->id]) {
+                visited[successor->id] = true;
+                stack[depth++] = successor;
+            }
+        } else {
+            postorder[finished++] = block;
+            depth--;
+        }
+    }
+
+    gen->rpo = realloc(gen->rpo, sizeof(BasicBlock*) * (gen->block_count + 1));
+    gen->rpo_count = finished;
+    for (int i = 0; i < finished; i++) {
+        gen->rpo[i] = postorder[finished - 1 - i];
+        gen->rpo[i]->rpo = i;
+    }
+    free(stack);
+    free(next_successor);
+    free(visited);
+    free(postorder);
+}
+
+static BasicBlock* intersect(BasicBlock* a, BasicBlock* b) {
+    while (a != b) {
+        while (a->rpo > b->rpo) a = a->idom;
+        while (b->rpo > a->rpo) b = b->idom;
+    }
+    return a;
+}
+
+static void compute_dominators(CodeGenerator* gen) {
+    BasicBlock* entry = gen->rpo[0];
+    entry->idom = entry;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = 1; i < gen->rpo_count; i++) {
+            BasicBlock* block = gen->rpo[i];
+            BasicBlock* idom = NULL;
+            for (int p = 0; p < block->predecessor_count; p++) {
+                BasicBlock* predecessor = block->predecessors[p];
+                if (predecessor->rpo < 0 || predecessor->idom == NULL) continue;
+                idom = idom == NULL ? predecessor : intersect(predecessor, idom);
+            }
+            if (idom != block->idom) {
+                block->idom = idom;
+                changed = true;
+            }
+        }
+    }
+    entry->idom = NULL;
+
+    for (int i = 1; i < gen->rpo_count; i++) {
+        BasicBlock* block = gen->rpo[i];
+        BasicBlock* parent = block->idom;
+        parent->dominated = realloc(parent->dominated, sizeof(BasicBlock*) * (parent->dominated_count + 1));
+        parent->dominated[parent->dominated_count++] = block;
+    }
+}
+
+bool block_dominates(const BasicBlock* dominator, const BasicBlock* block) {
+    if (dominator->rpo < 0 || block->rpo < 0) return false;
+    while (block != NULL && block->rpo >= dominator->rpo) {
+        if (block == dominator) return true;
+        block = block->idom;
+    }
+    return false;
+}
+
+bool loop_contains(const Loop* loop, const BasicBlock* block) {
+    for (const Loop* l = block->loop; l != NULL; l = l->parent) {
+        if (l == loop) return true;
+    }
+    return false;
+}
+
+static void add_to_loop(Loop* loop, BasicBlock* block) {
+    if (loop->block_count == loop->block_capacity) {
+        loop->block_capacity = loop->block_capacity ? loop->block_capacity * 2 : 8;
+        loop->blocks = realloc(loop->blocks, sizeof(BasicBlock*) * loop->block_capacity);
+    }
+    loop->blocks[loop->block_count++] = block;
+    block->loop = loop;
+    block->loop_depth++;
+}
+
+// An edge to a dominator closes a natural loop: the header plus every
+// block that reaches the edge without passing through the header. Back
+// edges sharing a header form one loop. Headers are visited in reverse
+// post-order, so enclosing loops are found first and each block is left
+// pointing at the innermost loop containing it.
+static void find_loops(CodeGenerator* gen) {
+    free_loops(gen);
+    int* mark = malloc(sizeof(int) * (gen->block_count + 1));
+    BasicBlock** worklist = malloc(sizeof(BasicBlock*) * (gen->block_count + 1));
+    for (int i = 0; i < gen->block_count; i++) mark[i] = -1;
+
+    for (int h = 0; h < gen->rpo_count; h++) {
+        BasicBlock* header = gen->rpo[h];
+        Loop* loop = NULL;
+        int count = 0;
+        for (int p = 0; p < header->predecessor_count; p++) {
+            BasicBlock* latch = header->predecessors[p];
+            if (!block_dominates(header, latch)) continue;
+            if (loop == NULL) {
+                loop = calloc(1, sizeof(Loop));
+                loop->header = header;
+                loop->parent = header->loop;
+                if (gen->loop_count == gen->loop_capacity) {
+                    gen->loop_capacity = gen->loop_capacity ? gen->loop_capacity * 2 : 8;
+                    gen->loops = realloc(gen->loops, sizeof(Loop*) * gen->loop_capacity);
+                }
+                gen->loops[gen->loop_count++] = loop;
+                header->is_loop_header = true;
+                mark[header->id] = header->id;
+                add_to_loop(loop, header);
+            }
+            if (mark[latch->id] != header->id) {
+                mark[latch->id] = header->id;
+                add_to_loop(loop, latch);
+                worklist[count++] = latch;
+            }
+            while (count > 0) {
+                BasicBlock* block = worklist[--count];
+                for (int q = 0; q < block->predecessor_count; q++) {
+                    BasicBlock* predecessor = block->predecessors[q];
+                    if (predecessor->rpo < 0 || mark[predecessor->id] == header->id) continue;
+                    mark[predecessor->id] = header->id;
+                    add_to_loop(loop, predecessor);
+                    worklist[count++] = predecessor;
+                }
+            }
+        }
+    }
+    free(mark);
+    free(worklist);
+}
+
+// Where each block's dominance stops: the blocks it does not strictly
+// dominate with a predecessor it does dominate
+static void compute_frontiers(CodeGenerator* gen) {
+    for (int i = 0; i < gen->rpo_count; i++) {
+        BasicBlock* block = gen->rpo[i];
+        if (block->predecessor_count < 2) continue;
+        for (int p = 0; p < block->predecessor_count; p++) {
+            BasicBlock* runner = block->predecessors[p];
+            if (runner->rpo < 0) continue;
+            while (runner != block->idom) {
+                bool present = runner->frontier_count > 0 && runner->frontier[runner->frontier_count - 1] == block;
+                if (!present) {
+                    runner->frontier = realloc(runner->frontier, sizeof(BasicBlock*) * (runner->frontier_count + 1));
+                    runner->frontier[runner->frontier_count++] = block;
+                }
+                runner = runner->idom;
+            }
+        }
+    }
+}
+
+void analyze_control_flow(CodeGenerator* gen) {
+    if (gen->block_count == 0) return;
+    for (int i = 0; i < gen->block_count; i++) {
+        BasicBlock* block = gen->blocks[i];
+        block->rpo = -1;
+        block->idom = NULL;
+        block->dominated_count = 0;
+        block->frontier_count = 0;
+        block->loop_depth = 0;
+        block->is_loop_header = false;
+        block->loop = NULL;
+    }
+    number_blocks(gen);
+    compute_dominators(gen);
+    compute_frontiers(gen);
+    find_loops(gen);
+}
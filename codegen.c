@@ -1,123 +1,1194 @@
 #include "codegen.h"
+#include "ir.h"
+#include "object.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
+static const int argument_registers[6] = {
+    REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9
+};
+
+static bool is_callee_saved(int reg) {
+    return reg == REG_RBX || reg >= REG_R12;
+}
+
+static const Operand no_operand = {OPERAND_NONE, 0, -1, 0, NULL};
+
+// Instructions are collected into an AsmList, which is printed as
+// assembly or encoded into an object once generation is done
+void emit_instruction(CodeGenerator* gen, const MInst* inst) {
+    asm_list_add(gen->out, ITEM_INSTRUCTION)->inst = *inst;
+}
+
+static void emit(CodeGenerator* gen, X86Opcode opcode, Operand src, Operand dst) {
+    MInst inst = {opcode, COND_O, src, dst};
+    emit_instruction(gen, &inst);
+}
+
+static void emit_unary(CodeGenerator* gen, X86Opcode opcode, Operand dst) {
+    emit(gen, opcode, no_operand, dst);
+}
+
+static void emit_conditional(CodeGenerator* gen, X86Opcode opcode, ConditionCode cond, Operand dst) {
+    MInst inst = {opcode, cond, no_operand, dst};
+    emit_instruction(gen, &inst);
+}
+
+static AsmItem* emit_item(CodeGenerator* gen, AsmItemKind kind, const char* name, long long value) {
+    AsmItem* item = asm_list_add(gen->out, kind);
+    item->name = name;
+    item->value = value;
+    return item;
+}
+
+static Operand reg64(int reg) {
+    return operand_register(reg, 8);
+}
+
+static Operand reg32(int reg) {
+    return operand_register(reg, 4);
+}
+
+static Operand reg16(int reg) {
+    return operand_register(reg, 2);
+}
+
+static Operand reg8(int reg) {
+    return operand_register(reg, 1);
+}
+
+// Memory operand accessed with `size` bytes
+static Operand sized(Operand address, int size) {
+    address.size = size;
+    return address;
+}
+
+static char* print_listing(const AsmList* list, size_t* length) {
+    Emitter out = {NULL, 0, 0, false};
+    asm_print(list, &out);
+    emitter_char(&out, '\0');
+    *length = out.length - 1;
+    return out.data;
+}
+
+bool codegen_flush(CodeGenerator* gen) {
+    size_t length;
+    char* text = print_listing(&gen->program, &length);
+    bool ok = gen->output == NULL || fwrite(text, 1, length, gen->output) == length;
+    free(text);
+    gen->program.count = 0;
+    return ok;
+}
+
+char* codegen_take_output(CodeGenerator* gen, size_t* length) {
+    char* text = print_listing(&gen->program, length);
+    gen->program.count = 0;
+    return text;
+}
+
+char* codegen_take_object(CodeGenerator* gen, size_t* length) {
+    char* object = object_write(&gen->program, length);
+    gen->program.count = 0;
+    return object;
+}
+
 // Code generator initialization
 CodeGenerator* codegen_init(FILE* output, bool optimize) {
-    CodeGenerator* gen = malloc(sizeof(CodeGenerator));
+    CodeGenerator* gen = calloc(1, sizeof(CodeGenerator));
     gen->output = output;
+    asm_list_init(&gen->program);
+    asm_list_init(&gen->body);
+    asm_list_init(&gen->stubs);
+    gen->out = &gen->program;
     gen->blocks = NULL;
     gen->block_count = 0;
     gen->live_ranges = NULL;
+    gen->vreg_count = 0;
+    gen->vreg_capacity = 0;
+    gen->liveness = NULL;
     gen->current_stack_offset = 0;
     gen->label_counter = 0;
     gen->optimize = optimize;
-    
+    gen->unroll_factor = DEFAULT_UNROLL_FACTOR;
+    gen->vector_width = DEFAULT_VECTOR_WIDTH;
+    gen->inline_functions = true;
+    gen->specialize_functions = true;
+    gen->schedule_instructions = true;
+
     // Initialize registers
     for (int i = 0; i < 16; i++) {
-        gen->registers[i].is_available = true;
-        gen->registers[i].current_var = NULL;
         gen->registers[i].is_dirty = false;
     }
-    
+
     return gen;
 }
 
 void codegen_free(CodeGenerator* gen) {
-    // Free basic blocks
-    for (int i = 0; i < gen->block_count; i++) {
-        free(gen->blocks[i]);
-    }
+    free_ir(gen);
+    free_basic_blocks(gen);
     free(gen->blocks);
-    
-    // Free live ranges
-    LiveRange* current = gen->live_ranges;
-    while (current != NULL) {
-        LiveRange* next = current->next;
-        free(current->var_name);
-        free(current);
-        current = next;
-    }
-    
+    free(gen->rpo);
+    free(gen->loops);
+
+    free(gen->live_ranges);
+    asm_list_free(&gen->program);
+    asm_list_free(&gen->body);
+    asm_list_free(&gen->stubs);
+    free(gen->report.data);
+    free(gen->strings);
+    free(gen->functions);
+    free(gen->inline_sources);
+    free_call_sites(gen);
     free(gen);
 }
 
-// Code generation functions
-void generate_program(CodeGenerator* gen, Statement* program) {
-    // Generate assembly prologue
-    fprintf(gen->output, ".text\n");
-    fprintf(gen->output, ".globl _main\n");
-    fprintf(gen->output, "_main:\n");
-    
-    // Set up stack frame
-    fprintf(gen->output, "    push {fp, lr}\n");
-    fprintf(gen->output, "    mov fp, sp\n");
-    
-    // Generate code for the program
-    if (program->type == NODE_COMPOUND) {
-        for (int i = 0; i < program->as.compound.count; i++) {
-            generate_statement(gen, program->as.compound.statements[i]);
+// Values live in virtual registers until allocate_registers maps them
+// onto physical ones
+int get_register(CodeGenerator* gen) {
+    return VREG_BASE + gen->vreg_count++;
+}
+
+// Value representation. Integers narrower than int live in registers as
+// sign- or zero-extended 32-bit values; long and pointers use all 64 bits.
+bool is_wide(const Type* type) {
+    return type->kind == TYPE_LONG || type->kind == TYPE_POINTER ||
+           type->kind == TYPE_ARRAY || type->kind == TYPE_FUNCTION;
+}
+
+static Operand value_reg(int reg, const Type* type) {
+    return operand_register(reg, is_wide(type) ? 8 : 4);
+}
+
+bool is_unsigned_type(const Type* type) {
+    return type->is_unsigned || is_pointer_type(type);
+}
+
+static const Type int_type = {TYPE_INT, false, false, false, {0}};
+static const Type long_type = {TYPE_LONG, false, false, false, {0}};
+
+// Integer promotion: char and short values are already held as ints
+const Type* promoted(const Type* type) {
+    return type->kind == TYPE_CHAR || type->kind == TYPE_SHORT || type->kind == TYPE_BOOL ? &int_type : type;
+}
+
+// Type both operands of an arithmetic or comparison are converted to
+const Type* operation_type(const Type* left, const Type* right) {
+    left = promoted(left);
+    right = promoted(right);
+    if (is_wide(left) != is_wide(right)) return is_wide(left) ? left : right;
+    if (is_unsigned_type(right) && !is_unsigned_type(left)) return right;
+    return left;
+}
+
+// Whether a value of type `from`, held as an int, must be sign- or
+// zero-extended again from the low bits to become a `to`. Changing only
+// the signedness of a char or short changes its value too.
+bool narrows(const Type* from, const Type* to) {
+    if (to->kind == TYPE_CHAR) return from->kind != TYPE_CHAR || from->is_unsigned != to->is_unsigned;
+    if (to->kind != TYPE_SHORT) return false;
+    if (from->kind == TYPE_SHORT) return from->is_unsigned != to->is_unsigned;
+    // Every char value fits, except negative ones in an unsigned short
+    if (from->kind == TYPE_CHAR) return !from->is_unsigned && to->is_unsigned;
+    return true;
+}
+
+static void convert(CodeGenerator* gen, int reg, const Type* from, const Type* to) {
+    if (reg < 0 || from == NULL || to == NULL) return;
+
+    if (is_wide(to) && !is_wide(from)) {
+        if (from->is_unsigned) {
+            emit(gen, X86_MOV, reg32(reg), reg32(reg));
+        } else {
+            emit(gen, X86_MOVSX, reg32(reg), reg64(reg));
+        }
+    } else if (narrows(from, to)) {
+        Operand low = to->kind == TYPE_CHAR ? reg8(reg) : reg16(reg);
+        emit(gen, to->is_unsigned ? X86_MOVZX : X86_MOVSX, low, reg32(reg));
+    }
+}
+
+// Memory access
+static void load(CodeGenerator* gen, int reg, const Type* type, Operand address) {
+    if (type->kind == TYPE_ARRAY || type->kind == TYPE_FUNCTION) {
+        // Arrays and functions evaluate to their address
+        emit(gen, X86_LEA, address, reg64(reg));
+        return;
+    }
+
+    int size = type_size(type);
+    if (size < 4) {
+        emit(gen, type->is_unsigned ? X86_MOVZX : X86_MOVSX, sized(address, size), reg32(reg));
+    } else {
+        emit(gen, X86_MOV, sized(address, size), operand_register(reg, size));
+    }
+}
+
+static void store(CodeGenerator* gen, int reg, const Type* type, Operand address) {
+    int size = type_size(type);
+    emit(gen, X86_MOV, operand_register(reg, size), sized(address, size));
+}
+
+// Labels are local to the function, so functions generated separately
+// never clash
+static int new_label(CodeGenerator* gen) {
+    return gen->label_counter++;
+}
+
+static void emit_label(CodeGenerator* gen, int label) {
+    asm_list_add(gen->out, ITEM_LABEL)->operand = operand_label(gen->function_name, label);
+}
+
+static void emit_jump(CodeGenerator* gen, int label) {
+    emit_unary(gen, X86_JMP, operand_label(gen->function_name, label));
+}
+
+static void emit_branch(CodeGenerator* gen, ConditionCode cond, int label) {
+    emit_conditional(gen, X86_JCC, cond, operand_label(gen->function_name, label));
+}
+
+// Locals
+static LocalVar* find_local(CodeGenerator* gen, const char* name) {
+    for (LocalVar* local = gen->locals; local != NULL; local = local->next) {
+        if (strcmp(local->name, name) == 0) return local;
+    }
+    return NULL;
+}
+
+static LocalVar* declare_local(CodeGenerator* gen, char* name, Type* type) {
+    int size = type_size(type);
+    int align = type->kind == TYPE_ARRAY ? (size >= 16 ? 16 : 8) : size;
+    if (align < 1) align = 1;
+    gen->current_stack_offset = (gen->current_stack_offset + size + align - 1) / align * align;
+
+    LocalVar* local = malloc(sizeof(LocalVar));
+    local->name = name;
+    local->type = type;
+    local->offset = -gen->current_stack_offset;
+    local->next = gen->locals;
+    gen->locals = local;
+    return local;
+}
+
+// Drop locals declared after `mark`
+static void pop_locals(CodeGenerator* gen, LocalVar* mark) {
+    while (gen->locals != mark) {
+        LocalVar* next = gen->locals->next;
+        free(gen->locals);
+        gen->locals = next;
+    }
+}
+
+static Operand local_address(const LocalVar* local) {
+    return operand_memory(REG_RBP, local->offset, 0);
+}
+
+// Location of a named variable
+static const Type* variable_address(CodeGenerator* gen, Token* name, Operand* address,
+                                    const Type* fallback) {
+    LocalVar* local = find_local(gen, name->lexeme);
+    if (local != NULL) {
+        *address = local_address(local);
+        return local->type;
+    }
+    *address = operand_symbol(name->lexeme, 0);
+    return fallback;
+}
+
+static int generate_address(CodeGenerator* gen, Expression* expr);
+
+static void emit_literal(CodeGenerator* gen, int reg, Expression* expr) {
+    long long value = expr->token->value.int_value;
+    if (value == 0) {
+        emit(gen, X86_XOR, reg32(reg), reg32(reg));
+    } else if (!is_wide(expr->expr_type) || (value >= 0 && value <= 0xffffffffLL)) {
+        emit(gen, X86_MOV, operand_immediate(value & 0xffffffffLL), reg32(reg));
+    } else if (value >= -2147483648LL && value <= 2147483647LL) {
+        emit(gen, X86_MOV, operand_immediate(value), reg64(reg));
+    } else {
+        emit(gen, X86_MOVABS, operand_immediate(value), reg64(reg));
+    }
+}
+
+int add_string(CodeGenerator* gen, Token* token) {
+    if (gen->string_count == gen->string_capacity) {
+        gen->string_capacity = gen->string_capacity ? gen->string_capacity * 2 : 8;
+        gen->strings = realloc(gen->strings, sizeof(Token*) * gen->string_capacity);
+    }
+    gen->strings[gen->string_count] = token;
+    return gen->string_count++;
+}
+
+static void emit_string_data(CodeGenerator* gen, const char* owner, int index, Token* token) {
+    asm_list_add(gen->out, ITEM_LABEL)->operand = operand_string(owner, index);
+    emit_item(gen, ITEM_STRING, token->value.string_value, 0);
+}
+
+// Multiply a 64-bit index register by an element size
+static void scale(CodeGenerator* gen, int reg, int size) {
+    if (size == 1) return;
+    int shift = 0;
+    while ((1 << shift) < size) shift++;
+    if ((1 << shift) == size) {
+        emit(gen, X86_SHL, operand_immediate(shift), reg64(reg));
+    } else {
+        emit(gen, X86_IMUL, operand_immediate(size), reg64(reg));
+    }
+}
+
+int element_size(const Type* pointer) {
+    const Type* base = pointer->kind == TYPE_POINTER ? pointer->info.base : pointer->info.array.elem_type;
+    return base->kind == TYPE_VOID ? 1 : type_size(base);
+}
+
+ConditionCode condition_code(TokenType op, bool is_unsigned) {
+    switch (op) {
+        case TOKEN_EQUALEQUAL: return COND_E;
+        case TOKEN_NOTEQUAL: return COND_NE;
+        case TOKEN_LESS: return is_unsigned ? COND_B : COND_L;
+        case TOKEN_LESSEQUAL: return is_unsigned ? COND_BE : COND_LE;
+        case TOKEN_GREATER: return is_unsigned ? COND_A : COND_G;
+        case TOKEN_GREATEREQUAL: return is_unsigned ? COND_AE : COND_GE;
+        default: return COND_NE;
+    }
+}
+
+bool is_comparison(TokenType op) {
+    return op == TOKEN_EQUALEQUAL || op == TOKEN_NOTEQUAL || op == TOKEN_LESS ||
+           op == TOKEN_LESSEQUAL || op == TOKEN_GREATER || op == TOKEN_GREATEREQUAL;
+}
+
+// Materialize the flags as 0 or 1 in `reg`
+static void emit_set(CodeGenerator* gen, ConditionCode cond, int reg) {
+    emit_conditional(gen, X86_SETCC, cond, reg8(reg));
+    emit(gen, X86_MOVZX, reg8(reg), reg32(reg));
+}
+
+static void emit_test(CodeGenerator* gen, int reg, const Type* type) {
+    emit(gen, X86_TEST, value_reg(reg, type), value_reg(reg, type));
+}
+
+// Binary operator on a register of type `type`; the result is in `left`.
+// `right` is a register or an immediate.
+static void emit_arithmetic(CodeGenerator* gen, TokenType op, const Type* type, int left, Operand right) {
+    X86Opcode opcode = X86_ADD;
+    switch (op) {
+        case TOKEN_PLUS: opcode = X86_ADD; break;
+        case TOKEN_MINUS: opcode = X86_SUB; break;
+        case TOKEN_STAR: opcode = X86_IMUL; break;
+        case TOKEN_AMPERSAND: opcode = X86_AND; break;
+        case TOKEN_PIPE: opcode = X86_OR; break;
+        case TOKEN_CARET: opcode = X86_XOR; break;
+        default: break;
+    }
+    emit(gen, opcode, right, value_reg(left, type));
+}
+
+static void emit_division(CodeGenerator* gen, TokenType op, const Type* type, int left, int right) {
+    Operand rax = value_reg(REG_RAX, type);
+    emit(gen, X86_MOV, value_reg(left, type), rax);
+    if (type->is_unsigned) {
+        emit(gen, X86_XOR, reg32(REG_RDX), reg32(REG_RDX));
+        emit_unary(gen, X86_DIV, value_reg(right, type));
+    } else {
+        emit_unary(gen, is_wide(type) ? X86_CQTO : X86_CLTD, no_operand);
+        emit_unary(gen, X86_IDIV, value_reg(right, type));
+    }
+    Operand result = op == TOKEN_SLASH ? rax : value_reg(REG_RDX, type);
+    emit(gen, X86_MOV, result, value_reg(left, type));
+}
+
+static void emit_shift(CodeGenerator* gen, TokenType op, const Type* type, int left, Operand count) {
+    X86Opcode opcode = op == TOKEN_LESSLESS ? X86_SHL : (type->is_unsigned ? X86_SHR : X86_SAR);
+    emit(gen, opcode, count, value_reg(left, type));
+}
+
+// Apply a compound operator to `left`, with the right operand in `right`
+static void emit_operator(CodeGenerator* gen, TokenType op, const Type* type, int left, int right) {
+    switch (op) {
+        case TOKEN_SLASH:
+        case TOKEN_PERCENT:
+            emit_division(gen, op, type, left, right);
+            break;
+        case TOKEN_LESSLESS:
+        case TOKEN_GREATERGREATER:
+            emit(gen, X86_MOV, reg32(right), reg32(REG_RCX));
+            emit_shift(gen, op, type, left, reg8(REG_RCX));
+            break;
+        default:
+            emit_arithmetic(gen, op, type, left, value_reg(right, type));
+            break;
+    }
+}
+
+TokenType compound_operator(TokenType op) {
+    switch (op) {
+        case TOKEN_PLUSEQUAL: return TOKEN_PLUS;
+        case TOKEN_MINUSEQUAL: return TOKEN_MINUS;
+        case TOKEN_STAREQUAL: return TOKEN_STAR;
+        case TOKEN_SLASHEQUAL: return TOKEN_SLASH;
+        case TOKEN_PERCENTEQUAL: return TOKEN_PERCENT;
+        case TOKEN_ANDEQUAL: return TOKEN_AMPERSAND;
+        case TOKEN_OREQUAL: return TOKEN_PIPE;
+        case TOKEN_XOREQUAL: return TOKEN_CARET;
+        case TOKEN_LESSLESSEQUAL: return TOKEN_LESSLESS;
+        case TOKEN_GREATERGREATEREQUAL: return TOKEN_GREATERGREATER;
+        default: return op;
+    }
+}
+
+// Both operands of an operator, the one taking more registers first (the
+// checker's Sethi-Ullman numbers): the other is then computed while only
+// one value is held, rather than the first being held throughout. C leaves
+// the order unspecified.
+static void generate_operands(CodeGenerator* gen, Expression* left_expr, Expression* right_expr,
+                              int* left, int* right) {
+    if (right_expr->registers > left_expr->registers) {
+        *right = generate_expression(gen, right_expr);
+        *left = generate_expression(gen, left_expr);
+    } else {
+        *left = generate_expression(gen, left_expr);
+        *right = generate_expression(gen, right_expr);
+    }
+}
+
+static int generate_logical(CodeGenerator* gen, Expression* expr) {
+    int end = new_label(gen);
+    bool is_and = expr->op == TOKEN_ANDAND;
+
+    int left = generate_expression(gen, expr->as.binary.left);
+    emit_test(gen, left, expr->as.binary.left->expr_type);
+    emit_branch(gen, is_and ? COND_E : COND_NE, end);
+
+    int right = generate_expression(gen, expr->as.binary.right);
+    emit_test(gen, right, expr->as.binary.right->expr_type);
+
+    // Both paths arrive with the flags of the deciding operand
+    emit_label(gen, end);
+    int result = get_register(gen);
+    emit_set(gen, COND_NE, result);
+    return result;
+}
+
+static int generate_comparison(CodeGenerator* gen, Expression* expr) {
+    Expression* left_expr = expr->as.binary.left;
+    Expression* right_expr = expr->as.binary.right;
+    const Type* type = operation_type(left_expr->expr_type, right_expr->expr_type);
+
+    int left, right;
+    generate_operands(gen, left_expr, right_expr, &left, &right);
+    convert(gen, left, left_expr->expr_type, type);
+    convert(gen, right, right_expr->expr_type, type);
+    emit(gen, X86_CMP, value_reg(right, type), value_reg(left, type));
+
+    emit_set(gen, condition_code(expr->op, is_unsigned_type(type)), left);
+    return left;
+}
+
+// Pointer plus or minus an integer, or the difference of two pointers
+static int generate_pointer_arithmetic(CodeGenerator* gen, Expression* expr) {
+    Expression* left_expr = expr->as.binary.left;
+    Expression* right_expr = expr->as.binary.right;
+    const Type* left_type = left_expr->expr_type;
+    const Type* right_type = right_expr->expr_type;
+
+    int left, right;
+    generate_operands(gen, left_expr, right_expr, &left, &right);
+
+    if (is_pointer_type(left_type) && is_pointer_type(right_type)) {
+        emit(gen, X86_SUB, reg64(right), reg64(left));
+        int size = element_size(left_type);
+        if (size > 1) {
+            emit(gen, X86_MOV, reg64(left), reg64(REG_RAX));
+            emit_unary(gen, X86_CQTO, no_operand);
+            emit(gen, X86_MOV, operand_immediate(size), reg64(right));
+            emit_unary(gen, X86_IDIV, reg64(right));
+            emit(gen, X86_MOV, reg64(REG_RAX), reg64(left));
+        }
+    } else {
+        // Scale the integer operand and add in 64 bits
+        int pointer = is_pointer_type(left_type) ? left : right;
+        int index = pointer == left ? right : left;
+        const Type* index_type = pointer == left ? right_type : left_type;
+        const Type* pointer_type = pointer == left ? left_type : right_type;
+        convert(gen, index, index_type, expr->expr_type);
+        scale(gen, index, element_size(pointer_type));
+        emit(gen, expr->op == TOKEN_PLUS ? X86_ADD : X86_SUB, reg64(index), reg64(pointer));
+        if (pointer != left) emit(gen, X86_MOV, reg64(pointer), reg64(left));
+    }
+
+    return left;
+}
+
+static int generate_binary(CodeGenerator* gen, Expression* expr) {
+    if (expr->op == TOKEN_ANDAND || expr->op == TOKEN_OROR) return generate_logical(gen, expr);
+    if (is_comparison(expr->op)) return generate_comparison(gen, expr);
+
+    Expression* left_expr = expr->as.binary.left;
+    Expression* right_expr = expr->as.binary.right;
+    if (is_pointer_type(left_expr->expr_type) || is_pointer_type(right_expr->expr_type)) {
+        return generate_pointer_arithmetic(gen, expr);
+    }
+
+    const Type* type = expr->expr_type;
+    bool is_shift = expr->op == TOKEN_LESSLESS || expr->op == TOKEN_GREATERGREATER;
+    int left, right;
+    generate_operands(gen, left_expr, right_expr, &left, &right);
+    convert(gen, left, left_expr->expr_type, type);
+    convert(gen, right, right_expr->expr_type, is_shift ? right_expr->expr_type : type);
+    emit_operator(gen, expr->op, type, left, right);
+
+    return left;
+}
+
+// Increment and decrement, prefix and postfix
+static int generate_increment(CodeGenerator* gen, Expression* expr) {
+    Expression* target = expr->as.unary.operand;
+    const Type* type = target->expr_type;
+    int step = is_pointer_type(type) ? element_size(type) : 1;
+    bool is_increment = expr->op == TOKEN_PLUSPLUS;
+
+    Operand address;
+    int base = -1;
+    if (target->type == NODE_IDENTIFIER) {
+        type = variable_address(gen, target->token, &address, type);
+    } else {
+        base = generate_address(gen, target);
+        address = operand_memory(base, 0, 0);
+    }
+
+    int result = get_register(gen);
+    load(gen, result, type, address);
+    if (expr->as.unary.prefix) {
+        emit(gen, is_increment ? X86_ADD : X86_SUB, operand_immediate(step), value_reg(result, type));
+        convert(gen, result, promoted(type), type);
+        store(gen, result, type, address);
+    } else {
+        // Update the variable from a copy; the result keeps the old value
+        int updated = get_register(gen);
+        emit(gen, X86_LEA, operand_memory(result, is_increment ? step : -step, 0), value_reg(updated, type));
+        store(gen, updated, type, address);
+    }
+    return result;
+}
+
+static int generate_unary(CodeGenerator* gen, Expression* expr) {
+    Expression* operand_expr = expr->as.unary.operand;
+    const Type* type = expr->expr_type;
+    int operand;
+
+    switch (expr->op) {
+        case TOKEN_MINUS:
+        case TOKEN_PLUS:
+        case TOKEN_TILDE:
+            operand = generate_expression(gen, operand_expr);
+            convert(gen, operand, operand_expr->expr_type, type);
+            if (expr->op != TOKEN_PLUS) {
+                emit_unary(gen, expr->op == TOKEN_MINUS ? X86_NEG : X86_NOT, value_reg(operand, type));
+            }
+            return operand;
+        case TOKEN_BANG:
+            operand = generate_expression(gen, operand_expr);
+            emit_test(gen, operand, operand_expr->expr_type);
+            emit_set(gen, COND_E, operand);
+            return operand;
+        case TOKEN_STAR:
+            operand = generate_expression(gen, operand_expr);
+            load(gen, operand, type, operand_memory(operand, 0, 0));
+            return operand;
+        case TOKEN_AMPERSAND:
+            return generate_address(gen, operand_expr);
+        case TOKEN_PLUSPLUS:
+        case TOKEN_MINUSMINUS:
+            return generate_increment(gen, expr);
+        default:
+            return -1;
+    }
+}
+
+static int generate_assignment(CodeGenerator* gen, Expression* expr) {
+    Expression* target = expr->as.binary.left;
+    Expression* value_expr = expr->as.binary.right;
+    const Type* type = target->expr_type;
+
+    // The address of a target other than a variable and the value come
+    // in either order, like the operands of an operator
+    Operand address = no_operand;
+    int base = -1;
+    int value;
+    if (target->type == NODE_IDENTIFIER) {
+        type = variable_address(gen, target->token, &address, type);
+        value = generate_expression(gen, value_expr);
+    } else if (value_expr->registers > target->as.unary.operand->registers) {
+        value = generate_expression(gen, value_expr);
+        base = generate_address(gen, target);
+    } else {
+        base = generate_address(gen, target);
+        value = generate_expression(gen, value_expr);
+    }
+
+    TokenType op = compound_operator(expr->op);
+    const Type* value_type = value_expr->expr_type;
+    if (base >= 0) address = operand_memory(base, 0, 0);
+
+    if (op == TOKEN_EQUALS) {
+        convert(gen, value, value_type, type);
+    } else if (is_pointer_type(type)) {
+        // p += n scales n by the element size
+        convert(gen, value, value_type, type);
+        scale(gen, value, element_size(type));
+        int current = get_register(gen);
+        load(gen, current, type, address);
+        emit(gen, op == TOKEN_PLUS ? X86_ADD : X86_SUB, reg64(value), reg64(current));
+        emit(gen, X86_MOV, reg64(current), reg64(value));
+    } else {
+        // Compute in the promoted type of the operands, then narrow
+        bool is_shift = op == TOKEN_LESSLESS || op == TOKEN_GREATERGREATER;
+        const Type* op_type = is_shift ? promoted(type) : operation_type(promoted(type), promoted(value_type));
+        if (!is_shift) convert(gen, value, value_type, op_type);
+
+        int current = get_register(gen);
+        load(gen, current, type, address);
+        convert(gen, current, type, op_type);
+        emit_operator(gen, op, op_type, current, value);
+        emit(gen, X86_MOV, reg64(current), reg64(value));
+        convert(gen, value, op_type, type);
+    }
+
+    store(gen, value, type, address);
+    return value;
+}
+
+static int generate_call(CodeGenerator* gen, Expression* expr) {
+    Expression* callee = expr->as.call.callee;
+    const Type* func = callee->expr_type;
+    int arg_count = expr->as.call.arg_count;
+    int stack_args = arg_count > 6 ? arg_count - 6 : 0;
+
+    // Arguments are evaluated right to left, those taking more registers
+    // (nested calls among them) first. Values still needed across a nested
+    // call are the register allocator's concern.
+    int* values = malloc(sizeof(int) * (arg_count > 0 ? arg_count : 1));
+    int* order = malloc(sizeof(int) * (arg_count > 0 ? arg_count : 1));
+    for (int n = 0; n < arg_count; n++) {
+        int i = arg_count - 1 - n;
+        int k = n;
+        while (k > 0 && expr->as.call.args[order[k - 1]]->registers < expr->as.call.args[i]->registers) {
+            order[k] = order[k - 1];
+            k--;
         }
+        order[k] = i;
+    }
+    for (int n = 0; n < arg_count; n++) {
+        int i = order[n];
+        Expression* arg = expr->as.call.args[i];
+        values[i] = generate_expression(gen, arg);
+        const Type* param = i < func->info.func.param_count ? func->info.func.param_types[i] : NULL;
+        if (param != NULL) {
+            convert(gen, values[i], arg->expr_type, param);
+        } else if (!is_wide(arg->expr_type)) {
+            // Variadic int arguments are passed sign-extended
+            convert(gen, values[i], arg->expr_type, &long_type);
+        }
+    }
+    free(order);
+    int target = -1;
+    if (callee->type != NODE_IDENTIFIER || find_local(gen, callee->token->lexeme) != NULL) {
+        target = generate_expression(gen, callee);
+    }
+
+    // Keep %rsp 16-byte aligned at the call instruction
+    bool padded = (gen->push_depth + stack_args) % 2 != 0;
+    if (padded) {
+        emit(gen, X86_SUB, operand_immediate(8), reg64(REG_RSP));
+        gen->push_depth++;
+    }
+    for (int i = arg_count - 1; i >= 6; i--) {
+        emit_unary(gen, X86_PUSH, reg64(values[i]));
+        gen->push_depth++;
+    }
+    for (int i = 0; i < arg_count && i < 6; i++) {
+        emit(gen, X86_MOV, reg64(values[i]), reg64(argument_registers[i]));
+    }
+    free(values);
+
+    if (func->info.func.is_variadic) {
+        emit(gen, X86_XOR, reg32(REG_RAX), reg32(REG_RAX));
+    }
+    Operand register_args = operand_immediate(arg_count < 6 ? arg_count : 6);
+    if (target < 0) {
+        emit(gen, X86_CALL, register_args, operand_symbol(callee->token->lexeme, 0));
     } else {
-        generate_statement(gen, program);
+        emit(gen, X86_CALL, register_args, reg64(target));
+    }
+
+    int cleanup = stack_args + (padded ? 1 : 0);
+    if (cleanup > 0) {
+        emit(gen, X86_ADD, operand_immediate(cleanup * 8), reg64(REG_RSP));
+        gen->push_depth -= cleanup;
+    }
+
+    Type* return_type = func->info.func.return_type;
+    if (return_type->kind == TYPE_VOID) return -1;
+    int result = get_register(gen);
+    emit(gen, X86_MOV, value_reg(REG_RAX, return_type), value_reg(result, return_type));
+    return result;
+}
+
+// Address of an lvalue in a register
+static int generate_address(CodeGenerator* gen, Expression* expr) {
+    if (expr->type == NODE_IDENTIFIER) {
+        Operand address;
+        variable_address(gen, expr->token, &address, expr->expr_type);
+        int reg = get_register(gen);
+        emit(gen, X86_LEA, address, reg64(reg));
+        return reg;
+    }
+    // *p: the address is the pointer's value
+    return generate_expression(gen, expr->as.unary.operand);
+}
+
+int generate_expression(CodeGenerator* gen, Expression* expr) {
+    int reg;
+    switch (expr->type) {
+        case NODE_LITERAL:
+            reg = get_register(gen);
+            if (expr->token->type == TOKEN_STRING_LITERAL) {
+                int index = add_string(gen, expr->token);
+                emit(gen, X86_LEA, operand_string(gen->function_name, index), reg64(reg));
+            } else {
+                emit_literal(gen, reg, expr);
+            }
+            return reg;
+        case NODE_IDENTIFIER: {
+            Operand address;
+            const Type* type = variable_address(gen, expr->token, &address, expr->expr_type);
+            reg = get_register(gen);
+            if (expr->as.identifier.is_array) {
+                emit(gen, X86_LEA, address, reg64(reg));
+            } else {
+                load(gen, reg, type, address);
+            }
+            return reg;
+        }
+        case NODE_BINARY_OP:
+            return generate_binary(gen, expr);
+        case NODE_UNARY_OP:
+            return generate_unary(gen, expr);
+        case NODE_ASSIGN:
+            return generate_assignment(gen, expr);
+        case NODE_CALL:
+            return generate_call(gen, expr);
+        case NODE_CAST: {
+            reg = generate_expression(gen, expr->as.cast.operand);
+            if (expr->expr_type->kind == TYPE_VOID) return -1;
+            convert(gen, reg, expr->as.cast.operand->expr_type, expr->expr_type);
+            return reg;
+        }
+        default:
+            return -1;
     }
-    
-    // Generate assembly epilogue
-    fprintf(gen->output, "    mov sp, fp\n");
-    fprintf(gen->output, "    pop {fp, pc}\n");
+}
+
+// Jump to `label` when the condition is `when`
+static void generate_condition(CodeGenerator* gen, Expression* condition, bool when, int label) {
+    int reg = generate_expression(gen, condition);
+    emit_test(gen, reg, condition->expr_type);
+    emit_branch(gen, when ? COND_NE : COND_E, label);
+}
+
+static void generate_declaration(CodeGenerator* gen, Statement* stmt) {
+    Type* type = stmt->as.declaration.var_type;
+    LocalVar* local = declare_local(gen, stmt->as.declaration.name->lexeme, type);
+
+    Expression* initializer = stmt->as.declaration.initializer;
+    if (initializer != NULL) {
+        int reg = generate_expression(gen, initializer);
+        convert(gen, reg, initializer->expr_type, type);
+        store(gen, reg, type, local_address(local));
+    }
+}
+
+static void generate_loop_body(CodeGenerator* gen, Statement* body, int break_label, int continue_label) {
+    int outer_break = gen->break_label;
+    int outer_continue = gen->continue_label;
+    gen->break_label = break_label;
+    gen->continue_label = continue_label;
+    generate_statement(gen, body);
+    gen->break_label = outer_break;
+    gen->continue_label = outer_continue;
 }
 
 void generate_statement(CodeGenerator* gen, Statement* stmt) {
+    if (stmt == NULL) return;
+
     switch (stmt->type) {
         case NODE_EXPRESSION:
             generate_expression(gen, stmt->as.expression.expr);
             break;
         case NODE_RETURN:
             if (stmt->as.return_stmt.value) {
-                generate_expression(gen, stmt->as.return_stmt.value);
-                fprintf(gen->output, "    mov r0, r1\n"); // Move return value to r0
+                Expression* value = stmt->as.return_stmt.value;
+                int reg = generate_expression(gen, value);
+                convert(gen, reg, value->expr_type, gen->return_type);
+                emit(gen, X86_MOV, reg64(reg), reg64(REG_RAX));
             }
+            emit_jump(gen, LABEL_RETURN);
             break;
         case NODE_DECLARATION:
-            // Handle variable declarations
+            generate_declaration(gen, stmt);
+            break;
+        case NODE_COMPOUND: {
+            LocalVar* mark = gen->locals;
+            for (int i = 0; i < stmt->as.compound.count; i++) {
+                generate_statement(gen, stmt->as.compound.statements[i]);
+            }
+            if (stmt->as.compound.scoped) pop_locals(gen, mark);
+            break;
+        }
+        case NODE_IF: {
+            int else_label = new_label(gen);
+            generate_condition(gen, stmt->as.if_stmt.condition, false, else_label);
+            generate_statement(gen, stmt->as.if_stmt.then_branch);
+            if (stmt->as.if_stmt.else_branch != NULL) {
+                int end_label = new_label(gen);
+                emit_jump(gen, end_label);
+                emit_label(gen, else_label);
+                generate_statement(gen, stmt->as.if_stmt.else_branch);
+                emit_label(gen, end_label);
+            } else {
+                emit_label(gen, else_label);
+            }
+            break;
+        }
+        // Loops test their condition at the bottom, with a guard ahead of
+        // while and for loops, so that each iteration takes one branch
+        case NODE_WHILE: {
+            int top = new_label(gen);
+            int next = new_label(gen);
+            int end = new_label(gen);
+            generate_condition(gen, stmt->as.while_stmt.condition, false, end);
+            emit_label(gen, top);
+            generate_loop_body(gen, stmt->as.while_stmt.body, end, next);
+            emit_label(gen, next);
+            generate_condition(gen, stmt->as.while_stmt.condition, true, top);
+            emit_label(gen, end);
+            break;
+        }
+        case NODE_DO_WHILE: {
+            int top = new_label(gen);
+            int next = new_label(gen);
+            int end = new_label(gen);
+            emit_label(gen, top);
+            generate_loop_body(gen, stmt->as.while_stmt.body, end, next);
+            emit_label(gen, next);
+            generate_condition(gen, stmt->as.while_stmt.condition, true, top);
+            emit_label(gen, end);
+            break;
+        }
+        case NODE_FOR: {
+            LocalVar* mark = gen->locals;
+            int top = new_label(gen);
+            int next = new_label(gen);
+            int end = new_label(gen);
+            Expression* condition = stmt->as.for_stmt.condition;
+            generate_statement(gen, stmt->as.for_stmt.initializer);
+            if (condition != NULL) generate_condition(gen, condition, false, end);
+            emit_label(gen, top);
+            generate_loop_body(gen, stmt->as.for_stmt.body, end, next);
+            emit_label(gen, next);
+            generate_statement(gen, stmt->as.for_stmt.increment);
+            if (condition != NULL) {
+                generate_condition(gen, condition, true, top);
+            } else {
+                emit_jump(gen, top);
+            }
+            emit_label(gen, end);
+            pop_locals(gen, mark);
+            break;
+        }
+        case NODE_BREAK:
+            emit_jump(gen, gen->break_label);
+            break;
+        case NODE_CONTINUE:
+            emit_jump(gen, gen->continue_label);
+            break;
+        case NODE_FUNCTION:
+            // Block-scope prototypes need no code
             break;
         default:
             break;
     }
 }
 
-void generate_expression(CodeGenerator* gen, Expression* expr) {
-    switch (expr->type) {
-        case NODE_LITERAL:
-            if (expr->token->type == TOKEN_INTEGER_LITERAL) {
-                fprintf(gen->output, "    mov r1, #%s\n", expr->token->lexeme);
+// Code generation functions. The program is a preamble followed by one
+// independent fragment per top-level declaration, so fragments generated
+// separately can be spliced together into the same output.
+void generate_program(CodeGenerator* gen, Statement* program) {
+    collect_functions(gen, program);
+    analyze_call_sites(gen);
+    generate_preamble(gen);
+
+    if (program->type == NODE_COMPOUND) {
+        for (int i = 0; i < program->as.compound.count; i++) {
+            generate_toplevel(gen, program->as.compound.statements[i]);
+        }
+    } else {
+        generate_toplevel(gen, program);
+    }
+}
+
+void collect_functions(CodeGenerator* gen, Statement* stmt) {
+    if (stmt->type == NODE_COMPOUND) {
+        for (int i = 0; i < stmt->as.compound.count; i++) {
+            collect_functions(gen, stmt->as.compound.statements[i]);
+        }
+        return;
+    }
+    if (stmt->type != NODE_FUNCTION || stmt->as.function.body == NULL) return;
+    if (stmt->as.function.is_unreachable) return;
+    if (gen->function_count == gen->function_capacity) {
+        gen->function_capacity = gen->function_capacity ? gen->function_capacity * 2 : 16;
+        gen->functions = realloc(gen->functions, sizeof(Statement*) * gen->function_capacity);
+    }
+    gen->functions[gen->function_count++] = stmt;
+}
+
+void generate_preamble(CodeGenerator* gen) {
+    emit_item(gen, ITEM_SECTION, NULL, SECTION_NOTE_GNU_STACK);
+}
+
+// A function as its calls see it, then the clones made for the constants
+// some of them pass
+static void generate_definition(CodeGenerator* gen, Statement* func_def) {
+    int index = -1;
+    for (int i = 0; i < gen->function_count && index < 0; i++) {
+        if (gen->functions[i] == func_def) index = i;
+    }
+
+    gen->specialization = NULL;
+    for (int i = 0; i < gen->specialization_count; i++) {
+        Specialization* spec = &gen->specializations[i];
+        if (spec->function == index && !spec->is_clone) gen->specialization = spec;
+    }
+    generate_function(gen, func_def);
+    for (int i = 0; i < gen->specialization_count; i++) {
+        Specialization* spec = &gen->specializations[i];
+        if (spec->function != index || !spec->is_clone) continue;
+        gen->specialization = spec;
+        generate_function(gen, func_def);
+    }
+    gen->specialization = NULL;
+}
+
+void generate_toplevel(CodeGenerator* gen, Statement* stmt) {
+    switch (stmt->type) {
+        case NODE_FUNCTION:
+            if (stmt->as.function.body != NULL && !stmt->as.function.is_unreachable) {
+                generate_definition(gen, stmt);
             }
             break;
-        case NODE_BINARY_OP:
-            generate_expression(gen, expr->as.binary.left);
-            // Save left result
-            fprintf(gen->output, "    push {r1}\n");
-            generate_expression(gen, expr->as.binary.right);
-            // Restore left result to r2
-            fprintf(gen->output, "    pop {r2}\n");
-            
-            // Perform operation
-            switch (expr->token->type) {
-                case TOKEN_PLUS:
-                    fprintf(gen->output, "    add r1, r2, r1\n");
-                    break;
-                case TOKEN_MINUS:
-                    fprintf(gen->output, "    sub r1, r2, r1\n");
-                    break;
-                case TOKEN_STAR:
-                    fprintf(gen->output, "    mul r1, r2, r1\n");
-                    break;
-                default:
-                    break;
+        case NODE_DECLARATION:
+            if (!stmt->as.declaration.is_unreachable) generate_global(gen, stmt);
+            break;
+        case NODE_COMPOUND:
+            for (int i = 0; i < stmt->as.compound.count; i++) {
+                generate_toplevel(gen, stmt->as.compound.statements[i]);
             }
             break;
         default:
             break;
     }
-}
\ No newline at end of file
+}
+
+void generate_global(CodeGenerator* gen, Statement* decl) {
+    if (decl->as.declaration.is_extern) return;
+
+    char* name = decl->as.declaration.name->lexeme;
+    Type* type = decl->as.declaration.var_type;
+    Expression* initializer = decl->as.declaration.initializer;
+    int size = type_size(type);
+    int align = type->kind == TYPE_ARRAY ? (size >= 16 ? 16 : 8) : size;
+
+    long long value = 0;
+    bool is_string = initializer != NULL && initializer->token->type == TOKEN_STRING_LITERAL;
+    if (initializer != NULL && !is_string) {
+        Expression* literal = initializer->type == NODE_UNARY_OP ? initializer->as.unary.operand : initializer;
+        value = literal->token->value.int_value;
+        if (initializer->type == NODE_UNARY_OP) value = -value;
+    }
+
+    emit_item(gen, ITEM_SECTION, NULL, value != 0 || is_string ? SECTION_DATA : SECTION_BSS);
+    if (!decl->as.declaration.is_static) emit_item(gen, ITEM_GLOBAL, name, 0);
+    emit_item(gen, ITEM_TYPE, name, 0);
+    emit_item(gen, ITEM_SIZE, name, size);
+    emit_item(gen, ITEM_ALIGN, NULL, align);
+    emit_item(gen, ITEM_SYMBOL, name, 0);
+    if (is_string) {
+        AsmItem* item = emit_item(gen, ITEM_DATA, NULL, 0);
+        item->size = 8;
+        item->operand = operand_string(name, 0);
+        emit_item(gen, ITEM_SECTION, NULL, SECTION_RODATA);
+        emit_string_data(gen, name, 0, initializer->token);
+    } else if (value == 0) {
+        emit_item(gen, ITEM_ZERO, NULL, size);
+    } else {
+        emit_item(gen, ITEM_DATA, NULL, value)->size = size;
+    }
+}
+
+// Frame setup, once the body has determined the frame size and which
+// callee-saved registers it uses. Their slots go below the locals.
+void emit_prologue(CodeGenerator* gen) {
+    gen->current_stack_offset = (gen->current_stack_offset + 7) / 8 * 8;
+    for (int reg = 0; reg < 16; reg++) {
+        if (is_callee_saved(reg) && gen->registers[reg].is_dirty) {
+            gen->current_stack_offset += 8;
+            gen->saved_offsets[reg] = -gen->current_stack_offset;
+        }
+    }
+    gen->frame_size = (gen->current_stack_offset + 15) / 16 * 16;
+
+    emit_unary(gen, X86_PUSH, reg64(REG_RBP));
+    emit(gen, X86_MOV, reg64(REG_RSP), reg64(REG_RBP));
+    if (gen->frame_size > 0) emit(gen, X86_SUB, operand_immediate(gen->frame_size), reg64(REG_RSP));
+    for (int reg = 0; reg < 16; reg++) {
+        if (is_callee_saved(reg) && gen->registers[reg].is_dirty) {
+            emit(gen, X86_MOV, reg64(reg), operand_memory(REG_RBP, gen->saved_offsets[reg], 8));
+        }
+    }
+}
+
+// Frame teardown, ahead of the return or of a tail call
+static void emit_frame_exit(CodeGenerator* gen) {
+    for (int reg = 0; reg < 16; reg++) {
+        if (is_callee_saved(reg) && gen->registers[reg].is_dirty) {
+            emit(gen, X86_MOV, operand_memory(REG_RBP, gen->saved_offsets[reg], 8), reg64(reg));
+        }
+    }
+    // Leaving the upper halves of the AVX registers dirty slows down the
+    // SSE code of the caller
+    if (gen->has_wide_vectors) emit_unary(gen, X86_VZEROUPPER, no_operand);
+    emit_unary(gen, X86_LEAVE, no_operand);
+}
+
+void emit_epilogue(CodeGenerator* gen) {
+    emit_frame_exit(gen);
+    emit_unary(gen, X86_RET, no_operand);
+}
+
+// The allocated body, each tail call preceded by the frame teardown
+static void emit_body(CodeGenerator* gen) {
+    for (int i = 0; i < gen->body.count; i++) {
+        const AsmItem* item = &gen->body.items[i];
+        if (item->kind == ITEM_INSTRUCTION && minst_is_tail_call(&item->inst)) emit_frame_exit(gen);
+        *asm_list_add(gen->out, item->kind) = *item;
+    }
+}
+
+// Parameters and statements of a function, straight from the AST
+static void generate_body(CodeGenerator* gen, Statement* func_def) {
+    Type* type = func_def->as.function.type;
+
+    // Parameters: register arguments are moved into their variables, stack
+    // arguments stay where the caller put them
+    for (int i = 0; i < func_def->as.function.param_count; i++) {
+        Type* param_type = type->info.func.param_types[i];
+        char* param_name = func_def->as.function.params[i]->lexeme;
+        if (i < 6) {
+            LocalVar* local = declare_local(gen, param_name, param_type);
+            store(gen, argument_registers[i], param_type, local_address(local));
+        } else {
+            LocalVar* local = malloc(sizeof(LocalVar));
+            local->name = param_name;
+            local->type = param_type;
+            local->offset = 16 + 8 * (i - 6);
+            local->next = gen->locals;
+            gen->locals = local;
+        }
+    }
+
+    Statement* body = func_def->as.function.body;
+    for (int i = 0; i < body->as.compound.count; i++) {
+        generate_statement(gen, body->as.compound.statements[i]);
+    }
+    // Falling off the end of main returns 0
+    if (strcmp(func_def->as.function.name->lexeme, "main") == 0) {
+        emit(gen, X86_XOR, reg32(REG_RAX), reg32(REG_RAX));
+    }
+}
+
+void generate_function(CodeGenerator* gen, Statement* func_def) {
+    const Specialization* spec = gen->specialization;
+    const char* name = spec != NULL ? spec->name : func_def->as.function.name->lexeme;
+    Type* type = func_def->as.function.type;
+
+    gen->function_name = name;
+    gen->return_type = type->info.func.return_type;
+    gen->current_stack_offset = 0;
+    gen->label_counter = 0;
+    gen->push_depth = 0;
+    gen->string_count = 0;
+    gen->vreg_count = 0;
+    gen->has_wide_vectors = false;
+    for (int i = 0; i < 16; i++) gen->registers[i].is_dirty = false;
+
+    // The body is generated first with virtual registers, since the frame
+    // size and the saved registers are only known after allocation
+    gen->body.count = 0;
+    gen->stubs.count = 0;
+    gen->out = &gen->body;
+
+    if (gen->optimize) {
+        // Through the SSA form of its control-flow graph
+        build_basic_blocks(gen, func_def);
+        analyze_control_flow(gen);
+        build_ir(gen, func_def);
+        promote_locals(gen);
+        specialize_function(gen);
+        inline_calls(gen);
+        specialize_calls(gen);
+        eliminate_tail_recursion(gen);
+        propagate_constants(gen);
+        eliminate_dead_code(gen);
+        optimize_basic_blocks(gen);
+        hoist_loop_invariants(gen);
+        eliminate_common_subexpressions(gen);
+        reduce_induction_variables(gen);
+        eliminate_common_subexpressions(gen);
+        // The counters the new exit tests left unused go first
+        eliminate_dead_code(gen);
+        vectorize_loops(gen);
+        unroll_loops(gen);
+        eliminate_dead_code(gen);
+        mark_tail_calls(gen);
+        select_instructions(gen);
+        if (gen->schedule_instructions) schedule_instructions(gen);
+    } else {
+        generate_body(gen, func_def);
+    }
+    pop_locals(gen, NULL);
+    compute_live_ranges(gen);
+    allocate_registers(gen);
+    if (gen->optimize) peephole_optimization(gen);
+    gen->out = &gen->program;
+
+    emit_item(gen, ITEM_SECTION, NULL, SECTION_TEXT);
+    bool is_static = func_def->as.function.is_static || (spec != NULL && spec->is_clone);
+    if (!is_static) emit_item(gen, ITEM_GLOBAL, name, 0);
+    emit_item(gen, ITEM_TYPE, name, 1);
+    emit_item(gen, ITEM_SYMBOL, name, 0);
+    emit_prologue(gen);
+    emit_body(gen);
+    emit_label(gen, LABEL_RETURN);
+    emit_epilogue(gen);
+    asm_list_append(&gen->program, &gen->stubs);
+    emit_item(gen, ITEM_SIZE, name, -1);
+
+    if (gen->string_count > 0) {
+        emit_item(gen, ITEM_SECTION, NULL, SECTION_RODATA);
+        for (int i = 0; i < gen->string_count; i++) {
+            emit_string_data(gen, name, i, gen->strings[i]);
+        }
+    }
+}
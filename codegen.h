@@ -3,77 +3,273 @@
 
 #include <stdio.h>
 #include "ast.h"
+#include "x86.h"
 #include <stdbool.h>
 
-// Basic block structure for control flow analysis
+// How control leaves a basic block
+typedef enum {
+    EXIT_JUMP,               // To successors[0]
+    EXIT_BRANCH,             // On `condition`: successors[0] if true, else [1]
+    EXIT_RETURN              // Through `return_stmt`, or off the end when NULL
+} BlockExit;
+
+// Basic block of the control-flow graph of a function. Blocks are kept in
+// source order; each one lists the statements that begin in it, nested
+// statements belonging to the blocks they begin in.
 typedef struct BasicBlock {
-    int id;
+    int id;                  // Index in CodeGenerator.blocks
     Statement** statements;
     int statement_count;
+    int statement_capacity;
+    BlockExit exit;
+    Expression* condition;
+    Statement* return_stmt;
     struct BasicBlock** predecessors;
     int predecessor_count;
-    struct BasicBlock** successors;
+    int predecessor_capacity;
+    struct BasicBlock* successors[2];
     int successor_count;
     bool is_entry;
     bool is_exit;
+    bool is_epilogue;        // Loop finishing what a vectorized copy of it left
+
+    // Filled in by analyze_control_flow
+    int rpo;                 // Position in reverse post-order, -1 if unreachable
+    struct BasicBlock* idom; // Immediate dominator, NULL for the entry
+    struct BasicBlock** dominated;   // Children in the dominator tree
+    int dominated_count;
+    int loop_depth;          // Number of natural loops containing the block
+    bool is_loop_header;
+    struct Loop* loop;       // Innermost loop containing the block, or NULL
+    struct BasicBlock** frontier;    // Dominance frontier
+    int frontier_count;
+
+    // Instructions, when the function is compiled through the IR (ir.h)
+    struct IrInst* first;
+    struct IrInst* last;
 } BasicBlock;
 
-// Live range structure for register allocation
-typedef struct LiveRange {
-    char* var_name;
-    int start_block;
-    int end_block;
-    int reg;
-    struct LiveRange* next;
+// Natural loop of the control-flow graph, found by analyze_control_flow
+typedef struct Loop {
+    BasicBlock* header;
+    BasicBlock** blocks;     // The header first, then the rest of the body
+    int block_count;
+    int block_capacity;
+    struct Loop* parent;     // Innermost enclosing loop, or NULL
+} Loop;
+
+// Live interval of a virtual register in the body of the current
+// function. Item k of the body reads its operands at position 2k and
+// writes its results at 2k + 1.
+typedef struct {
+    int start;               // First position the value is live at, or -1
+    int end;
+    int reg;                 // Physical register, or -1 when spilled throughout
+    int split;               // The value moves to its slot from here on, or -1
+    int slot;                // Frame offset of the spill slot, 0 when none
+    long long weight;        // Uses and definitions, weighted by loop depth
 } LiveRange;
 
-// Register descriptor
+// Register descriptor; is_dirty marks registers written by the current
+// function, so the callee-saved ones among them get saved
 typedef struct {
-    bool is_available;
-    char* current_var;
     bool is_dirty;
 } Register;
 
+// Local variable or parameter in the current function's frame
+typedef struct LocalVar {
+    char* name;
+    Type* type;              // Borrowed from the declaration
+    int offset;              // From %rbp
+    struct LocalVar* next;   // Previously declared locals
+} LocalVar;
+
+// Loop bodies are unrolled four times unless told otherwise
+#define DEFAULT_UNROLL_FACTOR 4
+
+// Loops are vectorized four int lanes at a time, on SSE2, unless told
+// otherwise
+#define DEFAULT_VECTOR_WIDTH 4
+
+// Code for a function of CodeGenerator.functions with some parameters
+// bound to constants, decided by analyze_call_sites: the function itself
+// when every call passes the same values, or a static clone of it that
+// the calls passing these values are redirected to
+typedef struct {
+    const char* name;        // Symbol of the code; owned by the generator for clones
+    int function;            // Index in CodeGenerator.functions
+    long long* values;       // By parameter, for those is_bound marks
+    bool* is_bound;
+    bool is_clone;
+} Specialization;
+
 // Code generator state
 typedef struct {
-    FILE* output;
-    BasicBlock** blocks;
+    FILE* output;            // Receives the assembly in codegen_flush; may be NULL
+    AsmList program;         // Everything generated so far
+    AsmList body;            // Body of the current function, before its prologue
+    AsmList* out;            // Where instructions currently go
+    AsmList stubs;           // Out-of-line code placed after the epilogue
+    BasicBlock** blocks;     // Control-flow graph of the current function
     int block_count;
-    LiveRange* live_ranges;
+    int block_capacity;
+    BasicBlock** rpo;        // Reachable blocks in reverse post-order
+    int rpo_count;
+    Loop** loops;            // Natural loops, each after those enclosing it
+    int loop_count;
+    int loop_capacity;
+    struct IrFunction* ir;   // IR of the current function when optimizing
+    LiveRange* live_ranges;  // Indexed by virtual register number
+    int vreg_count;
+    int vreg_capacity;
+    struct Liveness* liveness;   // Built by compute_live_ranges
     Register registers[16];  // x86_64 has 16 general purpose registers
-    int current_stack_offset;
+    int current_stack_offset;  // Bytes of locals in the current frame
     int label_counter;
     bool optimize;
+    int unroll_factor;       // Copies of a loop body unrolling may make; 1 turns it off
+    int vector_width;        // Int lanes of vectorized loops: 4 (SSE2), 8 (AVX2), 0 off
+    bool inline_functions;   // Replace calls to small functions by their bodies
+    Statement** functions;   // Definitions calls may be inlined from, borrowed from the AST
+    int function_count;
+    int function_capacity;
+    const char** inline_sources;   // Functions whose definitions inlining looked at
+    int inline_source_count;
+    int inline_source_capacity;
+    bool specialize_functions;   // Propagate constant arguments across calls, with clones
+    bool schedule_instructions;  // Reorder the selected instructions of each block
+    Specialization* specializations;   // From analyze_call_sites, in function order
+    int specialization_count;
+
+    // Current function
+    const char* function_name;
+    const Specialization* specialization;  // What it is generated for, or NULL
+    Type* return_type;
+    LocalVar* locals;
+    int push_depth;          // 8-byte values pushed below the frame
+    int break_label;
+    int continue_label;
+    Token** strings;         // String literals to emit after the function
+    int string_count;
+    int string_capacity;
+    int frame_size;
+    int saved_offsets[16];   // Frame slots of the callee-saved registers in use
+    int spill_count;         // Values of the current function kept in memory
+    int split_count;         // Values moved to memory partway through
+    bool has_wide_vectors;   // Uses the upper halves of the AVX registers
+
+    Emitter report;          // Per function: register allocation, then peephole hits
 } CodeGenerator;
 
 // Code generator interface functions
 CodeGenerator* codegen_init(FILE* output, bool optimize);
 void codegen_free(CodeGenerator* gen);
 
-// Basic block analysis
-void build_basic_blocks(CodeGenerator* gen, Statement* program);
+// Print the generated code as assembly, write it to the output with a
+// single write and start over
+bool codegen_flush(CodeGenerator* gen);
+
+// Hand the generated code to the caller as assembly text or as an ELF
+// relocatable object; the caller frees it. The generator starts over.
+// codegen_take_object returns NULL if an instruction cannot be encoded.
+char* codegen_take_output(CodeGenerator* gen, size_t* length);
+char* codegen_take_object(CodeGenerator* gen, size_t* length);
+
+// Control-flow graph (cfg.c). build_basic_blocks lowers the structured
+// statements of a function into basic blocks joined by edges, with
+// conditions folded when they are integer literals. analyze_control_flow
+// then orders the blocks, computes dominators with the algorithm of
+// Cooper, Harvey and Kennedy, dominance frontiers and the loop nest;
+// it can be run again whenever the graph changes.
+void build_basic_blocks(CodeGenerator* gen, Statement* function);
 void analyze_control_flow(CodeGenerator* gen);
+bool block_dominates(const BasicBlock* dominator, const BasicBlock* block);
+bool loop_contains(const Loop* loop, const BasicBlock* block);
+void free_basic_blocks(CodeGenerator* gen);
 
-// Register allocation
+// Graph editing. cfg_insert_block places a new block at `position` in
+// the block list and renumbers the blocks after it.
+BasicBlock* cfg_new_block(void);
+void cfg_insert_block(CodeGenerator* gen, int position, BasicBlock* block);
+void cfg_add_edge(BasicBlock* from, BasicBlock* to);
+void cfg_free_block(BasicBlock* block);
+
+// Register allocation (regalloc.c). The body of each function is first
+// generated with virtual registers from get_register. compute_live_ranges
+// then finds their live intervals, and allocate_registers assigns them
+// physical registers by linear scan, splitting or spilling intervals to
+// the frame under pressure, and rewrites the body accordingly.
+// allocation_cost runs the scan without rewriting anything and returns
+// twice the spills plus the splits it would make.
 void compute_live_ranges(CodeGenerator* gen);
+int allocation_cost(CodeGenerator* gen);
 void allocate_registers(CodeGenerator* gen);
-int get_register(CodeGenerator* gen, char* var_name);
-void free_register(CodeGenerator* gen, int reg);
+int get_register(CodeGenerator* gen);
 
-// Code generation
+// Code generation. generate_program emits the preamble and then each
+// top-level declaration through generate_toplevel. collect_functions
+// makes the function definitions of a top-level statement available for
+// inlining into the functions generated afterwards; generate_program
+// collects those of the whole program first. Functions and data that
+// mark_reachable found unreachable are neither collected nor generated.
 void generate_program(CodeGenerator* gen, Statement* program);
+void collect_functions(CodeGenerator* gen, Statement* stmt);
+void generate_preamble(CodeGenerator* gen);
+void generate_toplevel(CodeGenerator* gen, Statement* stmt);
 void generate_function(CodeGenerator* gen, Statement* func_def);
 void generate_statement(CodeGenerator* gen, Statement* stmt);
-void generate_expression(CodeGenerator* gen, Expression* expr);
+void generate_global(CodeGenerator* gen, Statement* decl);
+
+// Interprocedural constant propagation (ipcp.c). When optimizing,
+// analyze_call_sites looks at what the calls among the collected
+// functions pass before any of them is generated, and decides
+// gen->specializations; generate_program runs it.
+// call_site_hash sums up what it decided for the function `name`, 0 for
+// nothing, so that watch mode knows which code to generate again.
+void analyze_call_sites(CodeGenerator* gen);
+unsigned long long call_site_hash(const CodeGenerator* gen, const char* name);
+void free_call_sites(CodeGenerator* gen);
+
+// Evaluate an expression into a fresh virtual register, or -1 for void
+// values
+int generate_expression(CodeGenerator* gen, Expression* expr);
 
-// Optimization functions
+// Optimization functions. With optimization, functions are compiled
+// through the SSA form of ir.h: optimize_basic_blocks merges and
+// threads blocks of its CFG and turns branches that only choose values
+// into selects, and eliminate_dead_code removes
+// computations and branches nothing observable depends on (ssa.c).
+// peephole_optimization then rewrites the allocated body with a table of
+// local patterns until none applies, reporting the hits of each
+// (peephole.c).
 void optimize_basic_blocks(CodeGenerator* gen);
 void eliminate_dead_code(CodeGenerator* gen);
 void peephole_optimization(CodeGenerator* gen);
 
-// Assembly generation helpers
+// Instruction scheduling (schedule.c). schedule_instructions reorders the
+// selected instructions between labels, jumps and calls, before register
+// allocation, so that long-latency ones start early and the issue ports
+// stay busy.
+void schedule_instructions(CodeGenerator* gen);
+
+// Helpers shared by the AST code generator and the IR builder.
+// Integers narrower than int are held as sign- or zero-extended 32-bit
+// values; long and pointers use all 64 bits.
+bool is_wide(const Type* type);
+bool is_unsigned_type(const Type* type);
+const Type* promoted(const Type* type);
+const Type* operation_type(const Type* left, const Type* right);
+bool narrows(const Type* from, const Type* to);
+int element_size(const Type* pointer);
+bool is_comparison(TokenType op);
+ConditionCode condition_code(TokenType op, bool is_unsigned);
+TokenType compound_operator(TokenType op);
+int add_string(CodeGenerator* gen, Token* token);
+
+// Assembly generation helpers. emit_instruction appends one instruction
+// to the current function.
 void emit_prologue(CodeGenerator* gen);
 void emit_epilogue(CodeGenerator* gen);
-void emit_instruction(CodeGenerator* gen, const char* format, ...);
+void emit_instruction(CodeGenerator* gen, const MInst* inst);
 
 #endif // CODEGEN_H
\ No newline at end of file
@@ -0,0 +1,501 @@
+#include "driver.h"
+#include "threadpool.h"
+#include "watch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+void driver_usage(const char* program) {
+    fprintf(stderr, "Usage: %s [-c] [-fno-integrated-as] [-funroll-factor=<N>] [-mavx2] [-fno-vectorize] [-fno-inline] [-fno-ipa-cp] [-fno-schedule-insns] [-o <output>] [-j<N>] [--cache] [--regalloc-stats] <source>...\n", program);
+    fprintf(stderr, "       %s --watch [-c] [-o <output>] <source>\n", program);
+    fprintf(stderr, "       %s --cache-stats [--cache-dir <dir>]\n", program);
+    fprintf(stderr, "       %s --server [--socket <path>]\n", program);
+    fprintf(stderr, "       %s --client [--socket <path>] <options>...\n", program);
+}
+
+// Read entire source file into memory
+static char* read_file(const char* filename, size_t* length) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) return NULL;
+
+    // Get file size
+    fseek(file, 0, SEEK_END);
+    size_t size = ftell(file);
+    rewind(file);
+
+    // Allocate buffer and read file
+    char* buffer = malloc(size + 1);
+    if (buffer == NULL) {
+        fclose(file);
+        return NULL;
+    }
+
+    size_t bytes_read = fread(buffer, 1, size, file);
+    fclose(file);
+    if (bytes_read < size) {
+        free(buffer);
+        return NULL;
+    }
+
+    buffer[bytes_read] = '\0';
+    *length = bytes_read;
+    return buffer;
+}
+
+static bool write_file(const char* filename, const char* data, size_t length) {
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL) return false;
+    size_t written = fwrite(data, 1, length, file);
+    return fclose(file) == 0 && written == length;
+}
+
+// Derive "name.<extension>" in the current directory from "dir/name.c"
+static char* default_output_name(const char* input, const char* extension) {
+    const char* base = strrchr(input, '/');
+    base = base ? base + 1 : input;
+
+    const char* dot = strrchr(base, '.');
+    size_t stem = dot ? (size_t)(dot - base) : strlen(base);
+
+    char* name = malloc(stem + strlen(extension) + 2);
+    memcpy(name, base, stem);
+    name[stem] = '.';
+    strcpy(name + stem + 1, extension);
+    return name;
+}
+
+// Run the system assembler over an in-memory assembly listing
+static char* run_assembler(const char* assembly, size_t length, size_t* object_length) {
+    char asm_file[] = "/tmp/c4-XXXXXX.s";
+    char object_file[] = "/tmp/c4-XXXXXX.o";
+    int asm_fd = mkstemps(asm_file, 2);
+    int object_fd = mkstemps(object_file, 2);
+    char* object = NULL;
+
+    if (asm_fd < 0 || object_fd < 0) goto cleanup;
+    if (write(asm_fd, assembly, length) != (ssize_t)length) goto cleanup;
+
+    char* argv[] = {"as", "-o", object_file, asm_file, NULL};
+    pid_t pid;
+    if (posix_spawnp(&pid, "as", NULL, NULL, argv, environ) != 0) goto cleanup;
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0) goto cleanup;
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        object = read_file(object_file, object_length);
+    }
+
+cleanup:
+    if (asm_fd >= 0) {
+        close(asm_fd);
+        unlink(asm_file);
+    }
+    if (object_fd >= 0) {
+        close(object_fd);
+        unlink(object_file);
+    }
+    return object;
+}
+
+static void job_error(CompileJob* job, const char* format, const char* path) {
+    size_t length = strlen(format) + strlen(path);
+    job->diagnostics = realloc(job->diagnostics, job->diagnostics_length + length + 1);
+    job->diagnostics_length += sprintf(job->diagnostics + job->diagnostics_length, format, path);
+    job->failed = true;
+}
+
+// Option handling
+bool driver_parse_options(int argc, char* argv[], DriverOptions* options) {
+    options->inputs = malloc(sizeof(char*) * (argc + 1));
+    options->input_count = 0;
+    options->output_file = NULL;
+    options->assemble = false;
+    options->integrated_as = true;
+    options->unroll_factor = 0;
+    options->vector_width = -1;
+    options->no_inline = false;
+    options->no_ipa_cp = false;
+    options->no_schedule = false;
+    options->jobs = 0;
+    options->use_cache = false;
+    options->cache_dir = NULL;
+    options->cache_size = 0;
+    options->cache_stats = false;
+    options->watch = false;
+    options->regalloc_stats = false;
+
+    for (int i = 1; i < argc; i++) {
+        char* arg = argv[i];
+        if (strcmp(arg, "-o") == 0) {
+            if (++i >= argc) return false;
+            options->output_file = argv[i];
+        } else if (strcmp(arg, "-c") == 0) {
+            options->assemble = true;
+        } else if (strcmp(arg, "-S") == 0) {
+            options->assemble = false;
+        } else if (strcmp(arg, "-fintegrated-as") == 0) {
+            options->integrated_as = true;
+        } else if (strcmp(arg, "-fno-integrated-as") == 0) {
+            options->integrated_as = false;
+        } else if (strncmp(arg, "-funroll-factor=", 16) == 0) {
+            options->unroll_factor = atoi(arg + 16);
+            if (options->unroll_factor < 1) return false;
+        } else if (strcmp(arg, "-mavx2") == 0) {
+            options->vector_width = 8;
+        } else if (strcmp(arg, "-fno-vectorize") == 0) {
+            options->vector_width = 0;
+        } else if (strcmp(arg, "-fno-inline") == 0) {
+            options->no_inline = true;
+        } else if (strcmp(arg, "-fno-ipa-cp") == 0) {
+            options->no_ipa_cp = true;
+        } else if (strcmp(arg, "-fno-schedule-insns") == 0) {
+            options->no_schedule = true;
+        } else if (strncmp(arg, "-j", 2) == 0) {
+            char* count = arg[2] ? arg + 2 : (++i < argc ? argv[i] : NULL);
+            if (count == NULL) return false;
+            options->jobs = atoi(count);
+            if (options->jobs < 1) return false;
+        } else if (strcmp(arg, "--cache") == 0) {
+            options->use_cache = true;
+        } else if (strcmp(arg, "--cache-dir") == 0) {
+            if (++i >= argc) return false;
+            options->use_cache = true;
+            options->cache_dir = argv[i];
+        } else if (strcmp(arg, "--cache-size") == 0) {
+            if (++i >= argc) return false;
+            options->cache_size = cache_parse_size(argv[i]);
+            if (options->cache_size == 0) return false;
+        } else if (strcmp(arg, "--cache-stats") == 0) {
+            options->cache_stats = true;
+        } else if (strcmp(arg, "--watch") == 0) {
+            options->watch = true;
+        } else if (strcmp(arg, "--regalloc-stats") == 0) {
+            options->regalloc_stats = true;
+        } else if (arg[0] == '-' && arg[1] != '\0') {
+            fprintf(stderr, "Unknown option '%s'\n", arg);
+            return false;
+        } else {
+            options->inputs[options->input_count++] = arg;
+        }
+    }
+
+    if (options->input_count == 0) return options->cache_stats && !options->watch;
+    if (options->watch && options->input_count > 1) {
+        fprintf(stderr, "--watch takes a single input file\n");
+        return false;
+    }
+    if (options->output_file && options->input_count > 1) {
+        fprintf(stderr, "Cannot specify -o with multiple input files\n");
+        return false;
+    }
+    return true;
+}
+
+void driver_free_options(DriverOptions* options) {
+    free(options->inputs);
+    options->inputs = NULL;
+}
+
+CompileCache* driver_open_cache(const DriverOptions* options) {
+    if (!options->use_cache && !options->cache_stats) return NULL;
+    CompileCache* cache = cache_open(options->cache_dir, options->cache_size);
+    if (cache == NULL) {
+        fprintf(stderr, "warning: compilation cache unavailable, compiling without it\n");
+    }
+    return cache;
+}
+
+// Cache key: compiler identity, output kind, code-affecting options and
+// the source bytes
+static void compute_cache_key(const CompileJob* job, const C4Options* options,
+                              const char* source, size_t length,
+                              char key[CACHE_KEY_LENGTH + 1]) {
+    char fingerprint[256];
+    c4_options_fingerprint(options, fingerprint, sizeof(fingerprint));
+
+    CacheHasher hasher;
+    cache_hasher_init(&hasher);
+    cache_hasher_add_string(&hasher, "c4");
+    cache_hasher_add_string(&hasher, c4_version());
+    cache_hasher_add_string(&hasher, job->options->assemble ? "object" : "assembly");
+    cache_hasher_add_string(&hasher, fingerprint);
+    cache_hasher_update(&hasher, &length, sizeof(length));
+    cache_hasher_update(&hasher, source, length);
+    cache_hasher_finish(&hasher, key);
+}
+
+// Jobs
+CompileJob* driver_create_jobs(const DriverOptions* options, CompileCache* cache) {
+    CompileJob* jobs = calloc(options->input_count, sizeof(CompileJob));
+    for (int i = 0; i < options->input_count; i++) {
+        jobs[i].options = options;
+        jobs[i].cache = cache;
+        jobs[i].input_file = options->inputs[i];
+        jobs[i].output_file = options->output_file
+            ? strdup(options->output_file)
+            : default_output_name(options->inputs[i], options->assemble ? "o" : "s");
+    }
+    return jobs;
+}
+
+void driver_free_jobs(CompileJob* jobs, int count) {
+    for (int i = 0; i < count; i++) {
+        free(jobs[i].output_file);
+        free(jobs[i].output);
+        free(jobs[i].diagnostics);
+    }
+    free(jobs);
+}
+
+// Library options for compiling one input as the command line asks
+static void compile_options(const DriverOptions* driver, const char* filename, C4Options* options) {
+    c4_options_init(options);
+    options->filename = filename;
+    options->object = driver->assemble && driver->integrated_as;
+    if (driver->unroll_factor > 0) options->unroll_factor = driver->unroll_factor;
+    if (driver->vector_width >= 0) options->vector_width = driver->vector_width;
+    if (driver->no_inline) options->inline_functions = false;
+    if (driver->no_ipa_cp) options->specialize_functions = false;
+    if (driver->no_schedule) options->schedule_instructions = false;
+}
+
+void driver_run_job(C4Context* ctx, CompileJob* job, const char* base_dir, bool write_output) {
+    char* path = (char*)job->input_file;
+    if (base_dir != NULL && path[0] != '/') {
+        path = malloc(strlen(base_dir) + strlen(job->input_file) + 2);
+        sprintf(path, "%s/%s", base_dir, job->input_file);
+    }
+
+    size_t length;
+    char* source = read_file(path, &length);
+    if (path != job->input_file) free(path);
+    if (source == NULL) {
+        job_error(job, "Could not open file '%s'\n", job->input_file);
+        return;
+    }
+
+    C4Options options;
+    compile_options(job->options, job->input_file, &options);
+
+    char key[CACHE_KEY_LENGTH + 1];
+    if (job->cache != NULL && !job->options->regalloc_stats) {
+        compute_cache_key(job, &options, source, length, key);
+        job->output = cache_lookup(job->cache, key, &job->output_length);
+        if (job->output != NULL) {
+            free(source);
+            job->cache_hit = true;
+            goto write;
+        }
+    }
+
+    C4Result result;
+    bool ok = c4_compile(ctx, source, length, &options, &result);
+    free(source);
+
+    if (result.diagnostics_length > 0) {
+        job->diagnostics = malloc(result.diagnostics_length + 1);
+        memcpy(job->diagnostics, result.diagnostics, result.diagnostics_length + 1);
+        job->diagnostics_length = result.diagnostics_length;
+    }
+    if (!ok) {
+        job->failed = true;
+        return;
+    }
+    if (job->options->regalloc_stats) {
+        job->diagnostics = realloc(job->diagnostics, job->diagnostics_length + result.report_length + 1);
+        memcpy(job->diagnostics + job->diagnostics_length, result.report, result.report_length + 1);
+        job->diagnostics_length += result.report_length;
+    }
+
+    if (options.object) {
+        job->output = malloc(result.object_length);
+        memcpy(job->output, result.object, result.object_length);
+        job->output_length = result.object_length;
+    } else if (job->options->assemble) {
+        job->output = run_assembler(result.assembly, result.assembly_length, &job->output_length);
+        if (job->output == NULL) {
+            job_error(job, "Could not assemble '%s'\n", job->input_file);
+            return;
+        }
+    } else {
+        job->output = malloc(result.assembly_length);
+        memcpy(job->output, result.assembly, result.assembly_length);
+        job->output_length = result.assembly_length;
+    }
+
+    // Only successful, diagnostic-free compilations are cached
+    if (job->cache != NULL && result.diagnostics_length == 0) {
+        cache_store(job->cache, key, job->output, job->output_length);
+    }
+
+write:
+    if (write_output) {
+        if (!write_file(job->output_file, job->output, job->output_length)) {
+            job_error(job, "Could not create output file '%s'\n", job->output_file);
+        }
+        free(job->output);
+        job->output = NULL;
+        job->output_length = 0;
+    }
+}
+
+// Every local job gets its own context, so jobs never share state
+static void run_local_job(void* arg) {
+    CompileJob* job = arg;
+    C4Context* ctx = c4_context_new();
+    driver_run_job(ctx, job, NULL, true);
+    c4_context_free(ctx);
+}
+
+int driver_run(const DriverOptions* options) {
+    if (options->watch) return driver_watch(options);
+
+    CompileCache* cache = driver_open_cache(options);
+    if (options->cache_stats) {
+        if (cache != NULL) cache_print_stats(cache, stdout);
+        if (options->input_count == 0) {
+            cache_close(cache);
+            return cache != NULL ? 0 : 1;
+        }
+    }
+
+    CompileJob* jobs = driver_create_jobs(options, cache);
+
+    int workers = options->jobs ? options->jobs : threadpool_default_workers();
+    if (workers > options->input_count) workers = options->input_count;
+
+    if (workers <= 1) {
+        for (int i = 0; i < options->input_count; i++) run_local_job(&jobs[i]);
+    } else {
+        ThreadPool* pool = threadpool_init(workers);
+        for (int i = 0; i < options->input_count; i++) {
+            threadpool_submit(pool, run_local_job, &jobs[i]);
+        }
+        threadpool_wait(pool);
+        threadpool_free(pool);
+    }
+
+    int status = 0;
+    for (int i = 0; i < options->input_count; i++) {
+        fwrite(jobs[i].diagnostics, 1, jobs[i].diagnostics_length, stderr);
+        if (jobs[i].failed) status = 1;
+    }
+    driver_free_jobs(jobs, options->input_count);
+    cache_close(cache);
+    return status;
+}
+
+// Replace a file atomically so readers never see a partial output
+static bool replace_file(const char* filename, const char* data, size_t length) {
+    size_t size = strlen(filename) + 16;
+    char* temp = malloc(size);
+    snprintf(temp, size, "%s.tmp%d", filename, (int)getpid());
+    bool ok = write_file(temp, data, length) && rename(temp, filename) == 0;
+    if (!ok) unlink(temp);
+    free(temp);
+    return ok;
+}
+
+static double elapsed_ms(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+int driver_watch(const DriverOptions* options) {
+    const char* input = options->inputs[0];
+    char* output = options->output_file ? strdup(options->output_file)
+                                        : default_output_name(input, options->assemble ? "o" : "s");
+
+    C4Options compile;
+    compile_options(options, input, &compile);
+    WatchState state;
+    watch_init(&state, input, compile.optimize);
+    state.unroll_factor = compile.unroll_factor;
+    state.vector_width = compile.vector_width;
+    state.inline_functions = compile.inline_functions;
+    state.specialize_functions = compile.specialize_functions;
+    state.schedule_instructions = compile.schedule_instructions;
+
+    // The watch state splices assembly text; objects come from the
+    // library's encoder as in a normal build, unless -fno-integrated-as
+    C4Context* ctx = compile.object ? c4_context_new() : NULL;
+
+    struct stat last = {0};
+    bool first = true;
+    for (;;) {
+        struct stat info;
+        if (stat(input, &info) != 0) {
+            if (first) {
+                fprintf(stderr, "Could not open file '%s'\n", input);
+                break;
+            }
+            usleep(100 * 1000);
+            continue;
+        }
+        if (!first && info.st_mtim.tv_sec == last.st_mtim.tv_sec &&
+            info.st_mtim.tv_nsec == last.st_mtim.tv_nsec && info.st_size == last.st_size) {
+            usleep(100 * 1000);
+            continue;
+        }
+        last = info;
+        first = false;
+
+        size_t length;
+        char* source = read_file(input, &length);
+        if (source == NULL) continue;
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        bool ok = watch_update(&state, source, length, stderr);
+        if (!ok) {
+            fprintf(stderr, "c4: %s has errors, keeping the previous output\n", input);
+            free(source);
+            continue;
+        }
+
+        char* data = state.output;
+        size_t data_length = state.output_length;
+        char* object = NULL;
+        if (compile.object) {
+            C4Result result;
+            ok = c4_compile(ctx, source, length, &compile, &result);
+            if (!ok) {
+                fwrite(result.diagnostics, 1, result.diagnostics_length, stderr);
+                fprintf(stderr, "c4: could not encode '%s', keeping the previous output\n", input);
+                free(source);
+                continue;
+            }
+            data = (char*)result.object;
+            data_length = result.object_length;
+        } else if (options->assemble) {
+            object = run_assembler(data, data_length, &data_length);
+            if (object == NULL) {
+                fprintf(stderr, "c4: assembler failed for '%s'\n", input);
+                free(source);
+                continue;
+            }
+            data = object;
+        }
+        if (!replace_file(output, data, data_length)) {
+            fprintf(stderr, "Could not write file '%s'\n", output);
+        }
+        free(object);
+        free(source);
+
+        fprintf(stderr, "c4: recompiled %d of %d declarations in %.1f ms\n",
+                state.recompiled, state.decl_count, elapsed_ms(&start));
+    }
+
+    watch_free(&state);
+    c4_context_free(ctx);
+    free(output);
+    return 1;
+}
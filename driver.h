@@ -0,0 +1,69 @@
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include "c4.h"
+#include "cache.h"
+#include <stddef.h>
+#include <stdbool.h>
+
+// Command-line options shared (read-only) by every compilation job
+typedef struct {
+    char** inputs;
+    int input_count;
+    char* output_file;   // -o, only valid with a single input
+    bool assemble;       // -c: produce an object file instead of assembly
+    bool integrated_as;  // Encode objects directly; -fno-integrated-as runs `as`
+    int unroll_factor;   // -funroll-factor=N, 0 for the default
+    int vector_width;    // 8 for -mavx2, 0 for -fno-vectorize, -1 for the default
+    bool no_inline;      // -fno-inline
+    bool no_ipa_cp;      // -fno-ipa-cp
+    bool no_schedule;    // -fno-schedule-insns
+    int jobs;            // -jN, 0 means one worker per online CPU
+    bool use_cache;      // --cache
+    char* cache_dir;     // --cache-dir, NULL for the default location
+    unsigned long long cache_size;   // --cache-size, 0 for the default
+    bool cache_stats;    // --cache-stats
+    bool watch;          // --watch: recompile the single input whenever it changes
+    bool regalloc_stats; // --regalloc-stats: report spills per function, bypassing the cache
+} DriverOptions;
+
+// One input file and everything its compilation produced
+typedef struct {
+    const DriverOptions* options;
+    const char* input_file;    // As given on the command line
+    char* output_file;
+    CompileCache* cache;       // NULL when caching is off
+    bool cache_hit;
+    char* output;              // Output bytes, unless already written to disk
+    size_t output_length;
+    char* diagnostics;
+    size_t diagnostics_length;
+    bool failed;
+} CompileJob;
+
+// Option handling
+bool driver_parse_options(int argc, char* argv[], DriverOptions* options);
+void driver_free_options(DriverOptions* options);
+void driver_usage(const char* program);
+
+// Open the compilation cache if the options ask for one
+CompileCache* driver_open_cache(const DriverOptions* options);
+
+// Jobs
+CompileJob* driver_create_jobs(const DriverOptions* options, CompileCache* cache);
+void driver_free_jobs(CompileJob* jobs, int count);
+
+// Compile one job with the given context. Relative input paths are resolved
+// against `base_dir` when it is not NULL. With `write_output` the result is
+// written to job->output_file instead of being kept in job->output.
+void driver_run_job(C4Context* ctx, CompileJob* job, const char* base_dir, bool write_output);
+
+// Compile every job locally, in parallel, and report diagnostics in order.
+// Returns the process exit status.
+int driver_run(const DriverOptions* options);
+
+// Watch the single input and recompile it incrementally on every change.
+// Only returns if the input cannot be read at startup.
+int driver_watch(const DriverOptions* options);
+
+#endif // DRIVER_H
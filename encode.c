@@ -0,0 +1,480 @@
+#include "encode.h"
+#include <string.h>
+
+static void put(Encoding* e, int byte) {
+    e->bytes[e->length++] = (unsigned char)byte;
+}
+
+static void put_value(Encoding* e, long long value, int size) {
+    for (int i = 0; i < size; i++) {
+        put(e, (int)((unsigned long long)value >> (8 * i)) & 0xff);
+    }
+}
+
+static bool fits_int8(long long value) {
+    return value >= -128 && value <= 127;
+}
+
+static bool fits_int32(long long value) {
+    return value >= -2147483648LL && value <= 2147483647LL;
+}
+
+static bool is_memory(const Operand* operand) {
+    return operand->kind == OPERAND_MEMORY || operand->kind == OPERAND_SYMBOL ||
+           operand->kind == OPERAND_STRING;
+}
+
+static bool is_register(const Operand* operand) {
+    return operand->kind == OPERAND_REGISTER;
+}
+
+static bool is_vector(const Operand* operand) {
+    return operand->kind == OPERAND_VECTOR;
+}
+
+// Register operands, which the ModRM byte addresses directly
+static bool is_direct(const Operand* operand) {
+    return operand->kind == OPERAND_REGISTER || operand->kind == OPERAND_VECTOR;
+}
+
+static int base_register(const Operand* rm) {
+    return is_direct(rm) || rm->kind == OPERAND_MEMORY ? rm->reg : 0;
+}
+
+// ModRM byte with `reg` in the reg field and `rm` as the r/m operand,
+// followed by the SIB byte and displacement a memory operand needs
+static void put_modrm(Encoding* e, int reg, const Operand* rm) {
+    int base = base_register(rm);
+    reg &= 7;
+    if (is_direct(rm)) {
+        put(e, 0xc0 | reg << 3 | (base & 7));
+    } else if (rm->kind == OPERAND_MEMORY) {
+        long long displacement = rm->value;
+        int mod = displacement == 0 && (base & 7) != REG_RBP ? 0 : fits_int8(displacement) ? 1 : 2;
+        put(e, mod << 6 | reg << 3 | (base & 7));
+        if ((base & 7) == REG_RSP) put(e, 0x24);
+        if (mod == 1) put_value(e, displacement, 1);
+        if (mod == 2) put_value(e, displacement, 4);
+    } else {
+        // RIP-relative
+        put(e, reg << 3 | 0x05);
+        e->fixup_offset = e->length;
+        e->fixup_size = 4;
+        e->fixup = rm;
+        put_value(e, 0, 4);
+    }
+}
+
+// Prefixes, opcode and ModRM of an instruction with `reg` (a register or
+// an opcode extension) in the reg field and `rm` as the r/m operand.
+// `size` is the operation size; `byte_reg` marks reg as an 8-bit register.
+static void encode_modrm(Encoding* e, int size, const unsigned char* opcode, int opcode_length,
+                         int reg, bool byte_reg, const Operand* rm) {
+    if (size == 2) put(e, 0x66);
+
+    int base = base_register(rm);
+    int rex = 0;
+    if (size == 8) rex |= 0x48;
+    if (reg >= 8) rex |= 0x44;
+    if (base >= 8) rex |= 0x41;
+    // spl, bpl, sil and dil are only reachable with a REX prefix
+    if (byte_reg && reg >= 4 && reg < 8) rex |= 0x40;
+    if (is_register(rm) && rm->size == 1 && base >= 4 && base < 8) rex |= 0x40;
+    if (rex) put(e, rex);
+
+    for (int i = 0; i < opcode_length; i++) put(e, opcode[i]);
+    put_modrm(e, reg, rm);
+}
+
+static void encode_simple(Encoding* e, int size, int opcode, int reg, bool byte_reg, const Operand* rm) {
+    unsigned char byte = (unsigned char)opcode;
+    encode_modrm(e, size, &byte, 1, reg, byte_reg, rm);
+}
+
+static void encode_two_byte(Encoding* e, int size, int opcode, int reg, bool byte_reg, const Operand* rm) {
+    unsigned char bytes[2] = {0x0f, (unsigned char)opcode};
+    encode_modrm(e, size, bytes, 2, reg, byte_reg, rm);
+}
+
+// Opcode extension of the 0x81/0x83 group and base opcode of the
+// register forms
+static int alu_extension(X86Opcode opcode) {
+    switch (opcode) {
+        case X86_ADD: return 0;
+        case X86_OR: return 1;
+        case X86_AND: return 4;
+        case X86_SUB: return 5;
+        case X86_XOR: return 6;
+        default: return 7;  // cmp
+    }
+}
+
+static int shift_extension(X86Opcode opcode) {
+    return opcode == X86_SHL ? 4 : opcode == X86_SHR ? 5 : 7;
+}
+
+static bool encode_alu(Encoding* e, const MInst* inst, int size) {
+    const Operand* src = &inst->src;
+    const Operand* dst = &inst->dst;
+    int extension = alu_extension(inst->opcode);
+    bool byte = size == 1;
+
+    if (src->kind == OPERAND_IMMEDIATE) {
+        if (!fits_int32(src->value)) return false;
+        if (byte) {
+            encode_simple(e, size, 0x80, extension, false, dst);
+            put_value(e, src->value, 1);
+        } else if (fits_int8(src->value)) {
+            encode_simple(e, size, 0x83, extension, false, dst);
+            put_value(e, src->value, 1);
+        } else {
+            encode_simple(e, size, 0x81, extension, false, dst);
+            put_value(e, src->value, size == 2 ? 2 : 4);
+        }
+    } else if (is_register(src)) {
+        encode_simple(e, size, extension * 8 + (byte ? 0 : 1), src->reg, byte, dst);
+    } else if (is_register(dst)) {
+        encode_simple(e, size, extension * 8 + (byte ? 2 : 3), dst->reg, byte, src);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool encode_mov(Encoding* e, const MInst* inst, int size) {
+    const Operand* src = &inst->src;
+    const Operand* dst = &inst->dst;
+    bool byte = size == 1;
+
+    if (src->kind == OPERAND_IMMEDIATE) {
+        if (is_register(dst) && size <= 4) {
+            // mov $imm, %reg with the register in the opcode
+            if (size == 2) put(e, 0x66);
+            if (dst->reg >= 8 || (byte && dst->reg >= 4)) put(e, dst->reg >= 8 ? 0x41 : 0x40);
+            put(e, (byte ? 0xb0 : 0xb8) + (dst->reg & 7));
+            put_value(e, src->value, size);
+            return true;
+        }
+        if (!fits_int32(src->value)) return false;
+        encode_simple(e, size, byte ? 0xc6 : 0xc7, 0, false, dst);
+        put_value(e, src->value, size == 8 ? 4 : size);
+        return true;
+    }
+    if (is_register(src)) {
+        encode_simple(e, size, byte ? 0x88 : 0x89, src->reg, byte, dst);
+        return true;
+    }
+    if (is_register(dst)) {
+        encode_simple(e, size, byte ? 0x8a : 0x8b, dst->reg, byte, src);
+        return true;
+    }
+    return false;
+}
+
+// A vector instruction's mandatory prefix (0x66, 0xf3 or none), opcode
+// map (1 for 0f, 2 for 0f 38, 3 for 0f 3a) and opcode byte
+typedef struct {
+    int prefix;
+    int map;
+    int opcode;
+} VectorOpcode;
+
+// The legacy SSE form: the prefix, then REX, the escape bytes and the opcode
+static void encode_sse(Encoding* e, VectorOpcode op, int reg, const Operand* rm) {
+    if (op.prefix != 0) put(e, op.prefix);
+    unsigned char bytes[3] = {0x0f, op.map == 2 ? 0x38 : 0x3a, (unsigned char)op.opcode};
+    if (op.map == 1) bytes[1] = (unsigned char)op.opcode;
+    encode_modrm(e, 4, bytes, op.map == 1 ? 2 : 3, reg, false, rm);
+}
+
+// The VEX form, with `source` as the extra source register (VEX.vvvv,
+// 0 when unused) and 256-bit operands when `wide`. The two-byte prefix
+// serves when neither the 0f 38 and 0f 3a maps nor a high base is needed.
+static void encode_vex(Encoding* e, VectorOpcode op, bool wide, int reg, int source, const Operand* rm) {
+    int pp = op.prefix == 0x66 ? 1 : op.prefix == 0xf3 ? 2 : 0;
+    int inverted_r = reg < 8 ? 0x80 : 0;
+    int base = base_register(rm);
+    int tail = (~source & 15) << 3 | (wide ? 0x04 : 0) | pp;
+    if (op.map == 1 && base < 8) {
+        put(e, 0xc5);
+        put(e, inverted_r | tail);
+    } else {
+        put(e, 0xc4);
+        put(e, inverted_r | 0x40 | (base < 8 ? 0x20 : 0) | op.map);
+        put(e, tail);
+    }
+    put(e, op.opcode);
+    put_modrm(e, reg, rm);
+}
+
+static VectorOpcode vector_opcode(X86Opcode opcode) {
+    VectorOpcode op = {0x66, 1, 0};
+    switch (opcode) {
+        case X86_PADDD: op.opcode = 0xfe; break;
+        case X86_PSUBD: op.opcode = 0xfa; break;
+        case X86_PMULUDQ: op.opcode = 0xf4; break;
+        case X86_PAND: op.opcode = 0xdb; break;
+        case X86_POR: op.opcode = 0xeb; break;
+        case X86_PXOR: op.opcode = 0xef; break;
+        case X86_PCMPEQD: op.opcode = 0x76; break;
+        case X86_PUNPCKLDQ: op.opcode = 0x62; break;
+        case X86_PUNPCKLQDQ: op.opcode = 0x6c; break;
+        case X86_PSLLD: case X86_PSRLD: case X86_PSRAD: op.opcode = 0x72; break;
+        case X86_PSLLQ: case X86_PSRLQ: case X86_PSRLDQ: op.opcode = 0x73; break;
+        case X86_PMULLD: op.map = 2; op.opcode = 0x40; break;
+        case X86_VPBROADCASTD: op.map = 2; op.opcode = 0x58; break;
+        case X86_VEXTRACTI128: op.map = 3; op.opcode = 0x39; break;
+        default: break;
+    }
+    return op;
+}
+
+static int vector_shift_extension(X86Opcode opcode) {
+    switch (opcode) {
+        case X86_PSLLD: case X86_PSLLQ: return 6;
+        case X86_PSRAD: return 4;
+        case X86_PSRLDQ: return 3;
+        default: return 2;  // psrld, psrlq
+    }
+}
+
+static bool encode_vector(Encoding* e, const MInst* inst) {
+    const Operand* src = &inst->src;
+    const Operand* dst = &inst->dst;
+    VectorOpcode op = vector_opcode(inst->opcode);
+    bool wide = (is_vector(src) && src->size == 32) || (is_vector(dst) && dst->size == 32);
+    int reg;
+    int source = 0;
+    const Operand* rm;
+    long long immediate = -1;
+
+    switch (inst->opcode) {
+        case X86_MOVDQU:
+        case X86_MOVDQA:
+            op.prefix = inst->opcode == X86_MOVDQU ? 0xf3 : 0x66;
+            // Between registers, the store form keeps a high source out of
+            // the base field, where VEX would need its three-byte prefix
+            if (is_vector(dst) && !is_register(src) &&
+                !(minst_is_vex(inst) && is_vector(src) && src->reg >= 8 && dst->reg < 8)) {
+                op.opcode = 0x6f;
+                reg = dst->reg;
+                rm = src;
+            } else if (is_vector(src) && !is_register(dst)) {
+                op.opcode = 0x7f;
+                reg = src->reg;
+                rm = dst;
+            } else {
+                return false;
+            }
+            break;
+        case X86_MOVD:
+            wide = false;
+            if (is_vector(dst) && !is_vector(src) && src->size == 4) {
+                op.opcode = 0x6e;
+                reg = dst->reg;
+                rm = src;
+            } else if (is_vector(src) && !is_vector(dst) && dst->size == 4) {
+                op.opcode = 0x7e;
+                reg = src->reg;
+                rm = dst;
+            } else {
+                return false;
+            }
+            break;
+        case X86_PSLLD: case X86_PSRLD: case X86_PSRAD:
+        case X86_PSLLQ: case X86_PSRLQ: case X86_PSRLDQ:
+            if (src->kind != OPERAND_IMMEDIATE || !is_vector(dst)) return false;
+            reg = vector_shift_extension(inst->opcode);
+            source = dst->reg;
+            rm = dst;
+            immediate = src->value & 0xff;
+            break;
+        case X86_VPBROADCASTD:
+            if (!is_vector(dst) || is_register(src)) return false;
+            reg = dst->reg;
+            rm = src;
+            break;
+        case X86_VEXTRACTI128:
+            if (!is_vector(src) || !is_vector(dst)) return false;
+            wide = true;
+            reg = src->reg;
+            rm = dst;
+            immediate = 1;
+            break;
+        case X86_VZEROUPPER:
+            put(e, 0xc5);
+            put(e, 0xf8);
+            put(e, 0x77);
+            return true;
+        default:
+            // Lanewise operations on the destination
+            if (!is_vector(dst) || is_register(src) || src->kind == OPERAND_IMMEDIATE) return false;
+            reg = dst->reg;
+            source = dst->reg;
+            rm = src;
+            break;
+    }
+
+    if (minst_is_vex(inst)) {
+        encode_vex(e, op, wide, reg, minst_is_vex_rmw(inst) ? source : 0, rm);
+    } else {
+        encode_sse(e, op, reg, rm);
+    }
+    if (immediate >= 0) put_value(e, immediate, 1);
+    return true;
+}
+
+bool x86_encode(const MInst* inst, bool short_jump, Encoding* out) {
+    Encoding* e = out;
+    memset(e, 0, sizeof(Encoding));
+    e->fixup_offset = -1;
+
+    const Operand* src = &inst->src;
+    const Operand* dst = &inst->dst;
+    int size = minst_size(inst);
+
+    switch (inst->opcode) {
+        case X86_MOV:
+            return encode_mov(e, inst, size);
+        case X86_MOVABS:
+            if (!is_register(dst)) return false;
+            put(e, 0x48 | (dst->reg >= 8 ? 0x01 : 0));
+            put(e, 0xb8 + (dst->reg & 7));
+            put_value(e, src->value, 8);
+            return true;
+        case X86_MOVSX:
+            if (!is_register(dst)) return false;
+            if (src->size == 4) {
+                encode_simple(e, dst->size, 0x63, dst->reg, false, src);
+            } else {
+                encode_two_byte(e, dst->size, src->size == 1 ? 0xbe : 0xbf, dst->reg, false, src);
+            }
+            return true;
+        case X86_MOVZX:
+            if (!is_register(dst) || src->size == 4) return false;
+            encode_two_byte(e, dst->size, src->size == 1 ? 0xb6 : 0xb7, dst->reg, false, src);
+            return true;
+        case X86_LEA:
+            if (!is_memory(src) || !is_register(dst)) return false;
+            encode_simple(e, size, 0x8d, dst->reg, false, src);
+            return true;
+        case X86_ADD:
+        case X86_SUB:
+        case X86_AND:
+        case X86_OR:
+        case X86_XOR:
+        case X86_CMP:
+            return encode_alu(e, inst, size);
+        case X86_TEST:
+            if (src->kind == OPERAND_IMMEDIATE) {
+                encode_simple(e, size, size == 1 ? 0xf6 : 0xf7, 0, false, dst);
+                put_value(e, src->value, size == 1 ? 1 : size == 2 ? 2 : 4);
+            } else if (is_register(src)) {
+                encode_simple(e, size, size == 1 ? 0x84 : 0x85, src->reg, size == 1, dst);
+            } else {
+                return false;
+            }
+            return true;
+        case X86_IMUL:
+            if (!is_register(dst)) return false;
+            if (src->kind == OPERAND_IMMEDIATE) {
+                if (!fits_int32(src->value)) return false;
+                bool small = fits_int8(src->value);
+                encode_simple(e, size, small ? 0x6b : 0x69, dst->reg, false, dst);
+                put_value(e, src->value, small ? 1 : size == 2 ? 2 : 4);
+            } else {
+                encode_two_byte(e, size, 0xaf, dst->reg, false, src);
+            }
+            return true;
+        case X86_NEG:
+        case X86_NOT:
+        case X86_IDIV:
+        case X86_DIV:
+        case X86_MUL: {
+            int extension = inst->opcode == X86_NEG ? 3 : inst->opcode == X86_NOT ? 2 :
+                            inst->opcode == X86_IDIV ? 7 : inst->opcode == X86_DIV ? 6 : 4;
+            encode_simple(e, size, size == 1 ? 0xf6 : 0xf7, extension, false, dst);
+            return true;
+        }
+        case X86_SHL:
+        case X86_SHR:
+        case X86_SAR:
+            if (src->kind == OPERAND_IMMEDIATE) {
+                encode_simple(e, size, size == 1 ? 0xc0 : 0xc1, shift_extension(inst->opcode), false, dst);
+                put_value(e, src->value, 1);
+            } else if (is_register(src) && src->reg == REG_RCX) {
+                encode_simple(e, size, size == 1 ? 0xd2 : 0xd3, shift_extension(inst->opcode), false, dst);
+            } else {
+                return false;
+            }
+            return true;
+        case X86_CLTD:
+            put(e, 0x99);
+            return true;
+        case X86_CQTO:
+            put(e, 0x48);
+            put(e, 0x99);
+            return true;
+        case X86_SETCC:
+            encode_two_byte(e, 1, 0x90 + inst->cond, 0, false, dst);
+            return true;
+        case X86_CMOV:
+            if (!is_register(dst) || size < 4) return false;
+            encode_two_byte(e, size, 0x40 + inst->cond, dst->reg, false, src);
+            return true;
+        case X86_PUSH:
+        case X86_POP:
+            if (!is_register(dst)) {
+                // push and pop of a 64-bit memory operand need no REX.W
+                if (inst->opcode == X86_PUSH) {
+                    encode_simple(e, 4, 0xff, 6, false, dst);
+                } else {
+                    encode_simple(e, 4, 0x8f, 0, false, dst);
+                }
+                return true;
+            }
+            if (dst->reg >= 8) put(e, 0x41);
+            put(e, (inst->opcode == X86_PUSH ? 0x50 : 0x58) + (dst->reg & 7));
+            return true;
+        case X86_CALL:
+            if (dst->kind == OPERAND_SYMBOL) {
+                put(e, 0xe8);
+                e->fixup_offset = e->length;
+                e->fixup_size = 4;
+                e->fixup = dst;
+                put_value(e, 0, 4);
+            } else {
+                // Indirect calls always use 64-bit operands
+                encode_simple(e, 4, 0xff, 2, false, dst);
+            }
+            return true;
+        case X86_JMP:
+        case X86_JCC:
+            if (short_jump) {
+                put(e, inst->opcode == X86_JMP ? 0xeb : 0x70 + inst->cond);
+            } else if (inst->opcode == X86_JMP) {
+                put(e, 0xe9);
+            } else {
+                put(e, 0x0f);
+                put(e, 0x80 + inst->cond);
+            }
+            e->fixup_offset = e->length;
+            e->fixup_size = short_jump ? 1 : 4;
+            e->fixup = dst;
+            put_value(e, 0, e->fixup_size);
+            return true;
+        case X86_LEAVE:
+            put(e, 0xc9);
+            return true;
+        case X86_RET:
+            put(e, 0xc3);
+            return true;
+        case X86_MOVDQU: case X86_MOVDQA: case X86_MOVD: case X86_PADDD: case X86_PSUBD:
+        case X86_PMULLD: case X86_PMULUDQ: case X86_PAND: case X86_POR: case X86_PXOR:
+        case X86_PCMPEQD: case X86_PSLLD: case X86_PSRLD: case X86_PSRAD: case X86_PSLLQ:
+        case X86_PSRLQ: case X86_PSRLDQ: case X86_PUNPCKLDQ: case X86_PUNPCKLQDQ:
+        case X86_VPBROADCASTD: case X86_VEXTRACTI128: case X86_VZEROUPPER:
+            return encode_vector(e, inst);
+    }
+    return false;
+}
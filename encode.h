@@ -0,0 +1,21 @@
+#ifndef ENCODE_H
+#define ENCODE_H
+
+#include "x86.h"
+
+// Machine code of one instruction. A reference to a label, string or
+// symbol leaves a displacement field to be filled in by the caller.
+typedef struct {
+    unsigned char bytes[16];
+    int length;
+    int fixup_offset;           // Start of the displacement field, or -1
+    int fixup_size;             // 1 or 4 bytes
+    const Operand* fixup;       // What the field refers to
+} Encoding;
+
+// Encode an instruction. Jumps take an 8-bit displacement when
+// `short_jump` is set. Returns false for operand combinations the
+// encoder does not support.
+bool x86_encode(const MInst* inst, bool short_jump, Encoding* out);
+
+#endif // ENCODE_H
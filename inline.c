@@ -0,0 +1,341 @@
+#include "ir.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Inlining. A call to a function of gen->functions is replaced by the
+// callee's IR when the callee is small enough: its parameters become the
+// arguments, its frame variables join the caller's, and its returns jump
+// to the rest of the caller, where a phi joins the values returned.
+// Callees are expanded bottom-up, their own calls inlined and the result
+// cleaned up before it is measured and spliced in, so a chain of small
+// helpers collapses into its outermost caller and constant propagation
+// of the caller then specializes what it got. A function being expanded
+// is never inlined into itself, which stops recursion.
+
+// Instructions a callee may have, beyond what the call itself takes
+#define INLINE_BUDGET 24
+
+// Instructions a callee declared inline may have
+#define INLINE_KEYWORD_BUDGET 96
+
+// Added to the budget per constant argument, which the callee may fold
+#define INLINE_CONSTANT_BONUS 8
+
+// Instructions a function may grow to by inlining
+#define INLINE_GROWTH_LIMIT 2000
+
+// Functions being expanded at once, the caller included
+#define INLINE_DEPTH 8
+
+// Control-flow graph and IR of a function, so that a callee can be built
+// while its caller is set aside
+typedef struct {
+    BasicBlock** blocks;
+    int block_count;
+    int block_capacity;
+    BasicBlock** rpo;
+    int rpo_count;
+    Loop** loops;
+    int loop_count;
+    int loop_capacity;
+    IrFunction* ir;
+} FunctionState;
+
+typedef struct {
+    CodeGenerator* gen;
+    int* sizes;              // By function: size when last expanded, or -1
+    int stack[INLINE_DEPTH]; // Functions being expanded, the outermost first
+    int depth;
+} Inliner;
+
+static void swap_state(CodeGenerator* gen, FunctionState* state) {
+    FunctionState current = {gen->blocks, gen->block_count, gen->block_capacity, gen->rpo,
+                             gen->rpo_count, gen->loops, gen->loop_count, gen->loop_capacity, gen->ir};
+    gen->blocks = state->blocks;
+    gen->block_count = state->block_count;
+    gen->block_capacity = state->block_capacity;
+    gen->rpo = state->rpo;
+    gen->rpo_count = state->rpo_count;
+    gen->loops = state->loops;
+    gen->loop_count = state->loop_count;
+    gen->loop_capacity = state->loop_capacity;
+    gen->ir = state->ir;
+    *state = current;
+}
+
+// Free a function set aside. Once spliced, its blocks and values belong
+// to the caller and only the lists holding them go.
+static void free_state(CodeGenerator* gen, FunctionState* state, bool is_spliced) {
+    swap_state(gen, state);
+    if (is_spliced) {
+        gen->block_count = 0;
+        gen->ir->value_count = 0;
+    }
+    free_ir(gen);
+    free_basic_blocks(gen);
+    free(gen->blocks);
+    free(gen->rpo);
+    free(gen->loops);
+    // Back to the caller, which the swap left in `state`
+    FunctionState caller = *state;
+    memset(state, 0, sizeof(FunctionState));
+    swap_state(gen, &caller);
+}
+
+static int find_function(CodeGenerator* gen, const char* name) {
+    for (int i = 0; i < gen->function_count; i++) {
+        if (strcmp(gen->functions[i]->as.function.name->lexeme, name) == 0) return i;
+    }
+    return -1;
+}
+
+// Remembered for watch mode, which regenerates the callers of a function
+// whose body changed
+static void add_source(CodeGenerator* gen, const char* name) {
+    for (int i = 0; i < gen->inline_source_count; i++) {
+        if (gen->inline_sources[i] == name) return;
+    }
+    if (gen->inline_source_count == gen->inline_source_capacity) {
+        gen->inline_source_capacity = gen->inline_source_capacity ? gen->inline_source_capacity * 2 : 8;
+        gen->inline_sources = realloc(gen->inline_sources, sizeof(const char*) * gen->inline_source_capacity);
+    }
+    gen->inline_sources[gen->inline_source_count++] = name;
+}
+
+static bool is_expanding(Inliner* in, int function) {
+    for (int i = 0; i < in->depth; i++) {
+        if (in->stack[i] == function) return true;
+    }
+    return false;
+}
+
+int inline_budget(Statement* callee, int constant_count, bool in_loop) {
+    int budget = callee->as.function.is_inline ? INLINE_KEYWORD_BUDGET : INLINE_BUDGET;
+    budget += constant_count * INLINE_CONSTANT_BONUS;
+    if (in_loop) budget *= 2;
+    // The argument moves and the call go away
+    return budget + callee->as.function.param_count + 1;
+}
+
+static void inline_into(Inliner* in);
+
+// Build the IR of function `index` with its own calls inlined, leaving
+// the current function in place; returns its size
+static int expand(Inliner* in, int index, FunctionState* callee) {
+    CodeGenerator* gen = in->gen;
+    Statement* function = gen->functions[index];
+    memset(callee, 0, sizeof(FunctionState));
+    swap_state(gen, callee);
+    build_basic_blocks(gen, function);
+    analyze_control_flow(gen);
+    build_ir(gen, function);
+    promote_locals(gen);
+    in->stack[in->depth++] = index;
+    inline_into(in);
+    in->depth--;
+    eliminate_tail_recursion(gen);
+    propagate_constants(gen);
+    eliminate_dead_code(gen);
+    optimize_basic_blocks(gen);
+    int size = ir_size(gen);
+    swap_state(gen, callee);
+    return size;
+}
+
+static void adopt_value(IrFunction* fn, IrInst* inst) {
+    if (fn->value_count == fn->value_capacity) {
+        fn->value_capacity = fn->value_capacity ? fn->value_capacity * 2 : 64;
+        fn->values = realloc(fn->values, sizeof(IrInst*) * fn->value_capacity);
+    }
+    inst->id = fn->value_count;
+    fn->values[fn->value_count++] = inst;
+}
+
+static IrInst* resolve(IrInst** replacement, IrInst* value) {
+    while (replacement[value->id] != NULL) value = replacement[value->id];
+    return value;
+}
+
+// Replace `call` by the expanded callee. The call's block is split after
+// it; the callee's blocks go in between.
+static void splice(CodeGenerator* gen, IrInst* call, FunctionState* callee) {
+    IrFunction* fn = gen->ir;
+    IrFunction* inlined = callee->ir;
+    BasicBlock* block = call->block;
+
+    int local_base = fn->local_count;
+    for (int l = 0; l < inlined->local_count; l++) {
+        if (fn->local_count == fn->local_capacity) {
+            fn->local_capacity = fn->local_capacity ? fn->local_capacity * 2 : 16;
+            fn->locals = realloc(fn->locals, sizeof(IrLocal) * fn->local_capacity);
+        }
+        fn->locals[fn->local_count++] = inlined->locals[l];
+    }
+    for (int v = 0; v < inlined->value_count; v++) adopt_value(fn, inlined->values[v]);
+
+    // The rest of the caller's block, with its edges out
+    BasicBlock* rest = cfg_new_block();
+    while (call->next != NULL) {
+        IrInst* inst = call->next;
+        ir_remove(inst);
+        ir_append(rest, inst);
+    }
+    for (int s = 0; s < block->successor_count; s++) {
+        BasicBlock* successor = block->successors[s];
+        rest->successors[s] = successor;
+        for (int p = 0; p < successor->predecessor_count; p++) {
+            if (successor->predecessors[p] == block) successor->predecessors[p] = rest;
+        }
+    }
+    rest->successor_count = block->successor_count;
+    rest->is_exit = block->is_exit;
+    block->successor_count = 0;
+    block->is_exit = false;
+    ir_remove(call);
+    ir_append(block, ir_new(fn, IR_JUMP, IR_VOID));
+    cfg_add_edge(block, callee->blocks[0]);
+
+    IrInst** results = malloc(sizeof(IrInst*) * (callee->block_count + 1));
+    BasicBlock** returns = malloc(sizeof(BasicBlock*) * (callee->block_count + 1));
+    int return_count = 0;
+    for (int b = 0; b < callee->block_count; b++) {
+        BasicBlock* inlined_block = callee->blocks[b];
+        inlined_block->is_entry = false;
+        inlined_block->is_exit = false;
+        cfg_insert_block(gen, block->id + 1 + b, inlined_block);
+        for (IrInst* inst = inlined_block->first; inst != NULL; inst = inst->next) {
+            if (inst->op == IR_LOCAL) inst->value += local_base;
+            if (inst->op != IR_RETURN) continue;
+            results[return_count] = inst->operand_count > 0 ? inst->operands[0] : NULL;
+            returns[return_count++] = inlined_block;
+            inst->op = IR_JUMP;
+            inst->operand_count = 0;
+        }
+    }
+    cfg_insert_block(gen, block->id + 1 + callee->block_count, rest);
+    for (int r = 0; r < return_count; r++) cfg_add_edge(returns[r], rest);
+
+    // What the call returned: a value, or a phi of them in the order of
+    // the returns, which is that of the rest's predecessors
+    IrInst* result = NULL;
+    if (call->type != IR_VOID) {
+        if (return_count > 1) {
+            result = ir_new(fn, IR_PHI, call->type);
+            ir_insert_before(rest->first, result);
+        }
+        for (int r = 0; r < return_count; r++) {
+            IrInst* value = results[r];
+            if (value == NULL) {
+                value = ir_new(fn, IR_UNDEF, call->type);
+                ir_insert_before(ir_terminator(returns[r]), value);
+            }
+            if (return_count > 1) {
+                ir_add_operand(result, value);
+            } else {
+                result = value;
+            }
+        }
+        if (result == NULL) {
+            // Nothing returns, and the rest is unreachable
+            result = ir_new(fn, IR_UNDEF, call->type);
+            ir_insert_before(ir_terminator(block), result);
+        }
+    }
+
+    // The arguments stand for the parameters
+    IrInst** replacement = calloc(fn->value_count + 1, sizeof(IrInst*));
+    replacement[call->id] = result;
+    for (IrInst* inst = callee->blocks[0]->first; inst != NULL;) {
+        IrInst* next = inst->next;
+        if (inst->op == IR_PARAM) {
+            replacement[inst->id] = call->operands[inst->value];
+            ir_remove(inst);
+        }
+        inst = next;
+    }
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            for (int i = 0; i < inst->operand_count; i++) {
+                inst->operands[i] = resolve(replacement, inst->operands[i]);
+            }
+        }
+    }
+    free(replacement);
+    free(results);
+    free(returns);
+
+    ir_remove_unreachable_blocks(gen);
+    analyze_control_flow(gen);
+}
+
+// Inline the calls of the current function worth it
+static void inline_into(Inliner* in) {
+    CodeGenerator* gen = in->gen;
+
+    // The calls as the function was built; the callees spliced in have
+    // had theirs inlined already
+    int call_count = 0;
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            if (inst->op == IR_CALL && inst->symbol != NULL) call_count++;
+        }
+    }
+    if (call_count == 0) return;
+    IrInst** calls = malloc(sizeof(IrInst*) * call_count);
+    call_count = 0;
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            if (inst->op == IR_CALL && inst->symbol != NULL) calls[call_count++] = inst;
+        }
+    }
+
+    int size = ir_size(gen);
+    for (int c = 0; c < call_count; c++) {
+        IrInst* call = calls[c];
+        int index = find_function(gen, call->symbol);
+        if (index < 0) continue;
+        Statement* callee = gen->functions[index];
+        add_source(gen, callee->as.function.name->lexeme);
+        Type* type = callee->as.function.type;
+        if (in->depth == INLINE_DEPTH || is_expanding(in, index) || type->info.func.is_variadic ||
+            call->value != callee->as.function.param_count || call->operand_count != call->value) {
+            continue;
+        }
+        int constant_count = 0;
+        for (int i = 0; i < call->operand_count; i++) {
+            if (call->operands[i]->op == IR_CONST) constant_count++;
+        }
+        int budget = inline_budget(callee, constant_count, call->block->loop_depth > 0);
+        if (in->sizes[index] > budget || size + in->sizes[index] > INLINE_GROWTH_LIMIT) continue;
+
+        // Strings of a callee left out are not emitted
+        int string_count = gen->string_count;
+        FunctionState expanded;
+        int callee_size = expand(in, index, &expanded);
+        in->sizes[index] = callee_size;
+        if (callee_size > budget || size + callee_size > INLINE_GROWTH_LIMIT ||
+            expanded.blocks[0]->predecessor_count > 0) {
+            free_state(gen, &expanded, false);
+            gen->string_count = string_count;
+            continue;
+        }
+        splice(gen, call, &expanded);
+        free_state(gen, &expanded, true);
+        size += callee_size;
+    }
+    free(calls);
+}
+
+void inline_calls(CodeGenerator* gen) {
+    if (!gen->inline_functions || gen->function_count == 0) return;
+    Inliner in;
+    in.gen = gen;
+    in.sizes = malloc(sizeof(int) * gen->function_count);
+    for (int i = 0; i < gen->function_count; i++) in.sizes[i] = -1;
+    in.depth = 0;
+    // A clone is its original as far as recursion goes
+    int self = gen->specialization != NULL ? gen->specialization->function : find_function(gen, gen->ir->name);
+    if (self >= 0) in.stack[in.depth++] = self;
+    inline_into(&in);
+    free(in.sizes);
+}
@@ -0,0 +1,646 @@
+#include "ir.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Interprocedural constant propagation. Before any function is generated,
+// the calls among gen->functions are looked at for the arguments they
+// pass: literals, possibly negated or cast to types that hold them, and
+// parameters of the caller that are themselves always passed one value
+// and never changed. A parameter of a static function that every call
+// passes the same value gets bound to it, so that the function's own
+// constant propagation folds what depends on it. The values some calls
+// pass to the other parameters are tried on the IR of the function: when
+// constant propagation and dead-code elimination shrink it enough, a
+// static clone bound to them is generated next to it and those calls are
+// redirected there, within a budget for the whole unit. Static functions
+// nothing else names are not generated at all.
+
+// Instructions a clone must save, and the share of the function it must
+// save, as a shift: an eighth
+#define SPECIALIZE_MIN_GAIN 4
+#define SPECIALIZE_MIN_GAIN_SHIFT 3
+
+// Clones a function may get
+#define SPECIALIZE_CLONES 4
+
+// Instructions the clones of a unit may add up to
+#define SPECIALIZE_GROWTH_LIMIT 1000
+
+typedef enum {
+    ARG_UNSEEN,              // No call passing it seen yet
+    ARG_CONSTANT,            // `value` at every call
+    ARG_VARYING
+} ArgState;
+
+typedef struct {
+    ArgState state;
+    long long value;
+} Argument;
+
+typedef struct {
+    const char* name;
+    int index;               // In gen->functions
+} NamedFunction;
+
+// A call naming a function of the unit as its target
+typedef struct {
+    int caller;
+    int callee;
+    Expression* call;
+    bool in_loop;
+} CallSite;
+
+// Set of constant arguments some calls pass to a function
+typedef struct {
+    long long* values;
+    bool* is_bound;
+    int calls;
+    int order;               // Of its first call among the candidates
+} Candidate;
+
+typedef struct {
+    CodeGenerator* gen;
+    NamedFunction* names;    // Sorted by name, then by index
+    Argument** params;       // By function and parameter
+    bool** is_fixed;         // Never assigned, incremented, taken the address of or redeclared
+    bool* is_address_taken;  // Named other than as the target of a call
+    CallSite* calls;
+    int call_count;
+    int call_capacity;
+    const char** modified;   // Names the function being scanned changes or declares
+    int modified_count;
+    int modified_capacity;
+    int loop_depth;          // Of the statement being scanned
+} Analysis;
+
+static int compare_names(const void* a, const void* b) {
+    const NamedFunction* left = a;
+    const NamedFunction* right = b;
+    int order = strcmp(left->name, right->name);
+    return order != 0 ? order : left->index - right->index;
+}
+
+// The first definition of `name`, or -1
+static int function_index(Analysis* an, const char* name) {
+    int low = 0;
+    int high = an->gen->function_count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (strcmp(an->names[mid].name, name) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low < an->gen->function_count && strcmp(an->names[low].name, name) == 0) return an->names[low].index;
+    return -1;
+}
+
+static void modify(Analysis* an, const char* name) {
+    if (an->modified_count == an->modified_capacity) {
+        an->modified_capacity = an->modified_capacity ? an->modified_capacity * 2 : 16;
+        an->modified = realloc(an->modified, sizeof(const char*) * an->modified_capacity);
+    }
+    an->modified[an->modified_count++] = name;
+}
+
+static void modify_target(Analysis* an, Expression* target) {
+    if (target != NULL && target->type == NODE_IDENTIFIER) modify(an, target->token->lexeme);
+}
+
+static void add_call(Analysis* an, int caller, int callee, Expression* call) {
+    if (an->call_count == an->call_capacity) {
+        an->call_capacity = an->call_capacity ? an->call_capacity * 2 : 64;
+        an->calls = realloc(an->calls, sizeof(CallSite) * an->call_capacity);
+    }
+    an->calls[an->call_count++] = (CallSite){caller, callee, call, an->loop_depth > 0};
+}
+
+// Names are matched without scopes: a local that shadows a function only
+// makes the function look used more than it is
+static void scan_expression(Analysis* an, int caller, Expression* expr) {
+    if (expr == NULL) return;
+    switch (expr->type) {
+        case NODE_IDENTIFIER: {
+            int function = function_index(an, expr->token->lexeme);
+            if (function >= 0) an->is_address_taken[function] = true;
+            break;
+        }
+        case NODE_ASSIGN:
+            modify_target(an, expr->as.binary.left);
+            scan_expression(an, caller, expr->as.binary.left);
+            scan_expression(an, caller, expr->as.binary.right);
+            break;
+        case NODE_BINARY_OP:
+            scan_expression(an, caller, expr->as.binary.left);
+            scan_expression(an, caller, expr->as.binary.right);
+            break;
+        case NODE_UNARY_OP:
+            if (expr->op == TOKEN_PLUSPLUS || expr->op == TOKEN_MINUSMINUS || expr->op == TOKEN_AMPERSAND) {
+                modify_target(an, expr->as.unary.operand);
+            }
+            scan_expression(an, caller, expr->as.unary.operand);
+            break;
+        case NODE_CAST:
+            scan_expression(an, caller, expr->as.cast.operand);
+            break;
+        case NODE_CALL: {
+            Expression* callee = expr->as.call.callee;
+            int function = callee->type == NODE_IDENTIFIER ? function_index(an, callee->token->lexeme) : -1;
+            if (function >= 0) {
+                add_call(an, caller, function, expr);
+            } else {
+                scan_expression(an, caller, callee);
+            }
+            for (int i = 0; i < expr->as.call.arg_count; i++) {
+                scan_expression(an, caller, expr->as.call.args[i]);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static void scan_statement(Analysis* an, int caller, Statement* stmt) {
+    if (stmt == NULL) return;
+    switch (stmt->type) {
+        case NODE_EXPRESSION:
+            scan_expression(an, caller, stmt->as.expression.expr);
+            break;
+        case NODE_RETURN:
+            scan_expression(an, caller, stmt->as.return_stmt.value);
+            break;
+        case NODE_DECLARATION:
+            modify(an, stmt->as.declaration.name->lexeme);
+            scan_expression(an, caller, stmt->as.declaration.initializer);
+            break;
+        case NODE_COMPOUND:
+            for (int i = 0; i < stmt->as.compound.count; i++) {
+                scan_statement(an, caller, stmt->as.compound.statements[i]);
+            }
+            break;
+        case NODE_IF:
+            scan_expression(an, caller, stmt->as.if_stmt.condition);
+            scan_statement(an, caller, stmt->as.if_stmt.then_branch);
+            scan_statement(an, caller, stmt->as.if_stmt.else_branch);
+            break;
+        case NODE_WHILE:
+        case NODE_DO_WHILE:
+            an->loop_depth++;
+            scan_expression(an, caller, stmt->as.while_stmt.condition);
+            scan_statement(an, caller, stmt->as.while_stmt.body);
+            an->loop_depth--;
+            break;
+        case NODE_FOR:
+            scan_statement(an, caller, stmt->as.for_stmt.initializer);
+            an->loop_depth++;
+            scan_expression(an, caller, stmt->as.for_stmt.condition);
+            scan_statement(an, caller, stmt->as.for_stmt.increment);
+            scan_statement(an, caller, stmt->as.for_stmt.body);
+            an->loop_depth--;
+            break;
+        default:
+            break;
+    }
+}
+
+// Whether an integer of `type` holds `value` exactly
+static bool holds(const Type* type, long long value) {
+    if (type == NULL) return false;
+    switch (type->kind) {
+        case TYPE_BOOL:
+            return value == 0 || value == 1;
+        case TYPE_CHAR:
+            return type->is_unsigned ? value >= 0 && value <= 0xff : value >= -0x80 && value <= 0x7f;
+        case TYPE_SHORT:
+            return type->is_unsigned ? value >= 0 && value <= 0xffff : value >= -0x8000 && value <= 0x7fff;
+        case TYPE_INT:
+            return type->is_unsigned ? value >= 0 && value <= 0xffffffffLL : value >= INT_MIN && value <= INT_MAX;
+        case TYPE_LONG:
+            return !type->is_unsigned || value >= 0;
+        default:
+            return false;
+    }
+}
+
+static int param_index(Statement* function, const char* name) {
+    for (int i = 0; i < function->as.function.param_count; i++) {
+        Token* param = function->as.function.params[i];
+        if (param != NULL && strcmp(param->lexeme, name) == 0) return i;
+    }
+    return -1;
+}
+
+// What `expr` is in `caller` whenever the caller is called, given what
+// is known of the caller's parameters so far. Every conversion on the
+// way has to keep the value, so the callee sees it whatever the
+// conversions do.
+static ArgState evaluate(Analysis* an, int caller, Expression* expr, long long* value) {
+    ArgState state;
+    switch (expr->type) {
+        case NODE_LITERAL:
+            if (expr->token->type != TOKEN_INTEGER_LITERAL) return ARG_VARYING;
+            *value = expr->token->value.int_value;
+            state = ARG_CONSTANT;
+            break;
+        case NODE_UNARY_OP:
+            if (expr->op != TOKEN_MINUS) return ARG_VARYING;
+            state = evaluate(an, caller, expr->as.unary.operand, value);
+            if (state == ARG_CONSTANT) {
+                if (*value == LLONG_MIN) return ARG_VARYING;
+                *value = -*value;
+            }
+            break;
+        case NODE_CAST:
+            state = evaluate(an, caller, expr->as.cast.operand, value);
+            break;
+        case NODE_IDENTIFIER: {
+            int param = param_index(an->gen->functions[caller], expr->token->lexeme);
+            if (param < 0 || !an->is_fixed[caller][param]) return ARG_VARYING;
+            state = an->params[caller][param].state;
+            *value = an->params[caller][param].value;
+            break;
+        }
+        default:
+            return ARG_VARYING;
+    }
+    if (state == ARG_CONSTANT && !holds(expr->expr_type, *value)) return ARG_VARYING;
+    return state;
+}
+
+// Argument `index` of a call site as its callee receives it
+static ArgState argument(Analysis* an, CallSite* site, int index, long long* value) {
+    ArgState state = evaluate(an, site->caller, site->call->as.call.args[index], value);
+    Type* type = an->gen->functions[site->callee]->as.function.type;
+    if (state == ARG_CONSTANT && !holds(type->info.func.param_types[index], *value)) return ARG_VARYING;
+    return state;
+}
+
+static bool meet(Argument* param, ArgState state, long long value) {
+    if (state == ARG_UNSEEN || param->state == ARG_VARYING) return false;
+    if (state == ARG_CONSTANT && param->state == ARG_UNSEEN) {
+        param->state = ARG_CONSTANT;
+        param->value = value;
+        return true;
+    }
+    if (state == ARG_CONSTANT && param->value == value) return false;
+    param->state = ARG_VARYING;
+    return true;
+}
+
+// Optimistically, parameters start out unseen and only go to constant
+// and then to varying, until no call changes any
+static void propagate(Analysis* an) {
+    CodeGenerator* gen = an->gen;
+    for (int f = 0; f < gen->function_count; f++) {
+        Statement* function = gen->functions[f];
+        bool is_varying = !function->as.function.is_static || an->is_address_taken[f] ||
+                          function->as.function.type->info.func.is_variadic ||
+                          strcmp(function->as.function.name->lexeme, "main") == 0;
+        for (int p = 0; p < function->as.function.param_count; p++) {
+            if (is_varying) an->params[f][p].state = ARG_VARYING;
+        }
+    }
+    for (int c = 0; c < an->call_count; c++) {
+        CallSite* site = &an->calls[c];
+        Statement* callee = gen->functions[site->callee];
+        if (site->call->as.call.arg_count == callee->as.function.param_count) continue;
+        for (int p = 0; p < callee->as.function.param_count; p++) an->params[site->callee][p].state = ARG_VARYING;
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int c = 0; c < an->call_count; c++) {
+            CallSite* site = &an->calls[c];
+            Statement* callee = gen->functions[site->callee];
+            if (site->call->as.call.arg_count != callee->as.function.param_count) continue;
+            for (int p = 0; p < callee->as.function.param_count; p++) {
+                long long value = 0;
+                ArgState state = argument(an, site, p, &value);
+                if (meet(&an->params[site->callee][p], state, value)) changed = true;
+            }
+        }
+    }
+}
+
+static Specialization* add_specialization(CodeGenerator* gen, int function, const char* name, bool is_clone) {
+    if (gen->specialization_count % 16 == 0) {
+        gen->specializations = realloc(gen->specializations, sizeof(Specialization) * (gen->specialization_count + 16));
+    }
+    int param_count = gen->functions[function]->as.function.param_count;
+    Specialization* spec = &gen->specializations[gen->specialization_count++];
+    spec->name = name;
+    spec->function = function;
+    spec->values = calloc(param_count + 1, sizeof(long long));
+    spec->is_bound = calloc(param_count + 1, sizeof(bool));
+    spec->is_clone = is_clone;
+    return spec;
+}
+
+// Parameters of the current function bound to constants
+static void bind_parameters(CodeGenerator* gen, const Specialization* spec) {
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            if (inst->op != IR_PARAM || !spec->is_bound[inst->value]) continue;
+            inst->op = IR_CONST;
+            inst->value = ir_normalize(inst->type, spec->values[inst->value]);
+        }
+    }
+}
+
+// Size of a function with its parameters bound per `spec`, once the
+// constants are folded
+static int specialized_size(CodeGenerator* gen, int function, const Specialization* spec) {
+    Statement* func_def = gen->functions[function];
+    build_basic_blocks(gen, func_def);
+    analyze_control_flow(gen);
+    build_ir(gen, func_def);
+    promote_locals(gen);
+    if (spec != NULL) bind_parameters(gen, spec);
+    propagate_constants(gen);
+    eliminate_dead_code(gen);
+    optimize_basic_blocks(gen);
+    int size = ir_size(gen);
+    free_ir(gen);
+    free_basic_blocks(gen);
+    gen->string_count = 0;
+    return size;
+}
+
+static int compare_candidates(const void* a, const void* b) {
+    const Candidate* left = a;
+    const Candidate* right = b;
+    return left->calls != right->calls ? right->calls - left->calls : left->order - right->order;
+}
+
+// Arguments of a call to `function`, on top of what `binding` has bound:
+// whether any is a constant for a parameter left unbound, and how many
+// of them are constants at all
+static bool site_arguments(Analysis* an, CallSite* site, const Specialization* binding, long long* values,
+                           bool* is_bound, int* constant_count) {
+    int function = site->callee;
+    bool is_new = false;
+    *constant_count = 0;
+    for (int p = 0; p < site->call->as.call.arg_count; p++) {
+        long long value = 0;
+        bool is_constant = argument(an, site, p, &value) == ARG_CONSTANT;
+        if (is_constant) (*constant_count)++;
+        is_bound[p] = binding != NULL && binding->is_bound[p];
+        values[p] = is_bound[p] ? binding->values[p] : 0;
+        if (is_bound[p] || an->params[function][p].state != ARG_VARYING || !is_constant) continue;
+        is_bound[p] = true;
+        values[p] = value;
+        is_new = true;
+    }
+    return is_new;
+}
+
+// Constant arguments the calls of `function` pass to parameters left
+// unbound, grouped, the most frequent first. Calls inlining is going to
+// take are left out, since the copies they get are specialized anyway;
+// `base_size` is the size inlining goes by, or -1 when no call needed it.
+static int collect_candidates(Analysis* an, int function, const Specialization* binding, int* base_size,
+                              Candidate** out) {
+    CodeGenerator* gen = an->gen;
+    Statement* func_def = gen->functions[function];
+    int param_count = func_def->as.function.param_count;
+    Candidate* candidates = NULL;
+    int count = 0;
+    long long* values = calloc(param_count + 1, sizeof(long long));
+    bool* is_bound = calloc(param_count + 1, sizeof(bool));
+    *base_size = -1;
+    for (int c = 0; c < an->call_count; c++) {
+        CallSite* site = &an->calls[c];
+        if (site->callee != function || site->call->as.call.arg_count != param_count) continue;
+        int constant_count;
+        if (!site_arguments(an, site, binding, values, is_bound, &constant_count)) continue;
+        if (*base_size < 0) *base_size = specialized_size(gen, function, binding);
+        if (gen->inline_functions && *base_size <= inline_budget(func_def, constant_count, site->in_loop)) continue;
+
+        int match = -1;
+        for (int i = 0; i < count && match < 0; i++) {
+            bool same = true;
+            for (int p = 0; p < param_count && same; p++) {
+                same = candidates[i].is_bound[p] == is_bound[p] && (!is_bound[p] || candidates[i].values[p] == values[p]);
+            }
+            if (same) match = i;
+        }
+        if (match >= 0) {
+            candidates[match].calls++;
+            continue;
+        }
+        candidates = realloc(candidates, sizeof(Candidate) * (count + 1));
+        candidates[count].values = values;
+        candidates[count].is_bound = is_bound;
+        candidates[count].calls = 1;
+        candidates[count].order = count;
+        count++;
+        values = calloc(param_count + 1, sizeof(long long));
+        is_bound = calloc(param_count + 1, sizeof(bool));
+    }
+    free(values);
+    free(is_bound);
+    if (count > 1) {
+        qsort(candidates, count, sizeof(Candidate), compare_candidates);
+    }
+    *out = candidates;
+    return count;
+}
+
+// Bind what every call passes, then clone for what some calls pass
+static void specialize(Analysis* an, int function, int* growth) {
+    CodeGenerator* gen = an->gen;
+    Statement* func_def = gen->functions[function];
+    int param_count = func_def->as.function.param_count;
+    const char* name = func_def->as.function.name->lexeme;
+
+    Specialization* binding = NULL;
+    for (int p = 0; p < param_count; p++) {
+        if (an->params[function][p].state != ARG_CONSTANT) continue;
+        if (binding == NULL) binding = add_specialization(gen, function, name, false);
+        binding->is_bound[p] = true;
+        binding->values[p] = an->params[function][p].value;
+    }
+    if (func_def->as.function.type->info.func.is_variadic || strcmp(name, "main") == 0) return;
+
+    Candidate* candidates;
+    int base_size;
+    int count = collect_candidates(an, function, binding, &base_size, &candidates);
+    int clones = 0;
+    for (int i = 0; i < count; i++) {
+        Candidate* candidate = &candidates[i];
+        if (clones < SPECIALIZE_CLONES) {
+            Specialization trial = {name, function, candidate->values, candidate->is_bound, true};
+            int size = specialized_size(gen, function, &trial);
+            int gain = base_size - size;
+            if (gain >= SPECIALIZE_MIN_GAIN && (gain << SPECIALIZE_MIN_GAIN_SHIFT) >= base_size &&
+                *growth + size <= SPECIALIZE_GROWTH_LIMIT) {
+                size_t length = strlen(name) + 32;
+                char* clone_name = malloc(length);
+                snprintf(clone_name, length, "%s.constprop.%d", name, clones++);
+                Specialization* clone = add_specialization(gen, function, clone_name, true);
+                memcpy(clone->values, candidate->values, sizeof(long long) * param_count);
+                memcpy(clone->is_bound, candidate->is_bound, sizeof(bool) * param_count);
+                *growth += size;
+            }
+        }
+        free(candidate->values);
+        free(candidate->is_bound);
+    }
+    free(candidates);
+}
+
+void analyze_call_sites(CodeGenerator* gen) {
+    free_call_sites(gen);
+    if (!gen->optimize || gen->function_count == 0) return;
+
+    Analysis an;
+    memset(&an, 0, sizeof(an));
+    an.gen = gen;
+    int count = gen->function_count;
+    an.names = malloc(sizeof(NamedFunction) * count);
+    an.params = malloc(sizeof(Argument*) * count);
+    an.is_fixed = malloc(sizeof(bool*) * count);
+    an.is_address_taken = calloc(count, sizeof(bool));
+    for (int f = 0; f < count; f++) {
+        an.names[f].name = gen->functions[f]->as.function.name->lexeme;
+        an.names[f].index = f;
+    }
+    qsort(an.names, count, sizeof(NamedFunction), compare_names);
+
+    for (int f = 0; f < count; f++) {
+        Statement* function = gen->functions[f];
+        int param_count = function->as.function.param_count;
+        an.params[f] = calloc(param_count + 1, sizeof(Argument));
+        an.is_fixed[f] = calloc(param_count + 1, sizeof(bool));
+        an.modified_count = 0;
+        scan_statement(&an, f, function->as.function.body);
+        for (int p = 0; p < param_count; p++) {
+            Token* param = function->as.function.params[p];
+            bool is_fixed = param != NULL;
+            for (int i = 0; i < an.modified_count && is_fixed; i++) {
+                is_fixed = strcmp(an.modified[i], param->lexeme) != 0;
+            }
+            an.is_fixed[f][p] = is_fixed;
+        }
+    }
+
+    if (gen->specialize_functions) {
+        propagate(&an);
+        int growth = 0;
+        for (int f = 0; f < count; f++) specialize(&an, f, &growth);
+    }
+
+    for (int f = 0; f < count; f++) {
+        free(an.params[f]);
+        free(an.is_fixed[f]);
+    }
+    free(an.names);
+    free(an.params);
+    free(an.is_fixed);
+    free(an.is_address_taken);
+    free(an.calls);
+    free(an.modified);
+}
+
+void free_call_sites(CodeGenerator* gen) {
+    for (int i = 0; i < gen->specialization_count; i++) {
+        Specialization* spec = &gen->specializations[i];
+        if (spec->is_clone) free((char*)spec->name);
+        free(spec->values);
+        free(spec->is_bound);
+    }
+    free(gen->specializations);
+    gen->specializations = NULL;
+    gen->specialization_count = 0;
+}
+
+unsigned long long call_site_hash(const CodeGenerator* gen, const char* name) {
+    int function = -1;
+    for (int f = 0; f < gen->function_count && function < 0; f++) {
+        if (strcmp(gen->functions[f]->as.function.name->lexeme, name) == 0) function = f;
+    }
+    if (function < 0) return 0;
+
+    unsigned long long hash = 0;
+    int param_count = gen->functions[function]->as.function.param_count;
+    for (int i = 0; i < gen->specialization_count; i++) {
+        const Specialization* spec = &gen->specializations[i];
+        if (spec->function != function) continue;
+        hash = (hash ^ (spec->is_clone ? 2 : 1)) * 1099511628211ULL;
+        for (int p = 0; p < param_count; p++) {
+            unsigned long long value = spec->is_bound[p] ? (unsigned long long)spec->values[p] : 0x5a5a;
+            hash = (hash ^ value ^ (unsigned long long)p << 56) * 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+void specialize_function(CodeGenerator* gen) {
+    const Specialization* spec = gen->specialization;
+    if (spec == NULL) return;
+    gen->ir->name = spec->name;
+    bind_parameters(gen, spec);
+}
+
+// A call argument that is a constant, possibly converted
+static bool constant_value(IrInst* inst, long long* value) {
+    if (inst->op == IR_CONST) {
+        *value = inst->value;
+        return true;
+    }
+    if (inst->op != IR_EXTEND && inst->op != IR_TRUNCATE && inst->op != IR_NEG) return false;
+    long long operand;
+    return constant_value(inst->operands[0], &operand) && ir_fold(inst, &operand, value);
+}
+
+// What the code `call` goes to is generated for: the clone made for its
+// constant arguments with the most of them, or else the callee's own
+// binding, if any
+static const Specialization* find_target(CodeGenerator* gen, IrInst* call) {
+    const Specialization* best = NULL;
+    int best_bound = -1;
+    for (int i = 0; i < gen->specialization_count; i++) {
+        const Specialization* spec = &gen->specializations[i];
+        Statement* function = gen->functions[spec->function];
+        if (strcmp(function->as.function.name->lexeme, call->symbol) != 0) continue;
+        if (call->value != function->as.function.param_count || call->operand_count != call->value) continue;
+        int bound = 0;
+        bool matches = true;
+        for (int p = 0; p < call->value && matches && spec->is_clone; p++) {
+            if (!spec->is_bound[p]) continue;
+            IrInst* operand = call->operands[p];
+            long long value;
+            matches = constant_value(operand, &value) && value == ir_normalize(operand->type, spec->values[p]);
+            bound++;
+        }
+        if (matches && bound > best_bound) {
+            best = spec;
+            best_bound = bound;
+        }
+    }
+    return best;
+}
+
+void specialize_calls(CodeGenerator* gen) {
+    if (gen->specialization_count == 0) return;
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            if (inst->op != IR_CALL || inst->symbol == NULL) continue;
+            const Specialization* target = find_target(gen, inst);
+            if (target == NULL) continue;
+            inst->symbol = target->name;
+            // Nothing reads the registers of the bound parameters
+            for (int p = 0; p < inst->value && p < 6; p++) {
+                if (!target->is_bound[p]) continue;
+                IrInst* undef = ir_new(gen->ir, IR_UNDEF, inst->operands[p]->type);
+                ir_insert_before(inst, undef);
+                inst->operands[p] = undef;
+            }
+        }
+    }
+}
@@ -0,0 +1,1056 @@
+#include "ir.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Instructions
+IrInst* ir_new(IrFunction* fn, IrOpcode op, IrType type) {
+    IrInst* inst = calloc(1, sizeof(IrInst));
+    inst->op = op;
+    inst->type = type;
+    inst->vreg = -1;
+    if (fn->value_count == fn->value_capacity) {
+        fn->value_capacity = fn->value_capacity ? fn->value_capacity * 2 : 64;
+        fn->values = realloc(fn->values, sizeof(IrInst*) * fn->value_capacity);
+    }
+    inst->id = fn->value_count;
+    fn->values[fn->value_count++] = inst;
+    return inst;
+}
+
+void ir_add_operand(IrInst* inst, IrInst* operand) {
+    if (inst->operand_count == inst->operand_capacity) {
+        inst->operand_capacity = inst->operand_capacity ? inst->operand_capacity * 2 : 2;
+        inst->operands = realloc(inst->operands, sizeof(IrInst*) * inst->operand_capacity);
+    }
+    inst->operands[inst->operand_count++] = operand;
+}
+
+void ir_append(BasicBlock* block, IrInst* inst) {
+    inst->block = block;
+    inst->prev = block->last;
+    inst->next = NULL;
+    if (block->last != NULL) {
+        block->last->next = inst;
+    } else {
+        block->first = inst;
+    }
+    block->last = inst;
+}
+
+void ir_insert_before(IrInst* position, IrInst* inst) {
+    BasicBlock* block = position->block;
+    inst->block = block;
+    inst->next = position;
+    inst->prev = position->prev;
+    if (position->prev != NULL) {
+        position->prev->next = inst;
+    } else {
+        block->first = inst;
+    }
+    position->prev = inst;
+}
+
+// Unlink an instruction from its block; the function still owns it
+void ir_remove(IrInst* inst) {
+    BasicBlock* block = inst->block;
+    if (inst->prev != NULL) {
+        inst->prev->next = inst->next;
+    } else {
+        block->first = inst->next;
+    }
+    if (inst->next != NULL) {
+        inst->next->prev = inst->prev;
+    } else {
+        block->last = inst->prev;
+    }
+    inst->prev = inst->next = NULL;
+    inst->block = NULL;
+}
+
+IrInst* ir_terminator(const BasicBlock* block) {
+    IrInst* last = block->last;
+    if (last != NULL && (last->op == IR_JUMP || last->op == IR_BRANCH || last->op == IR_RETURN)) return last;
+    return NULL;
+}
+
+bool ir_has_side_effects(const IrInst* inst) {
+    return inst->op == IR_STORE || inst->op == IR_CALL || inst->op == IR_JUMP ||
+           inst->op == IR_BRANCH || inst->op == IR_RETURN;
+}
+
+// Edges. Phi operands follow the order of the predecessors, so removing
+// an edge removes the matching operand of each phi.
+int ir_predecessor_index(const BasicBlock* from, int successor) {
+    BasicBlock* to = from->successors[successor];
+    int occurrence = 0;
+    for (int k = 0; k < successor; k++) {
+        if (from->successors[k] == to) occurrence++;
+    }
+    for (int p = 0; p < to->predecessor_count; p++) {
+        if (to->predecessors[p] == from && occurrence-- == 0) return p;
+    }
+    return -1;
+}
+
+void ir_remove_edge(BasicBlock* from, int successor) {
+    BasicBlock* to = from->successors[successor];
+    int index = ir_predecessor_index(from, successor);
+    for (int p = index; p + 1 < to->predecessor_count; p++) {
+        to->predecessors[p] = to->predecessors[p + 1];
+    }
+    to->predecessor_count--;
+    for (IrInst* inst = to->first; inst != NULL && inst->op == IR_PHI; inst = inst->next) {
+        for (int p = index; p + 1 < inst->operand_count; p++) {
+            inst->operands[p] = inst->operands[p + 1];
+        }
+        inst->operand_count--;
+    }
+    for (int k = successor; k + 1 < from->successor_count; k++) {
+        from->successors[k] = from->successors[k + 1];
+    }
+    from->successor_count--;
+}
+
+// Put a block on the edge, just before its target so it falls through
+BasicBlock* ir_split_edge(CodeGenerator* gen, BasicBlock* from, int successor) {
+    BasicBlock* to = from->successors[successor];
+    int index = ir_predecessor_index(from, successor);
+    BasicBlock* middle = cfg_new_block();
+    cfg_insert_block(gen, to->id, middle);
+    IrInst* jump = ir_new(gen->ir, IR_JUMP, IR_VOID);
+    ir_append(middle, jump);
+
+    from->successors[successor] = middle;
+    cfg_add_edge(middle, to);
+    to->predecessor_count--;
+    to->predecessors[index] = middle;
+    middle->predecessors = malloc(sizeof(BasicBlock*) * 2);
+    middle->predecessor_capacity = 2;
+    middle->predecessors[0] = from;
+    middle->predecessor_count = 1;
+    return middle;
+}
+
+// Delete the blocks no path from the entry reaches
+void ir_remove_unreachable_blocks(CodeGenerator* gen) {
+    bool* reached = calloc(gen->block_count + 1, sizeof(bool));
+    BasicBlock** worklist = malloc(sizeof(BasicBlock*) * (gen->block_count + 1));
+    int count = 0;
+    reached[0] = true;
+    worklist[count++] = gen->blocks[0];
+    while (count > 0) {
+        BasicBlock* block = worklist[--count];
+        for (int s = 0; s < block->successor_count; s++) {
+            BasicBlock* successor = block->successors[s];
+            if (reached[successor->id]) continue;
+            reached[successor->id] = true;
+            worklist[count++] = successor;
+        }
+    }
+
+    for (int i = 0; i < gen->block_count; i++) {
+        BasicBlock* block = gen->blocks[i];
+        if (reached[i]) continue;
+        while (block->successor_count > 0) ir_remove_edge(block, block->successor_count - 1);
+    }
+    int kept = 0;
+    for (int i = 0; i < gen->block_count; i++) {
+        BasicBlock* block = gen->blocks[i];
+        if (!reached[i]) {
+            while (block->first != NULL) ir_remove(block->first);
+            cfg_free_block(block);
+            continue;
+        }
+        block->id = kept;
+        gen->blocks[kept++] = block;
+    }
+    gen->block_count = kept;
+    free(reached);
+    free(worklist);
+}
+
+// Constant folding
+long long ir_normalize(IrType type, long long value) {
+    return type == IR_I64 ? value : (long long)(int)value;
+}
+
+static bool compare(ConditionCode cond, long long left, long long right, IrType type) {
+    unsigned long long left_unsigned = type == IR_I64 ? (unsigned long long)left : (unsigned int)left;
+    unsigned long long right_unsigned = type == IR_I64 ? (unsigned long long)right : (unsigned int)right;
+    switch (cond) {
+        case COND_E: return left == right;
+        case COND_NE: return left != right;
+        case COND_L: return left < right;
+        case COND_LE: return left <= right;
+        case COND_G: return left > right;
+        case COND_GE: return left >= right;
+        case COND_B: return left_unsigned < right_unsigned;
+        case COND_BE: return left_unsigned <= right_unsigned;
+        case COND_A: return left_unsigned > right_unsigned;
+        case COND_AE: return left_unsigned >= right_unsigned;
+        default: return false;
+    }
+}
+
+bool ir_fold(const IrInst* inst, const long long* operands, long long* result) {
+    bool wide = inst->type == IR_I64;
+    int bits = wide ? 64 : 32;
+    unsigned long long a = inst->operand_count > 0 ? (unsigned long long)operands[0] : 0;
+    unsigned long long b = inst->operand_count > 1 ? (unsigned long long)operands[1] : 0;
+    unsigned long long value;
+
+    switch (inst->op) {
+        case IR_CONST: value = inst->value; break;
+        case IR_COPY: value = a; break;
+        case IR_ADD: value = a + b; break;
+        case IR_SUB: value = a - b; break;
+        case IR_MUL: value = a * b; break;
+        case IR_AND: value = a & b; break;
+        case IR_OR: value = a | b; break;
+        case IR_XOR: value = a ^ b; break;
+        case IR_NEG: value = 0 - a; break;
+        case IR_NOT: value = ~a; break;
+        case IR_SHL: value = a << (b & (bits - 1)); break;
+        case IR_SHR:
+            if (inst->is_signed) {
+                value = wide ? (unsigned long long)((long long)a >> (b & 63))
+                             : (unsigned long long)(long long)((int)a >> (b & 31));
+            } else {
+                value = wide ? a >> (b & 63) : (unsigned int)a >> (b & 31);
+            }
+            break;
+        case IR_DIV:
+        case IR_REM:
+            if (wide ? b == 0 : (unsigned int)b == 0) return false;
+            if (inst->is_signed) {
+                long long left = wide ? (long long)a : (int)a;
+                long long right = wide ? (long long)b : (int)b;
+                if (right == -1 && left == (wide ? (long long)(1ULL << 63) : -2147483648LL)) return false;
+                value = inst->op == IR_DIV ? left / right : left % right;
+            } else {
+                unsigned long long left = wide ? a : (unsigned int)a;
+                unsigned long long right = wide ? b : (unsigned int)b;
+                value = inst->op == IR_DIV ? left / right : left % right;
+            }
+            break;
+        case IR_CMP:
+            value = compare(inst->cond, operands[0], operands[1], inst->operands[0]->type);
+            break;
+        case IR_EXTEND:
+            switch (inst->size) {
+                case 1: value = inst->is_signed ? (unsigned long long)(signed char)a : (unsigned char)a; break;
+                case 2: value = inst->is_signed ? (unsigned long long)(short)a : (unsigned short)a; break;
+                default: value = inst->is_signed ? (unsigned long long)(int)a : (unsigned int)a; break;
+            }
+            break;
+        case IR_TRUNCATE: value = (unsigned int)a; break;
+        case IR_SELECT: value = a != 0 ? b : (unsigned long long)operands[2]; break;
+        default:
+            return false;
+    }
+    *result = ir_normalize(inst->type, (long long)value);
+    return true;
+}
+
+// Lowering from the AST. Names are resolved up front, so that the
+// statements of a block can be lowered without replaying the scopes.
+typedef struct {
+    const void* key;         // Identifier expression, declaration or parameter name
+    int local;
+} Binding;
+
+typedef struct {
+    CodeGenerator* gen;
+    IrFunction* fn;
+    BasicBlock* block;       // Where instructions go
+    Binding* bindings;
+    int binding_count;
+    int binding_capacity;
+    const char** scope_names;
+    int* scope_locals;
+    int scope_depth;
+    int scope_capacity;
+} IrBuilder;
+
+static void bind(IrBuilder* builder, const void* key, int local) {
+    if (builder->binding_count == builder->binding_capacity) {
+        builder->binding_capacity = builder->binding_capacity ? builder->binding_capacity * 2 : 64;
+        builder->bindings = realloc(builder->bindings, sizeof(Binding) * builder->binding_capacity);
+    }
+    builder->bindings[builder->binding_count].key = key;
+    builder->bindings[builder->binding_count].local = local;
+    builder->binding_count++;
+}
+
+static int compare_bindings(const void* a, const void* b) {
+    const void* left = ((const Binding*)a)->key;
+    const void* right = ((const Binding*)b)->key;
+    return left < right ? -1 : left > right;
+}
+
+// Local bound to a key, or -1 for globals
+static int lookup(IrBuilder* builder, const void* key) {
+    int low = 0;
+    int high = builder->binding_count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (builder->bindings[mid].key == key) return builder->bindings[mid].local;
+        if (builder->bindings[mid].key < key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return -1;
+}
+
+static int declare(IrBuilder* builder, const void* key, const char* name, Type* type) {
+    IrFunction* fn = builder->fn;
+    if (fn->local_count == fn->local_capacity) {
+        fn->local_capacity = fn->local_capacity ? fn->local_capacity * 2 : 16;
+        fn->locals = realloc(fn->locals, sizeof(IrLocal) * fn->local_capacity);
+    }
+    int local = fn->local_count++;
+    fn->locals[local].type = type;
+    fn->locals[local].offset = 0;
+    fn->locals[local].is_promoted = false;
+    bind(builder, key, local);
+
+    if (builder->scope_depth == builder->scope_capacity) {
+        builder->scope_capacity = builder->scope_capacity ? builder->scope_capacity * 2 : 16;
+        builder->scope_names = realloc(builder->scope_names, sizeof(char*) * builder->scope_capacity);
+        builder->scope_locals = realloc(builder->scope_locals, sizeof(int) * builder->scope_capacity);
+    }
+    builder->scope_names[builder->scope_depth] = name;
+    builder->scope_locals[builder->scope_depth] = local;
+    builder->scope_depth++;
+    return local;
+}
+
+static void resolve_expression(IrBuilder* builder, Expression* expr) {
+    if (expr == NULL) return;
+    switch (expr->type) {
+        case NODE_IDENTIFIER:
+            for (int i = builder->scope_depth - 1; i >= 0; i--) {
+                if (strcmp(builder->scope_names[i], expr->token->lexeme) == 0) {
+                    bind(builder, expr, builder->scope_locals[i]);
+                    break;
+                }
+            }
+            break;
+        case NODE_BINARY_OP:
+        case NODE_ASSIGN:
+            resolve_expression(builder, expr->as.binary.left);
+            resolve_expression(builder, expr->as.binary.right);
+            break;
+        case NODE_UNARY_OP:
+        case NODE_CAST:
+            resolve_expression(builder, expr->as.unary.operand);
+            break;
+        case NODE_CALL:
+            resolve_expression(builder, expr->as.call.callee);
+            for (int i = 0; i < expr->as.call.arg_count; i++) {
+                resolve_expression(builder, expr->as.call.args[i]);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// Scopes follow the AST code generator: compound statements and for
+// loops open one, and a declaration is in scope in its own initializer
+static void resolve_statement(IrBuilder* builder, Statement* stmt) {
+    if (stmt == NULL) return;
+    int mark = builder->scope_depth;
+    switch (stmt->type) {
+        case NODE_EXPRESSION:
+            resolve_expression(builder, stmt->as.expression.expr);
+            break;
+        case NODE_RETURN:
+            resolve_expression(builder, stmt->as.return_stmt.value);
+            break;
+        case NODE_DECLARATION:
+            declare(builder, stmt, stmt->as.declaration.name->lexeme, stmt->as.declaration.var_type);
+            resolve_expression(builder, stmt->as.declaration.initializer);
+            break;
+        case NODE_COMPOUND:
+            for (int i = 0; i < stmt->as.compound.count; i++) {
+                resolve_statement(builder, stmt->as.compound.statements[i]);
+            }
+            if (stmt->as.compound.scoped) builder->scope_depth = mark;
+            break;
+        case NODE_IF:
+            resolve_expression(builder, stmt->as.if_stmt.condition);
+            resolve_statement(builder, stmt->as.if_stmt.then_branch);
+            resolve_statement(builder, stmt->as.if_stmt.else_branch);
+            break;
+        case NODE_WHILE:
+        case NODE_DO_WHILE:
+            resolve_expression(builder, stmt->as.while_stmt.condition);
+            resolve_statement(builder, stmt->as.while_stmt.body);
+            break;
+        case NODE_FOR:
+            resolve_statement(builder, stmt->as.for_stmt.initializer);
+            resolve_expression(builder, stmt->as.for_stmt.condition);
+            resolve_statement(builder, stmt->as.for_stmt.increment);
+            resolve_statement(builder, stmt->as.for_stmt.body);
+            builder->scope_depth = mark;
+            break;
+        default:
+            break;
+    }
+}
+
+static const Type long_type = {TYPE_LONG, false, false, false, {0}};
+
+static IrType value_type(const Type* type) {
+    return is_wide(type) ? IR_I64 : IR_I32;
+}
+
+static IrInst* add(IrBuilder* builder, IrOpcode op, IrType type) {
+    IrInst* inst = ir_new(builder->fn, op, type);
+    ir_append(builder->block, inst);
+    return inst;
+}
+
+static IrInst* unary(IrBuilder* builder, IrOpcode op, IrType type, IrInst* operand) {
+    IrInst* inst = add(builder, op, type);
+    ir_add_operand(inst, operand);
+    return inst;
+}
+
+static IrInst* binary(IrBuilder* builder, IrOpcode op, IrType type, IrInst* left, IrInst* right) {
+    IrInst* inst = add(builder, op, type);
+    ir_add_operand(inst, left);
+    ir_add_operand(inst, right);
+    return inst;
+}
+
+static IrInst* constant(IrBuilder* builder, IrType type, long long value) {
+    IrInst* inst = add(builder, IR_CONST, type);
+    inst->value = ir_normalize(type, value);
+    return inst;
+}
+
+static IrInst* extend(IrBuilder* builder, IrInst* value, IrType type, int size, bool is_signed) {
+    IrInst* inst = unary(builder, IR_EXTEND, type, value);
+    inst->size = size;
+    inst->is_signed = is_signed;
+    return inst;
+}
+
+static IrInst* compare_zero(IrBuilder* builder, IrInst* value, ConditionCode cond) {
+    IrInst* inst = binary(builder, IR_CMP, IR_I32, value, constant(builder, value->type, 0));
+    inst->cond = cond;
+    return inst;
+}
+
+// The conversions of the AST code generator's convert()
+static IrInst* convert(IrBuilder* builder, IrInst* value, const Type* from, const Type* to) {
+    if (value == NULL || from == NULL || to == NULL) return value;
+
+    if (is_wide(to) && !is_wide(from)) {
+        return extend(builder, value, IR_I64, 4, !from->is_unsigned);
+    }
+    if (narrows(from, to)) {
+        if (value->type == IR_I64) value = unary(builder, IR_TRUNCATE, IR_I32, value);
+        return extend(builder, value, IR_I32, to->kind == TYPE_CHAR ? 1 : 2, !to->is_unsigned);
+    }
+    if (!is_wide(to) && value->type == IR_I64) {
+        return unary(builder, IR_TRUNCATE, IR_I32, value);
+    }
+    return value;
+}
+
+static IrInst* load(IrBuilder* builder, const Type* type, IrInst* address) {
+    if (type->kind == TYPE_ARRAY || type->kind == TYPE_FUNCTION) return address;
+    int size = type_size(type);
+    IrInst* inst = unary(builder, IR_LOAD, size < 8 ? IR_I32 : IR_I64, address);
+    inst->size = size;
+    inst->is_signed = !type->is_unsigned;
+    return inst;
+}
+
+static void store(IrBuilder* builder, const Type* type, IrInst* address, IrInst* value) {
+    IrInst* inst = binary(builder, IR_STORE, IR_VOID, address, value);
+    inst->size = type_size(type);
+}
+
+static IrInst* local_address(IrBuilder* builder, int local) {
+    IrInst* inst = add(builder, IR_LOCAL, IR_I64);
+    inst->value = local;
+    return inst;
+}
+
+// Address and type of a named variable
+static IrInst* variable_address(IrBuilder* builder, Expression* expr, const Type** type) {
+    int local = lookup(builder, expr);
+    if (local >= 0) {
+        *type = builder->fn->locals[local].type;
+        return local_address(builder, local);
+    }
+    *type = expr->expr_type;
+    IrInst* inst = add(builder, IR_GLOBAL, IR_I64);
+    inst->symbol = expr->token->lexeme;
+    return inst;
+}
+
+static IrInst* lower_expression(IrBuilder* builder, Expression* expr);
+
+static IrInst* lower_address(IrBuilder* builder, Expression* expr) {
+    if (expr->type == NODE_IDENTIFIER) {
+        const Type* type;
+        return variable_address(builder, expr, &type);
+    }
+    // *p: the address is the pointer's value
+    return lower_expression(builder, expr->as.unary.operand);
+}
+
+// The block being filled ends here; `rest` takes over its edges out
+static void split_block(IrBuilder* builder, BasicBlock* rest) {
+    BasicBlock* block = builder->block;
+    for (int s = 0; s < block->successor_count; s++) {
+        BasicBlock* successor = block->successors[s];
+        rest->successors[s] = successor;
+        for (int p = 0; p < successor->predecessor_count; p++) {
+            if (successor->predecessors[p] == block) successor->predecessors[p] = rest;
+        }
+    }
+    rest->successor_count = block->successor_count;
+    rest->is_exit = block->is_exit;
+    block->successor_count = 0;
+    block->is_exit = false;
+}
+
+// a && b and a || b as values: the right operand gets a block of its
+// own, and a phi joins the two outcomes
+static IrInst* lower_logical(IrBuilder* builder, Expression* expr) {
+    bool is_and = expr->op == TOKEN_ANDAND;
+    IrInst* left = compare_zero(builder, lower_expression(builder, expr->as.binary.left), COND_NE);
+    IrInst* shortcut = constant(builder, IR_I32, is_and ? 0 : 1);
+
+    BasicBlock* start = builder->block;
+    BasicBlock* right_block = cfg_new_block();
+    BasicBlock* join = cfg_new_block();
+    split_block(builder, join);
+    cfg_insert_block(builder->gen, start->id + 1, right_block);
+    cfg_insert_block(builder->gen, right_block->id + 1, join);
+
+    unary(builder, IR_BRANCH, IR_VOID, left);
+    cfg_add_edge(start, is_and ? right_block : join);
+    cfg_add_edge(start, is_and ? join : right_block);
+
+    builder->block = right_block;
+    IrInst* right = compare_zero(builder, lower_expression(builder, expr->as.binary.right), COND_NE);
+    add(builder, IR_JUMP, IR_VOID);
+    cfg_add_edge(builder->block, join);
+
+    // The join's predecessors are the start and the end of the right operand
+    builder->block = join;
+    IrInst* phi = add(builder, IR_PHI, IR_I32);
+    ir_add_operand(phi, shortcut);
+    ir_add_operand(phi, right);
+    return phi;
+}
+
+// Both operands of an operator, the one taking more registers first, as
+// the AST code generator's generate_operands orders them
+static void lower_operands(IrBuilder* builder, Expression* left_expr, Expression* right_expr,
+                           IrInst** left, IrInst** right) {
+    if (right_expr->registers > left_expr->registers) {
+        *right = lower_expression(builder, right_expr);
+        *left = lower_expression(builder, left_expr);
+    } else {
+        *left = lower_expression(builder, left_expr);
+        *right = lower_expression(builder, right_expr);
+    }
+}
+
+static IrInst* lower_comparison(IrBuilder* builder, Expression* expr) {
+    Expression* left_expr = expr->as.binary.left;
+    Expression* right_expr = expr->as.binary.right;
+    const Type* type = operation_type(left_expr->expr_type, right_expr->expr_type);
+
+    IrInst* left;
+    IrInst* right;
+    lower_operands(builder, left_expr, right_expr, &left, &right);
+    left = convert(builder, left, left_expr->expr_type, type);
+    right = convert(builder, right, right_expr->expr_type, type);
+    IrInst* inst = binary(builder, IR_CMP, IR_I32, left, right);
+    inst->cond = condition_code(expr->op, is_unsigned_type(type));
+    return inst;
+}
+
+// Pointer plus or minus an integer, or the difference of two pointers
+static IrInst* lower_pointer_arithmetic(IrBuilder* builder, Expression* expr) {
+    Expression* left_expr = expr->as.binary.left;
+    Expression* right_expr = expr->as.binary.right;
+    const Type* left_type = left_expr->expr_type;
+    const Type* right_type = right_expr->expr_type;
+
+    IrInst* left;
+    IrInst* right;
+    lower_operands(builder, left_expr, right_expr, &left, &right);
+
+    if (is_pointer_type(left_type) && is_pointer_type(right_type)) {
+        IrInst* difference = binary(builder, IR_SUB, IR_I64, left, right);
+        int size = element_size(left_type);
+        if (size == 1) return difference;
+        IrInst* quotient = binary(builder, IR_DIV, IR_I64, difference, constant(builder, IR_I64, size));
+        quotient->is_signed = true;
+        return quotient;
+    }
+
+    bool pointer_left = is_pointer_type(left_type);
+    IrInst* pointer = pointer_left ? left : right;
+    IrInst* index = convert(builder, pointer_left ? right : left, pointer_left ? right_type : left_type,
+                            expr->expr_type);
+    int size = element_size(pointer_left ? left_type : right_type);
+    if (size > 1) index = binary(builder, IR_MUL, IR_I64, index, constant(builder, IR_I64, size));
+    return binary(builder, expr->op == TOKEN_PLUS ? IR_ADD : IR_SUB, IR_I64, pointer, index);
+}
+
+// Binary operator of the language on values of type `type`
+static IrInst* arithmetic(IrBuilder* builder, TokenType op, const Type* type, IrInst* left, IrInst* right) {
+    IrOpcode opcode = IR_ADD;
+    switch (op) {
+        case TOKEN_PLUS: opcode = IR_ADD; break;
+        case TOKEN_MINUS: opcode = IR_SUB; break;
+        case TOKEN_STAR: opcode = IR_MUL; break;
+        case TOKEN_SLASH: opcode = IR_DIV; break;
+        case TOKEN_PERCENT: opcode = IR_REM; break;
+        case TOKEN_AMPERSAND: opcode = IR_AND; break;
+        case TOKEN_PIPE: opcode = IR_OR; break;
+        case TOKEN_CARET: opcode = IR_XOR; break;
+        case TOKEN_LESSLESS: opcode = IR_SHL; break;
+        case TOKEN_GREATERGREATER: opcode = IR_SHR; break;
+        default: break;
+    }
+    IrInst* inst = binary(builder, opcode, value_type(type), left, right);
+    inst->is_signed = !type->is_unsigned;
+    return inst;
+}
+
+static IrInst* lower_binary(IrBuilder* builder, Expression* expr) {
+    if (expr->op == TOKEN_ANDAND || expr->op == TOKEN_OROR) return lower_logical(builder, expr);
+    if (is_comparison(expr->op)) return lower_comparison(builder, expr);
+
+    Expression* left_expr = expr->as.binary.left;
+    Expression* right_expr = expr->as.binary.right;
+    if (is_pointer_type(left_expr->expr_type) || is_pointer_type(right_expr->expr_type)) {
+        return lower_pointer_arithmetic(builder, expr);
+    }
+
+    const Type* type = expr->expr_type;
+    bool is_shift = expr->op == TOKEN_LESSLESS || expr->op == TOKEN_GREATERGREATER;
+    IrInst* left;
+    IrInst* right;
+    lower_operands(builder, left_expr, right_expr, &left, &right);
+    left = convert(builder, left, left_expr->expr_type, type);
+    if (!is_shift) right = convert(builder, right, right_expr->expr_type, type);
+    return arithmetic(builder, expr->op, type, left, right);
+}
+
+// Increment and decrement, prefix and postfix
+static IrInst* lower_increment(IrBuilder* builder, Expression* expr) {
+    Expression* target = expr->as.unary.operand;
+    const Type* type = target->expr_type;
+    IrInst* address = target->type == NODE_IDENTIFIER ? variable_address(builder, target, &type)
+                                                     : lower_address(builder, target);
+    int step = is_pointer_type(type) ? element_size(type) : 1;
+    bool is_increment = expr->op == TOKEN_PLUSPLUS;
+
+    IrInst* old = load(builder, type, address);
+    IrType operation = value_type(type);
+    IrInst* updated = binary(builder, is_increment ? IR_ADD : IR_SUB, operation, old,
+                             constant(builder, operation, step));
+    updated->is_signed = !is_pointer_type(type) && !type->is_unsigned;
+    updated = convert(builder, updated, promoted(type), type);
+    store(builder, type, address, updated);
+    return expr->as.unary.prefix ? updated : old;
+}
+
+static IrInst* lower_unary(IrBuilder* builder, Expression* expr) {
+    Expression* operand_expr = expr->as.unary.operand;
+    const Type* type = expr->expr_type;
+    IrInst* operand;
+
+    switch (expr->op) {
+        case TOKEN_MINUS:
+        case TOKEN_PLUS:
+        case TOKEN_TILDE:
+            operand = convert(builder, lower_expression(builder, operand_expr), operand_expr->expr_type, type);
+            if (expr->op == TOKEN_PLUS) return operand;
+            return unary(builder, expr->op == TOKEN_MINUS ? IR_NEG : IR_NOT, value_type(type), operand);
+        case TOKEN_BANG:
+            return compare_zero(builder, lower_expression(builder, operand_expr), COND_E);
+        case TOKEN_STAR:
+            return load(builder, type, lower_expression(builder, operand_expr));
+        case TOKEN_AMPERSAND:
+            return lower_address(builder, operand_expr);
+        case TOKEN_PLUSPLUS:
+        case TOKEN_MINUSMINUS:
+            return lower_increment(builder, expr);
+        default:
+            return NULL;
+    }
+}
+
+static IrInst* lower_assignment(IrBuilder* builder, Expression* expr) {
+    Expression* target = expr->as.binary.left;
+    Expression* value_expr = expr->as.binary.right;
+    const Type* type = target->expr_type;
+
+    // The address of a target other than a variable and the value come
+    // in either order, like the operands of an operator
+    IrInst* address;
+    IrInst* value;
+    if (target->type == NODE_IDENTIFIER) {
+        address = variable_address(builder, target, &type);
+        value = lower_expression(builder, value_expr);
+    } else if (value_expr->registers > target->as.unary.operand->registers) {
+        value = lower_expression(builder, value_expr);
+        address = lower_address(builder, target);
+    } else {
+        address = lower_address(builder, target);
+        value = lower_expression(builder, value_expr);
+    }
+
+    TokenType op = compound_operator(expr->op);
+    const Type* value_type_ = value_expr->expr_type;
+
+    if (op == TOKEN_EQUALS) {
+        value = convert(builder, value, value_type_, type);
+    } else if (is_pointer_type(type)) {
+        // p += n scales n by the element size
+        value = convert(builder, value, value_type_, type);
+        int size = element_size(type);
+        if (size > 1) value = binary(builder, IR_MUL, IR_I64, value, constant(builder, IR_I64, size));
+        IrInst* current = load(builder, type, address);
+        value = binary(builder, op == TOKEN_PLUS ? IR_ADD : IR_SUB, IR_I64, current, value);
+    } else {
+        // Compute in the promoted type of the operands, then narrow
+        bool is_shift = op == TOKEN_LESSLESS || op == TOKEN_GREATERGREATER;
+        const Type* op_type = is_shift ? promoted(type) : operation_type(promoted(type), promoted(value_type_));
+        if (!is_shift) value = convert(builder, value, value_type_, op_type);
+        IrInst* current = convert(builder, load(builder, type, address), type, op_type);
+        value = convert(builder, arithmetic(builder, op, op_type, current, value), op_type, type);
+    }
+
+    store(builder, type, address, value);
+    return value;
+}
+
+static IrInst* lower_call(IrBuilder* builder, Expression* expr) {
+    Expression* callee = expr->as.call.callee;
+    const Type* func = callee->expr_type;
+    int arg_count = expr->as.call.arg_count;
+
+    // Arguments are evaluated right to left, those taking more registers
+    // first, as in generate_call
+    IrInst** values = malloc(sizeof(IrInst*) * (arg_count > 0 ? arg_count : 1));
+    int* order = malloc(sizeof(int) * (arg_count > 0 ? arg_count : 1));
+    for (int n = 0; n < arg_count; n++) {
+        int i = arg_count - 1 - n;
+        int k = n;
+        while (k > 0 && expr->as.call.args[order[k - 1]]->registers < expr->as.call.args[i]->registers) {
+            order[k] = order[k - 1];
+            k--;
+        }
+        order[k] = i;
+    }
+    for (int n = 0; n < arg_count; n++) {
+        int i = order[n];
+        Expression* arg = expr->as.call.args[i];
+        const Type* param = i < func->info.func.param_count ? func->info.func.param_types[i] : NULL;
+        values[i] = lower_expression(builder, arg);
+        if (param != NULL) {
+            values[i] = convert(builder, values[i], arg->expr_type, param);
+        } else if (!is_wide(arg->expr_type)) {
+            // Variadic int arguments are passed sign-extended
+            values[i] = convert(builder, values[i], arg->expr_type, &long_type);
+        }
+    }
+    free(order);
+    IrInst* target = NULL;
+    if (callee->type != NODE_IDENTIFIER || lookup(builder, callee) >= 0) {
+        target = lower_expression(builder, callee);
+    }
+
+    Type* return_type = func->info.func.return_type;
+    IrInst* call = add(builder, IR_CALL, return_type->kind == TYPE_VOID ? IR_VOID : value_type(return_type));
+    call->value = arg_count;
+    call->is_variadic = func->info.func.is_variadic;
+    for (int i = 0; i < arg_count; i++) ir_add_operand(call, values[i]);
+    if (target != NULL) {
+        ir_add_operand(call, target);
+    } else {
+        call->symbol = callee->token->lexeme;
+    }
+    free(values);
+    return call->type == IR_VOID ? NULL : call;
+}
+
+static IrInst* lower_expression(IrBuilder* builder, Expression* expr) {
+    switch (expr->type) {
+        case NODE_LITERAL:
+            if (expr->token->type == TOKEN_STRING_LITERAL) {
+                IrInst* inst = add(builder, IR_STRING, IR_I64);
+                inst->value = add_string(builder->gen, expr->token);
+                return inst;
+            }
+            return constant(builder, value_type(expr->expr_type), expr->token->value.int_value);
+        case NODE_IDENTIFIER: {
+            const Type* type;
+            IrInst* address = variable_address(builder, expr, &type);
+            if (expr->as.identifier.is_array) return address;
+            return load(builder, type, address);
+        }
+        case NODE_BINARY_OP:
+            return lower_binary(builder, expr);
+        case NODE_UNARY_OP:
+            return lower_unary(builder, expr);
+        case NODE_ASSIGN:
+            return lower_assignment(builder, expr);
+        case NODE_CALL:
+            return lower_call(builder, expr);
+        case NODE_CAST: {
+            IrInst* value = lower_expression(builder, expr->as.cast.operand);
+            if (expr->expr_type->kind == TYPE_VOID) return NULL;
+            return convert(builder, value, expr->as.cast.operand->expr_type, expr->expr_type);
+        }
+        default:
+            return NULL;
+    }
+}
+
+static void lower_statement(IrBuilder* builder, Statement* stmt) {
+    switch (stmt->type) {
+        case NODE_EXPRESSION:
+            lower_expression(builder, stmt->as.expression.expr);
+            break;
+        case NODE_DECLARATION: {
+            Expression* initializer = stmt->as.declaration.initializer;
+            if (initializer == NULL) break;
+            Type* type = stmt->as.declaration.var_type;
+            IrInst* value = convert(builder, lower_expression(builder, initializer), initializer->expr_type, type);
+            store(builder, type, local_address(builder, lookup(builder, stmt)), value);
+            break;
+        }
+        default:
+            // Control flow is already in the shape of the graph
+            break;
+    }
+}
+
+// The exit of a block whose successors are the targets of `condition`
+// being true and false. && and || become chains of branches, each
+// operand testing in a block of its own, and ! swaps the targets, so that
+// no truth value has to be computed.
+static void lower_branch(IrBuilder* builder, Expression* condition) {
+    BasicBlock* block = builder->block;
+    if (condition->type == NODE_UNARY_OP && condition->op == TOKEN_BANG) {
+        BasicBlock* swap = block->successors[0];
+        block->successors[0] = block->successors[1];
+        block->successors[1] = swap;
+        lower_branch(builder, condition->as.unary.operand);
+        return;
+    }
+    if (condition->type == NODE_BINARY_OP && (condition->op == TOKEN_ANDAND || condition->op == TOKEN_OROR)) {
+        bool is_and = condition->op == TOKEN_ANDAND;
+        BasicBlock* right_block = cfg_new_block();
+        split_block(builder, right_block);
+        cfg_insert_block(builder->gen, block->id + 1, right_block);
+        BasicBlock* if_true = right_block->successors[0];
+        BasicBlock* if_false = right_block->successors[1];
+        cfg_add_edge(block, is_and ? right_block : if_true);
+        cfg_add_edge(block, is_and ? if_false : right_block);
+        lower_branch(builder, condition->as.binary.left);
+
+        builder->block = right_block;
+        lower_branch(builder, condition->as.binary.right);
+        return;
+    }
+    unary(builder, IR_BRANCH, IR_VOID, lower_expression(builder, condition));
+}
+
+// The instructions of one block of the statement CFG, which may spill
+// over into blocks split off it
+static void lower_block(IrBuilder* builder, BasicBlock* block) {
+    builder->block = block;
+    for (int i = 0; i < block->statement_count; i++) {
+        lower_statement(builder, block->statements[i]);
+    }
+
+    switch (block->exit) {
+        case EXIT_JUMP:
+            add(builder, IR_JUMP, IR_VOID);
+            break;
+        case EXIT_BRANCH:
+            lower_branch(builder, block->condition);
+            break;
+        case EXIT_RETURN: {
+            Statement* stmt = block->return_stmt;
+            IrInst* result = NULL;
+            if (stmt != NULL && stmt->as.return_stmt.value != NULL) {
+                Expression* value = stmt->as.return_stmt.value;
+                result = convert(builder, lower_expression(builder, value), value->expr_type,
+                                 builder->fn->return_type);
+            } else if (stmt == NULL && strcmp(builder->fn->name, "main") == 0) {
+                // Falling off the end of main returns 0
+                result = constant(builder, IR_I32, 0);
+            }
+            IrInst* ret = add(builder, IR_RETURN, IR_VOID);
+            if (result != NULL) ir_add_operand(ret, result);
+            break;
+        }
+    }
+}
+
+void build_ir(CodeGenerator* gen, Statement* function) {
+    free_ir(gen);
+    IrFunction* fn = calloc(1, sizeof(IrFunction));
+    gen->ir = fn;
+    fn->name = function->as.function.name->lexeme;
+    fn->return_type = function->as.function.type->info.func.return_type;
+
+    IrBuilder builder;
+    memset(&builder, 0, sizeof(builder));
+    builder.gen = gen;
+    builder.fn = fn;
+
+    // Parameters are locals initialized from the incoming arguments
+    Type* type = function->as.function.type;
+    int param_count = function->as.function.param_count;
+    fn->param_count = param_count;
+    for (int i = 0; i < param_count; i++) {
+        Token* name = function->as.function.params[i];
+        declare(&builder, name, name != NULL ? name->lexeme : "", type->info.func.param_types[i]);
+    }
+    Statement* body = function->as.function.body;
+    for (int i = 0; i < body->as.compound.count; i++) {
+        resolve_statement(&builder, body->as.compound.statements[i]);
+    }
+    if (builder.binding_count > 1) {
+        qsort(builder.bindings, builder.binding_count, sizeof(Binding), compare_bindings);
+    }
+
+    builder.block = gen->blocks[0];
+    for (int i = 0; i < param_count; i++) {
+        IrInst* param = add(&builder, IR_PARAM, value_type(type->info.func.param_types[i]));
+        param->value = i;
+        store(&builder, type->info.func.param_types[i], local_address(&builder, i), param);
+    }
+
+    // Lowering splits blocks, so walk a copy of the original list
+    int count = gen->block_count;
+    BasicBlock** blocks = malloc(sizeof(BasicBlock*) * count);
+    memcpy(blocks, gen->blocks, sizeof(BasicBlock*) * count);
+    for (int i = 0; i < count; i++) {
+        if (blocks[i]->rpo >= 0) lower_block(&builder, blocks[i]);
+    }
+    free(blocks);
+
+    free(builder.bindings);
+    free(builder.scope_names);
+    free(builder.scope_locals);
+
+    ir_remove_unreachable_blocks(gen);
+    analyze_control_flow(gen);
+}
+
+void free_ir(CodeGenerator* gen) {
+    IrFunction* fn = gen->ir;
+    if (fn == NULL) return;
+    for (int i = 0; i < fn->value_count; i++) {
+        free(fn->values[i]->operands);
+        free(fn->values[i]);
+    }
+    free(fn->values);
+    free(fn->locals);
+    free(fn);
+    gen->ir = NULL;
+}
+
+// Instructions that end up as machine code, roughly
+int ir_size(CodeGenerator* gen) {
+    int size = 0;
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            switch (inst->op) {
+                case IR_PHI: case IR_JUMP: case IR_RETURN: case IR_PARAM: case IR_CONST: case IR_UNDEF:
+                    break;
+                default:
+                    size++;
+                    break;
+            }
+        }
+    }
+    return size;
+}
+
+// Listing
+static const char* opcode_names[] = {
+    "const", "undef", "param", "local", "global", "string", "load", "store",
+    "add", "sub", "mul", "div", "rem", "and", "or", "xor", "shl", "shr", "neg", "not",
+    "cmp", "extend", "truncate", "select", "broadcast", "reduce", "call", "phi", "copy", "jump", "branch",
+    "return"
+};
+
+static const char* condition_names[] = {
+    "o", "no", "b", "ae", "e", "ne", "be", "a", "s", "ns", "p", "np", "l", "ge", "le", "g"
+};
+
+static void print_text(Emitter* out, const char* text) {
+    emitter_write(out, text, strlen(text));
+}
+
+void ir_print(CodeGenerator* gen, Emitter* out) {
+    for (int b = 0; b < gen->block_count; b++) {
+        BasicBlock* block = gen->blocks[b];
+        print_text(out, "b");
+        emitter_integer(out, block->id);
+        print_text(out, ":");
+        if (block->loop_depth > 0) {
+            print_text(out, " ; loop depth ");
+            emitter_integer(out, block->loop_depth);
+        }
+        emitter_char(out, '\n');
+
+        for (IrInst* inst = block->first; inst != NULL; inst = inst->next) {
+            print_text(out, "    ");
+            if (inst->type != IR_VOID) {
+                print_text(out, "%");
+                emitter_integer(out, inst->id);
+                print_text(out, inst->type == IR_I64 ? ":i64 = " : inst->type == IR_V32 ? ":v32 = " : ":i32 = ");
+            }
+            print_text(out, opcode_names[inst->op]);
+            if (inst->op == IR_CMP) {
+                emitter_char(out, '.');
+                print_text(out, condition_names[inst->cond]);
+            }
+            if (inst->op == IR_LOAD || inst->op == IR_STORE || inst->op == IR_EXTEND) {
+                emitter_char(out, '.');
+                emitter_integer(out, inst->size);
+            }
+            if (inst->op == IR_CONST || inst->op == IR_PARAM || inst->op == IR_LOCAL || inst->op == IR_STRING) {
+                emitter_char(out, ' ');
+                emitter_integer(out, inst->value);
+            }
+            if (inst->symbol != NULL) {
+                emitter_char(out, ' ');
+                print_text(out, inst->symbol);
+            }
+            for (int i = 0; i < inst->operand_count; i++) {
+                print_text(out, i == 0 ? " %" : ", %");
+                emitter_integer(out, inst->operands[i]->id);
+            }
+            for (int s = 0; s < block->successor_count && ir_terminator(block) == inst; s++) {
+                print_text(out, s == 0 && inst->operand_count == 0 ? " b" : ", b");
+                emitter_integer(out, block->successors[s]->id);
+            }
+            emitter_char(out, '\n');
+        }
+    }
+}
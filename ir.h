@@ -0,0 +1,165 @@
+#ifndef IR_H
+#define IR_H
+
+#include "codegen.h"
+
+// Typed three-address intermediate representation in SSA form, used
+// between the AST and instruction selection when optimizing. Instructions
+// live in the basic blocks of the function's control-flow graph and are
+// themselves the values they compute. Loads, stores and arithmetic on
+// vectors work lane by lane; a vector load or store accesses its lanes'
+// `size`-byte elements in a row, and a vector shift's count is a scalar
+// constant.
+
+typedef enum {
+    IR_VOID,
+    IR_I32,                  // int and narrower, sign- or zero-extended
+    IR_I64,                  // long and pointers
+    IR_V32                   // gen->vector_width lanes of 32 bits, made by vectorize_loops
+} IrType;
+
+typedef enum {
+    IR_CONST,                // `value`, sign-extended from the type's width
+    IR_UNDEF,                // Read of a variable no assignment reaches
+    IR_PARAM,                // Incoming argument number `value`
+    IR_LOCAL,                // Address of frame variable `value`
+    IR_GLOBAL,               // Address of `symbol`
+    IR_STRING,               // Address of string literal `value` of the function
+    IR_LOAD,                 // `size` bytes at operand 0, extended per is_signed
+    IR_STORE,                // Low `size` bytes of operand 1 to operand 0
+    IR_ADD,
+    IR_SUB,
+    IR_MUL,
+    IR_DIV,                  // Signed or unsigned per is_signed
+    IR_REM,
+    IR_AND,
+    IR_OR,
+    IR_XOR,
+    IR_SHL,                  // Operand 1 is the count, of any type
+    IR_SHR,                  // Arithmetic when is_signed
+    IR_NEG,
+    IR_NOT,
+    IR_CMP,                  // 1 if operand 0 `cond` operand 1, else 0
+    IR_EXTEND,               // Low `size` bytes of operand 0, extended per is_signed
+    IR_TRUNCATE,             // Low 32 bits of a 64-bit operand
+    IR_SELECT,               // Operand 1 if operand 0 is nonzero, else operand 2
+    IR_BROADCAST,            // Vector of operand 0 in every lane
+    IR_REDUCE,               // Sum of the lanes of vector operand 0
+    IR_CALL,                 // `value` arguments, then the target when `symbol` is NULL
+    IR_PHI,                  // One operand per predecessor of the block, in order
+    IR_COPY,
+    IR_JUMP,                 // Terminators; targets are the block's successors
+    IR_BRANCH,               // To successors[0] when operand 0 is nonzero
+    IR_RETURN                // Operand 0, if any, is the return value
+} IrOpcode;
+
+typedef struct IrInst {
+    IrOpcode op;
+    IrType type;
+    int id;                  // Index in IrFunction.values
+    struct IrInst** operands;
+    int operand_count;
+    int operand_capacity;
+    long long value;
+    int size;
+    bool is_signed;
+    bool is_variadic;        // Calls to variadic functions
+    bool is_tail;            // Calls made as a jump, for the return after them
+    ConditionCode cond;      // Comparisons, using the x86 condition codes
+    const char* symbol;
+    BasicBlock* block;
+    struct IrInst* prev;
+    struct IrInst* next;
+    int vreg;                // Virtual register during instruction selection
+} IrInst;
+
+// Frame variable of the function being compiled
+typedef struct {
+    Type* type;              // Borrowed from its declaration
+    int offset;              // From %rbp, set by instruction selection
+    bool is_promoted;        // Replaced by SSA values
+} IrLocal;
+
+typedef struct IrFunction {
+    const char* name;
+    Type* return_type;
+    int param_count;
+    IrInst** values;         // Every instruction created, removed or not
+    int value_count;
+    int value_capacity;
+    IrLocal* locals;         // The parameters first
+    int local_count;
+    int local_capacity;
+} IrFunction;
+
+// Construction (ir.c). build_ir lowers the statements of each reachable
+// block of the function's CFG, splitting blocks where && and || need
+// control flow of their own, and drops the unreachable ones.
+void build_ir(CodeGenerator* gen, Statement* function);
+void free_ir(CodeGenerator* gen);
+
+// Instruction and CFG editing
+IrInst* ir_new(IrFunction* fn, IrOpcode op, IrType type);
+void ir_add_operand(IrInst* inst, IrInst* operand);
+void ir_append(BasicBlock* block, IrInst* inst);
+void ir_insert_before(IrInst* position, IrInst* inst);
+void ir_remove(IrInst* inst);
+IrInst* ir_terminator(const BasicBlock* block);
+bool ir_has_side_effects(const IrInst* inst);
+int ir_predecessor_index(const BasicBlock* from, int successor);
+void ir_remove_edge(BasicBlock* from, int successor);
+void ir_remove_unreachable_blocks(CodeGenerator* gen);
+BasicBlock* ir_split_edge(CodeGenerator* gen, BasicBlock* from, int successor);
+
+// Instructions of the current function that end up as machine code,
+// roughly
+int ir_size(CodeGenerator* gen);
+
+// Constant folding shared by the passes; false when the result is not
+// defined or the operation may trap
+bool ir_fold(const IrInst* inst, const long long* operands, long long* result);
+long long ir_normalize(IrType type, long long value);
+
+// Readable listing, for tests and debugging
+void ir_print(CodeGenerator* gen, Emitter* out);
+
+// SSA passes (ssa.c)
+void promote_locals(CodeGenerator* gen);        // mem2reg
+void propagate_constants(CodeGenerator* gen);   // Sparse conditional constant propagation
+void eliminate_common_subexpressions(CodeGenerator* gen); // Over the dominator tree
+
+// Inlining (inline.c): calls to small functions of gen->functions are
+// replaced by copies of their bodies. inline_budget is how big a callee
+// may be at a call: bigger when it is declared inline, for constant
+// arguments and when the call is in a loop.
+void inline_calls(CodeGenerator* gen);
+int inline_budget(Statement* callee, int constant_count, bool in_loop);
+
+// Specialization (ipcp.c): the current function's IR becomes the code
+// gen->specialization describes, named after it and with its parameters
+// bound; calls whose constant arguments a clone was made for are
+// redirected to it
+void specialize_function(CodeGenerator* gen);
+void specialize_calls(CodeGenerator* gen);
+
+// Tail calls (tailcall.c): calls to the function itself that it returns
+// the value of become jumps back to its start, early; other calls it
+// returns the value of are marked is_tail, last, when the frame allows
+void eliminate_tail_recursion(CodeGenerator* gen);
+void mark_tail_calls(CodeGenerator* gen);
+
+// Loop passes (loop.c)
+void hoist_loop_invariants(CodeGenerator* gen); // Loop-invariant code motion
+void reduce_induction_variables(CodeGenerator* gen); // Strength reduction and test replacement
+void vectorize_loops(CodeGenerator* gen);       // SIMD loops with a scalar epilogue
+void unroll_loops(CodeGenerator* gen);          // Complete, or partial with an epilogue loop
+
+// SSE registers vector values are kept in; instruction selection has the
+// rest for temporaries
+#define VECTOR_REGISTERS 12
+
+// Instruction selection (isel.c): the IR of the current function into
+// gen->body, with virtual registers
+void select_instructions(CodeGenerator* gen);
+
+#endif // IR_H
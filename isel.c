@@ -0,0 +1,1173 @@
+#include "ir.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Instruction selection: each IR instruction becomes a short sequence of
+// x86-64 instructions on virtual registers, one per value. Constants and
+// addresses are not given registers but rematerialized where they are
+// used, folded into immediates and memory operands when they fit. Phis
+// become copies at the end of the predecessors, so edges into blocks
+// with phis must not be critical.
+
+static const int argument_registers[6] = {
+    REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9
+};
+
+static const Operand no_operand = {OPERAND_NONE, 0, -1, 0, NULL};
+
+typedef struct {
+    CodeGenerator* gen;
+    IrFunction* fn;
+    int* use_count;          // By value id
+    bool* is_fused;          // Comparisons only ever tested by branches and selects
+} Selector;
+
+static void emit(Selector* sel, X86Opcode opcode, Operand src, Operand dst) {
+    MInst inst = {opcode, COND_O, src, dst};
+    emit_instruction(sel->gen, &inst);
+}
+
+static void emit_unary(Selector* sel, X86Opcode opcode, Operand dst) {
+    emit(sel, opcode, no_operand, dst);
+}
+
+static void emit_conditional(Selector* sel, X86Opcode opcode, ConditionCode cond, Operand dst) {
+    MInst inst = {opcode, cond, no_operand, dst};
+    emit_instruction(sel->gen, &inst);
+}
+
+static void emit_jump(Selector* sel, X86Opcode opcode, ConditionCode cond, int label) {
+    emit_conditional(sel, opcode, cond, operand_label(sel->gen->function_name, label));
+}
+
+static Operand reg64(int reg) {
+    return operand_register(reg, 8);
+}
+
+static Operand reg32(int reg) {
+    return operand_register(reg, 4);
+}
+
+static int value_size(const IrInst* value) {
+    return value->type == IR_I64 ? 8 : 4;
+}
+
+static bool is_rematerialized(const IrInst* value) {
+    return value->op == IR_CONST || value->op == IR_UNDEF || value->op == IR_LOCAL ||
+           value->op == IR_GLOBAL || value->op == IR_STRING;
+}
+
+static bool fits_immediate(const IrInst* value) {
+    return value->op == IR_CONST && value->value >= -2147483648LL && value->value <= 2147483647LL;
+}
+
+static Operand local_slot(Selector* sel, const IrInst* address, int size) {
+    return operand_memory(REG_RBP, sel->fn->locals[address->value].offset, size);
+}
+
+// Compute a rematerialized value into `reg`
+static void materialize(Selector* sel, const IrInst* value, int reg) {
+    switch (value->op) {
+        case IR_CONST: {
+            long long constant = value->value;
+            if (constant == 0) {
+                emit(sel, X86_XOR, reg32(reg), reg32(reg));
+            } else if (value->type == IR_I32 || (constant >= 0 && constant <= 0xffffffffLL)) {
+                emit(sel, X86_MOV, operand_immediate(constant & 0xffffffffLL), reg32(reg));
+            } else if (constant >= -2147483648LL && constant <= 2147483647LL) {
+                emit(sel, X86_MOV, operand_immediate(constant), reg64(reg));
+            } else {
+                emit(sel, X86_MOVABS, operand_immediate(constant), reg64(reg));
+            }
+            break;
+        }
+        case IR_UNDEF:
+            emit(sel, X86_XOR, reg32(reg), reg32(reg));
+            break;
+        case IR_LOCAL:
+            emit(sel, X86_LEA, local_slot(sel, value, 0), reg64(reg));
+            break;
+        case IR_GLOBAL:
+            emit(sel, X86_LEA, operand_symbol(value->symbol, 0), reg64(reg));
+            break;
+        case IR_STRING:
+            emit(sel, X86_LEA, operand_string(sel->gen->function_name, (int)value->value), reg64(reg));
+            break;
+        default:
+            emit(sel, X86_MOV, reg64(value->vreg), reg64(reg));
+            break;
+    }
+}
+
+// A register holding the value
+static int value_register(Selector* sel, const IrInst* value) {
+    if (!is_rematerialized(value)) return value->vreg;
+    int reg = get_register(sel->gen);
+    materialize(sel, value, reg);
+    return reg;
+}
+
+// The value as a source operand: an immediate when it fits
+static Operand value_operand(Selector* sel, const IrInst* value, int size) {
+    if (fits_immediate(value)) return operand_immediate(value->value);
+    return operand_register(value_register(sel, value), size);
+}
+
+// A constant offset from an address folds into the displacement
+static bool is_offset_address(const IrInst* address) {
+    return address->op == IR_ADD && address->type == IR_I64 && fits_immediate(address->operands[1]) &&
+           address->operands[0]->op != IR_GLOBAL && address->operands[0]->op != IR_CONST;
+}
+
+// Memory operand at the address `address`
+static Operand memory_at(Selector* sel, const IrInst* address, int size) {
+    if (is_offset_address(address)) {
+        const IrInst* base = address->operands[0];
+        long long offset = address->operands[1]->value;
+        if (base->op == IR_LOCAL) {
+            return operand_memory(REG_RBP, sel->fn->locals[base->value].offset + offset, size);
+        }
+        return operand_memory(value_register(sel, base), offset, size);
+    }
+    if (address->op == IR_LOCAL) return local_slot(sel, address, size);
+    if (address->op == IR_GLOBAL) return operand_symbol(address->symbol, size);
+    return operand_memory(value_register(sel, address), 0, size);
+}
+
+// Result register of `inst`, starting out as a copy of `value`
+static Operand copy_into_result(Selector* sel, const IrInst* inst, const IrInst* value) {
+    Operand result = operand_register(inst->vreg, value_size(inst));
+    if (is_rematerialized(value)) {
+        materialize(sel, value, inst->vreg);
+    } else {
+        emit(sel, X86_MOV, reg64(value->vreg), reg64(inst->vreg));
+    }
+    return result;
+}
+
+static ConditionCode swapped_condition(ConditionCode cond) {
+    switch (cond) {
+        case COND_L: return COND_G;
+        case COND_G: return COND_L;
+        case COND_LE: return COND_GE;
+        case COND_GE: return COND_LE;
+        case COND_B: return COND_A;
+        case COND_A: return COND_B;
+        case COND_BE: return COND_AE;
+        case COND_AE: return COND_BE;
+        default: return cond;
+    }
+}
+
+static bool is_commutative(IrOpcode op) {
+    return op == IR_ADD || op == IR_MUL || op == IR_AND || op == IR_OR || op == IR_XOR;
+}
+
+static void select_arithmetic(Selector* sel, IrInst* inst) {
+    IrInst* left = inst->operands[0];
+    IrInst* right = inst->operands[1];
+    if (is_commutative(inst->op) && fits_immediate(left) && !fits_immediate(right)) {
+        IrInst* swap = left;
+        left = right;
+        right = swap;
+    }
+    int size = value_size(inst);
+    X86Opcode opcode = X86_ADD;
+    switch (inst->op) {
+        case IR_SUB: opcode = X86_SUB; break;
+        case IR_MUL: opcode = X86_IMUL; break;
+        case IR_AND: opcode = X86_AND; break;
+        case IR_OR: opcode = X86_OR; break;
+        case IR_XOR: opcode = X86_XOR; break;
+        default: break;
+    }
+    // Multiplications by powers of two, such as index scaling, are shifts
+    if (inst->op == IR_MUL && right->op == IR_CONST && right->value > 0 && (right->value & (right->value - 1)) == 0) {
+        int shift = 0;
+        while ((1LL << shift) < right->value) shift++;
+        emit(sel, X86_SHL, operand_immediate(shift), copy_into_result(sel, inst, left));
+        return;
+    }
+    Operand source = value_operand(sel, right, size);
+    emit(sel, opcode, source, copy_into_result(sel, inst, left));
+}
+
+// Magic numbers for division by a constant, as computed in Hacker's
+// Delight (10-1 and 10-10). The quotient is the high half of the
+// dividend times `multiplier`, shifted right by `shift`.
+typedef struct {
+    unsigned long long multiplier;
+    int shift;
+    bool has_carry;          // Unsigned: the multiplier has one bit more, 2^bits
+} Magic;
+
+static Magic signed_magic(long long divisor, int bits) {
+    unsigned long long mask = bits == 64 ? ~0ULL : (1ULL << bits) - 1;
+    unsigned long long top = 1ULL << (bits - 1);
+    unsigned long long d = (unsigned long long)divisor & mask;
+    unsigned long long ad = divisor < 0 ? (0 - d) & mask : d;
+    unsigned long long t = top + (d >> (bits - 1));
+    unsigned long long anc = t - 1 - t % ad;
+    unsigned long long q1 = top / anc, r1 = top - q1 * anc;
+    unsigned long long q2 = top / ad, r2 = top - q2 * ad;
+    unsigned long long delta;
+    int p = bits - 1;
+    do {
+        p++;
+        q1 = (q1 * 2) & mask;
+        r1 = (r1 * 2) & mask;
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+        q2 = (q2 * 2) & mask;
+        r2 = (r2 * 2) & mask;
+        if (r2 >= ad) {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    Magic magic = {(q2 + 1) & mask, p - bits, false};
+    if (divisor < 0) magic.multiplier = (0 - magic.multiplier) & mask;
+    return magic;
+}
+
+static Magic unsigned_magic(unsigned long long d, int bits) {
+    unsigned long long mask = bits == 64 ? ~0ULL : (1ULL << bits) - 1;
+    unsigned long long top = 1ULL << (bits - 1);
+    unsigned long long nc = (mask - ((0 - d) & mask) % d) & mask;
+    unsigned long long q1 = top / nc, r1 = top - q1 * nc;
+    unsigned long long q2 = (top - 1) / d, r2 = (top - 1) - q2 * d;
+    unsigned long long delta;
+    bool has_carry = false;
+    int p = bits - 1;
+    do {
+        p++;
+        if (r1 >= nc - r1) {
+            q1 = (q1 * 2 + 1) & mask;
+            r1 = (r1 * 2 - nc) & mask;
+        } else {
+            q1 = (q1 * 2) & mask;
+            r1 = (r1 * 2) & mask;
+        }
+        if (r2 + 1 >= d - r2) {
+            if (q2 >= top - 1) has_carry = true;
+            q2 = (q2 * 2 + 1) & mask;
+            r2 = (r2 * 2 + 1 - d) & mask;
+        } else {
+            if (q2 >= top) has_carry = true;
+            q2 = (q2 * 2) & mask;
+            r2 = (r2 * 2 + 1) & mask;
+        }
+        delta = d - 1 - r2;
+    } while (p < bits * 2 && (q1 < delta || (q1 == delta && r1 == 0)));
+    Magic magic = {(q2 + 1) & mask, p - bits, has_carry};
+    return magic;
+}
+
+// A constant as a source operand of a `size`-byte operation: an
+// immediate when it fits, else loaded into a register
+static Operand constant_operand(Selector* sel, unsigned long long value, int size) {
+    long long immediate = size == 4 ? (long long)(int)value : (long long)value;
+    if (immediate >= -2147483648LL && immediate <= 2147483647LL) return operand_immediate(immediate);
+    int reg = get_register(sel->gen);
+    if (value <= 0xffffffffULL) {
+        emit(sel, X86_MOV, operand_immediate((long long)value), reg32(reg));
+    } else {
+        emit(sel, X86_MOVABS, operand_immediate((long long)value), reg64(reg));
+    }
+    return reg64(reg);
+}
+
+// High half of the unsigned 128-bit product of `reg` and `multiplier`,
+// into a new register. `factor` is set to the register holding the
+// multiplier.
+static int multiply_high(Selector* sel, int reg, unsigned long long multiplier, int* factor) {
+    Operand operand = constant_operand(sel, multiplier, 8);
+    if (operand.kind == OPERAND_IMMEDIATE) {
+        operand = reg64(get_register(sel->gen));
+        emit(sel, X86_MOV, operand_immediate((long long)multiplier), operand);
+    }
+    *factor = operand.reg;
+    emit(sel, X86_MOV, reg64(reg), reg64(REG_RAX));
+    emit_unary(sel, X86_MUL, operand);
+    int high = get_register(sel->gen);
+    emit(sel, X86_MOV, reg64(REG_RDX), reg64(high));
+    return high;
+}
+
+// The quotient of `dividend` by a divisor that is neither 0, 1, -1 nor
+// a power of two, into a new register. 32-bit dividends are extended and
+// multiplied in 64 bits, where the product is exact.
+static int divide_by_magic(Selector* sel, int dividend, long long divisor, bool is_signed, int size) {
+    int bits = size * 8;
+    int quotient = get_register(sel->gen);
+    if (is_signed) {
+        Magic magic = signed_magic(divisor, bits);
+        if (size == 4) {
+            // The exact multiplier, whose top bit signed_magic drops
+            long long multiplier = (int)magic.multiplier;
+            if (divisor > 0 && multiplier < 0) multiplier += 1LL << 32;
+            if (divisor < 0 && multiplier > 0) multiplier -= 1LL << 32;
+            emit(sel, X86_MOVSX, reg32(dividend), reg64(quotient));
+            emit(sel, X86_IMUL, constant_operand(sel, (unsigned long long)multiplier, 8), reg64(quotient));
+            emit(sel, X86_SAR, operand_immediate(32 + magic.shift), reg64(quotient));
+        } else {
+            // The signed high half from the unsigned one, and the
+            // dividend subtracted for negative divisors
+            int factor;
+            int high = multiply_high(sel, dividend, magic.multiplier, &factor);
+            int sign = get_register(sel->gen);
+            emit(sel, X86_MOV, reg64(dividend), reg64(sign));
+            emit(sel, X86_SAR, operand_immediate(63), reg64(sign));
+            emit(sel, X86_AND, reg64(factor), reg64(sign));
+            emit(sel, X86_SUB, reg64(sign), reg64(high));
+            if (divisor < 0) emit(sel, X86_SUB, reg64(dividend), reg64(high));
+            emit(sel, X86_MOV, reg64(high), reg64(quotient));
+            if (magic.shift > 0) emit(sel, X86_SAR, operand_immediate(magic.shift), reg64(quotient));
+        }
+        // Rounded toward zero rather than down
+        int round = get_register(sel->gen);
+        emit(sel, X86_MOV, operand_register(quotient, size), operand_register(round, size));
+        emit(sel, X86_SHR, operand_immediate(bits - 1), operand_register(round, size));
+        emit(sel, X86_ADD, operand_register(round, size), operand_register(quotient, size));
+        return quotient;
+    }
+
+    Magic magic = unsigned_magic((unsigned long long)divisor & (size == 4 ? 0xffffffffULL : ~0ULL), bits);
+    if (size == 4) {
+        int extended = get_register(sel->gen);
+        emit(sel, X86_MOV, reg32(dividend), reg32(extended));
+        emit(sel, X86_MOV, reg64(extended), reg64(quotient));
+        emit(sel, X86_IMUL, constant_operand(sel, magic.multiplier, 8), reg64(quotient));
+        if (!magic.has_carry) {
+            emit(sel, X86_SHR, operand_immediate(32 + magic.shift), reg64(quotient));
+            return quotient;
+        }
+        // Adding the dividend supplies the multiplier's top bit
+        emit(sel, X86_SHR, operand_immediate(32), reg64(quotient));
+        emit(sel, X86_ADD, reg64(extended), reg64(quotient));
+        emit(sel, X86_SHR, operand_immediate(magic.shift), reg64(quotient));
+        return quotient;
+    }
+    int factor;
+    int high = multiply_high(sel, dividend, magic.multiplier, &factor);
+    if (!magic.has_carry) {
+        emit(sel, X86_MOV, reg64(high), reg64(quotient));
+        if (magic.shift > 0) emit(sel, X86_SHR, operand_immediate(magic.shift), reg64(quotient));
+        return quotient;
+    }
+    // ((n - high) / 2 + high) >> (shift - 1), which cannot overflow
+    emit(sel, X86_MOV, reg64(dividend), reg64(quotient));
+    emit(sel, X86_SUB, reg64(high), reg64(quotient));
+    emit(sel, X86_SHR, operand_immediate(1), reg64(quotient));
+    emit(sel, X86_ADD, reg64(high), reg64(quotient));
+    if (magic.shift > 1) emit(sel, X86_SHR, operand_immediate(magic.shift - 1), reg64(quotient));
+    return quotient;
+}
+
+// Division and remainder by a nonzero constant without a divide
+// instruction: shifts and masks for powers of two, a comparison for
+// unsigned divisors with the top bit set, and a multiplication by a
+// magic number otherwise. The remainder is the dividend less the
+// quotient times the divisor.
+static void select_constant_division(Selector* sel, IrInst* inst) {
+    int size = value_size(inst);
+    int bits = size * 8;
+    Operand result = operand_register(inst->vreg, size);
+    long long divisor = inst->operands[1]->value;
+    unsigned long long mask = size == 4 ? 0xffffffffULL : ~0ULL;
+    unsigned long long magnitude = (unsigned long long)divisor & mask;
+    if (inst->is_signed && divisor < 0) magnitude = (0 - magnitude) & mask;
+    int dividend = value_register(sel, inst->operands[0]);
+    Operand source = operand_register(dividend, size);
+    int shift = 0;
+    while (shift < bits && (1ULL << shift) != magnitude) shift++;
+    bool is_power = shift < bits;
+
+    if (magnitude == 1) {
+        if (inst->op == IR_REM) {
+            emit(sel, X86_XOR, reg32(inst->vreg), reg32(inst->vreg));
+            return;
+        }
+        emit(sel, X86_MOV, source, result);
+        if (inst->is_signed && divisor < 0) emit_unary(sel, X86_NEG, result);
+        return;
+    }
+    if (is_power && !inst->is_signed) {
+        emit(sel, X86_MOV, source, result);
+        if (inst->op == IR_DIV) {
+            emit(sel, X86_SHR, operand_immediate(shift), result);
+        } else {
+            emit(sel, X86_AND, constant_operand(sel, magnitude - 1, size), result);
+        }
+        return;
+    }
+    if (is_power) {
+        // Negative dividends are biased by 2^shift - 1 to round toward zero
+        emit(sel, X86_MOV, source, result);
+        emit(sel, X86_SAR, operand_immediate(bits - 1), result);
+        emit(sel, X86_SHR, operand_immediate(bits - shift), result);
+        emit(sel, X86_ADD, source, result);
+        if (inst->op == IR_DIV) {
+            emit(sel, X86_SAR, operand_immediate(shift), result);
+            if (divisor < 0) emit_unary(sel, X86_NEG, result);
+        } else {
+            emit(sel, X86_AND, constant_operand(sel, (0 - magnitude) & mask, size), result);
+            emit_unary(sel, X86_NEG, result);
+            emit(sel, X86_ADD, source, result);
+        }
+        return;
+    }
+    if (!inst->is_signed && (magnitude >> (bits - 1)) != 0) {
+        // The quotient is 0 or 1
+        Operand limit = constant_operand(sel, magnitude, size);
+        if (inst->op == IR_DIV) {
+            emit(sel, X86_CMP, limit, source);
+            emit_conditional(sel, X86_SETCC, COND_AE, operand_register(inst->vreg, 1));
+            emit(sel, X86_MOVZX, operand_register(inst->vreg, 1), reg32(inst->vreg));
+            return;
+        }
+        int reduced = get_register(sel->gen);
+        emit(sel, X86_MOV, source, result);
+        emit(sel, X86_MOV, source, operand_register(reduced, size));
+        emit(sel, X86_SUB, limit, operand_register(reduced, size));
+        MInst cmov = {X86_CMOV, COND_AE, operand_register(reduced, size), result};
+        emit_instruction(sel->gen, &cmov);
+        return;
+    }
+
+    int quotient = divide_by_magic(sel, dividend, divisor, inst->is_signed, size);
+    if (inst->op == IR_DIV) {
+        emit(sel, X86_MOV, operand_register(quotient, size), result);
+        return;
+    }
+    emit(sel, X86_IMUL, constant_operand(sel, (unsigned long long)divisor & mask, size), operand_register(quotient, size));
+    emit(sel, X86_MOV, source, result);
+    emit(sel, X86_SUB, operand_register(quotient, size), result);
+}
+
+static void select_division(Selector* sel, IrInst* inst) {
+    if (inst->operands[1]->op == IR_CONST && inst->operands[1]->value != 0) {
+        select_constant_division(sel, inst);
+        return;
+    }
+    int size = value_size(inst);
+    Operand rax = operand_register(REG_RAX, size);
+    int divisor = value_register(sel, inst->operands[1]);
+    IrInst* dividend = inst->operands[0];
+    if (is_rematerialized(dividend)) {
+        materialize(sel, dividend, REG_RAX);
+    } else {
+        emit(sel, X86_MOV, operand_register(dividend->vreg, size), rax);
+    }
+    if (inst->is_signed) {
+        emit_unary(sel, size == 8 ? X86_CQTO : X86_CLTD, no_operand);
+        emit_unary(sel, X86_IDIV, operand_register(divisor, size));
+    } else {
+        emit(sel, X86_XOR, reg32(REG_RDX), reg32(REG_RDX));
+        emit_unary(sel, X86_DIV, operand_register(divisor, size));
+    }
+    Operand result = inst->op == IR_DIV ? rax : operand_register(REG_RDX, size);
+    emit(sel, X86_MOV, result, operand_register(inst->vreg, size));
+}
+
+static void select_shift(Selector* sel, IrInst* inst) {
+    int size = value_size(inst);
+    X86Opcode opcode = inst->op == IR_SHL ? X86_SHL : (inst->is_signed ? X86_SAR : X86_SHR);
+    IrInst* count = inst->operands[1];
+    if (count->op == IR_CONST) {
+        Operand result = copy_into_result(sel, inst, inst->operands[0]);
+        emit(sel, opcode, operand_immediate(count->value & (size * 8 - 1)), result);
+        return;
+    }
+    int count_reg = value_register(sel, count);
+    Operand result = copy_into_result(sel, inst, inst->operands[0]);
+    emit(sel, X86_MOV, reg32(count_reg), reg32(REG_RCX));
+    emit(sel, opcode, operand_register(REG_RCX, 1), result);
+}
+
+// Set the flags for a comparison; returns the condition to test
+static ConditionCode emit_compare(Selector* sel, const IrInst* inst) {
+    IrInst* left = inst->operands[0];
+    IrInst* right = inst->operands[1];
+    ConditionCode cond = inst->cond;
+    if (fits_immediate(left) && !fits_immediate(right)) {
+        IrInst* swap = left;
+        left = right;
+        right = swap;
+        cond = swapped_condition(cond);
+    }
+    int size = value_size(left);
+    if (right->op == IR_CONST && right->value == 0) {
+        Operand value = operand_register(value_register(sel, left), size);
+        emit(sel, X86_TEST, value, value);
+        return cond;
+    }
+    Operand source = value_operand(sel, right, size);
+    emit(sel, X86_CMP, source, operand_register(value_register(sel, left), size));
+    return cond;
+}
+
+// Set the flags for a condition: a fused comparison, or any value
+// tested against zero
+static ConditionCode emit_condition(Selector* sel, const IrInst* condition) {
+    if (sel->is_fused[condition->id]) return emit_compare(sel, condition);
+    int size = value_size(condition);
+    Operand value = operand_register(value_register(sel, condition), size);
+    emit(sel, X86_TEST, value, value);
+    return COND_NE;
+}
+
+// Comparisons are only turned into 0 or 1 when used as values
+static void select_compare(Selector* sel, IrInst* inst) {
+    ConditionCode cond = emit_compare(sel, inst);
+    emit_conditional(sel, X86_SETCC, cond, operand_register(inst->vreg, 1));
+    emit(sel, X86_MOVZX, operand_register(inst->vreg, 1), reg32(inst->vreg));
+}
+
+// The false value, replaced by the true one with cmov. Both are ready
+// before the flags are set, since materializing zero clobbers them.
+static void select_select(Selector* sel, IrInst* inst) {
+    Operand result = copy_into_result(sel, inst, inst->operands[2]);
+    int if_true = value_register(sel, inst->operands[1]);
+    ConditionCode cond = emit_condition(sel, inst->operands[0]);
+    MInst cmov = {X86_CMOV, cond, operand_register(if_true, result.size), result};
+    emit_instruction(sel->gen, &cmov);
+}
+
+static void select_extend(Selector* sel, IrInst* inst) {
+    int source = value_register(sel, inst->operands[0]);
+    if (inst->size == 4) {
+        if (inst->is_signed) {
+            emit(sel, X86_MOVSX, reg32(source), reg64(inst->vreg));
+        } else {
+            emit(sel, X86_MOV, reg32(source), reg32(inst->vreg));
+        }
+        return;
+    }
+    emit(sel, inst->is_signed ? X86_MOVSX : X86_MOVZX, operand_register(source, inst->size), reg32(inst->vreg));
+}
+
+static void select_load(Selector* sel, IrInst* inst) {
+    Operand address = memory_at(sel, inst->operands[0], inst->size);
+    if (inst->size < 4) {
+        emit(sel, inst->is_signed ? X86_MOVSX : X86_MOVZX, address, reg32(inst->vreg));
+    } else {
+        emit(sel, X86_MOV, address, operand_register(inst->vreg, inst->size));
+    }
+}
+
+static void select_store(Selector* sel, IrInst* inst) {
+    IrInst* value = inst->operands[1];
+    Operand source = value_operand(sel, value, inst->size);
+    emit(sel, X86_MOV, source, memory_at(sel, inst->operands[0], inst->size));
+}
+
+// Vector values live in the SSE register numbered by their vreg; the
+// registers past them are temporaries
+static Operand vector_register(Selector* sel, int reg) {
+    return operand_vector(reg, sel->gen->vector_width * 4);
+}
+
+static Operand vector_of(Selector* sel, const IrInst* value) {
+    return vector_register(sel, value->vreg);
+}
+
+// Result register of a vector operation, starting out as a copy of
+// `value`. Only `value` may share the register, so the other operand
+// is left alone.
+static Operand copy_into_vector(Selector* sel, const IrInst* inst, const IrInst* value) {
+    Operand result = vector_of(sel, inst);
+    if (value->vreg != inst->vreg) emit(sel, X86_MOVDQA, vector_of(sel, value), result);
+    return result;
+}
+
+static void select_broadcast(Selector* sel, IrInst* inst) {
+    Operand result = vector_of(sel, inst);
+    IrInst* value = inst->operands[0];
+    if (value->op == IR_UNDEF || (value->op == IR_CONST && value->value == 0)) {
+        emit(sel, X86_PXOR, result, result);
+        return;
+    }
+    emit(sel, X86_MOVD, reg32(value_register(sel, value)), result);
+    if (sel->gen->vector_width == 8) {
+        emit(sel, X86_VPBROADCASTD, operand_vector(inst->vreg, 16), result);
+    } else {
+        emit(sel, X86_PUNPCKLDQ, result, result);
+        emit(sel, X86_PUNPCKLQDQ, result, result);
+    }
+}
+
+// SSE2 has no 32-bit lanewise multiply: pmuludq gives the 64-bit
+// products of the even lanes, and then of the odd ones shifted down
+static void select_vector_multiply(Selector* sel, IrInst* inst) {
+    Operand result = copy_into_vector(sel, inst, inst->operands[0]);
+    Operand right = vector_of(sel, inst->operands[1]);
+    if (sel->gen->vector_width == 8) {
+        emit(sel, X86_PMULLD, right, result);
+        return;
+    }
+    Operand odd = vector_register(sel, VECTOR_REGISTERS);
+    Operand odd_right = vector_register(sel, VECTOR_REGISTERS + 1);
+    emit(sel, X86_MOVDQA, result, odd);
+    emit(sel, X86_PMULUDQ, right, result);
+    emit(sel, X86_PSLLQ, operand_immediate(32), result);
+    emit(sel, X86_PSRLQ, operand_immediate(32), result);
+    emit(sel, X86_PSRLQ, operand_immediate(32), odd);
+    emit(sel, X86_MOVDQA, right, odd_right);
+    emit(sel, X86_PSRLQ, operand_immediate(32), odd_right);
+    emit(sel, X86_PMULUDQ, odd_right, odd);
+    emit(sel, X86_PSLLQ, operand_immediate(32), odd);
+    emit(sel, X86_POR, odd, result);
+}
+
+// The lanes added up: the upper half of the vector onto the lower, until
+// one lane is left
+static void select_reduce(Selector* sel, IrInst* inst) {
+    Operand sum = vector_register(sel, VECTOR_REGISTERS);
+    Operand part = vector_register(sel, VECTOR_REGISTERS + 1);
+    Operand vector = vector_of(sel, inst->operands[0]);
+    if (sel->gen->vector_width == 8) {
+        emit(sel, X86_VEXTRACTI128, vector, operand_vector(VECTOR_REGISTERS, 16));
+        emit(sel, X86_PADDD, vector, sum);
+    } else {
+        emit(sel, X86_MOVDQA, vector, sum);
+    }
+    for (int bytes = 8; bytes >= 4; bytes /= 2) {
+        emit(sel, X86_MOVDQA, sum, part);
+        emit(sel, X86_PSRLDQ, operand_immediate(bytes), part);
+        emit(sel, X86_PADDD, part, sum);
+    }
+    emit(sel, X86_MOVD, sum, reg32(inst->vreg));
+}
+
+static void select_vector(Selector* sel, IrInst* inst) {
+    X86Opcode opcode = X86_PADDD;
+    switch (inst->op) {
+        case IR_LOAD:
+            emit(sel, X86_MOVDQU, memory_at(sel, inst->operands[0], sel->gen->vector_width * 4), vector_of(sel, inst));
+            return;
+        case IR_STORE:
+            emit(sel, X86_MOVDQU, vector_of(sel, inst->operands[1]),
+                 memory_at(sel, inst->operands[0], sel->gen->vector_width * 4));
+            return;
+        case IR_BROADCAST:
+            select_broadcast(sel, inst);
+            return;
+        case IR_REDUCE:
+            select_reduce(sel, inst);
+            return;
+        case IR_MUL:
+            select_vector_multiply(sel, inst);
+            return;
+        case IR_SHL:
+        case IR_SHR: {
+            opcode = inst->op == IR_SHL ? X86_PSLLD : (inst->is_signed ? X86_PSRAD : X86_PSRLD);
+            Operand result = copy_into_vector(sel, inst, inst->operands[0]);
+            emit(sel, opcode, operand_immediate(inst->operands[1]->value & 31), result);
+            return;
+        }
+        case IR_NEG: {
+            Operand result = vector_of(sel, inst);
+            emit(sel, X86_PXOR, result, result);
+            emit(sel, X86_PSUBD, vector_of(sel, inst->operands[0]), result);
+            return;
+        }
+        case IR_NOT: {
+            Operand ones = vector_register(sel, VECTOR_REGISTERS);
+            emit(sel, X86_PCMPEQD, ones, ones);
+            emit(sel, X86_PXOR, ones, copy_into_vector(sel, inst, inst->operands[0]));
+            return;
+        }
+        case IR_SUB: opcode = X86_PSUBD; break;
+        case IR_AND: opcode = X86_PAND; break;
+        case IR_OR: opcode = X86_POR; break;
+        case IR_XOR: opcode = X86_PXOR; break;
+        default: break;
+    }
+    Operand right = vector_of(sel, inst->operands[1]);
+    emit(sel, opcode, right, copy_into_vector(sel, inst, inst->operands[0]));
+}
+
+static void select_call(Selector* sel, IrInst* inst) {
+    int arg_count = (int)inst->value;
+    int stack_args = arg_count > 6 ? arg_count - 6 : 0;
+    int target = inst->symbol == NULL ? value_register(sel, inst->operands[arg_count]) : -1;
+
+    // Keep %rsp 16-byte aligned at the call instruction
+    bool padded = stack_args % 2 != 0;
+    if (padded) emit(sel, X86_SUB, operand_immediate(8), reg64(REG_RSP));
+    for (int i = arg_count - 1; i >= 6; i--) {
+        emit_unary(sel, X86_PUSH, reg64(value_register(sel, inst->operands[i])));
+    }
+    for (int i = 0; i < arg_count && i < 6; i++) {
+        IrInst* arg = inst->operands[i];
+        // Left as it is: the callee has no use for it
+        if (arg->op == IR_UNDEF) continue;
+        if (is_rematerialized(arg)) {
+            materialize(sel, arg, argument_registers[i]);
+        } else {
+            emit(sel, X86_MOV, reg64(arg->vreg), reg64(argument_registers[i]));
+        }
+    }
+
+    Operand register_args = operand_immediate(arg_count < 6 ? arg_count : 6);
+    if (inst->is_tail) {
+        // The frame goes, the return address stays: the callee returns
+        // to our caller
+        emit(sel, X86_JMP, register_args, operand_symbol(inst->symbol, 0));
+        return;
+    }
+    if (inst->is_variadic) emit(sel, X86_XOR, reg32(REG_RAX), reg32(REG_RAX));
+    if (sel->gen->has_wide_vectors) emit_unary(sel, X86_VZEROUPPER, no_operand);
+    if (target < 0) {
+        emit(sel, X86_CALL, register_args, operand_symbol(inst->symbol, 0));
+    } else {
+        emit(sel, X86_CALL, register_args, reg64(target));
+    }
+
+    int cleanup = stack_args + (padded ? 1 : 0);
+    if (cleanup > 0) emit(sel, X86_ADD, operand_immediate(cleanup * 8), reg64(REG_RSP));
+    if (inst->vreg >= 0) emit(sel, X86_MOV, reg64(REG_RAX), reg64(inst->vreg));
+}
+
+static bool has_phis(const BasicBlock* block) {
+    return block->first != NULL && block->first->op == IR_PHI;
+}
+
+// Copy `source` into the register of `phi`
+static void copy_into_phi(Selector* sel, const IrInst* source, const IrInst* phi) {
+    if (phi->type == IR_V32) {
+        emit(sel, X86_MOVDQA, vector_of(sel, source), vector_of(sel, phi));
+    } else {
+        materialize(sel, source, phi->vreg);
+    }
+}
+
+// Phi copies on an edge, made at the end of the predecessor. They
+// happen in parallel, so when one reads a phi of the same block every
+// source is copied out first.
+static void select_phi_copies(Selector* sel, BasicBlock* block, int edge) {
+    BasicBlock* successor = block->successors[edge];
+    if (!has_phis(successor)) return;
+    int index = ir_predecessor_index(block, edge);
+
+    bool overlap = false;
+    for (IrInst* phi = successor->first; phi != NULL && phi->op == IR_PHI; phi = phi->next) {
+        IrInst* source = phi->operands[index];
+        if (source->op == IR_PHI && source->block == successor && source != phi) overlap = true;
+    }
+    if (!overlap) {
+        for (IrInst* phi = successor->first; phi != NULL && phi->op == IR_PHI; phi = phi->next) {
+            IrInst* source = phi->operands[index];
+            if (source != phi) copy_into_phi(sel, source, phi);
+        }
+        return;
+    }
+
+    int count = 0;
+    for (IrInst* phi = successor->first; phi != NULL && phi->op == IR_PHI; phi = phi->next) count++;
+    int* temporaries = malloc(sizeof(int) * count);
+    int i = 0;
+    for (IrInst* phi = successor->first; phi != NULL && phi->op == IR_PHI; phi = phi->next, i++) {
+        // Vectors never take the value of a phi of the same block
+        if (phi->type == IR_V32) continue;
+        temporaries[i] = get_register(sel->gen);
+        materialize(sel, phi->operands[index], temporaries[i]);
+    }
+    i = 0;
+    for (IrInst* phi = successor->first; phi != NULL && phi->op == IR_PHI; phi = phi->next, i++) {
+        if (phi->type == IR_V32) {
+            copy_into_phi(sel, phi->operands[index], phi);
+        } else {
+            emit(sel, X86_MOV, reg64(temporaries[i]), reg64(phi->vreg));
+        }
+    }
+    free(temporaries);
+}
+
+static void select_terminator(Selector* sel, BasicBlock* block, IrInst* inst) {
+    CodeGenerator* gen = sel->gen;
+    bool is_last = block->id == gen->block_count - 1;
+    switch (inst->op) {
+        case IR_JUMP: {
+            select_phi_copies(sel, block, 0);
+            BasicBlock* target = block->successors[0];
+            if (target->id != block->id + 1) emit_jump(sel, X86_JMP, COND_O, target->id);
+            break;
+        }
+        case IR_BRANCH: {
+            BasicBlock* if_true = block->successors[0];
+            BasicBlock* if_false = block->successors[1];
+            ConditionCode cond;
+            int back_edge = has_phis(if_true) ? 0 : has_phis(if_false) ? 1 : -1;
+            if (back_edge >= 0) {
+                // The condition then reads the copies of the values it
+                // shares with the phis, so that the originals die there
+                select_phi_copies(sel, block, back_edge);
+                BasicBlock* header = block->successors[back_edge];
+                int index = ir_predecessor_index(block, back_edge);
+                int* vregs = malloc(sizeof(int) * sel->fn->value_count);
+                for (IrInst* phi = header->first; phi != NULL && phi->op == IR_PHI; phi = phi->next) {
+                    IrInst* source = phi->operands[index];
+                    vregs[source->id] = source->vreg;
+                }
+                for (IrInst* phi = header->first; phi != NULL && phi->op == IR_PHI; phi = phi->next) {
+                    IrInst* source = phi->operands[index];
+                    if (!is_rematerialized(source) && source->op != IR_PHI) source->vreg = phi->vreg;
+                }
+                cond = emit_condition(sel, inst->operands[0]);
+                for (IrInst* phi = header->first; phi != NULL && phi->op == IR_PHI; phi = phi->next) {
+                    IrInst* source = phi->operands[index];
+                    source->vreg = vregs[source->id];
+                }
+                free(vregs);
+            } else {
+                cond = emit_condition(sel, inst->operands[0]);
+            }
+            if (if_true->id == block->id + 1) {
+                emit_jump(sel, X86_JCC, cond ^ 1, if_false->id);
+            } else {
+                emit_jump(sel, X86_JCC, cond, if_true->id);
+                if (if_false->id != block->id + 1) emit_jump(sel, X86_JMP, COND_O, if_false->id);
+            }
+            break;
+        }
+        case IR_RETURN:
+            // A tail call has jumped away already
+            if (inst->prev != NULL && inst->prev->op == IR_CALL && inst->prev->is_tail) break;
+            if (inst->operand_count > 0) {
+                IrInst* value = inst->operands[0];
+                if (is_rematerialized(value)) {
+                    materialize(sel, value, REG_RAX);
+                } else {
+                    emit(sel, X86_MOV, reg64(value->vreg), reg64(REG_RAX));
+                }
+            }
+            if (!is_last) emit_jump(sel, X86_JMP, COND_O, LABEL_RETURN);
+            break;
+        default:
+            break;
+    }
+}
+
+static void select_instruction(Selector* sel, IrInst* inst) {
+    bool is_vector = (inst->type == IR_V32 && inst->op != IR_PHI) || inst->op == IR_REDUCE ||
+                     (inst->op == IR_STORE && inst->operands[1]->type == IR_V32);
+    if (is_vector) {
+        select_vector(sel, inst);
+        return;
+    }
+    switch (inst->op) {
+        case IR_ADD: case IR_SUB: case IR_MUL: case IR_AND: case IR_OR: case IR_XOR:
+            select_arithmetic(sel, inst);
+            break;
+        case IR_DIV:
+        case IR_REM:
+            select_division(sel, inst);
+            break;
+        case IR_SHL:
+        case IR_SHR:
+            select_shift(sel, inst);
+            break;
+        case IR_NEG:
+        case IR_NOT:
+            emit_unary(sel, inst->op == IR_NEG ? X86_NEG : X86_NOT, copy_into_result(sel, inst, inst->operands[0]));
+            break;
+        case IR_CMP:
+            select_compare(sel, inst);
+            break;
+        case IR_SELECT:
+            select_select(sel, inst);
+            break;
+        case IR_EXTEND:
+            select_extend(sel, inst);
+            break;
+        case IR_TRUNCATE:
+        case IR_COPY:
+            copy_into_result(sel, inst, inst->operands[0]);
+            break;
+        case IR_LOAD:
+            select_load(sel, inst);
+            break;
+        case IR_STORE:
+            select_store(sel, inst);
+            break;
+        case IR_CALL:
+            select_call(sel, inst);
+            break;
+        default:
+            // Phis are copied into on the way in; parameters are moved at
+            // the entry; constants and addresses are rematerialized
+            break;
+    }
+}
+
+// Frame slots for the locals left in memory, laid out as the AST code
+// generator lays out its locals. Parameters past the sixth stay where
+// the caller put them.
+static void assign_frame_slots(CodeGenerator* gen, IrFunction* fn) {
+    for (int l = 0; l < fn->local_count; l++) {
+        IrLocal* local = &fn->locals[l];
+        if (local->is_promoted) continue;
+        if (l < fn->param_count && l >= 6) {
+            local->offset = 16 + 8 * (l - 6);
+            continue;
+        }
+        int size = type_size(local->type);
+        int align = local->type->kind == TYPE_ARRAY ? (size >= 16 ? 16 : 8) : size;
+        if (align < 1) align = 1;
+        gen->current_stack_offset = (gen->current_stack_offset + size + align - 1) / align * align;
+        local->offset = -gen->current_stack_offset;
+    }
+}
+
+// Whether the copies into the phis of a rotated loop's header can be
+// made ahead of the branch at its bottom: only when nothing on the way
+// out, the branch included, reads the phis they overwrite
+static bool copies_before_branch(CodeGenerator* gen, BasicBlock* latch, int successor) {
+    BasicBlock* header = latch->successors[successor];
+    BasicBlock* exit = latch->successors[1 - successor];
+    if (header == exit || !block_dominates(header, latch)) return false;
+
+    // The loop: the blocks reaching the latch other than through the header
+    bool* in_loop = calloc(gen->block_count, sizeof(bool));
+    BasicBlock** stack = malloc(sizeof(BasicBlock*) * gen->block_count);
+    int stack_count = 0;
+    in_loop[header->id] = true;
+    if (latch != header) {
+        in_loop[latch->id] = true;
+        stack[stack_count++] = latch;
+    }
+    while (stack_count > 0) {
+        BasicBlock* block = stack[--stack_count];
+        for (int p = 0; p < block->predecessor_count; p++) {
+            BasicBlock* predecessor = block->predecessors[p];
+            if (in_loop[predecessor->id]) continue;
+            in_loop[predecessor->id] = true;
+            stack[stack_count++] = predecessor;
+        }
+    }
+
+    bool is_safe = !in_loop[exit->id];
+    for (int b = 0; b < gen->block_count && is_safe; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL && is_safe; inst = inst->next) {
+            for (int i = 0; i < inst->operand_count; i++) {
+                IrInst* operand = inst->operands[i];
+                if (operand->op == IR_PHI && operand->block == header && !in_loop[b]) is_safe = false;
+            }
+        }
+    }
+    IrInst* condition = ir_terminator(latch)->operands[0];
+    if (condition->op == IR_PHI && condition->block == header) is_safe = false;
+    if (condition->op == IR_CMP) {
+        for (int i = 0; i < 2; i++) {
+            IrInst* operand = condition->operands[i];
+            if (operand->op == IR_PHI && operand->block == header) is_safe = false;
+        }
+    }
+    free(in_loop);
+    free(stack);
+    return is_safe;
+}
+
+// A block with phis gets the copies of each incoming edge at the end of
+// the predecessor, which must then have no other successor. The bottom
+// of a rotated loop may keep its back edge when the copies can go ahead
+// of its branch.
+static void split_critical_edges(CodeGenerator* gen) {
+    for (int b = 0; b < gen->block_count; b++) {
+        BasicBlock* block = gen->blocks[b];
+        if (block->successor_count < 2) continue;
+        bool kept = false;
+        for (int s = 0; s < block->successor_count; s++) {
+            if (!has_phis(block->successors[s])) continue;
+            if (!kept && copies_before_branch(gen, block, s)) {
+                kept = true;
+                continue;
+            }
+            ir_split_edge(gen, block, s);
+        }
+    }
+}
+
+// Vectors get SSE registers directly, by linear scan over the blocks in
+// order. A vector is live from its definition to its last use, and all
+// through a loop that uses it but does not define it; a phi from the
+// first to the last of the copies into it at the ends of its
+// predecessors. Vectorizing keeps what is live at once within
+// VECTOR_REGISTERS. Returns whether there are any vectors.
+static bool assign_vector_registers(CodeGenerator* gen, IrFunction* fn) {
+    int* start = malloc(sizeof(int) * fn->value_count);
+    int* end = malloc(sizeof(int) * fn->value_count);
+    int* block_end = malloc(sizeof(int) * gen->block_count);
+    IrInst** vectors = malloc(sizeof(IrInst*) * fn->value_count);
+    int vector_count = 0;
+    int position = 0;
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next, position++) {
+            start[inst->id] = position;
+            end[inst->id] = position;
+            if (inst->type == IR_V32) vectors[vector_count++] = inst;
+        }
+        block_end[b] = position - 1;
+    }
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            if (inst->op == IR_PHI && inst->type == IR_V32) {
+                start[inst->id] = block_end[inst->block->predecessors[0]->id];
+                for (int p = 0; p < inst->block->predecessor_count; p++) {
+                    int copy = block_end[inst->block->predecessors[p]->id];
+                    if (copy < start[inst->id]) start[inst->id] = copy;
+                    if (copy > end[inst->id]) end[inst->id] = copy;
+                }
+            }
+            for (int i = 0; i < inst->operand_count; i++) {
+                IrInst* operand = inst->operands[i];
+                if (operand->type != IR_V32) continue;
+                BasicBlock* user = inst->op == IR_PHI ? inst->block->predecessors[i] : inst->block;
+                int at = inst->op == IR_PHI ? block_end[user->id] : start[inst->id];
+                if (at > end[operand->id]) end[operand->id] = at;
+                for (Loop* loop = user->loop; loop != NULL && !loop_contains(loop, operand->block); loop = loop->parent) {
+                    for (int l = 0; l < loop->block_count; l++) {
+                        int last = block_end[loop->blocks[l]->id];
+                        if (last > end[operand->id]) end[operand->id] = last;
+                    }
+                }
+            }
+        }
+    }
+
+    // By start; those that have ended before one starts free their registers
+    for (int i = 1; i < vector_count; i++) {
+        IrInst* vector = vectors[i];
+        int j = i;
+        for (; j > 0 && start[vectors[j - 1]->id] > start[vector->id]; j--) vectors[j] = vectors[j - 1];
+        vectors[j] = vector;
+    }
+    IrInst* holders[VECTOR_REGISTERS] = {NULL};
+    for (int i = 0; i < vector_count; i++) {
+        IrInst* vector = vectors[i];
+        int reg = 0;
+        for (int r = VECTOR_REGISTERS - 1; r >= 0; r--) {
+            if (holders[r] != NULL && end[holders[r]->id] < start[vector->id]) holders[r] = NULL;
+            if (holders[r] == NULL) reg = r;
+        }
+        // An operation on a vector that dies there can work on it in
+        // place, unless it reads its source after the result is written
+        IrInst* left = vector->operand_count > 0 ? vector->operands[0] : NULL;
+        bool in_place = vector->op != IR_PHI && vector->op != IR_NEG && vector->op != IR_BROADCAST &&
+                        left != NULL && left->type == IR_V32 && end[left->id] == start[vector->id] &&
+                        !(vector->op == IR_MUL && vector->operands[1] == left);
+        if (in_place) reg = left->vreg;
+        holders[reg] = vector;
+        vector->vreg = reg;
+    }
+    free(start);
+    free(end);
+    free(block_end);
+    free(vectors);
+    return vector_count > 0;
+}
+
+// Loops start on a 16-byte boundary: at the header, or at the block
+// holding the copies of the back edge when that falls through into it
+#define LOOP_ALIGNMENT 16
+
+static bool is_back_edge_copy(const BasicBlock* block, const BasicBlock* header) {
+    return header->is_loop_header && block->successor_count == 1 && block->successors[0] == header &&
+           block->predecessor_count == 1 && block_dominates(header, block->predecessors[0]);
+}
+
+static bool starts_loop(CodeGenerator* gen, int b) {
+    BasicBlock* block = gen->blocks[b];
+    if (b + 1 < gen->block_count && is_back_edge_copy(block, gen->blocks[b + 1])) return true;
+    return block->is_loop_header && !(b > 0 && is_back_edge_copy(gen->blocks[b - 1], block));
+}
+
+void select_instructions(CodeGenerator* gen) {
+    IrFunction* fn = gen->ir;
+    split_critical_edges(gen);
+    assign_frame_slots(gen, fn);
+
+    Selector sel;
+    sel.gen = gen;
+    sel.fn = fn;
+    sel.use_count = calloc(fn->value_count, sizeof(int));
+    sel.is_fused = calloc(fn->value_count, sizeof(bool));
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            if (inst->op == IR_CMP) sel.is_fused[inst->id] = true;
+        }
+    }
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            for (int i = 0; i < inst->operand_count; i++) {
+                IrInst* operand = inst->operands[i];
+                // Each branch or select in the comparison's block repeats it
+                // right before the jump or cmov
+                bool is_condition = i == 0 && (inst->op == IR_BRANCH || inst->op == IR_SELECT) &&
+                                    inst->block == operand->block;
+                if (!is_condition) sel.is_fused[operand->id] = false;
+                bool is_access = i == 0 && (inst->op == IR_LOAD || inst->op == IR_STORE);
+                if (is_access && is_offset_address(operand)) {
+                    // Computed as part of the memory operand instead
+                    sel.use_count[operand->operands[0]->id]++;
+                    continue;
+                }
+                sel.use_count[operand->id]++;
+            }
+        }
+    }
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            inst->vreg = -1;
+            if (inst->type != IR_VOID && inst->type != IR_V32 && !is_rematerialized(inst) && sel.use_count[inst->id] > 0 &&
+                !sel.is_fused[inst->id]) {
+                inst->vreg = get_register(gen);
+            }
+        }
+    }
+
+    gen->has_wide_vectors = assign_vector_registers(gen, fn) && gen->vector_width == 8;
+
+    // Incoming arguments first, before anything can clobber their registers
+    for (IrInst* inst = gen->blocks[0]->first; inst != NULL; inst = inst->next) {
+        if (inst->op != IR_PARAM || inst->vreg < 0) continue;
+        int size = value_size(inst);
+        if (inst->value < 6) {
+            emit(&sel, X86_MOV, reg64(argument_registers[inst->value]), reg64(inst->vreg));
+        } else {
+            emit(&sel, X86_MOV, operand_memory(REG_RBP, 16 + 8 * (inst->value - 6), size),
+                 operand_register(inst->vreg, size));
+        }
+    }
+
+    for (int b = 0; b < gen->block_count; b++) {
+        BasicBlock* block = gen->blocks[b];
+        // Blocks only entered by falling through need no label
+        bool labeled = b > 0;
+        if (block->predecessor_count == 1 && block->predecessors[0]->id == b - 1 &&
+            block->predecessors[0]->successor_count == 1) {
+            labeled = false;
+        }
+        if (labeled && starts_loop(gen, b)) {
+            asm_list_add(gen->out, ITEM_ALIGN)->value = LOOP_ALIGNMENT;
+        }
+        if (labeled) asm_list_add(gen->out, ITEM_LABEL)->operand = operand_label(gen->function_name, b);
+
+        for (IrInst* inst = block->first; inst != NULL; inst = inst->next) {
+            if (inst == block->last && ir_terminator(block) == inst) {
+                select_terminator(&sel, block, inst);
+                break;
+            }
+            if (!ir_has_side_effects(inst) && (sel.use_count[inst->id] == 0 || sel.is_fused[inst->id])) continue;
+            select_instruction(&sel, inst);
+        }
+    }
+    gen->label_counter = gen->block_count;
+    free(sel.use_count);
+    free(sel.is_fused);
+}
@@ -5,8 +5,8 @@
 #include <ctype.h>
 #include <stdbool.h>
 
-// Keyword lookup table
-static struct {
+// Keyword lookup table (read-only, safe to share between threads)
+static const struct {
     const char* keyword;
     TokenType type;
 } keywords[] = {
@@ -82,13 +82,25 @@ static bool match(Lexer* lexer, char expected) {
     return true;
 }
 
-// Token creation helper
-static Token* make_token(Lexer* lexer, TokenType type, size_t start, size_t length) {
-    Token* token = malloc(sizeof(Token));
+// Token creation helpers
+static Token* alloc_token(Lexer* lexer, TokenType type, size_t start) {
+    Token* token = lexer->arena != NULL ? arena_alloc(lexer->arena, sizeof(Token))
+                                        : malloc(sizeof(Token));
     token->type = type;
     token->line = lexer->line;
-    token->column = start + 1;
-    
+    token->column = start - lexer->line_start + 1;
+    token->offset = start;
+    return token;
+}
+
+static Token* make_token(Lexer* lexer, TokenType type, size_t start, size_t length) {
+    Token* token = alloc_token(lexer, type, start);
+
+    if (lexer->arena != NULL) {
+        token->lexeme = arena_strndup(lexer->arena, &lexer->source[start], length);
+        return token;
+    }
+
     token->lexeme = malloc(length + 1);
     strncpy(token->lexeme, &lexer->source[start], length);
     token->lexeme[length] = '\0';
@@ -104,7 +116,10 @@ Lexer* lexer_init(char* source, char* filename) {
     lexer->current = 0;
     lexer->line = 1;
     lexer->column = 1;
+    lexer->line_start = 0;
     lexer->filename = strdup(filename);
+    lexer->arena = NULL;
+    lexer->interner = NULL;
     return lexer;
 }
 
@@ -126,6 +141,7 @@ static void skip_whitespace(Lexer* lexer) {
             case '\n':
                 lexer->line++;
                 lexer->column = 1;
+                lexer->line_start = lexer->current + 1;
                 advance(lexer);
                 break;
             case '/':
@@ -140,6 +156,7 @@ static void skip_whitespace(Lexer* lexer) {
                         if (peek(lexer) == '\n') {
                             lexer->line++;
                             lexer->column = 1;
+                            lexer->line_start = lexer->current + 1;
                         }
                         if (peek(lexer) == '\0') return; // Unterminated comment
                         advance(lexer);
@@ -161,6 +178,14 @@ static Token* identifier(Lexer* lexer) {
     while (is_alnum(peek(lexer))) advance(lexer);
     
     size_t length = lexer->current - start;
+
+    // Interned spellings already know whether they are keywords
+    if (lexer->interner != NULL) {
+        const InternEntry* entry = interner_intern(lexer->interner, &lexer->source[start], length);
+        Token* token = alloc_token(lexer, entry->type, start);
+        token->lexeme = (char*)entry->string;
+        return token;
+    }
     
     // Check if it's a keyword
     for (int i = 0; keywords[i].keyword != NULL; i++) {
@@ -174,31 +199,74 @@ static Token* identifier(Lexer* lexer) {
 }
 
 
+static bool is_hex_digit(char c) {
+    return is_digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
 // Scan a number (integer or float)
 static Token* number(Lexer* lexer) {
-    size_t start = lexer->current - 1;
+    size_t start = lexer->current;
     TokenType type = TOKEN_INTEGER_LITERAL;
-    
-    while (is_digit(peek(lexer))) advance(lexer);
-    
-    // Look for a decimal point
-    if (peek(lexer) == '.' && is_digit(peek_next(lexer))) {
-        type = TOKEN_FLOAT_LITERAL;
-        advance(lexer); // Consume the .
+
+    if (peek(lexer) == '0' && (peek_next(lexer) == 'x' || peek_next(lexer) == 'X')) {
+        advance(lexer);
+        advance(lexer);
+        while (is_hex_digit(peek(lexer))) advance(lexer);
+    } else {
         while (is_digit(peek(lexer))) advance(lexer);
+
+        // Look for a decimal point
+        if (peek(lexer) == '.' && is_digit(peek_next(lexer))) {
+            type = TOKEN_FLOAT_LITERAL;
+            advance(lexer); // Consume the .
+            while (is_digit(peek(lexer))) advance(lexer);
+        }
+    }
+
+    // Integer suffixes (u, l, ul, ll, ...)
+    if (type == TOKEN_INTEGER_LITERAL) {
+        while (peek(lexer) == 'u' || peek(lexer) == 'U' ||
+               peek(lexer) == 'l' || peek(lexer) == 'L') {
+            advance(lexer);
+        }
     }
     
     size_t length = lexer->current - start;
     Token* token = make_token(lexer, type, start, length);
     
     if (type == TOKEN_INTEGER_LITERAL) {
-        token->value.int_value = strtoll(token->lexeme, NULL, 10);
+        token->value.int_value = (long long)strtoull(token->lexeme, NULL, 0);
     } else {
         token->value.float_value = strtod(token->lexeme, NULL);
     }
     return token;
 }
 
+// Scan a character constant; it becomes an integer literal
+static Token* character(Lexer* lexer) {
+    size_t start = lexer->current - 1;  // Include the opening quote
+    char c = advance(lexer);
+    if (c == '\\') {
+        c = advance(lexer);
+        switch (c) {
+            case 'n': c = '\n'; break;
+            case 't': c = '\t'; break;
+            case 'r': c = '\r'; break;
+            case '0': c = '\0'; break;
+            default: break;      // \\, \', \" and unknown escapes
+        }
+    }
+
+    if (peek(lexer) != '\'') {
+        return make_token(lexer, TOKEN_ERROR, start, 1);
+    }
+    advance(lexer);  // Consume the closing quote
+
+    Token* token = make_token(lexer, TOKEN_INTEGER_LITERAL, start, lexer->current - start);
+    token->value.int_value = c;
+    return token;
+}
+
 // Scan a string literal
 static Token* string(Lexer* lexer) {
     size_t start = lexer->current - 1;  // Include the opening quote
@@ -210,6 +278,7 @@ static Token* string(Lexer* lexer) {
         if (peek(lexer) == '\n') {
             lexer->line++;
             lexer->column = 1;
+            lexer->line_start = lexer->current + 1;
         }
 
         char c = peek(lexer);
@@ -260,7 +329,12 @@ static Token* string(Lexer* lexer) {
     Token* token = make_token(lexer, TOKEN_STRING_LITERAL, start, lexer->current - start);
 
     // Set the processed string value
-    token->value.string_value = buffer;  // Transfer ownership of buffer to token
+    if (lexer->arena != NULL) {
+        token->value.string_value = arena_strndup(lexer->arena, buffer, buf_idx);
+        free(buffer);
+    } else {
+        token->value.string_value = buffer;  // Transfer ownership of buffer to token
+    }
 
     return token;
 }
@@ -274,7 +348,7 @@ Token* lexer_next_token(Lexer* lexer) {
     }
     
     size_t token_start = lexer->current;
-    lexer->column = token_start + 1;  // Set column to the start of this token
+    lexer->column = token_start - lexer->line_start + 1;  // Set column to the start of this token
     char c = advance(lexer);
     
     if (is_alpha(c)) {
@@ -295,11 +369,19 @@ Token* lexer_next_token(Lexer* lexer) {
         case ']': return make_token(lexer, TOKEN_RBRACKET, token_start, 1);
         case ';': return make_token(lexer, TOKEN_SEMICOLON, token_start, 1);
         case ',': return make_token(lexer, TOKEN_COMMA, token_start, 1);
-        case '.': return make_token(lexer, TOKEN_DOT, token_start, 1);
+        case '.': {
+            if (peek(lexer) == '.' && peek_next(lexer) == '.') {
+                advance(lexer);
+                advance(lexer);
+                return make_token(lexer, TOKEN_ELLIPSIS, token_start, 3);
+            }
+            return make_token(lexer, TOKEN_DOT, token_start, 1);
+        }
         case '-': {
-            size_t len = 1 + (peek(lexer) == '>' || peek(lexer) == '-' ? 1 : 0);
-            TokenType type = match(lexer, '>') ? TOKEN_MINUSEQUAL :
-                            match(lexer, '-') ? TOKEN_MINUSMINUS : TOKEN_MINUS;
+            size_t len = 1 + (peek(lexer) == '>' || peek(lexer) == '-' || peek(lexer) == '=' ? 1 : 0);
+            TokenType type = match(lexer, '>') ? TOKEN_ARROW :
+                            match(lexer, '-') ? TOKEN_MINUSMINUS :
+                            match(lexer, '=') ? TOKEN_MINUSEQUAL : TOKEN_MINUS;
             return make_token(lexer, type, token_start, len);
         }
         case '+': {
@@ -318,6 +400,11 @@ Token* lexer_next_token(Lexer* lexer) {
             TokenType type = match(lexer, '=') ? TOKEN_STAREQUAL : TOKEN_STAR;
             return make_token(lexer, type, token_start, len);
         }
+        case '%': {
+            size_t len = 1 + (peek(lexer) == '=' ? 1 : 0);
+            TokenType type = match(lexer, '=') ? TOKEN_PERCENTEQUAL : TOKEN_PERCENT;
+            return make_token(lexer, type, token_start, len);
+        }
         case '!': {
             size_t len = 1 + (peek(lexer) == '=' ? 1 : 0);
             TokenType type = match(lexer, '=') ? TOKEN_NOTEQUAL : TOKEN_BANG;
@@ -329,12 +416,22 @@ Token* lexer_next_token(Lexer* lexer) {
             return make_token(lexer, type, token_start, len);
         }
         case '<': {
+            if (peek(lexer) == '<' && peek_next(lexer) == '=') {
+                advance(lexer);
+                advance(lexer);
+                return make_token(lexer, TOKEN_LESSLESSEQUAL, token_start, 3);
+            }
             size_t len = 1 + (peek(lexer) == '=' || peek(lexer) == '<' ? 1 : 0);
             TokenType type = match(lexer, '=') ? TOKEN_LESSEQUAL :
                             match(lexer, '<') ? TOKEN_LESSLESS : TOKEN_LESS;
             return make_token(lexer, type, token_start, len);
         }
         case '>': {
+            if (peek(lexer) == '>' && peek_next(lexer) == '=') {
+                advance(lexer);
+                advance(lexer);
+                return make_token(lexer, TOKEN_GREATERGREATEREQUAL, token_start, 3);
+            }
             size_t len = 1 + (peek(lexer) == '=' || peek(lexer) == '>' ? 1 : 0);
             TokenType type = match(lexer, '=') ? TOKEN_GREATEREQUAL :
                             match(lexer, '>') ? TOKEN_GREATERGREATER : TOKEN_GREATER;
@@ -357,12 +454,14 @@ Token* lexer_next_token(Lexer* lexer) {
             TokenType type = match(lexer, '=') ? TOKEN_XOREQUAL : TOKEN_CARET;
             return make_token(lexer, type, token_start, len);
         }
+        case '~': return make_token(lexer, TOKEN_TILDE, token_start, 1);
         case '?': return make_token(lexer, TOKEN_QUESTION, token_start, 1);
         case ':': return make_token(lexer, TOKEN_COLON, token_start, 1);
         case '"': return string(lexer);
+        case '\'': return character(lexer);
     }
     
-    return make_token(lexer, TOKEN_ERROR, lexer->current, 1);
+    return make_token(lexer, TOKEN_ERROR, token_start, 1);
 }
 
 char* token_type_to_string(TokenType type) {
@@ -375,3 +474,87 @@ char* token_type_to_string(TokenType type) {
         default: return "UNKNOWN";
     }
 }
+
+// Interner implementation
+static unsigned int hash_string(const char* str, size_t length) {
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static InternEntry* interner_find_slot(InternEntry* entries, int capacity,
+                                       const char* str, size_t length, unsigned int hash) {
+    int index = hash & (capacity - 1);
+    for (;;) {
+        InternEntry* entry = &entries[index];
+        if (entry->string == NULL) return entry;
+        if (entry->hash == hash && entry->length == length &&
+            memcmp(entry->string, str, length) == 0) {
+            return entry;
+        }
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+static void interner_grow(Interner* interner) {
+    int capacity = interner->capacity * 2;
+    InternEntry* entries = calloc(capacity, sizeof(InternEntry));
+    for (int i = 0; i < interner->capacity; i++) {
+        InternEntry* old = &interner->entries[i];
+        if (old->string == NULL) continue;
+        *interner_find_slot(entries, capacity, old->string, old->length, old->hash) = *old;
+    }
+    free(interner->entries);
+    interner->entries = entries;
+    interner->capacity = capacity;
+}
+
+static void interner_seed_keywords(Interner* interner) {
+    for (int i = 0; keywords[i].keyword != NULL; i++) {
+        const InternEntry* entry = interner_intern(interner, keywords[i].keyword,
+                                                   strlen(keywords[i].keyword));
+        ((InternEntry*)entry)->type = keywords[i].type;
+    }
+}
+
+void interner_init(Interner* interner) {
+    interner->capacity = 256;
+    interner->count = 0;
+    interner->entries = calloc(interner->capacity, sizeof(InternEntry));
+    arena_init(&interner->strings);
+    interner_seed_keywords(interner);
+}
+
+void interner_free(Interner* interner) {
+    free(interner->entries);
+    arena_free(&interner->strings);
+}
+
+void interner_reset(Interner* interner) {
+    memset(interner->entries, 0, sizeof(InternEntry) * interner->capacity);
+    interner->count = 0;
+    arena_reset(&interner->strings);
+    interner_seed_keywords(interner);
+}
+
+const InternEntry* interner_intern(Interner* interner, const char* str, size_t length) {
+    unsigned int hash = hash_string(str, length);
+    InternEntry* entry = interner_find_slot(interner->entries, interner->capacity, str, length, hash);
+    if (entry->string != NULL) return entry;
+
+    // Keep the load factor under 1/2
+    if ((interner->count + 1) * 2 > interner->capacity) {
+        interner_grow(interner);
+        entry = interner_find_slot(interner->entries, interner->capacity, str, length, hash);
+    }
+
+    entry->string = arena_strndup(&interner->strings, str, length);
+    entry->length = length;
+    entry->hash = hash;
+    entry->type = TOKEN_IDENTIFIER;
+    interner->count++;
+    return entry;
+}
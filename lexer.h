@@ -2,6 +2,7 @@
 #define LEXER_H
 
 #include <stddef.h>
+#include "arena.h"
 
 // Token types for C11 language features
 typedef enum {
@@ -23,7 +24,7 @@ typedef enum {
     TOKEN_DOT, TOKEN_MINUS, TOKEN_PLUS, TOKEN_SLASH, TOKEN_STAR,
     TOKEN_BANG, TOKEN_EQUALS, TOKEN_LESS, TOKEN_GREATER,
     TOKEN_AMPERSAND, TOKEN_PIPE, TOKEN_CARET, TOKEN_QUESTION,
-    TOKEN_COLON,
+    TOKEN_COLON, TOKEN_PERCENT, TOKEN_TILDE,
 
     // Two-character tokens
     TOKEN_MINUSEQUAL, TOKEN_MINUSMINUS, TOKEN_PLUSPLUS,
@@ -31,7 +32,10 @@ typedef enum {
     TOKEN_NOTEQUAL, TOKEN_EQUALEQUAL, TOKEN_LESSEQUAL,
     TOKEN_LESSLESS, TOKEN_GREATEREQUAL, TOKEN_GREATERGREATER,
     TOKEN_ANDAND, TOKEN_ANDEQUAL, TOKEN_OROR, TOKEN_OREQUAL,
-    TOKEN_XOREQUAL,
+    TOKEN_XOREQUAL, TOKEN_PERCENTEQUAL, TOKEN_ARROW,
+
+    // Three-character tokens
+    TOKEN_LESSLESSEQUAL, TOKEN_GREATERGREATEREQUAL, TOKEN_ELLIPSIS,
 
     // Literals
     TOKEN_IDENTIFIER, TOKEN_INTEGER_LITERAL, TOKEN_FLOAT_LITERAL,
@@ -47,6 +51,7 @@ typedef struct {
     char* lexeme;
     int line;
     int column;
+    size_t offset;       // Position of the first character in the source
     union {
         long long int_value;
         double float_value;
@@ -54,6 +59,23 @@ typedef struct {
     } value;
 } Token;
 
+// Interned identifier or keyword
+typedef struct {
+    const char* string;
+    size_t length;
+    unsigned int hash;
+    TokenType type;      // Keyword type, or TOKEN_IDENTIFIER
+} InternEntry;
+
+// Hash table of every identifier spelling seen so far, seeded with the
+// keywords. Interned strings live until the interner is freed or reset.
+typedef struct {
+    InternEntry* entries;
+    int capacity;
+    int count;
+    Arena strings;
+} Interner;
+
 // Lexer structure
 typedef struct {
     char* source;
@@ -61,7 +83,10 @@ typedef struct {
     size_t current;
     int line;
     int column;
+    size_t line_start;   // Offset of the first character of the current line
     char* filename;
+    Arena* arena;        // Token storage; NULL means tokens are malloc'ed
+    Interner* interner;  // Identifier table; NULL means keywords are scanned
 } Lexer;
 
 // Lexer interface functions
@@ -70,4 +95,10 @@ void lexer_free(Lexer* lexer);
 Token* lexer_next_token(Lexer* lexer);
 char* token_type_to_string(TokenType type);
 
+// Interner functions
+void interner_init(Interner* interner);
+void interner_free(Interner* interner);
+void interner_reset(Interner* interner);
+const InternEntry* interner_intern(Interner* interner, const char* str, size_t length);
+
 #endif // LEXER_H
\ No newline at end of file
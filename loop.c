@@ -0,0 +1,1699 @@
+#include "ir.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Loop optimizations over the SSA form, on the loop nest found by
+// analyze_control_flow
+
+// The block control enters a loop from: the header's only predecessor
+// outside the loop, when it has no other successor
+static BasicBlock* find_preheader(const Loop* loop) {
+    BasicBlock* preheader = NULL;
+    for (int p = 0; p < loop->header->predecessor_count; p++) {
+        BasicBlock* predecessor = loop->header->predecessors[p];
+        if (loop_contains(loop, predecessor)) continue;
+        if (preheader != NULL) return NULL;
+        preheader = predecessor;
+    }
+    return preheader != NULL && preheader->successor_count == 1 ? preheader : NULL;
+}
+
+// A loop entered from a branch, as a rotated loop is from its guard,
+// gets a block of its own on the entry edge
+static void insert_preheaders(CodeGenerator* gen) {
+    bool changed = false;
+    for (int l = 0; l < gen->loop_count; l++) {
+        Loop* loop = gen->loops[l];
+        if (find_preheader(loop) != NULL) continue;
+        BasicBlock* entry = NULL;
+        int entries = 0;
+        for (int p = 0; p < loop->header->predecessor_count; p++) {
+            BasicBlock* predecessor = loop->header->predecessors[p];
+            if (loop_contains(loop, predecessor)) continue;
+            entry = predecessor;
+            entries++;
+        }
+        if (entries != 1 || entry->successors[0] == entry->successors[1]) continue;
+        ir_split_edge(gen, entry, entry->successors[0] == loop->header ? 0 : 1);
+        changed = true;
+    }
+    if (changed) analyze_control_flow(gen);
+}
+
+// The local or global an address points into, or NULL when unknown.
+// Pointer arithmetic keeps the pointer as its first operand.
+static const IrInst* base_object(const IrInst* address) {
+    while (address->op == IR_ADD || address->op == IR_SUB) address = address->operands[0];
+    return address->op == IR_LOCAL || address->op == IR_GLOBAL ? address : NULL;
+}
+
+static bool same_object(const IrInst* a, const IrInst* b) {
+    if (a->op != b->op) return false;
+    return a->op == IR_LOCAL ? a->value == b->value : strcmp(a->symbol, b->symbol) == 0;
+}
+
+// What the body of a loop may write
+typedef struct {
+    const IrInst** stored;   // Objects stored to through known addresses
+    int stored_count;
+    bool has_unknown_store;  // A store through an address of unknown origin
+    bool has_call;
+} LoopEffects;
+
+typedef struct {
+    CodeGenerator* gen;
+    bool* escaped;           // By local: its address is used other than to access it
+    Loop* loop;
+    LoopEffects effects;
+    BasicBlock** exiting;    // Blocks of the loop with a successor outside it
+    int exiting_count;
+} Hoister;
+
+// Locals whose address flows anywhere but into loads, stores and
+// pointer arithmetic may be written through other pointers and by calls
+static void find_escaped_locals(Hoister* h) {
+    CodeGenerator* gen = h->gen;
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            for (int i = 0; i < inst->operand_count; i++) {
+                const IrInst* base = base_object(inst->operands[i]);
+                if (base == NULL || base->op != IR_LOCAL) continue;
+                bool is_address = i == 0 && (inst->op == IR_LOAD || inst->op == IR_STORE ||
+                                             inst->op == IR_ADD || inst->op == IR_SUB);
+                if (!is_address) h->escaped[base->value] = true;
+            }
+        }
+    }
+}
+
+static void summarize_loop(Hoister* h) {
+    LoopEffects* effects = &h->effects;
+    effects->stored_count = 0;
+    effects->has_unknown_store = false;
+    effects->has_call = false;
+    h->exiting_count = 0;
+    for (int b = 0; b < h->loop->block_count; b++) {
+        BasicBlock* block = h->loop->blocks[b];
+        for (IrInst* inst = block->first; inst != NULL; inst = inst->next) {
+            if (inst->op == IR_CALL) effects->has_call = true;
+            if (inst->op != IR_STORE) continue;
+            const IrInst* base = base_object(inst->operands[0]);
+            if (base == NULL) {
+                effects->has_unknown_store = true;
+            } else {
+                effects->stored[effects->stored_count++] = base;
+            }
+        }
+        for (int s = 0; s < block->successor_count; s++) {
+            if (!loop_contains(h->loop, block->successors[s])) {
+                h->exiting[h->exiting_count++] = block;
+                break;
+            }
+        }
+    }
+}
+
+static bool may_be_written(Hoister* h, const IrInst* address) {
+    const LoopEffects* effects = &h->effects;
+    const IrInst* base = base_object(address);
+    if (base == NULL) return effects->stored_count > 0 || effects->has_unknown_store || effects->has_call;
+    for (int i = 0; i < effects->stored_count; i++) {
+        if (same_object(effects->stored[i], base)) return true;
+    }
+    bool is_shared = base->op == IR_GLOBAL || h->escaped[base->value];
+    return is_shared && (effects->has_unknown_store || effects->has_call);
+}
+
+// Whether a block runs whenever the loop is entered and left: it
+// dominates every way out
+static bool always_runs(Hoister* h, const BasicBlock* block) {
+    if (h->exiting_count == 0) return false;
+    for (int i = 0; i < h->exiting_count; i++) {
+        if (!block_dominates(block, h->exiting[i])) return false;
+    }
+    return true;
+}
+
+static bool is_invariant_operand(Hoister* h, const IrInst* operand) {
+    return !loop_contains(h->loop, operand->block);
+}
+
+// A comparison only tested by the branches and selects of its own block
+// becomes part of them, and would only take up a register once hoisted
+static bool is_tested_in_place(Hoister* h, const IrInst* cmp) {
+    CodeGenerator* gen = h->gen;
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            for (int i = 0; i < inst->operand_count; i++) {
+                if (inst->operands[i] != cmp) continue;
+                bool is_test = i == 0 && (inst->op == IR_BRANCH || inst->op == IR_SELECT);
+                if (!is_test || inst->block != cmp->block) return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Whether running `inst` once ahead of the loop is the same as running
+// it wherever it is in the loop. Operations that may trap only move if
+// they would have run anyway.
+static bool can_hoist(Hoister* h, const IrInst* inst) {
+    for (int i = 0; i < inst->operand_count; i++) {
+        if (!is_invariant_operand(h, inst->operands[i])) return false;
+    }
+    switch (inst->op) {
+        case IR_CONST: case IR_UNDEF: case IR_LOCAL: case IR_GLOBAL: case IR_STRING:
+        case IR_ADD: case IR_SUB: case IR_MUL: case IR_AND: case IR_OR: case IR_XOR:
+        case IR_SHL: case IR_SHR: case IR_NEG: case IR_NOT:
+        case IR_EXTEND: case IR_TRUNCATE: case IR_SELECT: case IR_COPY:
+            return true;
+        case IR_CMP:
+            return !is_tested_in_place(h, inst);
+        case IR_DIV:
+        case IR_REM: {
+            const IrInst* divisor = inst->operands[1];
+            if (divisor->op == IR_CONST && divisor->value != 0 && divisor->value != -1) return true;
+            return always_runs(h, inst->block);
+        }
+        case IR_LOAD: {
+            const IrInst* address = inst->operands[0];
+            if (may_be_written(h, address)) return false;
+            return address->op == IR_LOCAL || address->op == IR_GLOBAL || always_runs(h, inst->block);
+        }
+        default:
+            return false;
+    }
+}
+
+static int compare_rpo(const void* a, const void* b) {
+    return (*(BasicBlock* const*)a)->rpo - (*(BasicBlock* const*)b)->rpo;
+}
+
+// Move the invariant computations of one loop to its preheader, in
+// dominance order so that each one follows the operands it needs
+static void hoist_from_loop(Hoister* h, BasicBlock* preheader) {
+    Loop* loop = h->loop;
+    BasicBlock** blocks = malloc(sizeof(BasicBlock*) * loop->block_count);
+    memcpy(blocks, loop->blocks, sizeof(BasicBlock*) * loop->block_count);
+    qsort(blocks, loop->block_count, sizeof(BasicBlock*), compare_rpo);
+
+    IrInst* position = ir_terminator(preheader);
+    for (int b = 0; b < loop->block_count; b++) {
+        IrInst* next;
+        for (IrInst* inst = blocks[b]->first; inst != NULL; inst = next) {
+            next = inst->next;
+            if (inst->op == IR_PHI || !can_hoist(h, inst)) continue;
+            ir_remove(inst);
+            ir_insert_before(position, inst);
+        }
+    }
+    free(blocks);
+}
+
+// Loop-invariant code motion. Inner loops go first, so that what they
+// hoist into a preheader inside an outer loop can move on out of it.
+void hoist_loop_invariants(CodeGenerator* gen) {
+    insert_preheaders(gen);
+    if (gen->loop_count == 0) return;
+
+    int instructions = 0;
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) instructions++;
+    }
+    Hoister h;
+    h.gen = gen;
+    h.escaped = calloc(gen->ir->local_count + 1, sizeof(bool));
+    h.effects.stored = malloc(sizeof(IrInst*) * (instructions + 1));
+    h.exiting = malloc(sizeof(BasicBlock*) * (gen->block_count + 1));
+    find_escaped_locals(&h);
+
+    for (int l = gen->loop_count - 1; l >= 0; l--) {
+        h.loop = gen->loops[l];
+        BasicBlock* preheader = find_preheader(h.loop);
+        if (preheader == NULL) continue;
+        summarize_loop(&h);
+        hoist_from_loop(&h, preheader);
+    }
+    free(h.escaped);
+    free(h.effects.stored);
+    free(h.exiting);
+}
+
+// Induction variables. A basic induction variable is a header phi
+// advanced by an invariant step on the back edge; a derived one is an
+// affine function of a basic one, such as the address of a[i * k].
+// Derived ones computed with a multiply or shift get a phi of their own,
+// advanced by an add, and a basic one left to only count iterations is
+// replaced in the exit test by a derived one (linear-function test
+// replacement) so that it dies.
+
+typedef struct {
+    IrInst* phi;
+    IrInst* increment;       // The value on the back edge: phi plus step
+    IrInst* step;
+} BasicInduction;
+
+// What is known about a value of the loop
+typedef struct {
+    bool is_classified;
+    int base;                // Basic induction variable it is affine in, or -1
+    bool is_exact;           // Computed without 32-bit wraparound, under the signed overflow rules
+    bool has_multiply;       // Worth reducing
+    bool has_scale;          // A constant multiple of its basic variable, plus an invariant
+    long long scale;
+} Induction;
+
+typedef struct {
+    CodeGenerator* gen;
+    Loop* loop;
+    BasicBlock* preheader;
+    BasicBlock* latch;
+    int entry;               // The preheader's index among the header's predecessors
+    BasicInduction* bases;
+    int base_count;
+    Induction* info;         // By value id, for the values before the pass
+    int value_count;
+    IrInst** replacement;    // By value id: the phi a derived variable is replaced by
+} Reducer;
+
+static bool is_invariant(Reducer* r, const IrInst* value) {
+    return !loop_contains(r->loop, value->block);
+}
+
+static void find_bases(Reducer* r) {
+    r->base_count = 0;
+    BasicBlock* header = r->loop->header;
+    for (IrInst* phi = header->first; phi != NULL && phi->op == IR_PHI; phi = phi->next) {
+        IrInst* increment = phi->operands[1 - r->entry];
+        if (increment->op != IR_ADD && increment->op != IR_SUB) continue;
+        if (increment->operand_count != 2 || increment->type != phi->type) continue;
+        IrInst* step = NULL;
+        if (increment->operands[0] == phi && is_invariant(r, increment->operands[1])) {
+            step = increment->operands[1];
+        } else if (increment->op == IR_ADD && increment->operands[1] == phi && is_invariant(r, increment->operands[0])) {
+            step = increment->operands[0];
+        }
+        // Only constant steps go down
+        if (step == NULL || (increment->op == IR_SUB && step->op != IR_CONST)) continue;
+        r->bases[r->base_count].phi = phi;
+        r->bases[r->base_count].increment = increment;
+        r->bases[r->base_count].step = step;
+        r->base_count++;
+    }
+}
+
+static const Induction* classify(Reducer* r, IrInst* value);
+
+// Combine an operation's operands: the induction variable they share,
+// with the others invariant
+static bool combine(Reducer* r, IrInst* value, Induction* info) {
+    int variables = 0;
+    for (int i = 0; i < value->operand_count; i++) {
+        IrInst* operand = value->operands[i];
+        if (is_invariant(r, operand)) continue;
+        const Induction* operand_info = classify(r, operand);
+        if (operand_info->base < 0 || (info->base >= 0 && operand_info->base != info->base)) return false;
+        info->base = operand_info->base;
+        info->is_exact = operand_info->is_exact;
+        info->has_multiply = operand_info->has_multiply;
+        info->has_scale = operand_info->has_scale;
+        info->scale = operand_info->scale;
+        variables++;
+    }
+    return variables == 1;
+}
+
+static const Induction* classify(Reducer* r, IrInst* value) {
+    Induction* info = &r->info[value->id];
+    if (info->is_classified) return info;
+    info->is_classified = true;
+    info->base = -1;
+    if (is_invariant(r, value)) return info;
+
+    if (value->op == IR_PHI) {
+        for (int b = 0; b < r->base_count; b++) {
+            if (r->bases[b].phi != value) continue;
+            info->base = b;
+            info->is_exact = value->type == IR_I64 || r->bases[b].increment->is_signed;
+            info->has_scale = true;
+            info->scale = r->bases[b].increment->op == IR_SUB ? -1 : 1;
+        }
+        return info;
+    }
+
+    Induction result = { true, -1, false, false, false, 0 };
+    bool wraps = value->type == IR_I32 && !value->is_signed;
+    switch (value->op) {
+        case IR_ADD:
+            if (!combine(r, value, &result)) return info;
+            break;
+        case IR_SUB:
+            if (!combine(r, value, &result)) return info;
+            if (!is_invariant(r, value->operands[1])) result.scale = -result.scale;
+            break;
+        case IR_MUL: {
+            if (!combine(r, value, &result)) return info;
+            IrInst* factor = is_invariant(r, value->operands[0]) ? value->operands[0] : value->operands[1];
+            result.has_scale = result.has_scale && factor->op == IR_CONST;
+            result.scale *= factor->value;
+            result.has_multiply = true;
+            break;
+        }
+        case IR_SHL:
+            if (value->operands[1]->op != IR_CONST || !combine(r, value, &result)) return info;
+            result.scale <<= value->operands[1]->value & (value->type == IR_I64 ? 63 : 31);
+            result.has_multiply = true;
+            break;
+        case IR_NEG:
+            if (!combine(r, value, &result)) return info;
+            result.scale = -result.scale;
+            break;
+        case IR_EXTEND:
+            // Sign extension distributes over the additions of values that
+            // do not overflow
+            if (value->type != IR_I64 || value->size != 4 || !value->is_signed) return info;
+            if (!combine(r, value, &result)) return info;
+            if (!result.is_exact) return info;
+            wraps = false;
+            break;
+        case IR_TRUNCATE:
+            if (!combine(r, value, &result)) return info;
+            wraps = true;
+            break;
+        default:
+            return info;
+    }
+    if (wraps) result.is_exact = false;
+    *info = result;
+    return info;
+}
+
+static bool is_constant(const IrInst* value, long long constant) {
+    return value != NULL && value->op == IR_CONST && value->value == constant;
+}
+
+// An operation like `model` on invariant operands, computed in the
+// preheader, or folded when they are constants. Starting values are
+// often computed from zero.
+static IrInst* compute_ahead(Reducer* r, const IrInst* model, IrOpcode op, IrInst* left, IrInst* right) {
+    if (op == IR_ADD && is_constant(left, 0)) return right;
+    if ((op == IR_ADD || op == IR_SUB || op == IR_SHL) && is_constant(right, 0)) return left;
+    if (op == IR_MUL && (is_constant(left, 0) || is_constant(right, 1))) return left;
+    if (op == IR_MUL && (is_constant(right, 0) || is_constant(left, 1))) return right;
+    IrInst* inst = ir_new(r->gen->ir, op, model->type);
+    inst->size = model->size;
+    inst->is_signed = model->is_signed;
+    ir_add_operand(inst, left);
+    if (right != NULL) ir_add_operand(inst, right);
+
+    long long operands[2];
+    bool is_folded = true;
+    for (int i = 0; i < inst->operand_count; i++) {
+        is_folded = is_folded && inst->operands[i]->op == IR_CONST;
+        operands[i] = inst->operands[i]->value;
+    }
+    long long folded;
+    if (is_folded && ir_fold(inst, operands, &folded)) {
+        inst->op = IR_CONST;
+        inst->operand_count = 0;
+        inst->value = ir_normalize(inst->type, folded);
+    }
+    ir_insert_before(ir_terminator(r->preheader), inst);
+    return inst;
+}
+
+// The derived variable `value` computed from `base` in place of its
+// basic variable
+static IrInst* substitute(Reducer* r, IrInst* value, IrInst* base) {
+    if (is_invariant(r, value)) return value;
+    if (value->op == IR_PHI) return base;
+    IrInst* operands[2] = { NULL, NULL };
+    for (int i = 0; i < value->operand_count; i++) operands[i] = substitute(r, value->operands[i], base);
+    return compute_ahead(r, value, value->op, operands[0], operands[1]);
+}
+
+// How much a derived variable advances per iteration, or NULL when it
+// does not
+static IrInst* advance(Reducer* r, IrInst* value) {
+    if (is_invariant(r, value)) return NULL;
+    if (value->op == IR_PHI) {
+        const BasicInduction* base = &r->bases[r->info[value->id].base];
+        if (base->increment->op == IR_ADD) return base->step;
+        return compute_ahead(r, base->increment, IR_NEG, base->step, NULL);
+    }
+    IrInst* left = advance(r, value->operands[0]);
+    IrInst* right = value->operand_count > 1 ? advance(r, value->operands[1]) : NULL;
+    switch (value->op) {
+        case IR_ADD:
+            return left != NULL ? left : right;
+        case IR_SUB:
+            return left != NULL ? left : compute_ahead(r, value, IR_NEG, right, NULL);
+        case IR_MUL:
+            if (left != NULL) return compute_ahead(r, value, IR_MUL, left, value->operands[1]);
+            return compute_ahead(r, value, IR_MUL, value->operands[0], right);
+        case IR_SHL:
+            return compute_ahead(r, value, IR_SHL, left, value->operands[1]);
+        default:
+            return compute_ahead(r, value, value->op, left, NULL);
+    }
+}
+
+// Whether any use of `value` is other than as part of a derived variable
+// of the same basic one
+static bool has_other_use(Reducer* r, IrInst* value, int base) {
+    CodeGenerator* gen = r->gen;
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            for (int i = 0; i < inst->operand_count; i++) {
+                if (inst->operands[i] != value) continue;
+                if (inst->id >= r->value_count || inst->op == IR_PHI) return true;
+                if (classify(r, inst)->base != base) return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Whether every use of `value` is by one of `users`
+static bool is_only_used_by(CodeGenerator* gen, const IrInst* value, IrInst* const* users, int user_count) {
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            for (int i = 0; i < inst->operand_count; i++) {
+                if (inst->operands[i] != value) continue;
+                bool is_user = false;
+                for (int u = 0; u < user_count; u++) is_user = is_user || inst == users[u];
+                if (!is_user) return false;
+            }
+        }
+    }
+    return true;
+}
+
+// The exit test of a basic variable: a comparison with an invariant
+// limit, branching back or out of the loop from the latch
+static IrInst* find_exit_test(Reducer* r, int base, int* side) {
+    const BasicInduction* induction = &r->bases[base];
+    IrInst* branch = ir_terminator(r->latch);
+    if (branch->op != IR_BRANCH || branch->operands[0]->op != IR_CMP) return NULL;
+    IrInst* test = branch->operands[0];
+    switch (test->cond) {
+        case COND_E: case COND_NE: case COND_L: case COND_LE: case COND_G: case COND_GE: break;
+        default: return NULL;
+    }
+    for (int i = 0; i < 2; i++) {
+        IrInst* operand = test->operands[i];
+        if ((operand == induction->phi || operand == induction->increment) && is_invariant(r, test->operands[1 - i])) {
+            *side = i;
+            return test;
+        }
+    }
+    return NULL;
+}
+
+// A basic variable that only counts iterations now has its exit test
+// compare the derived variable `phi` instead, against the limit mapped
+// through the same function, so that it dies
+static void replace_exit_test(Reducer* r, int base, IrInst* phi, IrInst* increment, IrInst* limit) {
+    const BasicInduction* induction = &r->bases[base];
+    int side;
+    IrInst* test = find_exit_test(r, base, &side);
+    if (test == NULL) return;
+    IrInst* branch = ir_terminator(r->latch);
+    IrInst* phi_users[] = { induction->increment, test };
+    IrInst* increment_users[] = { induction->phi, test };
+    IrInst* test_users[] = { branch };
+    if (!is_only_used_by(r->gen, induction->phi, phi_users, 2) ||
+        !is_only_used_by(r->gen, induction->increment, increment_users, 2) ||
+        !is_only_used_by(r->gen, test, test_users, 1)) {
+        return;
+    }
+
+    IrInst* replaced = ir_new(r->gen->ir, IR_CMP, IR_I32);
+    replaced->cond = test->cond;
+    IrInst* counter = test->operands[side] == induction->phi ? phi : increment;
+    ir_add_operand(replaced, side == 0 ? counter : limit);
+    ir_add_operand(replaced, side == 0 ? limit : counter);
+    ir_insert_before(branch, replaced);
+    branch->operands[0] = replaced;
+}
+
+// Remove the derived variables left without uses, so that they no longer
+// hold on to their basic ones
+static void remove_unused(Reducer* r) {
+    CodeGenerator* gen = r->gen;
+    int* uses = calloc(gen->ir->value_count, sizeof(int));
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            for (int i = 0; i < inst->operand_count; i++) uses[inst->operands[i]->id]++;
+        }
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int b = 0; b < r->loop->block_count; b++) {
+            IrInst* next;
+            for (IrInst* inst = r->loop->blocks[b]->first; inst != NULL; inst = next) {
+                next = inst->next;
+                if (inst->id >= r->value_count || inst->op == IR_PHI || uses[inst->id] > 0) continue;
+                if (r->info[inst->id].base < 0) continue;
+                for (int i = 0; i < inst->operand_count; i++) uses[inst->operands[i]->id]--;
+                ir_remove(inst);
+                changed = true;
+            }
+        }
+    }
+    free(uses);
+}
+
+static void reduce_loop(Reducer* r) {
+    CodeGenerator* gen = r->gen;
+    Loop* loop = r->loop;
+    find_bases(r);
+    if (r->base_count == 0) return;
+
+    // Derived variables whose value is used, not only built upon
+    IrInst** roots = malloc(sizeof(IrInst*) * (r->value_count + 1));
+    int root_count = 0;
+    for (int b = 0; b < loop->block_count; b++) {
+        for (IrInst* inst = loop->blocks[b]->first; inst != NULL; inst = inst->next) {
+            if (inst->op == IR_PHI) continue;
+            const Induction* info = classify(r, inst);
+            if (info->base < 0 || !info->has_multiply || !has_other_use(r, inst, info->base)) continue;
+            roots[root_count++] = inst;
+        }
+    }
+
+    // The derived variable to test in place of each basic one, and then
+    // the limit to test it against
+    IrInst** test_derived = calloc(r->base_count, sizeof(IrInst*));
+    IrInst** test_phi = calloc(r->base_count, sizeof(IrInst*));
+    IrInst** test_increment = calloc(r->base_count, sizeof(IrInst*));
+    BasicBlock* header = loop->header;
+    for (int i = 0; i < root_count; i++) {
+        IrInst* root = roots[i];
+        const Induction* info = &r->info[root->id];
+        const BasicInduction* base = &r->bases[info->base];
+        IrInst* step = advance(r, root);
+        IrInst* start = substitute(r, root, base->phi->operands[r->entry]);
+
+        IrInst* phi = ir_new(gen->ir, IR_PHI, root->type);
+        IrInst* increment = ir_new(gen->ir, IR_ADD, root->type);
+        increment->is_signed = root->is_signed;
+        ir_add_operand(increment, phi);
+        ir_add_operand(increment, step);
+        ir_insert_before(ir_terminator(r->latch), increment);
+        for (int p = 0; p < header->predecessor_count; p++) ir_add_operand(phi, p == r->entry ? start : increment);
+        ir_insert_before(header->first, phi);
+        r->replacement[root->id] = phi;
+
+        bool is_counter = info->is_exact && info->has_scale && info->scale > 0;
+        IrInst* current = test_phi[info->base];
+        if (is_counter && (current == NULL || (current->type == IR_I32 && root->type == IR_I64))) {
+            test_derived[info->base] = root;
+            test_phi[info->base] = phi;
+            test_increment[info->base] = increment;
+        }
+    }
+    // Limits are mapped while the derived variables are whole
+    for (int b = 0; b < r->base_count; b++) {
+        int side;
+        IrInst* test = test_phi[b] != NULL ? find_exit_test(r, b, &side) : NULL;
+        if (test != NULL) {
+            test_derived[b] = substitute(r, test_derived[b], test->operands[1 - side]);
+        } else {
+            test_phi[b] = NULL;
+        }
+    }
+
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            for (int i = 0; i < inst->operand_count; i++) {
+                IrInst* operand = inst->operands[i];
+                if (operand->id < r->value_count && r->replacement[operand->id] != NULL) {
+                    inst->operands[i] = r->replacement[operand->id];
+                }
+            }
+        }
+    }
+    remove_unused(r);
+    for (int b = 0; b < r->base_count; b++) {
+        if (test_phi[b] != NULL) replace_exit_test(r, b, test_phi[b], test_increment[b], test_derived[b]);
+    }
+
+    free(roots);
+    free(test_derived);
+    free(test_phi);
+    free(test_increment);
+}
+
+// Strength reduction of the induction variables of loops with a
+// preheader and a single back edge, inner loops first
+void reduce_induction_variables(CodeGenerator* gen) {
+    for (int l = gen->loop_count - 1; l >= 0; l--) {
+        Reducer r;
+        r.gen = gen;
+        r.loop = gen->loops[l];
+        r.preheader = find_preheader(r.loop);
+        BasicBlock* header = r.loop->header;
+        if (r.preheader == NULL || header->predecessor_count != 2) continue;
+        r.entry = header->predecessors[0] == r.preheader ? 0 : 1;
+        r.latch = header->predecessors[1 - r.entry];
+        if (ir_terminator(r.preheader) == NULL || ir_terminator(r.latch) == NULL) continue;
+
+        r.value_count = gen->ir->value_count;
+        r.bases = malloc(sizeof(BasicInduction) * (r.value_count + 1));
+        r.info = calloc(r.value_count, sizeof(Induction));
+        r.replacement = calloc(r.value_count, sizeof(IrInst*));
+        reduce_loop(&r);
+        free(r.bases);
+        free(r.info);
+        free(r.replacement);
+    }
+}
+
+// Unrolling. A loop of a single block, counted by a basic induction
+// variable advanced by a constant and tested against an invariant limit,
+// is unrolled completely when it runs a small constant number of times.
+// Otherwise its body is repeated gen->unroll_factor times in a new loop
+// that runs while that many iterations are left, and the original loop
+// follows as the epilogue that runs the rest.
+
+// Instructions an unrolled body may grow to
+#define UNROLL_BUDGET 64
+
+typedef struct {
+    IrInst* phi;
+    IrInst* increment;       // The phi's value on the back edge
+    long long step;
+    IrInst* test;            // Compares the phi or the increment with the limit
+    IrInst* limit;
+    bool is_incremented;     // The increment is tested, not the phi
+    ConditionCode cond;      // The loop goes on while the tested value `cond` the limit
+} Counter;
+
+typedef struct {
+    CodeGenerator* gen;
+    BasicBlock* body;        // The loop: header and latch at once
+    BasicBlock* preheader;
+    BasicBlock* exit;
+    int entry;               // The preheader's index among the body's predecessors
+    int value_count;
+    IrInst** map;            // By value id: its counterpart in the current copy
+} Unroller;
+
+static ConditionCode swapped_condition(ConditionCode cond) {
+    switch (cond) {
+        case COND_L: return COND_G;
+        case COND_G: return COND_L;
+        case COND_LE: return COND_GE;
+        case COND_GE: return COND_LE;
+        case COND_B: return COND_A;
+        case COND_A: return COND_B;
+        case COND_BE: return COND_AE;
+        case COND_AE: return COND_BE;
+        default: return cond;
+    }
+}
+
+static bool find_counter(Unroller* u, Counter* counter) {
+    IrInst* branch = ir_terminator(u->body);
+    IrInst* test = branch->operands[0];
+    if (test->op != IR_CMP || test->block != u->body) return false;
+    for (int side = 0; side < 2; side++) {
+        IrInst* tested = test->operands[side];
+        IrInst* limit = test->operands[1 - side];
+        if (limit->block == u->body || tested->block != u->body) continue;
+        IrInst* phi = tested;
+        IrInst* increment = tested;
+        if (tested->op == IR_PHI) {
+            increment = phi->operands[1 - u->entry];
+        } else if (tested->op == IR_ADD || tested->op == IR_SUB) {
+            phi = tested->operands[tested->op == IR_ADD && tested->operands[0]->op == IR_CONST ? 1 : 0];
+        }
+        if (increment->op != IR_ADD && increment->op != IR_SUB) continue;
+        if (phi->op != IR_PHI || phi->block != u->body || phi->operands[1 - u->entry] != increment) continue;
+        int constant = increment->operands[0] == phi ? 1 : 0;
+        if (increment->operands[constant]->op != IR_CONST || (increment->op == IR_SUB && constant == 0)) continue;
+
+        long long step = increment->operands[constant]->value;
+        if (increment->op == IR_SUB) step = -step;
+        if (step == 0 || step >= (1 << 24) || step <= -(1 << 24)) continue;
+        counter->phi = phi;
+        counter->increment = increment;
+        counter->step = step;
+        counter->test = test;
+        counter->limit = limit;
+        counter->is_incremented = tested == increment;
+        counter->cond = side == 0 ? test->cond : swapped_condition(test->cond);
+        // The opposite condition has the low bit of the encoding flipped
+        if (u->body->successors[0] != u->body) counter->cond ^= 1;
+        return true;
+    }
+    return false;
+}
+
+// How many times the loop runs when it starts and ends at constants, or
+// at a constant distance as a pointer compared with the end of an array
+// is after test replacement; 0 when that is more than `limit` times
+static int count_trips(Unroller* u, const Counter* counter, int limit) {
+    IrInst* start = counter->phi->operands[u->entry];
+    IrInst* end = counter->limit;
+    long long value;
+    long long end_value;
+    if (start->op == IR_CONST && end->op == IR_CONST) {
+        value = start->value;
+        end_value = end->value;
+    } else if (end->op == IR_ADD && end->operands[0] == start && end->operands[1]->op == IR_CONST &&
+               (end->type == IR_I64 || end->is_signed)) {
+        // Without wraparound in between, only the distance matters
+        value = 0;
+        end_value = end->operands[1]->value;
+    } else {
+        return 0;
+    }
+    for (int trips = 1; trips <= limit; trips++) {
+        long long operands[2];
+        long long next;
+        for (int i = 0; i < 2; i++) {
+            const IrInst* operand = counter->increment->operands[i];
+            operands[i] = operand == counter->phi ? value : operand->value;
+        }
+        if (!ir_fold(counter->increment, operands, &next)) return 0;
+        long long tested = counter->is_incremented ? next : value;
+        long long result;
+        operands[0] = counter->test->operands[0] == end ? end_value : tested;
+        operands[1] = counter->test->operands[1] == end ? end_value : tested;
+        if (!ir_fold(counter->test, operands, &result)) return 0;
+        bool goes_on = (result != 0) == (u->body->successors[0] == u->body);
+        if (!goes_on) return trips;
+        value = next;
+    }
+    return 0;
+}
+
+static int body_size(const BasicBlock* body) {
+    int size = 0;
+    for (IrInst* inst = body->first; inst != NULL; inst = inst->next) {
+        if (inst->op != IR_PHI && inst != ir_terminator(body)) size++;
+    }
+    return size;
+}
+
+// The value standing for `value` of the loop in the current copy
+static IrInst* mapped(Unroller* u, IrInst* value) {
+    return value->block == u->body ? u->map[value->id] : value;
+}
+
+static IrInst* append_constant(Unroller* u, BasicBlock* block, IrType type, long long value) {
+    IrInst* constant = ir_new(u->gen->ir, IR_CONST, type);
+    constant->value = ir_normalize(type, value);
+    ir_append(block, constant);
+    return constant;
+}
+
+// One more copy of the body at the end of `into`. Constant offsets from
+// an earlier copy's add are combined, so that each copy advances its
+// pointers from those the copies start with, and operations on
+// constants are folded.
+static void copy_body(Unroller* u, BasicBlock* into) {
+    IrInst* terminator = ir_terminator(u->body);
+    for (IrInst* inst = u->body->first; inst != terminator; inst = inst->next) {
+        if (inst->op == IR_PHI) continue;
+        IrInst* copy = ir_new(u->gen->ir, inst->op, inst->type);
+        copy->value = inst->value;
+        copy->size = inst->size;
+        copy->is_signed = inst->is_signed;
+        copy->is_variadic = inst->is_variadic;
+        copy->cond = inst->cond;
+        copy->symbol = inst->symbol;
+        for (int i = 0; i < inst->operand_count; i++) ir_add_operand(copy, mapped(u, inst->operands[i]));
+
+        if (copy->op == IR_ADD && copy->operands[1]->op == IR_CONST) {
+            IrInst* inner = copy->operands[0];
+            if (inner->op == IR_ADD && inner->block == into && inner->id >= u->value_count &&
+                inner->operands[1]->op == IR_CONST && inner->type == copy->type) {
+                unsigned long long offset = (unsigned long long)inner->operands[1]->value + copy->operands[1]->value;
+                copy->operands[0] = inner->operands[0];
+                copy->operands[1] = append_constant(u, into, copy->type, (long long)offset);
+                copy->is_signed = copy->is_signed && inner->is_signed;
+            }
+        }
+        long long operands[3];
+        bool is_folded = copy->operand_count <= 3;
+        for (int i = 0; i < copy->operand_count && is_folded; i++) {
+            is_folded = copy->operands[i]->op == IR_CONST;
+            operands[i] = copy->operands[i]->value;
+        }
+        long long folded;
+        if (is_folded && copy->operand_count > 0 && ir_fold(copy, operands, &folded)) {
+            copy->op = IR_CONST;
+            copy->operand_count = 0;
+            copy->value = ir_normalize(copy->type, folded);
+        }
+        ir_append(into, copy);
+        u->map[inst->id] = copy;
+    }
+}
+
+// The values the phis take on the back edge after the current copy
+static void carry_phis(Unroller* u, IrInst** carried) {
+    int k = 0;
+    for (IrInst* phi = u->body->first; phi->op == IR_PHI; phi = phi->next) {
+        carried[k++] = mapped(u, phi->operands[1 - u->entry]);
+    }
+}
+
+static void set_phis(Unroller* u, IrInst** values) {
+    int k = 0;
+    for (IrInst* phi = u->body->first; phi->op == IR_PHI; phi = phi->next) u->map[phi->id] = values[k++];
+}
+
+// Values of the loop used after it, which now also leaves from a copy,
+// are given by `replacement` instead: the last copy's values, or phis
+// joining them with the loop's
+static void replace_outside_uses(Unroller* u, IrInst** replacement) {
+    CodeGenerator* gen = u->gen;
+    for (int b = 0; b < gen->block_count; b++) {
+        if (gen->blocks[b] == u->body) continue;
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            // The exit's phis already take a value per edge
+            if (inst->op == IR_PHI && inst->block == u->exit) continue;
+            for (int i = 0; i < inst->operand_count; i++) {
+                IrInst* operand = inst->operands[i];
+                if (operand->block == u->body && replacement[operand->id] != NULL) {
+                    inst->operands[i] = replacement[operand->id];
+                }
+            }
+        }
+    }
+}
+
+// The exit is also reached from the copies in `from`: its phis take the
+// last copy's values on the new edge
+static void add_exit_edge(Unroller* u, BasicBlock* from) {
+    int index = -1;
+    for (int p = 0; p < u->exit->predecessor_count; p++) {
+        if (u->exit->predecessors[p] == u->body) index = p;
+    }
+    cfg_add_edge(from, u->exit);
+    for (IrInst* phi = u->exit->first; phi != NULL && phi->op == IR_PHI; phi = phi->next) {
+        ir_add_operand(phi, mapped(u, phi->operands[index]));
+    }
+}
+
+static BasicBlock* add_block(Unroller* u) {
+    BasicBlock* block = cfg_new_block();
+    cfg_insert_block(u->gen, u->body->id, block);
+    return block;
+}
+
+static void append_branch(Unroller* u, BasicBlock* block, IrInst* condition, BasicBlock* if_true, BasicBlock* if_false) {
+    IrInst* branch = ir_new(u->gen->ir, IR_BRANCH, IR_VOID);
+    ir_add_operand(branch, condition);
+    ir_append(block, branch);
+    cfg_add_edge(block, if_true);
+    cfg_add_edge(block, if_false);
+}
+
+static IrInst* append_compare(Unroller* u, BasicBlock* block, ConditionCode cond, IrInst* left, IrInst* right) {
+    IrInst* compare = ir_new(u->gen->ir, IR_CMP, IR_I32);
+    compare->cond = cond;
+    ir_add_operand(compare, left);
+    ir_add_operand(compare, right);
+    ir_append(block, compare);
+    return compare;
+}
+
+// Whether the loop will go on for `count` more iterations after one run
+// from `value`, given that `value` passes the exit test. The distance to
+// the limit is then exact as an unsigned number, where value plus count
+// steps could overflow.
+static IrInst* append_trips_left(Unroller* u, BasicBlock* block, const Counter* counter, IrInst* value, int count) {
+    bool is_up = counter->step > 0;
+    IrInst* distance = ir_new(u->gen->ir, IR_SUB, value->type);
+    ir_add_operand(distance, is_up ? counter->limit : value);
+    ir_add_operand(distance, is_up ? value : counter->limit);
+    ir_append(block, distance);
+    long long steps = count * (is_up ? counter->step : -counter->step);
+    bool is_strict = counter->cond == COND_L || counter->cond == COND_B ||
+                     counter->cond == COND_G || counter->cond == COND_A;
+    return append_compare(u, block, is_strict ? COND_A : COND_AE, distance,
+                          append_constant(u, block, value->type, steps));
+}
+
+// Replace the loop by `trips` copies of its body in a row
+static void unroll_completely(Unroller* u, int trips) {
+    CodeGenerator* gen = u->gen;
+    BasicBlock* straight = add_block(u);
+    u->preheader->successor_count = 0;
+    cfg_add_edge(u->preheader, straight);
+
+    int phi_count = 0;
+    for (IrInst* phi = u->body->first; phi->op == IR_PHI; phi = phi->next) phi_count++;
+    IrInst** carried = malloc(sizeof(IrInst*) * (phi_count + 1));
+    int k = 0;
+    for (IrInst* phi = u->body->first; phi->op == IR_PHI; phi = phi->next) carried[k++] = phi->operands[u->entry];
+    for (int copy = 0; copy < trips; copy++) {
+        if (copy > 0) carry_phis(u, carried);
+        set_phis(u, carried);
+        copy_body(u, straight);
+    }
+    ir_append(straight, ir_new(gen->ir, IR_JUMP, IR_VOID));
+
+    // The straight-line copies dominate whatever the loop dominated
+    if (u->exit->predecessor_count == 1) {
+        IrInst** replacement = calloc(u->value_count, sizeof(IrInst*));
+        for (IrInst* inst = u->body->first; inst != NULL; inst = inst->next) {
+            if (inst->type != IR_VOID) replacement[inst->id] = u->map[inst->id];
+        }
+        replace_outside_uses(u, replacement);
+        free(replacement);
+    }
+    add_exit_edge(u, straight);
+    free(carried);
+    ir_remove_unreachable_blocks(gen);
+}
+
+// Unroll `factor` times, keeping the loop to finish what is left:
+//
+//   check:     does the loop pass its test at the start?
+//   ahead:     and will it run `factor` times?
+//   unrolled:  `factor` copies, leaving when the last one fails the test
+//   again:     will it run `factor` times more?
+//   remainder: into the original loop, which runs the rest
+static void unroll_partially(Unroller* u, const Counter* counter, int factor) {
+    CodeGenerator* gen = u->gen;
+    BasicBlock* body = u->body;
+    bool is_dominated = u->exit->predecessor_count == 1;
+    BasicBlock* check = add_block(u);
+    BasicBlock* ahead = add_block(u);
+    BasicBlock* unrolled = add_block(u);
+    BasicBlock* again = add_block(u);
+    BasicBlock* remainder = add_block(u);
+
+    u->preheader->successor_count = 0;
+    cfg_add_edge(u->preheader, check);
+    IrInst* start = counter->phi->operands[u->entry];
+    append_branch(u, check, append_compare(u, check, counter->cond, start, counter->limit), ahead, remainder);
+    append_branch(u, ahead, append_trips_left(u, ahead, counter, start, factor - 1), unrolled, remainder);
+
+    int phi_count = 0;
+    for (IrInst* phi = body->first; phi->op == IR_PHI; phi = phi->next) phi_count++;
+    IrInst** heads = malloc(sizeof(IrInst*) * (phi_count + 1));
+    IrInst** carried = malloc(sizeof(IrInst*) * (phi_count + 1));
+    int k = 0;
+    for (IrInst* phi = body->first; phi->op == IR_PHI; phi = phi->next) {
+        heads[k] = ir_new(gen->ir, IR_PHI, phi->type);
+        ir_append(unrolled, heads[k]);
+        k++;
+    }
+    for (int copy = 0; copy < factor; copy++) {
+        if (copy > 0) carry_phis(u, carried);
+        set_phis(u, copy > 0 ? carried : heads);
+        copy_body(u, unrolled);
+    }
+    carry_phis(u, carried);
+
+    // The last copy runs the loop's own exit test
+    IrInst* exit_test = ir_new(gen->ir, IR_BRANCH, IR_VOID);
+    ir_add_operand(exit_test, mapped(u, counter->test));
+    ir_append(unrolled, exit_test);
+    for (int s = 0; s < 2; s++) {
+        if (body->successors[s] == body) {
+            cfg_add_edge(unrolled, again);
+        } else {
+            add_exit_edge(u, unrolled);
+        }
+    }
+    IrInst* next = NULL;
+    k = 0;
+    for (IrInst* phi = body->first; phi->op == IR_PHI; phi = phi->next, k++) {
+        if (phi == counter->phi) next = carried[k];
+    }
+    append_branch(u, again, append_trips_left(u, again, counter, next, factor - 1), unrolled, remainder);
+
+    // Phis of the unrolled loop, over its entry and back edge, and of the
+    // remainder's entry, over the check, ahead and again
+    k = 0;
+    for (IrInst* phi = body->first; phi->op == IR_PHI; phi = phi->next, k++) {
+        IrInst* initial = phi->operands[u->entry];
+        ir_add_operand(heads[k], initial);
+        ir_add_operand(heads[k], carried[k]);
+        IrInst* resumed = ir_new(gen->ir, IR_PHI, phi->type);
+        ir_add_operand(resumed, initial);
+        ir_add_operand(resumed, initial);
+        ir_add_operand(resumed, carried[k]);
+        ir_append(remainder, resumed);
+        phi->operands[u->entry] = resumed;
+    }
+    ir_append(remainder, ir_new(gen->ir, IR_JUMP, IR_VOID));
+    remainder->successors[remainder->successor_count++] = body;
+    body->predecessors[u->entry] = remainder;
+
+    // Values used past a loop that dominated its exit now come from
+    // either loop, through phis
+    if (is_dominated) {
+        IrInst** replacement = calloc(u->value_count, sizeof(IrInst*));
+        for (IrInst* inst = body->first; inst != NULL; inst = inst->next) {
+            if (inst->type == IR_VOID) continue;
+            IrInst* phi = ir_new(gen->ir, IR_PHI, inst->type);
+            ir_add_operand(phi, inst);
+            ir_add_operand(phi, mapped(u, inst));
+            replacement[inst->id] = phi;
+        }
+        replace_outside_uses(u, replacement);
+        // Those left unused go with the dead code
+        for (IrInst* inst = body->first; inst != NULL; inst = inst->next) {
+            if (replacement[inst->id] != NULL) ir_insert_before(u->exit->first, replacement[inst->id]);
+        }
+        free(replacement);
+    }
+    free(heads);
+    free(carried);
+}
+
+// Whether the counter moves toward its limit, as one counting up and
+// tested with < does
+static bool approaches_limit(const Counter* counter) {
+    switch (counter->cond) {
+        case COND_L: case COND_LE: case COND_B: case COND_BE: return counter->step > 0;
+        case COND_G: case COND_GE: case COND_A: case COND_AE: return counter->step < 0;
+        default: return false;
+    }
+}
+
+// The loop's own counter, when it ends in a branch of which one way
+// leaves the loop
+static bool find_loop_counter(Unroller* u, Counter* counter) {
+    IrInst* branch = ir_terminator(u->body);
+    if (branch == NULL || branch->op != IR_BRANCH || ir_terminator(u->preheader) == NULL) return false;
+    if (u->body->successors[0] == u->body->successors[1]) return false;
+    return find_counter(u, counter);
+}
+
+static bool unroll_loop(Unroller* u) {
+    Counter counter;
+    if (!find_loop_counter(u, &counter)) return false;
+
+    int size = body_size(u->body);
+    if (size == 0) return false;
+    int trips = count_trips(u, &counter, UNROLL_BUDGET / size);
+    if (trips > 0) {
+        unroll_completely(u, trips);
+        return true;
+    }
+
+    // An epilogue mostly runs fewer times than the vector width
+    int factor = u->body->is_epilogue ? 1 : u->gen->unroll_factor;
+    if (factor * size > UNROLL_BUDGET) factor = UNROLL_BUDGET / size;
+    if (factor < 2 || !counter.is_incremented || !approaches_limit(&counter)) return false;
+    unroll_partially(u, &counter, factor);
+    return true;
+}
+
+// The innermost loops that are a single block with a preheader. They
+// are disjoint, so transforming one leaves the others in place.
+static BasicBlock** find_loop_bodies(CodeGenerator* gen, int* count) {
+    BasicBlock** bodies = malloc(sizeof(BasicBlock*) * (gen->loop_count + 1));
+    *count = 0;
+    for (int l = 0; l < gen->loop_count; l++) {
+        Loop* loop = gen->loops[l];
+        if (loop->block_count == 1 && loop->header->predecessor_count == 2 && find_preheader(loop) != NULL) {
+            bodies[(*count)++] = loop->header;
+        }
+    }
+    return bodies;
+}
+
+static void start_unroller(Unroller* u, CodeGenerator* gen, BasicBlock* body) {
+    u->gen = gen;
+    u->body = body;
+    u->preheader = find_preheader(body->loop);
+    u->entry = body->predecessors[0] == u->preheader ? 0 : 1;
+    u->exit = body->successors[body->successors[0] == body ? 1 : 0];
+    u->value_count = gen->ir->value_count;
+    u->map = calloc(u->value_count, sizeof(IrInst*));
+}
+
+// Unrolling of the innermost loops that are a single block with a
+// preheader, by up to gen->unroll_factor; a factor of 1 turns it off
+void unroll_loops(CodeGenerator* gen) {
+    if (gen->unroll_factor < 2) return;
+    int body_count;
+    BasicBlock** bodies = find_loop_bodies(gen, &body_count);
+    for (int i = 0; i < body_count; i++) {
+        Unroller u;
+        start_unroller(&u, gen, bodies[i]);
+        if (unroll_loop(&u)) analyze_control_flow(gen);
+        free(u.map);
+    }
+    free(bodies);
+}
+
+// Vectorization. A counted loop of a single block whose body loads and
+// stores 32-bit elements through pointers advanced by one element an
+// iteration, and computes on them lane by lane or adds them up, is run
+// gen->vector_width iterations at a time. As after partial unrolling,
+// the original loop then runs what is left:
+//
+//   check, ahead: does the loop run `width` times?
+//   overlap:      one test per load through another pointer than the
+//                 store's, that the store cannot write what the load
+//                 reads for a later iteration
+//   setup:        the scalars the body uses, in every lane, and the
+//                 zeros the sums start from
+//   vector:       `width` iterations, leaving when the last one fails
+//                 the loop's test
+//   again:        will it run `width` times more?
+//   done:         the sums' totals, then the loop's test once more
+//   remainder:    into the original loop, which runs the rest
+
+// The part a value of the body plays
+typedef enum {
+    LANE_NONE,
+    LANE_INDUCTION,          // Phi advanced by a constant step
+    LANE_OFFSET,             // Constant offset from an induction phi: its increment, or an address
+    LANE_TEST,               // The exit test
+    LANE_SUM,                // Phi adding up a value of each iteration
+    LANE_VECTOR              // A value per lane, or the store
+} LaneRole;
+
+typedef struct {
+    Unroller u;
+    Counter counter;
+    int width;
+    LaneRole* roles;         // By value id
+    IrInst* store;           // The body's only store, if any
+    IrInst** broadcasts;     // By value id: an invariant in every lane
+    BasicBlock* setup;
+} Vectorizer;
+
+// `value` as `base` plus a constant
+static bool constant_offset(IrInst* value, IrInst** base, long long* offset) {
+    if (value->op != IR_ADD && value->op != IR_SUB) return false;
+    int constant = value->operands[1]->op == IR_CONST ? 1 : -1;
+    if (value->op == IR_ADD && value->operands[0]->op == IR_CONST) constant = 0;
+    if (constant < 0) return false;
+    *base = value->operands[1 - constant];
+    *offset = value->op == IR_SUB ? -value->operands[1]->value : value->operands[constant]->value;
+    return true;
+}
+
+static IrInst* back_value(Vectorizer* v, const IrInst* phi) {
+    return phi->operands[1 - v->u.entry];
+}
+
+static long long induction_step(Vectorizer* v, const IrInst* phi) {
+    IrInst* base;
+    long long step = 0;
+    constant_offset(back_value(v, phi), &base, &step);
+    return step;
+}
+
+// The induction phi an address is a constant `offset` from, when it
+// advances by one 32-bit element an iteration
+static IrInst* element_pointer(Vectorizer* v, IrInst* address, long long* offset) {
+    if (address->block != v->u.body || address->type != IR_I64) return NULL;
+    IrInst* phi = address;
+    *offset = 0;
+    if (v->roles[address->id] == LANE_OFFSET) {
+        constant_offset(address, &phi, offset);
+    } else if (v->roles[address->id] != LANE_INDUCTION) {
+        return NULL;
+    }
+    return induction_step(v, phi) == 4 ? phi : NULL;
+}
+
+// The sum phi `value` is the next value of, if any
+static IrInst* summed_phi(Vectorizer* v, const IrInst* value) {
+    for (IrInst* phi = v->u.body->first; phi->op == IR_PHI; phi = phi->next) {
+        if (v->roles[phi->id] == LANE_SUM && back_value(v, phi) == value) return phi;
+    }
+    return NULL;
+}
+
+// Whether a vector operation `user` can take `operand`: another vector,
+// an int of outside the loop in every lane, or the sum it adds to
+static bool is_lane_operand(Vectorizer* v, const IrInst* user, IrInst* operand) {
+    if (operand->block != v->u.body) return operand->type == IR_I32;
+    if (v->roles[operand->id] == LANE_SUM) return back_value(v, operand) == user;
+    return v->roles[operand->id] == LANE_VECTOR && operand->op != IR_STORE;
+}
+
+// The shift a multiplication by a power of two amounts to, with the
+// index of its other operand; -1 for any other operation
+static int multiplier_shift(const IrInst* inst, int* other) {
+    if (inst->op != IR_MUL) return -1;
+    for (int i = 0; i < 2; i++) {
+        long long constant = inst->operands[i]->value;
+        if (inst->operands[i]->op != IR_CONST || constant <= 0 || (constant & (constant - 1)) != 0) continue;
+        int shift = 0;
+        while ((1LL << shift) < constant) shift++;
+        *other = 1 - i;
+        return shift;
+    }
+    return -1;
+}
+
+static bool is_lane_operation(Vectorizer* v, IrInst* inst) {
+    long long offset;
+    switch (inst->op) {
+        case IR_LOAD:
+            // Loads after the store could read what it wrote
+            return inst->type == IR_I32 && inst->size == 4 && v->store == NULL &&
+                   element_pointer(v, inst->operands[0], &offset) != NULL;
+        case IR_STORE:
+            return inst->size == 4 && v->store == NULL && element_pointer(v, inst->operands[0], &offset) != NULL &&
+                   is_lane_operand(v, inst, inst->operands[1]);
+        case IR_SHL:
+        case IR_SHR:
+            return inst->type == IR_I32 && inst->operands[1]->op == IR_CONST &&
+                   is_lane_operand(v, inst, inst->operands[0]);
+        case IR_ADD: case IR_SUB: case IR_MUL: case IR_AND: case IR_OR: case IR_XOR: case IR_NEG: case IR_NOT:
+            if (inst->type != IR_I32) return false;
+            for (int i = 0; i < inst->operand_count; i++) {
+                if (!is_lane_operand(v, inst, inst->operands[i])) return false;
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+// The part each value of the body plays; false when one fits none
+static bool classify_lanes(Vectorizer* v) {
+    BasicBlock* body = v->u.body;
+    for (IrInst* phi = body->first; phi->op == IR_PHI; phi = phi->next) {
+        IrInst* back = back_value(v, phi);
+        IrInst* base;
+        long long step;
+        if (constant_offset(back, &base, &step) && base == phi && step != 0) {
+            v->roles[phi->id] = LANE_INDUCTION;
+            continue;
+        }
+        if (phi->type != IR_I32 || back->block != body || (back->op != IR_ADD && back->op != IR_SUB)) return false;
+        bool is_added = back->operands[0] == phi ? back->operands[1] != phi
+                                                 : back->op == IR_ADD && back->operands[1] == phi;
+        if (!is_added) return false;
+        v->roles[phi->id] = LANE_SUM;
+    }
+    bool has_lanes = false;
+    IrInst* terminator = ir_terminator(body);
+    for (IrInst* inst = body->first; inst != terminator; inst = inst->next) {
+        if (inst->op == IR_PHI) continue;
+        IrInst* base;
+        long long offset;
+        if (inst == v->counter.test) {
+            v->roles[inst->id] = LANE_TEST;
+        } else if (constant_offset(inst, &base, &offset) && base->block == body &&
+                   v->roles[base->id] == LANE_INDUCTION) {
+            v->roles[inst->id] = LANE_OFFSET;
+        } else if (is_lane_operation(v, inst)) {
+            v->roles[inst->id] = LANE_VECTOR;
+            if (inst->op == IR_STORE) v->store = inst;
+            has_lanes = true;
+        } else {
+            return false;
+        }
+    }
+    return has_lanes;
+}
+
+// Values of the body are used after it only where the vector loop has
+// their last value at hand: the induction phis, their increments and the
+// sums. A sum's next value is used by nothing else in the body.
+static bool has_vector_uses(Vectorizer* v) {
+    CodeGenerator* gen = v->u.gen;
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            for (int i = 0; i < inst->operand_count; i++) {
+                IrInst* operand = inst->operands[i];
+                if (operand->block != v->u.body) continue;
+                LaneRole role = v->roles[operand->id];
+                IrInst* sum = role == LANE_VECTOR ? summed_phi(v, operand) : NULL;
+                if (inst->block == v->u.body) {
+                    if (sum != NULL && inst != sum) return false;
+                    continue;
+                }
+                IrInst* base;
+                long long offset;
+                bool is_increment = role == LANE_OFFSET && constant_offset(operand, &base, &offset) &&
+                                    back_value(v, base) == operand;
+                if (role != LANE_INDUCTION && !is_increment && sum == NULL) return false;
+            }
+        }
+    }
+    return true;
+}
+
+// The vector registers the loop needs: one for each scalar in every
+// lane, each sum and the zeros they start from, all through the loop,
+// and one for each other vector from its definition to its last use
+static int count_vectors(Vectorizer* v) {
+    BasicBlock* body = v->u.body;
+    IrInst* terminator = ir_terminator(body);
+    bool* is_held = calloc(v->u.value_count, sizeof(bool));
+    int* position = calloc(v->u.value_count, sizeof(int));
+    int* last_use = calloc(v->u.value_count, sizeof(int));
+    int held = 0;
+    bool has_sums = false;
+    int p = 0;
+    for (IrInst* inst = body->first; inst != terminator; inst = inst->next, p++) {
+        position[inst->id] = p;
+        if (v->roles[inst->id] == LANE_SUM) {
+            // The sum and its next value, and the zeros all sums share
+            held += has_sums ? 2 : 3;
+            has_sums = true;
+            is_held[back_value(v, inst)->id] = true;
+        }
+        if (v->roles[inst->id] != LANE_VECTOR) continue;
+        int other = -1;
+        int shift = multiplier_shift(inst, &other);
+        for (int i = 0; i < inst->operand_count; i++) {
+            IrInst* operand = inst->operands[i];
+            bool is_scalar = (i == 0 && (inst->op == IR_LOAD || inst->op == IR_STORE)) ||
+                             (i == 1 && (inst->op == IR_SHL || inst->op == IR_SHR)) || (shift >= 0 && i != other);
+            if (is_scalar) continue;
+            if (operand->block == body) {
+                last_use[operand->id] = p;
+            } else if (!is_held[operand->id]) {
+                is_held[operand->id] = true;
+                held++;
+            }
+        }
+    }
+    int most = 0;
+    for (IrInst* inst = body->first; inst != terminator; inst = inst->next) {
+        if (v->roles[inst->id] != LANE_VECTOR || inst->op == IR_STORE || is_held[inst->id]) continue;
+        int live = 1;
+        for (IrInst* other = body->first; other != inst; other = other->next) {
+            bool is_local = v->roles[other->id] == LANE_VECTOR && other->op != IR_STORE && !is_held[other->id];
+            if (is_local && last_use[other->id] >= position[inst->id]) live++;
+        }
+        if (live > most) most = live;
+    }
+    free(is_held);
+    free(position);
+    free(last_use);
+    return held + most;
+}
+
+// Whether the store, `distance` bytes ahead of a load, writes what the
+// load reads for a later lane of the same vector iteration
+static bool overlaps_later_lane(Vectorizer* v, long long distance) {
+    return distance > 0 && distance < 4 * v->width;
+}
+
+// Where an access starts out: a value outside the loop, and a constant
+// offset from it
+static IrInst* access_origin(Vectorizer* v, IrInst* address, long long* offset) {
+    IrInst* pointer = element_pointer(v, address, offset);
+    IrInst* start = pointer->operands[v->u.entry];
+    IrInst* base;
+    long long start_offset;
+    if (!constant_offset(start, &base, &start_offset)) return start;
+    *offset += start_offset;
+    return base;
+}
+
+// The loads that need a test at run time: those from another origin than
+// the store's, which may point anywhere. False when a load of the same
+// origin always overlaps.
+static bool find_overlap_tests(Vectorizer* v, IrInst** loads, int* load_count) {
+    *load_count = 0;
+    if (v->store == NULL) return true;
+    long long store_offset;
+    IrInst* store_origin = access_origin(v, v->store->operands[0], &store_offset);
+    for (IrInst* inst = v->u.body->first; inst != v->store; inst = inst->next) {
+        if (inst->op != IR_LOAD) continue;
+        long long load_offset;
+        IrInst* load_origin = access_origin(v, inst->operands[0], &load_offset);
+        if (load_origin != store_origin) {
+            if (loads != NULL) loads[*load_count] = inst;
+            (*load_count)++;
+        } else if (overlaps_later_lane(v, store_offset - load_offset)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The vector of `value`: its copy in the vector loop, or for a value of
+// outside the loop, its broadcast in the setup block
+static IrInst* lanes(Vectorizer* v, IrInst* value) {
+    if (value->block == v->u.body) return v->u.map[value->id];
+    if (v->broadcasts[value->id] == NULL) {
+        IrInst* broadcast = ir_new(v->u.gen->ir, IR_BROADCAST, IR_V32);
+        ir_add_operand(broadcast, value);
+        ir_append(v->setup, broadcast);
+        v->broadcasts[value->id] = broadcast;
+    }
+    return v->broadcasts[value->id];
+}
+
+// The body on `width` iterations at once, at the end of `into`: vector
+// operations, and the offsets from the induction phis for the first of
+// the iterations
+static void copy_lanes(Vectorizer* v, BasicBlock* into) {
+    Unroller* u = &v->u;
+    IrInst* terminator = ir_terminator(u->body);
+    for (IrInst* inst = u->body->first; inst != terminator; inst = inst->next) {
+        LaneRole role = v->roles[inst->id];
+        if (inst->op == IR_PHI || role == LANE_TEST) continue;
+        bool is_vector = role == LANE_VECTOR && inst->op != IR_STORE;
+        IrInst* copy = ir_new(u->gen->ir, inst->op, is_vector ? IR_V32 : inst->type);
+        copy->size = inst->size;
+        copy->is_signed = inst->is_signed;
+        int other = -1;
+        int shift = role == LANE_VECTOR ? multiplier_shift(inst, &other) : -1;
+        if (shift >= 0) {
+            copy->op = IR_SHL;
+            ir_add_operand(copy, lanes(v, inst->operands[other]));
+            ir_add_operand(copy, append_constant(u, into, IR_I32, shift));
+        } else {
+            for (int i = 0; i < inst->operand_count; i++) {
+                bool is_scalar = role == LANE_OFFSET || (i == 0 && (inst->op == IR_LOAD || inst->op == IR_STORE)) ||
+                                 (i == 1 && (inst->op == IR_SHL || inst->op == IR_SHR));
+                IrInst* operand = inst->operands[i];
+                ir_add_operand(copy, is_scalar ? mapped(u, operand) : lanes(v, operand));
+            }
+        }
+        ir_append(into, copy);
+        u->map[inst->id] = copy;
+    }
+}
+
+// The loop's exit test, on the counter's next value `next`
+static IrInst* append_exit_test(Vectorizer* v, BasicBlock* block, IrInst* next) {
+    IrInst* test = v->counter.test;
+    IrInst* left = test->operands[0] == v->counter.increment ? next : test->operands[0];
+    IrInst* right = test->operands[1] == v->counter.increment ? next : test->operands[1];
+    IrInst* branch = ir_new(v->u.gen->ir, IR_BRANCH, IR_VOID);
+    ir_add_operand(branch, append_compare(&v->u, block, test->cond, left, right));
+    ir_append(block, branch);
+    return branch;
+}
+
+static void vectorize_body(Vectorizer* v, IrInst** loads, int load_count) {
+    Unroller* u = &v->u;
+    CodeGenerator* gen = u->gen;
+    BasicBlock* body = u->body;
+    const Counter* counter = &v->counter;
+    int width = v->width;
+    bool is_dominated = u->exit->predecessor_count == 1;
+    BasicBlock* check = add_block(u);
+    BasicBlock* ahead = add_block(u);
+    BasicBlock** overlaps = malloc(sizeof(BasicBlock*) * (load_count + 1));
+    for (int l = 0; l < load_count; l++) overlaps[l] = add_block(u);
+    v->setup = add_block(u);
+    overlaps[load_count] = v->setup;
+    BasicBlock* vector = add_block(u);
+    BasicBlock* again = add_block(u);
+    BasicBlock* done = add_block(u);
+    BasicBlock* remainder = add_block(u);
+
+    u->preheader->successor_count = 0;
+    cfg_add_edge(u->preheader, check);
+    IrInst* start = counter->phi->operands[u->entry];
+    append_branch(u, check, append_compare(u, check, counter->cond, start, counter->limit), ahead, remainder);
+    append_branch(u, ahead, append_trips_left(u, ahead, counter, start, width - 1), overlaps[0], remainder);
+
+    // How far the store is ahead of each load, from where they start
+    for (int l = 0; l < load_count; l++) {
+        long long store_offset;
+        long long load_offset;
+        IrInst* distance = ir_new(gen->ir, IR_SUB, IR_I64);
+        ir_add_operand(distance, access_origin(v, v->store->operands[0], &store_offset));
+        ir_add_operand(distance, access_origin(v, loads[l]->operands[0], &load_offset));
+        ir_append(overlaps[l], distance);
+        // 0 < distance < 4 * width, as one unsigned comparison
+        IrInst* shifted = ir_new(gen->ir, IR_ADD, IR_I64);
+        ir_add_operand(shifted, distance);
+        ir_add_operand(shifted, append_constant(u, overlaps[l], IR_I64, store_offset - load_offset - 1));
+        ir_append(overlaps[l], shifted);
+        IrInst* limit = append_constant(u, overlaps[l], IR_I64, 4 * width - 1);
+        append_branch(u, overlaps[l], append_compare(u, overlaps[l], COND_B, shifted, limit), remainder, overlaps[l + 1]);
+    }
+
+    int phi_count = 0;
+    for (IrInst* phi = body->first; phi->op == IR_PHI; phi = phi->next) phi_count++;
+    IrInst** heads = malloc(sizeof(IrInst*) * (phi_count + 1));
+    IrInst** nexts = malloc(sizeof(IrInst*) * (phi_count + 1));
+    IrInst* zero = NULL;
+    int k = 0;
+    for (IrInst* phi = body->first; phi->op == IR_PHI; phi = phi->next, k++) {
+        bool is_sum = v->roles[phi->id] == LANE_SUM;
+        heads[k] = ir_new(gen->ir, IR_PHI, is_sum ? IR_V32 : phi->type);
+        ir_append(vector, heads[k]);
+        u->map[phi->id] = heads[k];
+        if (is_sum && zero == NULL) {
+            zero = ir_new(gen->ir, IR_BROADCAST, IR_V32);
+            ir_add_operand(zero, append_constant(u, v->setup, IR_I32, 0));
+            ir_append(v->setup, zero);
+        }
+    }
+    copy_lanes(v, vector);
+    ir_append(v->setup, ir_new(gen->ir, IR_JUMP, IR_VOID));
+    cfg_add_edge(v->setup, vector);
+
+    // Induction phis advance by `width` steps, sums lane by lane
+    IrInst* next = NULL;
+    k = 0;
+    for (IrInst* phi = body->first; phi->op == IR_PHI; phi = phi->next, k++) {
+        if (v->roles[phi->id] == LANE_SUM) {
+            nexts[k] = u->map[back_value(v, phi)->id];
+        } else {
+            IrInst* step = append_constant(u, vector, phi->type, induction_step(v, phi) * width);
+            nexts[k] = ir_new(gen->ir, IR_ADD, phi->type);
+            nexts[k]->is_signed = back_value(v, phi)->is_signed;
+            ir_add_operand(nexts[k], heads[k]);
+            ir_add_operand(nexts[k], step);
+            ir_append(vector, nexts[k]);
+        }
+        if (phi == counter->phi) next = nexts[k];
+        ir_add_operand(heads[k], v->roles[phi->id] == LANE_SUM ? zero : phi->operands[u->entry]);
+        ir_add_operand(heads[k], nexts[k]);
+    }
+    append_exit_test(v, vector, next);
+    for (int s = 0; s < 2; s++) cfg_add_edge(vector, body->successors[s] == body ? again : done);
+    append_branch(u, again, append_trips_left(u, again, counter, next, width - 1), vector, done);
+
+    // After the vector loop: the sums' totals, and the values of the last
+    // iteration it ran for the uses after the loop
+    k = 0;
+    for (IrInst* phi = body->first; phi->op == IR_PHI; phi = phi->next, k++) {
+        IrInst* back = back_value(v, phi);
+        if (v->roles[phi->id] == LANE_SUM) {
+            IrInst* reduce = ir_new(gen->ir, IR_REDUCE, IR_I32);
+            ir_add_operand(reduce, nexts[k]);
+            ir_append(done, reduce);
+            IrInst* total = ir_new(gen->ir, IR_ADD, IR_I32);
+            ir_add_operand(total, phi->operands[u->entry]);
+            ir_add_operand(total, reduce);
+            ir_append(done, total);
+            nexts[k] = total;
+        } else {
+            IrInst* step = append_constant(u, done, phi->type, induction_step(v, phi) * (width - 1));
+            IrInst* last = ir_new(gen->ir, IR_ADD, phi->type);
+            last->is_signed = back->is_signed;
+            ir_add_operand(last, heads[k]);
+            ir_add_operand(last, step);
+            ir_append(done, last);
+            u->map[phi->id] = last;
+        }
+        u->map[back->id] = nexts[k];
+    }
+    append_exit_test(v, done, next);
+    for (int s = 0; s < 2; s++) {
+        if (body->successors[s] == body) {
+            cfg_add_edge(done, remainder);
+        } else {
+            add_exit_edge(u, done);
+        }
+    }
+
+    // The remainder resumes where the vector loop left off, or starts
+    // from the beginning when it did not run
+    k = 0;
+    for (IrInst* phi = body->first; phi->op == IR_PHI; phi = phi->next, k++) {
+        IrInst* resumed = ir_new(gen->ir, IR_PHI, phi->type);
+        for (int p = 0; p < remainder->predecessor_count; p++) {
+            ir_add_operand(resumed, remainder->predecessors[p] == done ? nexts[k] : phi->operands[u->entry]);
+        }
+        ir_append(remainder, resumed);
+        phi->operands[u->entry] = resumed;
+    }
+    ir_append(remainder, ir_new(gen->ir, IR_JUMP, IR_VOID));
+    remainder->successors[remainder->successor_count++] = body;
+    body->predecessors[u->entry] = remainder;
+    body->is_epilogue = true;
+
+    if (is_dominated) {
+        IrInst** replacement = calloc(u->value_count, sizeof(IrInst*));
+        for (IrInst* phi = body->first; phi->op == IR_PHI; phi = phi->next) {
+            IrInst* back = back_value(v, phi);
+            IrInst* values[2] = {phi, back};
+            for (int i = v->roles[phi->id] == LANE_SUM ? 1 : 0; i < 2; i++) {
+                IrInst* joined = ir_new(gen->ir, IR_PHI, values[i]->type);
+                ir_add_operand(joined, values[i]);
+                ir_add_operand(joined, u->map[values[i]->id]);
+                replacement[values[i]->id] = joined;
+            }
+        }
+        replace_outside_uses(u, replacement);
+        for (IrInst* inst = body->first; inst != NULL; inst = inst->next) {
+            if (replacement[inst->id] != NULL) ir_insert_before(u->exit->first, replacement[inst->id]);
+        }
+        free(replacement);
+    }
+    free(overlaps);
+    free(heads);
+    free(nexts);
+}
+
+static bool vectorize_loop(Vectorizer* v) {
+    Unroller* u = &v->u;
+    if (!find_loop_counter(u, &v->counter) || !v->counter.is_incremented || !approaches_limit(&v->counter)) {
+        return false;
+    }
+    // Loops unrolling takes apart completely, and those too short to
+    // fill a vector, are left alone
+    int size = body_size(u->body);
+    int trips_limit = v->width - 1;
+    if (u->gen->unroll_factor >= 2 && size > 0 && UNROLL_BUDGET / size > trips_limit) {
+        trips_limit = UNROLL_BUDGET / size;
+    }
+    if (size == 0 || count_trips(u, &v->counter, trips_limit) > 0) return false;
+    if (!classify_lanes(v) || !has_vector_uses(v) || count_vectors(v) > VECTOR_REGISTERS) return false;
+
+    int load_count;
+    if (!find_overlap_tests(v, NULL, &load_count)) return false;
+    IrInst** loads = malloc(sizeof(IrInst*) * (load_count + 1));
+    find_overlap_tests(v, loads, &load_count);
+    vectorize_body(v, loads, load_count);
+    free(loads);
+    return true;
+}
+
+// Vectorization of the innermost loops that are a single block with a
+// preheader, gen->vector_width iterations at a time; a width of 0 turns
+// it off
+void vectorize_loops(CodeGenerator* gen) {
+    if (gen->vector_width < 2) return;
+    int body_count;
+    BasicBlock** bodies = find_loop_bodies(gen, &body_count);
+    for (int i = 0; i < body_count; i++) {
+        Vectorizer v;
+        start_unroller(&v.u, gen, bodies[i]);
+        v.width = gen->vector_width;
+        v.roles = calloc(v.u.value_count, sizeof(LaneRole));
+        v.store = NULL;
+        v.broadcasts = calloc(v.u.value_count, sizeof(IrInst*));
+        v.setup = NULL;
+        if (vectorize_loop(&v)) analyze_control_flow(gen);
+        free(v.u.map);
+        free(v.roles);
+        free(v.broadcasts);
+    }
+    free(bodies);
+}
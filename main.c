@@ -1,97 +1,50 @@
-#include "lexer.h"
-#include "parser.h"
-#include "semantic.h"
-#include "codegen.h"
+#include "driver.h"
+#include "server.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-// Read entire source file into memory
-static char* read_file(const char* filename) {
-    FILE* file = fopen(filename, "r");
-    if (file == NULL) {
-        fprintf(stderr, "Could not open file '%s'\n", filename);
-        return NULL;
-    }
-
-    // Get file size
-    fseek(file, 0, SEEK_END);
-    size_t size = ftell(file);
-    rewind(file);
-
-    // Allocate buffer and read file
-    char* buffer = malloc(size + 1);
-    if (buffer == NULL) {
-        fprintf(stderr, "Not enough memory to read file '%s'\n", filename);
-        fclose(file);
-        return NULL;
-    }
-
-    size_t bytes_read = fread(buffer, 1, size, file);
-    if (bytes_read < size) {
-        fprintf(stderr, "Could not read file '%s'\n", filename);
-        free(buffer);
-        fclose(file);
-        return NULL;
-    }
-
-    buffer[bytes_read] = '\0';
-    fclose(file);
-    return buffer;
-}
+#include <stdbool.h>
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <source>\n", argv[0]);
-        return 1;
+    bool server = false;
+    bool client = false;
+    char socket_path[4096];
+    server_default_socket(socket_path, sizeof(socket_path));
+
+    // Mode options come first; everything after them is a compile command
+    int first = 1;
+    while (first < argc) {
+        if (strcmp(argv[first], "--server") == 0) {
+            server = true;
+        } else if (strcmp(argv[first], "--client") == 0) {
+            client = true;
+        } else if (strcmp(argv[first], "--socket") == 0 && first + 1 < argc) {
+            snprintf(socket_path, sizeof(socket_path), "%s", argv[++first]);
+        } else {
+            break;
+        }
+        first++;
     }
 
-    // Read source file
-    char* source = read_file(argv[1]);
-    if (source == NULL) return 1;
-
-    // Initialize compiler components
-    Lexer* lexer = lexer_init(source, argv[1]);
-    Parser* parser = parser_init(lexer);
-    SemanticAnalyzer* analyzer = semantic_init();
-    analyzer->filename = strdup(argv[1]);
-
-    // Parse program
-    Statement* program = parse_program(parser);
-    if (parser->had_error) {
-        fprintf(stderr, "%s:%d:%d: %s\n",
-                parser->error->filename,
-                parser->error->line,
-                parser->error->column,
-                parser->error->message);
-        goto cleanup;
+    if (server) {
+        return server_run(socket_path);
     }
 
-    // Perform semantic analysis
-    check_statement(analyzer, program);
-    if (analyzer->had_error) {
-        goto cleanup;
+    if (client) {
+        int status = client_run(socket_path, argc - first, argv + first);
+        if (status >= 0) return status;
+        // No server running: compile in this process instead
     }
 
-    // Generate code
-    char* output_file = "output.s";
-    FILE* output = fopen(output_file, "w");
-    if (output == NULL) {
-        fprintf(stderr, "Could not create output file '%s'\n", output_file);
-        goto cleanup;
+    // argv[first - 1] stands in for the program name
+    DriverOptions options;
+    if (!driver_parse_options(argc - first + 1, argv + first - 1, &options)) {
+        driver_usage(argv[0]);
+        driver_free_options(&options);
+        return 1;
     }
 
-    CodeGenerator* gen = codegen_init(output, true);
-    generate_program(gen, program);
-    fclose(output);
-
-    // Cleanup
-cleanup:
-    free_statement(program);
-    semantic_free(analyzer);
-    parser_free(parser);
-    lexer_free(lexer);
-    free(source);
-
-    return 0;
+    int status = driver_run(&options);
+    driver_free_options(&options);
+    return status;
 }
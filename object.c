@@ -0,0 +1,578 @@
+#include "object.h"
+#include "encode.h"
+#include <elf.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Output section indices. The first ones follow SectionKind.
+enum {
+    SHNDX_RELA_TEXT = SECTION_COUNT + 1,
+    SHNDX_RELA_DATA,
+    SHNDX_SYMTAB,
+    SHNDX_STRTAB,
+    SHNDX_SHSTRTAB,
+    SHNDX_COUNT
+};
+
+// Symbol table indices of the section symbols
+#define SECTION_SYMBOL(section) (1 + (section))
+#define SECTION_SYMBOL_COUNT SECTION_NOTE_GNU_STACK
+
+typedef struct {
+    const char* name;
+    int section;             // -1 while undefined
+    long long value;
+    long long size;
+    bool global;
+    bool function;
+    bool typed;
+    int index;               // In .symtab
+} ObjectSymbol;
+
+// Local label or string: owner function, number and kind
+typedef struct {
+    const char* owner;
+    long long number;
+    bool is_string;
+    int section;
+    long long offset;
+} ObjectLabel;
+
+typedef struct {
+    ObjectSymbol* symbols;
+    int symbol_count;
+    int* symbol_slots;       // Open addressing, -1 when empty
+    int symbol_capacity;
+
+    ObjectLabel* labels;
+    int label_count;
+    int* label_slots;
+    int label_capacity;
+} ObjectTables;
+
+static unsigned long long hash_name(const char* name, unsigned long long hash) {
+    for (const unsigned char* c = (const unsigned char*)name; *c; c++) {
+        hash = (hash ^ *c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void grow_slots(int** slots, int* capacity, int count) {
+    if (count * 2 < *capacity) return;
+    free(*slots);
+    *capacity = *capacity ? *capacity * 2 : 256;
+    *slots = malloc(sizeof(int) * *capacity);
+    memset(*slots, 0xff, sizeof(int) * *capacity);
+}
+
+static unsigned long long label_hash(const char* owner, long long number, bool is_string) {
+    return hash_name(owner, 14695981039346656037ULL) ^ (unsigned long long)(number * 2 + is_string) * 0x9e3779b97f4a7c15ULL;
+}
+
+static void insert_label_slot(ObjectTables* tables, int index) {
+    ObjectLabel* label = &tables->labels[index];
+    unsigned long long mask = tables->label_capacity - 1;
+    unsigned long long slot = label_hash(label->owner, label->number, label->is_string) & mask;
+    while (tables->label_slots[slot] >= 0) slot = (slot + 1) & mask;
+    tables->label_slots[slot] = index;
+}
+
+static ObjectLabel* find_label(ObjectTables* tables, const Operand* operand, bool create) {
+    bool is_string = operand->kind == OPERAND_STRING;
+    if (tables->label_capacity > 0) {
+        unsigned long long mask = tables->label_capacity - 1;
+        unsigned long long slot = label_hash(operand->symbol, operand->value, is_string) & mask;
+        for (int index; (index = tables->label_slots[slot]) >= 0; slot = (slot + 1) & mask) {
+            ObjectLabel* label = &tables->labels[index];
+            if (label->number == operand->value && label->is_string == is_string &&
+                strcmp(label->owner, operand->symbol) == 0) {
+                return label;
+            }
+        }
+    }
+    if (!create) return NULL;
+
+    int old_capacity = tables->label_capacity;
+    grow_slots(&tables->label_slots, &tables->label_capacity, tables->label_count + 1);
+    if (tables->label_capacity != old_capacity) {
+        tables->labels = realloc(tables->labels, sizeof(ObjectLabel) * tables->label_capacity);
+        for (int i = 0; i < tables->label_count; i++) insert_label_slot(tables, i);
+    }
+    ObjectLabel* label = &tables->labels[tables->label_count];
+    label->owner = operand->symbol;
+    label->number = operand->value;
+    label->is_string = is_string;
+    label->section = -1;
+    label->offset = 0;
+    insert_label_slot(tables, tables->label_count++);
+    return label;
+}
+
+static void insert_symbol_slot(ObjectTables* tables, int index) {
+    unsigned long long mask = tables->symbol_capacity - 1;
+    unsigned long long slot = hash_name(tables->symbols[index].name, 14695981039346656037ULL) & mask;
+    while (tables->symbol_slots[slot] >= 0) slot = (slot + 1) & mask;
+    tables->symbol_slots[slot] = index;
+}
+
+static ObjectSymbol* find_symbol(ObjectTables* tables, const char* name) {
+    if (tables->symbol_capacity > 0) {
+        unsigned long long mask = tables->symbol_capacity - 1;
+        unsigned long long slot = hash_name(name, 14695981039346656037ULL) & mask;
+        for (int index; (index = tables->symbol_slots[slot]) >= 0; slot = (slot + 1) & mask) {
+            if (strcmp(tables->symbols[index].name, name) == 0) return &tables->symbols[index];
+        }
+    }
+
+    int old_capacity = tables->symbol_capacity;
+    grow_slots(&tables->symbol_slots, &tables->symbol_capacity, tables->symbol_count + 1);
+    if (tables->symbol_capacity != old_capacity) {
+        tables->symbols = realloc(tables->symbols, sizeof(ObjectSymbol) * tables->symbol_capacity);
+        for (int i = 0; i < tables->symbol_count; i++) insert_symbol_slot(tables, i);
+    }
+    ObjectSymbol* symbol = &tables->symbols[tables->symbol_count];
+    memset(symbol, 0, sizeof(ObjectSymbol));
+    symbol->name = name;
+    symbol->section = -1;
+    insert_symbol_slot(tables, tables->symbol_count++);
+    return symbol;
+}
+
+static void free_tables(ObjectTables* tables) {
+    free(tables->symbols);
+    free(tables->symbol_slots);
+    free(tables->labels);
+    free(tables->label_slots);
+}
+
+// Layout: item offsets within their sections. Jumps start short and are
+// widened until every displacement fits.
+typedef struct {
+    long long* offsets;
+    int* sizes;
+    bool* long_jumps;
+    long long section_sizes[SECTION_COUNT];
+} Layout;
+
+static bool is_jump(const AsmItem* item) {
+    return item->kind == ITEM_INSTRUCTION && minst_is_jump(&item->inst);
+}
+
+static int jump_size(const AsmItem* item, bool long_jump) {
+    if (!long_jump) return 2;
+    return item->inst.opcode == X86_JMP ? 5 : 6;
+}
+
+static long long padding(long long offset, long long alignment) {
+    return alignment > 1 ? (alignment - offset % alignment) % alignment : 0;
+}
+
+static bool compute_layout(const AsmList* list, ObjectTables* tables, Layout* layout) {
+    // Sizes of everything but jumps are fixed
+    for (int i = 0; i < list->count; i++) {
+        const AsmItem* item = &list->items[i];
+        if (item->kind == ITEM_INSTRUCTION && !is_jump(item)) {
+            Encoding encoding;
+            if (!x86_encode(&item->inst, false, &encoding)) return false;
+            layout->sizes[i] = encoding.length;
+        }
+    }
+
+    for (;;) {
+        int section = SECTION_TEXT;
+        memset(layout->section_sizes, 0, sizeof(layout->section_sizes));
+        for (int i = 0; i < list->count; i++) {
+            const AsmItem* item = &list->items[i];
+            long long* offset = &layout->section_sizes[section];
+            layout->offsets[i] = *offset;
+            switch (item->kind) {
+                case ITEM_INSTRUCTION:
+                    if (is_jump(item)) layout->sizes[i] = jump_size(item, layout->long_jumps[i]);
+                    *offset += layout->sizes[i];
+                    break;
+                case ITEM_LABEL: {
+                    ObjectLabel* label = find_label(tables, &item->operand, true);
+                    label->section = section;
+                    label->offset = *offset;
+                    break;
+                }
+                case ITEM_SYMBOL: {
+                    ObjectSymbol* symbol = find_symbol(tables, item->name);
+                    symbol->section = section;
+                    symbol->value = *offset;
+                    break;
+                }
+                case ITEM_SECTION:
+                    section = (int)item->value;
+                    break;
+                case ITEM_SIZE: {
+                    ObjectSymbol* symbol = find_symbol(tables, item->name);
+                    symbol->size = item->value >= 0 ? item->value : *offset - symbol->value;
+                    break;
+                }
+                case ITEM_ALIGN:
+                    *offset += padding(*offset, item->value);
+                    break;
+                case ITEM_ZERO:
+                    *offset += item->value;
+                    break;
+                case ITEM_DATA:
+                    *offset += item->size;
+                    break;
+                case ITEM_STRING:
+                    *offset += strlen(item->name) + 1;
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        bool changed = false;
+        for (int i = 0; i < list->count; i++) {
+            const AsmItem* item = &list->items[i];
+            if (!is_jump(item) || layout->long_jumps[i]) continue;
+            ObjectLabel* label = find_label(tables, &item->inst.dst, false);
+            if (label == NULL) return false;
+            long long displacement = label->offset - (layout->offsets[i] + layout->sizes[i]);
+            if (displacement < -128 || displacement > 127) {
+                layout->long_jumps[i] = true;
+                changed = true;
+            }
+        }
+        if (!changed) return true;
+    }
+}
+
+// Section contents and relocations
+typedef struct {
+    Emitter bytes[SECTION_COUNT];
+    Emitter relocations[SECTION_COUNT];   // Elf64_Rela records
+} Sections;
+
+static void add_relocation(Sections* sections, int section, long long offset, int symbol,
+                           int type, long long addend) {
+    Elf64_Rela rela;
+    rela.r_offset = offset;
+    rela.r_info = ELF64_R_INFO(symbol, type);
+    rela.r_addend = addend;
+    emitter_write(&sections->relocations[section], (const char*)&rela, sizeof(rela));
+}
+
+static void put_bytes(Emitter* out, long long value, int size) {
+    for (int i = 0; i < size; i++) {
+        emitter_char(out, (char)(((unsigned long long)value >> (8 * i)) & 0xff));
+    }
+}
+
+// Multi-byte NOPs used to pad code
+static void put_nops(Emitter* out, long long count) {
+    static const char* nops[] = {
+        "",
+        "\x90",
+        "\x66\x90",
+        "\x0f\x1f\x00",
+        "\x0f\x1f\x40\x00",
+        "\x0f\x1f\x44\x00\x00",
+        "\x66\x0f\x1f\x44\x00\x00",
+        "\x0f\x1f\x80\x00\x00\x00\x00",
+        "\x0f\x1f\x84\x00\x00\x00\x00\x00",
+        "\x66\x0f\x1f\x84\x00\x00\x00\x00\x00"
+    };
+    while (count > 0) {
+        int length = count > 9 ? 9 : (int)count;
+        emitter_write(out, nops[length], length);
+        count -= length;
+    }
+}
+
+static bool emit_instruction_bytes(const AsmItem* item, int index, const Layout* layout,
+                                   ObjectTables* tables, Sections* sections, int section) {
+    Encoding encoding;
+    if (!x86_encode(&item->inst, is_jump(item) && !layout->long_jumps[index], &encoding)) return false;
+
+    long long offset = layout->offsets[index];
+    if (encoding.fixup_offset >= 0) {
+        const Operand* target = encoding.fixup;
+        long long field = offset + encoding.fixup_offset;
+        long long to_end = encoding.length - encoding.fixup_offset;
+        long long value = 0;
+
+        if (target->kind == OPERAND_LABEL) {
+            ObjectLabel* label = find_label(tables, target, false);
+            if (label == NULL || label->section != section) return false;
+            value = label->offset - (offset + encoding.length);
+        } else if (target->kind == OPERAND_STRING) {
+            ObjectLabel* label = find_label(tables, target, false);
+            if (label == NULL) return false;
+            add_relocation(sections, section, field, SECTION_SYMBOL(label->section),
+                           R_X86_64_PC32, label->offset - to_end);
+        } else {
+            ObjectSymbol* symbol = find_symbol(tables, target->symbol);
+            bool is_call = item->inst.opcode == X86_CALL || minst_is_tail_call(&item->inst);
+            int type = is_call ? R_X86_64_PLT32 : R_X86_64_PC32;
+            add_relocation(sections, section, field, symbol->index, type, -to_end);
+        }
+        for (int i = 0; i < encoding.fixup_size; i++) {
+            encoding.bytes[encoding.fixup_offset + i] = (unsigned char)(((unsigned long long)value >> (8 * i)) & 0xff);
+        }
+    }
+
+    emitter_write(&sections->bytes[section], (const char*)encoding.bytes, encoding.length);
+    return true;
+}
+
+static bool emit_sections(const AsmList* list, const Layout* layout, ObjectTables* tables,
+                          Sections* sections) {
+    int section = SECTION_TEXT;
+    for (int i = 0; i < list->count; i++) {
+        const AsmItem* item = &list->items[i];
+        Emitter* out = &sections->bytes[section];
+        switch (item->kind) {
+            case ITEM_INSTRUCTION:
+                if (!emit_instruction_bytes(item, i, layout, tables, sections, section)) return false;
+                break;
+            case ITEM_SECTION:
+                section = (int)item->value;
+                break;
+            case ITEM_ALIGN: {
+                long long count = padding(out->length, item->value);
+                if (section == SECTION_TEXT) {
+                    put_nops(out, count);
+                } else if (section != SECTION_BSS) {
+                    put_bytes(out, 0, (int)count);
+                }
+                break;
+            }
+            case ITEM_ZERO:
+                if (section != SECTION_BSS) {
+                    for (long long n = 0; n < item->value; n++) emitter_char(out, 0);
+                }
+                break;
+            case ITEM_DATA:
+                if (item->operand.kind == OPERAND_STRING) {
+                    ObjectLabel* label = find_label(tables, &item->operand, false);
+                    if (label == NULL) return false;
+                    add_relocation(sections, section, out->length, SECTION_SYMBOL(label->section),
+                                   R_X86_64_64, label->offset);
+                    put_bytes(out, 0, item->size);
+                } else {
+                    put_bytes(out, item->value, item->size);
+                }
+                break;
+            case ITEM_STRING:
+                emitter_write(out, item->name, strlen(item->name) + 1);
+                break;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+// Symbol table: the null symbol, section symbols, locals, then globals
+static int assign_symbol_indices(const AsmList* list, ObjectTables* tables) {
+    for (int i = 0; i < list->count; i++) {
+        const AsmItem* item = &list->items[i];
+        if (item->kind == ITEM_GLOBAL) {
+            find_symbol(tables, item->name)->global = true;
+        } else if (item->kind == ITEM_TYPE) {
+            ObjectSymbol* symbol = find_symbol(tables, item->name);
+            symbol->typed = true;
+            symbol->function = item->value != 0;
+        } else if (item->kind == ITEM_INSTRUCTION) {
+            if (item->inst.src.kind == OPERAND_SYMBOL) find_symbol(tables, item->inst.src.symbol);
+            if (item->inst.dst.kind == OPERAND_SYMBOL) find_symbol(tables, item->inst.dst.symbol);
+        }
+    }
+
+    int index = 1 + SECTION_SYMBOL_COUNT;
+    for (int i = 0; i < tables->symbol_count; i++) {
+        ObjectSymbol* symbol = &tables->symbols[i];
+        if (symbol->section < 0) symbol->global = true;
+        if (!symbol->global) symbol->index = index++;
+    }
+    int first_global = index;
+    for (int i = 0; i < tables->symbol_count; i++) {
+        if (tables->symbols[i].global) tables->symbols[i].index = index++;
+    }
+    return first_global;
+}
+
+static void write_symbol_table(ObjectTables* tables, Emitter* symtab, Emitter* strtab) {
+    Elf64_Sym symbol;
+    memset(&symbol, 0, sizeof(symbol));
+    emitter_write(symtab, (const char*)&symbol, sizeof(symbol));
+    emitter_char(strtab, '\0');
+
+    for (int section = 0; section < SECTION_SYMBOL_COUNT; section++) {
+        symbol.st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+        symbol.st_shndx = section + 1;
+        emitter_write(symtab, (const char*)&symbol, sizeof(symbol));
+    }
+
+    // Entries in index order: locals first
+    ObjectSymbol** ordered = malloc(sizeof(ObjectSymbol*) * (tables->symbol_count + 1));
+    for (int i = 0; i < tables->symbol_count; i++) {
+        ObjectSymbol* entry = &tables->symbols[i];
+        ordered[entry->index - 1 - SECTION_SYMBOL_COUNT] = entry;
+    }
+    for (int i = 0; i < tables->symbol_count; i++) {
+        ObjectSymbol* entry = ordered[i];
+        memset(&symbol, 0, sizeof(symbol));
+        symbol.st_name = strtab->length;
+        emitter_write(strtab, entry->name, strlen(entry->name) + 1);
+        int type = !entry->typed ? STT_NOTYPE : entry->function ? STT_FUNC : STT_OBJECT;
+        symbol.st_info = ELF64_ST_INFO(entry->global ? STB_GLOBAL : STB_LOCAL, type);
+        symbol.st_shndx = entry->section < 0 ? SHN_UNDEF : entry->section + 1;
+        symbol.st_value = entry->section < 0 ? 0 : entry->value;
+        symbol.st_size = entry->size;
+        emitter_write(symtab, (const char*)&symbol, sizeof(symbol));
+    }
+    free(ordered);
+}
+
+static void align_output(Emitter* out, size_t alignment) {
+    while (out->length % alignment != 0) emitter_char(out, 0);
+}
+
+static int section_name(Emitter* shstrtab, const char* name) {
+    int offset = shstrtab->length;
+    emitter_write(shstrtab, name, strlen(name) + 1);
+    return offset;
+}
+
+char* object_write(const AsmList* list, size_t* length) {
+    ObjectTables tables;
+    memset(&tables, 0, sizeof(tables));
+    Layout layout;
+    layout.offsets = calloc(list->count + 1, sizeof(long long));
+    layout.sizes = calloc(list->count + 1, sizeof(int));
+    layout.long_jumps = calloc(list->count + 1, sizeof(bool));
+    Sections sections;
+    memset(&sections, 0, sizeof(sections));
+    Emitter out = {NULL, 0, 0, false};
+    char* image = NULL;
+
+    if (!compute_layout(list, &tables, &layout)) goto cleanup;
+    int first_global = assign_symbol_indices(list, &tables);
+    if (!emit_sections(list, &layout, &tables, &sections)) goto cleanup;
+    for (int section = 0; section < SECTION_COUNT; section++) {
+        if (section != SECTION_TEXT && section != SECTION_DATA && sections.relocations[section].length > 0) {
+            goto cleanup;
+        }
+    }
+
+    Emitter symtab = {NULL, 0, 0, false};
+    Emitter strtab = {NULL, 0, 0, false};
+    Emitter shstrtab = {NULL, 0, 0, false};
+    write_symbol_table(&tables, &symtab, &strtab);
+    emitter_char(&shstrtab, '\0');
+
+    Elf64_Shdr headers[SHNDX_COUNT];
+    memset(headers, 0, sizeof(headers));
+    static const char* names[SECTION_COUNT] = {".text", ".data", ".bss", ".rodata", ".note.GNU-stack"};
+    static const int flags[SECTION_COUNT] = {
+        SHF_ALLOC | SHF_EXECINSTR, SHF_ALLOC | SHF_WRITE, SHF_ALLOC | SHF_WRITE, SHF_ALLOC, 0
+    };
+
+    // Contents follow the ELF header
+    emitter_write(&out, (const char*)&(Elf64_Ehdr){0}, sizeof(Elf64_Ehdr));
+    for (int section = 0; section < SECTION_COUNT; section++) {
+        Elf64_Shdr* header = &headers[section + 1];
+        header->sh_name = section_name(&shstrtab, names[section]);
+        header->sh_type = section == SECTION_BSS ? SHT_NOBITS : SHT_PROGBITS;
+        header->sh_flags = flags[section];
+        header->sh_addralign = section == SECTION_NOTE_GNU_STACK ? 1 : 16;
+        align_output(&out, header->sh_addralign);
+        header->sh_offset = out.length;
+        if (section == SECTION_BSS) {
+            header->sh_size = layout.section_sizes[SECTION_BSS];
+        } else {
+            header->sh_size = sections.bytes[section].length;
+            emitter_write(&out, sections.bytes[section].data, sections.bytes[section].length);
+        }
+    }
+
+    int relocated[2] = {SECTION_TEXT, SECTION_DATA};
+    for (int i = 0; i < 2; i++) {
+        Elf64_Shdr* header = &headers[SHNDX_RELA_TEXT + i];
+        Emitter* records = &sections.relocations[relocated[i]];
+        header->sh_name = section_name(&shstrtab, i == 0 ? ".rela.text" : ".rela.data");
+        header->sh_type = SHT_RELA;
+        header->sh_flags = SHF_INFO_LINK;
+        header->sh_link = SHNDX_SYMTAB;
+        header->sh_info = relocated[i] + 1;
+        header->sh_addralign = 8;
+        header->sh_entsize = sizeof(Elf64_Rela);
+        align_output(&out, 8);
+        header->sh_offset = out.length;
+        header->sh_size = records->length;
+        emitter_write(&out, records->data, records->length);
+    }
+
+    Elf64_Shdr* header = &headers[SHNDX_SYMTAB];
+    header->sh_name = section_name(&shstrtab, ".symtab");
+    header->sh_type = SHT_SYMTAB;
+    header->sh_link = SHNDX_STRTAB;
+    header->sh_info = first_global;
+    header->sh_addralign = 8;
+    header->sh_entsize = sizeof(Elf64_Sym);
+    align_output(&out, 8);
+    header->sh_offset = out.length;
+    header->sh_size = symtab.length;
+    emitter_write(&out, symtab.data, symtab.length);
+
+    header = &headers[SHNDX_STRTAB];
+    header->sh_name = section_name(&shstrtab, ".strtab");
+    header->sh_type = SHT_STRTAB;
+    header->sh_addralign = 1;
+    header->sh_offset = out.length;
+    header->sh_size = strtab.length;
+    emitter_write(&out, strtab.data, strtab.length);
+
+    header = &headers[SHNDX_SHSTRTAB];
+    header->sh_name = section_name(&shstrtab, ".shstrtab");
+    header->sh_type = SHT_STRTAB;
+    header->sh_addralign = 1;
+    header->sh_offset = out.length;
+    header->sh_size = shstrtab.length;
+    emitter_write(&out, shstrtab.data, shstrtab.length);
+
+    align_output(&out, 8);
+    size_t header_offset = out.length;
+    emitter_write(&out, (const char*)headers, sizeof(headers));
+
+    Elf64_Ehdr* elf = (Elf64_Ehdr*)out.data;
+    memcpy(elf->e_ident, ELFMAG, SELFMAG);
+    elf->e_ident[EI_CLASS] = ELFCLASS64;
+    elf->e_ident[EI_DATA] = ELFDATA2LSB;
+    elf->e_ident[EI_VERSION] = EV_CURRENT;
+    elf->e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    elf->e_type = ET_REL;
+    elf->e_machine = EM_X86_64;
+    elf->e_version = EV_CURRENT;
+    elf->e_shoff = header_offset;
+    elf->e_ehsize = sizeof(Elf64_Ehdr);
+    elf->e_shentsize = sizeof(Elf64_Shdr);
+    elf->e_shnum = SHNDX_COUNT;
+    elf->e_shstrndx = SHNDX_SHSTRTAB;
+
+    free(symtab.data);
+    free(strtab.data);
+    free(shstrtab.data);
+    image = out.data;
+    *length = out.length;
+    out.data = NULL;
+
+cleanup:
+    free(out.data);
+    for (int section = 0; section < SECTION_COUNT; section++) {
+        free(sections.bytes[section].data);
+        free(sections.relocations[section].data);
+    }
+    free(layout.offsets);
+    free(layout.sizes);
+    free(layout.long_jumps);
+    free_tables(&tables);
+    return image;
+}
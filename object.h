@@ -0,0 +1,12 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include "x86.h"
+
+// Assemble a listing into an ELF64 relocatable object for x86-64. Local
+// labels are resolved here; strings and symbols become R_X86_64_PC32,
+// R_X86_64_PLT32 and R_X86_64_64 relocations. Returns a malloc'd image,
+// or NULL when an instruction cannot be encoded.
+char* object_write(const AsmList* list, size_t* length);
+
+#endif // OBJECT_H
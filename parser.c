@@ -10,21 +10,58 @@ typedef struct {
     Precedence precedence;
 } ParseRule;
 
+// Declaration specifiers collected before the declarators
+typedef struct {
+    Type* base;
+    bool is_static;
+    bool is_extern;
+    bool is_inline;
+} DeclSpecifiers;
+
 // Parser implementation
-Parser* parser_init(Lexer* lexer) {
+static Parser* parser_create(Lexer* lexer, char* filename) {
     Parser* parser = malloc(sizeof(Parser));
     parser->lexer = lexer;
+    parser->tokens = NULL;
+    parser->token_count = 0;
+    parser->token_index = 0;
+    parser->filename = filename;
     parser->current = NULL;
     parser->previous = NULL;
     parser->error = NULL;
     parser->panic_mode = false;
     parser->had_error = false;
-    
+    return parser;
+}
+
+Parser* parser_init(Lexer* lexer) {
+    Parser* parser = parser_create(lexer, lexer->filename);
+
     // Prime the parser with the first token
     advance(parser);
     return parser;
 }
 
+Parser* parser_init_tokens(Token** tokens, int token_count, char* filename) {
+    Parser* parser = parser_create(NULL, filename);
+    parser->tokens = tokens;
+    parser->token_count = token_count;
+
+    // End-of-input token positioned after the last real token
+    memset(&parser->eof, 0, sizeof(Token));
+    parser->eof.type = TOKEN_EOF;
+    parser->eof.lexeme = "";
+    if (token_count > 0) {
+        Token* last = tokens[token_count - 1];
+        parser->eof.line = last->line;
+        parser->eof.column = last->column + (int)strlen(last->lexeme);
+        parser->eof.offset = last->offset + strlen(last->lexeme);
+    }
+
+    advance(parser);
+    return parser;
+}
+
 void parser_free(Parser* parser) {
     if (parser->error) {
         free(parser->error->message);
@@ -35,44 +72,40 @@ void parser_free(Parser* parser) {
 
 // Error handling
 void parser_error_at_current(Parser* parser, const char* message) {
-    if (parser->panic_mode) return;
-    parser->panic_mode = true;
-    parser->had_error = true;
-    
-    ParseError* error = malloc(sizeof(ParseError));
-    error->message = strdup(message);
-    error->token = parser->current;
-    error->line = parser->current->line;
-    error->column = parser->current->column;
-    error->filename = parser->lexer->filename;
-    
-    parser->error = error;
+    parser_error_at(parser, parser->current, message);
 }
 
 void parser_error_at(Parser* parser, Token* token, const char* message) {
     if (parser->panic_mode) return;
     parser->panic_mode = true;
+    if (parser->had_error) return;   // Only the first error is reported
     parser->had_error = true;
-    
+
     ParseError* error = malloc(sizeof(ParseError));
     error->message = strdup(message);
     error->token = token;
     error->line = token->line;
     error->column = token->column;
-    error->filename = parser->lexer->filename;
-    
+    error->filename = parser->filename;
+
     parser->error = error;
 }
 
 // Token handling
 Token* advance(Parser* parser) {
     parser->previous = parser->current;
-    parser->current = lexer_next_token(parser->lexer);
-    
+    if (parser->lexer != NULL) {
+        parser->current = lexer_next_token(parser->lexer);
+    } else if (parser->token_index < parser->token_count) {
+        parser->current = parser->tokens[parser->token_index++];
+    } else {
+        parser->current = &parser->eof;
+    }
+
     if (parser->current->type == TOKEN_ERROR) {
         parser_error_at_current(parser, "Invalid token");
     }
-    
+
     return parser->current;
 }
 
@@ -82,7 +115,7 @@ Token* consume(Parser* parser, TokenType type, const char* message) {
         advance(parser);
         return token;
     }
-    
+
     parser_error_at_current(parser, message);
     return NULL;
 }
@@ -97,57 +130,316 @@ bool match(Parser* parser, TokenType type) {
     return true;
 }
 
+// Growable array of statements
+static void append_statement(Statement*** statements, int* count, int* capacity, Statement* stmt) {
+    if (*count >= *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 8;
+        *statements = realloc(*statements, sizeof(Statement*) * *capacity);
+    }
+    (*statements)[(*count)++] = stmt;
+}
+
 // Forward declarations for recursive descent
 static Expression* expression(Parser* parser) {
     return parse_precedence(parser, PREC_ASSIGNMENT);
 }
 
 static Statement* statement(Parser* parser) {
+    Token* keyword = parser->current;
     if (match(parser, TOKEN_IF)) return if_statement(parser);
     if (match(parser, TOKEN_WHILE)) return while_statement(parser);
+    if (match(parser, TOKEN_DO)) return do_while_statement(parser);
     if (match(parser, TOKEN_FOR)) return for_statement(parser);
     if (match(parser, TOKEN_RETURN)) return return_statement(parser);
     if (match(parser, TOKEN_LBRACE)) return block_statement(parser);
-    
+    if (match(parser, TOKEN_BREAK)) {
+        consume(parser, TOKEN_SEMICOLON, "Expect ';' after 'break'");
+        return create_jump_stmt(NODE_BREAK, keyword);
+    }
+    if (match(parser, TOKEN_CONTINUE)) {
+        consume(parser, TOKEN_SEMICOLON, "Expect ';' after 'continue'");
+        return create_jump_stmt(NODE_CONTINUE, keyword);
+    }
+    if (match(parser, TOKEN_SEMICOLON)) {
+        Statement* empty = create_compound_stmt(NULL, 0, keyword);
+        empty->as.compound.scoped = false;
+        return empty;
+    }
+
     return expression_statement(parser);
 }
 
 static Statement* declaration(Parser* parser) {
     Statement* stmt;
-    
+
     if (match(parser, TOKEN_VAR)) {
         stmt = var_declaration(parser);
+    } else if (is_type_start(parser)) {
+        stmt = typed_declaration(parser);
     } else {
         stmt = statement(parser);
     }
-    
+
     if (parser->panic_mode) parser_synchronize(parser);
     return stmt;
 }
 
-static ParseRule* get_rule(TokenType type);
+// Type parsing
+bool is_type_start(Parser* parser) {
+    switch (parser->current->type) {
+        case TOKEN_VOID:
+        case TOKEN_CHAR:
+        case TOKEN_SHORT:
+        case TOKEN_INT:
+        case TOKEN_LONG:
+        case TOKEN_SIGNED:
+        case TOKEN_UNSIGNED:
+        case TOKEN_FLOAT:
+        case TOKEN_DOUBLE:
+        case TOKEN_CONST:
+        case TOKEN_VOLATILE:
+        case TOKEN_STATIC:
+        case TOKEN_EXTERN:
+        case TOKEN_INLINE:
+        case TOKEN_REGISTER:
+        case TOKEN_AUTO:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static DeclSpecifiers parse_specifiers(Parser* parser) {
+    DeclSpecifiers specs = {NULL, false, false, false};
+    Token* start = parser->current;
+    bool is_const = false, is_volatile = false, is_unsigned = false, is_signed = false;
+    int shorts = 0, longs = 0;
+    TypeKind kind = TYPE_INT;
+    bool have_kind = false;
+
+    while (is_type_start(parser)) {
+        advance(parser);
+        Token* token = parser->previous;
+        switch (token->type) {
+            case TOKEN_CONST: is_const = true; break;
+            case TOKEN_VOLATILE: is_volatile = true; break;
+            case TOKEN_STATIC: specs.is_static = true; break;
+            case TOKEN_EXTERN: specs.is_extern = true; break;
+            case TOKEN_INLINE: specs.is_inline = true; break;
+            case TOKEN_REGISTER:
+            case TOKEN_AUTO: break;
+            case TOKEN_UNSIGNED: is_unsigned = true; break;
+            case TOKEN_SIGNED: is_signed = true; break;
+            case TOKEN_SHORT: shorts++; break;
+            case TOKEN_LONG: longs++; break;
+            default:
+                if (have_kind) {
+                    parser_error_at(parser, token, "Multiple types in declaration");
+                }
+                have_kind = true;
+                kind = token->type == TOKEN_VOID ? TYPE_VOID :
+                       token->type == TOKEN_CHAR ? TYPE_CHAR :
+                       token->type == TOKEN_FLOAT ? TYPE_FLOAT :
+                       token->type == TOKEN_DOUBLE ? TYPE_DOUBLE : TYPE_INT;
+                break;
+        }
+    }
+
+    if (shorts > 0 || longs > 0) {
+        if ((have_kind && kind != TYPE_INT) || (shorts > 0 && longs > 0) || shorts > 1 || longs > 2) {
+            parser_error_at(parser, start, "Invalid type specifier combination");
+        }
+        kind = shorts > 0 ? TYPE_SHORT : TYPE_LONG;
+    }
+    if ((is_unsigned || is_signed) && !(kind == TYPE_CHAR || kind == TYPE_SHORT ||
+                                         kind == TYPE_INT || kind == TYPE_LONG)) {
+        parser_error_at(parser, start, "Invalid use of 'signed' or 'unsigned'");
+    }
+
+    specs.base = create_basic_type(kind, is_const, is_volatile);
+    specs.base->is_unsigned = is_unsigned;
+    return specs;
+}
+
+static Type* parse_pointers(Parser* parser, Type* type) {
+    while (match(parser, TOKEN_STAR)) {
+        bool is_const = false, is_volatile = false;
+        for (;;) {
+            if (match(parser, TOKEN_CONST)) is_const = true;
+            else if (match(parser, TOKEN_VOLATILE)) is_volatile = true;
+            else if (!match(parser, TOKEN_RESTRICT)) break;
+        }
+        type = create_pointer_type(type, is_const, is_volatile);
+    }
+    return type;
+}
+
+// Array suffixes apply innermost-last: int a[2][3] is an array of 2 arrays of 3
+static Type* parse_array_suffixes(Parser* parser, Type* type) {
+    if (!check(parser, TOKEN_LBRACKET)) return type;
+
+    int sizes[16];
+    int count = 0;
+    while (match(parser, TOKEN_LBRACKET)) {
+        Token* size = consume(parser, TOKEN_INTEGER_LITERAL, "Expect array size");
+        consume(parser, TOKEN_RBRACKET, "Expect ']' after array size");
+        if (size == NULL) break;
+        if (count == 16) {
+            parser_error_at(parser, size, "Too many array dimensions");
+            break;
+        }
+        if (size->value.int_value <= 0) {
+            parser_error_at(parser, size, "Array size must be positive");
+        }
+        sizes[count++] = (int)size->value.int_value;
+    }
+    for (int i = count - 1; i >= 0; i--) {
+        type = create_array_type(type, sizes[i], false, false);
+    }
+    return type;
+}
+
+// Parameter list after the '(' of a function declarator
+static Type* parse_parameters(Parser* parser, Type* return_type, Token*** names, int* count) {
+    Type** types = malloc(sizeof(Type*) * 8);
+    Token** params = malloc(sizeof(Token*) * 8);
+    int capacity = 8;
+    int param_count = 0;
+    bool is_variadic = false;
+
+    while (!check(parser, TOKEN_RPAREN) && !check(parser, TOKEN_EOF) && !parser->panic_mode) {
+        if (match(parser, TOKEN_ELLIPSIS)) {
+            is_variadic = true;
+            break;
+        }
+        if (!is_type_start(parser)) {
+            parser_error_at_current(parser, "Expect parameter type");
+            break;
+        }
+        DeclSpecifiers specs = parse_specifiers(parser);
+        Type* type = parse_pointers(parser, specs.base);
+        Token* name = NULL;
+        if (match(parser, TOKEN_IDENTIFIER)) name = parser->previous;
+        type = parse_array_suffixes(parser, type);
+
+        // f(void) takes no parameters
+        if (param_count == 0 && name == NULL && type->kind == TYPE_VOID && check(parser, TOKEN_RPAREN)) {
+            free_type(type);
+            break;
+        }
+
+        // Array parameters are pointers
+        if (type->kind == TYPE_ARRAY) {
+            Type* elem = type->info.array.elem_type;
+            type->info.array.elem_type = NULL;
+            free_type(type);
+            type = create_pointer_type(elem, false, false);
+        }
+
+        if (param_count >= capacity) {
+            capacity *= 2;
+            types = realloc(types, sizeof(Type*) * capacity);
+            params = realloc(params, sizeof(Token*) * capacity);
+        }
+        types[param_count] = type;
+        params[param_count] = name;
+        param_count++;
+
+        if (!match(parser, TOKEN_COMMA)) break;
+    }
+    consume(parser, TOKEN_RPAREN, "Expect ')' after parameters");
+
+    Type* func = create_function_type(return_type, types, param_count);
+    func->info.func.is_variadic = is_variadic;
+    *names = params;
+    *count = param_count;
+    return func;
+}
+
+Type* parse_type_name(Parser* parser) {
+    DeclSpecifiers specs = parse_specifiers(parser);
+    if (specs.is_static || specs.is_extern || specs.is_inline) {
+        parser_error_at(parser, parser->previous, "Storage class in type name");
+    }
+    return parse_pointers(parser, specs.base);
+}
+
+static const ParseRule* get_rule(TokenType type);
 
 // Expression parsing with precedence climbing
 static Expression* binary(Parser* parser, Expression* left, bool can_assign) {
-    TokenType operator_type = parser->previous->type;
-    
+    Token* operator = parser->previous;
+
     // Get the rule for the operator
-    ParseRule* rule = get_rule(operator_type);
+    const ParseRule* rule = get_rule(operator->type);
     Expression* right = parse_precedence(parser, (Precedence)(rule->precedence + 1));
-    
-    return create_binary_expr(left, right, operator_type, parser->previous);
+
+    return create_binary_expr(left, right, operator->type, operator);
+}
+
+static Expression* assignment(Parser* parser, Expression* left, bool can_assign) {
+    Token* operator = parser->previous;
+
+    // Assignment is right-associative
+    Expression* value = parse_precedence(parser, PREC_ASSIGNMENT);
+    return create_assign_expr(left, value, operator->type, operator);
 }
 
 static Expression* unary(Parser* parser, bool can_assign) {
-    TokenType operator_type = parser->previous->type;
-    
+    Token* operator = parser->previous;
+
     // Parse the operand with unary precedence
     Expression* operand = parse_precedence(parser, PREC_UNARY);
-    
-    return create_unary_expr(operand, operator_type, true, parser->previous);
+
+    return create_unary_expr(operand, operator->type, true, operator);
+}
+
+static Expression* postfix(Parser* parser, Expression* left, bool can_assign) {
+    Token* operator = parser->previous;
+    return create_unary_expr(left, operator->type, false, operator);
+}
+
+static Expression* call(Parser* parser, Expression* callee, bool can_assign) {
+    Token* paren = parser->previous;
+    Expression** args = NULL;
+    int count = 0;
+    int capacity = 0;
+
+    if (!check(parser, TOKEN_RPAREN)) {
+        do {
+            if (count >= capacity) {
+                capacity = capacity ? capacity * 2 : 4;
+                args = realloc(args, sizeof(Expression*) * capacity);
+            }
+            args[count++] = parse_precedence(parser, PREC_ASSIGNMENT);
+        } while (match(parser, TOKEN_COMMA));
+    }
+    consume(parser, TOKEN_RPAREN, "Expect ')' after arguments");
+
+    return create_call_expr(callee, args, count, paren);
+}
+
+// a[i] is *(a + i)
+static Expression* subscript(Parser* parser, Expression* array, bool can_assign) {
+    Token* bracket = parser->previous;
+    Expression* index = expression(parser);
+    consume(parser, TOKEN_RBRACKET, "Expect ']' after index");
+
+    Expression* sum = create_binary_expr(array, index, TOKEN_PLUS, bracket);
+    return create_unary_expr(sum, TOKEN_STAR, true, bracket);
 }
 
 static Expression* grouping(Parser* parser, bool can_assign) {
+    Token* paren = parser->previous;
+
+    // (type) operand
+    if (is_type_start(parser)) {
+        Type* target = parse_type_name(parser);
+        consume(parser, TOKEN_RPAREN, "Expect ')' after type name");
+        Expression* operand = parse_precedence(parser, PREC_UNARY);
+        return create_cast_expr(operand, target, paren);
+    }
+
     Expression* expr = expression(parser);
     consume(parser, TOKEN_RPAREN, "Expect ')' after expression.");
     return expr;
@@ -165,41 +457,73 @@ static Expression* variable(Parser* parser, bool can_assign) {
     return create_identifier_expr(parser->previous);
 }
 
-// Get parsing rule for token type
-static ParseRule* get_rule(TokenType type) {
-    static ParseRule rules[] = {
-        [TOKEN_LPAREN]    = {grouping, NULL,   PREC_NONE},
+// Get parsing rule for token type. The table is read-only so parsers on
+// different threads can share it.
+static const ParseRule* get_rule(TokenType type) {
+    static const ParseRule rules[] = {
+        [TOKEN_LPAREN]    = {grouping, call,   PREC_CALL},
+        [TOKEN_LBRACKET]  = {NULL,     subscript, PREC_CALL},
+        [TOKEN_PLUSPLUS]  = {unary,    postfix, PREC_CALL},
+        [TOKEN_MINUSMINUS] = {unary,   postfix, PREC_CALL},
         [TOKEN_MINUS]     = {unary,    binary, PREC_TERM},
-        [TOKEN_PLUS]      = {NULL,     binary, PREC_TERM},
+        [TOKEN_PLUS]      = {unary,    binary, PREC_TERM},
         [TOKEN_SLASH]     = {NULL,     binary, PREC_FACTOR},
-        [TOKEN_STAR]      = {NULL,     binary, PREC_FACTOR},
+        [TOKEN_STAR]      = {unary,    binary, PREC_FACTOR},
+        [TOKEN_PERCENT]   = {NULL,     binary, PREC_FACTOR},
+        [TOKEN_LESSLESS]  = {NULL,     binary, PREC_SHIFT},
+        [TOKEN_GREATERGREATER] = {NULL, binary, PREC_SHIFT},
+        [TOKEN_LESS]      = {NULL,     binary, PREC_COMPARISON},
+        [TOKEN_LESSEQUAL] = {NULL,     binary, PREC_COMPARISON},
+        [TOKEN_GREATER]   = {NULL,     binary, PREC_COMPARISON},
+        [TOKEN_GREATEREQUAL] = {NULL,  binary, PREC_COMPARISON},
+        [TOKEN_EQUALEQUAL] = {NULL,    binary, PREC_EQUALITY},
+        [TOKEN_NOTEQUAL]  = {NULL,     binary, PREC_EQUALITY},
+        [TOKEN_AMPERSAND] = {unary,    binary, PREC_BIT_AND},
+        [TOKEN_CARET]     = {NULL,     binary, PREC_BIT_XOR},
+        [TOKEN_PIPE]      = {NULL,     binary, PREC_BIT_OR},
+        [TOKEN_ANDAND]    = {NULL,     binary, PREC_AND},
+        [TOKEN_OROR]      = {NULL,     binary, PREC_OR},
+        [TOKEN_BANG]      = {unary,    NULL,   PREC_NONE},
+        [TOKEN_TILDE]     = {unary,    NULL,   PREC_NONE},
+        [TOKEN_EQUALS]    = {NULL,     assignment, PREC_ASSIGNMENT},
+        [TOKEN_PLUSEQUAL] = {NULL,     assignment, PREC_ASSIGNMENT},
+        [TOKEN_MINUSEQUAL] = {NULL,    assignment, PREC_ASSIGNMENT},
+        [TOKEN_STAREQUAL] = {NULL,     assignment, PREC_ASSIGNMENT},
+        [TOKEN_SLASHEQUAL] = {NULL,    assignment, PREC_ASSIGNMENT},
+        [TOKEN_PERCENTEQUAL] = {NULL,  assignment, PREC_ASSIGNMENT},
+        [TOKEN_ANDEQUAL]  = {NULL,     assignment, PREC_ASSIGNMENT},
+        [TOKEN_OREQUAL]   = {NULL,     assignment, PREC_ASSIGNMENT},
+        [TOKEN_XOREQUAL]  = {NULL,     assignment, PREC_ASSIGNMENT},
+        [TOKEN_LESSLESSEQUAL] = {NULL, assignment, PREC_ASSIGNMENT},
+        [TOKEN_GREATERGREATEREQUAL] = {NULL, assignment, PREC_ASSIGNMENT},
         [TOKEN_INTEGER_LITERAL] = {number, NULL, PREC_NONE},
+        [TOKEN_FLOAT_LITERAL] = {number, NULL, PREC_NONE},
         [TOKEN_STRING_LITERAL] = {string, NULL, PREC_NONE},
         [TOKEN_IDENTIFIER] = {variable, NULL, PREC_NONE},
-        // Add more rules for other operators
+        [TOKEN_EOF]       = {NULL,     NULL,   PREC_NONE},
     };
-    
+
     return &rules[type];
 }
 
 // Parse with precedence climbing
 Expression* parse_precedence(Parser* parser, Precedence precedence) {
     advance(parser);
-    ParseRule* rule = get_rule(parser->previous->type);
+    const ParseRule* rule = get_rule(parser->previous->type);
     if (rule->prefix == NULL) {
-        parser_error_at_current(parser, "Expect expression.");
+        parser_error_at(parser, parser->previous, "Expect expression.");
         return NULL;
     }
-    
+
     bool can_assign = precedence <= PREC_ASSIGNMENT;
     Expression* expr = rule->prefix(parser, can_assign);
-    
-    while (precedence <= get_rule(parser->current->type)->precedence) {
+
+    while (!parser->panic_mode && precedence <= get_rule(parser->current->type)->precedence) {
         advance(parser);
         rule = get_rule(parser->previous->type);
         expr = rule->infix(parser, expr, can_assign);
     }
-    
+
     return expr;
 }
 
@@ -209,56 +533,34 @@ Expression* parse_expression(Parser* parser) {
 }
 
 Statement* parse_declaration(Parser* parser) {
-    Statement* stmt;
-    
-    if (match(parser, TOKEN_VAR)) {
-        stmt = var_declaration(parser);
-    } else {
-        stmt = statement(parser);
-    }
-    
-    if (parser->panic_mode) parser_synchronize(parser);
-    return stmt;
+    return declaration(parser);
 }
 
 Statement* parse_statement(Parser* parser) {
-    if (match(parser, TOKEN_IF)) return if_statement(parser);
-    if (match(parser, TOKEN_WHILE)) return while_statement(parser);
-    if (match(parser, TOKEN_FOR)) return for_statement(parser);
-    if (match(parser, TOKEN_RETURN)) return return_statement(parser);
-    if (match(parser, TOKEN_LBRACE)) return block_statement(parser);
-    
-    return expression_statement(parser);
+    return statement(parser);
 }
 
 Statement* parse_program(Parser* parser) {
     Statement** statements = NULL;
     int count = 0;
-    int capacity = 8;
-    
-    statements = malloc(sizeof(Statement*) * capacity);
-    
+    int capacity = 0;
+
     while (!match(parser, TOKEN_EOF)) {
-        if (count >= capacity) {
-            capacity *= 2;
-            statements = realloc(statements, sizeof(Statement*) * capacity);
-        }
-        
-        statements[count++] = declaration(parser);
-        
+        append_statement(&statements, &count, &capacity, declaration(parser));
+
         if (parser->had_error) break;
     }
-    
+
     return create_compound_stmt(statements, count, parser->previous);
 }
 
 // Error recovery
 void parser_synchronize(Parser* parser) {
     parser->panic_mode = false;
-    
+
     while (parser->current->type != TOKEN_EOF) {
-        if (parser->previous->type == TOKEN_SEMICOLON) return;
-        
+        if (parser->previous != NULL && parser->previous->type == TOKEN_SEMICOLON) return;
+
         switch (parser->current->type) {
             case TOKEN_CLASS:
             case TOKEN_FUN:
@@ -266,17 +568,19 @@ void parser_synchronize(Parser* parser) {
             case TOKEN_FOR:
             case TOKEN_IF:
             case TOKEN_WHILE:
+            case TOKEN_DO:
             case TOKEN_RETURN:
                 return;
             default:
-                ; // Do nothing
+                if (is_type_start(parser)) return;
         }
-        
+
         advance(parser);
     }
 }
 // Statement parsing functions
 Statement* if_statement(Parser* parser) {
+    Token* keyword = parser->previous;
     consume(parser, TOKEN_LPAREN, "Expect '(' after 'if'");
     Expression* condition = expression(parser);
     consume(parser, TOKEN_RPAREN, "Expect ')' after if condition");
@@ -287,19 +591,34 @@ Statement* if_statement(Parser* parser) {
         else_branch = statement(parser);
     }
 
-    return create_if_stmt(condition, then_branch, else_branch, parser->previous);
+    return create_if_stmt(condition, then_branch, else_branch, keyword);
 }
 
 Statement* while_statement(Parser* parser) {
+    Token* keyword = parser->previous;
     consume(parser, TOKEN_LPAREN, "Expect '(' after 'while'");
     Expression* condition = expression(parser);
     consume(parser, TOKEN_RPAREN, "Expect ')' after while condition");
 
     Statement* body = statement(parser);
-    return create_while_stmt(condition, body, parser->previous);
+    return create_while_stmt(condition, body, keyword);
+}
+
+Statement* do_while_statement(Parser* parser) {
+    Token* keyword = parser->previous;
+    Statement* body = statement(parser);
+
+    consume(parser, TOKEN_WHILE, "Expect 'while' after do body");
+    consume(parser, TOKEN_LPAREN, "Expect '(' after 'while'");
+    Expression* condition = expression(parser);
+    consume(parser, TOKEN_RPAREN, "Expect ')' after while condition");
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after do-while");
+
+    return create_do_while_stmt(body, condition, keyword);
 }
 
 Statement* for_statement(Parser* parser) {
+    Token* keyword = parser->previous;
     consume(parser, TOKEN_LPAREN, "Expect '(' after 'for'");
 
     Statement* initializer;
@@ -307,6 +626,8 @@ Statement* for_statement(Parser* parser) {
         initializer = NULL;
     } else if (match(parser, TOKEN_VAR)) {
         initializer = var_declaration(parser);
+    } else if (is_type_start(parser)) {
+        initializer = typed_declaration(parser);
     } else {
         initializer = expression_statement(parser);
     }
@@ -319,13 +640,14 @@ Statement* for_statement(Parser* parser) {
 
     Statement* increment = NULL;
     if (!check(parser, TOKEN_RPAREN)) {
+        Token* start = parser->current;
         Expression* increment_expr = expression(parser);
-        increment = create_expression_stmt(increment_expr, parser->previous);
+        increment = create_expression_stmt(increment_expr, start);
     }
     consume(parser, TOKEN_RPAREN, "Expect ')' after for clauses");
 
     Statement* body = statement(parser);
-    return create_for_stmt(initializer, condition, increment, body, parser->previous);
+    return create_for_stmt(initializer, condition, increment, body, keyword);
 }
 
 Statement* return_statement(Parser* parser) {
@@ -341,29 +663,24 @@ Statement* return_statement(Parser* parser) {
 }
 
 Statement* block_statement(Parser* parser) {
+    Token* brace = parser->previous;
     Statement** statements = NULL;
     int count = 0;
-    int capacity = 8;
-
-    statements = malloc(sizeof(Statement*) * capacity);
+    int capacity = 0;
 
     while (!check(parser, TOKEN_RBRACE) && !check(parser, TOKEN_EOF)) {
-        if (count >= capacity) {
-            capacity *= 2;
-            statements = realloc(statements, sizeof(Statement*) * capacity);
-        }
-
-        statements[count++] = declaration(parser);
+        append_statement(&statements, &count, &capacity, declaration(parser));
     }
 
     consume(parser, TOKEN_RBRACE, "Expect '}' after block");
-    return create_compound_stmt(statements, count, parser->previous);
+    return create_compound_stmt(statements, count, brace);
 }
 
 Statement* expression_statement(Parser* parser) {
+    Token* start = parser->current;
     Expression* expr = expression(parser);
     consume(parser, TOKEN_SEMICOLON, "Expect ';' after expression");
-    return create_expression_stmt(expr, parser->previous);
+    return create_expression_stmt(expr, start);
 }
 
 Statement* var_declaration(Parser* parser) {
@@ -375,5 +692,77 @@ Statement* var_declaration(Parser* parser) {
     }
 
     consume(parser, TOKEN_SEMICOLON, "Expect ';' after variable declaration");
-    return create_var_stmt(name, initializer, parser->previous);
-}
\ No newline at end of file
+    return create_var_stmt(name, initializer, name != NULL ? name : parser->previous);
+}
+
+// Declaration with type specifiers: variables, prototypes and function
+// definitions. Several declarators become an unscoped compound statement.
+Statement* typed_declaration(Parser* parser) {
+    DeclSpecifiers specs = parse_specifiers(parser);
+    Statement** decls = NULL;
+    int count = 0;
+    int capacity = 0;
+
+    do {
+        Type* type = parse_pointers(parser, copy_type(specs.base));
+        Token* name = consume(parser, TOKEN_IDENTIFIER, "Expect declarator name");
+        if (name == NULL) {
+            free_type(type);
+            break;
+        }
+
+        if (match(parser, TOKEN_LPAREN)) {
+            Token** params;
+            int param_count;
+            Type* func = parse_parameters(parser, type, &params, &param_count);
+            Statement* body = NULL;
+            bool definition = count == 0 && check(parser, TOKEN_LBRACE);
+            if (definition) {
+                advance(parser);
+                body = block_statement(parser);
+            }
+
+            Statement* stmt = create_function_stmt(name, func, params, param_count, body, name);
+            stmt->as.function.is_static = specs.is_static;
+            stmt->as.function.is_inline = specs.is_inline;
+            append_statement(&decls, &count, &capacity, stmt);
+            if (definition) {
+                free_type(specs.base);
+                free(decls);
+                return stmt;
+            }
+            continue;
+        }
+
+        type = parse_array_suffixes(parser, type);
+        Expression* initializer = NULL;
+        if (match(parser, TOKEN_EQUALS)) {
+            initializer = parse_precedence(parser, PREC_ASSIGNMENT);
+        }
+
+        Statement* stmt = create_var_stmt(name, initializer, name);
+        stmt->as.declaration.var_type = type;
+        stmt->as.declaration.is_static = specs.is_static;
+        stmt->as.declaration.is_extern = specs.is_extern;
+        append_statement(&decls, &count, &capacity, stmt);
+    } while (!parser->panic_mode && match(parser, TOKEN_COMMA));
+
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after declaration");
+    free_type(specs.base);
+
+    if (count == 0) {
+        free(decls);
+        Statement* empty = create_compound_stmt(NULL, 0, parser->previous);
+        empty->as.compound.scoped = false;
+        return empty;
+    }
+    if (count == 1) {
+        Statement* stmt = decls[0];
+        free(decls);
+        return stmt;
+    }
+
+    Statement* list = create_compound_stmt(decls, count, decls[0]->token);
+    list->as.compound.scoped = false;
+    return list;
+}
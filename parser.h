@@ -10,12 +10,16 @@ typedef enum {
     PREC_ASSIGNMENT,  // =
     PREC_OR,         // ||
     PREC_AND,        // &&
+    PREC_BIT_OR,     // |
+    PREC_BIT_XOR,    // ^
+    PREC_BIT_AND,    // &
     PREC_EQUALITY,   // == !=
     PREC_COMPARISON, // < > <= >=
+    PREC_SHIFT,      // << >>
     PREC_TERM,       // + -
-    PREC_FACTOR,     // * /
-    PREC_UNARY,      // ! -
-    PREC_CALL,       // . () []
+    PREC_FACTOR,     // * / %
+    PREC_UNARY,      // ! - ~ * & ++ -- casts
+    PREC_CALL,       // . () [] postfix ++ --
     PREC_PRIMARY
 } Precedence;
 
@@ -28,9 +32,15 @@ typedef struct {
     char* filename;
 } ParseError;
 
-// Parser state structure
+// Parser state structure. Tokens come either from a lexer or from an
+// already-lexed token array.
 typedef struct {
     Lexer* lexer;
+    Token** tokens;      // Used when lexer is NULL
+    int token_count;
+    int token_index;
+    Token eof;           // Returned once the token array is exhausted
+    char* filename;
     Token* current;
     Token* previous;
     ParseError* error;
@@ -40,6 +50,7 @@ typedef struct {
 
 // Parser interface functions
 Parser* parser_init(Lexer* lexer);
+Parser* parser_init_tokens(Token** tokens, int token_count, char* filename);
 void parser_free(Parser* parser);
 
 // Main parsing functions
@@ -56,11 +67,17 @@ Expression* parse_primary(Parser* parser);
 // Statement parsing functions
 Statement* if_statement(Parser* parser);
 Statement* while_statement(Parser* parser);
+Statement* do_while_statement(Parser* parser);
 Statement* for_statement(Parser* parser);
 Statement* return_statement(Parser* parser);
 Statement* block_statement(Parser* parser);
 Statement* expression_statement(Parser* parser);
 Statement* var_declaration(Parser* parser);
+Statement* typed_declaration(Parser* parser);
+
+// Type parsing
+bool is_type_start(Parser* parser);
+Type* parse_type_name(Parser* parser);
 
 // Error handling and recovery
 void parser_error_at_current(Parser* parser, const char* message);
@@ -0,0 +1,510 @@
+#include "codegen.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Peephole optimization of a function body after register allocation.
+// Each pattern of the table looks at a window of adjacent instructions,
+// filtered by opcode, and rewrites it in place when its conditions hold.
+// Passes over the body repeat until none applies, since one rewrite often
+// exposes another: forwarding a stored value turns a load into a move,
+// which a move chain then absorbs. Labels break windows, as control can
+// enter there from elsewhere.
+
+#define ANY_OPCODE (-1)
+#define FLAGS (-1)                   // Stands for the flags in liveness queries
+#define DEAD_SEARCH_LIMIT 256        // Instructions a liveness query looks at
+#define PEEPHOLE_PATTERN_COUNT 14
+
+typedef struct {
+    AsmList* body;
+    bool* removed;
+    int* label_at;           // Index of each label's definition in the body, or -1
+    int label_count;
+    int* visited;            // Stamp of the last liveness query to reach each item
+    int stamp;
+    int* stack;              // Labels a liveness query still has to scan from
+} Peephole;
+
+typedef struct {
+    const char* name;
+    int length;              // Instructions in the window
+    int opcodes[3];          // Per instruction, or ANY_OPCODE
+    bool (*apply)(Peephole* p, const int* at);
+} PeepholePattern;
+
+static MInst* inst_at(Peephole* p, int index) {
+    return &p->body->items[index].inst;
+}
+
+static void remove_at(Peephole* p, int index) {
+    p->removed[index] = true;
+}
+
+// Index of the instruction following `index` when nothing but removed
+// items separates them, or -1
+static int next_instruction(Peephole* p, int index) {
+    for (int i = index + 1; i < p->body->count; i++) {
+        if (p->removed[i]) continue;
+        return p->body->items[i].kind == ITEM_INSTRUCTION ? i : -1;
+    }
+    return -1;
+}
+
+static bool same_operand(const Operand* a, const Operand* b) {
+    return a->kind == b->kind && a->size == b->size && a->reg == b->reg && a->value == b->value &&
+           a->symbol == b->symbol;
+}
+
+static bool is_register(const Operand* operand) {
+    return operand->kind == OPERAND_REGISTER;
+}
+
+// Frame slots, the only memory whose value a register may stand in for:
+// data reached through pointers may be volatile or aliased
+static bool is_frame_slot(const Operand* operand) {
+    return operand->kind == OPERAND_MEMORY && operand->reg == REG_RBP;
+}
+
+static bool is_immediate(const Operand* operand, long long value) {
+    return operand->kind == OPERAND_IMMEDIATE && operand->value == value;
+}
+
+static bool is_return_jump(const MInst* inst) {
+    return inst->opcode == X86_JMP && inst->dst.kind == OPERAND_LABEL && inst->dst.value == LABEL_RETURN;
+}
+
+// Registers the epilogue and the caller may still read
+static bool live_at_return(int reg) {
+    return reg == REG_RAX || reg == REG_RSP || reg == REG_RBP;
+}
+
+static bool reads_flags(const MInst* inst) {
+    return inst->opcode == X86_JCC || inst->opcode == X86_SETCC || inst->opcode == X86_CMOV;
+}
+
+static bool writes_flags(const MInst* inst) {
+    switch (inst->opcode) {
+        case X86_ADD: case X86_SUB: case X86_IMUL: case X86_AND: case X86_OR: case X86_XOR:
+        case X86_CMP: case X86_TEST: case X86_NEG: case X86_IDIV: case X86_DIV: case X86_MUL: case X86_CALL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// How `inst` affects `reg`, or the flags for FLAGS: 1 if it reads it, -1
+// if it overwrites it without reading, 0 otherwise
+static int effect_on(const MInst* inst, int reg) {
+    if (reg == FLAGS) return reads_flags(inst) ? 1 : writes_flags(inst) ? -1 : 0;
+    RegisterEffects effects;
+    minst_effects(inst, &effects);
+    for (int u = 0; u < effects.use_count; u++) {
+        if (effects.uses[u] == reg) return 1;
+    }
+    for (int d = 0; d < effects.def_count; d++) {
+        if (effects.defs[d] == reg) return -1;
+    }
+    return 0;
+}
+
+// Whether no path from after `index` reads `reg` (or FLAGS) before
+// overwriting it. Jumps are followed through the label index; paths into
+// code outside the body, or longer than the search allows, count as
+// reading it.
+static bool dead_after(Peephole* p, int index, int reg) {
+    if (reg == REG_RSP || reg == REG_RBP) return false;
+    bool live_out = reg != FLAGS && live_at_return(reg);
+    p->stamp++;
+    int stack_count = 0;
+    p->stack[stack_count++] = index + 1;
+    int budget = DEAD_SEARCH_LIMIT;
+    while (stack_count > 0) {
+        int i = p->stack[--stack_count];
+        for (; ; i++) {
+            if (i >= p->body->count) {
+                // Falls into the epilogue
+                if (live_out) return false;
+                break;
+            }
+            if (p->visited[i] == p->stamp) break;
+            p->visited[i] = p->stamp;
+            if (p->removed[i] || p->body->items[i].kind != ITEM_INSTRUCTION) continue;
+            if (--budget == 0) return false;
+            const MInst* inst = inst_at(p, i);
+            int effect = effect_on(inst, reg);
+            if (effect > 0) return false;
+            if (effect < 0) break;
+            // The callee of a tail call reads only its arguments
+            if (minst_is_tail_call(inst)) break;
+            if (!minst_is_jump(inst)) continue;
+
+            if (is_return_jump(inst)) {
+                if (live_out) return false;
+            } else {
+                long long label = inst->dst.kind == OPERAND_LABEL ? inst->dst.value : -1;
+                if (label < 0 || label >= p->label_count || p->label_at[label] < 0) return false;
+                if (stack_count == DEAD_SEARCH_LIMIT) return false;
+                p->stack[stack_count++] = p->label_at[label];
+            }
+            if (inst->opcode == X86_JMP) break;
+        }
+    }
+    return true;
+}
+
+static bool register_dead_after(Peephole* p, int index, int reg) {
+    return dead_after(p, index, reg);
+}
+
+static bool flags_dead_after(Peephole* p, int index) {
+    return dead_after(p, index, FLAGS);
+}
+
+// Whether the label `target` is defined after `index` with only labels,
+// alignment and removed items in between
+static bool falls_through_to(Peephole* p, int index, const Operand* target) {
+    if (target->kind != OPERAND_LABEL) return false;
+    for (int i = index + 1; i < p->body->count; i++) {
+        if (p->removed[i]) continue;
+        const AsmItem* item = &p->body->items[i];
+        if (item->kind == ITEM_ALIGN) continue;
+        if (item->kind != ITEM_LABEL) return false;
+        if (item->operand.value == target->value) return true;
+    }
+    // The epilogue follows the body
+    return target->value == LABEL_RETURN;
+}
+
+// Patterns
+
+// mov %r, %r. Only the 64-bit form does nothing; the 32-bit one clears the
+// upper half and stands for a zero-extension.
+static bool self_move(Peephole* p, const int* at) {
+    MInst* inst = inst_at(p, at[0]);
+    if (!is_register(&inst->src) || !same_operand(&inst->src, &inst->dst) || inst->dst.size != 8) return false;
+    remove_at(p, at[0]);
+    return true;
+}
+
+// push %r; pop %s
+static bool push_pop(Peephole* p, const int* at) {
+    MInst* push = inst_at(p, at[0]);
+    MInst* pop = inst_at(p, at[1]);
+    if (!is_register(&push->dst) || !is_register(&pop->dst)) return false;
+    MInst move = {X86_MOV, COND_O, push->dst, pop->dst};
+    *pop = move;
+    remove_at(p, at[0]);
+    return true;
+}
+
+// mov %r, slot; mov slot, %s: the load becomes a move from %r
+static bool store_load(Peephole* p, const int* at) {
+    MInst* store = inst_at(p, at[0]);
+    MInst* load = inst_at(p, at[1]);
+    if (!is_register(&store->src) || !is_frame_slot(&store->dst) || !same_operand(&store->dst, &load->src) ||
+        !is_register(&load->dst) || load->dst.size != store->src.size || store->src.size < 4) {
+        return false;
+    }
+    load->src = store->src;
+    return true;
+}
+
+// mov slot, %r; mov %r, slot: the slot already holds the value
+static bool load_store(Peephole* p, const int* at) {
+    MInst* load = inst_at(p, at[0]);
+    MInst* store = inst_at(p, at[1]);
+    if (!is_frame_slot(&load->src) || !is_register(&load->dst) || !same_operand(&load->dst, &store->src) ||
+        !same_operand(&load->src, &store->dst)) {
+        return false;
+    }
+    remove_at(p, at[1]);
+    return true;
+}
+
+// Any move into %b, then mov %b, %c with %b dead afterwards: the first
+// writes %c directly
+static bool move_chain(Peephole* p, const int* at) {
+    MInst* first = inst_at(p, at[0]);
+    MInst* second = inst_at(p, at[1]);
+    switch (first->opcode) {
+        case X86_MOV: case X86_MOVABS: case X86_MOVSX: case X86_MOVZX: case X86_LEA:
+            break;
+        default:
+            return false;
+    }
+    if (!is_register(&first->dst) || !same_operand(&first->dst, &second->src) || !is_register(&second->dst) ||
+        first->dst.size < 4) {
+        return false;
+    }
+    int reg = first->dst.reg;
+    if (second->dst.reg == reg) return false;
+    if (first->dst.size == 8 && first->src.kind == OPERAND_REGISTER && first->src.reg == second->dst.reg &&
+        first->opcode == X86_MOV) {
+        // mov %a, %b; mov %b, %a: %a is unchanged
+        remove_at(p, at[1]);
+        return true;
+    }
+    if (!register_dead_after(p, at[1], reg)) return false;
+    first->dst.reg = second->dst.reg;
+    remove_at(p, at[1]);
+    return true;
+}
+
+static bool is_register_copy(const MInst* inst) {
+    return inst->opcode == X86_MOV && is_register(&inst->src) && is_register(&inst->dst) && inst->dst.size == 8 &&
+           inst->src.reg != inst->dst.reg;
+}
+
+static bool mentions(const Operand* operand, int reg) {
+    return (operand->kind == OPERAND_REGISTER || operand->kind == OPERAND_MEMORY) && operand->reg == reg;
+}
+
+// mov %a, %b, then an instruction reading %b as its source: it reads %a
+// instead, and the copy goes if nothing else needs %b
+static bool copy_forward(Peephole* p, const int* at) {
+    MInst* copy = inst_at(p, at[0]);
+    MInst* user = inst_at(p, at[1]);
+    if (!is_register_copy(copy) || user->opcode == X86_LEA || user->opcode == X86_CALL) return false;
+    int a = copy->src.reg;
+    int b = copy->dst.reg;
+    if (!is_register(&user->src) || user->src.reg != b) return false;
+    // Shift counts must stay in %cl
+    if (user->opcode == X86_SHL || user->opcode == X86_SHR || user->opcode == X86_SAR) return false;
+    bool overwrites = false;
+    if (mentions(&user->dst, b)) {
+        // Only a plain move may write %b, which then needs no copy
+        overwrites = user->dst.kind == OPERAND_REGISTER && user->dst.size >= 4 &&
+                     (user->opcode == X86_MOV || user->opcode == X86_MOVSX || user->opcode == X86_MOVZX);
+        if (!overwrites) return false;
+    }
+    if (!overwrites && !register_dead_after(p, at[1], b)) return false;
+    user->src.reg = a;
+    remove_at(p, at[0]);
+    return true;
+}
+
+// mov %a, %b; op x, %b; mov %b, %a with %b dead afterwards: the operation
+// works on %a in place
+static bool copy_operate(Peephole* p, const int* at) {
+    MInst* copy = inst_at(p, at[0]);
+    MInst* operation = inst_at(p, at[1]);
+    MInst* back = inst_at(p, at[2]);
+    if (!is_register_copy(copy) || !is_register_copy(back)) return false;
+    int a = copy->src.reg;
+    int b = copy->dst.reg;
+    if (back->src.reg != b || back->dst.reg != a) return false;
+    switch (operation->opcode) {
+        case X86_ADD: case X86_SUB: case X86_IMUL: case X86_AND: case X86_OR: case X86_XOR:
+        case X86_SHL: case X86_SHR: case X86_SAR: case X86_NEG: case X86_NOT:
+            break;
+        default:
+            return false;
+    }
+    if (operation->dst.kind != OPERAND_REGISTER || operation->dst.reg != b || operation->dst.size < 4 ||
+        mentions(&operation->src, b)) {
+        return false;
+    }
+    if (!register_dead_after(p, at[2], b)) return false;
+    operation->dst.reg = a;
+    remove_at(p, at[0]);
+    remove_at(p, at[2]);
+    return true;
+}
+
+// add $0, sub $0, or $0, xor $0, shifts by 0 and imul $1 of a register.
+// Removing a 32-bit one leaves the upper half unchanged, which is fine:
+// 32-bit values never rely on it, and zero-extensions are explicit.
+static bool identity_operation(Peephole* p, const int* at) {
+    MInst* inst = inst_at(p, at[0]);
+    if (!is_register(&inst->dst) || inst->dst.size < 4) return false;
+    switch (inst->opcode) {
+        case X86_SHL: case X86_SHR: case X86_SAR:
+            // Shifts by zero leave the flags alone too
+            if (!is_immediate(&inst->src, 0)) return false;
+            remove_at(p, at[0]);
+            return true;
+        case X86_ADD: case X86_SUB: case X86_OR: case X86_XOR:
+            if (!is_immediate(&inst->src, 0)) return false;
+            break;
+        case X86_IMUL:
+            if (!is_immediate(&inst->src, 1)) return false;
+            break;
+        default:
+            return false;
+    }
+    if (!flags_dead_after(p, at[0])) return false;
+    remove_at(p, at[0]);
+    return true;
+}
+
+// jmp or jcc to a label that immediately follows
+static bool jump_to_next(Peephole* p, const int* at) {
+    MInst* jump = inst_at(p, at[0]);
+    if (!minst_is_jump(jump) || !falls_through_to(p, at[0], &jump->dst)) return false;
+    remove_at(p, at[0]);
+    return true;
+}
+
+// jcc L1; jmp L2; L1: becomes jncc L2
+static bool branch_over_jump(Peephole* p, const int* at) {
+    MInst* branch = inst_at(p, at[0]);
+    MInst* jump = inst_at(p, at[1]);
+    if (minst_is_tail_call(jump) || !falls_through_to(p, at[1], &branch->dst)) return false;
+    branch->cond ^= 1;
+    branch->dst = jump->dst;
+    remove_at(p, at[1]);
+    return true;
+}
+
+// A jump to a label whose first instruction is another jmp goes straight
+// to the end of the chain. Chains that loop are left alone.
+static bool jump_chain(Peephole* p, const int* at) {
+    MInst* jump = inst_at(p, at[0]);
+    if (!minst_is_jump(jump)) return false;
+    Operand target = jump->dst;
+    for (int step = 0; step <= p->label_count; step++) {
+        if (target.kind != OPERAND_LABEL || target.value < 0 || target.value >= p->label_count ||
+            p->label_at[target.value] < 0) {
+            break;
+        }
+        int i = p->label_at[target.value] + 1;
+        while (i < p->body->count && (p->removed[i] || p->body->items[i].kind == ITEM_LABEL ||
+                                      p->body->items[i].kind == ITEM_ALIGN)) {
+            i++;
+        }
+        if (i == p->body->count || p->body->items[i].kind != ITEM_INSTRUCTION) break;
+        const MInst* next = inst_at(p, i);
+        if (!minst_is_jump(next) || next->opcode != X86_JMP) break;
+        if (step == p->label_count) return false;
+        target = next->dst;
+    }
+    if (same_operand(&target, &jump->dst)) return false;
+    jump->dst = target;
+    return true;
+}
+
+// Code after an unconditional jump up to the next label never runs
+static bool unreachable(Peephole* p, const int* at) {
+    remove_at(p, at[1]);
+    return true;
+}
+
+// cmp $0, %r sets the flags as test %r, %r does, with a shorter encoding
+static bool compare_zero(Peephole* p, const int* at) {
+    MInst* inst = inst_at(p, at[0]);
+    if (!is_immediate(&inst->src, 0) || !is_register(&inst->dst)) return false;
+    inst->opcode = X86_TEST;
+    inst->src = inst->dst;
+    return true;
+}
+
+// mov $0, %r becomes xor %r, %r when nothing reads the flags it clobbers
+static bool zero_register(Peephole* p, const int* at) {
+    MInst* inst = inst_at(p, at[0]);
+    if (!is_immediate(&inst->src, 0) || !is_register(&inst->dst) || inst->dst.size < 4) return false;
+    if (!flags_dead_after(p, at[0])) return false;
+    inst->opcode = X86_XOR;
+    inst->dst.size = 4;
+    inst->src = inst->dst;
+    return true;
+}
+
+static const PeepholePattern patterns[PEEPHOLE_PATTERN_COUNT] = {
+    {"self-move",        1, {X86_MOV},                  self_move},
+    {"push-pop",         2, {X86_PUSH, X86_POP},        push_pop},
+    {"store-load",       2, {X86_MOV, X86_MOV},         store_load},
+    {"load-store",       2, {X86_MOV, X86_MOV},         load_store},
+    {"move-chain",       2, {ANY_OPCODE, X86_MOV},      move_chain},
+    {"copy-forward",     2, {X86_MOV, ANY_OPCODE},      copy_forward},
+    {"copy-operate",     3, {X86_MOV, ANY_OPCODE, X86_MOV}, copy_operate},
+    {"identity",         1, {ANY_OPCODE},               identity_operation},
+    {"jump-to-next",     1, {ANY_OPCODE},               jump_to_next},
+    {"branch-over-jump", 2, {X86_JCC, X86_JMP},         branch_over_jump},
+    {"jump-chain",       1, {ANY_OPCODE},               jump_chain},
+    {"unreachable",      2, {X86_JMP, ANY_OPCODE},      unreachable},
+    {"compare-zero",     1, {X86_CMP},                  compare_zero},
+    {"zero-register",    1, {X86_MOV},                  zero_register},
+};
+
+static void index_labels(Peephole* p) {
+    for (int l = 0; l < p->label_count; l++) p->label_at[l] = -1;
+    for (int i = 0; i < p->body->count; i++) {
+        const AsmItem* item = &p->body->items[i];
+        if (item->kind == ITEM_LABEL && item->operand.value >= 0 && item->operand.value < p->label_count) {
+            p->label_at[item->operand.value] = i;
+        }
+    }
+}
+
+// One pass over the body; true if anything changed
+static bool run_patterns(Peephole* p, int* hits) {
+    bool changed = false;
+    for (int i = 0; i < p->body->count; i++) {
+        for (int k = 0; k < PEEPHOLE_PATTERN_COUNT && !p->removed[i]; k++) {
+            if (p->body->items[i].kind != ITEM_INSTRUCTION) break;
+            const PeepholePattern* pattern = &patterns[k];
+            int at[3] = {i, -1, -1};
+            bool matches = true;
+            for (int w = 0; w < pattern->length && matches; w++) {
+                if (w > 0) at[w] = next_instruction(p, at[w - 1]);
+                if (at[w] < 0) {
+                    matches = false;
+                } else if (pattern->opcodes[w] != ANY_OPCODE) {
+                    matches = (int)inst_at(p, at[w])->opcode == pattern->opcodes[w];
+                }
+            }
+            if (matches && pattern->apply(p, at)) {
+                hits[k]++;
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+static void compact(Peephole* p) {
+    int kept = 0;
+    for (int i = 0; i < p->body->count; i++) {
+        if (p->removed[i]) continue;
+        p->body->items[kept++] = p->body->items[i];
+    }
+    p->body->count = kept;
+    memset(p->removed, 0, sizeof(bool) * (kept + 1));
+}
+
+void peephole_optimization(CodeGenerator* gen) {
+    Peephole p;
+    p.body = &gen->body;
+    p.removed = calloc(gen->body.count + 1, sizeof(bool));
+    p.label_count = gen->label_counter;
+    p.label_at = malloc(sizeof(int) * (p.label_count + 1));
+    p.visited = calloc(gen->body.count + 1, sizeof(int));
+    p.stamp = 0;
+    p.stack = malloc(sizeof(int) * DEAD_SEARCH_LIMIT);
+
+    int hits[PEEPHOLE_PATTERN_COUNT] = {0};
+    bool changed = true;
+    while (changed) {
+        index_labels(&p);
+        changed = run_patterns(&p, hits);
+        compact(&p);
+    }
+    free(p.removed);
+    free(p.label_at);
+    free(p.visited);
+    free(p.stack);
+
+    // Hits per pattern, under the function's line of the allocation report
+    Emitter* report = &gen->report;
+    bool any = false;
+    for (int k = 0; k < PEEPHOLE_PATTERN_COUNT; k++) {
+        if (hits[k] == 0) continue;
+        const char* name = patterns[k].name;
+        emitter_write(report, any ? ", " : "  peephole: ", any ? 2 : 12);
+        emitter_write(report, name, strlen(name));
+        emitter_char(report, ' ');
+        emitter_integer(report, hits[k]);
+        any = true;
+    }
+    if (any) emitter_char(report, '\n');
+}
@@ -0,0 +1,831 @@
+#include "codegen.h"
+#include "encode.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Linear-scan register allocation in the style of Poletto and Sarkar.
+// The body of a function is generated with virtual registers; liveness is
+// computed over its basic blocks, each virtual register gets one interval
+// covering every position it is live at, and the intervals are handed
+// registers in order of their start. Under pressure the interval with the
+// smallest loop-weighted use count gives way: an active interval is split,
+// keeping its register up to the current position and living in a frame
+// slot afterwards, or the new interval is spilled outright. Moves on the
+// control-flow edges reconcile the two halves of split intervals.
+
+// Physical registers handed out, caller-saved first so that the
+// callee-saved ones, which cost a save and a restore, go to values that
+// live across calls. %rax stays out: it is the spill temporary of choice.
+static const int allocation_order[] = {
+    REG_R10, REG_R11, REG_RSI, REG_RDI, REG_R8, REG_R9, REG_RCX, REG_RDX,
+    REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15
+};
+#define ALLOCATABLE_COUNT ((int)(sizeof(allocation_order) / sizeof(allocation_order[0])))
+
+// Loop depths beyond this weigh the same
+#define MAX_WEIGHT_DEPTH 6
+
+typedef struct {
+    int start;
+    int end;
+} Range;
+
+// Sorted, disjoint ranges of positions
+typedef struct {
+    Range* ranges;
+    int count;
+    int capacity;
+} RangeList;
+
+typedef struct {
+    int first;                   // First and last item of the block
+    int last;
+    int successors[2];           // Block indices, -1 for the function exit
+    int successor_count;
+    unsigned int phys_gen;       // Physical registers read before written
+    unsigned int phys_kill;
+    unsigned int phys_in;
+    unsigned int phys_out;
+} Block;
+
+// Analysis results shared by compute_live_ranges and allocate_registers
+struct Liveness {
+    Block* blocks;
+    int block_count;
+    int* label_item;             // Item defining each label
+    int* depth;                  // Loop nesting depth of each item
+    int* global_index;           // Per virtual register; -1 when block-local
+    int* globals;                // Virtual register of each global index
+    int global_count;
+    int words;                   // 64-bit words per live set
+    unsigned long long* live_in; // block_count sets of global registers
+    unsigned long long* live_out;
+    RangeList fixed[16];         // Where each physical register is in use
+};
+
+typedef struct {
+    MInst* insts;
+    int count;
+    int capacity;
+} MInstList;
+
+static void range_add(RangeList* list, int start, int end) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->ranges = realloc(list->ranges, sizeof(Range) * list->capacity);
+    }
+    list->ranges[list->count].start = start;
+    list->ranges[list->count].end = end;
+    list->count++;
+}
+
+// Whether any range intersects [start, end]
+static bool range_overlaps(const RangeList* list, int start, int end) {
+    int low = 0;
+    int high = list->count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (list->ranges[mid].end < start) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low < list->count && list->ranges[low].start <= end;
+}
+
+static int compare_ranges(const void* a, const void* b) {
+    return ((const Range*)a)->start - ((const Range*)b)->start;
+}
+
+static void minst_list_add(MInstList* list, const MInst* inst) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 4;
+        list->insts = realloc(list->insts, sizeof(MInst) * list->capacity);
+    }
+    list->insts[list->count++] = *inst;
+}
+
+static bool is_virtual(int reg) {
+    return reg >= VREG_BASE;
+}
+
+static bool is_tracked(int reg) {
+    return reg != REG_RSP && reg != REG_RBP;
+}
+
+static bool test_bit(const unsigned long long* set, int bit) {
+    return (set[bit / 64] >> (bit % 64)) & 1;
+}
+
+static void set_bit(unsigned long long* set, int bit) {
+    set[bit / 64] |= 1ULL << (bit % 64);
+}
+
+static void extend(LiveRange* range, int position) {
+    if (range->start < 0 || position < range->start) range->start = position;
+    if (position > range->end) range->end = position;
+}
+
+static void free_liveness(struct Liveness* liveness) {
+    if (liveness == NULL) return;
+    free(liveness->blocks);
+    free(liveness->label_item);
+    free(liveness->depth);
+    free(liveness->global_index);
+    free(liveness->globals);
+    free(liveness->live_in);
+    free(liveness->live_out);
+    for (int i = 0; i < 16; i++) free(liveness->fixed[i].ranges);
+    free(liveness);
+}
+
+// Split the body into basic blocks at labels and after jumps
+static void build_blocks(CodeGenerator* gen, struct Liveness* liveness) {
+    AsmList* body = &gen->body;
+    liveness->blocks = malloc(sizeof(Block) * (body->count + 1));
+    liveness->label_item = malloc(sizeof(int) * (gen->label_counter + 1));
+    int* label_block = malloc(sizeof(int) * (gen->label_counter + 1));
+    for (int i = 0; i < gen->label_counter; i++) {
+        liveness->label_item[i] = -1;
+        label_block[i] = -1;
+    }
+
+    int count = 0;
+    for (int k = 0; k < body->count; k++) {
+        AsmItem* item = &body->items[k];
+        const AsmItem* previous = k > 0 ? &body->items[k - 1] : NULL;
+        bool starts = k == 0 || item->kind == ITEM_LABEL ||
+                      (previous->kind == ITEM_INSTRUCTION &&
+                       (minst_is_jump(&previous->inst) || minst_is_tail_call(&previous->inst)));
+        if (starts) {
+            memset(&liveness->blocks[count], 0, sizeof(Block));
+            liveness->blocks[count].first = k;
+            count++;
+        }
+        liveness->blocks[count - 1].last = k;
+        if (item->kind == ITEM_LABEL) {
+            liveness->label_item[item->operand.value] = k;
+            label_block[item->operand.value] = count - 1;
+        }
+    }
+    liveness->block_count = count;
+
+    for (int b = 0; b < count; b++) {
+        Block* block = &liveness->blocks[b];
+        AsmItem* last = &body->items[block->last];
+        int next = b + 1 < count ? b + 1 : -1;
+        // A tail call leaves the function, reading only its arguments
+        if (last->kind == ITEM_INSTRUCTION && minst_is_tail_call(&last->inst)) continue;
+        if (last->kind == ITEM_INSTRUCTION && minst_is_jump(&last->inst)) {
+            long long label = last->inst.dst.value;
+            block->successors[block->successor_count++] = label == LABEL_RETURN ? -1 : label_block[label];
+            if (last->inst.opcode == X86_JCC) block->successors[block->successor_count++] = next;
+        } else {
+            block->successors[block->successor_count++] = next;
+        }
+    }
+    free(label_block);
+
+    // A jump back to an earlier label closes a loop around the items between
+    liveness->depth = calloc(body->count + 1, sizeof(int));
+    for (int k = 0; k < body->count; k++) {
+        AsmItem* item = &body->items[k];
+        if (item->kind != ITEM_INSTRUCTION || !minst_is_jump(&item->inst)) continue;
+        if (item->inst.dst.value == LABEL_RETURN) continue;
+        int target = liveness->label_item[item->inst.dst.value];
+        if (target >= 0 && target <= k) {
+            liveness->depth[target]++;
+            liveness->depth[k + 1]--;
+        }
+    }
+    for (int k = 1; k < body->count; k++) liveness->depth[k] += liveness->depth[k - 1];
+}
+
+// Physical register ranges, found by walking each block backwards from
+// its live-out set. Writes nobody reads still occupy their position.
+static void build_fixed_ranges(CodeGenerator* gen, struct Liveness* liveness) {
+    AsmList* body = &gen->body;
+    for (int b = liveness->block_count - 1; b >= 0; b--) {
+        Block* block = &liveness->blocks[b];
+        unsigned int live = block->phys_out;
+        int end[16];
+        for (int r = 0; r < 16; r++) end[r] = 2 * block->last + 1;
+
+        for (int k = block->last; k >= block->first; k--) {
+            if (body->items[k].kind != ITEM_INSTRUCTION) continue;
+            RegisterEffects effects;
+            minst_effects(&body->items[k].inst, &effects);
+            for (int i = 0; i < effects.def_count; i++) {
+                int reg = effects.defs[i];
+                if (is_virtual(reg) || !is_tracked(reg)) continue;
+                if (live & (1u << reg)) {
+                    range_add(&liveness->fixed[reg], 2 * k + 1, end[reg]);
+                    live &= ~(1u << reg);
+                } else {
+                    range_add(&liveness->fixed[reg], 2 * k + 1, 2 * k + 1);
+                }
+            }
+            for (int i = 0; i < effects.use_count; i++) {
+                int reg = effects.uses[i];
+                if (is_virtual(reg) || !is_tracked(reg) || (live & (1u << reg))) continue;
+                end[reg] = 2 * k;
+                live |= 1u << reg;
+            }
+        }
+        for (int r = 0; r < 16; r++) {
+            if (live & (1u << r)) range_add(&liveness->fixed[r], 2 * block->first, end[r]);
+        }
+    }
+
+    // Ranges were found back to front; ranges of a block may also touch
+    // those of the next, so sort rather than reverse
+    for (int r = 0; r < 16; r++) {
+        RangeList* list = &liveness->fixed[r];
+        if (list->count > 1) qsort(list->ranges, list->count, sizeof(Range), compare_ranges);
+    }
+}
+
+void compute_live_ranges(CodeGenerator* gen) {
+    free_liveness(gen->liveness);
+    struct Liveness* liveness = calloc(1, sizeof(struct Liveness));
+    gen->liveness = liveness;
+    AsmList* body = &gen->body;
+    int vreg_count = gen->vreg_count;
+
+    if (gen->vreg_capacity < vreg_count) {
+        gen->vreg_capacity = vreg_count;
+        gen->live_ranges = realloc(gen->live_ranges, sizeof(LiveRange) * vreg_count);
+    }
+    LiveRange* ranges = gen->live_ranges;
+    for (int v = 0; v < vreg_count; v++) {
+        ranges[v].start = -1;
+        ranges[v].end = -1;
+        ranges[v].reg = -1;
+        ranges[v].split = -1;
+        ranges[v].slot = 0;
+        ranges[v].weight = 0;
+    }
+
+    build_blocks(gen, liveness);
+    int block_count = liveness->block_count;
+
+    // Registers read in a block before being written there are global;
+    // every other value lives and dies within one block
+    liveness->global_index = malloc(sizeof(int) * (vreg_count + 1));
+    int* defined_in = malloc(sizeof(int) * (vreg_count + 1));
+    for (int v = 0; v < vreg_count; v++) {
+        liveness->global_index[v] = -1;
+        defined_in[v] = -1;
+    }
+    int global_count = 0;
+    for (int b = 0; b < block_count; b++) {
+        Block* block = &liveness->blocks[b];
+        for (int k = block->first; k <= block->last; k++) {
+            if (body->items[k].kind != ITEM_INSTRUCTION) continue;
+            RegisterEffects effects;
+            minst_effects(&body->items[k].inst, &effects);
+            long long weight = 1LL << (3 * (liveness->depth[k] < MAX_WEIGHT_DEPTH ?
+                                            liveness->depth[k] : MAX_WEIGHT_DEPTH));
+            for (int i = 0; i < effects.use_count; i++) {
+                int reg = effects.uses[i];
+                if (!is_virtual(reg)) {
+                    if (is_tracked(reg) && !(block->phys_kill & (1u << reg))) block->phys_gen |= 1u << reg;
+                    continue;
+                }
+                int v = reg - VREG_BASE;
+                extend(&ranges[v], 2 * k);
+                ranges[v].weight += weight;
+                if (defined_in[v] != b && liveness->global_index[v] < 0) {
+                    liveness->global_index[v] = global_count++;
+                }
+            }
+            for (int i = 0; i < effects.def_count; i++) {
+                int reg = effects.defs[i];
+                if (!is_virtual(reg)) {
+                    if (is_tracked(reg)) block->phys_kill |= 1u << reg;
+                    continue;
+                }
+                int v = reg - VREG_BASE;
+                extend(&ranges[v], 2 * k + 1);
+                ranges[v].weight += weight;
+                defined_in[v] = b;
+            }
+        }
+    }
+    liveness->global_count = global_count;
+    liveness->globals = malloc(sizeof(int) * (global_count + 1));
+    for (int v = 0; v < vreg_count; v++) {
+        if (liveness->global_index[v] >= 0) liveness->globals[liveness->global_index[v]] = v;
+    }
+
+    // Use and kill sets of the global registers
+    int words = (global_count + 63) / 64;
+    if (words == 0) words = 1;
+    liveness->words = words;
+    size_t set_bytes = sizeof(unsigned long long) * words * block_count;
+    unsigned long long* gen_sets = calloc(1, set_bytes + 1);
+    unsigned long long* kill_sets = calloc(1, set_bytes + 1);
+    liveness->live_in = calloc(1, set_bytes + 1);
+    liveness->live_out = calloc(1, set_bytes + 1);
+    for (int b = 0; b < block_count; b++) {
+        Block* block = &liveness->blocks[b];
+        unsigned long long* use_set = gen_sets + (size_t)b * words;
+        unsigned long long* kill_set = kill_sets + (size_t)b * words;
+        for (int k = block->first; k <= block->last; k++) {
+            if (body->items[k].kind != ITEM_INSTRUCTION) continue;
+            RegisterEffects effects;
+            minst_effects(&body->items[k].inst, &effects);
+            for (int i = 0; i < effects.use_count; i++) {
+                if (!is_virtual(effects.uses[i])) continue;
+                int g = liveness->global_index[effects.uses[i] - VREG_BASE];
+                if (g >= 0 && !test_bit(kill_set, g)) set_bit(use_set, g);
+            }
+            for (int i = 0; i < effects.def_count; i++) {
+                if (!is_virtual(effects.defs[i])) continue;
+                int g = liveness->global_index[effects.defs[i] - VREG_BASE];
+                if (g >= 0) set_bit(kill_set, g);
+            }
+        }
+    }
+
+    // Backward dataflow to a fixed point. The return value in %rax is
+    // live at the exit.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int b = block_count - 1; b >= 0; b--) {
+            Block* block = &liveness->blocks[b];
+            unsigned long long* in = liveness->live_in + (size_t)b * words;
+            unsigned long long* out = liveness->live_out + (size_t)b * words;
+            unsigned int phys_out = 0;
+            for (int s = 0; s < block->successor_count; s++) {
+                int successor = block->successors[s];
+                if (successor < 0) {
+                    phys_out |= 1u << REG_RAX;
+                    continue;
+                }
+                phys_out |= liveness->blocks[successor].phys_in;
+                unsigned long long* successor_in = liveness->live_in + (size_t)successor * words;
+                for (int w = 0; w < words; w++) out[w] |= successor_in[w];
+            }
+            block->phys_out = phys_out;
+            unsigned int phys_in = block->phys_gen | (phys_out & ~block->phys_kill);
+            if (phys_in != block->phys_in) {
+                block->phys_in = phys_in;
+                changed = true;
+            }
+            unsigned long long* use_set = gen_sets + (size_t)b * words;
+            unsigned long long* kill_set = kill_sets + (size_t)b * words;
+            for (int w = 0; w < words; w++) {
+                unsigned long long value = use_set[w] | (out[w] & ~kill_set[w]);
+                if (value != in[w]) {
+                    in[w] = value;
+                    changed = true;
+                }
+            }
+        }
+    }
+    free(gen_sets);
+    free(kill_sets);
+    free(defined_in);
+
+    // Global intervals also span the blocks they are live through
+    for (int b = 0; b < block_count; b++) {
+        Block* block = &liveness->blocks[b];
+        unsigned long long* in = liveness->live_in + (size_t)b * words;
+        unsigned long long* out = liveness->live_out + (size_t)b * words;
+        for (int w = 0; w < words; w++) {
+            for (unsigned long long bits = in[w]; bits != 0; bits &= bits - 1) {
+                extend(&ranges[liveness->globals[w * 64 + __builtin_ctzll(bits)]], 2 * block->first);
+            }
+            for (unsigned long long bits = out[w]; bits != 0; bits &= bits - 1) {
+                extend(&ranges[liveness->globals[w * 64 + __builtin_ctzll(bits)]], 2 * block->last + 1);
+            }
+        }
+    }
+
+    build_fixed_ranges(gen, liveness);
+}
+
+// Allocation
+typedef struct {
+    int start;
+    int vreg;
+} RangeStart;
+
+static int compare_starts(const void* a, const void* b) {
+    const RangeStart* left = a;
+    const RangeStart* right = b;
+    if (left->start != right->start) return left->start - right->start;
+    return left->vreg - right->vreg;
+}
+
+// Whether `candidate` should give way before `other`
+static bool cheaper(const LiveRange* candidate, const LiveRange* other) {
+    if (candidate->weight != other->weight) return candidate->weight < other->weight;
+    return candidate->end > other->end;
+}
+
+static void linear_scan(CodeGenerator* gen, int* order, int count) {
+    struct Liveness* liveness = gen->liveness;
+    LiveRange* ranges = gen->live_ranges;
+    int active[ALLOCATABLE_COUNT];
+    int active_count = 0;
+
+    for (int i = 0; i < count; i++) {
+        int v = order[i];
+        LiveRange* current = &ranges[v];
+
+        // Expire intervals that ended before this one starts
+        int kept = 0;
+        for (int a = 0; a < active_count; a++) {
+            if (ranges[active[a]].end >= current->start) active[kept++] = active[a];
+        }
+        active_count = kept;
+
+        unsigned int held = 0;
+        for (int a = 0; a < active_count; a++) held |= 1u << ranges[active[a]].reg;
+        for (int r = 0; r < ALLOCATABLE_COUNT; r++) {
+            int reg = allocation_order[r];
+            if (held & (1u << reg)) continue;
+            if (range_overlaps(&liveness->fixed[reg], current->start, current->end)) continue;
+            current->reg = reg;
+            break;
+        }
+        if (current->reg >= 0) {
+            active[active_count++] = v;
+            continue;
+        }
+
+        // No register is free: the cheapest interval whose register would
+        // suit this one gives way
+        int victim = -1;
+        for (int a = 0; a < active_count; a++) {
+            LiveRange* range = &ranges[active[a]];
+            if (range_overlaps(&liveness->fixed[range->reg], current->start, current->end)) continue;
+            if (victim < 0 || cheaper(range, &ranges[active[victim]])) victim = a;
+        }
+        if (victim >= 0 && cheaper(&ranges[active[victim]], current)) {
+            LiveRange* range = &ranges[active[victim]];
+            current->reg = range->reg;
+            if (range->start == current->start) {
+                range->reg = -1;
+                gen->spill_count++;
+            } else {
+                range->split = current->start;
+                gen->split_count++;
+            }
+            active[victim] = v;
+        } else {
+            gen->spill_count++;
+        }
+    }
+}
+
+// Where a virtual register lives at a position
+static Operand location(CodeGenerator* gen, int v, int position, int size) {
+    LiveRange* range = &gen->live_ranges[v];
+    if (range->reg >= 0 && (range->split < 0 || position < range->split)) {
+        return operand_register(range->reg, size);
+    }
+    return operand_memory(REG_RBP, range->slot, size);
+}
+
+static void emit_move(MInstList* list, Operand src, Operand dst) {
+    MInst inst = {X86_MOV, COND_O, src, dst};
+    minst_list_add(list, &inst);
+}
+
+// Moves that carry the global registers live into `successor` from where
+// they are at the end of `block` to where the successor expects them.
+// Stores go first: they read registers the loads may overwrite.
+static void resolve_edge(CodeGenerator* gen, int block, int successor, MInstList* moves) {
+    struct Liveness* liveness = gen->liveness;
+    Block* from = &liveness->blocks[block];
+    Block* to = &liveness->blocks[successor];
+    unsigned long long* in = liveness->live_in + (size_t)successor * liveness->words;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int w = 0; w < liveness->words; w++) {
+            for (unsigned long long bits = in[w]; bits != 0; bits &= bits - 1) {
+                int v = liveness->globals[w * 64 + __builtin_ctzll(bits)];
+                Operand source = location(gen, v, 2 * from->last + 1, 8);
+                Operand target = location(gen, v, 2 * to->first, 8);
+                if (source.kind == target.kind) continue;
+                bool is_store = source.kind == OPERAND_REGISTER;
+                if (is_store == (pass == 0)) emit_move(moves, source, target);
+            }
+        }
+    }
+}
+
+// Registers neither allocated nor otherwise in use around item k
+static bool register_free(CodeGenerator* gen, RangeList* assigned, int reg, int k, unsigned int busy) {
+    if (busy & (1u << reg)) return false;
+    if (range_overlaps(&gen->liveness->fixed[reg], 2 * k, 2 * k + 1)) return false;
+    return !range_overlaps(&assigned[reg], 2 * k, 2 * k + 1);
+}
+
+static const int temporary_order[] = {
+    REG_RAX, REG_R10, REG_R11, REG_RSI, REG_RDI, REG_R8, REG_R9, REG_RCX, REG_RDX,
+    REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15
+};
+#define TEMPORARY_COUNT ((int)(sizeof(temporary_order) / sizeof(temporary_order[0])))
+
+// Substitute the locations of virtual registers into an instruction.
+// Registers in `in_temporary` (bit i for the i-th of `spilled`) use
+// temporaries[i]; other spilled ones become memory operands.
+static MInst substitute(CodeGenerator* gen, const MInst* inst, int k, const int* spilled, int spilled_count,
+                        unsigned int in_temporary, const int* temporaries) {
+    MInst result = *inst;
+    Operand* operands[2] = {&result.src, &result.dst};
+    for (int i = 0; i < 2; i++) {
+        Operand* operand = operands[i];
+        if ((operand->kind != OPERAND_REGISTER && operand->kind != OPERAND_MEMORY) ||
+            !is_virtual(operand->reg)) {
+            continue;
+        }
+        int v = operand->reg - VREG_BASE;
+        int slot = -1;
+        for (int s = 0; s < spilled_count; s++) {
+            if (spilled[s] == v) slot = s;
+        }
+        if (slot >= 0 && (in_temporary & (1u << slot))) {
+            operand->reg = temporaries[slot];
+        } else if (operand->kind == OPERAND_MEMORY) {
+            operand->reg = location(gen, v, 2 * k, 8).reg;
+        } else {
+            *operand = location(gen, v, operand == &result.dst ? 2 * k + 1 : 2 * k, operand->size);
+        }
+    }
+    return result;
+}
+
+// Rewrite item k, whose spilled registers may need temporaries
+static void rewrite_instruction(CodeGenerator* gen, AsmList* out, const MInst* inst, int k,
+                                RangeList* assigned) {
+    RegisterEffects effects;
+    minst_effects(inst, &effects);
+
+    // Spilled registers, and whether they must be in a register here:
+    // memory operands need a register base, and 32-bit writes must clear
+    // the upper half of the whole slot
+    int spilled[3];
+    int spilled_count = 0;
+    unsigned int forced = 0;
+    const Operand* operands[2] = {&inst->src, &inst->dst};
+    for (int i = 0; i < 2; i++) {
+        const Operand* operand = operands[i];
+        if ((operand->kind != OPERAND_REGISTER && operand->kind != OPERAND_MEMORY) ||
+            !is_virtual(operand->reg)) {
+            continue;
+        }
+        int v = operand->reg - VREG_BASE;
+        int position = operand == &inst->dst && operand->kind == OPERAND_REGISTER ? 2 * k + 1 : 2 * k;
+        if (location(gen, v, position, 8).kind == OPERAND_REGISTER) continue;
+        int slot = spilled_count;
+        for (int s = 0; s < spilled_count; s++) {
+            if (spilled[s] == v) slot = s;
+        }
+        if (slot == spilled_count) spilled[spilled_count++] = v;
+        bool is_def = false;
+        for (int d = 0; d < effects.def_count; d++) {
+            if (effects.defs[d] == operand->reg) is_def = true;
+        }
+        if (operand->kind == OPERAND_MEMORY || (is_def && operand->size == 4)) forced |= 1u << slot;
+    }
+
+    if (spilled_count == 0) {
+        MInst result = substitute(gen, inst, k, NULL, 0, 0, NULL);
+        // A 64-bit copy to the same register is a no-op; narrower ones
+        // still clear the upper bits
+        bool is_copy = result.opcode == X86_MOV && result.src.kind == OPERAND_REGISTER &&
+                       result.dst.kind == OPERAND_REGISTER && result.src.reg == result.dst.reg &&
+                       result.dst.size == 8;
+        if (!is_copy) asm_list_add(out, ITEM_INSTRUCTION)->inst = result;
+        return;
+    }
+
+    // Keep as many spilled registers in memory as the instruction allows
+    int placeholders[3] = {REG_RAX, REG_RCX, REG_RDX};
+    unsigned int in_temporary = (1u << spilled_count) - 1;
+    for (unsigned int mask = 0; mask < (1u << spilled_count); mask++) {
+        if ((mask & forced) != forced) continue;
+        if (__builtin_popcount(mask) >= __builtin_popcount(in_temporary)) continue;
+        MInst trial = substitute(gen, inst, k, spilled, spilled_count, mask, placeholders);
+        Encoding encoding;
+        if (x86_encode(&trial, false, &encoding)) in_temporary = mask;
+    }
+
+    // Temporaries: registers free at this item, else ones parked on the stack
+    MInst physical = substitute(gen, inst, k, spilled, spilled_count, 0, placeholders);
+    RegisterEffects physical_effects;
+    minst_effects(&physical, &physical_effects);
+    unsigned int busy = (1u << REG_RSP) | (1u << REG_RBP);
+    for (int i = 0; i < physical_effects.use_count; i++) {
+        if (!is_virtual(physical_effects.uses[i])) busy |= 1u << physical_effects.uses[i];
+    }
+    for (int i = 0; i < physical_effects.def_count; i++) {
+        if (!is_virtual(physical_effects.defs[i])) busy |= 1u << physical_effects.defs[i];
+    }
+    // Placeholder registers of spilled operands are not real uses
+    for (int s = 0; s < spilled_count; s++) busy &= ~(1u << placeholders[s]);
+    for (int i = 0; i < 2; i++) {
+        Operand* operand = i == 0 ? &physical.src : &physical.dst;
+        if ((operand->kind == OPERAND_REGISTER || operand->kind == OPERAND_MEMORY) && operand->reg < 16) {
+            int original = i == 0 ? inst->src.reg : inst->dst.reg;
+            if (!is_virtual(original) || location(gen, original - VREG_BASE, 2 * k, 8).kind == OPERAND_REGISTER) {
+                busy |= 1u << operand->reg;
+            }
+        }
+    }
+
+    int temporaries[3];
+    int parked[3];
+    int parked_count = 0;
+    for (int s = 0; s < spilled_count; s++) {
+        if (!(in_temporary & (1u << s))) continue;
+        temporaries[s] = -1;
+        for (int t = 0; t < TEMPORARY_COUNT && temporaries[s] < 0; t++) {
+            if (register_free(gen, assigned, temporary_order[t], k, busy)) temporaries[s] = temporary_order[t];
+        }
+        if (temporaries[s] < 0) {
+            for (int t = 0; t < TEMPORARY_COUNT && temporaries[s] < 0; t++) {
+                if (!(busy & (1u << temporary_order[t]))) temporaries[s] = temporary_order[t];
+            }
+            parked[parked_count++] = temporaries[s];
+        }
+        busy |= 1u << temporaries[s];
+        gen->registers[temporaries[s]].is_dirty = true;
+    }
+
+    for (int p = 0; p < parked_count; p++) {
+        MInst push = {X86_PUSH, COND_O, {OPERAND_NONE, 0, -1, 0, NULL}, operand_register(parked[p], 8)};
+        asm_list_add(out, ITEM_INSTRUCTION)->inst = push;
+    }
+    for (int s = 0; s < spilled_count; s++) {
+        if (!(in_temporary & (1u << s))) continue;
+        bool is_use = false;
+        for (int u = 0; u < effects.use_count; u++) {
+            if (effects.uses[u] == VREG_BASE + spilled[s]) is_use = true;
+        }
+        if (!is_use) continue;
+        MInst load = {X86_MOV, COND_O, location(gen, spilled[s], 2 * k, 8),
+                      operand_register(temporaries[s], 8)};
+        asm_list_add(out, ITEM_INSTRUCTION)->inst = load;
+    }
+    asm_list_add(out, ITEM_INSTRUCTION)->inst =
+        substitute(gen, inst, k, spilled, spilled_count, in_temporary, temporaries);
+    for (int s = 0; s < spilled_count; s++) {
+        if (!(in_temporary & (1u << s))) continue;
+        bool is_def = false;
+        for (int d = 0; d < effects.def_count; d++) {
+            if (effects.defs[d] == VREG_BASE + spilled[s]) is_def = true;
+        }
+        if (!is_def) continue;
+        MInst store = {X86_MOV, COND_O, operand_register(temporaries[s], 8),
+                       location(gen, spilled[s], 2 * k + 1, 8)};
+        asm_list_add(out, ITEM_INSTRUCTION)->inst = store;
+    }
+    for (int p = parked_count - 1; p >= 0; p--) {
+        MInst pop = {X86_POP, COND_O, {OPERAND_NONE, 0, -1, 0, NULL}, operand_register(parked[p], 8)};
+        asm_list_add(out, ITEM_INSTRUCTION)->inst = pop;
+    }
+}
+
+// Intervals in order of their starts, as linear_scan takes them
+static int order_ranges(CodeGenerator* gen, int* order) {
+    RangeStart* starts = malloc(sizeof(RangeStart) * (gen->vreg_count + 1));
+    int count = 0;
+    for (int v = 0; v < gen->vreg_count; v++) {
+        if (gen->live_ranges[v].start >= 0) starts[count++] = (RangeStart){gen->live_ranges[v].start, v};
+    }
+    qsort(starts, count, sizeof(RangeStart), compare_starts);
+    for (int i = 0; i < count; i++) order[i] = starts[i].vreg;
+    free(starts);
+    return count;
+}
+
+int allocation_cost(CodeGenerator* gen) {
+    compute_live_ranges(gen);
+    int* order = malloc(sizeof(int) * (gen->vreg_count + 1));
+    int count = order_ranges(gen, order);
+    gen->spill_count = 0;
+    gen->split_count = 0;
+    linear_scan(gen, order, count);
+    free(order);
+    for (int v = 0; v < gen->vreg_count; v++) {
+        gen->live_ranges[v].reg = -1;
+        gen->live_ranges[v].split = -1;
+    }
+    return 2 * gen->spill_count + gen->split_count;
+}
+
+void allocate_registers(CodeGenerator* gen) {
+    struct Liveness* liveness = gen->liveness;
+    LiveRange* ranges = gen->live_ranges;
+    AsmList* body = &gen->body;
+    gen->spill_count = 0;
+    gen->split_count = 0;
+
+    int* order = malloc(sizeof(int) * (gen->vreg_count + 1));
+    int count = order_ranges(gen, order);
+    linear_scan(gen, order, count);
+    free(order);
+
+    // Frame slots for values that spend any time in memory, and the
+    // stretches each register is taken
+    RangeList assigned[16];
+    memset(assigned, 0, sizeof(assigned));
+    gen->current_stack_offset = (gen->current_stack_offset + 7) / 8 * 8;
+    for (int v = 0; v < gen->vreg_count; v++) {
+        LiveRange* range = &ranges[v];
+        if (range->start < 0) continue;
+        if (range->reg < 0 || range->split >= 0) {
+            gen->current_stack_offset += 8;
+            range->slot = -gen->current_stack_offset;
+        }
+        if (range->reg >= 0) {
+            gen->registers[range->reg].is_dirty = true;
+            range_add(&assigned[range->reg], range->start, range->split >= 0 ? range->split - 1 : range->end);
+        }
+    }
+    for (int r = 0; r < 16; r++) {
+        if (assigned[r].count > 1) qsort(assigned[r].ranges, assigned[r].count, sizeof(Range), compare_ranges);
+    }
+
+    // Code to insert before each item: edge moves, then the stores of
+    // intervals split there
+    MInstList* before = calloc(body->count + 1, sizeof(MInstList));
+    for (int b = 0; b < liveness->block_count; b++) {
+        Block* block = &liveness->blocks[b];
+        AsmItem* last = &body->items[block->last];
+        for (int s = 0; s < block->successor_count; s++) {
+            int successor = block->successors[s];
+            if (successor < 0) continue;
+            MInstList moves = {NULL, 0, 0};
+            resolve_edge(gen, b, successor, &moves);
+            if (moves.count > 0) {
+                bool is_jump = last->kind == ITEM_INSTRUCTION && minst_is_jump(&last->inst) && s == 0;
+                if (!is_jump) {
+                    // Falls through into the successor
+                    for (int m = 0; m < moves.count; m++) minst_list_add(&before[block->last + 1], &moves.insts[m]);
+                } else if (last->inst.opcode == X86_JMP) {
+                    for (int m = 0; m < moves.count; m++) minst_list_add(&before[block->last], &moves.insts[m]);
+                } else {
+                    // A conditional branch gets its moves out of line
+                    int stub = gen->label_counter++;
+                    asm_list_add(&gen->stubs, ITEM_LABEL)->operand = operand_label(gen->function_name, stub);
+                    for (int m = 0; m < moves.count; m++) {
+                        asm_list_add(&gen->stubs, ITEM_INSTRUCTION)->inst = moves.insts[m];
+                    }
+                    MInst jump = {X86_JMP, COND_O, {OPERAND_NONE, 0, -1, 0, NULL}, last->inst.dst};
+                    asm_list_add(&gen->stubs, ITEM_INSTRUCTION)->inst = jump;
+                    last->inst.dst = operand_label(gen->function_name, stub);
+                }
+            }
+            free(moves.insts);
+        }
+    }
+    for (int v = 0; v < gen->vreg_count; v++) {
+        LiveRange* range = &ranges[v];
+        // Splits at a block boundary are handled by the edge moves
+        if (range->reg < 0 || range->split < 0 || range->split % 2 == 0) continue;
+        MInst store = {X86_MOV, COND_O, operand_register(range->reg, 8),
+                       operand_memory(REG_RBP, range->slot, 8)};
+        minst_list_add(&before[range->split / 2], &store);
+    }
+
+    AsmList out;
+    asm_list_init(&out);
+    for (int k = 0; k <= body->count; k++) {
+        for (int m = 0; m < before[k].count; m++) {
+            asm_list_add(&out, ITEM_INSTRUCTION)->inst = before[k].insts[m];
+        }
+        free(before[k].insts);
+        if (k == body->count) break;
+        if (body->items[k].kind == ITEM_INSTRUCTION) {
+            rewrite_instruction(gen, &out, &body->items[k].inst, k, assigned);
+        } else {
+            *asm_list_add(&out, body->items[k].kind) = body->items[k];
+        }
+    }
+    free(before);
+    for (int r = 0; r < 16; r++) free(assigned[r].ranges);
+
+    asm_list_free(body);
+    *body = out;
+
+    Emitter* report = &gen->report;
+    emitter_write(report, gen->function_name, strlen(gen->function_name));
+    emitter_write(report, ": ", 2);
+    emitter_integer(report, count);
+    emitter_write(report, " values, ", 9);
+    emitter_integer(report, gen->spill_count);
+    emitter_write(report, " spilled, ", 10);
+    emitter_integer(report, gen->split_count);
+    emitter_write(report, " split\n", 7);
+
+    free_liveness(liveness);
+    gen->liveness = NULL;
+}
@@ -0,0 +1,896 @@
+#include "codegen.h"
+#include <stdlib.h>
+#include <string.h>
+
+// List scheduling of a function body between instruction selection and
+// register allocation. The body is cut into regions at labels and at the
+// instructions that stay put: jumps, calls and anything that moves %rsp.
+// Within a region, instructions are issued cycle by cycle, within the
+// issue width and the ports of a simple model of a recent x86-64 core,
+// from those whose operands are ready, the one with the longest latency
+// path to the end of the region first. Loads, multiplies and divides so
+// start early, and what uses their results comes after independent work.
+//
+// Physical registers stay close to where instruction selection put them,
+// since each instruction in between keeps one from the allocator. An
+// instruction defining one that the very next instruction reads is glued
+// to it (cltd and idiv, the count of a shift and the shift); any other
+// instruction defining or reading one, such as the argument moves of a
+// call, moves no earlier than it was and is issued as soon as it may.
+//
+// A region may keep no more values live at once than there are
+// registers, or than its original order does if that is more; past the
+// limit, the instruction that ends the most values goes first. Values
+// living across calls count against the callee-saved registers too, and
+// before a call what only feeds such values is left for last. Since the
+// allocator gives each value a single interval, that cannot see all it
+// does: allocation_cost then compares the new order with the original,
+// and regions that make the allocator spill more go back to theirs.
+
+#define ISSUE_WIDTH 4
+#define REGION_LIMIT 256         // Longer regions are scheduled in pieces
+#define LOAD_LATENCY 5
+#define REGISTER_BUDGET 13       // Registers allocate_registers hands out
+#define SAVED_BUDGET 5           // Callee-saved ones among them
+
+typedef enum {
+    PORT_ALU, PORT_MULTIPLY, PORT_DIVIDE, PORT_LOAD, PORT_STORE,
+    PORT_VECTOR, PORT_VECTOR_MULTIPLY, PORT_SHUFFLE, PORT_COUNT
+} PortClass;
+
+// Instructions of each class a cycle can start
+static const int port_capacity[PORT_COUNT] = {4, 1, 1, 2, 1, 3, 2, 1};
+
+typedef struct {
+    int to;
+    int latency;
+    int next;                // Next edge out of the same node, or -1
+} Edge;
+
+// An instruction, or instructions glued together, scheduled as one
+typedef struct {
+    int first;               // Region positions of its instructions
+    int last;
+    int latency;             // Cycles from its issue until its last result
+    int height;              // Longest latency path from its issue to the region's end
+    int ports[PORT_COUNT];
+    int divide_cycles;       // Cycles the divider stays busy
+    int edges;               // First outgoing edge, or -1
+    int pending;             // Predecessors not scheduled yet
+    int ready_cycle;
+    bool pinned;             // Issued no earlier than the nodes before it
+    bool writes_flags;
+    int flag_source;         // Node whose flags it reads, or -1
+    int flag_readers;        // Readers of its flags not scheduled yet
+    bool deferred;           // Only feeds values live across the next call
+    bool scheduled;
+} Node;
+
+// A memory operand, as far as telling accesses apart goes
+typedef struct {
+    int position;
+    bool is_store;
+    const Operand* operand;
+    int version;             // Definitions of the base register before it
+} Access;
+
+typedef struct {
+    CodeGenerator* gen;
+    AsmItem* items;          // The region
+    int count;
+    int base;                // Body position of its first instruction
+    int key_count;
+    // Per region, indexed by register key and reset after each
+    int* uses_left;
+    int* last_def;           // Position, or -1
+    int* reads;              // First entry of the reads since the last definition
+    int* version;
+    bool* defined;
+    bool* live;
+    bool* crosses_call;      // By virtual register, whether its interval spans a call
+    int* touched;            // Keys to reset
+    int touched_count;
+    bool* is_touched;
+    // Per region
+    int* read_next;          // Pool of read lists: position and next entry
+    int* read_position;
+    int read_count;
+    Edge* edges;
+    int edge_count;
+    int edge_capacity;
+    Node* nodes;
+    int node_count;
+    int* node_of;            // Node of each position
+    int* offset;             // Cycles from its node's issue until its result
+    Access* accesses;
+    int access_count;
+} Scheduler;
+
+static bool is_barrier(const MInst* inst) {
+    switch (inst->opcode) {
+        case X86_JMP: case X86_JCC: case X86_CALL: case X86_RET: case X86_LEAVE:
+        case X86_PUSH: case X86_POP: case X86_VZEROUPPER:
+            return true;
+        default:
+            break;
+    }
+    RegisterEffects effects;
+    minst_effects(inst, &effects);
+    for (int i = 0; i < effects.use_count; i++) {
+        if (effects.uses[i] == REG_RSP) return true;
+    }
+    for (int i = 0; i < effects.def_count; i++) {
+        if (effects.defs[i] == REG_RSP) return true;
+    }
+    return false;
+}
+
+// Registers instruction selection only uses for a few instructions at a
+// time: those the allocator hands out, and %rax, which it reloads spilled
+// values into
+static bool is_physical(int reg) {
+    return reg < VREG_BASE && reg != REG_RSP && reg != REG_RBP;
+}
+
+static bool is_memory(const Operand* operand) {
+    return operand->kind == OPERAND_MEMORY || operand->kind == OPERAND_SYMBOL ||
+           operand->kind == OPERAND_STRING;
+}
+
+static bool reads_flags(const MInst* inst) {
+    return inst->opcode == X86_JCC || inst->opcode == X86_SETCC || inst->opcode == X86_CMOV;
+}
+
+// Shifts only leave the flags alone for a count of zero, so they count
+static bool writes_flags(const MInst* inst) {
+    switch (inst->opcode) {
+        case X86_MOV: case X86_MOVABS: case X86_MOVSX: case X86_MOVZX: case X86_LEA:
+        case X86_NOT: case X86_SETCC: case X86_CMOV: case X86_CLTD: case X86_CQTO:
+            return false;
+        default:
+            return !minst_is_vector(inst);
+    }
+}
+
+static bool loads(const MInst* inst) {
+    if (inst->opcode == X86_LEA) return false;
+    if (is_memory(&inst->src)) return true;
+    if (!is_memory(&inst->dst)) return false;
+    switch (inst->opcode) {
+        case X86_MOV: case X86_MOVD: case X86_MOVDQU: case X86_MOVDQA: case X86_SETCC:
+        case X86_VEXTRACTI128:
+            return false;
+        default:
+            return true;
+    }
+}
+
+static bool stores(const MInst* inst) {
+    return is_memory(&inst->dst) && inst->opcode != X86_CMP && inst->opcode != X86_TEST;
+}
+
+static PortClass port_class(const MInst* inst) {
+    switch (inst->opcode) {
+        case X86_IMUL: case X86_MUL:
+            return PORT_MULTIPLY;
+        case X86_IDIV: case X86_DIV:
+            return PORT_DIVIDE;
+        case X86_PMULLD: case X86_PMULUDQ: case X86_PSLLD: case X86_PSRLD: case X86_PSRAD:
+        case X86_PSLLQ: case X86_PSRLQ:
+            return PORT_VECTOR_MULTIPLY;
+        case X86_MOVD: case X86_PSRLDQ: case X86_PUNPCKLDQ: case X86_PUNPCKLQDQ:
+        case X86_VPBROADCASTD: case X86_VEXTRACTI128:
+            return PORT_SHUFFLE;
+        default:
+            return minst_is_vector(inst) ? PORT_VECTOR : PORT_ALU;
+    }
+}
+
+// Cycles until the result can be used, L1 hits assumed for loads
+static int latency(const MInst* inst) {
+    int cycles = 1;
+    switch (inst->opcode) {
+        case X86_IMUL: cycles = 3; break;
+        case X86_MUL: cycles = 4; break;
+        case X86_IDIV: case X86_DIV: cycles = minst_size(inst) == 8 ? 42 : 26; break;
+        case X86_PMULLD: cycles = 10; break;
+        case X86_PMULUDQ: cycles = 5; break;
+        case X86_VPBROADCASTD: case X86_VEXTRACTI128: cycles = 3; break;
+        case X86_MOVD: cycles = 2; break;
+        default: break;
+    }
+    return loads(inst) ? cycles + LOAD_LATENCY : cycles;
+}
+
+// Whether an instruction does any work beyond moving memory in or out
+static bool computes(const MInst* inst) {
+    switch (inst->opcode) {
+        case X86_MOV: case X86_MOVSX: case X86_MOVZX: case X86_MOVDQU: case X86_MOVDQA:
+            return !loads(inst) && !stores(inst);
+        default:
+            return true;
+    }
+}
+
+static int vector_key(Scheduler* s, int reg) {
+    return VREG_BASE + s->gen->vreg_count + reg;
+}
+
+// Registers an instruction reads and writes, the SSE ones included: a
+// vector destination is taken to be read as well
+static void effects_of(Scheduler* s, const MInst* inst, RegisterEffects* effects) {
+    minst_effects(inst, effects);
+    if (inst->src.kind == OPERAND_VECTOR && effects->use_count < 8) {
+        effects->uses[effects->use_count++] = vector_key(s, inst->src.reg);
+    }
+    if (inst->dst.kind == OPERAND_VECTOR && effects->use_count < 8 && effects->def_count < 12) {
+        effects->uses[effects->use_count++] = vector_key(s, inst->dst.reg);
+        effects->defs[effects->def_count++] = vector_key(s, inst->dst.reg);
+    }
+}
+
+static void touch(Scheduler* s, int key) {
+    if (s->is_touched[key]) return;
+    s->is_touched[key] = true;
+    s->touched[s->touched_count++] = key;
+}
+
+static void add_edge(Scheduler* s, int from, int to, int cycles) {
+    int a = s->node_of[from], b = s->node_of[to];
+    if (a == b) return;
+    if (s->edge_count == s->edge_capacity) {
+        s->edge_capacity = s->edge_capacity ? s->edge_capacity * 2 : 256;
+        s->edges = realloc(s->edges, sizeof(Edge) * s->edge_capacity);
+    }
+    s->edges[s->edge_count] = (Edge){b, cycles, s->nodes[a].edges};
+    s->nodes[a].edges = s->edge_count++;
+    s->nodes[b].pending++;
+}
+
+// Whether two memory accesses may touch the same bytes. The frame and
+// the globals are told apart, and so are disjoint ranges off one base
+// register holding one value.
+static bool may_alias(const Access* a, const Access* b) {
+    const Operand* x = a->operand;
+    const Operand* y = b->operand;
+    if (x->kind == OPERAND_STRING || y->kind == OPERAND_STRING) return false;
+    bool x_frame = x->kind == OPERAND_MEMORY && x->reg == REG_RBP;
+    bool y_frame = y->kind == OPERAND_MEMORY && y->reg == REG_RBP;
+    bool same_base;
+    if (x->kind == OPERAND_SYMBOL && y->kind == OPERAND_SYMBOL) {
+        same_base = strcmp(x->symbol, y->symbol) == 0;
+        if (!same_base) return false;
+    } else if (x->kind == OPERAND_SYMBOL || y->kind == OPERAND_SYMBOL) {
+        return !(x_frame || y_frame);
+    } else {
+        same_base = x->reg == y->reg && a->version == b->version;
+    }
+    if (!same_base) return true;
+    int x_size = x->size > 0 ? x->size : 32;
+    int y_size = y->size > 0 ? y->size : 32;
+    return x->value < y->value + y_size && y->value < x->value + x_size;
+}
+
+static void add_access(Scheduler* s, int position, const Operand* operand, bool is_store) {
+    Access access = {position, is_store, operand, 0};
+    if (operand->kind == OPERAND_MEMORY) {
+        touch(s, operand->reg);
+        access.version = s->version[operand->reg];
+    }
+    for (int i = 0; i < s->access_count; i++) {
+        Access* earlier = &s->accesses[i];
+        if (!earlier->is_store && !is_store) continue;
+        if (!may_alias(earlier, &access)) continue;
+        add_edge(s, earlier->position, position, earlier->is_store && !is_store ? 1 : 0);
+    }
+    s->accesses[s->access_count++] = access;
+}
+
+// Glue, pinning and the nodes. live_out has the physical registers read
+// after the region.
+static void build_nodes(Scheduler* s, unsigned int live_out) {
+    bool* glued = calloc(s->count + 1, sizeof(bool));
+    bool* pinned = calloc(s->count + 1, sizeof(bool));
+    unsigned int defined = 0;
+    for (int k = 0; k < s->count; k++) {
+        RegisterEffects effects;
+        minst_effects(&s->items[k].inst, &effects);
+        for (int i = 0; i < effects.use_count; i++) {
+            int reg = effects.uses[i];
+            if (is_physical(reg) && !(defined & (1u << reg))) pinned[k] = true;
+        }
+        for (int i = 0; i < effects.def_count; i++) {
+            int reg = effects.defs[i];
+            if (!is_physical(reg)) continue;
+            defined |= 1u << reg;
+            // Where the value goes next: read or overwritten, or out
+            bool read = (live_out >> reg) & 1;
+            int reader = -1;
+            for (int j = k + 1; j < s->count && reader < 0; j++) {
+                RegisterEffects later;
+                minst_effects(&s->items[j].inst, &later);
+                bool uses = false, defines = false;
+                for (int u = 0; u < later.use_count; u++) uses |= later.uses[u] == reg;
+                for (int d = 0; d < later.def_count; d++) defines |= later.defs[d] == reg;
+                if (uses) {
+                    reader = j;
+                } else if (defines) {
+                    read = false;
+                    break;
+                }
+            }
+            if (reader == k + 1) {
+                glued[k] = true;
+            } else if (reader >= 0 || read) {
+                pinned[k] = true;
+            }
+        }
+    }
+
+    s->node_count = 0;
+    for (int k = 0; k < s->count; k++) {
+        bool starts = k == 0 || !glued[k - 1];
+        if (starts) {
+            Node* node = &s->nodes[s->node_count++];
+            memset(node, 0, sizeof(Node));
+            node->first = k;
+            node->edges = -1;
+            node->flag_source = -1;
+        }
+        Node* node = &s->nodes[s->node_count - 1];
+        const MInst* inst = &s->items[k].inst;
+        node->last = k;
+        node->latency += latency(inst);
+        node->pinned |= pinned[k];
+        if (loads(inst)) node->ports[PORT_LOAD]++;
+        if (stores(inst)) node->ports[PORT_STORE]++;
+        if (computes(inst)) node->ports[port_class(inst)]++;
+        if (inst->opcode == X86_IDIV || inst->opcode == X86_DIV) {
+            node->divide_cycles += minst_size(inst) == 8 ? 24 : 6;
+        }
+        s->node_of[k] = s->node_count - 1;
+        s->offset[k] = node->latency;
+    }
+    free(glued);
+    free(pinned);
+}
+
+// Dependences through registers, the flags and memory
+static void build_edges(Scheduler* s, bool flags_live_out) {
+    s->edge_count = 0;
+    s->read_count = 0;
+    s->access_count = 0;
+    int flag_writer = -1;        // Last to write the flags
+    for (int k = 0; k < s->count; k++) {
+        const MInst* inst = &s->items[k].inst;
+        RegisterEffects effects;
+        effects_of(s, inst, &effects);
+
+        for (int i = 0; i < effects.use_count; i++) {
+            int key = effects.uses[i];
+            touch(s, key);
+            if (s->last_def[key] >= 0) add_edge(s, s->last_def[key], k, s->offset[s->last_def[key]]);
+            s->read_position[s->read_count] = k;
+            s->read_next[s->read_count] = s->reads[key];
+            s->reads[key] = s->read_count++;
+        }
+        for (int i = 0; i < effects.def_count; i++) {
+            int key = effects.defs[i];
+            touch(s, key);
+            for (int r = s->reads[key]; r >= 0; r = s->read_next[r]) {
+                if (s->read_position[r] != k) add_edge(s, s->read_position[r], k, 0);
+            }
+            if (s->last_def[key] >= 0) add_edge(s, s->last_def[key], k, 0);
+            s->reads[key] = -1;
+            s->last_def[key] = k;
+            s->version[key]++;
+        }
+
+        // A reader takes the flags of the last writer. Those the region
+        // starts with come before any writer.
+        Node* node = &s->nodes[s->node_of[k]];
+        if (reads_flags(inst)) {
+            if (flag_writer >= 0) {
+                add_edge(s, flag_writer, k, 1);
+                node->flag_source = s->node_of[flag_writer];
+                s->nodes[node->flag_source].flag_readers++;
+            } else {
+                for (int j = k + 1; j < s->count; j++) {
+                    if (writes_flags(&s->items[j].inst)) add_edge(s, k, j, 0);
+                }
+            }
+        }
+        if (writes_flags(inst)) {
+            node->writes_flags = true;
+            flag_writer = k;
+        }
+
+        if (loads(inst)) add_access(s, k, is_memory(&inst->src) ? &inst->src : &inst->dst, false);
+        if (stores(inst)) add_access(s, k, &inst->dst, true);
+    }
+    // The flags left for what follows come from the last writer still
+    if (flags_live_out && flag_writer >= 0) {
+        s->nodes[s->node_of[flag_writer]].flag_readers++;
+        for (int k = 0; k < flag_writer; k++) {
+            if (writes_flags(&s->items[k].inst)) add_edge(s, k, flag_writer, 0);
+        }
+    }
+}
+
+// Other writers may go anywhere but between a writer and the readers of
+// its flags, which the scheduler sees to. Those a reader depends on must
+// so go before the writer it reads: the reader could not go otherwise.
+static void order_flags(Scheduler* s) {
+    int words = (s->node_count + 63) / 64;
+    unsigned long long* below = calloc((size_t)s->node_count * words + 1, sizeof(unsigned long long));
+    for (int n = s->node_count - 1; n >= 0; n--) {
+        unsigned long long* set = &below[(size_t)n * words];
+        for (int e = s->nodes[n].edges; e >= 0; e = s->edges[e].next) {
+            int to = s->edges[e].to;
+            set[to / 64] |= 1ULL << (to % 64);
+            for (int w = 0; w < words; w++) set[w] |= below[(size_t)to * words + w];
+        }
+    }
+    for (int r = 0; r < s->node_count; r++) {
+        int source = s->nodes[r].flag_source;
+        if (source < 0) continue;
+        for (int n = 0; n < s->node_count; n++) {
+            if (n == source || !s->nodes[n].writes_flags) continue;
+            if (below[(size_t)n * words + r / 64] & (1ULL << (r % 64))) add_edge(s, n, source, 0);
+        }
+    }
+    free(below);
+}
+
+// Whether the interval compute_live_ranges found for a register goes on
+// past the region
+static bool lives_out(Scheduler* s, int key) {
+    if (key < VREG_BASE || key >= VREG_BASE + s->gen->vreg_count) return false;
+    return s->gen->live_ranges[key - VREG_BASE].end > 2 * (s->base + s->count);
+}
+
+// Counts of live values: all of them, and those living across a call,
+// which only the callee-saved registers can hold
+typedef struct {
+    int values;
+    int saved;
+} Pressure;
+
+static void count(Scheduler* s, Pressure* pressure, int key, int change) {
+    pressure->values += change;
+    if (s->crosses_call[key - VREG_BASE]) pressure->saved += change;
+}
+
+// Register pressure change if a node were issued now
+static Pressure pressure_delta(Scheduler* s, const Node* node) {
+    Pressure delta = {0, 0};
+    for (int k = node->first; k <= node->last; k++) {
+        RegisterEffects effects;
+        minst_effects(&s->items[k].inst, &effects);
+        for (int i = 0; i < effects.use_count; i++) {
+            int key = effects.uses[i];
+            if (key >= VREG_BASE && s->live[key] && s->uses_left[key] == 1 && !lives_out(s, key)) {
+                count(s, &delta, key, -1);
+            }
+        }
+        for (int i = 0; i < effects.def_count; i++) {
+            int key = effects.defs[i];
+            if (key >= VREG_BASE && !s->live[key]) count(s, &delta, key, 1);
+        }
+    }
+    return delta;
+}
+
+static void issue(Scheduler* s, const Node* node, Pressure* pressure) {
+    for (int k = node->first; k <= node->last; k++) {
+        RegisterEffects effects;
+        minst_effects(&s->items[k].inst, &effects);
+        for (int i = 0; i < effects.use_count; i++) {
+            int key = effects.uses[i];
+            if (key < VREG_BASE) continue;
+            s->uses_left[key]--;
+            if (s->live[key] && s->uses_left[key] == 0 && !lives_out(s, key)) {
+                s->live[key] = false;
+                count(s, pressure, key, -1);
+            }
+        }
+        for (int i = 0; i < effects.def_count; i++) {
+            int key = effects.defs[i];
+            if (key < VREG_BASE || s->live[key]) continue;
+            if (s->uses_left[key] == 0 && !lives_out(s, key)) continue;
+            s->live[key] = true;
+            count(s, pressure, key, 1);
+        }
+    }
+}
+
+static bool exceeds(Scheduler* s, const Node* node, Pressure pressure, Pressure limit) {
+    Pressure delta = pressure_delta(s, node);
+    return pressure.values + delta.values > limit.values || pressure.saved + delta.saved > limit.saved;
+}
+
+// Whether a node may be issued once its operands are ready
+static bool may_issue(const Scheduler* s, int n, int first_pending, int undeferred, int flags_open) {
+    const Node* node = &s->nodes[n];
+    if (node->scheduled || node->pending > 0) return false;
+    if (node->pinned && n != first_pending) return false;
+    if (node->deferred && undeferred > 0) return false;
+    return !(node->writes_flags && flags_open >= 0);
+}
+
+// Pinned nodes when they may go, then the longest path, then the
+// original order
+static bool better(const Node* a, const Node* b) {
+    if (a->pinned != b->pinned) return a->pinned;
+    if (a->height != b->height) return a->height > b->height;
+    return a->first < b->first;
+}
+
+// Past the limit, the node adding the fewest live values, then the one
+// ready first
+static bool relieves(Scheduler* s, const Node* a, const Node* b) {
+    Pressure x = pressure_delta(s, a), y = pressure_delta(s, b);
+    if (x.saved != y.saved) return x.saved < y.saved;
+    if (x.values != y.values) return x.values < y.values;
+    if (a->ready_cycle != b->ready_cycle) return a->ready_cycle < b->ready_cycle;
+    return better(a, b);
+}
+
+// Values live at the start of the region, those read before any
+// definition in it, with the uses of each counted afresh
+static Pressure start_pressure(Scheduler* s) {
+    for (int i = 0; i < s->touched_count; i++) {
+        int key = s->touched[i];
+        s->uses_left[key] = 0;
+        s->defined[key] = false;
+        s->live[key] = false;
+    }
+    Pressure pressure = {0, 0};
+    for (int k = 0; k < s->count; k++) {
+        RegisterEffects effects;
+        minst_effects(&s->items[k].inst, &effects);
+        for (int i = 0; i < effects.use_count; i++) {
+            int key = effects.uses[i];
+            if (key < VREG_BASE) continue;
+            touch(s, key);
+            s->uses_left[key]++;
+            if (!s->defined[key] && !s->live[key]) {
+                s->live[key] = true;
+                count(s, &pressure, key, 1);
+            }
+        }
+        for (int i = 0; i < effects.def_count; i++) {
+            touch(s, effects.defs[i]);
+            s->defined[effects.defs[i]] = true;
+        }
+    }
+    return pressure;
+}
+
+// Before a call, the values that live across it take callee-saved
+// registers, of which there are few. The nodes that only lead to them go
+// last, after the argument moves, so that they overlap as little as
+// possible with values the region ends; so they must leave the physical
+// registers alone.
+static void defer_nodes(Scheduler* s) {
+    for (int n = s->node_count - 1; n >= 0; n--) {
+        Node* node = &s->nodes[n];
+        node->deferred = false;
+        if (node->pinned || node->ports[PORT_STORE] > 0) continue;
+        if (node->flag_source >= 0 || node->flag_readers > 0) continue;
+        bool feeds = false, others = false;
+        for (int e = node->edges; e >= 0; e = s->edges[e].next) {
+            if (s->nodes[s->edges[e].to].deferred) {
+                feeds = true;
+            } else {
+                others = true;
+            }
+        }
+        for (int k = node->first; k <= node->last; k++) {
+            RegisterEffects effects;
+            minst_effects(&s->items[k].inst, &effects);
+            for (int i = 0; i < effects.def_count; i++) {
+                others |= effects.defs[i] < VREG_BASE;
+                feeds |= lives_out(s, effects.defs[i]);
+            }
+        }
+        node->deferred = feeds && !others;
+    }
+}
+
+// Schedules a region in place, returning whether anything moved, returning whether anything moved
+static bool schedule_region(Scheduler* s, unsigned int live_out, bool flags_live_out, bool before_call) {
+    build_nodes(s, live_out);
+    build_edges(s, flags_live_out);
+    order_flags(s);
+
+    // Edges only go forward, so heights come out back to front
+    for (int n = s->node_count - 1; n >= 0; n--) {
+        Node* node = &s->nodes[n];
+        node->height = node->latency;
+        for (int e = node->edges; e >= 0; e = s->edges[e].next) {
+            int height = s->edges[e].latency + s->nodes[s->edges[e].to].height;
+            if (height > node->height) node->height = height;
+        }
+    }
+
+    // Values live across the region take registers too. Up to the rest,
+    // or to as many as the original order keeps live at once if that is
+    // more, values may be live at the same time; the same goes for those
+    // living across calls and the callee-saved registers.
+    Pressure pressure = start_pressure(s);
+    Pressure limit = pressure;
+    for (int n = 0; n < s->node_count; n++) {
+        issue(s, &s->nodes[n], &pressure);
+        if (pressure.values > limit.values) limit.values = pressure.values;
+        if (pressure.saved > limit.saved) limit.saved = pressure.saved;
+    }
+    Pressure through = {0, 0};
+    for (int v = 0; v < s->gen->vreg_count; v++) {
+        const LiveRange* range = &s->gen->live_ranges[v];
+        if (range->start >= 0 && range->start < 2 * s->base && range->end > 2 * (s->base + s->count) &&
+            !s->is_touched[VREG_BASE + v]) {
+            count(s, &through, VREG_BASE + v, 1);
+        }
+    }
+    if (REGISTER_BUDGET - through.values > limit.values) limit.values = REGISTER_BUDGET - through.values;
+    if (SAVED_BUDGET - through.saved > limit.saved) limit.saved = SAVED_BUDGET - through.saved;
+    pressure = start_pressure(s);
+
+    int* order = malloc(sizeof(int) * (s->count + 1));
+    int order_count = 0;
+    int first_pending = 0;       // Lowest node neither scheduled nor deferred
+    int undeferred = 0;          // Nodes not deferred left
+    int flags_open = -1;         // Writer whose flags are still to be read
+    if (before_call) defer_nodes(s);
+    for (int n = 0; n < s->node_count; n++) undeferred += !s->nodes[n].deferred;
+    while (first_pending < s->node_count && s->nodes[first_pending].deferred) first_pending++;
+    int cycle = 0;
+    int divider_free = 0;
+    while (order_count < s->count) {
+        int used[PORT_COUNT] = {0};
+        int issued = 0;
+        for (;;) {
+            int best = -1;
+            bool waiting = false;        // For an operand, within the limit
+            for (int n = 0; n < s->node_count; n++) {
+                Node* node = &s->nodes[n];
+                if (!may_issue(s, n, first_pending, undeferred, flags_open)) continue;
+                if (!node->pinned && exceeds(s, node, pressure, limit)) continue;
+                if (node->ready_cycle > cycle || (node->divide_cycles > 0 && divider_free > cycle)) {
+                    waiting = true;
+                    continue;
+                }
+                int width = node->last - node->first + 1;
+                if (issued > 0 && issued + width > ISSUE_WIDTH) continue;
+                bool fits = true;
+                for (int p = 0; p < PORT_COUNT && fits; p++) {
+                    fits = node->ports[p] == 0 || issued == 0 || used[p] + node->ports[p] <= port_capacity[p];
+                }
+                if (!fits) continue;
+                if (best < 0 || better(node, &s->nodes[best])) best = n;
+            }
+            // Only nodes past the limit left: the one that least exceeds it
+            if (best < 0 && issued == 0 && !waiting) {
+                for (int n = 0; n < s->node_count; n++) {
+                    if (!may_issue(s, n, first_pending, undeferred, flags_open)) continue;
+                    if (best < 0 || relieves(s, &s->nodes[n], &s->nodes[best])) best = n;
+                }
+            }
+            if (best < 0) break;
+
+            Node* node = &s->nodes[best];
+            node->scheduled = true;
+            undeferred -= !node->deferred;
+            issued += node->last - node->first + 1;
+            for (int p = 0; p < PORT_COUNT; p++) used[p] += node->ports[p];
+            int start = node->ready_cycle > cycle ? node->ready_cycle : cycle;
+            if (node->divide_cycles > 0 && divider_free > start) start = divider_free;
+            if (node->divide_cycles > 0) divider_free = start + node->divide_cycles;
+            issue(s, node, &pressure);
+            if (node->writes_flags && node->flag_readers > 0) flags_open = best;
+            if (node->flag_source >= 0 && --s->nodes[node->flag_source].flag_readers == 0 &&
+                flags_open == node->flag_source) {
+                flags_open = -1;
+            }
+            for (int k = node->first; k <= node->last; k++) order[order_count++] = k;
+            for (int e = node->edges; e >= 0; e = s->edges[e].next) {
+                Node* successor = &s->nodes[s->edges[e].to];
+                successor->pending--;
+                if (start + s->edges[e].latency > successor->ready_cycle) {
+                    successor->ready_cycle = start + s->edges[e].latency;
+                }
+            }
+            while (first_pending < s->node_count &&
+                   (s->nodes[first_pending].scheduled || s->nodes[first_pending].deferred)) {
+                first_pending++;
+            }
+            if (issued >= ISSUE_WIDTH) break;
+        }
+
+        // Nothing could start: on to the first cycle something can. Should
+        // nothing ever, the region stays as it is.
+        int next = cycle + 1;
+        if (issued == 0) {
+            next = -1;
+            for (int n = 0; n < s->node_count; n++) {
+                Node* node = &s->nodes[n];
+                if (!may_issue(s, n, first_pending, undeferred, flags_open)) continue;
+                int ready = node->ready_cycle;
+                if (node->divide_cycles > 0 && divider_free > ready) ready = divider_free;
+                if (ready <= cycle) ready = cycle + 1;
+                if (next < 0 || ready < next) next = ready;
+            }
+            if (next < 0) {
+                for (int k = 0; k < s->count; k++) order[k] = k;
+                break;
+            }
+        }
+        cycle = next;
+    }
+
+    bool moved = false;
+    AsmItem* copy = malloc(sizeof(AsmItem) * (s->count + 1));
+    memcpy(copy, s->items, sizeof(AsmItem) * s->count);
+    for (int k = 0; k < s->count; k++) {
+        s->items[k] = copy[order[k]];
+        moved |= order[k] != k;
+    }
+    free(copy);
+    free(order);
+
+    for (int i = 0; i < s->touched_count; i++) {
+        int key = s->touched[i];
+        s->is_touched[key] = false;
+        s->uses_left[key] = 0;
+        s->last_def[key] = -1;
+        s->reads[key] = -1;
+        s->version[key] = 0;
+        s->defined[key] = false;
+        s->live[key] = false;
+    }
+    s->touched_count = 0;
+    return moved;
+}
+
+typedef struct {
+    int start;
+    int end;
+} Region;
+
+void schedule_instructions(CodeGenerator* gen) {
+    AsmList* body = &gen->body;
+    Scheduler s;
+    memset(&s, 0, sizeof(s));
+    s.gen = gen;
+    s.key_count = VREG_BASE + gen->vreg_count + 16;
+    s.uses_left = calloc(s.key_count, sizeof(int));
+    s.last_def = malloc(sizeof(int) * s.key_count);
+    s.reads = malloc(sizeof(int) * s.key_count);
+    s.version = calloc(s.key_count, sizeof(int));
+    s.defined = calloc(s.key_count, sizeof(bool));
+    s.live = calloc(s.key_count, sizeof(bool));
+    s.touched = malloc(sizeof(int) * s.key_count);
+    s.is_touched = calloc(s.key_count, sizeof(bool));
+    for (int key = 0; key < s.key_count; key++) {
+        s.last_def[key] = -1;
+        s.reads[key] = -1;
+    }
+    int pool = REGION_LIMIT * 8;
+    s.read_next = malloc(sizeof(int) * pool);
+    s.read_position = malloc(sizeof(int) * pool);
+    s.nodes = malloc(sizeof(Node) * REGION_LIMIT);
+    s.node_of = malloc(sizeof(int) * REGION_LIMIT);
+    s.offset = malloc(sizeof(int) * REGION_LIMIT);
+    s.accesses = malloc(sizeof(Access) * REGION_LIMIT * 2);
+
+    // Where each value lives, to know which of them the regions end and
+    // which live across calls, and what allocating the original order costs
+    int original_cost = allocation_cost(gen);
+    s.crosses_call = calloc(gen->vreg_count + 1, sizeof(bool));
+    int* calls = malloc(sizeof(int) * (body->count + 1));
+    int call_count = 0;
+    for (int k = 0; k < body->count; k++) {
+        if (body->items[k].kind == ITEM_INSTRUCTION && body->items[k].inst.opcode == X86_CALL) {
+            calls[call_count++] = 2 * k;
+        }
+    }
+    for (int v = 0; v < gen->vreg_count; v++) {
+        const LiveRange* range = &gen->live_ranges[v];
+        int low = 0, high = call_count;
+        while (low < high) {
+            int middle = (low + high) / 2;
+            if (calls[middle] <= range->start) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        s.crosses_call[v] = range->start >= 0 && low < call_count && calls[low] < range->end;
+    }
+    free(calls);
+    AsmItem* original = malloc(sizeof(AsmItem) * (body->count + 1));
+    memcpy(original, body->items, sizeof(AsmItem) * body->count);
+    Region* regions = malloc(sizeof(Region) * (body->count + 1));
+    int region_count = 0;
+
+    int start = 0;
+    while (start < body->count) {
+        AsmItem* item = &body->items[start];
+        if (item->kind != ITEM_INSTRUCTION || is_barrier(&item->inst)) {
+            start++;
+            continue;
+        }
+        int end = start;
+        while (end < body->count && end - start < REGION_LIMIT && body->items[end].kind == ITEM_INSTRUCTION &&
+               !is_barrier(&body->items[end].inst)) {
+            end++;
+        }
+
+        // What follows may read the flags and the physical registers
+        // left in it, unless it is a call or leaves the function; a piece
+        // of a longer region keeps them all
+        unsigned int live_out = 0;
+        bool flags_live_out = true;
+        bool before_call = false;
+        if (end - start == REGION_LIMIT) {
+            live_out = 0xffff;
+        } else if (end < body->count && body->items[end].kind == ITEM_INSTRUCTION) {
+            const MInst* next = &body->items[end].inst;
+            RegisterEffects effects;
+            minst_effects(next, &effects);
+            for (int i = 0; i < effects.use_count; i++) {
+                if (effects.uses[i] < VREG_BASE) live_out |= 1u << effects.uses[i];
+            }
+            before_call = next->opcode == X86_CALL;
+            flags_live_out = !(next->opcode == X86_CALL || minst_is_tail_call(next) ||
+                               (next->opcode == X86_JMP && next->dst.value == LABEL_RETURN));
+        }
+
+        s.items = &body->items[start];
+        s.count = end - start;
+        s.base = start;
+        if (s.count > 1 && schedule_region(&s, live_out, flags_live_out, before_call)) {
+            regions[region_count++] = (Region){start, end};
+        }
+        start = end;
+    }
+
+    // The allocator has the last word. When the new order would make it
+    // spill more, regions go back to the original one by one for as long
+    // as that helps.
+    int cost = allocation_cost(gen);
+    AsmItem* scheduled = malloc(sizeof(AsmItem) * (REGION_LIMIT + 1));
+    for (int r = 0; r < region_count && cost > original_cost; r++) {
+        AsmItem* items = &body->items[regions[r].start];
+        size_t size = sizeof(AsmItem) * (regions[r].end - regions[r].start);
+        memcpy(scheduled, items, size);
+        memcpy(items, &original[regions[r].start], size);
+        int reverted = allocation_cost(gen);
+        if (reverted < cost) {
+            cost = reverted;
+        } else {
+            memcpy(items, scheduled, size);
+        }
+    }
+    free(scheduled);
+    free(original);
+    free(regions);
+
+    free(s.uses_left);
+    free(s.last_def);
+    free(s.reads);
+    free(s.version);
+    free(s.defined);
+    free(s.live);
+    free(s.crosses_call);
+    free(s.touched);
+    free(s.is_touched);
+    free(s.read_next);
+    free(s.read_position);
+    free(s.edges);
+    free(s.nodes);
+    free(s.node_of);
+    free(s.offset);
+    free(s.accesses);
+}
@@ -2,28 +2,202 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
+
+// Store an expression's type, replacing any type from an earlier check
+static Type* set_type(Expression* expr, Type* type) {
+    free_type(expr->expr_type);
+    expr->expr_type = type;
+    return type;
+}
+
+static Type* int_type(void) {
+    return create_basic_type(TYPE_INT, false, false);
+}
+
+static bool is_null_constant(Expression* expr) {
+    return expr->type == NODE_LITERAL && expr->token->type == TOKEN_INTEGER_LITERAL &&
+           expr->token->value.int_value == 0;
+}
+
+// Integer promotion: bool, char and short become int
+static Type* promote(Type* type) {
+    if (type->kind == TYPE_BOOL || type->kind == TYPE_CHAR || type->kind == TYPE_SHORT) {
+        return int_type();
+    }
+    Type* copy = copy_type(type);
+    copy->is_const = false;
+    copy->is_volatile = false;
+    return copy;
+}
+
+static bool is_lvalue(SemanticAnalyzer* analyzer, Expression* expr) {
+    if (expr->type == NODE_IDENTIFIER) {
+        SymbolEntry* entry = lookup_symbol(analyzer, expr->token->lexeme);
+        return entry != NULL && entry->kind == SYMBOL_VARIABLE && !entry->info.var.is_array;
+    }
+    return expr->type == NODE_UNARY_OP && expr->op == TOKEN_STAR && expr->as.unary.prefix;
+}
+
+// Value of type `value` assigned to `target`, reporting a mismatch at `token`
+static bool check_assignable(SemanticAnalyzer* analyzer, Token* token, Type* target,
+                             Expression* value, const char* message) {
+    if (value->expr_type == NULL) return false;
+    if (is_pointer_type(target) && is_integer_type(value->expr_type) && is_null_constant(value)) {
+        return true;
+    }
+    if (!is_type_compatible(target, value->expr_type)) {
+        semantic_error(analyzer, token, message);
+        return false;
+    }
+    return true;
+}
+
+// The x86-64 backend has no floating-point support
+static bool uses_floating_point(const Type* type) {
+    if (type == NULL) return false;
+    switch (type->kind) {
+        case TYPE_FLOAT:
+        case TYPE_DOUBLE:
+            return true;
+        case TYPE_POINTER:
+            return uses_floating_point(type->info.base);
+        case TYPE_ARRAY:
+            return uses_floating_point(type->info.array.elem_type);
+        case TYPE_FUNCTION:
+            for (int i = 0; i < type->info.func.param_count; i++) {
+                if (uses_floating_point(type->info.func.param_types[i])) return true;
+            }
+            return uses_floating_point(type->info.func.return_type);
+        default:
+            return false;
+    }
+}
 
 // Forward declarations for semantic analysis functions
 static Type* check_binary_expression(SemanticAnalyzer* analyzer, Expression* expr) {
     Type* left = check_expression(analyzer, expr->as.binary.left);
     Type* right = check_expression(analyzer, expr->as.binary.right);
-    
-    if (!is_type_compatible(left, right)) {
-        semantic_error(analyzer, expr->token, "Type mismatch in binary expression");
-        return NULL;
+    if (left == NULL || right == NULL) return NULL;
+
+    switch (expr->op) {
+        case TOKEN_PLUS:
+        case TOKEN_MINUS:
+            // Pointer arithmetic
+            if (is_pointer_type(left) && is_integer_type(right)) {
+                return set_type(expr, copy_type(left));
+            }
+            if (expr->op == TOKEN_PLUS && is_integer_type(left) && is_pointer_type(right)) {
+                return set_type(expr, copy_type(right));
+            }
+            if (expr->op == TOKEN_MINUS && is_pointer_type(left) && is_pointer_type(right)) {
+                if (!types_equal(left->info.base, right->info.base)) {
+                    semantic_error(analyzer, expr->token, "Subtraction of incompatible pointers");
+                    return NULL;
+                }
+                return set_type(expr, create_basic_type(TYPE_LONG, false, false));
+            }
+            // Fall through
+        case TOKEN_STAR:
+        case TOKEN_SLASH:
+            if (!is_arithmetic_type(left) || !is_arithmetic_type(right)) {
+                semantic_error(analyzer, expr->token, "Type mismatch in binary expression");
+                return NULL;
+            }
+            return set_type(expr, common_type(left, right));
+        case TOKEN_PERCENT:
+        case TOKEN_AMPERSAND:
+        case TOKEN_PIPE:
+        case TOKEN_CARET:
+            if (!is_integer_type(left) || !is_integer_type(right)) {
+                semantic_error(analyzer, expr->token, "Operands must be integers");
+                return NULL;
+            }
+            return set_type(expr, common_type(left, right));
+        case TOKEN_LESSLESS:
+        case TOKEN_GREATERGREATER:
+            if (!is_integer_type(left) || !is_integer_type(right)) {
+                semantic_error(analyzer, expr->token, "Operands must be integers");
+                return NULL;
+            }
+            return set_type(expr, promote(left));
+        case TOKEN_LESS:
+        case TOKEN_LESSEQUAL:
+        case TOKEN_GREATER:
+        case TOKEN_GREATEREQUAL:
+        case TOKEN_EQUALEQUAL:
+        case TOKEN_NOTEQUAL:
+            if (is_arithmetic_type(left) && is_arithmetic_type(right)) {
+                return set_type(expr, int_type());
+            }
+            if ((is_pointer_type(left) && is_pointer_type(right)) ||
+                (is_pointer_type(left) && is_null_constant(expr->as.binary.right)) ||
+                (is_pointer_type(right) && is_null_constant(expr->as.binary.left))) {
+                return set_type(expr, int_type());
+            }
+            semantic_error(analyzer, expr->token, "Type mismatch in comparison");
+            return NULL;
+        case TOKEN_ANDAND:
+        case TOKEN_OROR:
+            if (!is_scalar_type(left) || !is_scalar_type(right)) {
+                semantic_error(analyzer, expr->token, "Operands must be scalars");
+                return NULL;
+            }
+            return set_type(expr, int_type());
+        default:
+            semantic_error(analyzer, expr->token, "Invalid binary operator");
+            return NULL;
     }
-    
-    return common_type(left, right);
 }
 
 static Type* check_unary_expression(SemanticAnalyzer* analyzer, Expression* expr) {
-    Type* operand = check_expression(analyzer, expr->as.unary.operand);
+    Expression* operand_expr = expr->as.unary.operand;
+    Type* operand = check_expression(analyzer, operand_expr);
     if (operand == NULL) return NULL;
-    
-    switch (expr->token->type) {
+
+    switch (expr->op) {
         case TOKEN_MINUS:
+        case TOKEN_PLUS:
+            if (!is_arithmetic_type(operand)) {
+                semantic_error(analyzer, expr->token, "Operand must be arithmetic");
+                return NULL;
+            }
+            return set_type(expr, promote(operand));
+        case TOKEN_TILDE:
+            if (!is_integer_type(operand)) {
+                semantic_error(analyzer, expr->token, "Operand must be an integer");
+                return NULL;
+            }
+            return set_type(expr, promote(operand));
         case TOKEN_BANG:
-            return operand;
+            if (!is_scalar_type(operand)) {
+                semantic_error(analyzer, expr->token, "Operand must be a scalar");
+                return NULL;
+            }
+            return set_type(expr, int_type());
+        case TOKEN_STAR:
+            if (!is_pointer_type(operand)) {
+                semantic_error(analyzer, expr->token, "Cannot dereference a non-pointer");
+                return NULL;
+            }
+            if (operand->info.base->kind == TYPE_VOID) {
+                semantic_error(analyzer, expr->token, "Cannot dereference a void pointer");
+                return NULL;
+            }
+            return set_type(expr, copy_type(operand->info.base));
+        case TOKEN_AMPERSAND:
+            if (!is_lvalue(analyzer, operand_expr)) {
+                semantic_error(analyzer, expr->token, "Cannot take the address of an rvalue");
+                return NULL;
+            }
+            return set_type(expr, create_pointer_type(copy_type(operand), false, false));
+        case TOKEN_PLUSPLUS:
+        case TOKEN_MINUSMINUS:
+            if (!is_lvalue(analyzer, operand_expr) || !is_scalar_type(operand)) {
+                semantic_error(analyzer, expr->token, "Operand of increment must be a scalar lvalue");
+                return NULL;
+            }
+            return set_type(expr, copy_type(operand));
         default:
             semantic_error(analyzer, expr->token, "Invalid unary operator");
             return NULL;
@@ -32,12 +206,25 @@ static Type* check_unary_expression(SemanticAnalyzer* analyzer, Expression* expr
 
 static Type* check_literal_expression(SemanticAnalyzer* analyzer, Expression* expr) {
     switch (expr->token->type) {
-        case TOKEN_INTEGER_LITERAL:
-            return create_basic_type(TYPE_INT, false, false);
+        case TOKEN_INTEGER_LITERAL: {
+            bool is_unsigned = strpbrk(expr->token->lexeme, "uU") != NULL &&
+                               expr->token->lexeme[0] != '\'';
+            bool is_long = strpbrk(expr->token->lexeme, "lL") != NULL &&
+                           expr->token->lexeme[0] != '\'';
+            long long value = expr->token->value.int_value;
+            if (value > (is_unsigned ? (long long)UINT_MAX : INT_MAX) || value < INT_MIN) {
+                is_long = true;
+            }
+            Type* type = create_basic_type(is_long ? TYPE_LONG : TYPE_INT, false, false);
+            type->is_unsigned = is_unsigned;
+            return set_type(expr, type);
+        }
         case TOKEN_FLOAT_LITERAL:
-            return create_basic_type(TYPE_FLOAT, false, false);
+            semantic_error(analyzer, expr->token, "Floating-point values are not supported");
+            return NULL;
         case TOKEN_STRING_LITERAL:
-            return create_basic_type(TYPE_CHAR, true, false);
+            return set_type(expr, create_pointer_type(create_basic_type(TYPE_CHAR, false, false),
+                                                      false, false));
         default:
             semantic_error(analyzer, expr->token, "Invalid literal type");
             return NULL;
@@ -50,27 +237,127 @@ static Type* check_identifier_expression(SemanticAnalyzer* analyzer, Expression*
         semantic_error(analyzer, expr->token, "Undefined variable");
         return NULL;
     }
-    return entry->type;
+
+    // Arrays decay to a pointer to their first element
+    expr->as.identifier.is_array = entry->type->kind == TYPE_ARRAY;
+    if (entry->type->kind == TYPE_ARRAY) {
+        return set_type(expr, create_pointer_type(copy_type(entry->type->info.array.elem_type),
+                                                  false, false));
+    }
+    return set_type(expr, copy_type(entry->type));
 }
 
 static Type* check_call_expression(SemanticAnalyzer* analyzer, Expression* expr) {
     Type* callee_type = check_expression(analyzer, expr->as.call.callee);
     if (callee_type == NULL) return NULL;
-    
+
     if (callee_type->kind != TYPE_FUNCTION) {
         semantic_error(analyzer, expr->token, "Cannot call non-function type");
         return NULL;
     }
-    
-    return callee_type->info.func.return_type;
+
+    FunctionType* func = &callee_type->info.func;
+    int arg_count = expr->as.call.arg_count;
+    if (arg_count < func->param_count || (arg_count > func->param_count && !func->is_variadic)) {
+        semantic_error(analyzer, expr->token, "Wrong number of arguments in call");
+        return NULL;
+    }
+
+    bool ok = true;
+    for (int i = 0; i < arg_count; i++) {
+        Expression* arg = expr->as.call.args[i];
+        if (check_expression(analyzer, arg) == NULL) {
+            ok = false;
+        } else if (i < func->param_count) {
+            ok &= check_assignable(analyzer, arg->token, func->param_types[i], arg,
+                                   "Argument type does not match parameter type");
+        } else if (!is_scalar_type(arg->expr_type)) {
+            semantic_error(analyzer, arg->token, "Invalid variadic argument");
+            ok = false;
+        }
+    }
+    if (!ok) return NULL;
+
+    return set_type(expr, copy_type(func->return_type));
 }
 
-static void check_if_statement(SemanticAnalyzer* analyzer, Statement* stmt) {
-    Type* condition = check_expression(analyzer, stmt->as.if_stmt.condition);
-    if (condition != NULL && condition->kind != TYPE_BOOL) {
-        semantic_error(analyzer, stmt->token, "Condition must be a boolean expression");
+static Type* check_assign_expression(SemanticAnalyzer* analyzer, Expression* expr) {
+    Expression* target = expr->as.binary.left;
+    Expression* value = expr->as.binary.right;
+    Type* target_type = check_expression(analyzer, target);
+    Type* value_type = check_expression(analyzer, value);
+    if (target_type == NULL || value_type == NULL) return NULL;
+
+    if (!is_lvalue(analyzer, target)) {
+        semantic_error(analyzer, expr->token, "Expression is not assignable");
+        return NULL;
+    }
+    if (target_type->is_const) {
+        semantic_error(analyzer, expr->token, "Cannot assign to a const object");
+        return NULL;
+    }
+
+    switch (expr->op) {
+        case TOKEN_EQUALS:
+            if (!check_assignable(analyzer, expr->token, target_type, value,
+                                  "Type mismatch in assignment")) {
+                return NULL;
+            }
+            break;
+        case TOKEN_PLUSEQUAL:
+        case TOKEN_MINUSEQUAL:
+            if (is_pointer_type(target_type) && is_integer_type(value_type)) break;
+            // Fall through
+        case TOKEN_STAREQUAL:
+        case TOKEN_SLASHEQUAL:
+            if (!is_arithmetic_type(target_type) || !is_arithmetic_type(value_type) ||
+                (is_integer_type(target_type) && !is_integer_type(value_type))) {
+                semantic_error(analyzer, expr->token, "Type mismatch in compound assignment");
+                return NULL;
+            }
+            break;
+        default:
+            if (!is_integer_type(target_type) || !is_integer_type(value_type)) {
+                semantic_error(analyzer, expr->token, "Operands must be integers");
+                return NULL;
+            }
+            break;
+    }
+
+    Type* result = copy_type(target_type);
+    result->is_const = false;
+    result->is_volatile = false;
+    return set_type(expr, result);
+}
+
+static Type* check_cast_expression(SemanticAnalyzer* analyzer, Expression* expr) {
+    Type* operand = check_expression(analyzer, expr->as.cast.operand);
+    if (operand == NULL) return NULL;
+
+    Type* target = expr->as.cast.target != NULL ? expr->as.cast.target : expr->expr_type;
+    if (uses_floating_point(target)) {
+        semantic_error(analyzer, expr->token, "Floating-point values are not supported");
+        return NULL;
+    }
+    if (target->kind != TYPE_VOID && (!is_scalar_type(target) || !is_scalar_type(operand))) {
+        semantic_error(analyzer, expr->token, "Invalid cast");
+        return NULL;
     }
-    
+    if (expr->as.cast.target == NULL) return target;
+    return set_type(expr, copy_type(target));
+}
+
+// Conditions of if, while, do and for statements
+static void check_condition(SemanticAnalyzer* analyzer, Expression* condition, Token* token) {
+    Type* type = check_expression(analyzer, condition);
+    if (type != NULL && !is_scalar_type(type)) {
+        semantic_error(analyzer, token, "Condition must be a scalar expression");
+    }
+}
+
+static void check_if_statement(SemanticAnalyzer* analyzer, Statement* stmt) {
+    check_condition(analyzer, stmt->as.if_stmt.condition, stmt->token);
+
     check_statement(analyzer, stmt->as.if_stmt.then_branch);
     if (stmt->as.if_stmt.else_branch != NULL) {
         check_statement(analyzer, stmt->as.if_stmt.else_branch);
@@ -80,29 +367,26 @@ static void check_if_statement(SemanticAnalyzer* analyzer, Statement* stmt) {
 static void check_loop_statement(SemanticAnalyzer* analyzer, Statement* stmt) {
     bool was_in_loop = analyzer->in_loop;
     analyzer->in_loop = true;
-    
-    if (stmt->type == NODE_WHILE) {
-        Type* condition = check_expression(analyzer, stmt->as.while_stmt.condition);
-        if (condition != NULL && condition->kind != TYPE_BOOL) {
-            semantic_error(analyzer, stmt->token, "Condition must be a boolean expression");
-        }
+
+    if (stmt->type == NODE_WHILE || stmt->type == NODE_DO_WHILE) {
+        check_condition(analyzer, stmt->as.while_stmt.condition, stmt->token);
         check_statement(analyzer, stmt->as.while_stmt.body);
     } else if (stmt->type == NODE_FOR) {
+        // The initializer's declarations are local to the loop
+        enter_scope(analyzer);
         if (stmt->as.for_stmt.initializer != NULL) {
             check_statement(analyzer, stmt->as.for_stmt.initializer);
         }
         if (stmt->as.for_stmt.condition != NULL) {
-            Type* condition = check_expression(analyzer, stmt->as.for_stmt.condition);
-            if (condition != NULL && condition->kind != TYPE_BOOL) {
-                semantic_error(analyzer, stmt->token, "Condition must be a boolean expression");
-            }
+            check_condition(analyzer, stmt->as.for_stmt.condition, stmt->token);
         }
         if (stmt->as.for_stmt.increment != NULL) {
             check_statement(analyzer, stmt->as.for_stmt.increment);
         }
         check_statement(analyzer, stmt->as.for_stmt.body);
+        leave_scope(analyzer);
     }
-    
+
     analyzer->in_loop = was_in_loop;
 }
 
@@ -111,13 +395,18 @@ static void check_return_statement(SemanticAnalyzer* analyzer, Statement* stmt)
         semantic_error(analyzer, stmt->token, "Return statement outside of function");
         return;
     }
-    
-    if (stmt->as.return_stmt.value != NULL) {
-        Type* value_type = check_expression(analyzer, stmt->as.return_stmt.value);
-        if (value_type != NULL && !is_type_compatible(analyzer->current_function_return_type, value_type)) {
-            semantic_error(analyzer, stmt->token, "Return value type does not match function return type");
+
+    Type* return_type = analyzer->current_function_return_type;
+    Expression* value = stmt->as.return_stmt.value;
+    if (value != NULL) {
+        if (check_expression(analyzer, value) == NULL) return;
+        if (return_type->kind == TYPE_VOID) {
+            semantic_error(analyzer, stmt->token, "Void function cannot return a value");
+        } else {
+            check_assignable(analyzer, stmt->token, return_type, value,
+                             "Return value type does not match function return type");
         }
-    } else if (analyzer->current_function_return_type->kind != TYPE_VOID) {
+    } else if (return_type->kind != TYPE_VOID) {
         semantic_error(analyzer, stmt->token, "Function must return a value");
     }
 }
@@ -130,6 +419,10 @@ SemanticAnalyzer* semantic_init(void) {
     analyzer->in_loop = false;
     analyzer->had_error = false;
     analyzer->filename = NULL;
+    analyzer->diagnostics = stderr;
+
+    // File scope
+    enter_scope(analyzer);
     return analyzer;
 }
 
@@ -152,19 +445,16 @@ void enter_scope(SemanticAnalyzer* analyzer) {
 
 void leave_scope(SemanticAnalyzer* analyzer) {
     if (analyzer->current_scope == NULL) return;
-    
+
     // Free all symbols in current scope
     SymbolEntry* entry = analyzer->current_scope->entries;
     while (entry != NULL) {
         SymbolEntry* next = entry->next;
         free(entry->name);
-        if (entry->kind == SYMBOL_FUNCTION) {
-            free(entry->info.func.param_types);
-        }
         free(entry);
         entry = next;
     }
-    
+
     Scope* parent = analyzer->current_scope->parent;
     free(analyzer->current_scope);
     analyzer->current_scope = parent;
@@ -176,15 +466,25 @@ SymbolEntry* declare_symbol(SemanticAnalyzer* analyzer, char* name, Type* type,
     if (lookup_symbol_current_scope(analyzer, name)) {
         return NULL; // Symbol already declared in current scope
     }
-    
+
     SymbolEntry* entry = malloc(sizeof(SymbolEntry));
     entry->name = strdup(name);
     entry->type = type;
     entry->kind = kind;
     entry->is_defined = false;
+    if (kind == SYMBOL_FUNCTION) {
+        // Parameter types are read from the function type itself
+        entry->info.func.param_types = NULL;
+        entry->info.func.param_count = type->info.func.param_count;
+        entry->info.func.is_variadic = type->info.func.is_variadic;
+    } else {
+        entry->info.var.is_global = analyzer->current_scope->parent == NULL;
+        entry->info.var.is_array = type->kind == TYPE_ARRAY;
+        entry->info.var.offset = 0;
+    }
     entry->next = analyzer->current_scope->entries;
     analyzer->current_scope->entries = entry;
-    
+
     return entry;
 }
 
@@ -210,25 +510,88 @@ SymbolEntry* lookup_symbol_current_scope(SemanticAnalyzer* analyzer, char* name)
     return NULL;
 }
 
+#define CALL_REGISTERS 32        // What a call counts as taking
+
+// Registers two operands take, the one taking more evaluated first
+static int combine_registers(int left, int right) {
+    if (left == right) return left + 1;
+    return left > right ? left : right;
+}
+
+// Sethi-Ullman number of an expression whose operands are labelled. A
+// call clobbers the caller-saved registers, so whatever is held across it
+// is costly: calls count as taking more registers than there are, which
+// has them evaluated ahead of the operands next to them.
+static int label_registers(const Expression* expr) {
+    switch (expr->type) {
+        case NODE_BINARY_OP: {
+            int left = expr->as.binary.left->registers;
+            int right = expr->as.binary.right->registers;
+            // The left operand of && and || is tested before the right
+            // is evaluated
+            if (expr->op == TOKEN_ANDAND || expr->op == TOKEN_OROR) return left > right ? left : right;
+            return combine_registers(left, right);
+        }
+        case NODE_UNARY_OP: {
+            int operand = expr->as.unary.operand->registers;
+            if (expr->op == TOKEN_PLUSPLUS || expr->op == TOKEN_MINUSMINUS) return operand + 1;
+            return operand;
+        }
+        case NODE_CAST:
+            return expr->as.cast.operand->registers;
+        case NODE_CALL:
+            return CALL_REGISTERS;
+        case NODE_ASSIGN: {
+            // A variable is stored to directly; other targets take their
+            // address, and compound assignments the current value too
+            const Expression* target = expr->as.binary.left;
+            int value = expr->as.binary.right->registers;
+            int address = target->type == NODE_IDENTIFIER ? 0 : target->as.unary.operand->registers;
+            if (expr->op != TOKEN_EQUALS) address++;
+            return address == 0 ? value : combine_registers(address, value);
+        }
+        default:
+            return 1;
+    }
+}
+
 // Type checking functions
 Type* check_expression(SemanticAnalyzer* analyzer, Expression* expr) {
+    if (expr == NULL) return NULL;
+
+    Type* type;
     switch (expr->type) {
         case NODE_BINARY_OP:
-            return check_binary_expression(analyzer, expr);
+            type = check_binary_expression(analyzer, expr);
+            break;
         case NODE_UNARY_OP:
-            return check_unary_expression(analyzer, expr);
+            type = check_unary_expression(analyzer, expr);
+            break;
         case NODE_LITERAL:
-            return check_literal_expression(analyzer, expr);
+            type = check_literal_expression(analyzer, expr);
+            break;
         case NODE_IDENTIFIER:
-            return check_identifier_expression(analyzer, expr);
+            type = check_identifier_expression(analyzer, expr);
+            break;
         case NODE_CALL:
-            return check_call_expression(analyzer, expr);
+            type = check_call_expression(analyzer, expr);
+            break;
+        case NODE_ASSIGN:
+            type = check_assign_expression(analyzer, expr);
+            break;
+        case NODE_CAST:
+            type = check_cast_expression(analyzer, expr);
+            break;
         default:
             return NULL;
     }
+    if (type != NULL) expr->registers = label_registers(expr);
+    return type;
 }
 
 void check_statement(SemanticAnalyzer* analyzer, Statement* stmt) {
+    if (stmt == NULL) return;
+
     switch (stmt->type) {
         case NODE_IF:
             check_if_statement(analyzer, stmt);
@@ -244,12 +607,25 @@ void check_statement(SemanticAnalyzer* analyzer, Statement* stmt) {
         case NODE_DECLARATION:
             check_declaration(analyzer, stmt);
             break;
+        case NODE_FUNCTION:
+            check_function(analyzer, stmt);
+            break;
+        case NODE_EXPRESSION:
+            check_expression(analyzer, stmt->as.expression.expr);
+            break;
+        case NODE_BREAK:
+        case NODE_CONTINUE:
+            if (!analyzer->in_loop) {
+                semantic_error(analyzer, stmt->token, stmt->type == NODE_BREAK ?
+                               "'break' outside of a loop" : "'continue' outside of a loop");
+            }
+            break;
         case NODE_COMPOUND:
-            enter_scope(analyzer);
+            if (stmt->as.compound.scoped) enter_scope(analyzer);
             for (int i = 0; i < stmt->as.compound.count; i++) {
                 check_statement(analyzer, stmt->as.compound.statements[i]);
             }
-            leave_scope(analyzer);
+            if (stmt->as.compound.scoped) leave_scope(analyzer);
             break;
         default:
             break;
@@ -258,53 +634,358 @@ void check_statement(SemanticAnalyzer* analyzer, Statement* stmt) {
 
 void check_declaration(SemanticAnalyzer* analyzer, Statement* stmt) {
     if (stmt->type != NODE_DECLARATION) return;
-    
+
     // Check if variable name is already declared in current scope
     SymbolEntry* existing = lookup_symbol_current_scope(analyzer, stmt->as.declaration.name->lexeme);
     if (existing != NULL) {
         semantic_error(analyzer, stmt->token, "Variable already declared in this scope");
         return;
     }
-    
+
+    Type* var_type = stmt->as.declaration.var_type;
+    Expression* initializer = stmt->as.declaration.initializer;
+    if (var_type != NULL && var_type->kind == TYPE_VOID) {
+        semantic_error(analyzer, stmt->token, "Variable has void type");
+        return;
+    }
+    if (uses_floating_point(var_type)) {
+        semantic_error(analyzer, stmt->token, "Floating-point values are not supported");
+        return;
+    }
+
     // Check initializer expression if present
-    Type* init_type = NULL;
-    if (stmt->as.declaration.initializer != NULL) {
-        init_type = check_expression(analyzer, stmt->as.declaration.initializer);
+    if (initializer != NULL) {
+        Type* init_type = check_expression(analyzer, initializer);
         if (init_type == NULL) return;
+
+        if (var_type == NULL) {
+            // Untyped 'var' declarations take the initializer's type
+            var_type = stmt->as.declaration.var_type = copy_type(init_type);
+        } else if (var_type->kind == TYPE_ARRAY) {
+            semantic_error(analyzer, stmt->token, "Array initializers are not supported");
+            return;
+        } else if (!check_assignable(analyzer, stmt->token, var_type, initializer,
+                                     "Initializer type does not match variable type")) {
+            return;
+        }
+
+        if (analyzer->current_scope->parent == NULL && initializer->type != NODE_LITERAL &&
+            !(initializer->type == NODE_UNARY_OP && initializer->op == TOKEN_MINUS &&
+              initializer->as.unary.operand->type == NODE_LITERAL)) {
+            semantic_error(analyzer, stmt->token, "Global initializer must be a constant");
+            return;
+        }
+    } else if (var_type == NULL) {
+        var_type = stmt->as.declaration.var_type = int_type();
     }
-    
+
     // Declare the variable in current scope
-    Type* var_type = create_basic_type(TYPE_INT, false, false); // Default to int for now
-    declare_symbol(analyzer, stmt->as.declaration.name->lexeme, var_type, SYMBOL_VARIABLE);
+    SymbolEntry* entry = declare_symbol(analyzer, stmt->as.declaration.name->lexeme,
+                                        var_type, SYMBOL_VARIABLE);
+    entry->is_defined = !stmt->as.declaration.is_extern;
+}
+
+// Enter a function's name into the current scope, merging it with earlier
+// prototypes. Returns false after reporting a conflict.
+static bool declare_function(SemanticAnalyzer* analyzer, Statement* func) {
+    char* name = func->as.function.name->lexeme;
+    Type* type = func->as.function.type;
+    bool definition = func->as.function.body != NULL;
+
+    SymbolEntry* existing = lookup_symbol_current_scope(analyzer, name);
+    if (existing == NULL) {
+        SymbolEntry* entry = declare_symbol(analyzer, name, type, SYMBOL_FUNCTION);
+        entry->is_defined = definition;
+        return true;
+    }
+
+    if (existing->kind != SYMBOL_FUNCTION || !types_equal(existing->type, type)) {
+        semantic_error(analyzer, func->token, "Conflicting types for function");
+        return false;
+    }
+    if (definition && existing->is_defined) {
+        semantic_error(analyzer, func->token, "Function already defined");
+        return false;
+    }
+    if (definition) {
+        existing->type = type;
+        existing->is_defined = true;
+    }
+    return true;
+}
+
+void check_function(SemanticAnalyzer* analyzer, Statement* func) {
+    if (analyzer->current_function_return_type != NULL && func->as.function.body != NULL) {
+        semantic_error(analyzer, func->token, "Function definition is not allowed here");
+        return;
+    }
+    if (uses_floating_point(func->as.function.type)) {
+        semantic_error(analyzer, func->token, "Floating-point values are not supported");
+        return;
+    }
+    if (!declare_function(analyzer, func)) return;
+
+    Statement* body = func->as.function.body;
+    if (body == NULL || func->as.function.is_unreachable) return;
+
+    // Parameters share the scope of the function body's outermost block
+    Type* type = func->as.function.type;
+    enter_scope(analyzer);
+    for (int i = 0; i < func->as.function.param_count; i++) {
+        Token* param = func->as.function.params[i];
+        if (param == NULL) {
+            semantic_error(analyzer, func->token, "Parameter name omitted");
+            continue;
+        }
+        if (declare_symbol(analyzer, param->lexeme, type->info.func.param_types[i],
+                           SYMBOL_VARIABLE) == NULL) {
+            semantic_error(analyzer, param, "Duplicate parameter name");
+        }
+    }
+
+    analyzer->current_function_return_type = type->info.func.return_type;
+    for (int i = 0; i < body->as.compound.count; i++) {
+        check_statement(analyzer, body->as.compound.statements[i]);
+    }
+    analyzer->current_function_return_type = NULL;
+    leave_scope(analyzer);
+}
+
+// File-scope checking
+void check_toplevel(SemanticAnalyzer* analyzer, Statement* stmt) {
+    switch (stmt->type) {
+        case NODE_FUNCTION:
+            check_function(analyzer, stmt);
+            break;
+        case NODE_DECLARATION:
+            check_declaration(analyzer, stmt);
+            break;
+        case NODE_COMPOUND:
+            if (!stmt->as.compound.scoped) {
+                for (int i = 0; i < stmt->as.compound.count; i++) {
+                    check_toplevel(analyzer, stmt->as.compound.statements[i]);
+                }
+                break;
+            }
+            // Fall through
+        default:
+            semantic_error(analyzer, stmt->token, "Expected a declaration or function definition");
+            break;
+    }
+}
+
+void declare_toplevel(SemanticAnalyzer* analyzer, Statement* stmt) {
+    switch (stmt->type) {
+        case NODE_FUNCTION:
+            declare_function(analyzer, stmt);
+            break;
+        case NODE_DECLARATION: {
+            SymbolEntry* entry = declare_symbol(analyzer, stmt->as.declaration.name->lexeme,
+                                                stmt->as.declaration.var_type, SYMBOL_VARIABLE);
+            if (entry != NULL) entry->is_defined = !stmt->as.declaration.is_extern;
+            break;
+        }
+        case NODE_COMPOUND:
+            for (int i = 0; i < stmt->as.compound.count; i++) {
+                declare_toplevel(analyzer, stmt->as.compound.statements[i]);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// Reachability. Names are matched without scopes: a local that shadows a
+// static only keeps the static alive.
+typedef struct {
+    Statement** statics;     // Static functions and data, sorted by name
+    int static_count;
+    Statement** pending;     // Reached, their bodies not scanned yet
+    int pending_count;
+} Reachability;
+
+static Token* toplevel_name(Statement* stmt) {
+    return stmt->type == NODE_FUNCTION ? stmt->as.function.name : stmt->as.declaration.name;
+}
+
+static int compare_toplevel(const void* a, const void* b) {
+    return strcmp(toplevel_name(*(Statement* const*)a)->lexeme, toplevel_name(*(Statement* const*)b)->lexeme);
+}
+
+// Functions and data, with declarator lists flattened
+static void collect_toplevel(Statement* stmt, Statement*** list, int* count, int* capacity) {
+    if (stmt->type == NODE_COMPOUND && !stmt->as.compound.scoped) {
+        for (int i = 0; i < stmt->as.compound.count; i++) {
+            collect_toplevel(stmt->as.compound.statements[i], list, count, capacity);
+        }
+        return;
+    }
+    if (stmt->type != NODE_FUNCTION && stmt->type != NODE_DECLARATION) return;
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        *list = realloc(*list, sizeof(Statement*) * *capacity);
+    }
+    (*list)[(*count)++] = stmt;
+}
+
+static void reach_name(Reachability* reach, const char* name) {
+    int low = 0, high = reach->static_count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (strcmp(toplevel_name(reach->statics[mid])->lexeme, name) < 0) low = mid + 1;
+        else high = mid;
+    }
+    for (; low < reach->static_count && strcmp(toplevel_name(reach->statics[low])->lexeme, name) == 0; low++) {
+        Statement* stmt = reach->statics[low];
+        bool* unreachable = stmt->type == NODE_FUNCTION ? &stmt->as.function.is_unreachable :
+                                                          &stmt->as.declaration.is_unreachable;
+        if (!*unreachable) continue;
+        *unreachable = false;
+        reach->pending[reach->pending_count++] = stmt;
+    }
+}
+
+static void reach_expression(Reachability* reach, Expression* expr) {
+    if (expr == NULL) return;
+    switch (expr->type) {
+        case NODE_IDENTIFIER:
+            reach_name(reach, expr->token->lexeme);
+            break;
+        case NODE_BINARY_OP:
+        case NODE_ASSIGN:
+            reach_expression(reach, expr->as.binary.left);
+            reach_expression(reach, expr->as.binary.right);
+            break;
+        case NODE_UNARY_OP:
+            reach_expression(reach, expr->as.unary.operand);
+            break;
+        case NODE_CAST:
+            reach_expression(reach, expr->as.cast.operand);
+            break;
+        case NODE_CALL:
+            reach_expression(reach, expr->as.call.callee);
+            for (int i = 0; i < expr->as.call.arg_count; i++) {
+                reach_expression(reach, expr->as.call.args[i]);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void reach_statement(Reachability* reach, Statement* stmt) {
+    if (stmt == NULL) return;
+    switch (stmt->type) {
+        case NODE_EXPRESSION:
+            reach_expression(reach, stmt->as.expression.expr);
+            break;
+        case NODE_RETURN:
+            reach_expression(reach, stmt->as.return_stmt.value);
+            break;
+        case NODE_DECLARATION:
+            reach_expression(reach, stmt->as.declaration.initializer);
+            break;
+        case NODE_COMPOUND:
+            for (int i = 0; i < stmt->as.compound.count; i++) {
+                reach_statement(reach, stmt->as.compound.statements[i]);
+            }
+            break;
+        case NODE_IF:
+            reach_expression(reach, stmt->as.if_stmt.condition);
+            reach_statement(reach, stmt->as.if_stmt.then_branch);
+            reach_statement(reach, stmt->as.if_stmt.else_branch);
+            break;
+        case NODE_WHILE:
+        case NODE_DO_WHILE:
+            reach_expression(reach, stmt->as.while_stmt.condition);
+            reach_statement(reach, stmt->as.while_stmt.body);
+            break;
+        case NODE_FOR:
+            reach_statement(reach, stmt->as.for_stmt.initializer);
+            reach_expression(reach, stmt->as.for_stmt.condition);
+            reach_statement(reach, stmt->as.for_stmt.increment);
+            reach_statement(reach, stmt->as.for_stmt.body);
+            break;
+        case NODE_FUNCTION:
+            reach_statement(reach, stmt->as.function.body);
+            break;
+        default:
+            break;
+    }
+}
+
+void mark_reachable(Statement** toplevel, int count) {
+    Statement** list = NULL;
+    int list_count = 0, capacity = 0;
+    for (int i = 0; i < count; i++) collect_toplevel(toplevel[i], &list, &list_count, &capacity);
+
+    // Statics start out unreachable, everything else is a root
+    Reachability reach = {0};
+    reach.statics = malloc(sizeof(Statement*) * (list_count + 1));
+    reach.pending = malloc(sizeof(Statement*) * (list_count + 1));
+    for (int i = 0; i < list_count; i++) {
+        Statement* stmt = list[i];
+        bool is_static = stmt->type == NODE_FUNCTION ? stmt->as.function.is_static : stmt->as.declaration.is_static;
+        if (stmt->type == NODE_FUNCTION) stmt->as.function.is_unreachable = is_static;
+        else stmt->as.declaration.is_unreachable = is_static;
+        if (is_static) reach.statics[reach.static_count++] = stmt;
+    }
+    if (reach.static_count > 1) {
+        qsort(reach.statics, reach.static_count, sizeof(Statement*), compare_toplevel);
+    }
+
+    for (int i = 0; i < list_count; i++) {
+        bool is_static = list[i]->type == NODE_FUNCTION ? list[i]->as.function.is_static :
+                                                          list[i]->as.declaration.is_static;
+        if (!is_static) reach_statement(&reach, list[i]);
+    }
+    while (reach.pending_count > 0) {
+        reach_statement(&reach, reach.pending[--reach.pending_count]);
+    }
+
+    free(reach.statics);
+    free(reach.pending);
+    free(list);
+}
+
+void check_program(SemanticAnalyzer* analyzer, Statement* program) {
+    mark_reachable(program->as.compound.statements, program->as.compound.count);
+    for (int i = 0; i < program->as.compound.count; i++) {
+        check_toplevel(analyzer, program->as.compound.statements[i]);
+    }
 }
 
 // Type compatibility and conversion
 bool is_type_compatible(Type* left, Type* right) {
     if (left == NULL || right == NULL) return false;
-    
-    // Same type
-    if (left->kind == right->kind) return true;
-    
-    // Pointer compatibility
-    if (left->kind == TYPE_POINTER && right->kind == TYPE_POINTER) {
-        return is_type_compatible(left->info.base, right->info.base);
-    }
-    
-    // Numeric type compatibility
-    if ((left->kind == TYPE_INT || left->kind == TYPE_FLOAT || left->kind == TYPE_DOUBLE) &&
-        (right->kind == TYPE_INT || right->kind == TYPE_FLOAT || right->kind == TYPE_DOUBLE)) {
-        return true;
+
+    // Integers cannot silently take floating-point values
+    if (is_integer_type(left)) return is_integer_type(right);
+    if (is_arithmetic_type(left)) return is_arithmetic_type(right);
+
+    // Pointer compatibility; void* converts to and from any object pointer
+    if (left->kind == TYPE_POINTER && is_pointer_type(right)) {
+        Type* left_base = left->info.base;
+        Type* right_base = right->kind == TYPE_POINTER ? right->info.base : right->info.array.elem_type;
+        if (left_base->kind == TYPE_VOID || right_base->kind == TYPE_VOID) return true;
+        if (!types_equal(left_base, right_base)) return false;
+        // Qualifiers may be added but not dropped
+        return left_base->is_const || !right_base->is_const;
+    }
+
+    return types_equal(left, right);
+}
+
+static int integer_rank(Type* type) {
+    switch (type->kind) {
+        case TYPE_LONG: return 2;
+        default: return 1;
     }
-    
-    return false;
 }
 
 Type* common_type(Type* left, Type* right) {
-    if (!is_type_compatible(left, right)) return NULL;
-    
-    // Same type
-    if (left->kind == right->kind) return left;
-    
+    if (!is_arithmetic_type(left) || !is_arithmetic_type(right)) return NULL;
+
     // Numeric type promotion
     if (left->kind == TYPE_DOUBLE || right->kind == TYPE_DOUBLE) {
         return create_basic_type(TYPE_DOUBLE, false, false);
@@ -312,18 +993,28 @@ Type* common_type(Type* left, Type* right) {
     if (left->kind == TYPE_FLOAT || right->kind == TYPE_FLOAT) {
         return create_basic_type(TYPE_FLOAT, false, false);
     }
-    
-    return create_basic_type(TYPE_INT, false, false);
+
+    // Usual arithmetic conversions on the promoted operands
+    Type* l = promote(left);
+    Type* r = promote(right);
+    Type* result;
+    if (integer_rank(l) != integer_rank(r)) {
+        result = integer_rank(l) > integer_rank(r) ? l : r;
+        // long can represent every unsigned int, so the signedness of the
+        // wider operand wins
+    } else {
+        result = l;
+        result->is_unsigned = l->is_unsigned || r->is_unsigned;
+    }
+    free_type(result == l ? r : l);
+    return result;
 }
 
 Expression* implicit_cast(Expression* expr, Type* target_type) {
     if (expr == NULL || target_type == NULL) return NULL;
-    if (is_type_compatible(expr->expr_type, target_type)) {
-        Expression* cast = malloc(sizeof(Expression));
-        cast->type = NODE_CAST;
-        cast->expr_type = target_type;
-        cast->token = expr->token;
-        cast->as.unary.operand = expr;
+    if (is_type_compatible(target_type, expr->expr_type)) {
+        Expression* cast = create_cast_expr(expr, NULL, expr->token);
+        cast->expr_type = copy_type(target_type);
         return cast;
     }
     return NULL;
@@ -332,9 +1023,9 @@ Expression* implicit_cast(Expression* expr, Type* target_type) {
 // Error reporting
 void semantic_error(SemanticAnalyzer* analyzer, Token* token, const char* message) {
     analyzer->had_error = true;
-    fprintf(stderr, "%s:%d:%d: error: %s\n",
+    fprintf(analyzer->diagnostics, "%s:%d:%d: error: %s\n",
             analyzer->filename,
             token->line,
             token->column,
             message);
-}
\ No newline at end of file
+}
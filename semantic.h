@@ -2,6 +2,7 @@
 #define SEMANTIC_H
 
 #include "ast.h"
+#include <stdio.h>
 #include <stdbool.h>
 
 // Symbol table entry structure
@@ -19,6 +20,7 @@ typedef struct SymbolEntry {
         // For variables
         struct {
             bool is_global;
+            bool is_array;   // Not assignable; the type stored is the array type
             int offset;
         } var;
         // For functions
@@ -38,13 +40,15 @@ typedef struct Scope {
     int level;
 } Scope;
 
-// Semantic analyzer state
+// Semantic analyzer state. Symbol types are borrowed from the declarations
+// and function definitions of the checked AST.
 typedef struct {
-    Scope* current_scope;
+    Scope* current_scope;    // The file scope is entered by semantic_init
     Type* current_function_return_type;
     bool in_loop;
     bool had_error;
     char* filename;
+    FILE* diagnostics;   // Where errors are reported, stderr by default
 } SemanticAnalyzer;
 
 // Semantic analyzer interface functions
@@ -60,12 +64,31 @@ SymbolEntry* declare_symbol(SemanticAnalyzer* analyzer, char* name, Type* type,
 SymbolEntry* lookup_symbol(SemanticAnalyzer* analyzer, char* name);
 SymbolEntry* lookup_symbol_current_scope(SemanticAnalyzer* analyzer, char* name);
 
-// Type checking functions
+// Type checking functions. The type returned by check_expression is
+// stored in (and owned by) expr->expr_type, and the registers evaluating
+// the expression takes in expr->registers.
 Type* check_expression(SemanticAnalyzer* analyzer, Expression* expr);
 void check_statement(SemanticAnalyzer* analyzer, Statement* stmt);
 void check_declaration(SemanticAnalyzer* analyzer, Statement* decl);
+void check_function(SemanticAnalyzer* analyzer, Statement* func);
 
-// Type compatibility and conversion
+// File-scope checking. check_program checks every top-level declaration of
+// a parsed program; check_toplevel checks a single one. declare_toplevel
+// only enters a declaration's names into the file scope, without checking
+// bodies or initializers again (used for declarations already checked).
+void check_program(SemanticAnalyzer* analyzer, Statement* program);
+void check_toplevel(SemanticAnalyzer* analyzer, Statement* stmt);
+void declare_toplevel(SemanticAnalyzer* analyzer, Statement* stmt);
+
+// Reachability over the parsed top-level declarations, from everything
+// the unit makes visible outside. Static functions and data nothing
+// reachable uses are marked is_unreachable: only the signature of such a
+// function is checked, and neither is generated. check_program runs it.
+void mark_reachable(Statement** toplevel, int count);
+
+// Type compatibility and conversion. is_type_compatible tells whether a
+// value of type `right` may be assigned to an object of type `left`;
+// common_type returns a new type for the usual arithmetic conversions.
 bool is_type_compatible(Type* left, Type* right);
 Type* common_type(Type* left, Type* right);
 Expression* implicit_cast(Expression* expr, Type* target_type);
@@ -0,0 +1,355 @@
+#define _GNU_SOURCE   // struct ucred
+#include "server.h"
+#include "driver.h"
+#include "c4.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+// Files whose checked ASTs the server keeps warm
+#define SERVER_CACHED_FILES 64
+
+// How long the server waits on a client that stops sending or reading
+// before dropping it, so that it cannot hold up the others
+#define SERVER_TIMEOUT_SECONDS 2
+
+// Wire helpers. Both ends run on the same machine, so integers are sent
+// in host byte order.
+static bool send_all(int fd, const void* data, size_t length) {
+    const char* bytes = data;
+    while (length > 0) {
+        ssize_t sent = send(fd, bytes, length, MSG_NOSIGNAL);
+        if (sent <= 0) return false;
+        bytes += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+static bool recv_all(int fd, void* data, size_t length) {
+    char* bytes = data;
+    while (length > 0) {
+        ssize_t received = recv(fd, bytes, length, 0);
+        if (received <= 0) return false;
+        bytes += received;
+        length -= received;
+    }
+    return true;
+}
+
+static bool send_blob(int fd, const char* data, size_t length) {
+    uint64_t size = length;
+    return send_all(fd, &size, sizeof(size)) && send_all(fd, data, length);
+}
+
+// Receive a length-prefixed blob as a NUL-terminated string
+static char* recv_blob(int fd, size_t* length) {
+    uint64_t size;
+    if (!recv_all(fd, &size, sizeof(size))) return NULL;
+    char* data = malloc(size + 1);
+    if (data == NULL || !recv_all(fd, data, size)) {
+        free(data);
+        return NULL;
+    }
+    data[size] = '\0';
+    if (length != NULL) *length = size;
+    return data;
+}
+
+static bool send_message(int fd, ServerMessage tag) {
+    char byte = (char)tag;
+    return send_all(fd, &byte, 1);
+}
+
+static bool send_exit(int fd, uint32_t status) {
+    return send_message(fd, SERVER_MSG_EXIT) && send_all(fd, &status, sizeof(status));
+}
+
+static void make_address(struct sockaddr_un* address, const char* socket_path) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    strncpy(address->sun_path, socket_path, sizeof(address->sun_path) - 1);
+}
+
+void server_default_socket(char* path, size_t size) {
+    const char* env = getenv("C4_SOCKET");
+    const char* runtime = getenv("XDG_RUNTIME_DIR");
+    if (env != NULL && env[0] != '\0') {
+        snprintf(path, size, "%s", env);
+    } else if (runtime != NULL && runtime[0] != '\0') {
+        snprintf(path, size, "%s/c4.sock", runtime);
+    } else {
+        snprintf(path, size, "/tmp/c4-%d/c4.sock", (int)getuid());
+    }
+}
+
+// Only processes of the same user may talk to each other
+static bool same_user(int fd) {
+    struct ucred peer;
+    socklen_t length = sizeof(peer);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &length) == 0 && peer.uid == getuid();
+}
+
+// The directory of the socket, created private if missing, must be one no
+// other user can put a socket of their own into: ours or root's, and not
+// writable by others unless sticky, as /tmp is
+static bool private_directory(const char* socket_path) {
+    char dir[4096];
+    snprintf(dir, sizeof(dir), "%s", socket_path);
+    char* slash = strrchr(dir, '/');
+    if (slash == NULL) {
+        snprintf(dir, sizeof(dir), ".");
+    } else if (slash == dir) {
+        dir[1] = '\0';
+    } else {
+        *slash = '\0';
+    }
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) return false;
+
+    struct stat info;
+    if (lstat(dir, &info) != 0 || !S_ISDIR(info.st_mode)) return false;
+    if (info.st_uid != getuid() && info.st_uid != 0) return false;
+    return (info.st_mode & (S_IWGRP | S_IWOTH)) == 0 || (info.st_mode & S_ISVTX) != 0;
+}
+
+// Handle one request. Returns false when the client asked for shutdown.
+static bool serve_client(C4Context* ctx, int fd) {
+    uint32_t count;
+    if (!recv_all(fd, &count, sizeof(count)) || count == 0) return true;
+
+    // The first string is the client's working directory, the rest its argv
+    char** args = calloc(count + 1, sizeof(char*));
+    args[0] = "c4";
+    char* cwd = recv_blob(fd, NULL);
+    bool received = cwd != NULL;
+    for (uint32_t i = 1; received && i < count; i++) {
+        args[i] = recv_blob(fd, NULL);
+        received = args[i] != NULL;
+    }
+
+    bool keep_running = true;
+    if (!received) goto cleanup;
+
+    if (count == 2 && strcmp(args[1], "--shutdown") == 0) {
+        send_exit(fd, 0);
+        keep_running = false;
+        goto cleanup;
+    }
+
+    DriverOptions options;
+    if (!driver_parse_options(count, args, &options) || options.watch) {
+        const char* message = options.watch ? "c4 server: --watch runs in the client only\n"
+                                             : "c4 server: invalid command line\n";
+        send_message(fd, SERVER_MSG_DIAGNOSTICS);
+        send_blob(fd, message, strlen(message));
+        send_exit(fd, 1);
+        driver_free_options(&options);
+        goto cleanup;
+    }
+
+    // Requests are served one at a time so they all share the warm context
+    uint32_t status = 0;
+    CompileCache* cache = driver_open_cache(&options);
+    CompileJob* jobs = driver_create_jobs(&options, cache);
+    for (int i = 0; i < options.input_count; i++) {
+        CompileJob* job = &jobs[i];
+        driver_run_job(ctx, job, cwd, false);
+
+        if (job->diagnostics_length > 0) {
+            send_message(fd, SERVER_MSG_DIAGNOSTICS);
+            send_blob(fd, job->diagnostics, job->diagnostics_length);
+        }
+        if (job->failed) {
+            status = 1;
+        } else {
+            uint32_t index = i;
+            send_message(fd, SERVER_MSG_FILE);
+            send_all(fd, &index, sizeof(index));
+            send_blob(fd, job->output, job->output_length);
+        }
+    }
+    send_exit(fd, status);
+    driver_free_jobs(jobs, options.input_count);
+    cache_close(cache);
+    driver_free_options(&options);
+
+cleanup:
+    for (uint32_t i = 1; i < count; i++) free(args[i]);
+    free(args);
+    free(cwd);
+    return keep_running;
+}
+
+int server_run(const char* socket_path) {
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    if (!private_directory(socket_path)) {
+        fprintf(stderr, "c4 server: the directory of %s is not private to this user\n", socket_path);
+        close(listener);
+        return 1;
+    }
+
+    struct sockaddr_un address;
+    make_address(&address, socket_path);
+    unlink(socket_path);
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+        listen(listener, 64) < 0) {
+        perror(socket_path);
+        close(listener);
+        return 1;
+    }
+
+    C4Context* ctx = c4_context_new();
+    c4_context_set_frontend_cache(ctx, SERVER_CACHED_FILES);
+
+    bool running = true;
+    while (running) {
+        int client = accept(listener, NULL, NULL);
+        if (client < 0) continue;
+        struct timeval timeout = {SERVER_TIMEOUT_SECONDS, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if (same_user(client)) running = serve_client(ctx, client);
+        close(client);
+    }
+
+    c4_context_free(ctx);
+    close(listener);
+    unlink(socket_path);
+    return 0;
+}
+
+// Send the request and replay the response, writing each output to the
+// path of the job it names, once
+static int exchange(const char* socket_path, int argc, char* argv[],
+                    CompileJob* jobs, int job_count, bool* written) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    struct sockaddr_un address;
+    make_address(&address, socket_path);
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    if (!same_user(fd)) {
+        fprintf(stderr, "c4: the server on %s runs as another user, compiling locally\n", socket_path);
+        close(fd);
+        return -1;
+    }
+
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    // Send the working directory and the command line
+    uint32_t count = argc + 1;
+    bool ok = send_all(fd, &count, sizeof(count)) && send_blob(fd, cwd, strlen(cwd));
+    for (int i = 0; ok && i < argc; i++) {
+        ok = send_blob(fd, argv[i], strlen(argv[i]));
+    }
+
+    // Replay the response
+    int status = 1;
+    while (ok) {
+        char tag;
+        if (!recv_all(fd, &tag, 1)) break;
+
+        if (tag == SERVER_MSG_EXIT) {
+            uint32_t code;
+            if (recv_all(fd, &code, sizeof(code))) status = code;
+            break;
+        } else if (tag == SERVER_MSG_DIAGNOSTICS) {
+            size_t length;
+            char* text = recv_blob(fd, &length);
+            if (text == NULL) break;
+            fwrite(text, 1, length, stderr);
+            free(text);
+        } else if (tag == SERVER_MSG_FILE) {
+            uint32_t index;
+            size_t length;
+            char* data = recv_all(fd, &index, sizeof(index)) ? recv_blob(fd, &length) : NULL;
+            if (data == NULL) break;
+            if (index >= (uint32_t)job_count || written[index]) {
+                fprintf(stderr, "c4: unexpected output from the server\n");
+                free(data);
+                status = 1;
+                break;
+            }
+            written[index] = true;
+            const char* path = jobs[index].output_file;
+            FILE* file = fopen(path, "wb");
+            bool saved = file != NULL && fwrite(data, 1, length, file) == length;
+            if (file != NULL && fclose(file) != 0) saved = false;
+            if (!saved) {
+                fprintf(stderr, "Could not create output file '%s'\n", path);
+                status = 1;
+            }
+            free(data);
+        } else {
+            break;
+        }
+    }
+
+    close(fd);
+    return status;
+}
+
+static bool print_cache_stats(const DriverOptions* options) {
+    CompileCache* cache = driver_open_cache(options);
+    if (cache == NULL) return false;
+    cache_print_stats(cache, stdout);
+    cache_close(cache);
+    return true;
+}
+
+int client_run(const char* socket_path, int argc, char* argv[]) {
+    // Output paths come from the client's own reading of the command line,
+    // never from the server
+    char** args = malloc(sizeof(char*) * (argc + 2));
+    args[0] = "c4";
+    memcpy(args + 1, argv, sizeof(char*) * argc);
+    args[argc + 1] = NULL;
+    DriverOptions options;
+    if (argc == 1 && strcmp(argv[0], "--shutdown") == 0) {
+        memset(&options, 0, sizeof(options));
+    } else if (!driver_parse_options(argc + 1, args, &options)) {
+        fprintf(stderr, "c4: invalid command line\n");
+        driver_free_options(&options);
+        free(args);
+        return 1;
+    }
+    free(args);
+
+    // The cache statistics are the client's to print; with nothing to
+    // compile the server is not needed at all
+    if (options.cache_stats && options.input_count == 0) {
+        int status = print_cache_stats(&options) ? 0 : 1;
+        driver_free_options(&options);
+        return status;
+    }
+
+    CompileJob* jobs = driver_create_jobs(&options, NULL);
+    bool* written = calloc(options.input_count + 1, sizeof(bool));
+
+    int status = exchange(socket_path, argc, argv, jobs, options.input_count, written);
+    if (status >= 0 && options.cache_stats) print_cache_stats(&options);
+
+    free(written);
+    driver_free_jobs(jobs, options.input_count);
+    driver_free_options(&options);
+    return status;
+}
@@ -0,0 +1,37 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Compile server. A resident process keeps one warm library context (token
+// arenas, interned identifiers and checked ASTs of recently compiled files)
+// and serves compile requests over a Unix domain socket. The client forwards
+// its command line and working directory, then writes the output files and
+// diagnostics the server streams back. The client parses the command line
+// too and only ever writes the output paths it derived itself; the server
+// names a file by the index of its input.
+
+// Message tags sent from the server to the client
+typedef enum {
+    SERVER_MSG_FILE = 'F',          // Input index followed by its output's contents
+    SERVER_MSG_DIAGNOSTICS = 'D',   // Text for the client's stderr
+    SERVER_MSG_EXIT = 'X'           // Exit status, ends the response
+} ServerMessage;
+
+// Default socket path: $C4_SOCKET, $XDG_RUNTIME_DIR/c4.sock, or
+// /tmp/c4-<uid>/c4.sock
+void server_default_socket(char* path, size_t size);
+
+// Serve requests until a client sends --shutdown. Returns the exit status.
+// The socket's directory is created with mode 0700 if missing, and the
+// server refuses to start in one other users can write to. Both ends
+// refuse a peer running as another user.
+int server_run(const char* socket_path);
+
+// Forward a command line (without the program name) to the server and
+// replay its response. Returns the compile exit status, or -1 when no
+// server is listening on the socket.
+int client_run(const char* socket_path, int argc, char* argv[]);
+
+#endif // SERVER_H
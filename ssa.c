@@ -0,0 +1,1097 @@
+#include "ir.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Passes over the SSA form of the current function
+
+static IrInst* first_non_phi(BasicBlock* block) {
+    IrInst* inst = block->first;
+    while (inst != NULL && inst->op == IR_PHI) inst = inst->next;
+    return inst;
+}
+
+// Phis stay at the start of their block
+static void insert_at_start(BasicBlock* block, IrInst* inst) {
+    IrInst* position = first_non_phi(block);
+    if (position != NULL) {
+        ir_insert_before(position, inst);
+    } else {
+        ir_append(block, inst);
+    }
+}
+
+// Follow a chain of replaced values
+static IrInst* resolve(IrInst** replacement, int count, IrInst* value) {
+    while (value != NULL && value->id < count && replacement[value->id] != NULL) {
+        value = replacement[value->id];
+    }
+    return value;
+}
+
+// Point every operand at the value that replaced it
+static void replace_values(CodeGenerator* gen, IrInst** replacement, int count) {
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            for (int i = 0; i < inst->operand_count; i++) {
+                inst->operands[i] = resolve(replacement, count, inst->operands[i]);
+            }
+        }
+    }
+}
+
+// Users of each value, in one array indexed through `start`
+typedef struct {
+    int* start;              // Users of value v are users[start[v] .. start[v + 1])
+    IrInst** users;
+} UseLists;
+
+static void build_use_lists(CodeGenerator* gen, UseLists* uses) {
+    int count = gen->ir->value_count;
+    uses->start = calloc(count + 2, sizeof(int));
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            for (int i = 0; i < inst->operand_count; i++) uses->start[inst->operands[i]->id + 2]++;
+        }
+    }
+    for (int v = 2; v < count + 2; v++) uses->start[v] += uses->start[v - 1];
+    uses->users = malloc(sizeof(IrInst*) * (uses->start[count + 1] + 1));
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            for (int i = 0; i < inst->operand_count; i++) {
+                uses->users[uses->start[inst->operands[i]->id + 1]++] = inst;
+            }
+        }
+    }
+}
+
+static void free_use_lists(UseLists* uses) {
+    free(uses->start);
+    free(uses->users);
+}
+
+// mem2reg. A local is promoted when its address is only ever used to
+// load or store the whole variable. Phis go on the iterated dominance
+// frontier of its stores, and a walk over the dominator tree renames
+// each load to the value stored last.
+typedef struct {
+    int local;
+    IrInst* previous;
+} Definition;
+
+typedef struct {
+    CodeGenerator* gen;
+    const bool* promote;
+    IrInst** current;        // Value of each local at this point of the walk
+    Definition* log;         // Values overwritten, restored on the way back up
+    int log_count;
+    int log_capacity;
+    IrInst** replacement;    // What each removed load stands for, by id
+    int* phi_local;          // Local each placed phi stands for, or -1, by id
+    int value_count;         // Size of the two arrays above
+    IrInst* undef[3];        // One undefined value per type
+} Renamer;
+
+static void define(Renamer* renamer, int local, IrInst* value) {
+    if (renamer->log_count == renamer->log_capacity) {
+        renamer->log_capacity = renamer->log_capacity ? renamer->log_capacity * 2 : 64;
+        renamer->log = realloc(renamer->log, sizeof(Definition) * renamer->log_capacity);
+    }
+    renamer->log[renamer->log_count].local = local;
+    renamer->log[renamer->log_count].previous = renamer->current[local];
+    renamer->log_count++;
+    renamer->current[local] = value;
+}
+
+static IrInst* current_value(Renamer* renamer, int local, IrType type) {
+    if (renamer->current[local] != NULL) return renamer->current[local];
+    if (renamer->undef[type] == NULL) {
+        IrInst* undef = ir_new(renamer->gen->ir, IR_UNDEF, type);
+        BasicBlock* entry = renamer->gen->blocks[0];
+        if (entry->first != NULL) {
+            ir_insert_before(entry->first, undef);
+        } else {
+            ir_append(entry, undef);
+        }
+        renamer->undef[type] = undef;
+    }
+    return renamer->undef[type];
+}
+
+// Local whose promoted address `address` is, or -1
+static int promoted_address(Renamer* renamer, IrInst* address) {
+    if (address->op != IR_LOCAL || !renamer->promote[address->value]) return -1;
+    return (int)address->value;
+}
+
+static void rename_block(Renamer* renamer, BasicBlock* block) {
+    IrInst* next;
+    for (IrInst* inst = block->first; inst != NULL; inst = next) {
+        next = inst->next;
+        if (inst->op == IR_PHI) {
+            int local = inst->id < renamer->value_count ? renamer->phi_local[inst->id] : -1;
+            if (local >= 0) define(renamer, local, inst);
+            continue;
+        }
+        if (inst->op != IR_LOAD && inst->op != IR_STORE) continue;
+        int local = promoted_address(renamer, inst->operands[0]);
+        if (local < 0) continue;
+        if (inst->op == IR_LOAD) {
+            renamer->replacement[inst->id] = current_value(renamer, local, inst->type);
+        } else {
+            define(renamer, local, resolve(renamer->replacement, renamer->value_count, inst->operands[1]));
+        }
+        ir_remove(inst);
+    }
+
+    for (int s = 0; s < block->successor_count; s++) {
+        BasicBlock* successor = block->successors[s];
+        int index = ir_predecessor_index(block, s);
+        for (IrInst* phi = successor->first; phi != NULL && phi->op == IR_PHI; phi = phi->next) {
+            int local = phi->id < renamer->value_count ? renamer->phi_local[phi->id] : -1;
+            if (local >= 0) phi->operands[index] = current_value(renamer, local, phi->type);
+        }
+    }
+}
+
+typedef struct {
+    BasicBlock* block;
+    int child;               // Next child in the dominator tree, -1 before the block is renamed
+    int mark;                // Log position on entry
+} RenameFrame;
+
+static void rename_locals(Renamer* renamer) {
+    CodeGenerator* gen = renamer->gen;
+    RenameFrame* stack = malloc(sizeof(RenameFrame) * (gen->block_count + 1));
+    int depth = 0;
+    stack[depth].block = gen->blocks[0];
+    stack[depth].child = -1;
+    stack[depth].mark = 0;
+    depth++;
+
+    while (depth > 0) {
+        RenameFrame* frame = &stack[depth - 1];
+        if (frame->child < 0) {
+            frame->mark = renamer->log_count;
+            rename_block(renamer, frame->block);
+            frame->child = 0;
+        }
+        if (frame->child < frame->block->dominated_count) {
+            stack[depth].block = frame->block->dominated[frame->child++];
+            stack[depth].child = -1;
+            depth++;
+            continue;
+        }
+        while (renamer->log_count > frame->mark) {
+            Definition* definition = &renamer->log[--renamer->log_count];
+            renamer->current[definition->local] = definition->previous;
+        }
+        depth--;
+    }
+    free(stack);
+}
+
+void promote_locals(CodeGenerator* gen) {
+    IrFunction* fn = gen->ir;
+    if (fn->local_count == 0) return;
+
+    bool* promote = malloc(sizeof(bool) * fn->local_count);
+    for (int l = 0; l < fn->local_count; l++) {
+        const Type* type = fn->locals[l].type;
+        promote[l] = !type->is_volatile && type->kind != TYPE_ARRAY && type->kind != TYPE_BOOL &&
+                     type->kind != TYPE_VOID;
+    }
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            for (int i = 0; i < inst->operand_count; i++) {
+                IrInst* address = inst->operands[i];
+                if (address->op != IR_LOCAL) continue;
+                bool is_access = i == 0 && (inst->op == IR_LOAD ||
+                                            (inst->op == IR_STORE && inst->operands[1] != address));
+                if (!is_access || inst->size != type_size(fn->locals[address->value].type)) {
+                    promote[address->value] = false;
+                }
+            }
+        }
+    }
+
+    // Blocks storing to each promoted local
+    int* def_start = calloc(fn->local_count + 2, sizeof(int));
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            if (inst->op == IR_STORE && inst->operands[0]->op == IR_LOCAL && promote[inst->operands[0]->value]) {
+                def_start[inst->operands[0]->value + 2]++;
+            }
+        }
+    }
+    for (int l = 2; l < fn->local_count + 2; l++) def_start[l] += def_start[l - 1];
+    BasicBlock** def_blocks = malloc(sizeof(BasicBlock*) * (def_start[fn->local_count + 1] + 1));
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            if (inst->op == IR_STORE && inst->operands[0]->op == IR_LOCAL && promote[inst->operands[0]->value]) {
+                def_blocks[def_start[inst->operands[0]->value + 1]++] = gen->blocks[b];
+            }
+        }
+    }
+
+    // Phis on the iterated dominance frontiers
+    int* has_phi = malloc(sizeof(int) * gen->block_count);
+    int* queued = malloc(sizeof(int) * gen->block_count);
+    BasicBlock** worklist = malloc(sizeof(BasicBlock*) * (gen->block_count + 1));
+    IrInst** phis = NULL;
+    int phi_count = 0;
+    int phi_capacity = 0;
+    for (int b = 0; b < gen->block_count; b++) has_phi[b] = queued[b] = -1;
+    for (int l = 0; l < fn->local_count; l++) {
+        if (!promote[l]) continue;
+        int count = 0;
+        for (int d = def_start[l]; d < def_start[l + 1]; d++) {
+            BasicBlock* block = def_blocks[d];
+            if (queued[block->id] == l) continue;
+            queued[block->id] = l;
+            worklist[count++] = block;
+        }
+        while (count > 0) {
+            BasicBlock* block = worklist[--count];
+            for (int f = 0; f < block->frontier_count; f++) {
+                BasicBlock* join = block->frontier[f];
+                if (has_phi[join->id] == l) continue;
+                has_phi[join->id] = l;
+
+                IrInst* phi = ir_new(fn, IR_PHI, is_wide(fn->locals[l].type) ? IR_I64 : IR_I32);
+                phi->value = l;
+                for (int p = 0; p < join->predecessor_count; p++) ir_add_operand(phi, NULL);
+                if (join->first != NULL) {
+                    ir_insert_before(join->first, phi);
+                } else {
+                    ir_append(join, phi);
+                }
+                if (phi_count == phi_capacity) {
+                    phi_capacity = phi_capacity ? phi_capacity * 2 : 16;
+                    phis = realloc(phis, sizeof(IrInst*) * phi_capacity);
+                }
+                phis[phi_count++] = phi;
+
+                if (queued[join->id] != l) {
+                    queued[join->id] = l;
+                    worklist[count++] = join;
+                }
+            }
+        }
+    }
+    free(def_start);
+    free(def_blocks);
+    free(has_phi);
+    free(queued);
+    free(worklist);
+
+    Renamer renamer;
+    memset(&renamer, 0, sizeof(renamer));
+    renamer.gen = gen;
+    renamer.promote = promote;
+    renamer.current = calloc(fn->local_count, sizeof(IrInst*));
+    renamer.value_count = fn->value_count;
+    renamer.replacement = calloc(fn->value_count, sizeof(IrInst*));
+    renamer.phi_local = malloc(sizeof(int) * fn->value_count);
+    for (int v = 0; v < fn->value_count; v++) renamer.phi_local[v] = -1;
+    for (int i = 0; i < phi_count; i++) {
+        renamer.phi_local[phis[i]->id] = (int)phis[i]->value;
+        phis[i]->value = 0;
+    }
+    rename_locals(&renamer);
+    replace_values(gen, renamer.replacement, renamer.value_count);
+
+    // The addresses of promoted locals are no longer used
+    for (int b = 0; b < gen->block_count; b++) {
+        IrInst* next;
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = next) {
+            next = inst->next;
+            if (inst->op == IR_LOCAL && promote[inst->value]) ir_remove(inst);
+        }
+    }
+    for (int l = 0; l < fn->local_count; l++) fn->locals[l].is_promoted = promote[l];
+
+    free(phis);
+    free(promote);
+    free(renamer.current);
+    free(renamer.log);
+    free(renamer.replacement);
+    free(renamer.phi_local);
+}
+
+// Sparse conditional constant propagation, after Wegman and Zadeck.
+// Values start out unknown and only ever move down the lattice, and
+// only edges shown to be taken make their targets executable.
+typedef enum {
+    LATTICE_UNKNOWN,
+    LATTICE_CONSTANT,
+    LATTICE_VARYING
+} LatticeState;
+
+typedef struct {
+    LatticeState state;
+    long long value;
+} Lattice;
+
+typedef struct {
+    CodeGenerator* gen;
+    UseLists uses;
+    Lattice* values;         // By value id
+    bool* executable;        // By block id
+    int* incoming_start;     // Flags of block b's incoming edges start here
+    bool* incoming;          // One flag per predecessor entry
+    int* edges;              // Flow worklist: block id * 2 + successor
+    int edge_count;
+    IrInst** worklist;       // Values whose lattice changed
+    int worklist_count;
+    int worklist_capacity;
+} Propagator;
+
+static void add_edge(Propagator* prop, BasicBlock* block, int successor) {
+    int index = ir_predecessor_index(block, successor);
+    BasicBlock* target = block->successors[successor];
+    bool* flag = &prop->incoming[prop->incoming_start[target->id] + index];
+    if (*flag) return;
+    *flag = true;
+    prop->edges[prop->edge_count++] = block->id * 2 + successor;
+}
+
+static Lattice evaluate(Propagator* prop, IrInst* inst) {
+    Lattice result = {LATTICE_VARYING, 0};
+    switch (inst->op) {
+        case IR_CONST:
+            result.state = LATTICE_CONSTANT;
+            result.value = inst->value;
+            return result;
+        case IR_PHI: {
+            BasicBlock* block = inst->block;
+            result.state = LATTICE_UNKNOWN;
+            for (int p = 0; p < inst->operand_count; p++) {
+                if (!prop->incoming[prop->incoming_start[block->id] + p]) continue;
+                Lattice operand = prop->values[inst->operands[p]->id];
+                if (operand.state == LATTICE_UNKNOWN) continue;
+                if (operand.state == LATTICE_VARYING ||
+                    (result.state == LATTICE_CONSTANT && result.value != operand.value)) {
+                    result.state = LATTICE_VARYING;
+                    return result;
+                }
+                result = operand;
+            }
+            return result;
+        }
+        case IR_SELECT: {
+            Lattice condition = prop->values[inst->operands[0]->id];
+            if (condition.state == LATTICE_CONSTANT) {
+                return prop->values[inst->operands[condition.value != 0 ? 1 : 2]->id];
+            }
+            Lattice if_true = prop->values[inst->operands[1]->id];
+            Lattice if_false = prop->values[inst->operands[2]->id];
+            if (condition.state == LATTICE_UNKNOWN || if_true.state == LATTICE_UNKNOWN) {
+                result.state = LATTICE_UNKNOWN;
+                if (condition.state != LATTICE_UNKNOWN) result = if_false;
+                return result;
+            }
+            if (if_false.state == LATTICE_UNKNOWN) return if_true;
+            if (if_true.state == LATTICE_CONSTANT && if_false.state == LATTICE_CONSTANT &&
+                if_true.value == if_false.value) {
+                return if_true;
+            }
+            return result;
+        }
+        case IR_COPY: case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV: case IR_REM:
+        case IR_AND: case IR_OR: case IR_XOR: case IR_SHL: case IR_SHR: case IR_NEG: case IR_NOT:
+        case IR_CMP: case IR_EXTEND: case IR_TRUNCATE: {
+            long long operands[2] = {0, 0};
+            bool unknown = false;
+            for (int i = 0; i < inst->operand_count; i++) {
+                Lattice operand = prop->values[inst->operands[i]->id];
+                if (operand.state == LATTICE_VARYING) return result;
+                if (operand.state == LATTICE_UNKNOWN) unknown = true;
+                operands[i] = operand.value;
+            }
+            if (unknown) {
+                result.state = LATTICE_UNKNOWN;
+            } else if (ir_fold(inst, operands, &result.value)) {
+                result.state = LATTICE_CONSTANT;
+            }
+            return result;
+        }
+        default:
+            // Loads, calls, parameters and addresses
+            return result;
+    }
+}
+
+static void visit(Propagator* prop, IrInst* inst) {
+    BasicBlock* block = inst->block;
+    switch (inst->op) {
+        case IR_JUMP:
+            add_edge(prop, block, 0);
+            return;
+        case IR_BRANCH: {
+            Lattice condition = prop->values[inst->operands[0]->id];
+            if (condition.state == LATTICE_CONSTANT) {
+                add_edge(prop, block, condition.value != 0 ? 0 : 1);
+            } else if (condition.state == LATTICE_VARYING) {
+                add_edge(prop, block, 0);
+                add_edge(prop, block, 1);
+            }
+            return;
+        }
+        case IR_STORE:
+        case IR_RETURN:
+            return;
+        default:
+            break;
+    }
+
+    Lattice old = prop->values[inst->id];
+    if (old.state == LATTICE_VARYING) return;
+    Lattice result = evaluate(prop, inst);
+    if (result.state == old.state && result.value == old.value) return;
+    prop->values[inst->id] = result;
+
+    if (prop->worklist_count == prop->worklist_capacity) {
+        prop->worklist_capacity = prop->worklist_capacity ? prop->worklist_capacity * 2 : 64;
+        prop->worklist = realloc(prop->worklist, sizeof(IrInst*) * prop->worklist_capacity);
+    }
+    prop->worklist[prop->worklist_count++] = inst;
+}
+
+void propagate_constants(CodeGenerator* gen) {
+    IrFunction* fn = gen->ir;
+    Propagator prop;
+    memset(&prop, 0, sizeof(prop));
+    prop.gen = gen;
+    build_use_lists(gen, &prop.uses);
+    prop.values = calloc(fn->value_count, sizeof(Lattice));
+    prop.executable = calloc(gen->block_count, sizeof(bool));
+    prop.incoming_start = malloc(sizeof(int) * (gen->block_count + 1));
+    int edge_total = 0;
+    for (int b = 0; b < gen->block_count; b++) {
+        prop.incoming_start[b] = edge_total;
+        edge_total += gen->blocks[b]->predecessor_count;
+    }
+    prop.incoming = calloc(edge_total + 1, sizeof(bool));
+    prop.edges = malloc(sizeof(int) * (edge_total + 1));
+
+    prop.executable[0] = true;
+    for (IrInst* inst = gen->blocks[0]->first; inst != NULL; inst = inst->next) visit(&prop, inst);
+
+    while (prop.edge_count > 0 || prop.worklist_count > 0) {
+        if (prop.edge_count > 0) {
+            int edge = prop.edges[--prop.edge_count];
+            BasicBlock* target = gen->blocks[edge / 2]->successors[edge % 2];
+            if (!prop.executable[target->id]) {
+                prop.executable[target->id] = true;
+                for (IrInst* inst = target->first; inst != NULL; inst = inst->next) visit(&prop, inst);
+            } else {
+                for (IrInst* phi = target->first; phi != NULL && phi->op == IR_PHI; phi = phi->next) {
+                    visit(&prop, phi);
+                }
+            }
+            continue;
+        }
+        IrInst* value = prop.worklist[--prop.worklist_count];
+        for (int u = prop.uses.start[value->id]; u < prop.uses.start[value->id + 1]; u++) {
+            IrInst* user = prop.uses.users[u];
+            if (prop.executable[user->block->id]) visit(&prop, user);
+        }
+    }
+
+    // Constants replace the values computed, and branches on them become
+    // jumps; blocks never found executable become unreachable
+    IrInst** replacement = calloc(fn->value_count, sizeof(IrInst*));
+    int value_count = fn->value_count;
+    for (int b = 0; b < gen->block_count; b++) {
+        BasicBlock* block = gen->blocks[b];
+        if (!prop.executable[b]) continue;
+        IrInst* next;
+        for (IrInst* inst = block->first; inst != NULL; inst = next) {
+            next = inst->next;
+            // Constants put after the phis of the block in place of one
+            if (inst->id >= value_count) continue;
+            Lattice value = prop.values[inst->id];
+            if (inst->op == IR_BRANCH) {
+                Lattice condition = prop.values[inst->operands[0]->id];
+                if (condition.state != LATTICE_CONSTANT) continue;
+                ir_remove_edge(block, condition.value != 0 ? 1 : 0);
+                inst->op = IR_JUMP;
+                inst->operand_count = 0;
+                continue;
+            }
+            if (value.state != LATTICE_CONSTANT || inst->op == IR_CONST || ir_has_side_effects(inst)) continue;
+            IrInst* constant = ir_new(fn, IR_CONST, inst->type);
+            constant->value = value.value;
+            if (inst->op == IR_PHI) {
+                insert_at_start(block, constant);
+            } else {
+                ir_insert_before(inst, constant);
+            }
+            replacement[inst->id] = constant;
+            ir_remove(inst);
+        }
+    }
+    replace_values(gen, replacement, value_count);
+    ir_remove_unreachable_blocks(gen);
+    analyze_control_flow(gen);
+
+    free(replacement);
+    free_use_lists(&prop.uses);
+    free(prop.values);
+    free(prop.executable);
+    free(prop.incoming_start);
+    free(prop.incoming);
+    free(prop.edges);
+    free(prop.worklist);
+}
+
+// Aggressive dead code elimination. Only stores, calls and returns are
+// assumed live; everything else must earn it, branches included, through
+// control dependence on the postdominator tree. A branch nothing live
+// depends on becomes a jump to its immediate postdominator. Branches in
+// loops, or with no postdominator, are kept so that a loop that may not
+// terminate is never removed.
+typedef struct {
+    CodeGenerator* gen;
+    int* ipdom;              // Immediate postdominator, block_count for the exit, -1 if none
+    int* cd_start;           // Blocks controlling block b are controllers[cd_start[b] ..]
+    int* controllers;
+    bool* live;              // By value id
+    bool* block_live;
+    IrInst** worklist;
+    int worklist_count;
+} DeadCodeEliminator;
+
+static void compute_postdominators(CodeGenerator* gen, int* ipdom) {
+    int n = gen->block_count;
+    int exit = n;
+    // Depth-first search of the reverse graph from a virtual exit that
+    // every return leads to
+    int* order = malloc(sizeof(int) * (n + 1));
+    int* index = malloc(sizeof(int) * (n + 1));
+    int* stack = malloc(sizeof(int) * (n + 1));
+    int* next = calloc(n + 1, sizeof(int));
+    int* returns = malloc(sizeof(int) * (n + 1));
+    int return_count = 0;
+    for (int b = 0; b < n; b++) {
+        IrInst* terminator = ir_terminator(gen->blocks[b]);
+        if (terminator != NULL && terminator->op == IR_RETURN) returns[return_count++] = b;
+    }
+    for (int i = 0; i <= n; i++) index[i] = -1;
+
+    int finished = 0;
+    int depth = 0;
+    stack[depth++] = exit;
+    index[exit] = 0;
+    while (depth > 0) {
+        int node = stack[depth - 1];
+        int count = node == exit ? return_count : gen->blocks[node]->predecessor_count;
+        if (next[node] < count) {
+            int child = node == exit ? returns[next[node]] : gen->blocks[node]->predecessors[next[node]]->id;
+            next[node]++;
+            if (index[child] < 0) {
+                index[child] = 0;
+                stack[depth++] = child;
+            }
+        } else {
+            order[finished++] = node;
+            depth--;
+        }
+    }
+    // Reverse post-order numbers, the exit first
+    for (int i = 0; i < finished; i++) index[order[finished - 1 - i]] = i;
+    for (int i = 0; i <= n; i++) ipdom[i] = -1;
+    ipdom[exit] = exit;
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = finished - 2; i >= 0; i--) {
+            int node = order[i];
+            BasicBlock* block = gen->blocks[node];
+            int idom = -1;
+            int count = block->successor_count;
+            IrInst* terminator = ir_terminator(block);
+            bool returns_here = terminator != NULL && terminator->op == IR_RETURN;
+            for (int s = 0; s < count + (returns_here ? 1 : 0); s++) {
+                int other = s < count ? block->successors[s]->id : exit;
+                if (index[other] < 0 || ipdom[other] < 0) continue;
+                if (idom < 0) {
+                    idom = other;
+                    continue;
+                }
+                int a = other;
+                int b = idom;
+                while (a != b) {
+                    while (index[a] > index[b]) a = ipdom[a];
+                    while (index[b] > index[a]) b = ipdom[b];
+                }
+                idom = a;
+            }
+            if (idom != ipdom[node]) {
+                ipdom[node] = idom;
+                changed = true;
+            }
+        }
+    }
+    free(order);
+    free(index);
+    free(stack);
+    free(next);
+    free(returns);
+}
+
+// Block b is control dependent on branch block a when it postdominates a
+// successor of a but not a itself
+static void compute_control_dependence(DeadCodeEliminator* dce) {
+    CodeGenerator* gen = dce->gen;
+    int n = gen->block_count;
+    dce->cd_start = calloc(n + 2, sizeof(int));
+    for (int pass = 0; pass < 2; pass++) {
+        for (int a = 0; a < n; a++) {
+            BasicBlock* block = gen->blocks[a];
+            if (block->successor_count < 2 || dce->ipdom[a] < 0) continue;
+            for (int s = 0; s < block->successor_count; s++) {
+                int runner = block->successors[s]->id;
+                while (runner != dce->ipdom[a] && runner >= 0 && runner != n) {
+                    if (pass == 0) {
+                        dce->cd_start[runner + 2]++;
+                    } else {
+                        dce->controllers[dce->cd_start[runner + 1]++] = a;
+                    }
+                    runner = dce->ipdom[runner];
+                }
+            }
+        }
+        if (pass == 0) {
+            for (int b = 2; b < n + 2; b++) dce->cd_start[b] += dce->cd_start[b - 1];
+            dce->controllers = malloc(sizeof(int) * (dce->cd_start[n + 1] + 1));
+        }
+    }
+}
+
+static void mark_live(DeadCodeEliminator* dce, IrInst* inst) {
+    if (dce->live[inst->id]) return;
+    dce->live[inst->id] = true;
+    dce->worklist[dce->worklist_count++] = inst;
+}
+
+// A block with live code needs the branches deciding whether it runs
+static void mark_block_live(DeadCodeEliminator* dce, BasicBlock* block) {
+    if (dce->block_live[block->id]) return;
+    dce->block_live[block->id] = true;
+    for (int c = dce->cd_start[block->id]; c < dce->cd_start[block->id + 1]; c++) {
+        mark_live(dce, ir_terminator(dce->gen->blocks[dce->controllers[c]]));
+    }
+}
+
+static void propagate_liveness(DeadCodeEliminator* dce) {
+    while (dce->worklist_count > 0) {
+        IrInst* inst = dce->worklist[--dce->worklist_count];
+        mark_block_live(dce, inst->block);
+        for (int i = 0; i < inst->operand_count; i++) mark_live(dce, inst->operands[i]);
+        if (inst->op != IR_PHI) continue;
+        // Which value a phi takes depends on how control got there
+        BasicBlock* block = inst->block;
+        for (int p = 0; p < block->predecessor_count; p++) {
+            BasicBlock* predecessor = block->predecessors[p];
+            IrInst* terminator = ir_terminator(predecessor);
+            if (terminator != NULL && terminator->op == IR_BRANCH) mark_live(dce, terminator);
+            mark_block_live(dce, predecessor);
+        }
+    }
+}
+
+static bool has_live_phi(DeadCodeEliminator* dce, BasicBlock* block) {
+    for (IrInst* inst = block->first; inst != NULL && inst->op == IR_PHI; inst = inst->next) {
+        if (dce->live[inst->id]) return true;
+    }
+    return false;
+}
+
+void eliminate_dead_code(CodeGenerator* gen) {
+    IrFunction* fn = gen->ir;
+    int n = gen->block_count;
+    DeadCodeEliminator dce;
+    memset(&dce, 0, sizeof(dce));
+    dce.gen = gen;
+    dce.ipdom = malloc(sizeof(int) * (n + 1));
+    compute_postdominators(gen, dce.ipdom);
+    compute_control_dependence(&dce);
+    dce.live = calloc(fn->value_count, sizeof(bool));
+    dce.block_live = calloc(n, sizeof(bool));
+    dce.worklist = malloc(sizeof(IrInst*) * (fn->value_count + 1));
+
+    for (int b = 0; b < n; b++) {
+        BasicBlock* block = gen->blocks[b];
+        for (IrInst* inst = block->first; inst != NULL; inst = inst->next) {
+            bool is_root = inst->op == IR_STORE || inst->op == IR_CALL || inst->op == IR_RETURN;
+            if (inst->op == IR_BRANCH) {
+                is_root = block->loop_depth > 0 || dce.ipdom[b] < 0 || dce.ipdom[b] == n ||
+                          dce.ipdom[block->successors[0]->id] < 0 || dce.ipdom[block->successors[1]->id] < 0;
+            }
+            if (is_root) mark_live(&dce, inst);
+        }
+    }
+    propagate_liveness(&dce);
+
+    // A dead branch can only become a jump to a join without live phis
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int b = 0; b < n; b++) {
+            IrInst* terminator = ir_terminator(gen->blocks[b]);
+            if (terminator == NULL || terminator->op != IR_BRANCH || dce.live[terminator->id]) continue;
+            if (!has_live_phi(&dce, gen->blocks[dce.ipdom[b]])) continue;
+            mark_live(&dce, terminator);
+            propagate_liveness(&dce);
+            changed = true;
+        }
+    }
+
+    for (int b = 0; b < n; b++) {
+        BasicBlock* block = gen->blocks[b];
+        IrInst* next;
+        for (IrInst* inst = block->first; inst != NULL; inst = next) {
+            next = inst->next;
+            if (dce.live[inst->id] || inst->op == IR_JUMP) continue;
+            if (inst->op == IR_BRANCH) {
+                BasicBlock* join = gen->blocks[dce.ipdom[b]];
+                ir_remove_edge(block, 1);
+                ir_remove_edge(block, 0);
+                inst->op = IR_JUMP;
+                inst->operand_count = 0;
+                cfg_add_edge(block, join);
+                continue;
+            }
+            ir_remove(inst);
+        }
+    }
+    // Dead phis are gone, so joins that gained an edge need no operands for it
+    ir_remove_unreachable_blocks(gen);
+    analyze_control_flow(gen);
+
+    free(dce.ipdom);
+    free(dce.cd_start);
+    free(dce.controllers);
+    free(dce.live);
+    free(dce.block_live);
+    free(dce.worklist);
+}
+
+// Common subexpression elimination over the dominator tree: a pure
+// computation repeating one that dominates it is replaced by it. The
+// computations available at a block are those of its dominators, kept in
+// a hash table whose chains are unwound on the way back up the tree.
+// Comparisons are left alone, as they are free to repeat next to the
+// branch or select testing them. Constants and addresses are numbered
+// too, so that expressions over equal ones match.
+typedef struct {
+    int* buckets;            // Latest value of each chain, or -1
+    int mask;
+    int* chain;              // Value below each one in its chain, by id
+    IrInst** replacement;
+    int value_count;
+    IrInst** log;            // Values entered, removed in reverse
+    int log_count;
+} ExpressionTable;
+
+static bool is_redundant_candidate(const IrInst* inst) {
+    switch (inst->op) {
+        case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV: case IR_REM:
+        case IR_AND: case IR_OR: case IR_XOR: case IR_SHL: case IR_SHR:
+        case IR_NEG: case IR_NOT: case IR_EXTEND: case IR_TRUNCATE: case IR_SELECT:
+        case IR_CONST: case IR_LOCAL: case IR_GLOBAL: case IR_STRING:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static unsigned int hash_expression(const IrInst* inst) {
+    unsigned long long hash = inst->op * 31 + inst->type;
+    hash = hash * 31 + (unsigned long long)inst->value;
+    hash = hash * 31 + inst->size * 2 + inst->is_signed;
+    for (const char* c = inst->symbol; c != NULL && *c != '\0'; c++) hash = hash * 31 + *c;
+    for (int i = 0; i < inst->operand_count; i++) hash = hash * 1000003 + inst->operands[i]->id;
+    return (unsigned int)(hash ^ (hash >> 29));
+}
+
+static bool same_expression(const IrInst* a, const IrInst* b) {
+    if (a->op != b->op || a->type != b->type || a->value != b->value || a->size != b->size ||
+        a->is_signed != b->is_signed || a->operand_count != b->operand_count) {
+        return false;
+    }
+    if ((a->symbol == NULL) != (b->symbol == NULL)) return false;
+    if (a->symbol != NULL && strcmp(a->symbol, b->symbol) != 0) return false;
+    for (int i = 0; i < a->operand_count; i++) {
+        if (a->operands[i] != b->operands[i]) return false;
+    }
+    return true;
+}
+
+static void number_block(ExpressionTable* table, BasicBlock* block) {
+    IrInst* next;
+    for (IrInst* inst = block->first; inst != NULL; inst = next) {
+        next = inst->next;
+        for (int i = 0; i < inst->operand_count; i++) {
+            inst->operands[i] = resolve(table->replacement, table->value_count, inst->operands[i]);
+        }
+        if (!is_redundant_candidate(inst)) continue;
+        unsigned int bucket = hash_expression(inst) & table->mask;
+        IrInst* available = NULL;
+        for (int v = table->buckets[bucket]; v >= 0 && available == NULL; v = table->chain[v]) {
+            IrInst* candidate = table->log[v];
+            if (same_expression(candidate, inst)) available = candidate;
+        }
+        if (available != NULL) {
+            table->replacement[inst->id] = available;
+            ir_remove(inst);
+            continue;
+        }
+        // Chains hold positions in the log, so that entries leave in order
+        table->chain[table->log_count] = table->buckets[bucket];
+        table->buckets[bucket] = table->log_count;
+        table->log[table->log_count++] = inst;
+    }
+}
+
+typedef struct {
+    BasicBlock* block;
+    int child;               // Next child in the dominator tree, -1 before the block is numbered
+    int mark;                // Log position on entry
+} NumberFrame;
+
+void eliminate_common_subexpressions(CodeGenerator* gen) {
+    IrFunction* fn = gen->ir;
+    ExpressionTable table;
+    int size = 16;
+    while (size < fn->value_count * 2) size *= 2;
+    table.buckets = malloc(sizeof(int) * size);
+    for (int i = 0; i < size; i++) table.buckets[i] = -1;
+    table.mask = size - 1;
+    table.chain = malloc(sizeof(int) * (fn->value_count + 1));
+    table.log = malloc(sizeof(IrInst*) * (fn->value_count + 1));
+    table.log_count = 0;
+    table.replacement = calloc(fn->value_count, sizeof(IrInst*));
+    table.value_count = fn->value_count;
+
+    NumberFrame* stack = malloc(sizeof(NumberFrame) * (gen->block_count + 1));
+    int depth = 0;
+    stack[depth].block = gen->blocks[0];
+    stack[depth].child = -1;
+    depth++;
+    while (depth > 0) {
+        NumberFrame* frame = &stack[depth - 1];
+        if (frame->child < 0) {
+            frame->mark = table.log_count;
+            number_block(&table, frame->block);
+            frame->child = 0;
+        }
+        if (frame->child < frame->block->dominated_count) {
+            stack[depth].block = frame->block->dominated[frame->child++];
+            stack[depth].child = -1;
+            depth++;
+            continue;
+        }
+        while (table.log_count > frame->mark) {
+            IrInst* inst = table.log[--table.log_count];
+            table.buckets[hash_expression(inst) & table.mask] = table.chain[table.log_count];
+        }
+        depth--;
+    }
+    // Phis may read values of blocks numbered after them
+    replace_values(gen, table.replacement, table.value_count);
+
+    free(stack);
+    free(table.buckets);
+    free(table.chain);
+    free(table.log);
+    free(table.replacement);
+}
+
+// CFG cleanup: phis with a single distinct operand are replaced by it,
+// branches that only choose phi operands become selects, branches to one
+// block become jumps, a block is merged into its only predecessor when
+// that jumps to it, and empty blocks are bypassed.
+static bool simplify_phis(CodeGenerator* gen) {
+    IrFunction* fn = gen->ir;
+    IrInst** replacement = calloc(fn->value_count, sizeof(IrInst*));
+    bool changed = false;
+    for (int b = 0; b < gen->block_count; b++) {
+        IrInst* next;
+        for (IrInst* phi = gen->blocks[b]->first; phi != NULL && phi->op == IR_PHI; phi = next) {
+            next = phi->next;
+            IrInst* unique = NULL;
+            bool is_unique = true;
+            for (int p = 0; p < phi->operand_count; p++) {
+                IrInst* operand = resolve(replacement, fn->value_count, phi->operands[p]);
+                if (operand == phi || operand == unique) continue;
+                if (unique != NULL) is_unique = false;
+                unique = operand;
+            }
+            if (!is_unique || unique == NULL) continue;
+            replacement[phi->id] = unique;
+            ir_remove(phi);
+            changed = true;
+        }
+    }
+    if (changed) replace_values(gen, replacement, fn->value_count);
+    free(replacement);
+    return changed;
+}
+
+static bool same_phi_operands(BasicBlock* block, int first, int second) {
+    for (IrInst* phi = block->first; phi != NULL && phi->op == IR_PHI; phi = phi->next) {
+        if (phi->operands[first] != phi->operands[second]) return false;
+    }
+    return true;
+}
+
+static bool is_predecessor(const BasicBlock* block, const BasicBlock* predecessor) {
+    for (int p = 0; p < block->predecessor_count; p++) {
+        if (block->predecessors[p] == predecessor) return true;
+    }
+    return false;
+}
+
+static void merge_into(BasicBlock* block, BasicBlock* successor) {
+    ir_remove(ir_terminator(block));
+    while (successor->first != NULL) {
+        IrInst* inst = successor->first;
+        ir_remove(inst);
+        ir_append(block, inst);
+    }
+    for (int s = 0; s < successor->successor_count; s++) {
+        BasicBlock* next = successor->successors[s];
+        block->successors[s] = next;
+        for (int p = 0; p < next->predecessor_count; p++) {
+            if (next->predecessors[p] == successor) next->predecessors[p] = block;
+        }
+    }
+    block->successor_count = successor->successor_count;
+    block->is_exit = successor->is_exit;
+    successor->successor_count = 0;
+    successor->predecessor_count = 0;
+}
+
+// Send the predecessors of an empty block straight to its successor
+static bool bypass(BasicBlock* block) {
+    BasicBlock* target = block->successors[0];
+    bool target_has_phi = target->first != NULL && target->first->op == IR_PHI;
+    if (target_has_phi) {
+        for (int p = 0; p < block->predecessor_count; p++) {
+            if (is_predecessor(target, block->predecessors[p])) return false;
+        }
+    }
+
+    int index = ir_predecessor_index(block, 0);
+    for (int p = 0; p < block->predecessor_count; p++) {
+        BasicBlock* predecessor = block->predecessors[p];
+        int s = predecessor->successors[0] == block ? 0 : 1;
+        predecessor->successors[s] = target;
+        if (p == 0) {
+            target->predecessors[index] = predecessor;
+            continue;
+        }
+        if (target->predecessor_count == target->predecessor_capacity) {
+            target->predecessor_capacity *= 2;
+            target->predecessors = realloc(target->predecessors, sizeof(BasicBlock*) * target->predecessor_capacity);
+        }
+        target->predecessors[target->predecessor_count++] = predecessor;
+        for (IrInst* phi = target->first; phi != NULL && phi->op == IR_PHI; phi = phi->next) {
+            ir_add_operand(phi, phi->operands[index]);
+        }
+    }
+    block->predecessor_count = 0;
+    block->successor_count = 0;
+    return true;
+}
+
+// If-conversion. A branch whose two ways meet again right away, each
+// directly or through an empty block, only chooses the operands of the
+// phis at the join; with few of them the choice becomes a select each,
+// computed before the branch, which then becomes a jump.
+#define MAX_SELECTS 4
+
+// Block reached from `block` through its successor `successor`, skipping
+// an empty block only `block` jumps to; `index` receives the edge's
+// position among the predecessors of the join
+static BasicBlock* branch_join(BasicBlock* block, int successor, int* index) {
+    BasicBlock* arm = block->successors[successor];
+    bool is_empty = arm->first != NULL && arm->first->op == IR_JUMP && arm->predecessor_count == 1 &&
+                    arm->id != 0 && arm->successors[0] != arm;
+    if (!is_empty) {
+        *index = ir_predecessor_index(block, successor);
+        return arm;
+    }
+    *index = ir_predecessor_index(arm, 0);
+    return arm->successors[0];
+}
+
+static bool convert_branch(CodeGenerator* gen, BasicBlock* block) {
+    IrInst* terminator = ir_terminator(block);
+    int if_true, if_false;
+    BasicBlock* join = branch_join(block, 0, &if_true);
+    if (join != branch_join(block, 1, &if_false) || join->id == 0) return false;
+    int selects = 0;
+    for (IrInst* phi = join->first; phi != NULL && phi->op == IR_PHI; phi = phi->next) {
+        if (phi->operands[if_true] != phi->operands[if_false]) selects++;
+    }
+    if (selects > MAX_SELECTS) return false;
+
+    // Both operands become the select, so the edge left over carries it
+    // whichever of the two is removed
+    for (IrInst* phi = join->first; phi != NULL && phi->op == IR_PHI; phi = phi->next) {
+        if (phi->operands[if_true] == phi->operands[if_false]) continue;
+        IrInst* select = ir_new(gen->ir, IR_SELECT, phi->type);
+        ir_add_operand(select, terminator->operands[0]);
+        ir_add_operand(select, phi->operands[if_true]);
+        ir_add_operand(select, phi->operands[if_false]);
+        ir_insert_before(terminator, select);
+        phi->operands[if_true] = select;
+        phi->operands[if_false] = select;
+    }
+    ir_remove_edge(block, 1);
+    terminator->op = IR_JUMP;
+    terminator->operand_count = 0;
+    return true;
+}
+
+void optimize_basic_blocks(CodeGenerator* gen) {
+    bool changed = true;
+    while (changed) {
+        changed = simplify_phis(gen);
+
+        for (int b = 0; b < gen->block_count; b++) {
+            BasicBlock* block = gen->blocks[b];
+            IrInst* terminator = ir_terminator(block);
+            if (terminator == NULL) continue;
+
+            if (terminator->op == IR_BRANCH && convert_branch(gen, block)) changed = true;
+            if (terminator->op == IR_BRANCH && block->successors[0] == block->successors[1] &&
+                same_phi_operands(block->successors[0], ir_predecessor_index(block, 0),
+                                  ir_predecessor_index(block, 1))) {
+                ir_remove_edge(block, 1);
+                terminator->op = IR_JUMP;
+                terminator->operand_count = 0;
+                changed = true;
+            }
+            if (terminator->op != IR_JUMP || block->successor_count != 1) continue;
+
+            BasicBlock* successor = block->successors[0];
+            bool has_phi = successor->first != NULL && successor->first->op == IR_PHI;
+            if (successor != block && successor->predecessor_count == 1 && successor->id != 0 && !has_phi) {
+                merge_into(block, successor);
+                changed = true;
+                b--;
+                continue;
+            }
+            if (block->first == terminator && block->id != 0 && successor != block && block->predecessor_count > 0) {
+                if (bypass(block)) changed = true;
+            }
+        }
+        ir_remove_unreachable_blocks(gen);
+    }
+    analyze_control_flow(gen);
+}
@@ -0,0 +1,167 @@
+#include "ir.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Tail calls. A call whose value the function returns as is can reuse
+// the caller's frame: a call to the function itself becomes a jump back
+// to its start with the arguments for the parameters, which turns
+// accumulator-style recursion into a loop the loop passes then work on,
+// and a call to another function becomes a jump to it once the frame is
+// torn down. Neither is allowed when the address of a frame variable may
+// be held on to, since the frame it points into would be reused or gone.
+
+// Whether the address of a frame variable is used other than to load
+// from it or store to it
+static bool has_escaping_locals(CodeGenerator* gen) {
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            for (int i = 0; i < inst->operand_count; i++) {
+                if (inst->operands[i]->op != IR_LOCAL) continue;
+                if ((inst->op == IR_LOAD || inst->op == IR_STORE) && i == 0) continue;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// The call ending `block` ahead of its terminator, or NULL
+static IrInst* last_call(BasicBlock* block) {
+    IrInst* terminator = ir_terminator(block);
+    if (terminator == NULL || terminator->prev == NULL || terminator->prev->op != IR_CALL) return NULL;
+    return terminator->prev;
+}
+
+static bool is_self_call(CodeGenerator* gen, IrInst* call) {
+    return call->symbol != NULL && strcmp(call->symbol, gen->ir->name) == 0 &&
+           call->value == gen->ir->param_count && call->operand_count == call->value;
+}
+
+// A call followed by a jump to a block that only returns, either the
+// call's value through a phi or nothing, gets a return of its own
+static void return_after_calls(CodeGenerator* gen, bool self_only) {
+    bool changed = false;
+    for (int b = 0; b < gen->block_count; b++) {
+        BasicBlock* block = gen->blocks[b];
+        IrInst* call = last_call(block);
+        IrInst* jump = ir_terminator(block);
+        if (call == NULL || jump->op != IR_JUMP || (self_only && !is_self_call(gen, call))) continue;
+        BasicBlock* target = block->successors[0];
+        IrInst* ret = target->first;
+        while (ret != NULL && ret->op == IR_PHI) ret = ret->next;
+        if (ret == NULL || ret->op != IR_RETURN) continue;
+        IrInst* value = NULL;
+        if (ret->operand_count > 0) {
+            value = ret->operands[0];
+            if (value->op == IR_PHI && value->block == target) {
+                value = value->operands[ir_predecessor_index(block, 0)];
+            }
+            if (value != call) continue;
+        }
+        ir_remove_edge(block, 0);
+        jump->op = IR_RETURN;
+        if (value != NULL) ir_add_operand(jump, value);
+        block->is_exit = true;
+        changed = true;
+    }
+    if (changed) {
+        ir_remove_unreachable_blocks(gen);
+        analyze_control_flow(gen);
+    }
+}
+
+// The call in tail position ending `block`, or NULL
+static IrInst* tail_call(BasicBlock* block) {
+    IrInst* call = last_call(block);
+    IrInst* ret = ir_terminator(block);
+    if (call == NULL || ret->op != IR_RETURN) return NULL;
+    if (ret->operand_count > 0 && ret->operands[0] != call) return NULL;
+    return call;
+}
+
+void eliminate_tail_recursion(CodeGenerator* gen) {
+    IrFunction* fn = gen->ir;
+    BasicBlock* entry = gen->blocks[0];
+    if (entry->predecessor_count > 0) return;
+    return_after_calls(gen, true);
+
+    int call_count = 0;
+    for (int b = 0; b < gen->block_count; b++) {
+        IrInst* call = tail_call(gen->blocks[b]);
+        if (call != NULL && is_self_call(gen, call)) call_count++;
+    }
+    if (call_count == 0 || has_escaping_locals(gen)) return;
+
+    // A new entry takes the parameters; the old one becomes the loop
+    // header, with a phi for each of them
+    BasicBlock* start = cfg_new_block();
+    cfg_insert_block(gen, 0, start);
+    start->is_entry = true;
+    entry->is_entry = false;
+    IrInst** params = calloc(fn->param_count + 1, sizeof(IrInst*));
+    for (IrInst* inst = entry->first; inst != NULL;) {
+        IrInst* next = inst->next;
+        if (inst->op == IR_PARAM) {
+            ir_remove(inst);
+            ir_append(start, inst);
+            params[inst->value] = inst;
+        }
+        inst = next;
+    }
+    ir_append(start, ir_new(fn, IR_JUMP, IR_VOID));
+    cfg_add_edge(start, entry);
+
+    IrInst** phis = malloc(sizeof(IrInst*) * (fn->param_count + 1));
+    IrInst** replacement = calloc(fn->value_count + 1, sizeof(IrInst*));
+    for (int p = 0; p < fn->param_count; p++) {
+        phis[p] = NULL;
+        if (params[p] == NULL) continue;
+        phis[p] = ir_new(fn, IR_PHI, params[p]->type);
+        ir_insert_before(entry->first, phis[p]);
+        replacement[params[p]->id] = phis[p];
+    }
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            for (int i = 0; i < inst->operand_count; i++) {
+                IrInst* operand = inst->operands[i];
+                if (operand->id < fn->value_count && replacement[operand->id] != NULL) {
+                    inst->operands[i] = replacement[operand->id];
+                }
+            }
+        }
+    }
+    for (int p = 0; p < fn->param_count; p++) {
+        if (phis[p] != NULL) ir_add_operand(phis[p], params[p]);
+    }
+
+    // Each call passes its arguments to the phis and jumps back, in the
+    // order of the header's predecessors
+    for (int b = 0; b < gen->block_count; b++) {
+        BasicBlock* block = gen->blocks[b];
+        IrInst* call = tail_call(block);
+        if (call == NULL || !is_self_call(gen, call)) continue;
+        for (int p = 0; p < fn->param_count; p++) {
+            if (phis[p] != NULL) ir_add_operand(phis[p], call->operands[p]);
+        }
+        ir_remove(ir_terminator(block));
+        ir_remove(call);
+        ir_append(block, ir_new(fn, IR_JUMP, IR_VOID));
+        block->is_exit = false;
+        cfg_add_edge(block, entry);
+    }
+    free(params);
+    free(phis);
+    free(replacement);
+    analyze_control_flow(gen);
+}
+
+void mark_tail_calls(CodeGenerator* gen) {
+    if (has_escaping_locals(gen)) return;
+    return_after_calls(gen, false);
+    for (int b = 0; b < gen->block_count; b++) {
+        IrInst* call = tail_call(gen->blocks[b]);
+        // Arguments on the stack would go in the caller's frame
+        if (call == NULL || call->symbol == NULL || call->is_variadic || call->value > 6) continue;
+        call->is_tail = true;
+    }
+}
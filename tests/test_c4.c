@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "../c4.h"
+
+void test_compile_to_buffer() {
+    C4Context* ctx = c4_context_new();
+    const char* source = "int main(void) { return 1 + 2 * 3; }";
+    C4Result result;
+
+    bool ok = c4_compile(ctx, source, strlen(source), NULL, &result);
+    assert(ok);
+    assert(result.assembly_length > 0);
+    assert(strstr(result.assembly, ".text") != NULL);
+    assert(result.diagnostics_length == 0);
+
+    c4_context_free(ctx);
+    printf("test_compile_to_buffer: PASSED\n");
+}
+
+void test_diagnostics_in_memory() {
+    C4Context* ctx = c4_context_new();
+    const char* source = "return 1;";
+    C4Options options;
+    c4_options_init(&options);
+    options.filename = "snippet.c";
+    C4Result result;
+
+    bool ok = c4_compile(ctx, source, strlen(source), &options, &result);
+    assert(!ok);
+    assert(result.assembly_length == 0);
+    assert(strstr(result.diagnostics, "snippet.c:1:1: error:") != NULL);
+
+    c4_context_free(ctx);
+    printf("test_diagnostics_in_memory: PASSED\n");
+}
+
+void test_context_reuse() {
+    C4Context* ctx = c4_context_new();
+    C4Result result;
+
+    // Source need not be NUL-terminated
+    const char* source = "int f(void) { return 4 * 5; }garbage";
+    size_t length = strlen(source) - strlen("garbage");
+    for (int i = 0; i < 100; i++) {
+        assert(c4_compile(ctx, source, length, NULL, &result));
+        assert(result.diagnostics_length == 0);
+    }
+    assert(strstr(result.assembly, "garbage") == NULL);
+
+    c4_context_free(ctx);
+    printf("test_context_reuse: PASSED\n");
+}
+
+// Enough live values in each function that allocation has intervals to sort
+static const char* parallel_source =
+    "int g[16];\n"
+    "int mix(int a, int b, int c, int d) {\n"
+    "    int e = a * b + c, f = b * c - d, h = c * d + a, i = d * a - b;\n"
+    "    int j = e + f * h, k = f - h * i, l = h + i * e, m = i - e * f;\n"
+    "    for (int n = 0; n < 16; n++) g[n] = g[n] * j + k * n - l + m;\n"
+    "    return e + f + h + i + j + k + l + m;\n"
+    "}\n"
+    "int main(void) {\n"
+    "    int s = 0;\n"
+    "    for (int n = 0; n < 8; n++) s += mix(n, n + 1, n * 2, s) + g[n];\n"
+    "    return s & 127;\n"
+    "}\n";
+
+typedef struct {
+    bool optimize;
+    const char* expected;
+    bool matched;
+} ParallelJob;
+
+static void* compile_repeatedly(void* arg) {
+    ParallelJob* job = arg;
+    C4Context* ctx = c4_context_new();
+    C4Options options;
+    c4_options_init(&options);
+    options.optimize = job->optimize;
+    job->matched = true;
+    for (int i = 0; i < 100; i++) {
+        C4Result result;
+        bool ok = c4_compile(ctx, parallel_source, strlen(parallel_source), &options, &result);
+        if (!ok || strcmp(result.assembly, job->expected) != 0) job->matched = false;
+    }
+    c4_context_free(ctx);
+    return NULL;
+}
+
+void test_parallel_contexts() {
+    for (int optimize = 0; optimize <= 1; optimize++) {
+        C4Context* ctx = c4_context_new();
+        C4Options options;
+        c4_options_init(&options);
+        options.optimize = optimize;
+        C4Result result;
+        assert(c4_compile(ctx, parallel_source, strlen(parallel_source), &options, &result));
+        char* expected = strdup(result.assembly);
+        c4_context_free(ctx);
+
+        // Contexts on separate threads must not see each other's state
+        pthread_t threads[8];
+        ParallelJob jobs[8];
+        for (int t = 0; t < 8; t++) {
+            jobs[t] = (ParallelJob){optimize, expected, false};
+            pthread_create(&threads[t], NULL, compile_repeatedly, &jobs[t]);
+        }
+        for (int t = 0; t < 8; t++) {
+            pthread_join(threads[t], NULL);
+            assert(jobs[t].matched);
+        }
+        free(expected);
+    }
+    printf("test_parallel_contexts: PASSED\n");
+}
+
+int main() {
+    printf("Running library tests...\n");
+    test_compile_to_buffer();
+    test_diagnostics_in_memory();
+    test_context_reuse();
+    test_parallel_contexts();
+    printf("All library tests passed!\n");
+    return 0;
+}
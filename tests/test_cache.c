@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include "../cache.h"
+
+static char cache_dir[64];
+
+static void make_key(const char* text, char key[CACHE_KEY_LENGTH + 1]) {
+    CacheHasher hasher;
+    cache_hasher_init(&hasher);
+    cache_hasher_update(&hasher, text, strlen(text));
+    cache_hasher_finish(&hasher, key);
+}
+
+void test_key_hash() {
+    char key[CACHE_KEY_LENGTH + 1];
+    make_key("abc", key);
+    assert(strcmp(key, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad") == 0);
+
+    // Field boundaries matter
+    CacheHasher a, b;
+    char key_a[CACHE_KEY_LENGTH + 1], key_b[CACHE_KEY_LENGTH + 1];
+    cache_hasher_init(&a);
+    cache_hasher_add_string(&a, "ab");
+    cache_hasher_add_string(&a, "c");
+    cache_hasher_finish(&a, key_a);
+    cache_hasher_init(&b);
+    cache_hasher_add_string(&b, "a");
+    cache_hasher_add_string(&b, "bc");
+    cache_hasher_finish(&b, key_b);
+    assert(strcmp(key_a, key_b) != 0);
+    printf("test_key_hash: PASSED\n");
+}
+
+void test_store_and_lookup() {
+    CompileCache* cache = cache_open(cache_dir, 0);
+    assert(cache != NULL);
+
+    char key[CACHE_KEY_LENGTH + 1];
+    make_key("source", key);
+
+    size_t length;
+    assert(cache_lookup(cache, key, &length) == NULL);
+    assert(cache_store(cache, key, "output", 6));
+
+    char* data = cache_lookup(cache, key, &length);
+    assert(data != NULL);
+    assert(length == 6 && memcmp(data, "output", 6) == 0);
+    free(data);
+
+    CacheStats stats;
+    assert(cache_read_stats(cache, &stats));
+    assert(stats.hits == 1);
+    assert(stats.misses == 1);
+    assert(stats.entries == 1);
+    assert(stats.size == 6);
+
+    // Replacing an entry does not count it twice
+    assert(cache_store(cache, key, "out", 3));
+    assert(cache_read_stats(cache, &stats));
+    assert(stats.entries == 1);
+    assert(stats.size == 3);
+
+    cache_close(cache);
+    printf("test_store_and_lookup: PASSED\n");
+}
+
+void test_lru_eviction() {
+    CompileCache* cache = cache_open(cache_dir, 1000);
+    char keys[20][CACHE_KEY_LENGTH + 1];
+    char payload[100];
+    memset(payload, 'x', sizeof(payload));
+
+    for (int i = 0; i < 20; i++) {
+        char text[16];
+        sprintf(text, "entry %d", i);
+        make_key(text, keys[i]);
+        assert(cache_store(cache, keys[i], payload, sizeof(payload)));
+
+        // Keep the first entry hot
+        size_t length;
+        free(cache_lookup(cache, keys[0], &length));
+        usleep(2000);
+    }
+
+    CacheStats stats;
+    assert(cache_read_stats(cache, &stats));
+    assert(stats.size <= 1000);
+    assert(stats.evictions > 0);
+
+    size_t length;
+    char* hot = cache_lookup(cache, keys[0], &length);
+    assert(hot != NULL);
+    free(hot);
+    assert(cache_lookup(cache, keys[1], &length) == NULL);
+
+    cache_close(cache);
+    printf("test_lru_eviction: PASSED\n");
+}
+
+void test_size_limit() {
+    // The limit given last is kept with the cache
+    CompileCache* cache = cache_open(cache_dir, 0);
+    CacheStats stats;
+    assert(cache_read_stats(cache, &stats));
+    assert(stats.max_size == 1000);
+    cache_close(cache);
+
+    // An entry that can never fit is refused and evicts nothing
+    cache = cache_open(cache_dir, 0);
+    unsigned long long entries = stats.entries;
+    char key[CACHE_KEY_LENGTH + 1];
+    make_key("too large", key);
+    char payload[950];
+    memset(payload, 'x', sizeof(payload));
+    assert(!cache_store(cache, key, payload, sizeof(payload)));
+    size_t length;
+    assert(cache_lookup(cache, key, &length) == NULL);
+    assert(cache_read_stats(cache, &stats));
+    assert(stats.entries == entries);
+    cache_close(cache);
+
+    // A new limit replaces it
+    cache = cache_open(cache_dir, 4000);
+    cache_close(cache);
+    cache = cache_open(cache_dir, 0);
+    assert(cache_read_stats(cache, &stats));
+    assert(stats.max_size == 4000);
+    assert(cache_store(cache, key, payload, sizeof(payload)));
+    cache_close(cache);
+    printf("test_size_limit: PASSED\n");
+}
+
+int main() {
+    printf("Running cache tests...\n");
+    strcpy(cache_dir, "/tmp/c4-cache-test-XXXXXX");
+    assert(mkdtemp(cache_dir) != NULL);
+
+    test_key_hash();
+    test_store_and_lookup();
+    test_lru_eviction();
+    test_size_limit();
+
+    char command[128];
+    sprintf(command, "rm -rf %s", cache_dir);
+    system(command);
+    printf("All cache tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../codegen.h"
+#include "../parser.h"
+#include "../lexer.h"
+
+// Parse a single function definition and build its analyzed CFG
+static CodeGenerator* build(const char* source, Statement** program) {
+    Lexer* lexer = lexer_init((char*)source, "test.c");
+    Parser* parser = parser_init(lexer);
+    *program = parse_program(parser);
+    assert(!parser->had_error);
+    parser_free(parser);
+
+    Statement* function = (*program)->as.compound.statements[0];
+    assert(function->type == NODE_FUNCTION);
+    CodeGenerator* gen = codegen_init(NULL, true);
+    build_basic_blocks(gen, function);
+    analyze_control_flow(gen);
+    return gen;
+}
+
+// The block where the statement of the given kind, nth of its kind, begins
+static BasicBlock* block_of(CodeGenerator* gen, NodeType type, int nth) {
+    for (int i = 0; i < gen->block_count; i++) {
+        BasicBlock* block = gen->blocks[i];
+        for (int s = 0; s < block->statement_count; s++) {
+            if (block->statements[s]->type == type && nth-- == 0) return block;
+        }
+    }
+    return NULL;
+}
+
+void test_diamond() {
+    Statement* program;
+    CodeGenerator* gen = build("int f(int a) { int x = 0; if (a) { x = 1; } else { x = 2; } return x; }", &program);
+
+    BasicBlock* entry = gen->blocks[0];
+    BasicBlock* then_block = block_of(gen, NODE_EXPRESSION, 0);
+    BasicBlock* else_block = block_of(gen, NODE_EXPRESSION, 1);
+    BasicBlock* join = block_of(gen, NODE_RETURN, 0);
+    assert(entry->exit == EXIT_BRANCH && entry->successor_count == 2);
+    assert(entry->successors[0] == then_block && entry->successors[1] == else_block);
+    assert(join->predecessor_count == 2 && join->is_exit);
+
+    assert(gen->rpo[0] == entry && entry->idom == NULL);
+    assert(then_block->idom == entry && else_block->idom == entry && join->idom == entry);
+    assert(entry->dominated_count == 3);
+    assert(block_dominates(entry, join) && !block_dominates(then_block, join));
+    for (int i = 0; i < gen->block_count; i++) assert(gen->blocks[i]->loop_depth == 0);
+
+    codegen_free(gen);
+    free_statement(program);
+    printf("test_diamond: PASSED\n");
+}
+
+void test_loops() {
+    Statement* program;
+    CodeGenerator* gen = build(
+        "int f(int n) { int s = 0;"
+        " for (int i = 0; i < n; i++) { int j = 0; while (j < i) { s += j; j++; } if (s > 100) break; }"
+        " return s; }", &program);
+
+    BasicBlock* inner = block_of(gen, NODE_EXPRESSION, 0);     // s += j
+    BasicBlock* outer = block_of(gen, NODE_DECLARATION, 2);    // int j = 0
+    BasicBlock* latch = block_of(gen, NODE_EXPRESSION, 2);     // i++
+    BasicBlock* after = block_of(gen, NODE_RETURN, 0);
+    assert(inner->loop_depth == 2);
+    assert(outer->loop_depth == 1 && latch->loop_depth == 1);
+    assert(after->loop_depth == 0);
+
+    // Loop headers dominate their bodies, and only they are headers
+    int headers = 0;
+    for (int i = 0; i < gen->block_count; i++) {
+        BasicBlock* block = gen->blocks[i];
+        if (!block->is_loop_header) continue;
+        headers++;
+        for (int p = 0; p < block->predecessor_count; p++) {
+            BasicBlock* predecessor = block->predecessors[p];
+            assert(predecessor->rpo < block->rpo || block_dominates(block, predecessor));
+        }
+    }
+    assert(headers == 2);
+    assert(block_dominates(outer, inner) && !block_dominates(inner, outer));
+
+    // Loops are rotated: the latch increments and tests, branching back
+    // to the top of the body or out
+    assert(outer->is_loop_header && latch->exit == EXIT_BRANCH);
+    assert(latch->successors[0] == outer && latch->successors[1]->loop_depth == 0);
+
+    // Every forward edge goes up in reverse post-order
+    for (int i = 0; i < gen->rpo_count; i++) {
+        BasicBlock* block = gen->rpo[i];
+        assert(block->rpo == i);
+        for (int s = 0; s < block->successor_count; s++) {
+            BasicBlock* successor = block->successors[s];
+            assert(successor->rpo > i || block_dominates(successor, block));
+        }
+    }
+
+    codegen_free(gen);
+    free_statement(program);
+    printf("test_loops: PASSED\n");
+}
+
+void test_unreachable() {
+    Statement* program;
+    CodeGenerator* gen = build(
+        "int f(int n) { while (1) { if (n) return 1; n++; continue; n--; }"
+        " n = 5; if (0) { n = 6; } return n; }", &program);
+
+    assert(block_of(gen, NODE_EXPRESSION, 0)->rpo >= 0);     // n++
+    assert(block_of(gen, NODE_EXPRESSION, 1)->rpo < 0);      // n--
+    assert(block_of(gen, NODE_EXPRESSION, 2)->rpo < 0);      // n = 5
+    assert(block_of(gen, NODE_EXPRESSION, 3)->rpo < 0);      // n = 6
+
+    codegen_free(gen);
+    free_statement(program);
+    printf("test_unreachable: PASSED\n");
+}
+
+int main() {
+    printf("Running CFG tests...\n");
+    test_diamond();
+    test_loops();
+    test_unreachable();
+    printf("All CFG tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,771 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../c4.h"
+
+// Compile `source` to assembly, or straight to an object, link it with
+// the system compiler and run it. Returns the program's exit status.
+// A negative vector width keeps the default.
+static int run_program(const char* source, bool optimize, bool object, int vector_width) {
+    C4Context* ctx = c4_context_new();
+    C4Options options;
+    c4_options_init(&options);
+    options.filename = "program.c";
+    options.optimize = optimize;
+    options.object = object;
+    if (vector_width >= 0) options.vector_width = vector_width;
+    C4Result result;
+    bool ok = c4_compile(ctx, source, strlen(source), &options, &result);
+    if (!ok) fprintf(stderr, "%s", result.diagnostics);
+    assert(ok);
+
+    const char* output = object ? result.object : result.assembly;
+    size_t length = object ? result.object_length : result.assembly_length;
+    if (object) assert(length > 4 && memcmp(output, "\177ELF", 4) == 0);
+
+    char input[] = "/tmp/c4_codegen_XXXXXX.s";
+    if (object) input[strlen(input) - 1] = 'o';
+    int fd = mkstemps(input, 2);
+    assert(fd >= 0);
+    assert(write(fd, output, length) == (ssize_t)length);
+    close(fd);
+    c4_context_free(ctx);
+
+    char executable[sizeof(input)];
+    strcpy(executable, input);
+    executable[strlen(executable) - 2] = '\0';
+
+    char command[256];
+    snprintf(command, sizeof(command), "cc -o %s %s", executable, input);
+    assert(system(command) == 0);
+    int status = system(executable);
+    unlink(input);
+    unlink(executable);
+    assert(WIFEXITED(status));
+    return WEXITSTATUS(status);
+}
+
+// Every program must behave the same assembled by `as` and encoded by c4
+static void expect(const char* source, int expected) {
+    assert(run_program(source, false, false, -1) == expected);
+    assert(run_program(source, true, false, -1) == expected);
+    assert(run_program(source, false, true, -1) == expected);
+    assert(run_program(source, true, true, -1) == expected);
+}
+
+void test_arithmetic() {
+    expect("int main(void) { return 1 + 2 * 3; }", 7);
+    expect("int main(void) { int a = -7; return (a / 2 == -3) + (a % 2 == -1) * 2 + (a >> 1 == -4) * 4; }", 7);
+    expect("int main(void) { unsigned int u = 4000000000u; return u / 7u % 256u; }", 4000000000u / 7u % 256u);
+    expect("int main(void) { long x = 1234567890123L; x >>= 20; return x % 100; }", (1234567890123L >> 20) % 100);
+    expect("int main(void) { char c = 120; c += 10; unsigned char u = 250; u += 10; return (c == -126) + u; }", 5);
+    expect("int main(void) { int i = 100; i /= 7; i %= 5; i <<= 4; i |= 1; i ^= 3; i &= 0x7f; return i; }", 66);
+    printf("test_arithmetic: PASSED\n");
+}
+
+void test_conversions() {
+    // Operands narrower than int are promoted before comparing: int
+    // against unsigned char or short compares as int
+    const char* compare =
+        "int ge(int a, unsigned char b) { return a >= b; }"
+        " int lt(int a, unsigned short b) { return a < b; }"
+        " int lt_cast(int a, int b) { return a < (unsigned short)b; }"
+        " int main(void) { return ge(-1, 4) + lt(-1, 4) * 2 + lt_cast(-1, 4) * 4 + (-1 < (unsigned char)4) * 8; }";
+    expect(compare, 14);
+
+    // Changing only the signedness of a char or short changes its value
+    const char* casts =
+        "int uc(char c) { return (unsigned char)c; }"
+        " int us(char c) { return (unsigned short)c; }"
+        " int uss(short s) { return (unsigned short)s; }"
+        " int sc(unsigned char c) { return (char)c; }"
+        " int ss(unsigned short s) { return (short)s; }"
+        " int sus(unsigned char c) { return (short)c; }"
+        " int main(void) { return (uc(-7) == 249) + (us(-1) == 65535) * 2 + (uss(-2) == 65534) * 4 +"
+        " (sc(200) == -56) * 8 + (ss(65535) == -1) * 16 + (sus(200) == 200) * 32 +"
+        " ((unsigned short)(char)-1 == 65535) * 64 + ((char)(unsigned char)200 == -56) * 128; }";
+    expect(casts, 255);
+    printf("test_conversions: PASSED\n");
+}
+
+void test_control_flow() {
+    expect("int main(void) { int s = 0; for (int i = 0; i < 10; i++) { if (i == 7) break;"
+           " if (i % 2) continue; s += i; } return s; }", 12);
+    expect("int main(void) { int k = 0; do { k++; } while (k < 5 && k != 3); return k; }", 3);
+    expect("int f(int n) { if (n < 2) return n; return f(n - 1) + f(n - 2); }"
+           "int main(void) { return f(10); }", 55);
+    printf("test_control_flow: PASSED\n");
+}
+
+void test_memory() {
+    expect("int g[4]; static long total = 5;"
+           "int main(void) { int a[5]; int* p = a; for (int i = 0; i < 5; i++) *p++ = i * i;"
+           " g[2] = a[3]; total += g[2]; return total + (p - a); }", 19);
+    expect("int len(char* s) { char* p = s; while (*p) p++; return p - s; }"
+           "int main(void) { return len(\"tab\\there\"); }", 8);
+    printf("test_memory: PASSED\n");
+}
+
+void test_calls() {
+    // Arguments beyond the sixth are passed on the stack
+    expect("int f(int a, int b, int c, int d, int e, int f, int g, int h) {"
+           " return a - b + c * d - e / f + g % h * 10; }"
+           "int main(void) { return f(f(1, 1, 1, 1, 1, 1, 1, 1), 2, 3, 4, 5, 6, 7, 8); }", 80);
+    expect("int id(int x) { return x; }"
+           "int main(void) { int a = 3; return a - (id(a) - (a - (id(a) - (a - (id(a) - (a - (id(a)"
+           " - (a - (id(a) - (a - (id(a) - a))))))))))); }", 3);
+    printf("test_calls: PASSED\n");
+}
+
+void test_object() {
+    // Relocations against strings, globals, static data and library calls
+    expect("int strcmp(char* a, char* b); char* name = \"c4\"; static int count = 3; int zero;"
+           "int main(void) { return (strcmp(name, \"c4\") == 0) + count * 2 + zero; }", 7);
+    // Branches far enough apart to need 32-bit displacements
+    expect("int main(void) { int s = 0; for (int i = 0; i < 4; i++) { s += i; s += i; s += i; s += i;"
+           " s += i; s += i; s += i; s += i; s += i; s += i; s += i; s += i; s += i; s += i;"
+           " s += i; s += i; s += i; s += i; s += i; s += i; s += i; s += i; } return s; }", 132);
+    // Byte registers that need a REX prefix, and wide immediates
+    expect("int sum(char a, char b, char c, char d) { return a + b + c + d; }"
+           "int main(void) { long big = 0x123456789L; return sum(1, 2, 3, 4) + (big >> 32); }", 11);
+    printf("test_object: PASSED\n");
+}
+
+// The allocator's report line for `function`
+static void allocation_report(const char* source, const char* function, char* line, size_t size) {
+    C4Context* ctx = c4_context_new();
+    C4Result result;
+    assert(c4_compile(ctx, source, strlen(source), NULL, &result));
+    const char* start = result.report;
+    size_t name_length = strlen(function);
+    while (!(strncmp(start, function, name_length) == 0 && start[name_length] == ':')) {
+        start = strchr(start, '\n');
+        assert(start != NULL);
+        start++;
+    }
+    size_t length = strchr(start, '\n') - start;
+    assert(length < size);
+    memcpy(line, start, length);
+    line[length] = '\0';
+    c4_context_free(ctx);
+}
+
+void test_register_allocation() {
+    // More values live across a loop than there are registers
+    const char* pressure =
+        "int mix(int n) { int a = n, b = n + 1, c = n + 2, d = n + 3, e = n + 4, f = n + 5, g = n + 6,"
+        " h = n + 7, i = n + 8, j = n + 9, k = n + 10, l = n + 11, m = n + 12, o = n + 13, p = n + 14;"
+        " for (int t = 0; t < n + 2; t++) { a += b; b += c; c += d; d += e; e += f; f += g; g += h;"
+        " h += i; i += j; j += k; k += l; l += m; m += o; o += p; p += a; }"
+        " return (a + b + c + d + e + f + g + h + i + j + k + l + m + o + p) & 127; }"
+        "int main(void) { return mix(1); }";
+    int a = 1, b = 2, c = 3, d = 4, e = 5, f = 6, g = 7, h = 8, i = 9, j = 10, k = 11, l = 12, m = 13, o = 14, p = 15;
+    for (int t = 0; t < 3; t++) {
+        a += b; b += c; c += d; d += e; e += f; f += g; g += h;
+        h += i; i += j; j += k; k += l; l += m; m += o; o += p; p += a;
+    }
+    expect(pressure, (a + b + c + d + e + f + g + h + i + j + k + l + m + o + p) & 127);
+
+    // Values live across calls, in loops, and through short-circuit branches
+    expect("int sq(int x) { return x * x; }"
+           "int main(void) { int s = 0, u = 1, v = 2; for (int i = 0; i < 6; i++) {"
+           " int w = sq(i) + u; if (i > 1 && w % 3 == 0 || v == 5) s += w; u += sq(v); v = i; }"
+           " return s & 255; }", 24);
+
+    char line[128];
+    allocation_report("int sum(int* a, int n) { int s = 0; for (int i = 0; i < n; i++) s += a[i]; return s; }",
+                      "sum", line, sizeof(line));
+    assert(strstr(line, " 0 spilled, 0 split") != NULL);
+    allocation_report(pressure, "mix", line, sizeof(line));
+    assert(strstr(line, " 0 spilled, 0 split") == NULL);
+    printf("test_register_allocation: PASSED\n");
+}
+
+void test_peephole() {
+    // A sum computed into a copy and moved into %rax, an addition of
+    // zero, and a comparison with zero tested without an immediate
+    const char* source =
+        "int fib(int n) { if (n < 2) return n + 0; return fib(n - 1) + fib(n - 2); }"
+        "int even(int x) { return x % 2 == 0; }"
+        "int main(void) { int s = 0; for (int i = 0; i < 10; i++) s += even(i) + i; return s + fib(5) - 5; }";
+    expect(source, 50);
+
+    C4Context* ctx = c4_context_new();
+    C4Result result;
+    assert(c4_compile(ctx, source, strlen(source), NULL, &result));
+    assert(strstr(result.assembly, "cmpl $0,") == NULL);
+    assert(strstr(result.report, "even: ") != NULL);
+    const char* hits = strstr(result.report, "  peephole: ");
+    assert(hits != NULL && strstr(hits, "move-chain 1") != NULL && strstr(hits, "identity 1") != NULL);
+    c4_context_free(ctx);
+    printf("test_peephole: PASSED\n");
+}
+
+// Assembly of `source`, compiled with optimization and, unless
+// `unroll_factor` is 0, that unroll factor; the caller frees it
+static char* optimized_assembly(const char* source, int unroll_factor, int vector_width) {
+    C4Context* ctx = c4_context_new();
+    C4Options options;
+    c4_options_init(&options);
+    if (unroll_factor != 0) options.unroll_factor = unroll_factor;
+    if (vector_width >= 0) options.vector_width = vector_width;
+    C4Result result;
+    assert(c4_compile(ctx, source, strlen(source), &options, &result));
+    char* assembly = strdup(result.assembly);
+    c4_context_free(ctx);
+    return assembly;
+}
+
+void test_branches() {
+    // Short-circuit conditions, negated and nested, with side effects in
+    // the operands that must not run
+    expect("int n; int bump(int v) { n++; return v; }"
+           "int main(void) { int s = 0; for (int i = 0; i < 20; i++) {"
+           " if (i > 3 && bump(i % 3) || !(i < 18) && !bump(0)) s += i;"
+           " if (!(i & 1 || bump(i) > 10)) s += 100; } return (s + n) & 255; }", 769 & 255);
+    expect("int main(void) { int a = 5, b = 0, c = -1;"
+           " return (a && b) + 2 * (a || b) + 4 * (b || c && a) + 8 * !(a && !c); }", 14);
+
+    // Selects, including unsigned and 64-bit ones
+    expect("int main(void) { int m = 0; unsigned u = 7; long l = 0;"
+           " for (int i = -5; i < 9; i++) { int x = (i * 7) % 11; if (x > m) m = x;"
+           " if ((unsigned)i < u) u = i; if (i > 2) l++; else l--; }"
+           " return m * 16 + u + (l == -2); }", 10 * 16 + 0 + 1);
+
+    // A loop condition is a compare and a jump, and a running maximum a
+    // conditional move
+    char* assembly = optimized_assembly(
+        "int max(int* a, int n) { int m = a[0]; for (int i = 1; i < n; i++) { int x = a[i]; if (x > m) m = x; } return m; }",
+        0, -1);
+    assert(strstr(assembly, "cmov") != NULL);
+    assert(strstr(assembly, "set") == NULL);
+    free(assembly);
+
+    // Loops are entered through a guard and iterate on one conditional
+    // branch back to an aligned top, without a jump of their own
+    assembly = optimized_assembly("int sum(int* a, int n) { int s = 0; for (int i = 0; i < n; i++) s += a[i]; return s; }", 1,
+                                  0);
+    const char* top = strstr(assembly, ".align 16");
+    assert(top != NULL);
+    const char* label = strstr(top, ".Lsum.");
+    char name[32];
+    int length = (int)strcspn(label, ":");
+    snprintf(name, sizeof(name), "jl %.*s\n", length, label);
+    const char* back = strstr(top, name);
+    assert(back != NULL);
+    for (const char* p = top; p < back; p++) assert(strncmp(p, "jmp", 3) != 0);
+    free(assembly);
+    printf("test_branches: PASSED\n");
+}
+
+// Division and remainder by constants, checked against the same
+// operations by the divisor held in memory, which need a divide
+// instruction. Signed division of the most negative value by -1 traps.
+typedef struct {
+    const char* type;
+    const char* name;
+    const char* minimum;     // Of a signed type
+    const char* divisors[80];
+} DivisionCase;
+
+static const DivisionCase division_cases[] = {
+    {"int", "s", "(-2147483647 - 1)",
+     {"1", "2", "3", "4", "5", "6", "7", "8", "9", "10", "11", "12", "13", "14", "15", "16", "17", "25", "31",
+      "32", "60", "100", "125", "641", "1000", "4096", "65535", "65536", "65537", "1000000007", "1073741824",
+      "2147483647", "(-2147483647 - 1)", "-1", "-2", "-3", "-5", "-6", "-7", "-8", "-10", "-100", "-65536",
+      "-1000000007", "-2147483647", NULL}},
+    {"unsigned", "u", NULL,
+     {"1u", "2u", "3u", "5u", "6u", "7u", "9u", "10u", "11u", "12u", "13u", "14u", "16u", "19u", "25u", "28u",
+      "100u", "125u", "641u", "1000u", "65535u", "65537u", "1000000007u", "2147483647u", "2147483648u",
+      "2147483649u", "3000000000u", "4294967294u", "4294967295u", NULL}},
+    {"long", "l", "(-9223372036854775807L - 1)",
+     {"1L", "2L", "3L", "5L", "6L", "7L", "10L", "12L", "25L", "100L", "641L", "1000L", "1000000007L",
+      "4294967296L", "4294967297L", "1000000000000L", "9223372036854775807L", "(-9223372036854775807L - 1)",
+      "-1L", "-2L", "-3L", "-7L", "-10L", "-4294967296L", "-1000000000000L", "-9223372036854775807L", NULL}},
+    {"unsigned long", "v", NULL,
+     {"1UL", "2UL", "3UL", "5UL", "7UL", "10UL", "12UL", "641UL", "1000UL", "1000000007UL", "4294967295UL",
+      "4294967296UL", "4294967297UL", "10000000000000000000UL", "9223372036854775807UL",
+      "9223372036854775808UL", "9223372036854775809UL", "18446744073709551614UL", "18446744073709551615UL",
+      NULL}},
+};
+
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} Text;
+
+static void append(Text* text, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    va_list copy;
+    va_copy(copy, args);
+    int n = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+    if (text->length + n + 1 > text->capacity) {
+        text->capacity = (text->length + n + 1) * 2;
+        text->data = realloc(text->data, text->capacity);
+    }
+    vsnprintf(text->data + text->length, n + 1, format, args);
+    text->length += n;
+    va_end(args);
+}
+
+void test_division_by_constants() {
+    Text source = {NULL, 0, 0};
+    int case_count = sizeof(division_cases) / sizeof(division_cases[0]);
+    for (int c = 0; c < case_count; c++) {
+        const DivisionCase* dc = &division_cases[c];
+        append(&source, "%s %s_divisor[80];\n", dc->type, dc->name);
+        for (int d = 0; dc->divisors[d] != NULL; d++) {
+            const char* divisor = dc->divisors[d];
+            append(&source, "int %s%d(%s x, %s d) {", dc->name, d, dc->type, dc->type);
+            if (dc->minimum != NULL && (strcmp(divisor, "-1") == 0 || strcmp(divisor, "-1L") == 0)) {
+                append(&source, " if (x == %s) return 0;", dc->minimum);
+            }
+            append(&source, " return (x / %s != x / d) + (x %% %s != x %% d); }\n", divisor, divisor);
+        }
+    }
+    append(&source, "void setup(void) {\n");
+    for (int c = 0; c < case_count; c++) {
+        const DivisionCase* dc = &division_cases[c];
+        for (int d = 0; dc->divisors[d] != NULL; d++) {
+            append(&source, " %s_divisor[%d] = %s;\n", dc->name, d, dc->divisors[d]);
+        }
+    }
+    append(&source, "}\nint check(long x) { int bad = 0;\n");
+    for (int c = 0; c < case_count; c++) {
+        const DivisionCase* dc = &division_cases[c];
+        for (int d = 0; dc->divisors[d] != NULL; d++) {
+            append(&source, " bad += %s%d(x, %s_divisor[%d]);\n", dc->name, d, dc->name, d);
+        }
+    }
+    // Dividends of every magnitude and sign from a generator, small ones,
+    // and the extremes of each type
+    append(&source,
+           " return bad; }\n"
+           "int main(void) { setup(); int bad = 0; unsigned long seed = 12345;\n"
+           " long extremes[8]; extremes[0] = 2147483647; extremes[1] = -2147483647 - 1;\n"
+           " extremes[2] = 4294967295L; extremes[3] = 9223372036854775807L;\n"
+           " extremes[4] = -9223372036854775807L - 1; extremes[5] = -1; extremes[6] = 2147483648L;\n"
+           " extremes[7] = -2147483647;\n"
+           " for (int i = 0; i < 8; i++) { bad += check(extremes[i]); bad += check(extremes[i] - 1); }\n"
+           " for (long x = -1000; x <= 1000; x++) bad += check(x);\n"
+           " for (int i = 0; i < 6000; i++) { seed = seed * 6364136223846793005UL + 1442695040888963407UL;\n"
+           "  bad += check((long)seed >> (i %% 64)); }\n"
+           " return bad != 0; }\n");
+    expect(source.data, 0);
+    free(source.data);
+
+    // No divide instructions are left
+    char* assembly = optimized_assembly(
+        "int f(int x) { return x / 7 + x % 10; } unsigned g(unsigned x) { return x / 10u + x % 3u; }"
+        "long h(long x) { return x / 1000L + x % 16L; } unsigned long k(unsigned long x) { return x / 7UL; }", 0, -1);
+    assert(strstr(assembly, "div") == NULL);
+    free(assembly);
+    printf("test_division_by_constants: PASSED\n");
+}
+
+void test_unrolling() {
+    // Every remainder of the unrolled trip counts, counting up and down,
+    // with the counter and other values used after the loops
+    expect("int a[40];"
+           " int up(int lo, int hi) { int s = 0; for (int i = lo; i < hi; i++) s += a[i]; return s; }"
+           " int down(int hi, int lo) { int s = 0; for (int i = hi; i >= lo; i -= 2) s = s * 3 + a[i]; return s; }"
+           " int last(int n) { int i, x = -1; for (i = 0; i < n; i++) x = a[i] * i; return x + i * 1000; }"
+           " int main(void) { int bad = 0; for (int i = 0; i < 40; i++) a[i] = i * 7 % 13;"
+           " for (int n = 0; n < 20; n++) { int s = 0, t = 0, x = -1, j = n - 1;"
+           "  for (int k = 3; k < n + 3; k = k + 1) s += a[k];"
+           "  while (j + 9 >= 9) { t = t * 3 + a[j + 9]; j -= 2; }"
+           "  if (n > 0) x = a[n - 1] * (n - 1);"
+           "  bad += (up(3, n + 3) != s) + (down(n + 8, 9) != t) + (last(n) != x + n * 1000); }"
+           " return bad; }", 0);
+
+    // Constant trip counts go away, near the limits of the counter too
+    expect("int main(void) { int s = 0, t = 0; unsigned u = 0;"
+           " for (int i = 0; i < 5; i++) s = s * 2 + i;"
+           " for (int i = 2147483640; i < 2147483647; i++) t += i & 3;"
+           " for (unsigned i = 4294967290u; i != 4294967295u; i++) u += i & 7;"
+           " return (s == 26) + (t == 9) * 2 + (u == 20) * 4; }", 7);
+    char* assembly = optimized_assembly("int f(int* a) { int s = 0; for (int i = 0; i < 8; i++) s += a[i]; return s; }", 0, -1);
+    assert(strstr(assembly, "28(") != NULL && strstr(assembly, "\tj") == NULL && strstr(assembly, " j") == NULL);
+    free(assembly);
+    printf("test_unrolling: PASSED\n");
+}
+
+void test_vectorization() {
+    // Every remainder of the vector width, with arrays overlapping a few
+    // elements apart either way, against the same loops kept scalar by a
+    // call in them, which recursion keeps from being inlined away
+    const char* source =
+        "int a[80], b[80], c[80];"
+        " int id(int x) { if (x < 0) return id(x + 1) - 1; return x; }"
+        " void mix(int* d, int* x, int* y, int k, int n) { for (int i = 0; i < n; i++)"
+        "  d[i] = (x[i] * y[i] + k ^ (x[i] << 3) - ((unsigned)y[i] >> 2)) | (~x[i] & -y[i]) + (x[i] >> 1) * 4; }"
+        " void mix_scalar(int* d, int* x, int* y, int k, int n) { for (int i = 0; i < n; i++)"
+        "  d[i] = (x[id(i)] * y[i] + k ^ (x[i] << 3) - ((unsigned)y[i] >> 2)) | (~x[i] & -y[i]) + (x[i] >> 1) * 4; }"
+        " int total(int* x, int n) { int s = 7; for (int i = 0; i < n; i++) s -= x[i] * 3; return s; }"
+        " int total_scalar(int* x, int n) { int s = 7; for (int i = 0; i < n; i++) s -= x[id(i)] * 3; return s; }"
+        " void fill(int* d, int v, int n) { for (int i = 0; i < n; i++) d[i] = v; }"
+        " int main(void) { int bad = 0;"
+        "  for (int i = 0; i < 80; i++) b[i] = i * 11 % 23 - 11;"
+        "  for (int n = 0; n < 20; n++) for (int apart = -9; apart <= 9; apart++) {"
+        "   for (int i = 0; i < 80; i++) a[i] = c[i] = i * 37 % 101 - 50;"
+        "   mix(a + 30 + apart, a + 30, b, n - 5, n); mix_scalar(c + 30 + apart, c + 30, b, n - 5, n);"
+        "   bad += total(a + 30 + apart, n) != total_scalar(c + 30 + apart, n);"
+        "   fill(a + apart + 40, n, n % 11); fill(c + apart + 40, n, n % 11);"
+        "   for (int i = 0; i < 80; i++) bad += a[i] != c[i]; }"
+        "  return bad != 0; }";
+    expect(source, 0);
+    if (__builtin_cpu_supports("avx2")) {
+        assert(run_program(source, true, false, 8) == 0);
+        assert(run_program(source, true, true, 8) == 0);
+    }
+
+    // SSE2 by default, AVX2 with its upper halves cleared on the way out,
+    // or not at all
+    const char* sum = "int sum(int* a, int n) { int s = 0; for (int i = 0; i < n; i++) s += a[i]; return s; }";
+    char* assembly = optimized_assembly(sum, 0, -1);
+    assert(strstr(assembly, "movdqu (") != NULL && strstr(assembly, "paddd %xmm") != NULL);
+    assert(strstr(assembly, "ymm") == NULL && strstr(assembly, "vzeroupper") == NULL);
+    free(assembly);
+    assembly = optimized_assembly(sum, 0, 8);
+    assert(strstr(assembly, "vmovdqu (") != NULL && strstr(assembly, "vpaddd %ymm") != NULL);
+    assert(strstr(assembly, "vzeroupper") != NULL);
+    free(assembly);
+    assembly = optimized_assembly(sum, 0, 0);
+    assert(strstr(assembly, "xmm") == NULL);
+    free(assembly);
+    printf("test_vectorization: PASSED\n");
+}
+
+void test_inlining() {
+    // Callees with several returns, stores through pointer arguments,
+    // strings, loops, frame arrays, narrow and stack parameters, and
+    // recursion, inlined and not
+    const char* source =
+        "int strcmp(char* a, char* b);"
+        " static int clamp(int v, int lo, int hi) { if (v < lo) return lo; if (v > hi) return hi; return v; }"
+        " static void put(int* p, int v) { *p = v; }"
+        " static int named(char* s) { return strcmp(s, \"c4\") == 0; }"
+        " static int sum(int n) { int s = 0; for (int i = 1; i <= n; i++) s += i; return s; }"
+        " static int pair(int a, int b) { int t[2]; t[0] = a; t[1] = b; return t[0] * 10 + t[1]; }"
+        " static int bytes(char a, unsigned char b) { return a + b; }"
+        " static int eight(int a, int b, int c, int d, int e, int f, int g, int h) { return a + b + c + d + e + f + g - h; }"
+        " int fact(int n) { if (n <= 1) return 1; return n * fact(n - 1); }"
+        " static int nothing(int x) { if (x) return 1; }"
+        " int main(void) { int s = 0; int t;"
+        "  for (int i = 0; i < 10; i++) s += clamp(i * i, 5, 50);"
+        "  put(&t, 7); nothing(0);"
+        "  return s - 250 + t - 7 + named(\"c4\") - 1 + sum(4) - 10 + pair(3, 4) - 34"
+        "   + bytes(300, 300) - 88 + eight(1, 2, 3, 4, 5, 6, 7, 8) - 20 + fact(5) - 120; }";
+    expect(source, 0);
+
+    // Small helpers leave no call behind, unless told otherwise
+    const char* helper = "static int sq(int x) { return x * x; } int f(int x) { return sq(x) + sq(x + 1); }";
+    char* assembly = optimized_assembly(helper, 0, -1);
+    assert(strstr(assembly, "call") == NULL);
+    free(assembly);
+    C4Context* ctx = c4_context_new();
+    C4Options options;
+    c4_options_init(&options);
+    options.inline_functions = false;
+    C4Result result;
+    assert(c4_compile(ctx, helper, strlen(helper), &options, &result));
+    assert(strstr(result.assembly, "call sq") != NULL);
+    c4_context_free(ctx);
+    printf("test_inlining: PASSED\n");
+}
+
+void test_tail_calls() {
+    // Tail calls to the function itself, to others, with stack arguments,
+    // through a returned phi and next to calls that are not in tail position
+    const char* source =
+        "int odd(int n);"
+        " int even(int n) { if (n == 0) return 1; return odd(n - 1); }"
+        " int odd(int n) { if (n == 0) return 0; return even(n - 1); }"
+        " long sum(long n, long acc) { if (n == 0) return acc; return sum(n - 1, acc + n); }"
+        " int eight(int a, int b, int c, int d, int e, int f, int g, int h) {"
+        "  if (a == 0) return b - h; return eight(a - 1, b + c, c, d, e, f, g, h + 1); }"
+        " int fact(int n) { if (n <= 1) return 1; return n * fact(n - 1); }"
+        " int deref(int* p, int n) { return *p + n; }"
+        " int kept(int n) { int x = n; if (n == 0) return 0; return deref(&x, kept(n - 1)); }"
+        " int main(void) { int r = fact(4);"
+        "  return even(9) + odd(9) - 1 + sum(100, 0) - 5050 + eight(3, 1, 2, 3, 4, 5, 6, 7) + 3 + kept(4) - 10 + r - 24; }";
+    expect(source, 0);
+
+    // Deep recursion runs in constant stack space once optimized, the
+    // calls between functions too big to inline being jumps
+    const char* deep =
+        "int g[4];"
+        " int pong(int n);"
+        " int ping(int n) { g[0] += n; g[1] ^= n * 3; g[2] += g[0] >> 2; g[3] -= g[1] & 7; g[0] ^= g[3] * 5;"
+        "  g[1] += g[2] >> 1; g[2] ^= g[1] << 2; g[3] += g[2] * 9; if (n == 0) return g[0] & 1; return pong(n - 1); }"
+        " int pong(int n) { g[3] += n; g[2] ^= n * 5; g[1] += g[3] >> 2; g[0] -= g[2] & 7; g[3] ^= g[0] * 3;"
+        "  g[2] += g[1] >> 1; g[1] ^= g[2] << 2; g[0] += g[1] * 9; if (n == 0) return g[3] & 1; return ping(n - 1); }"
+        " long sum(long n, long acc) { if (n == 0) return acc; return sum(n - 1, acc + n); }"
+        " int main(void) { return (sum(50000000, 0) == 1250000025000000) + ping(10000000) + pong(10000001); }";
+    char* assembly = optimized_assembly(deep, 0, -1);
+    assert(strstr(assembly, "jmp pong@PLT") != NULL && strstr(assembly, "jmp ping@PLT") != NULL);
+    assert(strstr(assembly, "call sum") == NULL);
+    free(assembly);
+    assert(run_program(deep, true, false, -1) == 1);
+    assert(run_program(deep, true, true, -1) == 1);
+
+    // A frame variable whose address is passed on must outlive the call
+    assembly = optimized_assembly("int g(int* p); int f(int x) { return g(&x); }", 0, -1);
+    assert(strstr(assembly, "call g") != NULL);
+    free(assembly);
+    printf("test_tail_calls: PASSED\n");
+}
+
+// Randomly generated programs that once differed from gcc: calls with
+// char and short arguments, compared and cast across signedness
+void test_generated_programs() {
+    const char* first =
+        "long g[8];\n"
+        "static int f0(int p0, unsigned short p1, char p2, int p3, unsigned short p4);\n"
+        "int f1(int p0, char p1, unsigned char p2);\n"
+        "static int f0(int p0, unsigned short p1, char p2, int p3, unsigned short p4) {\n"
+        "    if (p2 == -1) g[3] += p0; else g[0] -= 7;\n"
+        "    for (int i = 0; i < (p2 & 7); i++) g[6] += i * p2;\n"
+        "    if (p3 == 2) g[5] += ((p4 < p4) < (p0 * p1)); else g[2] -= (p0 + p1);\n"
+        "    if (p4 == 97) g[0] += ((p0 == p0) >> 1); else g[6] -= ((p2 & p1) | p2);\n"
+        "    if (p0 <= 0) return g[6];\n"
+        "    g[3] += f1(p0 - 1, p2, (g[6] >> 4));\n"
+        "    return 7;\n"
+        "}\n"
+        "int f1(int p0, char p1, unsigned char p2) {\n"
+        "    if (p1 == -56) g[1] += ((p1 < 4) - 4); else g[0] -= g[3];\n"
+        "    if (p0 <= 0) return p2;\n"
+        "    g[6] += f1(p0 - 1, p1, 7);\n"
+        "    g[3] += f1(p0 - 1, p2, p2);\n"
+        "    return (p1 ^ (g[3] == p1));\n"
+        "}\n"
+        "int main() {\n"
+        "    long t = 0;\n"
+        "    t = t * 3 + f1(4, (char)200, 1);\n"
+        "    t = t * 3 + f1(2, 7, (short)-4);\n"
+        "    t = t * 3 + f1(2, 7, (short)-4);\n"
+        "    t = t * 3 + f1(2, 7, (short)-4);\n"
+        "    long x = t + (g[0] + g[1]) * 3 + (g[2] + g[3] * 3) * 5 + (g[4] + g[5] + g[6]) * 7;\n"
+        "    return (x ^ x >> 8 ^ x >> 16 ^ x >> 24) & 255;\n"
+        "}\n";
+    expect(first, 133);
+
+    const char* second =
+        "long g[8];\n"
+        "static long f0(int p0, short p1);\n"
+        "static int f1(int p0, int p1, unsigned short p2);\n"
+        "static long f0(int p0, short p1) {\n"
+        "    p1++;\n"
+        "    if (p0 <= 0) return (p0 < (5 + g[2]));\n"
+        "    g[0] += f1(p0 - 1, 'a', 1);\n"
+        "    g[0] += f1(p0 - 1, -1, p1);\n"
+        "    return ((p0 >> 1) & p1);\n"
+        "}\n"
+        "static int f1(int p0, int p1, unsigned short p2) {\n"
+        "    if (p0 <= 0) return ((p0 * p1) >> 1);\n"
+        "    g[3] += f1(p0 - 1, 70000, (-1 * p0));\n"
+        "    g[6] += f1(p0 - 1, p1, 300);\n"
+        "    g[0] += f1(p0 - 1, (p0 ^ -1), (g[5] + p2));\n"
+        "    return p2;\n"
+        "}\n"
+        "int main() {\n"
+        "    long t = 0;\n"
+        "    t = t * 3 + f0(4, -3);\n"
+        "    t = t * 3 + f0(4, -3);\n"
+        "    t = t * 3 + f0(4, (short)-4);\n"
+        "    t = t * 3 + f0(4, (short)-4);\n"
+        "    t = t * 3 + f0(1, 'a');\n"
+        "    t = t * 3 + f0(1, 'a');\n"
+        "    t = t * 3 + f0(1, 'a');\n"
+        "    t = t * 3 + f1(2, (char)200, (char)200);\n"
+        "    t = t * 3 + f1(5, 70000, 200);\n"
+        "    t = t * 3 + f1(5, 70000, 200);\n"
+        "    t = t * 3 + f1(5, 70000, 200);\n"
+        "    t = t * 3 + f1(4, 3, -1);\n"
+        "    t = t * 3 + f1(4, 3, -1);\n"
+        "    t = t * 3 + f1(4, 3, -1);\n"
+        "    long x = t + (g[0] + g[1]) * 3 + (g[2] + g[3] * 3) * 5 + (g[4] + g[5] + g[6]) * 7;\n"
+        "    return (x ^ x >> 8 ^ x >> 16 ^ x >> 24) & 255;\n"
+        "}\n";
+    expect(second, 252);
+    printf("test_generated_programs: PASSED\n");
+}
+
+void test_specialization() {
+    // Parameters every call passes the same constant to, passed on in
+    // recursion, and clones for the flags some calls pass; narrow
+    // parameters get constants they cannot hold too
+    const char* source =
+        "int g[8];"
+        " static int unused(int x) { return x + 1; }"
+        " static int mix(int x, int mode, char c) { if (mode == 1) return x * 3 + c; if (mode == 2) return x - c; return x ^ c; }"
+        " int work(int* a, int n, int flags) { int s = 0; for (int i = 0; i < n; i++) {"
+        "  if (flags & 1) s += a[i] * 3; else if (flags & 2) s -= a[i] >> 1; else s ^= a[i];"
+        "  if (flags & 4) s += i; if (flags & 8) g[i & 7] += s; else g[(i + 1) & 7] -= s;"
+        "  if (flags & 16) s = s * 5 + g[i & 7]; else s = s + (g[(i + 3) & 7] >> 2); } return s; }"
+        " static int down(int n, int step) { if (n <= 0) return 0; return step + down(n - step, step); }"
+        " static long pass(long n, int k) { if (n == 0) return k; return pass(n - 1, k) + mix(k, k, -2); }"
+        " int main(void) { int a[8]; for (int i = 0; i < 8; i++) a[i] = i * 5 - 9;"
+        "  int r = work(a, 8, 1) + work(a, 8, 6) + work(a, 8, 25) + mix(4, 2, 300) + mix(5, 2, -3) + down(10, 3) + pass(5, 2);"
+        "  return (r + g[1] - g[2]) & 255; }";
+    expect(source, 227);
+
+    // Each set of flags gets a clone of its own, the bound arguments are
+    // not passed, and the function nothing calls is gone
+    char* assembly = optimized_assembly(source, 0, -1);
+    assert(strstr(assembly, "call work.constprop.0") != NULL && strstr(assembly, "work.constprop.2:") != NULL);
+    assert(strstr(assembly, "$3, %esi") == NULL);
+    assert(strstr(assembly, "unused") == NULL);
+    free(assembly);
+
+    C4Context* ctx = c4_context_new();
+    C4Options options;
+    c4_options_init(&options);
+    options.specialize_functions = false;
+    C4Result result;
+    assert(c4_compile(ctx, source, strlen(source), &options, &result));
+    assert(strstr(result.assembly, "constprop") == NULL && strstr(result.assembly, "$3, %esi") != NULL);
+    c4_context_free(ctx);
+    printf("test_specialization: PASSED\n");
+}
+
+void test_dead_functions() {
+    // Statics only other unreachable statics use, recursion included, are
+    // not generated at any optimization level
+    const char* source =
+        "static int table = 7; static int used = 3;"
+        " static int helper(int x) { return x * table; }"
+        " static int chain(int x) { return helper(x) + 1; }"
+        " static int ping(int x); static int pong(int x) { if (x) return ping(x - 1); return 0; }"
+        " static int ping(int x) { return pong(x); }"
+        " static int twice(int x) { return x + x; }"
+        " int main(void) { return twice(used) + 1; }";
+    expect(source, 7);
+    for (int optimize = 0; optimize <= 1; optimize++) {
+        C4Context* ctx = c4_context_new();
+        C4Options options;
+        c4_options_init(&options);
+        options.optimize = optimize;
+        C4Result result;
+        assert(c4_compile(ctx, source, strlen(source), &options, &result));
+        const char* gone[] = {"table", "helper", "chain", "ping", "pong"};
+        for (int i = 0; i < 5; i++) assert(strstr(result.assembly, gone[i]) == NULL);
+        assert(strstr(result.assembly, "used") != NULL);
+        c4_context_free(ctx);
+    }
+    printf("test_dead_functions: PASSED\n");
+}
+
+void test_scheduling() {
+    // The load and the division it feeds start before the multiply the
+    // source computes first; the order instruction selection emits is
+    // kept when scheduling is off
+    const char* source =
+        "int f(int* p, int a, int b) { int x = a * b + 3; int y = p[1] / 7;"
+        " return (x ^ 9) + (y | 2) + ((a - b) & 12); }"
+        " int main(void) { int v[2]; v[0] = 5; v[1] = 700; return f(v, 6, 4); }";
+    expect(source, 120);
+    for (int schedule = 0; schedule <= 1; schedule++) {
+        C4Context* ctx = c4_context_new();
+        C4Options options;
+        c4_options_init(&options);
+        options.schedule_instructions = schedule;
+        C4Result result;
+        assert(c4_compile(ctx, source, strlen(source), &options, &result));
+        const char* load = strstr(result.assembly, "movl 4(");
+        const char* multiply = strstr(result.assembly, "imull");
+        assert(load != NULL && multiply != NULL);
+        assert((load < multiply) == schedule);
+        c4_context_free(ctx);
+    }
+
+    // Divisions, loads and stores to the same array, and values living
+    // across a call in a loop keep their results
+    int g[4] = {0, 0, 0, 0}, s = 0;
+    for (int i = 1; i < 20; i++) {
+        int a = g[i & 3] + i, b = a * 7, c = b / 3;
+        int d = a + (b ^ c), e = c % 5 + d * i;
+        g[i & 3] = e & 1023;
+        s += (a - b + c - d + e) & 255;
+    }
+    expect("int g[4]; int id(int x) { return x; }"
+           " int main(void) { int s = 0; for (int i = 1; i < 20; i++) { int a = g[i & 3] + i, b = a * 7, c = b / 3;"
+           " int d = id(a) + (b ^ c), e = c % 5 + d * i; g[i & 3] = e & 1023; s += (a - b + c - d + e) & 255; }"
+           " return (s + g[0] + g[1] + g[2] + g[3]) & 255; }", (s + g[0] + g[1] + g[2] + g[3]) & 255);
+    printf("test_scheduling: PASSED\n");
+}
+
+void test_evaluation_order() {
+    // A right-leaning expression deeper than there are registers, and
+    // calls inside operands and arguments
+    const char* source =
+        "int g(int x) { return x * 3; }"
+        " int f(int a, int b) { return b ^ (a + (b - (a * (b ^ (a + (b - (a * (b ^ (a + (b - (a * (b ^ (a + (b - (a"
+        " * (b ^ (a + (b - a)))))))))))))))))); }"
+        " int h(int a, int b) { return a + b * (a - g(b)) + (a ^ g(a + b)) - g(g(a) + g(b) * b); }"
+        " int main(void) { return (f(3, 5) + h(2, 7)) & 255; }";
+    int a = 3, b = 5;
+    int deep = b ^ (a + (b - (a * (b ^ (a + (b - (a * (b ^ (a + (b - (a * (b ^ (a + (b - (a * (b ^ (a + (b - a))))))))))))))))));
+    a = 2;
+    b = 7;
+    int calls = a + b * (a - b * 3) + (a ^ (a + b) * 3) - (a * 3 + b * 3 * b) * 3;
+    expect(source, (deep + calls) & 255);
+
+    // Computed heavier operand first, the expression needs few registers
+    // even without optimization
+    C4Context* ctx = c4_context_new();
+    C4Options options;
+    c4_options_init(&options);
+    options.optimize = false;
+    C4Result result;
+    assert(c4_compile(ctx, source, strlen(source), &options, &result));
+    const char* line = strstr(result.report, "f: ");
+    assert(line != NULL && strncmp(strstr(line, "values, "), "values, 0 spilled, 0 split", 26) == 0);
+
+    // Lowered to IR in the same order, loads leaning right fit in the
+    // registers too, before any scheduling
+    const char* loads =
+        "int f(int* p) { return p[0] + (p[1] * (p[2] - (p[3] ^ (p[4] + (p[5] * (p[6] - (p[7] ^ (p[8] + (p[9]"
+        " * (p[10] - (p[11] ^ (p[12] + (p[13] * (p[14] - (p[15] ^ (p[16] + p[17])))))))))))))))); }"
+        " int main(void) { int p[18]; for (int i = 0; i < 18; i++) p[i] = i * 7 + 1; return f(p) & 255; }";
+    expect(loads, 33);
+    options.optimize = true;
+    options.schedule_instructions = false;
+    assert(c4_compile(ctx, loads, strlen(loads), &options, &result));
+    line = strstr(result.report, "f: ");
+    assert(line != NULL && strncmp(strstr(line, "values, "), "values, 0 spilled, 0 split", 26) == 0);
+    c4_context_free(ctx);
+    printf("test_evaluation_order: PASSED\n");
+}
+
+int main() {
+    printf("Running codegen tests...\n");
+    test_arithmetic();
+    test_conversions();
+    test_control_flow();
+    test_memory();
+    test_calls();
+    test_object();
+    test_register_allocation();
+    test_peephole();
+    test_branches();
+    test_division_by_constants();
+    test_unrolling();
+    test_vectorization();
+    test_inlining();
+    test_tail_calls();
+    test_generated_programs();
+    test_specialization();
+    test_dead_functions();
+    test_scheduling();
+    test_evaluation_order();
+    printf("All codegen tests passed!\n");
+    return 0;
+}
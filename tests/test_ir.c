@@ -0,0 +1,543 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../ir.h"
+#include "../parser.h"
+#include "../lexer.h"
+#include "../semantic.h"
+
+// Parse and check a program, then lower its last function to IR
+static CodeGenerator* build(const char* source, Statement** program) {
+    Lexer* lexer = lexer_init((char*)source, "test.c");
+    Parser* parser = parser_init(lexer);
+    *program = parse_program(parser);
+    assert(!parser->had_error);
+    parser_free(parser);
+
+    SemanticAnalyzer* analyzer = semantic_init();
+    check_program(analyzer, *program);
+    assert(!analyzer->had_error);
+    semantic_free(analyzer);
+
+    Statement* function = (*program)->as.compound.statements[(*program)->as.compound.count - 1];
+    assert(function->type == NODE_FUNCTION);
+    CodeGenerator* gen = codegen_init(NULL, true);
+    build_basic_blocks(gen, function);
+    analyze_control_flow(gen);
+    build_ir(gen, function);
+    return gen;
+}
+
+// Instructions of the given opcode left in the function
+static int count(CodeGenerator* gen, IrOpcode op) {
+    int n = 0;
+    for (int i = 0; i < gen->block_count; i++) {
+        for (IrInst* inst = gen->blocks[i]->first; inst; inst = inst->next) {
+            if (inst->op == op) n++;
+        }
+    }
+    return n;
+}
+
+static void finish(CodeGenerator* gen, Statement* program) {
+    codegen_free(gen);
+    free_statement(program);
+}
+
+void test_promotion() {
+    Statement* program;
+    CodeGenerator* gen = build("int f(int a) { int x = a + 1; if (a) x = x * 2; return x; }", &program);
+    assert(count(gen, IR_LOAD) > 0 && count(gen, IR_STORE) > 0);
+
+    promote_locals(gen);
+    assert(count(gen, IR_LOAD) == 0 && count(gen, IR_STORE) == 0 && count(gen, IR_LOCAL) == 0);
+    assert(count(gen, IR_PHI) == 1);
+    for (int i = 0; i < gen->ir->local_count; i++) assert(gen->ir->locals[i].is_promoted);
+
+    // Arrays and variables whose address escapes stay in memory
+    finish(gen, program);
+    gen = build("int g(int* p); int f() { int x = 1; int a[2]; a[0] = x; g(&x); return x + a[0]; }", &program);
+    promote_locals(gen);
+    assert(count(gen, IR_LOCAL) > 0 && count(gen, IR_LOAD) == 3);
+
+    finish(gen, program);
+    printf("test_promotion: PASSED\n");
+}
+
+void test_constant_propagation() {
+    Statement* program;
+    CodeGenerator* gen = build(
+        "int f(int a) { int k = 3; int y; if (k > 2) y = k * 4; else y = a; return y + 1; }", &program);
+    promote_locals(gen);
+    propagate_constants(gen);
+    optimize_basic_blocks(gen);
+
+    // Only `return 13` is left
+    assert(count(gen, IR_BRANCH) == 0 && count(gen, IR_PHI) == 0);
+    assert(count(gen, IR_MUL) == 0 && count(gen, IR_ADD) == 0);
+    assert(gen->block_count == 1);
+    IrInst* ret = ir_terminator(gen->blocks[0]);
+    assert(ret->op == IR_RETURN && ret->operands[0]->op == IR_CONST && ret->operands[0]->value == 13);
+
+    finish(gen, program);
+    printf("test_constant_propagation: PASSED\n");
+}
+
+void test_dead_code() {
+    Statement* program;
+    CodeGenerator* gen = build(
+        "int f(int a, int b) { int unused = a * b; if (b) unused = a - b; return a; }", &program);
+    promote_locals(gen);
+    propagate_constants(gen);
+    eliminate_dead_code(gen);
+    optimize_basic_blocks(gen);
+
+    // Neither the arithmetic nor the branch choosing between results
+    // nothing reads survives
+    assert(count(gen, IR_MUL) == 0 && count(gen, IR_SUB) == 0);
+    assert(count(gen, IR_BRANCH) == 0 && gen->block_count == 1);
+
+    // Stores and calls are kept
+    finish(gen, program);
+    gen = build("int g(); int f(int* p, int a) { int t = a * 2; if (a) g(); *p = t; return 0; }", &program);
+    promote_locals(gen);
+    propagate_constants(gen);
+    eliminate_dead_code(gen);
+    optimize_basic_blocks(gen);
+    assert(count(gen, IR_CALL) == 1 && count(gen, IR_STORE) == 1 && count(gen, IR_BRANCH) == 1);
+
+    finish(gen, program);
+    printf("test_dead_code: PASSED\n");
+}
+
+void test_loop() {
+    Statement* program;
+    CodeGenerator* gen = build(
+        "int f(int n) { int s = 0; for (int i = 0; i < n; i++) s += i; return s; }", &program);
+    promote_locals(gen);
+    propagate_constants(gen);
+    eliminate_dead_code(gen);
+    optimize_basic_blocks(gen);
+
+    // The loop is rotated: s and i each get a phi at the top of the body,
+    // merging the entry and back-edge values, and s another one after the
+    // loop, which is left from the guard or from the bottom test
+    BasicBlock* header = NULL;
+    for (int i = 0; i < gen->block_count; i++) {
+        if (gen->blocks[i]->is_loop_header) header = gen->blocks[i];
+    }
+    assert(header && header->predecessor_count == 2);
+    int phis = 0;
+    for (IrInst* inst = header->first; inst && inst->op == IR_PHI; inst = inst->next) {
+        assert(inst->operand_count == 2);
+        phis++;
+    }
+    assert(phis == 2 && count(gen, IR_PHI) == 3);
+    assert(count(gen, IR_BRANCH) == 2 && count(gen, IR_LOAD) == 0);
+    BasicBlock* latch = header->predecessors[1];
+    assert(ir_terminator(latch)->op == IR_BRANCH && latch->successors[0] == header);
+
+    finish(gen, program);
+    printf("test_loop: PASSED\n");
+}
+
+void test_short_circuit() {
+    Statement* program;
+    CodeGenerator* gen = build("int g(); int f(int a, int b) { if (a > 0 && !(b > 0 || a == b)) g(); return 0; }",
+                               &program);
+
+    // Each comparison gets a branch of its own, and no value is merged
+    assert(count(gen, IR_BRANCH) == 3 && count(gen, IR_PHI) == 0 && count(gen, IR_CMP) == 3);
+    promote_locals(gen);
+    propagate_constants(gen);
+    eliminate_dead_code(gen);
+    optimize_basic_blocks(gen);
+    assert(count(gen, IR_BRANCH) == 3 && count(gen, IR_PHI) == 0);
+
+    finish(gen, program);
+    printf("test_short_circuit: PASSED\n");
+}
+
+void test_if_conversion() {
+    Statement* program;
+    CodeGenerator* gen = build(
+        "int f(int a, int b) { int m = a; int n = b; if (b > a) { m = b; n = a; } return m - n; }", &program);
+    promote_locals(gen);
+    propagate_constants(gen);
+    eliminate_dead_code(gen);
+    optimize_basic_blocks(gen);
+
+    // A branch only choosing values becomes a select per value
+    assert(count(gen, IR_BRANCH) == 0 && count(gen, IR_PHI) == 0 && count(gen, IR_SELECT) == 2);
+    assert(gen->block_count == 1);
+
+    // Not when an arm has work of its own
+    finish(gen, program);
+    gen = build("int f(int a, int b) { int m = a; if (b > a) m = b * a; return m; }", &program);
+    promote_locals(gen);
+    propagate_constants(gen);
+    eliminate_dead_code(gen);
+    optimize_basic_blocks(gen);
+    assert(count(gen, IR_BRANCH) == 1 && count(gen, IR_SELECT) == 0);
+
+    finish(gen, program);
+    printf("test_if_conversion: PASSED\n");
+}
+
+// The innermost loop of the first instruction of the given opcode
+static Loop* loop_of(CodeGenerator* gen, IrOpcode op) {
+    for (int i = 0; i < gen->block_count; i++) {
+        for (IrInst* inst = gen->blocks[i]->first; inst; inst = inst->next) {
+            if (inst->op == op) return inst->block->loop;
+        }
+    }
+    assert(!"no such instruction");
+    return NULL;
+}
+
+static void optimize_loops(CodeGenerator* gen) {
+    promote_locals(gen);
+    propagate_constants(gen);
+    eliminate_dead_code(gen);
+    optimize_basic_blocks(gen);
+    hoist_loop_invariants(gen);
+}
+
+void test_loop_invariants() {
+    Statement* program;
+    CodeGenerator* gen = build(
+        "int g; int f(int n, int a, int b) { int s = 0; for (int i = 0; i < n; i++) s += a * b + g; return s; }",
+        &program);
+    optimize_loops(gen);
+
+    // Computed once ahead of the loop
+    assert(gen->loop_count == 1);
+    assert(loop_of(gen, IR_MUL) == NULL && loop_of(gen, IR_LOAD) == NULL);
+    assert(loop_of(gen, IR_PHI) == gen->loops[0]);
+
+    // A division the loop may never reach could trap if hoisted
+    finish(gen, program);
+    gen = build("int f(int n, int a, int b) { int s = 0; for (int i = 0; i < n; i++) if (i > 5) s += a / b; return s; }",
+                &program);
+    optimize_loops(gen);
+    assert(loop_of(gen, IR_DIV) == gen->loops[0]);
+
+    // A load of memory the loop stores to stays in it
+    finish(gen, program);
+    gen = build("int g; int f(int n) { int s = 0; for (int i = 0; i < n; i++) { s += g; g = i; } return s; }",
+                &program);
+    optimize_loops(gen);
+    assert(loop_of(gen, IR_LOAD) == gen->loops[0]);
+
+    finish(gen, program);
+    printf("test_loop_invariants: PASSED\n");
+}
+
+void test_common_subexpressions() {
+    Statement* program;
+    CodeGenerator* gen = build(
+        "int f(int a, int b) { int x = a * b + 1; if (a) { x = x * (a * b + 1); } return x - (b * a + 1); }",
+        &program);
+    promote_locals(gen);
+    propagate_constants(gen);
+    eliminate_dead_code(gen);
+    eliminate_common_subexpressions(gen);
+
+    // The repeats dominated by the first `a * b + 1` reuse it; `b * a` differs
+    assert(count(gen, IR_MUL) == 3 && count(gen, IR_ADD) == 2);
+
+    finish(gen, program);
+    printf("test_common_subexpressions: PASSED\n");
+}
+
+void test_induction_variables() {
+    Statement* program;
+    CodeGenerator* gen = build(
+        "int f(int* a, int n) { int s = 0; for (int i = 0; i < n; i++) s += a[i * 3]; return s; }", &program);
+    optimize_loops(gen);
+    reduce_induction_variables(gen);
+    eliminate_dead_code(gen);
+
+    // The address is a pointer advanced by 12 bytes, which the exit test
+    // compares in place of the dead counter i
+    assert(gen->loop_count == 1);
+    Loop* loop = gen->loops[0];
+    assert(loop_of(gen, IR_MUL) == NULL);
+    int phis = 0;
+    IrInst* pointer = NULL;
+    for (IrInst* inst = loop->header->first; inst && inst->op == IR_PHI; inst = inst->next) {
+        if (inst->type == IR_I64) pointer = inst;
+        phis++;
+    }
+    assert(phis == 2 && pointer != NULL);
+    IrInst* test = ir_terminator(loop->header->predecessors[1])->operands[0];
+    assert(test->op == IR_CMP && test->operands[0]->type == IR_I64);
+    assert(test->operands[0]->op == IR_ADD && test->operands[0]->operands[0] == pointer);
+    assert(test->operands[0]->operands[1]->value == 12);
+
+    // A stride unknown until run time is multiplied once, ahead of the loop
+    finish(gen, program);
+    gen = build("int f(int* a, int n, int k) { int s = 0; for (int i = 0; i < n; i++) s += a[i * k]; return s; }",
+                &program);
+    optimize_loops(gen);
+    reduce_induction_variables(gen);
+    eliminate_dead_code(gen);
+    assert(loop_of(gen, IR_MUL) == NULL);
+
+    finish(gen, program);
+    printf("test_induction_variables: PASSED\n");
+}
+
+// Loads inside `loop` and none of its inner loops
+static int loads_in(CodeGenerator* gen, Loop* loop) {
+    int n = 0;
+    for (int i = 0; i < gen->block_count; i++) {
+        for (IrInst* inst = gen->blocks[i]->first; inst; inst = inst->next) {
+            if (inst->op == IR_LOAD && inst->block->loop == loop) n++;
+        }
+    }
+    return n;
+}
+
+static CodeGenerator* unroll(const char* source, Statement** program, int factor) {
+    CodeGenerator* gen = build(source, program);
+    gen->unroll_factor = factor;
+    optimize_loops(gen);
+    reduce_induction_variables(gen);
+    unroll_loops(gen);
+    eliminate_dead_code(gen);
+    return gen;
+}
+
+void test_unrolling() {
+    // A constant trip count leaves the body repeated in a straight line
+    Statement* program;
+    CodeGenerator* gen = unroll("int f(int* a) { int s = 0; for (int i = 0; i < 6; i++) s += a[i]; return s; }",
+                                &program, 4);
+    assert(gen->loop_count == 0 && count(gen, IR_LOAD) == 6 && count(gen, IR_BRANCH) == 0);
+
+    // Otherwise four copies, loading at offsets from one pointer, and the
+    // original loop for the rest
+    finish(gen, program);
+    gen = unroll("int f(int* a, int n) { int s = 0; for (int i = 0; i < n; i++) s += a[i]; return s; }", &program, 4);
+    assert(gen->loop_count == 2);
+    Loop* unrolled = loads_in(gen, gen->loops[0]) == 4 ? gen->loops[0] : gen->loops[1];
+    Loop* remainder = unrolled == gen->loops[0] ? gen->loops[1] : gen->loops[0];
+    assert(loads_in(gen, unrolled) == 4 && loads_in(gen, remainder) == 1);
+    IrInst* pointer = unrolled->header->first;
+    assert(pointer->op == IR_PHI && pointer->type == IR_I64);
+    for (IrInst* inst = unrolled->header->first; inst; inst = inst->next) {
+        if (inst->op != IR_LOAD || inst->operands[0] == pointer) continue;
+        assert(inst->operands[0]->op == IR_ADD && inst->operands[0]->operands[0] == pointer);
+    }
+
+    // Bodies past the size budget stay as they are, and a factor of 1
+    // turns unrolling off
+    finish(gen, program);
+    gen = unroll("int f(int* a, int n) { int s = 0; for (int i = 0; i < n; i++) {"
+                 " s += a[i] * a[i + 1] / (a[i + 2] + a[i + 3]) % (a[i + 4] + 1) + (s ^ i) * 5 - (s >> 3) + (i & 3);"
+                 " s -= a[i + 5] * a[i + 6] / (a[i + 7] + s) % (a[i + 8] - 1) + (s | i) * 7 - (s >> 5) + (i ^ s); }"
+                 " return s; }", &program, 4);
+    assert(gen->loop_count == 1);
+    finish(gen, program);
+    gen = unroll("int f(int* a, int n) { int s = 0; for (int i = 0; i < n; i++) s += a[i]; return s; }", &program, 1);
+    assert(gen->loop_count == 1);
+
+    finish(gen, program);
+    printf("test_unrolling: PASSED\n");
+}
+
+static CodeGenerator* vectorize(const char* source, Statement** program, int width) {
+    CodeGenerator* gen = build(source, program);
+    gen->vector_width = width;
+    optimize_loops(gen);
+    reduce_induction_variables(gen);
+    eliminate_dead_code(gen);
+    vectorize_loops(gen);
+    eliminate_dead_code(gen);
+    return gen;
+}
+
+// Values of the function that are vectors
+static int vectors(CodeGenerator* gen) {
+    int n = 0;
+    for (int i = 0; i < gen->block_count; i++) {
+        for (IrInst* inst = gen->blocks[i]->first; inst; inst = inst->next) {
+            if (inst->type == IR_V32) n++;
+        }
+    }
+    return n;
+}
+
+// Unsigned comparisons, as the tests for overlapping arrays are
+static int unsigned_compares(CodeGenerator* gen) {
+    int n = 0;
+    for (int i = 0; i < gen->block_count; i++) {
+        for (IrInst* inst = gen->blocks[i]->first; inst; inst = inst->next) {
+            if (inst->op == IR_CMP && inst->cond == COND_B) n++;
+        }
+    }
+    return n;
+}
+
+void test_vectorization() {
+    // A vector loop over arrays that may overlap, tested once each ahead
+    // of it, with the scalar in every lane and the original loop after
+    Statement* program;
+    CodeGenerator* gen = vectorize("void f(int* a, int* b, int* c, int k, int n) {"
+                                   " for (int i = 0; i < n; i++) a[i] = b[i] + c[i] * k; }", &program, 4);
+    assert(gen->loop_count == 2 && loop_of(gen, IR_BROADCAST) == NULL);
+    assert(count(gen, IR_BROADCAST) == 1 && vectors(gen) == 5 && unsigned_compares(gen) == 2);
+
+    // Sums start from zero in every lane and are added up after the loop
+    finish(gen, program);
+    gen = vectorize("int f(int* a, int n) { int s = 0; for (int i = 0; i < n; i++) s += a[i]; return s; }",
+                    &program, 8);
+    assert(gen->loop_count == 2 && count(gen, IR_BROADCAST) == 1 && count(gen, IR_REDUCE) == 1);
+    assert(unsigned_compares(gen) == 0);
+
+    // The same array, read ahead of where it is written
+    finish(gen, program);
+    gen = vectorize("void f(int* a, int n) { for (int i = 0; i < n; i++) a[i] = a[i + 1] - a[i]; }", &program, 4);
+    assert(gen->loop_count == 2 && vectors(gen) == 3 && unsigned_compares(gen) == 0);
+
+    // Not when a later iteration reads what an earlier one wrote, when a
+    // running value is used as it goes, or when vectorizing is off
+    const char* scalar[] = {
+        "void f(int* a, int n) { for (int i = 0; i < n; i++) a[i + 1] = a[i] + 1; }",
+        "void f(int* a, int* b, int n) { int s = 0; for (int i = 0; i < n; i++) { s += a[i]; b[i] = s; } }",
+        "void f(long* a, int n) { for (int i = 0; i < n; i++) a[i] = a[i] + 1; }",
+        "int f(int* a, int n) { int s = 0; for (int i = 0; i < n; i++) s += a[i] / 3; return s; }",
+    };
+    for (int i = 0; i < 4; i++) {
+        finish(gen, program);
+        gen = vectorize(scalar[i], &program, 4);
+        assert(gen->loop_count == 1 && vectors(gen) == 0);
+    }
+    finish(gen, program);
+    gen = vectorize("int f(int* a, int n) { int s = 0; for (int i = 0; i < n; i++) s += a[i]; return s; }",
+                    &program, 0);
+    assert(gen->loop_count == 1 && vectors(gen) == 0);
+
+    finish(gen, program);
+    printf("test_vectorization: PASSED\n");
+}
+
+// Build the last function of `source` and inline into it
+static CodeGenerator* inline_last(const char* source, Statement** program) {
+    CodeGenerator* gen = build(source, program);
+    collect_functions(gen, *program);
+    promote_locals(gen);
+    inline_calls(gen);
+    return gen;
+}
+
+void test_inlining() {
+    // Callees are cloned in with the arguments for their parameters, so
+    // that constant propagation folds the whole chain
+    Statement* program;
+    CodeGenerator* gen = inline_last("static int add(int a, int b) { return a + b; }"
+                                     "int twice(int x) { return add(x, x); }"
+                                     "int f(void) { return twice(add(2, 3)) + 1; }", &program);
+    assert(count(gen, IR_CALL) == 0 && count(gen, IR_PARAM) == 0);
+    propagate_constants(gen);
+    eliminate_dead_code(gen);
+    optimize_basic_blocks(gen);
+    IrInst* ret = ir_terminator(gen->blocks[gen->block_count - 1]);
+    assert(ret->op == IR_RETURN && ret->operands[0]->op == IR_CONST && ret->operands[0]->value == 11);
+
+    // Several returns meet in a phi, and arrays become the caller's
+    finish(gen, program);
+    gen = inline_last("int pick(int c, int a, int b) { int t[2]; t[0] = a; t[1] = b; if (c) return t[0]; return t[1]; }"
+                      "int f(int c) { return pick(c, 4, 5); }", &program);
+    assert(count(gen, IR_CALL) == 0 && count(gen, IR_PHI) == 1 && gen->ir->local_count == 5);
+
+    // Recursion stops at the function being expanded
+    finish(gen, program);
+    gen = inline_last("int f(int n) { if (n == 0) return 0; return f(n - 1) + 1; }", &program);
+    assert(count(gen, IR_CALL) == 1);
+    finish(gen, program);
+    gen = inline_last("int odd(int n);"
+                      "int even(int n) { if (n == 0) return 1; return odd(n - 1); }"
+                      "int odd(int n) { if (n == 0) return 0; return even(n - 1); }", &program);
+    assert(count(gen, IR_CALL) == 1);
+
+    // Bodies too big stay calls unless declared inline
+    const char* body = "{ int s = 0; s += a * 3; s ^= a >> 2; s += a * 5; s ^= a >> 3; s += a * 7;"
+                       " s ^= a >> 4; s += a * 9; s ^= a >> 5; s += a * 11; s ^= a >> 6; s += a * 13;"
+                       " s ^= a >> 7; s += a * 15; s ^= a >> 8; return s; }";
+    char source[1024];
+    for (int is_inline = 0; is_inline < 2; is_inline++) {
+        finish(gen, program);
+        snprintf(source, sizeof(source), "%sint mix(int a) %s int f(int x) { return mix(x); }",
+                 is_inline ? "inline " : "", body);
+        gen = inline_last(source, &program);
+        assert(count(gen, IR_CALL) == (is_inline ? 0 : 1));
+    }
+
+    finish(gen, program);
+    printf("test_inlining: PASSED\n");
+}
+
+void test_tail_recursion() {
+    // The call becomes a jump back to the old entry, which gets a phi per
+    // parameter and heads a loop
+    Statement* program;
+    CodeGenerator* gen = build("int f(int n, int acc) { if (n <= 1) return acc; return f(n - 1, acc * n); }", &program);
+    promote_locals(gen);
+    eliminate_tail_recursion(gen);
+    assert(count(gen, IR_CALL) == 0 && count(gen, IR_PHI) == 2 && gen->loop_count == 1);
+    assert(count(gen, IR_PARAM) == 2 && gen->blocks[0]->first->op == IR_PARAM);
+    assert(gen->blocks[1]->is_loop_header && gen->blocks[1]->first->op == IR_PHI);
+
+    // Calls whose value is used, and calls that may see the frame, stay
+    finish(gen, program);
+    gen = build("int f(int n) { if (n <= 1) return 1; return n * f(n - 1); }", &program);
+    promote_locals(gen);
+    eliminate_tail_recursion(gen);
+    assert(count(gen, IR_CALL) == 1 && gen->loop_count == 0);
+    finish(gen, program);
+    gen = build("int g(int* p); int f(int n) { int x = n; if (g(&x)) return x; return f(n - 1); }", &program);
+    promote_locals(gen);
+    eliminate_tail_recursion(gen);
+    assert(count(gen, IR_CALL) == 2);
+
+    // Calls to other functions in tail position are marked
+    finish(gen, program);
+    gen = build("int g(int a); void h(int a); int f(int n) { if (n) return g(n); h(n); return 0; }", &program);
+    promote_locals(gen);
+    mark_tail_calls(gen);
+    int tail_count = 0;
+    for (int b = 0; b < gen->block_count; b++) {
+        for (IrInst* inst = gen->blocks[b]->first; inst != NULL; inst = inst->next) {
+            if (inst->op == IR_CALL && inst->is_tail) {
+                assert(strcmp(inst->symbol, "g") == 0);
+                tail_count++;
+            }
+        }
+    }
+    assert(tail_count == 1);
+
+    finish(gen, program);
+    printf("test_tail_recursion: PASSED\n");
+}
+
+int main() {
+    printf("Running IR tests...\n");
+    test_promotion();
+    test_constant_propagation();
+    test_dead_code();
+    test_loop();
+    test_short_circuit();
+    test_if_conversion();
+    test_loop_invariants();
+    test_common_subexpressions();
+    test_induction_variables();
+    test_unrolling();
+    test_vectorization();
+    test_inlining();
+    test_tail_recursion();
+    printf("All IR tests passed!\n");
+    return 0;
+}
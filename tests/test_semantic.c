@@ -104,6 +104,85 @@ void test_function_call() {
     printf("test_function_call: PASSED\n");
 }
 
+void test_reachability() {
+    // Only the signature of a static function nothing reachable uses is
+    // checked; what main uses is checked in full
+    char* source = ""
+        "static int unused(int x) { return missing + x; }"
+        "static int used(int x) { return x + 1; }"
+        "int main() { return used(1); }";
+
+    Lexer* lexer = lexer_init(source, "test.c");
+    Parser* parser = parser_init(lexer);
+    SemanticAnalyzer* analyzer = semantic_init();
+    analyzer->filename = strdup("test.c");
+
+    Statement* program = parse_program(parser);
+    check_program(analyzer, program);
+
+    assert(analyzer->had_error == false);
+    assert(program->as.compound.statements[0]->as.function.is_unreachable == true);
+    assert(program->as.compound.statements[1]->as.function.is_unreachable == false);
+
+    free_statement(program);
+    semantic_free(analyzer);
+    parser_free(parser);
+    lexer_free(lexer);
+
+    source = ""
+        "static int helper(int x) { return missing + x; }"
+        "static int used(int x) { return helper(x); }"
+        "int main() { return used(1); }";
+    lexer = lexer_init(source, "test.c");
+    parser = parser_init(lexer);
+    analyzer = semantic_init();
+    analyzer->filename = strdup("test.c");
+
+    program = parse_program(parser);
+    check_program(analyzer, program);
+
+    assert(analyzer->had_error == true); // Reached through used
+
+    free_statement(program);
+    semantic_free(analyzer);
+    parser_free(parser);
+    lexer_free(lexer);
+    printf("test_reachability: PASSED\n");
+}
+
+void test_register_labels() {
+    // Sethi-Ullman numbers: one register for a leaf, one more where both
+    // operands take the same number, and calls above any call-free operand
+    char* source = ""
+        "int g(int x);"
+        "int f(int a, int b) { return a + (b - a) * (a ^ b) - g(a); }";
+
+    Lexer* lexer = lexer_init(source, "test.c");
+    Parser* parser = parser_init(lexer);
+    SemanticAnalyzer* analyzer = semantic_init();
+    analyzer->filename = strdup("test.c");
+
+    Statement* program = parse_program(parser);
+    check_program(analyzer, program);
+    assert(analyzer->had_error == false);
+
+    Statement* body = program->as.compound.statements[1]->as.function.body;
+    Expression* difference = body->as.compound.statements[0]->as.return_stmt.value;
+    Expression* sum = difference->as.binary.left;
+    Expression* product = sum->as.binary.right;
+    assert(sum->as.binary.left->registers == 1);
+    assert(product->as.binary.left->registers == 2 && product->as.binary.right->registers == 2);
+    assert(product->registers == 3 && sum->registers == 3);
+    assert(difference->as.binary.right->registers > sum->registers);
+    assert(difference->registers == difference->as.binary.right->registers);
+
+    free_statement(program);
+    semantic_free(analyzer);
+    parser_free(parser);
+    lexer_free(lexer);
+    printf("test_register_labels: PASSED\n");
+}
+
 int main() {
     printf("Running semantic analyzer tests...\n");
     test_semantic_init();
@@ -111,6 +190,8 @@ int main() {
     test_scope_analysis();
     test_undefined_variable();
     test_function_call();
+    test_reachability();
+    test_register_labels();
     printf("All semantic analyzer tests passed!\n");
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "../server.h"
+#include "../c4.h"
+
+static char socket_path[256];
+static pid_t server_pid;
+
+static void write_source(const char* path, const char* source) {
+    FILE* file = fopen(path, "w");
+    assert(file != NULL);
+    fputs(source, file);
+    fclose(file);
+}
+
+static char* read_output(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return NULL;
+    char* data = calloc(1, 65536);
+    fread(data, 1, 65535, file);
+    fclose(file);
+    return data;
+}
+
+static int run_client(int argc, char** argv) {
+    return client_run(socket_path, argc, argv);
+}
+
+void test_server_start() {
+    server_pid = fork();
+    assert(server_pid >= 0);
+    if (server_pid == 0) {
+        _exit(server_run(socket_path));
+    }
+
+    // Wait for the socket to appear
+    for (int i = 0; i < 500 && access(socket_path, F_OK) != 0; i++) {
+        usleep(10000);
+    }
+    assert(access(socket_path, F_OK) == 0);
+    printf("test_server_start: PASSED\n");
+}
+
+void test_remote_compile() {
+    const char* source = "int main(void) { return 1 + 2 * 3; }\n";
+    write_source("a.c", source);
+
+    char* argv[] = {"a.c"};
+    assert(run_client(1, argv) == 0);
+
+    // Output matches an in-process compilation
+    char* remote = read_output("a.s");
+    assert(remote != NULL);
+    C4Context* ctx = c4_context_new();
+    C4Options options;
+    c4_options_init(&options);
+    options.filename = "a.c";
+    C4Result result;
+    assert(c4_compile(ctx, source, strlen(source), &options, &result));
+    assert(strlen(remote) == result.assembly_length);
+    assert(memcmp(remote, result.assembly, result.assembly_length) == 0);
+
+    // A second, warm compilation produces the same bytes
+    unlink("a.s");
+    assert(run_client(1, argv) == 0);
+    char* again = read_output("a.s");
+    assert(again != NULL && strcmp(again, remote) == 0);
+
+    free(again);
+    free(remote);
+    c4_context_free(ctx);
+    printf("test_remote_compile: PASSED\n");
+}
+
+void test_remote_options() {
+    write_source("b.c", "int b(void) { return 4 * 5; }\n");
+    write_source("c.c", "int c(void) { return 6 - 7; }\n");
+
+    char* named[] = {"-o", "named.s", "b.c"};
+    assert(run_client(3, named) == 0);
+    assert(access("named.s", F_OK) == 0);
+
+    char* several[] = {"-j2", "b.c", "c.c"};
+    assert(run_client(3, several) == 0);
+    assert(access("b.s", F_OK) == 0);
+    assert(access("c.s", F_OK) == 0);
+
+    char* invalid[] = {"--bogus", "b.c"};
+    assert(run_client(2, invalid) == 1);
+    printf("test_remote_options: PASSED\n");
+}
+
+void test_remote_errors() {
+    write_source("bad.c", "return 1;\n");
+
+    char* argv[] = {"bad.c"};
+    assert(run_client(1, argv) == 1);
+    assert(access("bad.s", F_OK) != 0);
+
+    char* missing[] = {"missing.c"};
+    assert(run_client(1, missing) == 1);
+    printf("test_remote_errors: PASSED\n");
+}
+
+// A server that answers every request with the given raw response
+static pid_t start_fake_server(const char* path, const char* response, size_t length) {
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    unlink(path);
+    assert(bind(listener, (struct sockaddr*)&address, sizeof(address)) == 0 && listen(listener, 4) == 0);
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        int client = accept(listener, NULL, NULL);
+        send(client, response, length, MSG_NOSIGNAL);
+        shutdown(client, SHUT_WR);
+        char drain[4096];
+        while (recv(client, drain, sizeof(drain), 0) > 0) {}
+        _exit(0);
+    }
+    close(listener);
+    return pid;
+}
+
+static size_t file_message(char* buffer, uint32_t index, const char* data) {
+    uint64_t size = strlen(data);
+    buffer[0] = 'F';
+    memcpy(buffer + 1, &index, sizeof(index));
+    memcpy(buffer + 5, &size, sizeof(size));
+    memcpy(buffer + 13, data, size);
+    return 13 + size;
+}
+
+void test_client_writes_own_outputs() {
+    char fake[300];
+    snprintf(fake, sizeof(fake), "%s.fake", socket_path);
+    write_source("d.c", "int d(void) { return 0; }\n");
+    char* argv[] = {"d.c"};
+    char response[256];
+    uint32_t status = 0;
+
+    // The output of input 0 goes where the client put it
+    unlink("d.s");
+    size_t length = file_message(response, 0, "first\n");
+    response[length] = 'X';
+    memcpy(response + length + 1, &status, sizeof(status));
+    pid_t pid = start_fake_server(fake, response, length + 5);
+    assert(client_run(fake, 1, argv) == 0);
+    waitpid(pid, NULL, 0);
+    char* output = read_output("d.s");
+    assert(output != NULL && strcmp(output, "first\n") == 0);
+    free(output);
+
+    // An index the client did not ask for, or one already written, is refused
+    uint32_t indices[][2] = {{1, 1}, {0, 0}};
+    for (int i = 0; i < 2; i++) {
+        length = file_message(response, indices[i][0], "stray\n");
+        if (indices[i][1] == 0) length += file_message(response + length, 0, "again\n");
+        response[length] = 'X';
+        memcpy(response + length + 1, &status, sizeof(status));
+        unlink("d.s");
+        pid = start_fake_server(fake, response, length + 5);
+        assert(client_run(fake, 1, argv) == 1);
+        waitpid(pid, NULL, 0);
+        output = read_output("d.s");
+        assert(indices[i][1] == 1 ? output == NULL : strcmp(output, "stray\n") == 0);
+        free(output);
+    }
+    unlink(fake);
+    printf("test_client_writes_own_outputs: PASSED\n");
+}
+
+// Run the client with its stdout going to a file, and read that back
+static char* client_stdout(int argc, char** argv, int* status) {
+    fflush(stdout);
+    int saved = dup(1);
+    FILE* capture = fopen("stdout.txt", "w");
+    assert(capture != NULL);
+    dup2(fileno(capture), 1);
+    *status = run_client(argc, argv);
+    fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+    fclose(capture);
+    return read_output("stdout.txt");
+}
+
+void test_remote_cache_stats() {
+    // The statistics are printed by the client, with or without inputs
+    char* stats[] = {"--cache-stats", "--cache-dir", "cache"};
+    int status;
+    char* output = client_stdout(3, stats, &status);
+    assert(status == 0 && strstr(output, "hits              0") != NULL);
+    free(output);
+
+    char* compile[] = {"--cache-stats", "--cache-dir", "cache", "a.c"};
+    output = client_stdout(4, compile, &status);
+    assert(status == 0 && strstr(output, "misses            1") != NULL);
+    free(output);
+    output = client_stdout(4, compile, &status);
+    assert(status == 0 && strstr(output, "hits              1") != NULL);
+    free(output);
+    printf("test_remote_cache_stats: PASSED\n");
+}
+
+void test_stalled_client() {
+    // A client that connects and sends nothing only holds the others up
+    // until the server drops it
+    int stalled = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+    assert(connect(stalled, (struct sockaddr*)&address, sizeof(address)) == 0);
+
+    char* argv[] = {"a.c"};
+    unlink("a.s");
+    assert(run_client(1, argv) == 0);
+    assert(access("a.s", F_OK) == 0);
+    close(stalled);
+    printf("test_stalled_client: PASSED\n");
+}
+
+void test_private_directory() {
+    // Not in a directory other users can write to
+    char shared[] = "/tmp/c4-server-test-shared-XXXXXX";
+    assert(mkdtemp(shared) != NULL);
+    assert(chmod(shared, 0777) == 0);
+    char path[400];
+    snprintf(path, sizeof(path), "%s/c4.sock", shared);
+    assert(server_run(path) == 1);
+    assert(access(path, F_OK) != 0);
+    rmdir(shared);
+
+    // A missing directory is created for this user alone
+    snprintf(path, sizeof(path), "%s.private/c4.sock", socket_path);
+    char* dir = strdup(path);
+    *strrchr(dir, '/') = '\0';
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) _exit(server_run(path));
+    // The socket is bound before it listens
+    char* argv[] = {"--shutdown"};
+    int status = -1;
+    for (int i = 0; i < 500 && (status = client_run(path, 1, argv)) < 0; i++) usleep(10000);
+    assert(status == 0);
+    struct stat info;
+    assert(stat(dir, &info) == 0 && (info.st_mode & 0777) == 0700);
+    assert(waitpid(pid, NULL, 0) == pid);
+    rmdir(dir);
+    free(dir);
+    printf("test_private_directory: PASSED\n");
+}
+
+void test_server_shutdown() {
+    char* argv[] = {"--shutdown"};
+    assert(run_client(1, argv) == 0);
+
+    int status;
+    assert(waitpid(server_pid, &status, 0) == server_pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(access(socket_path, F_OK) != 0);
+
+    // Without a server the client reports that nobody is listening
+    char* compile[] = {"a.c"};
+    assert(run_client(1, compile) == -1);
+    printf("test_server_shutdown: PASSED\n");
+}
+
+int main() {
+    printf("Running server tests...\n");
+
+    char dir[] = "/tmp/c4-server-test-XXXXXX";
+    assert(mkdtemp(dir) != NULL);
+    assert(chdir(dir) == 0);
+    snprintf(socket_path, sizeof(socket_path), "%s/c4.sock", dir);
+
+    test_server_start();
+    test_remote_compile();
+    test_remote_options();
+    test_remote_errors();
+    test_client_writes_own_outputs();
+    test_remote_cache_stats();
+    test_stalled_client();
+    test_private_directory();
+    test_server_shutdown();
+
+    system("rm -rf /tmp/c4-server-test-*");
+    printf("All server tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../watch.h"
+#include "../c4.h"
+
+static const char* base_source =
+    "int square(int x) { return x * x; }\n"
+    "int cube(int x) { return x * x * x; }\n"
+    "int twice(int x) { return x + x; }\n"
+    "int main(void) { return square(2) + twice(3); }\n";
+
+// The spliced output must match a from-scratch compilation
+static void assert_matches_full_build(WatchState* state, const char* source) {
+    C4Context* ctx = c4_context_new();
+    C4Options options;
+    c4_options_init(&options);
+    options.filename = "kernel.c";
+    C4Result result;
+    assert(c4_compile(ctx, source, strlen(source), &options, &result));
+    assert(state->output_length == result.assembly_length);
+    assert(memcmp(state->output, result.assembly, result.assembly_length) == 0);
+    c4_context_free(ctx);
+}
+
+static char* replace(const char* source, const char* from, const char* to) {
+    const char* at = strstr(source, from);
+    assert(at != NULL);
+    char* result = malloc(strlen(source) - strlen(from) + strlen(to) + 1);
+    size_t prefix = at - source;
+    memcpy(result, source, prefix);
+    strcpy(result + prefix, to);
+    strcat(result, at + strlen(from));
+    return result;
+}
+
+void test_initial_build() {
+    WatchState state;
+    watch_init(&state, "kernel.c", true);
+
+    assert(watch_update(&state, base_source, strlen(base_source), stderr));
+    assert(state.decl_count == 4);
+    assert(state.recompiled == 4);
+    assert_matches_full_build(&state, base_source);
+
+    // Nothing changed, nothing recompiled
+    assert(watch_update(&state, base_source, strlen(base_source), stderr));
+    assert(state.recompiled == 0);
+    assert_matches_full_build(&state, base_source);
+
+    watch_free(&state);
+    printf("test_initial_build: PASSED\n");
+}
+
+void test_body_edit() {
+    WatchState state;
+    watch_init(&state, "kernel.c", true);
+    assert(watch_update(&state, base_source, strlen(base_source), stderr));
+
+    // Only the edited function is regenerated when nothing inlined it
+    char* edited = replace(base_source, "return x * x * x; }", "return x * x * x - 0; }");
+    assert(watch_update(&state, edited, strlen(edited), stderr));
+    assert(state.recompiled == 1);
+    assert_matches_full_build(&state, edited);
+
+    // main inlined square, so it is regenerated with it
+    char* inlined = replace(edited, "return x * x; }", "return x * x + 1; }");
+    assert(watch_update(&state, inlined, strlen(inlined), stderr));
+    assert(state.recompiled == 2);
+    assert_matches_full_build(&state, inlined);
+    free(edited);
+    edited = inlined;
+
+    // Inserting lines above a function does not make it dirty
+    char* shifted = replace(edited, "int cube", "\n\n\nint cube");
+    assert(watch_update(&state, shifted, strlen(shifted), stderr));
+    assert(state.recompiled == 0);
+
+    free(edited);
+    free(shifted);
+    watch_free(&state);
+    printf("test_body_edit: PASSED\n");
+}
+
+void test_interface_change() {
+    WatchState state;
+    watch_init(&state, "kernel.c", true);
+    assert(watch_update(&state, base_source, strlen(base_source), stderr));
+
+    // A signature change regenerates the function and its callers only
+    char* edited = replace(base_source, "int twice(int x)", "long twice(long x)");
+    assert(watch_update(&state, edited, strlen(edited), stderr));
+    assert(state.recompiled == 2);
+    assert_matches_full_build(&state, edited);
+
+    // Removing a function that is still called is an error in its callers
+    char* removed = replace(edited, "long twice(long x) { return x + x; }\n", "");
+    FILE* diagnostics = tmpfile();
+    assert(!watch_update(&state, removed, strlen(removed), diagnostics));
+    assert(ftell(diagnostics) > 0);
+    fclose(diagnostics);
+
+    // The previous output survives the failed update
+    assert_matches_full_build(&state, edited);
+
+    free(edited);
+    free(removed);
+    watch_free(&state);
+    printf("test_interface_change: PASSED\n");
+}
+
+void test_error_recovery() {
+    WatchState state;
+    watch_init(&state, "kernel.c", true);
+    assert(watch_update(&state, base_source, strlen(base_source), stderr));
+
+    char* broken = replace(base_source, "return x + x;", "return x + ;");
+    FILE* diagnostics = tmpfile();
+    assert(!watch_update(&state, broken, strlen(broken), diagnostics));
+    fclose(diagnostics);
+    assert_matches_full_build(&state, base_source);
+
+    // Fixing the error brings the output back in sync
+    char* fixed = replace(base_source, "return x + x;", "return x + x + 1;");
+    assert(watch_update(&state, fixed, strlen(fixed), stderr));
+    assert_matches_full_build(&state, fixed);
+
+    free(broken);
+    free(fixed);
+    watch_free(&state);
+    printf("test_error_recovery: PASSED\n");
+}
+
+void test_specialization() {
+    const char* source =
+        "static int scale(int x, int mode) { if (mode == 1) return x * 3; return x / mode; }\n"
+        "static int spare(int x) { return x - 1; }\n"
+        "int work(int* a, int n, int flags) { int s = 0; for (int i = 0; i < n; i++) {"
+        " if (flags & 1) s += a[i] * 3; else if (flags & 2) s -= a[i] >> 1; else s ^= a[i];"
+        " if (flags & 4) s += i; if (flags & 8) a[i & 7] += s; else a[(i + 1) & 7] -= s;"
+        " if (flags & 16) s = s * 5 + a[i & 7]; else s = s + (a[(i + 3) & 7] >> 2); } return s; }\n"
+        "int main(void) { int a[8]; return scale(2, 1) + work(a, 8, 1); }\n";
+    WatchState state;
+    watch_init(&state, "kernel.c", true);
+    assert(watch_update(&state, source, strlen(source), stderr));
+    assert(strstr(state.output, "spare") == NULL && strstr(state.output, "work.constprop.0") != NULL);
+    assert_matches_full_build(&state, source);
+
+    // A call with another mode unbinds scale, though its text is the same
+    char* edited = replace(source, "scale(2, 1)", "scale(2, 1) + scale(3, 4)");
+    assert(watch_update(&state, edited, strlen(edited), stderr));
+    assert(state.recompiled == 2);
+    assert_matches_full_build(&state, edited);
+
+    // Calling spare brings it back, other flags give work another clone
+    char* called = replace(edited, "work(a, 8, 1)", "work(a, 8, 22) + spare(1)");
+    assert(watch_update(&state, called, strlen(called), stderr));
+    assert(strstr(state.output, "spare:") != NULL);
+    assert_matches_full_build(&state, called);
+
+    // And dropping the calls takes it all away again
+    assert(watch_update(&state, source, strlen(source), stderr));
+    assert_matches_full_build(&state, source);
+
+    free(edited);
+    free(called);
+    watch_free(&state);
+    printf("test_specialization: PASSED\n");
+}
+
+void test_reachability() {
+    // An unused static is not checked; once used, its body is
+    const char* source =
+        "static int broken(int x) { return x + missing; }\n"
+        "static int helper(int x) { return x * 2; }\n"
+        "int main(void) { return helper(3); }\n";
+    WatchState state;
+    watch_init(&state, "kernel.c", true);
+    assert(watch_update(&state, source, strlen(source), stderr));
+    assert(strstr(state.output, "broken") == NULL);
+    assert_matches_full_build(&state, source);
+
+    char* uses = replace(source, "helper(3)", "broken(3)");
+    FILE* diagnostics = tmpfile();
+    assert(!watch_update(&state, uses, strlen(uses), diagnostics));
+    assert(ftell(diagnostics) > 0);
+    fclose(diagnostics);
+
+    // Fixing it brings it in, and helper, now unused, goes away
+    char* fixed = replace(uses, "missing", "1");
+    assert(watch_update(&state, fixed, strlen(fixed), stderr));
+    assert(strstr(state.output, "broken:") != NULL && strstr(state.output, "helper") == NULL);
+    assert_matches_full_build(&state, fixed);
+
+    // Back to using helper: broken is left out again without a change to its text
+    char* back = replace(fixed, "broken(3)", "helper(3)");
+    assert(watch_update(&state, back, strlen(back), stderr));
+    assert(strstr(state.output, "broken") == NULL && strstr(state.output, "helper:") != NULL);
+    assert_matches_full_build(&state, back);
+
+    free(uses);
+    free(fixed);
+    free(back);
+    watch_free(&state);
+    printf("test_reachability: PASSED\n");
+}
+
+void test_inlined_dependents() {
+    // order inlines gsideeffect, and main may inline order in turn
+    const char* source =
+        "int g;\n"
+        "int gsideeffect(void) { g = g * 3 + 1; return g; }\n"
+        "int order(int x) { return x + gsideeffect() * 2; }\n"
+        "int main(void) { return order(4) & 127; }\n";
+    WatchState state;
+    watch_init(&state, "kernel.c", true);
+    assert(watch_update(&state, source, strlen(source), stderr));
+    assert_matches_full_build(&state, source);
+
+    // Retyping g changes gsideeffect without touching its text, and with
+    // it everything that inlined it, directly or not
+    char* retyped = replace(source, "int g;", "long g;");
+    assert(watch_update(&state, retyped, strlen(retyped), stderr));
+    assert(state.recompiled == 4);
+    assert_matches_full_build(&state, retyped);
+
+    assert(watch_update(&state, source, strlen(source), stderr));
+    assert_matches_full_build(&state, source);
+
+    free(retyped);
+    watch_free(&state);
+    printf("test_inlined_dependents: PASSED\n");
+}
+
+int main() {
+    printf("Running watch tests...\n");
+    test_initial_build();
+    test_body_edit();
+    test_interface_change();
+    test_error_recovery();
+    test_specialization();
+    test_reachability();
+    test_inlined_dependents();
+    printf("All watch tests passed!\n");
+    return 0;
+}
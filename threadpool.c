@@ -0,0 +1,185 @@
+#include "threadpool.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+// Deque operations
+static void deque_init(TaskDeque* deque) {
+    deque->capacity = 16;
+    deque->tasks = malloc(sizeof(Task) * deque->capacity);
+    deque->top = 0;
+    deque->bottom = 0;
+    pthread_mutex_init(&deque->lock, NULL);
+}
+
+static void deque_free(TaskDeque* deque) {
+    pthread_mutex_destroy(&deque->lock);
+    free(deque->tasks);
+}
+
+static void deque_push_bottom(TaskDeque* deque, Task task) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom - deque->top >= deque->capacity) {
+        // Grow and unwrap the ring buffer
+        int new_capacity = deque->capacity * 2;
+        Task* tasks = malloc(sizeof(Task) * new_capacity);
+        for (int i = deque->top; i < deque->bottom; i++) {
+            tasks[i - deque->top] = deque->tasks[i % deque->capacity];
+        }
+        free(deque->tasks);
+        deque->bottom -= deque->top;
+        deque->top = 0;
+        deque->tasks = tasks;
+        deque->capacity = new_capacity;
+    }
+    deque->tasks[deque->bottom % deque->capacity] = task;
+    deque->bottom++;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+static bool deque_pop_bottom(TaskDeque* deque, Task* task) {
+    bool found = false;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top) {
+        deque->bottom--;
+        *task = deque->tasks[deque->bottom % deque->capacity];
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static bool deque_steal_top(TaskDeque* deque, Task* task) {
+    bool found = false;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top) {
+        *task = deque->tasks[deque->top % deque->capacity];
+        deque->top++;
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// Try the worker's own deque first, then steal from the others
+static bool find_task(Worker* self, Task* task) {
+    if (deque_pop_bottom(&self->deque, task)) return true;
+
+    ThreadPool* pool = self->pool;
+    for (int i = 1; i < pool->worker_count; i++) {
+        Worker* victim = &pool->workers[(self->index + i) % pool->worker_count];
+        if (deque_steal_top(&victim->deque, task)) return true;
+    }
+    return false;
+}
+
+static void* worker_main(void* arg) {
+    Worker* self = arg;
+    ThreadPool* pool = self->pool;
+
+    for (;;) {
+        Task task;
+        if (find_task(self, &task)) {
+            task.function(task.arg);
+
+            pthread_mutex_lock(&pool->lock);
+            pool->pending--;
+            if (pool->pending == 0) pthread_cond_broadcast(&pool->all_done);
+            pthread_mutex_unlock(&pool->lock);
+            continue;
+        }
+
+        // Nothing to run or steal: sleep until new work or shutdown.
+        // Tasks still queued (pending but not stolen yet) mean a retry.
+        pthread_mutex_lock(&pool->lock);
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        int queued = 0;
+        for (int i = 0; i < pool->worker_count; i++) {
+            TaskDeque* deque = &pool->workers[i].deque;
+            pthread_mutex_lock(&deque->lock);
+            queued += deque->bottom - deque->top;
+            pthread_mutex_unlock(&deque->lock);
+        }
+        if (queued == 0) pthread_cond_wait(&pool->work_available, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+// Thread pool interface implementation
+ThreadPool* threadpool_init(int worker_count) {
+    if (worker_count < 1) worker_count = 1;
+
+    ThreadPool* pool = malloc(sizeof(ThreadPool));
+    pool->workers = malloc(sizeof(Worker) * worker_count);
+    pool->worker_count = worker_count;
+    pool->next_worker = 0;
+    pool->pending = 0;
+    pool->shutdown = false;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_available, NULL);
+    pthread_cond_init(&pool->all_done, NULL);
+
+    for (int i = 0; i < worker_count; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        deque_init(&pool->workers[i].deque);
+    }
+    for (int i = 0; i < worker_count; i++) {
+        pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i]);
+    }
+
+    return pool;
+}
+
+void threadpool_free(ThreadPool* pool) {
+    threadpool_wait(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->work_available);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->worker_count; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    for (int i = 0; i < pool->worker_count; i++) {
+        deque_free(&pool->workers[i].deque);
+    }
+
+    pthread_cond_destroy(&pool->all_done);
+    pthread_cond_destroy(&pool->work_available);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
+
+void threadpool_submit(ThreadPool* pool, TaskFunction function, void* arg) {
+    Task task = {function, arg};
+
+    pthread_mutex_lock(&pool->lock);
+    Worker* worker = &pool->workers[pool->next_worker];
+    pool->next_worker = (pool->next_worker + 1) % pool->worker_count;
+    pool->pending++;
+    pthread_mutex_unlock(&pool->lock);
+
+    deque_push_bottom(&worker->deque, task);
+
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->work_available);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void threadpool_wait(ThreadPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->all_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int threadpool_default_workers(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
@@ -0,0 +1,55 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+// Unit of work executed by a pool worker
+typedef void (*TaskFunction)(void* arg);
+
+typedef struct {
+    TaskFunction function;
+    void* arg;
+} Task;
+
+// Per-worker double-ended queue. The owner pops from the bottom,
+// idle workers steal from the top.
+typedef struct {
+    Task* tasks;
+    int capacity;
+    int top;
+    int bottom;
+    pthread_mutex_t lock;
+} TaskDeque;
+
+typedef struct ThreadPool ThreadPool;
+
+typedef struct {
+    ThreadPool* pool;
+    int index;
+    pthread_t thread;
+    TaskDeque deque;
+} Worker;
+
+// Work-stealing thread pool
+struct ThreadPool {
+    Worker* workers;
+    int worker_count;
+    int next_worker;      // Round-robin target for external submissions
+    int pending;          // Submitted tasks that have not finished yet
+    bool shutdown;
+    pthread_mutex_t lock;
+    pthread_cond_t work_available;
+    pthread_cond_t all_done;
+};
+
+// Thread pool interface functions
+ThreadPool* threadpool_init(int worker_count);
+void threadpool_free(ThreadPool* pool);
+void threadpool_submit(ThreadPool* pool, TaskFunction function, void* arg);
+void threadpool_wait(ThreadPool* pool);
+
+// Number of online processors, at least 1
+int threadpool_default_workers(void);
+
+#endif // THREADPOOL_H
@@ -0,0 +1,542 @@
+#include "watch.h"
+#include "parser.h"
+#include "semantic.h"
+#include "codegen.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Map from interned name to the index of the first declaration defining it.
+// Interned strings are unique, so names compare by pointer.
+typedef struct {
+    const char** keys;
+    int* values;
+    int capacity;
+} NameTable;
+
+static void names_init(NameTable* table, int count) {
+    table->capacity = 16;
+    while (table->capacity < count * 2) table->capacity *= 2;
+    table->keys = calloc(table->capacity, sizeof(const char*));
+    table->values = malloc(sizeof(int) * table->capacity);
+}
+
+static void names_free(NameTable* table) {
+    free(table->keys);
+    free(table->values);
+}
+
+static int names_slot(const NameTable* table, const char* name) {
+    size_t index = ((size_t)name >> 3) & (table->capacity - 1);
+    while (table->keys[index] != NULL && table->keys[index] != name) {
+        index = (index + 1) & (table->capacity - 1);
+    }
+    return (int)index;
+}
+
+static void names_add(NameTable* table, const char* name, int value) {
+    int slot = names_slot(table, name);
+    if (table->keys[slot] != NULL) return;   // Keep the first definition
+    table->keys[slot] = name;
+    table->values[slot] = value;
+}
+
+static int names_get(const NameTable* table, const char* name) {
+    int slot = names_slot(table, name);
+    return table->keys[slot] != NULL ? table->values[slot] : -1;
+}
+
+// FNV-1a over token types and spellings; positions are deliberately left
+// out so that moving a declaration does not change its hash
+static unsigned long long hash_tokens(Token** tokens, int count) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (int i = 0; i < count; i++) {
+        hash = (hash ^ (unsigned)tokens[i]->type) * 1099511628211ULL;
+        for (const char* c = tokens[i]->lexeme; *c; c++) {
+            hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+        }
+        hash = (hash ^ 0xff) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Tokens before the body of a function definition
+static int interface_length(Token** tokens, int count) {
+    int parens = 0;
+    for (int i = 0; i < count; i++) {
+        if (tokens[i]->type == TOKEN_LPAREN) parens++;
+        else if (tokens[i]->type == TOKEN_RPAREN) parens--;
+        else if (tokens[i]->type == TOKEN_LBRACE && parens == 0) return i;
+    }
+    return count;
+}
+
+// End of the top-level declaration starting at `start`: a ';' or the
+// closing '}' of a function body at nesting depth zero
+static int declaration_end(Token** tokens, int count, int start) {
+    int depth = 0;
+    for (int i = start; i < count; i++) {
+        switch (tokens[i]->type) {
+            case TOKEN_LPAREN:
+            case TOKEN_LBRACKET:
+            case TOKEN_LBRACE:
+                depth++;
+                break;
+            case TOKEN_RPAREN:
+            case TOKEN_RBRACKET:
+                depth--;
+                break;
+            case TOKEN_RBRACE:
+                if (--depth == 0) return i + 1;
+                break;
+            case TOKEN_SEMICOLON:
+                if (depth == 0) return i + 1;
+                break;
+            default:
+                break;
+        }
+    }
+    return count;
+}
+
+static void block_release(TokenBlock* block) {
+    if (block != NULL && --block->refs == 0) {
+        arena_free(&block->arena);
+        free(block);
+    }
+}
+
+static void decl_free(WatchDecl* decl) {
+    free_statement(decl->ast);
+    block_release(decl->block);
+    free(decl->names);
+    free(decl->refs);
+    free(decl->ref_defined);
+    free(decl->inlined);
+    free(decl->assembly);
+}
+
+// Names defined by a parsed declaration
+static void collect_names(WatchDecl* decl) {
+    Statement* list = decl->ast;
+    decl->names = malloc(sizeof(const char*) * (list->as.compound.count + 1));
+    decl->name_count = 0;
+    for (int i = 0; i < list->as.compound.count; i++) {
+        Statement* stmt = list->as.compound.statements[i];
+        Token* name = stmt->type == NODE_FUNCTION ? stmt->as.function.name :
+                      stmt->type == NODE_DECLARATION ? stmt->as.declaration.name : NULL;
+        if (name != NULL) decl->names[decl->name_count++] = name->lexeme;
+    }
+}
+
+// Distinct identifiers used by a declaration
+static void collect_refs(WatchDecl* decl, Token** tokens, int count) {
+    decl->refs = malloc(sizeof(const char*) * (count + 1));
+    decl->ref_count = 0;
+    for (int i = 0; i < count; i++) {
+        if (tokens[i]->type != TOKEN_IDENTIFIER) continue;
+        bool seen = false;
+        for (int j = 0; j < decl->ref_count && !seen; j++) {
+            seen = decl->refs[j] == tokens[i]->lexeme;
+        }
+        if (!seen) decl->refs[decl->ref_count++] = tokens[i]->lexeme;
+    }
+    decl->ref_defined = calloc(decl->ref_count + 1, sizeof(bool));
+}
+
+static bool parse_decl(WatchState* state, WatchDecl* decl, Token** tokens, int count,
+                       FILE* diagnostics) {
+    Parser* parser = parser_init_tokens(tokens, count, state->filename);
+    Statement* list = parse_program(parser);
+    list->as.compound.scoped = false;
+    decl->ast = list;
+
+    bool ok = !parser->had_error;
+    if (!ok) {
+        fprintf(diagnostics, "%s:%d:%d: %s\n",
+                parser->error->filename,
+                parser->error->line,
+                parser->error->column,
+                parser->error->message);
+    }
+    parser_free(parser);
+
+    collect_names(decl);
+    collect_refs(decl, tokens, count);
+    return ok;
+}
+
+// Which statements of a declaration mark_reachable left out
+static unsigned long long unreachable_mask(const WatchDecl* decl) {
+    Statement* list = decl->ast;
+    unsigned long long mask = 0;
+    for (int i = 0; i < list->as.compound.count && i < 64; i++) {
+        Statement* stmt = list->as.compound.statements[i];
+        bool unreachable = stmt->type == NODE_FUNCTION ? stmt->as.function.is_unreachable :
+                           stmt->type == NODE_DECLARATION && stmt->as.declaration.is_unreachable;
+        if (unreachable) mask |= 1ULL << i;
+    }
+    return mask;
+}
+
+// The generator has collected the functions of every declaration, which
+// may be inlined into this one; the names inlining looked at are kept,
+// interned, to know when to come back
+static void generate_decl(CodeGenerator* gen, WatchDecl* decl) {
+    free(decl->assembly);
+    gen->inline_source_count = 0;
+    generate_toplevel(gen, decl->ast);
+    decl->assembly = codegen_take_output(gen, &decl->assembly_length);
+
+    free(decl->inlined);
+    decl->inlined = malloc(sizeof(const char*) * (gen->inline_source_count + 1));
+    if (gen->inline_source_count > 0) {
+        memcpy(decl->inlined, gen->inline_sources, sizeof(const char*) * gen->inline_source_count);
+    }
+    decl->inlined_count = gen->inline_source_count;
+}
+
+// Declarations that inlined a function generated again, for whatever
+// reason, are generated again too, until no more follow. `rewritten`
+// holds the names of the functions generated again so far.
+static void spread_to_inliners(WatchDecl* decls, int count, bool* dirty, NameTable* rewritten) {
+    bool spread = true;
+    while (spread) {
+        spread = false;
+        for (int i = 0; i < count; i++) {
+            if (dirty[i]) continue;
+            for (int j = 0; j < decls[i].inlined_count && !dirty[i]; j++) {
+                if (names_get(rewritten, decls[i].inlined[j]) >= 0) dirty[i] = true;
+            }
+            if (!dirty[i]) continue;
+            for (int j = 0; j < decls[i].name_count; j++) names_add(rewritten, decls[i].names[j], i);
+            spread = true;
+        }
+    }
+}
+
+// Declarations whose functions the calls of the unit now specialize
+// differently, and those whose code calls or inlined them, are generated
+// again
+static void respecialize(WatchState* state, WatchDecl* decls, int count, const bool* fresh, bool* dirty,
+                         CodeGenerator* gen) {
+    NameTable previous;
+    names_init(&previous, state->decl_count);
+    for (int i = 0; i < state->decl_count; i++) {
+        for (int j = 0; j < state->decls[i].name_count; j++) names_add(&previous, state->decls[i].names[j], i);
+    }
+    NameTable respecialized;
+    names_init(&respecialized, count);
+    for (int i = 0; i < count; i++) {
+        WatchDecl* decl = &decls[i];
+        unsigned long long hash = 0;
+        unsigned long long old = fresh[i] ? 0 : decl->call_site_hash;
+        for (int j = 0; j < decl->name_count; j++) {
+            hash ^= call_site_hash(gen, decl->names[j]);
+            int k = names_get(&previous, decl->names[j]);
+            if (fresh[i] && k >= 0) old = state->decls[k].call_site_hash;
+        }
+        decl->call_site_hash = hash;
+        if (hash == old) continue;
+        dirty[i] = true;
+        for (int j = 0; j < decl->name_count; j++) names_add(&respecialized, decl->names[j], i);
+    }
+    for (int i = 0; i < count; i++) {
+        WatchDecl* decl = &decls[i];
+        for (int j = 0; j < decl->ref_count && !dirty[i]; j++) {
+            if (names_get(&respecialized, decl->refs[j]) >= 0) dirty[i] = true;
+        }
+        for (int j = 0; j < decl->inlined_count && !dirty[i]; j++) {
+            if (names_get(&respecialized, decl->inlined[j]) >= 0) dirty[i] = true;
+        }
+    }
+    names_free(&respecialized);
+    NameTable rewritten;
+    names_init(&rewritten, count);
+    for (int i = 0; i < count; i++) {
+        if (!dirty[i]) continue;
+        for (int j = 0; j < decls[i].name_count; j++) names_add(&rewritten, decls[i].names[j], i);
+    }
+    spread_to_inliners(decls, count, dirty, &rewritten);
+    names_free(&rewritten);
+    names_free(&previous);
+}
+
+static int compare_hashes(const void* a, const void* b) {
+    const WatchDecl* left = *(WatchDecl* const*)a;
+    const WatchDecl* right = *(WatchDecl* const*)b;
+    return left->hash < right->hash ? -1 : left->hash > right->hash;
+}
+
+static bool contains_hash(const unsigned long long* hashes, int count, unsigned long long hash) {
+    for (int i = 0; i < count; i++) {
+        if (hashes[i] == hash) return true;
+    }
+    return false;
+}
+
+void watch_init(WatchState* state, const char* filename, bool optimize) {
+    memset(state, 0, sizeof(WatchState));
+    state->filename = strdup(filename);
+    state->optimize = optimize;
+    state->unroll_factor = DEFAULT_UNROLL_FACTOR;
+    state->vector_width = DEFAULT_VECTOR_WIDTH;
+    state->inline_functions = true;
+    state->specialize_functions = true;
+    state->schedule_instructions = true;
+    interner_init(&state->interner);
+
+    CodeGenerator* gen = codegen_init(NULL, optimize);
+    generate_preamble(gen);
+    state->preamble = codegen_take_output(gen, &state->preamble_length);
+    codegen_free(gen);
+}
+
+void watch_free(WatchState* state) {
+    for (int i = 0; i < state->decl_count; i++) {
+        decl_free(&state->decls[i]);
+    }
+    free(state->decls);
+    free(state->preamble);
+    free(state->output);
+    interner_free(&state->interner);
+    free(state->filename);
+}
+
+bool watch_update(WatchState* state, const char* src, size_t len, FILE* diagnostics) {
+    // Lex the new version into its own token block
+    char* source = malloc(len + 1);
+    memcpy(source, src, len);
+    source[len] = '\0';
+
+    TokenBlock* block = malloc(sizeof(TokenBlock));
+    arena_init(&block->arena);
+    block->refs = 1;   // Held by this update until the new state is committed
+
+    Lexer* lexer = lexer_init(source, state->filename);
+    lexer->arena = &block->arena;
+    lexer->interner = &state->interner;
+    int token_count = 0;
+    int token_capacity = 1024;
+    Token** tokens = malloc(sizeof(Token*) * token_capacity);
+    for (;;) {
+        Token* token = lexer_next_token(lexer);
+        if (token->type == TOKEN_EOF) break;
+        if (token_count == token_capacity) {
+            token_capacity *= 2;
+            tokens = realloc(tokens, sizeof(Token*) * token_capacity);
+        }
+        tokens[token_count++] = token;
+    }
+    lexer_free(lexer);
+    free(source);
+
+    // Split into top-level declarations
+    int span_capacity = 64;
+    int span_count = 0;
+    int* starts = malloc(sizeof(int) * (span_capacity + 1));
+    for (int i = 0; i < token_count; i = declaration_end(tokens, token_count, i)) {
+        if (span_count == span_capacity) {
+            span_capacity *= 2;
+            starts = realloc(starts, sizeof(int) * (span_capacity + 1));
+        }
+        starts[span_count++] = i;
+    }
+    starts[span_count] = token_count;
+
+    // Reuse old declarations with identical text
+    WatchDecl** by_hash = malloc(sizeof(WatchDecl*) * (state->decl_count + 1));
+    for (int i = 0; i < state->decl_count; i++) by_hash[i] = &state->decls[i];
+    qsort(by_hash, state->decl_count, sizeof(WatchDecl*), compare_hashes);
+    bool* reused = calloc(state->decl_count + 1, sizeof(bool));
+
+    WatchDecl* decls = calloc(span_count + 1, sizeof(WatchDecl));
+    bool* fresh = calloc(span_count + 1, sizeof(bool));
+    bool* dirty = calloc(span_count + 1, sizeof(bool));
+    bool ok = true;
+    for (int i = 0; i < span_count; i++) {
+        Token** span = tokens + starts[i];
+        int count = starts[i + 1] - starts[i];
+        unsigned long long hash = hash_tokens(span, count);
+
+        int lo = 0, hi = state->decl_count;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (by_hash[mid]->hash < hash) lo = mid + 1;
+            else hi = mid;
+        }
+        for (; lo < state->decl_count && by_hash[lo]->hash == hash; lo++) {
+            int old = (int)(by_hash[lo] - state->decls);
+            if (!reused[old]) {
+                reused[old] = true;
+                decls[i] = state->decls[old];
+                break;
+            }
+        }
+        if (decls[i].ast != NULL) continue;
+
+        fresh[i] = dirty[i] = true;
+        decls[i].hash = hash;
+        decls[i].interface_hash = hash_tokens(span, interface_length(span, count));
+        decls[i].block = block;
+        block->refs++;
+        if (ok) ok = parse_decl(state, &decls[i], span, count, diagnostics);
+    }
+
+    // Statics that something reachable now uses are checked and generated,
+    // and those nothing does any more are left out
+    if (ok) {
+        Statement** lists = malloc(sizeof(Statement*) * (span_count + 1));
+        unsigned long long* masks = malloc(sizeof(unsigned long long) * (span_count + 1));
+        for (int i = 0; i < span_count; i++) {
+            lists[i] = decls[i].ast;
+            masks[i] = unreachable_mask(&decls[i]);
+        }
+        mark_reachable(lists, span_count);
+        for (int i = 0; i < span_count; i++) {
+            if (unreachable_mask(&decls[i]) != masks[i]) dirty[i] = true;
+        }
+        free(lists);
+        free(masks);
+    }
+
+    // Names whose declarations appeared, disappeared or changed interface
+    int removed_count = 0;
+    unsigned long long* removed = malloc(sizeof(unsigned long long) * (state->decl_count + 1));
+    unsigned long long* added = malloc(sizeof(unsigned long long) * (span_count + 1));
+    int added_count = 0;
+    for (int i = 0; i < state->decl_count; i++) {
+        if (!reused[i]) removed[removed_count++] = state->decls[i].interface_hash;
+    }
+    for (int i = 0; i < span_count; i++) {
+        if (fresh[i]) added[added_count++] = decls[i].interface_hash;
+    }
+
+    NameTable changed;
+    names_init(&changed, state->decl_count + span_count);
+    for (int i = 0; i < state->decl_count; i++) {
+        WatchDecl* decl = &state->decls[i];
+        if (reused[i] || contains_hash(added, added_count, decl->interface_hash)) continue;
+        for (int j = 0; j < decl->name_count; j++) names_add(&changed, decl->names[j], i);
+    }
+    for (int i = 0; i < span_count && ok; i++) {
+        if (!fresh[i] || contains_hash(removed, removed_count, decls[i].interface_hash)) continue;
+        for (int j = 0; j < decls[i].name_count; j++) names_add(&changed, decls[i].names[j], i);
+    }
+
+    // Dependents of changed names, and declarations whose uses now resolve
+    // to a different set of earlier declarations, are checked again. After
+    // a failed update everything is, since reused ASTs may hold stale types.
+    NameTable defined;
+    names_init(&defined, span_count);
+    for (int i = 0; i < span_count && ok; i++) {
+        for (int j = 0; j < decls[i].name_count; j++) names_add(&defined, decls[i].names[j], i);
+    }
+    for (int i = 0; i < span_count && ok; i++) {
+        WatchDecl* decl = &decls[i];
+        for (int j = 0; j < decl->ref_count; j++) {
+            int definition = names_get(&defined, decl->refs[j]);
+            bool earlier = definition >= 0 && definition <= i;
+            if (!fresh[i] && (earlier != decl->ref_defined[j] ||
+                              names_get(&changed, decl->refs[j]) >= 0)) {
+                dirty[i] = true;
+            }
+            decl->ref_defined[j] = earlier;
+        }
+        if (state->recheck_all) dirty[i] = true;
+    }
+    names_free(&defined);
+    names_free(&changed);
+
+    // Code that may have inlined a function generated again, for whatever
+    // reason, is generated again too, until no more declarations follow
+    NameTable rewritten;
+    names_init(&rewritten, state->decl_count + span_count);
+    for (int i = 0; i < state->decl_count; i++) {
+        if (reused[i]) continue;
+        for (int j = 0; j < state->decls[i].name_count; j++) names_add(&rewritten, state->decls[i].names[j], i);
+    }
+    for (int i = 0; i < span_count && ok; i++) {
+        if (!dirty[i]) continue;
+        for (int j = 0; j < decls[i].name_count; j++) names_add(&rewritten, decls[i].names[j], i);
+    }
+    if (ok) spread_to_inliners(decls, span_count, dirty, &rewritten);
+    names_free(&rewritten);
+
+    // Check in file order; unchanged declarations are only declared
+    if (ok) {
+        SemanticAnalyzer* analyzer = semantic_init();
+        analyzer->filename = strdup(state->filename);
+        analyzer->diagnostics = diagnostics;
+        for (int i = 0; i < span_count; i++) {
+            if (dirty[i]) {
+                check_toplevel(analyzer, decls[i].ast);
+            } else {
+                declare_toplevel(analyzer, decls[i].ast);
+            }
+        }
+        ok = !analyzer->had_error;
+        semantic_free(analyzer);
+    }
+
+    if (!ok) {
+        // Keep the previous version; reused declarations may have been
+        // checked against the broken one
+        for (int i = 0; i < span_count; i++) {
+            if (fresh[i]) decl_free(&decls[i]);
+        }
+        free(decls);
+        state->recheck_all = state->decl_count > 0;
+    } else {
+        // Regenerate and splice. One generator sees the whole unit, as in
+        // a full build, for inlining and for what the calls pass.
+        CodeGenerator* gen = codegen_init(NULL, state->optimize);
+        gen->unroll_factor = state->unroll_factor;
+        gen->vector_width = state->vector_width;
+        gen->inline_functions = state->inline_functions;
+        gen->specialize_functions = state->specialize_functions;
+        gen->schedule_instructions = state->schedule_instructions;
+        for (int i = 0; i < span_count; i++) collect_functions(gen, decls[i].ast);
+        analyze_call_sites(gen);
+        respecialize(state, decls, span_count, fresh, dirty, gen);
+
+        state->recompiled = 0;
+        size_t length = state->preamble_length;
+        for (int i = 0; i < span_count; i++) {
+            if (dirty[i]) {
+                generate_decl(gen, &decls[i]);
+                state->recompiled++;
+            }
+            length += decls[i].assembly_length;
+        }
+        codegen_free(gen);
+
+        free(state->output);
+        state->output = malloc(length + 1);
+        memcpy(state->output, state->preamble, state->preamble_length);
+        state->output_length = state->preamble_length;
+        for (int i = 0; i < span_count; i++) {
+            memcpy(state->output + state->output_length, decls[i].assembly, decls[i].assembly_length);
+            state->output_length += decls[i].assembly_length;
+        }
+        state->output[state->output_length] = '\0';
+
+        for (int i = 0; i < state->decl_count; i++) {
+            if (!reused[i]) decl_free(&state->decls[i]);
+        }
+        free(state->decls);
+        state->decls = decls;
+        state->decl_count = span_count;
+        state->recheck_all = false;
+    }
+
+    block_release(block);
+    free(removed);
+    free(added);
+    free(fresh);
+    free(dirty);
+    free(reused);
+    free(by_hash);
+    free(starts);
+    free(tokens);
+    return ok;
+}
@@ -0,0 +1,69 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "lexer.h"
+#include "ast.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Token storage of one version of the file. Declarations that stay
+// unchanged keep the tokens (and AST) of the version they were parsed from.
+typedef struct {
+    Arena arena;
+    int refs;                // Declarations whose AST points into the arena
+} TokenBlock;
+
+// One top-level declaration: its token span hash, the AST parsed from it
+// and the assembly generated for it
+typedef struct {
+    unsigned long long hash;            // All tokens of the declaration
+    unsigned long long interface_hash;  // Tokens before the function body
+    TokenBlock* block;
+    Statement* ast;                     // Unscoped compound of the declarations
+    const char** names;                 // Interned names the declaration defines
+    int name_count;
+    const char** refs;                  // Interned identifiers it uses
+    bool* ref_defined;                  // Whether each ref names an earlier declaration
+    int ref_count;
+    const char** inlined;               // Functions whose bodies its code may contain
+    int inlined_count;
+    unsigned long long call_site_hash;  // What the calls of the unit decided for its functions
+    char* assembly;
+    size_t assembly_length;
+} WatchDecl;
+
+// Incremental compilation state of one file
+typedef struct {
+    char* filename;
+    bool optimize;
+    int unroll_factor;
+    int vector_width;
+    bool inline_functions;
+    bool specialize_functions;
+    bool schedule_instructions;
+    Interner interner;       // Identifier spellings of every version
+    WatchDecl* decls;
+    int decl_count;
+    char* preamble;
+    size_t preamble_length;
+    char* output;            // Spliced assembly of the last good version
+    size_t output_length;
+    bool recheck_all;        // A failed update may have left stale types
+    int recompiled;          // Declarations regenerated by the last update
+} WatchState;
+
+void watch_init(WatchState* state, const char* filename, bool optimize);
+void watch_free(WatchState* state);
+
+// Bring the state up to date with a new version of the source. Only
+// declarations whose text changed, which use a declaration whose
+// interface changed, or which inlined a function whose body changed, are
+// parsed, checked and generated again; those using or defining a function
+// whose calls now specialize it differently are generated again too, and
+// statics that become reachable or unreachable are checked and generated
+// again. On error the diagnostics are written and the previous version is
+// kept.
+bool watch_update(WatchState* state, const char* src, size_t len, FILE* diagnostics);
+
+#endif // WATCH_H
@@ -0,0 +1,562 @@
+#include "x86.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char* register_names[4][16] = {
+    {"al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+     "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"},
+    {"ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+     "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w"},
+    {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+     "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"},
+    {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+     "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"}
+};
+
+static const char* condition_names[16] = {
+    "o", "no", "b", "ae", "e", "ne", "be", "a", "s", "ns", "p", "np", "l", "ge", "le", "g"
+};
+
+// Listing management
+void asm_list_init(AsmList* list) {
+    list->items = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+void asm_list_free(AsmList* list) {
+    free(list->items);
+    asm_list_init(list);
+}
+
+AsmItem* asm_list_add(AsmList* list, AsmItemKind kind) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 256;
+        list->items = realloc(list->items, sizeof(AsmItem) * list->capacity);
+    }
+    AsmItem* item = &list->items[list->count++];
+    memset(item, 0, sizeof(AsmItem));
+    item->kind = kind;
+    return item;
+}
+
+void asm_list_append(AsmList* list, const AsmList* other) {
+    for (int i = 0; i < other->count; i++) {
+        *asm_list_add(list, other->items[i].kind) = other->items[i];
+    }
+}
+
+// Operand constructors
+Operand operand_register(int reg, int size) {
+    Operand operand = {OPERAND_REGISTER, size, reg, 0, NULL};
+    return operand;
+}
+
+Operand operand_immediate(long long value) {
+    Operand operand = {OPERAND_IMMEDIATE, 0, -1, value, NULL};
+    return operand;
+}
+
+Operand operand_memory(int base, long long displacement, int size) {
+    Operand operand = {OPERAND_MEMORY, size, base, displacement, NULL};
+    return operand;
+}
+
+Operand operand_symbol(const char* symbol, int size) {
+    Operand operand = {OPERAND_SYMBOL, size, -1, 0, symbol};
+    return operand;
+}
+
+Operand operand_string(const char* owner, int index) {
+    Operand operand = {OPERAND_STRING, 8, -1, index, owner};
+    return operand;
+}
+
+Operand operand_label(const char* owner, int label) {
+    Operand operand = {OPERAND_LABEL, 0, -1, label, owner};
+    return operand;
+}
+
+Operand operand_vector(int reg, int size) {
+    Operand operand = {OPERAND_VECTOR, size, reg, 0, NULL};
+    return operand;
+}
+
+int minst_size(const MInst* inst) {
+    if (inst->dst.size != 0) return inst->dst.size;
+    return inst->src.size;
+}
+
+static void add_use(RegisterEffects* effects, int reg) {
+    effects->uses[effects->use_count++] = reg;
+}
+
+static void add_def(RegisterEffects* effects, int reg) {
+    effects->defs[effects->def_count++] = reg;
+}
+
+// Registers read to compute the address or value of an operand
+static void operand_uses(RegisterEffects* effects, const Operand* operand) {
+    if (operand->kind == OPERAND_REGISTER || operand->kind == OPERAND_MEMORY) {
+        add_use(effects, operand->reg);
+    }
+}
+
+static const int argument_registers[6] = {REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9};
+static const int caller_saved[9] = {
+    REG_RAX, REG_RCX, REG_RDX, REG_RSI, REG_RDI, REG_R8, REG_R9, REG_R10, REG_R11
+};
+
+void minst_effects(const MInst* inst, RegisterEffects* effects) {
+    effects->use_count = 0;
+    effects->def_count = 0;
+    const Operand* src = &inst->src;
+    const Operand* dst = &inst->dst;
+    bool dst_register = dst->kind == OPERAND_REGISTER;
+
+    switch (inst->opcode) {
+        case X86_MOV:
+        case X86_MOVABS:
+        case X86_MOVSX:
+        case X86_MOVZX:
+        case X86_LEA:
+        case X86_POP:
+        case X86_MOVD:
+            if (inst->opcode == X86_LEA) {
+                if (src->kind == OPERAND_MEMORY) add_use(effects, src->reg);
+            } else {
+                operand_uses(effects, src);
+            }
+            if (dst_register) {
+                if (dst->size < 4) add_use(effects, dst->reg);
+                add_def(effects, dst->reg);
+            } else {
+                operand_uses(effects, dst);
+            }
+            return;
+        case X86_CMP:
+        case X86_TEST:
+        case X86_PUSH:
+            operand_uses(effects, src);
+            operand_uses(effects, dst);
+            return;
+        case X86_SETCC:
+            // Its byte is always zero-extended before the value is read
+            if (dst_register) {
+                add_def(effects, dst->reg);
+            } else {
+                operand_uses(effects, dst);
+            }
+            return;
+        case X86_IDIV:
+        case X86_DIV:
+            add_use(effects, REG_RAX);
+            add_use(effects, REG_RDX);
+            operand_uses(effects, dst);
+            add_def(effects, REG_RAX);
+            add_def(effects, REG_RDX);
+            return;
+        case X86_MUL:
+            add_use(effects, REG_RAX);
+            operand_uses(effects, dst);
+            add_def(effects, REG_RAX);
+            add_def(effects, REG_RDX);
+            return;
+        case X86_CLTD:
+        case X86_CQTO:
+            add_use(effects, REG_RAX);
+            add_def(effects, REG_RDX);
+            return;
+        case X86_CALL:
+            for (int i = 0; i < src->value && i < 6; i++) add_use(effects, argument_registers[i]);
+            operand_uses(effects, dst);
+            for (int i = 0; i < 9; i++) add_def(effects, caller_saved[i]);
+            return;
+        case X86_JMP:
+            for (int i = 0; minst_is_tail_call(inst) && i < src->value && i < 6; i++) {
+                add_use(effects, argument_registers[i]);
+            }
+            return;
+        case X86_JCC:
+        case X86_LEAVE:
+        case X86_RET:
+            return;
+        default:
+            // Read-modify-write arithmetic, shifts, unary operators and cmov,
+            // which keeps its destination when the condition fails
+            operand_uses(effects, src);
+            operand_uses(effects, dst);
+            if (dst_register) add_def(effects, dst->reg);
+            return;
+    }
+}
+
+bool minst_is_jump(const MInst* inst) {
+    return (inst->opcode == X86_JMP || inst->opcode == X86_JCC) && !minst_is_tail_call(inst);
+}
+
+bool minst_is_tail_call(const MInst* inst) {
+    return inst->opcode == X86_JMP && inst->dst.kind == OPERAND_SYMBOL;
+}
+
+bool minst_is_vector(const MInst* inst) {
+    return inst->opcode >= X86_MOVDQU;
+}
+
+bool minst_is_vex(const MInst* inst) {
+    switch (inst->opcode) {
+        case X86_VPBROADCASTD: case X86_VEXTRACTI128: case X86_VZEROUPPER:
+            return true;
+        default:
+            return (inst->src.kind == OPERAND_VECTOR && inst->src.size == 32) ||
+                   (inst->dst.kind == OPERAND_VECTOR && inst->dst.size == 32);
+    }
+}
+
+bool minst_is_vex_rmw(const MInst* inst) {
+    switch (inst->opcode) {
+        case X86_MOVDQU: case X86_MOVDQA: case X86_MOVD: case X86_VPBROADCASTD: case X86_VEXTRACTI128:
+        case X86_VZEROUPPER:
+            return false;
+        default:
+            return minst_is_vector(inst) && minst_is_vex(inst);
+    }
+}
+
+// Emitter
+static bool emitter_reserve(Emitter* out, size_t size) {
+    if (out->length + size <= out->capacity) return true;
+    if (out->fixed) return false;
+    size_t capacity = out->capacity ? out->capacity : 65536;
+    while (capacity < out->length + size) capacity *= 2;
+    out->data = realloc(out->data, capacity);
+    out->capacity = capacity;
+    return true;
+}
+
+void emitter_write(Emitter* out, const char* data, size_t length) {
+    if (length == 0) return;
+    if (!emitter_reserve(out, length)) length = out->capacity - out->length;
+    memcpy(out->data + out->length, data, length);
+    out->length += length;
+}
+
+void emitter_char(Emitter* out, char c) {
+    if (emitter_reserve(out, 1)) out->data[out->length++] = c;
+}
+
+void emitter_integer(Emitter* out, long long value) {
+    char digits[24];
+    int count = 0;
+    unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    do {
+        digits[sizeof(digits) - 1 - count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0) digits[sizeof(digits) - 1 - count++] = '-';
+    emitter_write(out, digits + sizeof(digits) - count, count);
+}
+
+static void emit_text(Emitter* out, const char* text) {
+    emitter_write(out, text, strlen(text));
+}
+
+static void emit_register(Emitter* out, int reg, int size) {
+    int column = size == 1 ? 0 : size == 2 ? 1 : size == 4 ? 2 : 3;
+    emitter_char(out, '%');
+    if (reg >= VREG_BASE) {
+        // Only seen when dumping code before register allocation
+        emitter_char(out, 'v');
+        emitter_integer(out, reg - VREG_BASE);
+        emitter_char(out, "bwdq"[column]);
+        return;
+    }
+    emit_text(out, register_names[column][reg]);
+}
+
+static void emit_vector_register(Emitter* out, int reg, int size) {
+    emit_text(out, size == 32 ? "%ymm" : "%xmm");
+    emitter_integer(out, reg);
+}
+
+static char size_suffix(int size) {
+    return size == 1 ? 'b' : size == 2 ? 'w' : size == 4 ? 'l' : 'q';
+}
+
+// .L<owner>.<label> or .L<owner>.str<index>
+static void emit_local_name(Emitter* out, const Operand* operand) {
+    emit_text(out, ".L");
+    emit_text(out, operand->symbol);
+    if (operand->kind == OPERAND_STRING) {
+        emit_text(out, ".str");
+        emitter_integer(out, operand->value);
+    } else if (operand->value == LABEL_RETURN) {
+        emit_text(out, ".return");
+    } else {
+        emitter_char(out, '.');
+        emitter_integer(out, operand->value);
+    }
+}
+
+static void emit_operand(Emitter* out, const Operand* operand) {
+    switch (operand->kind) {
+        case OPERAND_REGISTER:
+            emit_register(out, operand->reg, operand->size);
+            break;
+        case OPERAND_IMMEDIATE:
+            emitter_char(out, '$');
+            emitter_integer(out, operand->value);
+            break;
+        case OPERAND_MEMORY:
+            if (operand->value != 0) emitter_integer(out, operand->value);
+            emitter_char(out, '(');
+            emit_register(out, operand->reg, 8);
+            emitter_char(out, ')');
+            break;
+        case OPERAND_SYMBOL:
+            emit_text(out, operand->symbol);
+            emit_text(out, "(%rip)");
+            break;
+        case OPERAND_STRING:
+            emit_local_name(out, operand);
+            emit_text(out, "(%rip)");
+            break;
+        case OPERAND_LABEL:
+            emit_local_name(out, operand);
+            break;
+        case OPERAND_VECTOR:
+            emit_vector_register(out, operand->reg, operand->size);
+            break;
+        default:
+            break;
+    }
+}
+
+static const char* mnemonic(X86Opcode opcode) {
+    switch (opcode) {
+        case X86_MOV: return "mov";
+        case X86_LEA: return "lea";
+        case X86_ADD: return "add";
+        case X86_SUB: return "sub";
+        case X86_IMUL: return "imul";
+        case X86_AND: return "and";
+        case X86_OR: return "or";
+        case X86_XOR: return "xor";
+        case X86_CMP: return "cmp";
+        case X86_TEST: return "test";
+        case X86_NEG: return "neg";
+        case X86_NOT: return "not";
+        case X86_SHL: return "shl";
+        case X86_SHR: return "shr";
+        case X86_SAR: return "sar";
+        case X86_IDIV: return "idiv";
+        case X86_DIV: return "div";
+        case X86_MUL: return "mul";
+        case X86_PUSH: return "push";
+        case X86_POP: return "pop";
+        case X86_MOVDQU: return "movdqu";
+        case X86_MOVDQA: return "movdqa";
+        case X86_MOVD: return "movd";
+        case X86_PADDD: return "paddd";
+        case X86_PSUBD: return "psubd";
+        case X86_PMULLD: return "pmulld";
+        case X86_PMULUDQ: return "pmuludq";
+        case X86_PAND: return "pand";
+        case X86_POR: return "por";
+        case X86_PXOR: return "pxor";
+        case X86_PCMPEQD: return "pcmpeqd";
+        case X86_PSLLD: return "pslld";
+        case X86_PSRLD: return "psrld";
+        case X86_PSRAD: return "psrad";
+        case X86_PSLLQ: return "psllq";
+        case X86_PSRLQ: return "psrlq";
+        case X86_PSRLDQ: return "psrldq";
+        case X86_PUNPCKLDQ: return "punpckldq";
+        case X86_PUNPCKLQDQ: return "punpcklqdq";
+        case X86_VPBROADCASTD: return "vpbroadcastd";
+        case X86_VEXTRACTI128: return "vextracti128";
+        case X86_VZEROUPPER: return "vzeroupper";
+        default: return "";
+    }
+}
+
+// Vector instructions: AVX forms take a `v`, and those whose destination
+// is also a source name it twice. vmovd moves the low lane only.
+static void print_vector_instruction(const MInst* inst, Emitter* out) {
+    emit_text(out, "    ");
+    const char* name = mnemonic(inst->opcode);
+    if (minst_is_vex(inst) && name[0] != 'v') emitter_char(out, 'v');
+    emit_text(out, name);
+    if (inst->opcode == X86_VZEROUPPER) {
+        emitter_char(out, '\n');
+        return;
+    }
+    emitter_char(out, ' ');
+    Operand src = inst->src;
+    Operand dst = inst->dst;
+    if (inst->opcode == X86_MOVD) {
+        if (src.kind == OPERAND_VECTOR) src.size = 16;
+        if (dst.kind == OPERAND_VECTOR) dst.size = 16;
+    }
+    if (inst->opcode == X86_VEXTRACTI128) emit_text(out, "$1, ");
+    emit_operand(out, &src);
+    emit_text(out, ", ");
+    if (minst_is_vex_rmw(inst)) {
+        emit_operand(out, &dst);
+        emit_text(out, ", ");
+    }
+    emit_operand(out, &dst);
+    emitter_char(out, '\n');
+}
+
+static void print_instruction(const MInst* inst, Emitter* out) {
+    if (minst_is_vector(inst)) {
+        print_vector_instruction(inst, out);
+        return;
+    }
+    emit_text(out, "    ");
+    switch (inst->opcode) {
+        case X86_MOVABS:
+            emit_text(out, "movabsq ");
+            break;
+        case X86_MOVSX:
+        case X86_MOVZX:
+            emit_text(out, inst->opcode == X86_MOVSX ? "movs" : "movz");
+            emitter_char(out, size_suffix(inst->src.size));
+            emitter_char(out, size_suffix(inst->dst.size));
+            emitter_char(out, ' ');
+            break;
+        case X86_CLTD:
+            emit_text(out, "cltd\n");
+            return;
+        case X86_CQTO:
+            emit_text(out, "cqto\n");
+            return;
+        case X86_LEAVE:
+            emit_text(out, "leave\n");
+            return;
+        case X86_RET:
+            emit_text(out, "ret\n");
+            return;
+        case X86_SETCC:
+        case X86_CMOV:
+        case X86_JCC:
+            emit_text(out, inst->opcode == X86_SETCC ? "set" : inst->opcode == X86_CMOV ? "cmov" : "j");
+            emit_text(out, condition_names[inst->cond]);
+            emitter_char(out, ' ');
+            break;
+        case X86_JMP:
+        case X86_CALL:
+            emit_text(out, inst->opcode == X86_JMP ? "jmp " : "call ");
+            if (inst->opcode == X86_JMP && inst->dst.kind == OPERAND_LABEL) {
+                emit_operand(out, &inst->dst);
+                emitter_char(out, '\n');
+            } else if (inst->dst.kind == OPERAND_SYMBOL) {
+                emit_text(out, inst->dst.symbol);
+                emit_text(out, "@PLT\n");
+            } else {
+                emitter_char(out, '*');
+                emit_operand(out, &inst->dst);
+                emitter_char(out, '\n');
+            }
+            return;
+        default:
+            emit_text(out, mnemonic(inst->opcode));
+            emitter_char(out, size_suffix(minst_size(inst)));
+            emitter_char(out, ' ');
+            break;
+    }
+
+    if (inst->src.kind != OPERAND_NONE) {
+        emit_operand(out, &inst->src);
+        emit_text(out, ", ");
+    }
+    emit_operand(out, &inst->dst);
+    emitter_char(out, '\n');
+}
+
+static void print_directive(Emitter* out, const char* directive, const char* name) {
+    emit_text(out, "    ");
+    emit_text(out, directive);
+    if (name != NULL) emit_text(out, name);
+}
+
+static void print_string(Emitter* out, const char* text) {
+    emit_text(out, "    .string \"");
+    for (const unsigned char* c = (const unsigned char*)text; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            emitter_char(out, '\\');
+            emitter_char(out, *c);
+        } else if (*c >= 32 && *c < 127) {
+            emitter_char(out, *c);
+        } else {
+            char escape[4] = {'\\', '0' + (*c >> 6), '0' + ((*c >> 3) & 7), '0' + (*c & 7)};
+            emitter_write(out, escape, 4);
+        }
+    }
+    emit_text(out, "\"\n");
+}
+
+static const char* section_directives[SECTION_COUNT] = {
+    ".text", ".data", ".bss", ".section .rodata", ".section .note.GNU-stack,\"\",@progbits"
+};
+
+void asm_print(const AsmList* list, Emitter* out) {
+    for (int i = 0; i < list->count; i++) {
+        const AsmItem* item = &list->items[i];
+        switch (item->kind) {
+            case ITEM_INSTRUCTION:
+                print_instruction(&item->inst, out);
+                continue;
+            case ITEM_LABEL:
+                emit_local_name(out, &item->operand);
+                emitter_char(out, ':');
+                break;
+            case ITEM_SYMBOL:
+                emit_text(out, item->name);
+                emitter_char(out, ':');
+                break;
+            case ITEM_SECTION:
+                print_directive(out, section_directives[item->value], NULL);
+                break;
+            case ITEM_GLOBAL:
+                print_directive(out, ".globl ", item->name);
+                break;
+            case ITEM_TYPE:
+                print_directive(out, ".type ", item->name);
+                emit_text(out, item->value ? ", @function" : ", @object");
+                break;
+            case ITEM_SIZE:
+                print_directive(out, ".size ", item->name);
+                emit_text(out, ", ");
+                if (item->value < 0) {
+                    emit_text(out, ".-");
+                    emit_text(out, item->name);
+                } else {
+                    emitter_integer(out, item->value);
+                }
+                break;
+            case ITEM_ALIGN:
+                print_directive(out, ".align ", NULL);
+                emitter_integer(out, item->value);
+                break;
+            case ITEM_ZERO:
+                print_directive(out, ".zero ", NULL);
+                emitter_integer(out, item->value);
+                break;
+            case ITEM_DATA:
+                print_directive(out, item->size == 1 ? ".byte " : item->size == 2 ? ".short " :
+                                     item->size == 4 ? ".long " : ".quad ", NULL);
+                if (item->operand.kind == OPERAND_STRING) {
+                    emit_local_name(out, &item->operand);
+                } else {
+                    emitter_integer(out, item->value);
+                }
+                break;
+            case ITEM_STRING:
+                print_string(out, item->name);
+                continue;
+        }
+        emitter_char(out, '\n');
+    }
+}
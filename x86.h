@@ -0,0 +1,164 @@
+#ifndef X86_H
+#define X86_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// x86-64 instructions and the assembly listing built from them. Code
+// generation produces an AsmList; it is then either printed as GNU
+// assembler text or encoded straight into an ELF object (elf.h).
+
+// General purpose registers, in encoding order
+typedef enum {
+    REG_RAX, REG_RCX, REG_RDX, REG_RBX, REG_RSP, REG_RBP, REG_RSI, REG_RDI,
+    REG_R8, REG_R9, REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15
+} RegisterName;
+
+// Registers numbered from VREG_BASE are virtual. Code generation uses as
+// many as it likes; register allocation maps them onto physical ones.
+#define VREG_BASE 16
+
+// Condition codes, in encoding order
+typedef enum {
+    COND_O, COND_NO, COND_B, COND_AE, COND_E, COND_NE, COND_BE, COND_A,
+    COND_S, COND_NS, COND_P, COND_NP, COND_L, COND_GE, COND_LE, COND_G
+} ConditionCode;
+
+typedef enum {
+    OPERAND_NONE,
+    OPERAND_REGISTER,    // reg
+    OPERAND_IMMEDIATE,   // $value
+    OPERAND_MEMORY,      // value(reg)
+    OPERAND_SYMBOL,      // symbol(%rip), or symbol@PLT as a call target
+    OPERAND_STRING,      // .L<symbol>.str<value>(%rip)
+    OPERAND_LABEL,       // .L<symbol>.<value>, or .L<symbol>.return
+    OPERAND_VECTOR       // %xmm<reg>, or %ymm<reg> when 32 bytes wide
+} OperandKind;
+
+#define LABEL_RETURN (-1)
+
+typedef struct {
+    OperandKind kind;
+    int size;            // Bytes accessed through a register or memory operand
+    int reg;             // Register, or the base of a memory operand
+    long long value;     // Immediate, displacement, string index or label number
+    const char* symbol;  // Symbol, or the function owning a label or string
+} Operand;
+
+typedef enum {
+    X86_MOV, X86_MOVABS, X86_MOVSX, X86_MOVZX, X86_LEA,
+    X86_ADD, X86_SUB, X86_IMUL, X86_AND, X86_OR, X86_XOR, X86_CMP, X86_TEST,
+    X86_NEG, X86_NOT, X86_SHL, X86_SHR, X86_SAR, X86_IDIV, X86_DIV, X86_MUL,
+    X86_CLTD, X86_CQTO, X86_SETCC, X86_CMOV, X86_PUSH, X86_POP,
+    X86_CALL, X86_JMP, X86_JCC, X86_LEAVE, X86_RET,
+    // Packed 32-bit lanes, on the SSE registers. With 32-byte operands
+    // they are the AVX2 forms, whose destination is also the first source.
+    X86_MOVDQU, X86_MOVDQA, X86_MOVD, X86_PADDD, X86_PSUBD, X86_PMULLD, X86_PMULUDQ,
+    X86_PAND, X86_POR, X86_PXOR, X86_PCMPEQD, X86_PSLLD, X86_PSRLD, X86_PSRAD,
+    X86_PSLLQ, X86_PSRLQ, X86_PSRLDQ, X86_PUNPCKLDQ, X86_PUNPCKLQDQ,
+    X86_VPBROADCASTD, X86_VEXTRACTI128, X86_VZEROUPPER
+} X86Opcode;
+
+// One instruction, operands in AT&T order. Single-operand instructions
+// use dst; the operation size is that of dst, or of src when dst has none.
+// A call's src is an immediate counting the argument registers it reads,
+// and so is that of a jmp to a symbol, which is a tail call.
+// vextracti128 always extracts the upper half of src.
+typedef struct {
+    X86Opcode opcode;
+    ConditionCode cond;  // setcc, cmov and jcc
+    Operand src;
+    Operand dst;
+} MInst;
+
+typedef enum {
+    SECTION_TEXT, SECTION_DATA, SECTION_BSS, SECTION_RODATA, SECTION_NOTE_GNU_STACK,
+    SECTION_COUNT
+} SectionKind;
+
+typedef enum {
+    ITEM_INSTRUCTION,
+    ITEM_LABEL,          // Definition of the label in `operand`
+    ITEM_SYMBOL,         // Definition of `name`
+    ITEM_SECTION,        // Switch to section `value`
+    ITEM_GLOBAL,         // .globl name
+    ITEM_TYPE,           // .type name, @function when value is 1, else @object
+    ITEM_SIZE,           // .size name, value; from the definition when value < 0
+    ITEM_ALIGN,          // .align value
+    ITEM_ZERO,           // .zero value
+    ITEM_DATA,           // `size`-byte value, or the address of `operand`
+    ITEM_STRING          // .string name, NUL-terminated
+} AsmItemKind;
+
+typedef struct {
+    AsmItemKind kind;
+    MInst inst;
+    Operand operand;
+    const char* name;    // Borrowed; must outlive the list's consumers
+    long long value;
+    int size;
+} AsmItem;
+
+typedef struct {
+    AsmItem* items;
+    int count;
+    int capacity;
+} AsmList;
+
+// Growable text buffer. A fixed buffer wraps caller storage and drops
+// what does not fit.
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+    bool fixed;
+} Emitter;
+
+void asm_list_init(AsmList* list);
+void asm_list_free(AsmList* list);
+AsmItem* asm_list_add(AsmList* list, AsmItemKind kind);
+void asm_list_append(AsmList* list, const AsmList* other);
+
+// Operand constructors
+Operand operand_register(int reg, int size);
+Operand operand_immediate(long long value);
+Operand operand_memory(int base, long long displacement, int size);
+Operand operand_symbol(const char* symbol, int size);
+Operand operand_string(const char* owner, int index);
+Operand operand_label(const char* owner, int label);
+Operand operand_vector(int reg, int size);
+
+// Operation size of an instruction in bytes
+int minst_size(const MInst* inst);
+
+// Registers an instruction reads and writes, including implicit ones such
+// as %rdx in division and everything a call clobbers. Writes narrower than
+// 32 bits keep the rest of the register and so count as reads too, except
+// for setcc, whose result is only ever read through a zero-extension.
+// The SSE registers are left out: instruction selection assigns them itself.
+typedef struct {
+    int uses[8];
+    int use_count;
+    int defs[12];
+    int def_count;
+} RegisterEffects;
+
+void minst_effects(const MInst* inst, RegisterEffects* effects);
+
+// Jumps to labels of the function, and jumps out of it to another one
+bool minst_is_jump(const MInst* inst);
+bool minst_is_tail_call(const MInst* inst);
+
+// Vector instructions, those of them in their AVX (VEX-encoded) form, and
+// of those the ones whose destination doubles as their first source
+bool minst_is_vector(const MInst* inst);
+bool minst_is_vex(const MInst* inst);
+bool minst_is_vex_rmw(const MInst* inst);
+
+// Text output, formatted by hand into one buffer
+void emitter_write(Emitter* out, const char* data, size_t length);
+void emitter_char(Emitter* out, char c);
+void emitter_integer(Emitter* out, long long value);
+void asm_print(const AsmList* list, Emitter* out);
+
+#endif // X86_H